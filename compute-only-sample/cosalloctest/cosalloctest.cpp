@@ -0,0 +1,183 @@
+#include <windows.h>
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+
+#include "CosUmd12AllocationIndex.h"
+
+// Benchmark for the allocation list lookup of CosUmd12CommandBuffer
+//
+// Records dispatches that bind 1..1024 distinct UAVs, every binding calls
+// UseAllocation() the way WriteHWDescriptor() does. A command buffer is
+// "submitted" (rewound) when the next dispatch would not fit its allocation
+// list. The linear search UseAllocation() used before and the hashed index
+// are run on the same handles, checked against each other and timed.
+
+static const UINT kAllocationListSizeLog2 = 11;
+static const UINT kAllocationListSize = 1 << kAllocationListSizeLog2;
+
+struct AllocationListEntry
+{
+	UINT m_hAllocation;
+	UINT m_writeOperation;
+};
+
+class LinearAllocationList
+{
+public:
+
+	void Reset() { m_numAllocations = 0; }
+
+	UINT UseAllocation(UINT hAllocation, UINT bWriteOperation)
+	{
+		UINT i;
+
+		for (i = 0; i < m_numAllocations; i++)
+		{
+			if (hAllocation == m_allocations[i].m_hAllocation)
+			{
+				m_allocations[i].m_writeOperation = bWriteOperation;
+				return i;
+			}
+		}
+
+		m_allocations[i].m_hAllocation = hAllocation;
+		m_allocations[i].m_writeOperation = bWriteOperation;
+		m_numAllocations++;
+
+		return i;
+	}
+
+	UINT GetNumAllocations() { return m_numAllocations; }
+
+private:
+
+	AllocationListEntry m_allocations[kAllocationListSize];
+	UINT m_numAllocations = 0;
+};
+
+class IndexedAllocationList
+{
+public:
+
+	void Reset()
+	{
+		m_numAllocations = 0;
+		m_index.Reset();
+	}
+
+	UINT UseAllocation(UINT hAllocation, UINT bWriteOperation)
+	{
+		UINT i = m_index.FindOrAdd(hAllocation, m_numAllocations);
+
+		if (i == m_numAllocations)
+		{
+			m_allocations[i].m_hAllocation = hAllocation;
+			m_numAllocations++;
+		}
+
+		m_allocations[i].m_writeOperation = bWriteOperation;
+
+		return i;
+	}
+
+	UINT GetNumAllocations() { return m_numAllocations; }
+
+private:
+
+	AllocationListEntry m_allocations[kAllocationListSize];
+	UINT m_numAllocations = 0;
+	CosUmd12AllocationIndex<kAllocationListSizeLog2 + 1> m_index;
+};
+
+//
+// Every dispatch binds numUavs allocations out of a pool of 4x as many
+// resources, so consecutive dispatches share some of their UAVs
+//
+
+static std::vector<UINT> MakeBindings(UINT numUavs, UINT numDispatches)
+{
+	std::vector<UINT> handles(4 * numUavs);
+	std::vector<UINT> bindings;
+
+	srand(numUavs);
+
+	for (UINT i = 0; i < handles.size(); i++)
+		handles[i] = 0x40000000 | (i * 0x40) | (rand() & 0x3f);
+
+	for (UINT d = 0; d < numDispatches; d++)
+	{
+		UINT first = (d * numUavs / 2) % handles.size();
+
+		for (UINT u = 0; u < numUavs; u++)
+			bindings.push_back(handles[(first + u) % handles.size()]);
+	}
+
+	return bindings;
+}
+
+template <typename TAllocationList>
+static double Record(TAllocationList * pList, const std::vector<UINT> & bindings, UINT numUavs, std::vector<UINT> * pIndices)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+
+	pList->Reset();
+
+	for (size_t b = 0; b < bindings.size(); b += numUavs)
+	{
+		if (pList->GetNumAllocations() + numUavs > kAllocationListSize)
+			pList->Reset();
+
+		for (UINT u = 0; u < numUavs; u++)
+			(*pIndices)[b + u] = pList->UseAllocation(bindings[b + u], u & 1);
+	}
+
+	auto end = std::chrono::high_resolution_clock::now();
+
+	return std::chrono::duration<double, std::nano>(end - start).count();
+}
+
+int main(int argc, char ** argv)
+{
+	UINT bindingsPerRun = (argc > 1) ? atoi(argv[1]) : 1 << 20;
+	bool passed = true;
+
+	printf("%-8s %14s %14s %8s\n", "uavs", "linear ns/use", "hashed ns/use", "speedup");
+
+	LinearAllocationList * pLinear = new LinearAllocationList();
+	IndexedAllocationList * pIndexed = new IndexedAllocationList();
+
+	for (UINT numUavs = 1; numUavs <= 1024; numUavs *= 2)
+	{
+		UINT numDispatches = bindingsPerRun / numUavs;
+		std::vector<UINT> bindings = MakeBindings(numUavs, numDispatches);
+		std::vector<UINT> linearIndices(bindings.size());
+		std::vector<UINT> indexedIndices(bindings.size());
+
+		double linearTime = Record(pLinear, bindings, numUavs, &linearIndices);
+		double indexedTime = Record(pIndexed, bindings, numUavs, &indexedIndices);
+
+		if (linearIndices != indexedIndices)
+		{
+			printf("%-8u allocation indices differ\n", numUavs);
+			passed = false;
+		}
+
+		printf("%-8u %14.2f %14.2f %7.1fx\n",
+			numUavs,
+			linearTime / bindings.size(),
+			indexedTime / bindings.size(),
+			linearTime / indexedTime);
+	}
+
+	delete pLinear;
+	delete pIndexed;
+
+	printf("%s\n", passed ? "all tests passed" : "TESTS FAILED");
+
+	return passed ? 0 : 1;
+}
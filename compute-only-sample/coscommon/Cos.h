@@ -35,8 +35,8 @@
 //
 // GPU Memory Model configuration
 //
-// COSD has only 1 engine, so COS_GPUVA_SUPPORT and COS_PHYSICAL_SUPPORT are 
-// mutually exclusive.
+// All COSD engine nodes use the same GPU Memory Model, so COS_GPUVA_SUPPORT
+// and COS_PHYSICAL_SUPPORT are mutually exclusive.
 //
 
 #define COS_GPUVA_SUPPORT       0
@@ -0,0 +1,228 @@
+#pragma once
+
+//
+// Scheduler for the compute core of the software adapter
+//
+// The compute nodes each drain their own DMA buffer queue on their own worker
+// thread, but there is a single dispatch engine (and set of root registers)
+// they all run on. A node requests the core before it runs a DMA buffer and
+// releases it after, so the core is handed over at DMA buffer boundaries and
+// a long queue on one node does not hold up the other nodes.
+//
+// With CosComputeSchedulingRoundRobin the waiting nodes get the core in turn,
+// starting after the node that released it. With CosComputeSchedulingPriority
+// the waiting node with the highest priority wins, ties are broken round
+// robin. A waiting node passed over kStarvationLimit times in a row wins ahead
+// of priority, so normal priority work still makes progress under a steady
+// stream of high priority DMA buffers.
+//
+// The scheduler only keeps the bookkeeping, the caller serializes the calls
+// and wakes the node returned by Release() before it drops its lock. Shared by
+// the KMD and the user mode test (cosschedtest).
+//
+
+enum CosComputeSchedulingPolicy
+{
+    CosComputeSchedulingRoundRobin,
+    CosComputeSchedulingPriority
+};
+
+struct CosComputeSchedulerStats
+{
+    UINT64  m_numGrants;
+    UINT64  m_numWaits;             // requests that did not get the core right away
+    UINT64  m_numCancels;
+    UINT64  m_numStarvationGrants;  // grants forced by kStarvationLimit
+};
+
+class CosComputeScheduler
+{
+public:
+
+    static const UINT   kMaxNodes = 8;
+    static const UINT   kNoNode = MAXUINT;
+    static const UINT   kStarvationLimit = 8;
+
+    void Initialize(UINT numNodes, CosComputeSchedulingPolicy policy)
+    {
+        NT_ASSERT(numNodes <= kMaxNodes);
+
+        m_numNodes = numNodes;
+        m_policy = policy;
+
+        m_owner = kNoNode;
+        m_lastOwner = numNodes - 1;
+
+        memset(m_waiters, 0, sizeof(m_waiters));
+        memset(&m_stats, 0, sizeof(m_stats));
+    }
+
+    //
+    // Returns true when the node got the core, otherwise the node waits until
+    // Release() returns it or it calls Cancel()
+    //
+
+    bool Request(UINT node, UINT priority)
+    {
+        NT_ASSERT(node < m_numNodes);
+        NT_ASSERT(node != m_owner);
+        NT_ASSERT(!m_waiters[node].m_bWaiting);
+
+        if (kNoNode == m_owner)
+        {
+            Grant(node);
+
+            return true;
+        }
+
+        m_waiters[node].m_bWaiting = true;
+        m_waiters[node].m_priority = priority;
+        m_waiters[node].m_numSkipped = 0;
+
+        m_stats.m_numWaits++;
+
+        return false;
+    }
+
+    //
+    // Withdraws the request of a waiting node. Returns false when the core was
+    // already handed to the node, it then owns it and must Release() it.
+    //
+
+    bool Cancel(UINT node)
+    {
+        NT_ASSERT(node < m_numNodes);
+
+        if (!m_waiters[node].m_bWaiting)
+        {
+            NT_ASSERT(node == m_owner);
+
+            return false;
+        }
+
+        m_waiters[node].m_bWaiting = false;
+
+        m_stats.m_numCancels++;
+
+        return true;
+    }
+
+    //
+    // Returns the node that gets the core next, kNoNode when none is waiting
+    //
+
+    UINT Release(UINT node)
+    {
+        NT_ASSERT(node == m_owner);
+
+        m_owner = kNoNode;
+
+        UINT next = PickNext();
+
+        if (kNoNode != next)
+        {
+            m_waiters[next].m_bWaiting = false;
+
+            Grant(next);
+        }
+
+        return next;
+    }
+
+    UINT GetOwner() const
+    {
+        return m_owner;
+    }
+
+    const CosComputeSchedulerStats & GetStats() const
+    {
+        return m_stats;
+    }
+
+private:
+
+    struct Waiter
+    {
+        bool    m_bWaiting;
+        UINT    m_priority;
+        UINT    m_numSkipped;
+    };
+
+    void Grant(UINT node)
+    {
+        m_owner = node;
+        m_lastOwner = node;
+
+        m_stats.m_numGrants++;
+    }
+
+    UINT PickNext()
+    {
+        UINT next = kNoNode;
+        bool bStarved = false;
+
+        //
+        // Nodes are visited round robin from the last owner, so the first
+        // one found wins ties
+        //
+
+        for (UINT i = 1; i <= m_numNodes; i++)
+        {
+            UINT node = (m_lastOwner + i) % m_numNodes;
+            Waiter * pWaiter = &m_waiters[node];
+
+            if (!pWaiter->m_bWaiting)
+            {
+                continue;
+            }
+
+            if (kNoNode == next)
+            {
+                next = node;
+                bStarved = (pWaiter->m_numSkipped >= kStarvationLimit);
+            }
+            else if ((CosComputeSchedulingPriority == m_policy) && !bStarved)
+            {
+                if (pWaiter->m_numSkipped >= kStarvationLimit)
+                {
+                    next = node;
+                    bStarved = true;
+                }
+                else if (pWaiter->m_priority > m_waiters[next].m_priority)
+                {
+                    next = node;
+                }
+            }
+        }
+
+        if (kNoNode == next)
+        {
+            return kNoNode;
+        }
+
+        for (UINT node = 0; node < m_numNodes; node++)
+        {
+            if (m_waiters[node].m_bWaiting && (node != next))
+            {
+                m_waiters[node].m_numSkipped++;
+            }
+        }
+
+        if (bStarved && (CosComputeSchedulingPriority == m_policy))
+        {
+            m_stats.m_numStarvationGrants++;
+        }
+
+        return next;
+    }
+
+    UINT                        m_numNodes;
+    CosComputeSchedulingPolicy  m_policy;
+
+    UINT                        m_owner;
+    UINT                        m_lastOwner;
+
+    Waiter                      m_waiters[kMaxNodes];
+
+    CosComputeSchedulerStats    m_stats;
+};
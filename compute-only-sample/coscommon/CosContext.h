@@ -1,12 +1,47 @@
 #pragma once
 
+//
+// Scheduling priority of a context on the compute core, paging buffers run
+// at CosContextPriorityPaging
+//
+
+enum CosContextPriority
+{
+    CosContextPriorityNormal,
+    CosContextPriorityHigh,
+    CosContextPriorityPaging
+};
+
 struct CosContextExchange
 {
-    int m_dummy;
+    UINT m_priority;
 };
 
 #define COS_COMMAND_BUFFER_SIZE    PAGE_SIZE
 
 const int C_COS_ALLOCATION_LIST_SIZE = 64;
+const int C_COS_ALLOCATION_LIST_SIZE_LOG2 = 6;
 const int C_COS_PATCH_LOCATION_LIST_SIZE = 128;
 
+//
+// Engine nodes. Compute queues are spread across the compute nodes, which
+// take turns on the compute core (see CosComputeScheduler). Copy queues get a
+// copy-only node of their own so uploads run alongside compute, paging stays
+// on the first compute node.
+//
+// The extra compute nodes and the copy node are only exposed in the Physical
+// GPU Memory Model, GPU VA command buffers share the MMU of the compute node.
+//
+
+const int C_COS_COMPUTE_NODE_ORDINAL = 0;
+
+#if COS_GPUVA_SUPPORT
+const int C_COS_COMPUTE_NODE_COUNT = 1;
+const int C_COS_NODE_COUNT = C_COS_COMPUTE_NODE_COUNT;
+#else
+const int C_COS_COMPUTE_NODE_COUNT = 2;
+const int C_COS_NODE_COUNT = C_COS_COMPUTE_NODE_COUNT + 1;
+#endif
+
+const int C_COS_COPY_NODE_ORDINAL = C_COS_COMPUTE_NODE_COUNT;
+
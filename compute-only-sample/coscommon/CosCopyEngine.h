@@ -0,0 +1,114 @@
+#pragma once
+
+//
+// Copy engine of the software adapter
+//
+// Runs the command buffers of the copy node. A copy node command buffer only
+// holds Header, Nop and ResourceCopy commands that stay within video memory.
+// The whole command buffer is validated before any copy runs, so a rejected
+// command buffer has no effect and the copy node never touches the compute
+// state of the adapter. That is what lets it run on its own worker thread
+// alongside the compute node.
+//
+// Command buffers, copies and bytes are counted in CosCopyEngineStats.
+//
+// Shared by the KMD and the user mode test (cosnodetest).
+//
+
+struct CosCopyEngineStats
+{
+    UINT64  m_numCommandBuffers;
+    UINT64  m_numRejected;
+    UINT64  m_numCopies;
+    UINT64  m_numBytes;
+};
+
+class CosCopyEngine
+{
+public:
+
+    void Initialize(BYTE * pVideoMemory, SIZE_T videoMemorySize)
+    {
+        m_pVideoMemory = pVideoMemory;
+        m_videoMemorySize = videoMemorySize;
+
+        memset(&m_stats, 0, sizeof(m_stats));
+    }
+
+    //
+    // Returns false, without running any of it, for a command buffer with a
+    // command the copy engine does not support
+    //
+
+    bool Execute(const GpuCommand * pGpuCommand, const GpuCommand * pEndOfCommand)
+    {
+        if (!Validate(pGpuCommand, pEndOfCommand))
+        {
+            m_stats.m_numRejected++;
+
+            return false;
+        }
+
+        for (; pGpuCommand < pEndOfCommand; pGpuCommand++)
+        {
+            if (ResourceCopy == pGpuCommand->m_commandId)
+            {
+                const GpuResourceCopy * pResourceCopy = &pGpuCommand->m_resourceCopy;
+
+                memmove(
+                    m_pVideoMemory + pResourceCopy->m_dstGpuAddress.QuadPart,
+                    m_pVideoMemory + pResourceCopy->m_srcGpuAddress.QuadPart,
+                    pResourceCopy->m_sizeBytes);
+
+                m_stats.m_numCopies++;
+                m_stats.m_numBytes += pResourceCopy->m_sizeBytes;
+            }
+        }
+
+        m_stats.m_numCommandBuffers++;
+
+        return true;
+    }
+
+    const CosCopyEngineStats & GetStats()
+    {
+        return m_stats;
+    }
+
+private:
+
+    bool IsInVideoMemory(LONGLONG gpuAddress, UINT size)
+    {
+        return ((UINT64)gpuAddress <= m_videoMemorySize) &&
+               (size <= m_videoMemorySize - (UINT64)gpuAddress);
+    }
+
+    bool Validate(const GpuCommand * pGpuCommand, const GpuCommand * pEndOfCommand)
+    {
+        for (; pGpuCommand < pEndOfCommand; pGpuCommand++)
+        {
+            switch (pGpuCommand->m_commandId)
+            {
+            case Header:
+            case Nop:
+                break;
+            case ResourceCopy:
+                if (!IsInVideoMemory(pGpuCommand->m_resourceCopy.m_dstGpuAddress.QuadPart, pGpuCommand->m_resourceCopy.m_sizeBytes) ||
+                    !IsInVideoMemory(pGpuCommand->m_resourceCopy.m_srcGpuAddress.QuadPart, pGpuCommand->m_resourceCopy.m_sizeBytes))
+                {
+                    return false;
+                }
+                break;
+            default:
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    BYTE *              m_pVideoMemory;
+    SIZE_T              m_videoMemorySize;
+
+    CosCopyEngineStats  m_stats;
+};
@@ -0,0 +1,105 @@
+#pragma once
+
+//
+// Resumption of a DMA buffer preempted in the middle of a dispatch
+//
+// The dispatch that sees the Preemption request stops claiming thread groups
+// and EndDispatch() records its offset and the first thread group that did
+// not run in the DMA buffer private data. The VidSch resubmits the DMA buffer from the
+// start, so the resubmission runs every command again: the ones setting up
+// state (root signature, shader images) take effect, the dispatches and meta
+// commands before the preempted dispatch already ran and are skipped, and the
+// preempted dispatch resumes at the saved thread group.
+//
+// Shared by the KMD software adapter and the user mode test (cosreplaytest).
+//
+
+class CosDispatchReplay
+{
+public:
+
+    //
+    // pResumeOffset and pResumeThreadGroup are kept in the DMA buffer private
+    // data, a resume offset of 0 means the DMA buffer was not preempted (the
+    // Header comes first). The saved position is consumed here.
+    //
+
+    void Begin(
+        UINT *  pResumeOffset,
+        UINT *  pResumeThreadGroup)
+    {
+        m_pResumeOffset = pResumeOffset;
+        m_pResumeThreadGroup = pResumeThreadGroup;
+
+        m_resumeOffset = *pResumeOffset;
+        m_resumeThreadGroup = m_resumeOffset ? *pResumeThreadGroup : 0;
+
+        *pResumeOffset = 0;
+    }
+
+    //
+    // True while the commands before the preempted dispatch are run again,
+    // only commands setting up state take effect
+    //
+
+    bool IsReplaying() const
+    {
+        return (0 != m_resumeOffset);
+    }
+
+    //
+    // Returns false when the dispatch at commandOffset already ran and is
+    // skipped, otherwise the thread group to start the dispatch from
+    //
+
+    bool BeginDispatch(
+        UINT    commandOffset,
+        UINT *  pFirstThreadGroup)
+    {
+        *pFirstThreadGroup = 0;
+
+        if (m_resumeOffset)
+        {
+            if (commandOffset < m_resumeOffset)
+            {
+                return false;
+            }
+
+            NT_ASSERT(commandOffset == m_resumeOffset);
+
+            *pFirstThreadGroup = m_resumeThreadGroup;
+            m_resumeOffset = 0;
+        }
+
+        return true;
+    }
+
+    //
+    // Returns true when the dispatch was preempted before nextThreadGroup, the
+    // rest of the DMA buffer is then left for the resubmission
+    //
+
+    bool EndDispatch(
+        UINT    commandOffset,
+        UINT    nextThreadGroup,
+        UINT    numThreadGroups)
+    {
+        if (nextThreadGroup >= numThreadGroups)
+        {
+            return false;
+        }
+
+        *m_pResumeOffset = commandOffset;
+        *m_pResumeThreadGroup = nextThreadGroup;
+
+        return true;
+    }
+
+private:
+
+    UINT *  m_pResumeOffset;
+    UINT *  m_pResumeThreadGroup;
+
+    UINT    m_resumeOffset;
+    UINT    m_resumeThreadGroup;
+};
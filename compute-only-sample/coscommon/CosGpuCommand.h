@@ -23,11 +23,13 @@ enum GpuCommandId
     ResourceCopy,
     Header = 'CSCB',
     RootSignatureSet = 'RTSS',
+    RootSignatureUpdate = 'RTSU',
     ComputeShaderDispatch = 'CSDP',
     QwordWrite = 'QWWT',
     DescriptorHeapSet = 'DHST',
     RootSignature2LevelSet = 'RS2S',
-    MetaCommandExecute = 'MCEX'
+    MetaCommandExecute = 'MCEX',
+    ShaderImageLoad = 'SHLD'
 };
 
 struct GpuCommandBufferHeader
@@ -146,6 +148,52 @@ struct GpuHWRootSignatureSet
     //
 };
 
+//
+// Register limits of root signatures that can be changed with RootSignatureUpdate
+//
+
+#define COS_MAX_HW_CBV_REGISTERS    14
+#define COS_MAX_HW_SRV_REGISTERS    128
+#define COS_MAX_HW_UAV_REGISTERS    64
+
+enum GpuHWRegisterType
+{
+    COS_HW_CBV_REGISTER,
+    COS_HW_SRV_REGISTER,
+    COS_HW_UAV_REGISTER
+};
+
+struct GpuHWRegisterRange
+{
+    GpuHWRegisterType   m_registerType;
+    UINT                m_firstRegister;
+    UINT                m_numRegisters;
+    UINT                m_reserved;
+
+    //
+    // Followed by m_numRegisters of GpuHWConstantDescriptor (Cbv) or GpuHWDescriptor (Srv, Uav)
+    //
+};
+
+//
+// Rewrites registers set by the last RootSignatureSet in the same command
+// buffer, sent instead of a RootSignatureSet when only some root parameters
+// changed
+//
+
+struct GpuHWRootSignatureUpdate
+{
+    GpuCommandId    m_commandId;
+    UINT            m_commandSize;
+
+    UINT            m_numRanges;
+    UINT            m_reserved;
+
+    //
+    // Followed by m_numRanges of GpuHWRegisterRange
+    //
+};
+
 #endif  // COS_RS_2LEVEL_SUPPORT
 
 struct GpuHwComputeShaderDisptch
@@ -162,7 +210,44 @@ struct GpuHwComputeShaderDisptch
     BYTE            m_ShaderHash[16];
 
     //
-    // Followed by shader binary code
+    // The shader image is made resident by a preceding ShaderImageLoad with
+    // the same hash, it is not repeated in every dispatch. In the GPU VA
+    // configuration the dispatch is followed by the GpuHwUavBinding of u0 on,
+    // m_commandSize covers them.
+    //
+};
+
+#if COS_GPUVA_SUPPORT
+
+//
+// UAV bound to a register of a GPU VA dispatch, resolved by the UMD from the
+// Root Signature and the descriptor heap. m_gpuVa of 0 leaves the register
+// unbound.
+//
+
+#define COS_MAX_HW_UAV_BINDINGS     4
+
+struct GpuHwUavBinding
+{
+    PHYSICAL_ADDRESS    m_gpuVa;
+    UINT                m_sizeBytes;
+    UINT                m_elementSize;
+};
+
+#endif
+
+struct GpuHwShaderImageLoad
+{
+    GpuCommandId    m_commandId;
+    UINT            m_commandSize;
+
+    BYTE            m_ShaderHash[16];
+
+    //
+    // Followed by shader binary code (VpuImageHeader)
+    //
+    // UMD emits it once per command buffer for each shader used, KMD skips
+    // loading when the image is already resident
     //
 };
 
@@ -180,7 +265,17 @@ enum MetaCommandId
     MetaCommandReduction        = 107,
     MetaCommandRNN              = 108,
     MetaCommandRoiPooling       = 109,
-    MetaCommandCopyTensor       = 110
+    MetaCommandCopyTensor       = 110,
+
+    //
+    // Fused by the UMD at command list Close: a Convolution or GEMM packet
+    // directly followed by the Normalization packet that consumes its output.
+    // The first packet's m_commandSize covers both, the second one is left
+    // intact.
+    //
+
+    MetaCommandConvolutionNormalization = 111,
+    MetaCommandGEMMNormalization        = 112
 #endif
 };
 
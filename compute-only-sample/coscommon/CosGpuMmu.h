@@ -0,0 +1,376 @@
+#pragma once
+
+//
+// Software GPU MMU for the GPU VA configuration
+//
+// Translates GPU virtual addresses by walking the DXGK_PTE page tables the OS
+// maintains through DXGK_OPERATION_UPDATE_PAGE_TABLE. Every level indexes
+// kCosGpuMmuIndexBits of the virtual page number and the last level maps 4KB
+// pages, so the two levels cover the 32 bit GPU VA space.
+//
+// Translations are cached in a set-associative TLB together with the CPU
+// mapping of the page, a hit costs a tag compare. The TLB is invalidated by
+// FlushTlb() (DXGK_OPERATION_FLUSH_TLB) and when the root page table changes.
+// Hits, misses (page walks), faults and flushes are counted in
+// CosGpuMmuStats.
+//
+// Page tables and pages are reached through CosGpuMmuMemory, which the KMD
+// implements over physical memory and the user mode test (cosmmutest) over
+// simulated memory.
+//
+
+#define kCosGpuMmuPageShift     12
+#define kCosGpuMmuPageSize      (1 << kCosGpuMmuPageShift)
+#define kCosGpuMmuIndexBits     10
+#define kCosGpuMmuLevelCount    2
+
+class CosGpuMmuMemory
+{
+public:
+
+    //
+    // CPU address of the page table starting at the physical page, NULL when
+    // no page table is known there
+    //
+
+    virtual DXGK_PTE * GetPageTable(UINT64 pageTablePage) = 0;
+
+    //
+    // Maps a physical page of the segment for CPU access, NULL on failure.
+    // *phMapping is passed back to UnmapPage().
+    //
+
+    virtual BYTE * MapPage(UINT segmentId, UINT64 page, void ** phMapping) = 0;
+    virtual void UnmapPage(BYTE * pCpuPage, void * hMapping) = 0;
+};
+
+struct CosGpuMmuStats
+{
+    UINT64  m_numTlbHits;
+    UINT64  m_numTlbMisses;
+    UINT64  m_numFaults;
+    UINT64  m_numFlushes;
+};
+
+class CosGpuMmu
+{
+public:
+
+    static const UINT kTlbSets = 64;
+    static const UINT kTlbWays = 4;
+
+    void Initialize(CosGpuMmuMemory * pMemory)
+    {
+        m_pMemory = pMemory;
+        m_rootPageTable = 0;
+        m_numRootEntries = 0;
+        m_useCounter = 0;
+
+        memset(m_tlb, 0, sizeof(m_tlb));
+        memset(&m_stats, 0, sizeof(m_stats));
+    }
+
+    //
+    // Address space of the following translations, the TLB is not tagged
+    // with the address space so switching flushes it
+    //
+
+    void SetRootPageTable(UINT64 rootPageTablePage, UINT numRootEntries)
+    {
+        if ((rootPageTablePage != m_rootPageTable) || (numRootEntries != m_numRootEntries))
+        {
+            FlushTlb();
+
+            m_rootPageTable = rootPageTablePage;
+            m_numRootEntries = numRootEntries;
+        }
+    }
+
+    void FlushTlb()
+    {
+        for (UINT i = 0; i < kTlbSets*kTlbWays; i++)
+        {
+            InvalidateEntry(&m_tlb[i]);
+        }
+
+        m_stats.m_numFlushes++;
+    }
+
+    //
+    // Returns the CPU address of gpuVa, NULL on a translation fault.
+    // *pBytesInPage receives the number of bytes up to the end of the page.
+    //
+
+    BYTE * Translate(UINT64 gpuVa, bool bWrite, UINT * pBytesInPage)
+    {
+        UINT64 virtualPage = gpuVa >> kCosGpuMmuPageShift;
+        UINT pageOffset = (UINT)(gpuVa & (kCosGpuMmuPageSize - 1));
+
+        TlbEntry * pSet = &m_tlb[(virtualPage & (kTlbSets - 1))*kTlbWays];
+        TlbEntry * pEntry = NULL;
+
+        for (UINT i = 0; i < kTlbWays; i++)
+        {
+            if (pSet[i].m_pCpuPage && (pSet[i].m_virtualPage == virtualPage))
+            {
+                pEntry = &pSet[i];
+                break;
+            }
+        }
+
+        if (pEntry)
+        {
+            m_stats.m_numTlbHits++;
+        }
+        else
+        {
+            m_stats.m_numTlbMisses++;
+
+            pEntry = FillEntry(pSet, virtualPage);
+        }
+
+        if ((NULL == pEntry) || (bWrite && pEntry->m_bReadOnly))
+        {
+            m_stats.m_numFaults++;
+
+            return NULL;
+        }
+
+        pEntry->m_lastUse = ++m_useCounter;
+
+        *pBytesInPage = kCosGpuMmuPageSize - pageOffset;
+
+        return pEntry->m_pCpuPage + pageOffset;
+    }
+
+    bool Read(UINT64 gpuVa, void * pDst, SIZE_T size)
+    {
+        BYTE * pDstBytes = (BYTE *)pDst;
+
+        while (size)
+        {
+            UINT bytesInPage;
+            BYTE * pSrc = Translate(gpuVa, false, &bytesInPage);
+
+            if (NULL == pSrc)
+            {
+                return false;
+            }
+
+            SIZE_T chunk = (size < bytesInPage) ? size : bytesInPage;
+
+            memcpy(pDstBytes, pSrc, chunk);
+
+            pDstBytes += chunk;
+            gpuVa += chunk;
+            size -= chunk;
+        }
+
+        return true;
+    }
+
+    bool Write(UINT64 gpuVa, const void * pSrc, SIZE_T size)
+    {
+        const BYTE * pSrcBytes = (const BYTE *)pSrc;
+
+        while (size)
+        {
+            UINT bytesInPage;
+            BYTE * pDst = Translate(gpuVa, true, &bytesInPage);
+
+            if (NULL == pDst)
+            {
+                return false;
+            }
+
+            SIZE_T chunk = (size < bytesInPage) ? size : bytesInPage;
+
+            memcpy(pDst, pSrcBytes, chunk);
+
+            pSrcBytes += chunk;
+            gpuVa += chunk;
+            size -= chunk;
+        }
+
+        return true;
+    }
+
+    //
+    // Copies in chunks that stay within one source and one destination page
+    //
+
+    bool Copy(UINT64 dstGpuVa, UINT64 srcGpuVa, SIZE_T size)
+    {
+        while (size)
+        {
+            UINT srcBytesInPage, dstBytesInPage;
+            BYTE * pSrc = Translate(srcGpuVa, false, &srcBytesInPage);
+            BYTE * pDst = Translate(dstGpuVa, true, &dstBytesInPage);
+
+            if ((NULL == pSrc) || (NULL == pDst))
+            {
+                return false;
+            }
+
+            SIZE_T chunk = (srcBytesInPage < dstBytesInPage) ? srcBytesInPage : dstBytesInPage;
+
+            if (size < chunk)
+            {
+                chunk = size;
+            }
+
+            memmove(pDst, pSrc, chunk);
+
+            srcGpuVa += chunk;
+            dstGpuVa += chunk;
+            size -= chunk;
+        }
+
+        return true;
+    }
+
+    const CosGpuMmuStats & GetStats()
+    {
+        return m_stats;
+    }
+
+    void ResetStats()
+    {
+        memset(&m_stats, 0, sizeof(m_stats));
+    }
+
+private:
+
+    struct TlbEntry
+    {
+        UINT64  m_virtualPage;
+        UINT64  m_lastUse;
+        BYTE *  m_pCpuPage;         // NULL for an invalid entry
+        void *  m_hMapping;
+        bool    m_bReadOnly;
+    };
+
+    void InvalidateEntry(TlbEntry * pEntry)
+    {
+        if (pEntry->m_pCpuPage)
+        {
+            m_pMemory->UnmapPage(pEntry->m_pCpuPage, pEntry->m_hMapping);
+
+            pEntry->m_pCpuPage = NULL;
+        }
+    }
+
+    bool WalkPageTables(UINT64 virtualPage, DXGK_PTE * pLeafPte)
+    {
+        UINT64 pageTable = m_rootPageTable;
+        UINT64 numEntries = m_numRootEntries;
+
+        for (UINT level = 0; level < kCosGpuMmuLevelCount; level++)
+        {
+            UINT shift = (kCosGpuMmuLevelCount - 1 - level)*kCosGpuMmuIndexBits;
+            UINT64 index = virtualPage >> shift;
+
+            if (level)
+            {
+                index &= (1 << kCosGpuMmuIndexBits) - 1;
+            }
+
+            if (index >= numEntries)
+            {
+                return false;
+            }
+
+            DXGK_PTE * pPageTable = m_pMemory->GetPageTable(pageTable);
+
+            if (NULL == pPageTable)
+            {
+                return false;
+            }
+
+            DXGK_PTE pte = pPageTable[index];
+
+            if (!pte.Valid)
+            {
+                return false;
+            }
+
+            if (level == (kCosGpuMmuLevelCount - 1))
+            {
+                *pLeafPte = pte;
+
+                return true;
+            }
+
+            //
+            // Large pages are not reported in DXGK_GPUMMUCAPS
+            //
+
+            if (pte.LargePage)
+            {
+                return false;
+            }
+
+            pageTable = pte.PageTableAddress;
+            numEntries = 1 << kCosGpuMmuIndexBits;
+        }
+
+        return false;
+    }
+
+    TlbEntry * FillEntry(TlbEntry * pSet, UINT64 virtualPage)
+    {
+        DXGK_PTE pte;
+
+        if (!WalkPageTables(virtualPage, &pte))
+        {
+            return NULL;
+        }
+
+        //
+        // Replace an invalid way if there is one, the least recently used otherwise
+        //
+
+        TlbEntry * pVictim = &pSet[0];
+
+        for (UINT i = 0; i < kTlbWays; i++)
+        {
+            if (NULL == pSet[i].m_pCpuPage)
+            {
+                pVictim = &pSet[i];
+                break;
+            }
+
+            if (pSet[i].m_lastUse < pVictim->m_lastUse)
+            {
+                pVictim = &pSet[i];
+            }
+        }
+
+        InvalidateEntry(pVictim);
+
+        void * hMapping = NULL;
+        BYTE * pCpuPage = m_pMemory->MapPage((UINT)pte.Segment, pte.PageAddress, &hMapping);
+
+        if (NULL == pCpuPage)
+        {
+            return NULL;
+        }
+
+        pVictim->m_virtualPage = virtualPage;
+        pVictim->m_pCpuPage = pCpuPage;
+        pVictim->m_hMapping = hMapping;
+        pVictim->m_bReadOnly = pte.ReadOnly ? true : false;
+
+        return pVictim;
+    }
+
+    CosGpuMmuMemory *   m_pMemory;
+
+    UINT64              m_rootPageTable;
+    UINT64              m_numRootEntries;
+
+    UINT64              m_useCounter;
+    TlbEntry            m_tlb[kTlbSets*kTlbWays];
+
+    CosGpuMmuStats      m_stats;
+};
@@ -0,0 +1,310 @@
+#pragma once
+
+//
+// GPU VA command buffer engine of the software adapter
+//
+// Runs the command buffers of the GPU VA configuration. Every address goes
+// through the software GPU MMU: the command buffer is fetched through its
+// GPU VA, copies and qword writes are translated page by page.
+//
+// Shader images come inline with ShaderImageLoad the same way as in the patch
+// location configuration. A ComputeShaderDispatch is followed by the UAV
+// bindings the UMD resolved from the Root Signature (GpuHwUavBinding). The
+// UAVs are read through the MMU into a contiguous staging area, the thread
+// groups run on the staged copies and the UAVs are written back through the
+// MMU afterwards, so dispatch traffic shows up in the TLB counters like any
+// other access. UAVs bound more than once in the same dispatch are not
+// supported, the last write back wins.
+//
+// Shader images are loaded and run by CosGpuVaShaderEngine, which the KMD
+// implements over CosKmDispatchEngine and the user mode test (cosmmutest)
+// with a reference shader.
+//
+
+class CosGpuVaShaderEngine
+{
+public:
+
+    virtual void LoadShaderImage(GpuHwShaderImageLoad * pImageLoad) = 0;
+
+    //
+    // Runs all thread groups of the dispatch, pUavs[i] is bound to register ui
+    //
+
+    virtual void Dispatch(
+        const GpuHwComputeShaderDisptch *   pDispatch,
+        VpuResourceDescriptor *             pUavs,
+        UINT                                numUavs) = 0;
+};
+
+struct CosGpuVaEngineStats
+{
+    UINT64  m_numCommandBuffers;
+    UINT64  m_numDispatches;
+    UINT64  m_numStagedBytes;
+};
+
+class CosGpuVaEngine
+{
+public:
+
+    static const SIZE_T kStagingAlignment = 16;
+
+    void Initialize(
+        CosGpuMmu *             pMmu,
+        CosGpuVaShaderEngine *  pShaderEngine,
+        BYTE *                  pCommandBuffer,
+        UINT                    commandBufferSize,
+        BYTE *                  pStaging,
+        SIZE_T                  stagingSize)
+    {
+        m_pMmu = pMmu;
+        m_pShaderEngine = pShaderEngine;
+        m_pCommandBuffer = pCommandBuffer;
+        m_commandBufferSize = commandBufferSize;
+        m_pStaging = pStaging;
+        m_stagingSize = stagingSize;
+
+        memset(&m_stats, 0, sizeof(m_stats));
+    }
+
+    //
+    // Fetches and runs the command buffer at commandBufferGpuVa. Returns false
+    // on a translation fault or a malformed command, *pFailedOffset then
+    // receives the offset of the command, or of the end of the command buffer
+    // when it could not be fetched.
+    //
+
+    bool Execute(UINT64 commandBufferGpuVa, UINT commandBufferSize, UINT * pFailedOffset)
+    {
+        *pFailedOffset = commandBufferSize;
+
+        if ((commandBufferSize > m_commandBufferSize) ||
+            !m_pMmu->Read(commandBufferGpuVa, m_pCommandBuffer, commandBufferSize))
+        {
+            return false;
+        }
+
+        m_stats.m_numCommandBuffers++;
+
+        UINT offset = 0;
+
+        while (offset < commandBufferSize)
+        {
+            UINT commandSize = ExecuteCommand(m_pCommandBuffer + offset, commandBufferSize - offset);
+
+            if (0 == commandSize)
+            {
+                *pFailedOffset = offset;
+
+                return false;
+            }
+
+            offset += commandSize;
+        }
+
+        return true;
+    }
+
+    //
+    // Valid after Execute() returned false with an offset inside the command buffer
+    //
+
+    GpuCommandId GetCommandId(UINT offset)
+    {
+        return *((GpuCommandId *)(m_pCommandBuffer + offset));
+    }
+
+    const CosGpuVaEngineStats & GetStats()
+    {
+        return m_stats;
+    }
+
+private:
+
+    //
+    // Returns the size of the command, 0 when it failed
+    //
+
+    UINT ExecuteCommand(BYTE * pGpuCommand, UINT bytesLeft)
+    {
+        if (bytesLeft < sizeof(GpuCommandId))
+        {
+            return 0;
+        }
+
+        switch (*((GpuCommandId *)pGpuCommand))
+        {
+        case Header:
+        case Nop:
+            return (bytesLeft >= sizeof(GpuCommand)) ? sizeof(GpuCommand) : 0;
+        case ResourceCopy:
+            {
+                if (bytesLeft < sizeof(GpuCommand))
+                {
+                    return 0;
+                }
+
+                GpuResourceCopy * pResourceCopy = &((GpuCommand *)pGpuCommand)->m_resourceCopy;
+
+                if (!m_pMmu->Copy(
+                        pResourceCopy->m_dstGpuAddress.QuadPart,
+                        pResourceCopy->m_srcGpuAddress.QuadPart,
+                        pResourceCopy->m_sizeBytes))
+                {
+                    return 0;
+                }
+
+                return sizeof(GpuCommand);
+            }
+        case QwordWrite:
+            {
+                if (bytesLeft < sizeof(GpuHwQwordWrite))
+                {
+                    return 0;
+                }
+
+                GpuHwQwordWrite * pQwordWrite = (GpuHwQwordWrite *)pGpuCommand;
+
+                if (!m_pMmu->Write(
+                        pQwordWrite->m_gpuAddress.QuadPart,
+                        &pQwordWrite->m_data,
+                        sizeof(pQwordWrite->m_data)))
+                {
+                    return 0;
+                }
+
+                return sizeof(GpuHwQwordWrite);
+            }
+        case DescriptorHeapSet:
+            return (bytesLeft >= sizeof(GpuHwDescriptorHeapSet)) ? sizeof(GpuHwDescriptorHeapSet) : 0;
+        case RootSignature2LevelSet:
+            {
+                //
+                // Dispatches carry their resolved UAV bindings, the root
+                // values are not needed
+                //
+
+                return GetCommandSize(pGpuCommand, bytesLeft, FIELD_OFFSET(GpuHWRootSignature2LSet, m_rootValues));
+            }
+        case ShaderImageLoad:
+            {
+                UINT commandSize = GetCommandSize(pGpuCommand, bytesLeft, sizeof(GpuHwShaderImageLoad));
+
+                if (commandSize)
+                {
+                    m_pShaderEngine->LoadShaderImage((GpuHwShaderImageLoad *)pGpuCommand);
+                }
+
+                return commandSize;
+            }
+        case ComputeShaderDispatch:
+            {
+                UINT commandSize = GetCommandSize(pGpuCommand, bytesLeft, sizeof(GpuHwComputeShaderDisptch));
+
+                if (commandSize && !Dispatch((GpuHwComputeShaderDisptch *)pGpuCommand))
+                {
+                    return 0;
+                }
+
+                return commandSize;
+            }
+        default:
+            return 0;
+        }
+    }
+
+    //
+    // m_commandSize of a variable size command, 0 when it is out of bounds
+    //
+
+    static UINT GetCommandSize(BYTE * pGpuCommand, UINT bytesLeft, UINT minSize)
+    {
+        if (bytesLeft < (sizeof(GpuCommandId) + sizeof(UINT)))
+        {
+            return 0;
+        }
+
+        UINT commandSize = *((UINT *)(pGpuCommand + sizeof(GpuCommandId)));
+
+        if ((commandSize < minSize) || (commandSize > bytesLeft))
+        {
+            return 0;
+        }
+
+        return commandSize;
+    }
+
+    bool Dispatch(GpuHwComputeShaderDisptch * pDispatch)
+    {
+        C_ASSERT(COS_MAX_HW_UAV_BINDINGS <= kVpuMaxUAVs);
+
+        GpuHwUavBinding * pUavBindings = (GpuHwUavBinding *)(pDispatch + 1);
+        UINT numUavs = (UINT)((pDispatch->m_commandSize - sizeof(GpuHwComputeShaderDisptch))/sizeof(GpuHwUavBinding));
+
+        if (numUavs > COS_MAX_HW_UAV_BINDINGS)
+        {
+            return false;
+        }
+
+        VpuResourceDescriptor uavs[COS_MAX_HW_UAV_BINDINGS];
+        SIZE_T stagingOffset = 0;
+        UINT64 numStagedBytes = 0;
+
+        for (UINT i = 0; i < numUavs; i++)
+        {
+            uavs[i].m_base = NULL;
+            uavs[i].m_elementSize = (int32_t)pUavBindings[i].m_elementSize;
+
+            if (0 == pUavBindings[i].m_gpuVa.QuadPart)
+            {
+                continue;
+            }
+
+            SIZE_T sizeBytes = pUavBindings[i].m_sizeBytes;
+            SIZE_T alignedSize = (sizeBytes + kStagingAlignment - 1) & ~(kStagingAlignment - 1);
+
+            if (alignedSize > (m_stagingSize - stagingOffset))
+            {
+                return false;
+            }
+
+            uavs[i].m_base = (int8_t *)(m_pStaging + stagingOffset);
+
+            if (!m_pMmu->Read(pUavBindings[i].m_gpuVa.QuadPart, uavs[i].m_base, sizeBytes))
+            {
+                return false;
+            }
+
+            stagingOffset += alignedSize;
+            numStagedBytes += sizeBytes;
+        }
+
+        m_pShaderEngine->Dispatch(pDispatch, uavs, numUavs);
+
+        for (UINT i = 0; i < numUavs; i++)
+        {
+            if (uavs[i].m_base &&
+                !m_pMmu->Write(pUavBindings[i].m_gpuVa.QuadPart, uavs[i].m_base, pUavBindings[i].m_sizeBytes))
+            {
+                return false;
+            }
+        }
+
+        m_stats.m_numDispatches++;
+        m_stats.m_numStagedBytes += numStagedBytes;
+
+        return true;
+    }
+
+    CosGpuMmu *             m_pMmu;
+    CosGpuVaShaderEngine *  m_pShaderEngine;
+
+    BYTE *                  m_pCommandBuffer;
+    UINT                    m_commandBufferSize;
+
+    BYTE *                  m_pStaging;
+    SIZE_T                  m_stagingSize;
+
+    CosGpuVaEngineStats     m_stats;
+};
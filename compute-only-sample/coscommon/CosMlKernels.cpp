@@ -0,0 +1,4125 @@
+//
+// CPU implementations of the ML meta command operators
+//
+// Shared by the KMD software adapter and user mode tests, so only the
+// compiler intrinsics and memcpy/memset are used from the runtime.
+//
+
+#ifdef _KERNEL_MODE
+#include <ntddk.h>
+#else
+#include <windows.h>
+#endif
+
+//
+// The vector loops use SSE2 on x86 and x64, the ARM builds run the scalar
+// loops that otherwise only handle the remainder. FP16 rows are the
+// exception, they convert with NEON on ARM and ARM64.
+//
+// x86 and x64 keep the SSE2 FP16 conversion rather than F16C. The workers
+// only save the legacy FP state (KeSaveFloatingPointState), and the VEX
+// encoded F16C instructions zero the upper YMM halves, so F16C would need a
+// CPUID check plus KeSaveExtendedProcessorState(XSTATE_MASK_AVX) around
+// every work item on every worker.
+//
+
+#if defined(_M_IX86) || defined(_M_X64)
+#include <emmintrin.h>
+#define COS_ML_SSE2     1
+#else
+#define COS_ML_SSE2     0
+#endif
+
+#if defined(_M_ARM) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define COS_ML_NEON     1
+#else
+#define COS_ML_NEON     0
+#endif
+
+#include "CosMlKernels.h"
+
+//
+// GEMM blocking, sized so a packed B panel (KC x NC) stays in L2 and a
+// packed A block (MC x KC) in L1/L2. The micro kernel computes MR x NR of
+// the output with 8 SSE accumulators (plain loops without SSE2).
+//
+
+#define kCosMlGemmMR    4
+#define kCosMlGemmNR    8
+#define kCosMlGemmMC    64
+#define kCosMlGemmNC    256
+#define kCosMlGemmKC    256
+
+#define kCosMlFloatInfinity     (1e30f * 1e30f)
+
+static inline UINT64
+CosMlMin(
+    UINT64  a,
+    UINT64  b)
+{
+    return (a < b) ? a : b;
+}
+
+static inline UINT64
+CosMlMax(
+    UINT64  a,
+    UINT64  b)
+{
+    return (a > b) ? a : b;
+}
+
+static inline UINT64
+CosMlAlignUp(
+    UINT64  value,
+    UINT64  alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+static inline float
+CosMlSqrt(
+    float   x)
+{
+#if COS_ML_SSE2
+    return _mm_cvtss_f32(_mm_sqrt_ss(_mm_set_ss(x)));
+#else
+    if ((x != x) || (x < 0.0f))
+    {
+        return kCosMlFloatInfinity - kCosMlFloatInfinity;
+    }
+
+    if ((0.0f == x) || (x >= kCosMlFloatInfinity))
+    {
+        return x;
+    }
+
+    //
+    // Halve the exponent for the initial guess (within 6%), scaling
+    // denormals up first, then refine with Newton iterations
+    //
+
+    float scale = 1.0f;
+
+    if (x < 1.17549435e-38f)
+    {
+        x *= 16777216.0f;
+        scale = 1.0f / 4096.0f;
+    }
+
+    UINT bits;
+    memcpy(&bits, &x, sizeof(bits));
+
+    bits = (bits >> 1) + 0x1fc00000;
+
+    float y;
+    memcpy(&y, &bits, sizeof(y));
+
+    for (UINT i = 0; i < 3; i++)
+    {
+        y = 0.5f * (y + x / y);
+    }
+
+    return y * scale;
+#endif
+}
+
+static inline float
+CosMlAbs(
+    float   x)
+{
+    return (x < 0.0f) ? -x : x;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Scalar math
+//
+////////////////////////////////////////////////////////////////////////////////
+
+float
+CosMlHalfToFloat(
+    USHORT  value)
+{
+    UINT sign = ((UINT)value & 0x8000) << 16;
+    UINT exponent = ((UINT)value >> 10) & 0x1f;
+    UINT mantissa = (UINT)value & 0x3ff;
+    UINT bits;
+
+    if (0x1f == exponent)
+    {
+        bits = sign | 0x7f800000 | (mantissa << 13);
+    }
+    else if (0 != exponent)
+    {
+        bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+    }
+    else if (0 == mantissa)
+    {
+        bits = sign;
+    }
+    else
+    {
+        //
+        // Denormal, normalize the mantissa
+        //
+
+        exponent = 113;
+        while (0 == (mantissa & 0x400))
+        {
+            mantissa <<= 1;
+            exponent--;
+        }
+
+        bits = sign | (exponent << 23) | ((mantissa & 0x3ff) << 13);
+    }
+
+    float result;
+    memcpy(&result, &bits, sizeof(result));
+
+    return result;
+}
+
+USHORT
+CosMlFloatToHalf(
+    float   value)
+{
+    UINT bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    UINT sign = (bits >> 16) & 0x8000;
+    UINT absBits = bits & 0x7fffffff;
+    UINT halfBits;
+    UINT remainder;
+    UINT halfway;
+
+    if (absBits >= 0x7f800000)
+    {
+        //
+        // Infinity or NaN (kept quiet)
+        //
+
+        return (USHORT)(sign | 0x7c00 | ((absBits > 0x7f800000) ? 0x200 : 0));
+    }
+
+    if (absBits >= 0x477ff000)
+    {
+        //
+        // Rounds to 65536 or more
+        //
+
+        return (USHORT)(sign | 0x7c00);
+    }
+
+    if (absBits >= 0x38800000)
+    {
+        halfBits = (absBits - 0x38000000) >> 13;
+        remainder = absBits & 0x1fff;
+        halfway = 0x1000;
+    }
+    else if (absBits >= 0x33000000)
+    {
+        UINT shift = 126 - (absBits >> 23);
+        UINT mantissa = (absBits & 0x7fffff) | 0x800000;
+
+        halfBits = mantissa >> shift;
+        remainder = mantissa & ((1 << shift) - 1);
+        halfway = 1 << (shift - 1);
+    }
+    else
+    {
+        return (USHORT)sign;
+    }
+
+    //
+    // Round to nearest even
+    //
+
+    if ((remainder > halfway) || ((remainder == halfway) && (halfBits & 1)))
+    {
+        halfBits++;
+    }
+
+    return (USHORT)(sign | halfBits);
+}
+
+float
+CosMlExp(
+    float   x)
+{
+    if (x != x)
+    {
+        return x;
+    }
+
+    if (x > 88.73f)
+    {
+        return kCosMlFloatInfinity;
+    }
+
+    if (x < -103.98f)
+    {
+        return 0.0f;
+    }
+
+    //
+    // x = n * ln(2) + r with |r| <= ln(2) / 2
+    //
+
+    const float log2e = 1.44269504f;
+    const float ln2Hi = 0.693145752f;
+    const float ln2Lo = 1.42860677e-6f;
+
+    float t = x * log2e;
+    int n = (int)(t + ((t >= 0.0f) ? 0.5f : -0.5f));
+
+    float r = (x - n * ln2Hi) - n * ln2Lo;
+
+    float p = 1.0f + r * (1.0f + r * (1.0f / 2 + r * (1.0f / 6 + r * (1.0f / 24 + r * (1.0f / 120 + r * (1.0f / 720 + r * (1.0f / 5040)))))));
+
+    //
+    // Scale by 2^n in two steps so neither factor leaves the normal range
+    //
+
+    int n1 = n / 2;
+    int n2 = n - n1;
+
+    UINT scale1Bits = (UINT)(n1 + 127) << 23;
+    UINT scale2Bits = (UINT)(n2 + 127) << 23;
+    float scale1;
+    float scale2;
+
+    memcpy(&scale1, &scale1Bits, sizeof(scale1));
+    memcpy(&scale2, &scale2Bits, sizeof(scale2));
+
+    return p * scale1 * scale2;
+}
+
+float
+CosMlLog(
+    float   x)
+{
+    if ((x != x) || (x < 0.0f))
+    {
+        return kCosMlFloatInfinity - kCosMlFloatInfinity;
+    }
+
+    if (0.0f == x)
+    {
+        return -kCosMlFloatInfinity;
+    }
+
+    if (x >= kCosMlFloatInfinity)
+    {
+        return x;
+    }
+
+    int exponent = 0;
+
+    if (x < 1.17549435e-38f)
+    {
+        //
+        // Denormal, scale by 2^23
+        //
+
+        x *= 8388608.0f;
+        exponent = -23;
+    }
+
+    UINT bits;
+    memcpy(&bits, &x, sizeof(bits));
+
+    exponent += (int)((bits >> 23) & 0xff) - 127;
+    bits = (bits & 0x7fffff) | 0x3f800000;
+
+    float m;
+    memcpy(&m, &bits, sizeof(m));
+
+    if (m > 1.41421356f)
+    {
+        m *= 0.5f;
+        exponent++;
+    }
+
+    //
+    // ln(m) = 2 * atanh(s), s = (m - 1) / (m + 1), |s| < 0.172
+    //
+
+    float s = (m - 1.0f) / (m + 1.0f);
+    float s2 = s * s;
+    float p = 2.0f * s * (1.0f + s2 * (1.0f / 3 + s2 * (1.0f / 5 + s2 * (1.0f / 7 + s2 * (1.0f / 9 + s2 * (1.0f / 11))))));
+
+    return exponent * 0.693147181f + p;
+}
+
+static float
+CosMlPow(
+    float   x,
+    UINT    p)
+{
+    float result = 1.0f;
+
+    while (p)
+    {
+        if (p & 1)
+        {
+            result *= x;
+        }
+
+        x *= x;
+        p >>= 1;
+    }
+
+    return result;
+}
+
+#if COS_ML_SSE2
+
+//
+// 4 wide FP16 conversions, bit exact with the scalar versions
+//
+
+static inline __m128
+CosMlHalfToFloat4(
+    const USHORT *  pSrc)
+{
+    __m128i h = _mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i *)pSrc), _mm_setzero_si128());
+    __m128i sign = _mm_slli_epi32(_mm_and_si128(h, _mm_set1_epi32(0x8000)), 16);
+    __m128i exponentMantissa = _mm_slli_epi32(_mm_and_si128(h, _mm_set1_epi32(0x7fff)), 13);
+
+    //
+    // Rebias the exponent by multiplying with 2^112, this also normalizes
+    // denormals. Infinity and NaN get the maximum exponent forced.
+    //
+
+    __m128 value = _mm_mul_ps(_mm_castsi128_ps(exponentMantissa), _mm_castsi128_ps(_mm_set1_epi32(0x77800000)));
+    __m128i infNan = _mm_cmpgt_epi32(exponentMantissa, _mm_set1_epi32(0x7bff << 13));
+
+    value = _mm_or_ps(value, _mm_castsi128_ps(_mm_and_si128(infNan, _mm_set1_epi32(0x7f800000))));
+
+    return _mm_or_ps(value, _mm_castsi128_ps(sign));
+}
+
+static inline void
+CosMlFloatToHalf4(
+    __m128      value,
+    USHORT *    pDst)
+{
+    __m128 sign = _mm_and_ps(value, _mm_castsi128_ps(_mm_set1_epi32(0x80000000)));
+    __m128 absValue = _mm_xor_ps(value, sign);
+    __m128i absBits = _mm_castps_si128(absValue);
+
+    __m128i isNan = _mm_castps_si128(_mm_cmpunord_ps(absValue, absValue));
+    __m128i isRegular = _mm_cmpgt_epi32(_mm_set1_epi32(0x47800000), absBits);
+    __m128i isDenormal = _mm_cmpgt_epi32(_mm_set1_epi32(0x38800000), absBits);
+    __m128i infNan = _mm_or_si128(_mm_and_si128(isNan, _mm_set1_epi32(0x200)), _mm_set1_epi32(0x7c00));
+
+    //
+    // Denormal results: adding 0.5 shifts the mantissa into place and the
+    // FP add rounds to nearest even
+    //
+
+    __m128i denormalMagic = _mm_set1_epi32(126 << 23);
+    __m128i denormal = _mm_sub_epi32(
+                        _mm_castps_si128(_mm_add_ps(absValue, _mm_castsi128_ps(denormalMagic))),
+                        denormalMagic);
+
+    //
+    // Normal results: rebias, add just under half an ULP plus the odd bit
+    // of the result mantissa and truncate
+    //
+
+    __m128i mantissaOdd = _mm_srai_epi32(_mm_slli_epi32(absBits, 31 - 13), 31);
+    __m128i normal = _mm_add_epi32(absBits, _mm_set1_epi32((int)(0xfff - (112u << 23))));
+
+    normal = _mm_srli_epi32(_mm_sub_epi32(normal, mantissaOdd), 13);
+
+    __m128i result = _mm_or_si128(_mm_and_si128(isDenormal, denormal), _mm_andnot_si128(isDenormal, normal));
+
+    result = _mm_or_si128(_mm_and_si128(isRegular, result), _mm_andnot_si128(isRegular, infNan));
+    result = _mm_or_si128(result, _mm_srai_epi32(_mm_castps_si128(sign), 16));
+
+    _mm_storel_epi64((__m128i *)pDst, _mm_packs_epi32(result, result));
+}
+
+//
+// 4 wide CosMlExp, same range reduction and polynomial
+//
+
+static inline __m128
+CosMlExp4(
+    __m128  x)
+{
+    __m128 isNan = _mm_cmpunord_ps(x, x);
+    __m128 isOverflow = _mm_cmpgt_ps(x, _mm_set1_ps(88.73f));
+    __m128 isUnderflow = _mm_cmplt_ps(x, _mm_set1_ps(-103.98f));
+
+    __m128 clamped = _mm_min_ps(_mm_max_ps(x, _mm_set1_ps(-103.98f)), _mm_set1_ps(88.73f));
+    __m128i n = _mm_cvtps_epi32(_mm_mul_ps(clamped, _mm_set1_ps(1.44269504f)));
+    __m128 nf = _mm_cvtepi32_ps(n);
+
+    __m128 r = _mm_sub_ps(_mm_sub_ps(clamped, _mm_mul_ps(nf, _mm_set1_ps(0.693145752f))), _mm_mul_ps(nf, _mm_set1_ps(1.42860677e-6f)));
+
+    __m128 p = _mm_set1_ps(1.0f / 5040);
+    p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(1.0f / 720));
+    p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(1.0f / 120));
+    p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(1.0f / 24));
+    p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(1.0f / 6));
+    p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(1.0f / 2));
+    p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(1.0f));
+    p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(1.0f));
+
+    __m128i n1 = _mm_srai_epi32(n, 1);
+    __m128i n2 = _mm_sub_epi32(n, n1);
+    __m128i bias = _mm_set1_epi32(127);
+
+    p = _mm_mul_ps(p, _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(n1, bias), 23)));
+    p = _mm_mul_ps(p, _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(n2, bias), 23)));
+
+    p = _mm_or_ps(_mm_andnot_ps(isOverflow, p), _mm_and_ps(isOverflow, _mm_set1_ps(kCosMlFloatInfinity)));
+    p = _mm_andnot_ps(isUnderflow, p);
+
+    return _mm_or_ps(_mm_andnot_ps(isNan, p), _mm_and_ps(isNan, x));
+}
+
+#endif
+
+#if COS_ML_NEON
+
+//
+// 4 wide FP16 conversions with the NEON convert instructions. NaNs are
+// patched to match the scalar versions, which keep signaling NaNs when
+// widening and always produce the quiet NaN when narrowing.
+//
+
+static inline float32x4_t
+CosMlHalfToFloat4(
+    const USHORT *  pSrc)
+{
+    uint16x4_t h = vld1_u16(pSrc);
+    uint32x4_t value = vreinterpretq_u32_f32(vcvt_f32_f16(vreinterpret_f16_u16(h)));
+
+    uint32x4_t h32 = vmovl_u16(h);
+    uint32x4_t isNan = vcgtq_u32(vandq_u32(h32, vdupq_n_u32(0x7fff)), vdupq_n_u32(0x7c00));
+    uint32x4_t nan = vorrq_u32(
+                        vorrq_u32(vshlq_n_u32(vandq_u32(h32, vdupq_n_u32(0x8000)), 16), vdupq_n_u32(0x7f800000)),
+                        vshlq_n_u32(vandq_u32(h32, vdupq_n_u32(0x3ff)), 13));
+
+    return vreinterpretq_f32_u32(vbslq_u32(isNan, nan, value));
+}
+
+static inline void
+CosMlFloatToHalf4(
+    float32x4_t value,
+    USHORT *    pDst)
+{
+    uint16x4_t h = vreinterpret_u16_f16(vcvt_f16_f32(value));
+
+    uint16x4_t isNan = vmovn_u32(vmvnq_u32(vceqq_f32(value, value)));
+    uint16x4_t nan = vorr_u16(vand_u16(h, vdup_n_u16(0x8000)), vdup_n_u16(0x7e00));
+
+    vst1_u16(pDst, vbsl_u16(isNan, nan, h));
+}
+
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Activation
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void
+CosMlApplyActivation(
+    const CosMlActivation * pActivation,
+    float *                 pValues,
+    UINT64                  count)
+{
+    UINT64 i = 0;
+
+    switch (pActivation->m_function)
+    {
+    case CosMlActivationNone:
+    case CosMlActivationIdentity:
+        break;
+
+    case CosMlActivationLinear:
+        {
+#if COS_ML_SSE2
+            __m128 alpha = _mm_set1_ps(pActivation->m_params[0]);
+            __m128 beta = _mm_set1_ps(pActivation->m_params[1]);
+
+            for (; i + 4 <= count; i += 4)
+            {
+                _mm_storeu_ps(pValues + i, _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(pValues + i), alpha), beta));
+            }
+#endif
+
+            for (; i < count; i++)
+            {
+                pValues[i] = pValues[i] * pActivation->m_params[0] + pActivation->m_params[1];
+            }
+        }
+        break;
+
+    case CosMlActivationRelu:
+        {
+#if COS_ML_SSE2
+            __m128 zero = _mm_setzero_ps();
+
+            for (; i + 4 <= count; i += 4)
+            {
+                _mm_storeu_ps(pValues + i, _mm_max_ps(_mm_loadu_ps(pValues + i), zero));
+            }
+#endif
+
+            for (; i < count; i++)
+            {
+                pValues[i] = (pValues[i] > 0.0f) ? pValues[i] : 0.0f;
+            }
+        }
+        break;
+
+    case CosMlActivationLeakyRelu:
+        {
+#if COS_ML_SSE2
+            __m128 zero = _mm_setzero_ps();
+            __m128 alpha = _mm_set1_ps(pActivation->m_params[0]);
+
+            for (; i + 4 <= count; i += 4)
+            {
+                __m128 x = _mm_loadu_ps(pValues + i);
+
+                _mm_storeu_ps(pValues + i, _mm_add_ps(_mm_max_ps(x, zero), _mm_mul_ps(_mm_min_ps(x, zero), alpha)));
+            }
+#endif
+
+            for (; i < count; i++)
+            {
+                pValues[i] = (pValues[i] > 0.0f) ? pValues[i] : pValues[i] * pActivation->m_params[0];
+            }
+        }
+        break;
+
+    case CosMlActivationSigmoid:
+#if COS_ML_SSE2
+        for (; i + 4 <= count; i += 4)
+        {
+            __m128 e = CosMlExp4(_mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(pValues + i)));
+
+            _mm_storeu_ps(pValues + i, _mm_div_ps(_mm_set1_ps(1.0f), _mm_add_ps(_mm_set1_ps(1.0f), e)));
+        }
+#endif
+
+        for (; i < count; i++)
+        {
+            pValues[i] = 1.0f / (1.0f + CosMlExp(-pValues[i]));
+        }
+        break;
+
+    case CosMlActivationTanh:
+#if COS_ML_SSE2
+        for (; i + 4 <= count; i += 4)
+        {
+            __m128 x = _mm_loadu_ps(pValues + i);
+            __m128 e = CosMlExp4(_mm_add_ps(x, x));
+
+            _mm_storeu_ps(pValues + i, _mm_sub_ps(_mm_set1_ps(1.0f), _mm_div_ps(_mm_set1_ps(2.0f), _mm_add_ps(e, _mm_set1_ps(1.0f)))));
+        }
+#endif
+
+        for (; i < count; i++)
+        {
+            pValues[i] = 1.0f - 2.0f / (CosMlExp(2.0f * pValues[i]) + 1.0f);
+        }
+        break;
+
+    case CosMlActivationElu:
+        for (; i < count; i++)
+        {
+            if (pValues[i] < 0.0f)
+            {
+                pValues[i] = pActivation->m_params[0] * (CosMlExp(pValues[i]) - 1.0f);
+            }
+        }
+        break;
+
+    case CosMlActivationSoftplus:
+        for (; i < count; i++)
+        {
+            if (pValues[i] < 20.0f)
+            {
+                pValues[i] = CosMlLog(1.0f + CosMlExp(pValues[i]));
+            }
+        }
+        break;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Tensor access
+//
+////////////////////////////////////////////////////////////////////////////////
+
+//
+// Tensor viewed with a fixed number of dimensions, missing outer dimensions
+// have size 1. Dimensions of size 1 get a stride of 0 so the view can be
+// indexed with the index of a larger (broadcast) tensor.
+//
+
+struct CosMlView
+{
+    BYTE *          m_pData;
+    CosMlDataType   m_dataType;
+    UINT64          m_size[kCosMlMaxDimensions];
+    INT64           m_stride[kCosMlMaxDimensions];
+};
+
+static bool
+CosMlGetView(
+    const CosMlTensor * pTensor,
+    UINT                dimensionCount,
+    CosMlView *         pView)
+{
+    if ((NULL == pTensor->m_pData) ||
+        (0 == pTensor->m_dimensionCount) ||
+        (pTensor->m_dimensionCount > kCosMlMaxDimensions))
+    {
+        return false;
+    }
+
+    pView->m_pData = (BYTE *)pTensor->m_pData;
+    pView->m_dataType = pTensor->m_dataType;
+
+    UINT srcDim = pTensor->m_dimensionCount;
+
+    for (UINT dstDim = dimensionCount; dstDim-- > 0;)
+    {
+        if (srcDim > 0)
+        {
+            srcDim--;
+            pView->m_size[dstDim] = pTensor->m_size[srcDim];
+            pView->m_stride[dstDim] = (INT64)pTensor->m_stride[srcDim];
+        }
+        else
+        {
+            pView->m_size[dstDim] = 1;
+            pView->m_stride[dstDim] = 0;
+        }
+
+        if (0 == pView->m_size[dstDim])
+        {
+            return false;
+        }
+
+        if (1 == pView->m_size[dstDim])
+        {
+            pView->m_stride[dstDim] = 0;
+        }
+    }
+
+    //
+    // Extra outer dimensions are only allowed if they have size 1
+    //
+
+    while (srcDim > 0)
+    {
+        srcDim--;
+        if (pTensor->m_size[srcDim] != 1)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+//
+// Per channel parameter (bias, mean, scale, ...) given as C, or as a tensor
+// broadcast to NxCxHxW. Returns a 4D view.
+//
+
+static bool
+CosMlGetChannelView(
+    const CosMlTensor * pTensor,
+    UINT64              channelCount,
+    CosMlView *         pView)
+{
+    if (1 == pTensor->m_dimensionCount)
+    {
+        if (!CosMlGetView(pTensor, 1, pView))
+        {
+            return false;
+        }
+
+        pView->m_size[1] = pView->m_size[0];
+        pView->m_stride[1] = pView->m_stride[0];
+        pView->m_size[0] = pView->m_size[2] = pView->m_size[3] = 1;
+        pView->m_stride[0] = pView->m_stride[2] = pView->m_stride[3] = 0;
+    }
+    else if (!CosMlGetView(pTensor, 4, pView))
+    {
+        return false;
+    }
+
+    return (pView->m_size[1] == channelCount) || (1 == pView->m_size[1]);
+}
+
+static bool
+CosMlIsBroadcastable(
+    const CosMlView *   pView,
+    const CosMlView *   pTarget,
+    UINT                dimensionCount)
+{
+    for (UINT i = 0; i < dimensionCount; i++)
+    {
+        if ((pView->m_size[i] != pTarget->m_size[i]) && (pView->m_size[i] != 1))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static inline float
+CosMlLoadElement(
+    const CosMlView *   pView,
+    INT64               offset)
+{
+    switch (pView->m_dataType)
+    {
+    case CosMlDataTypeFloat32:
+        return ((float *)pView->m_pData)[offset];
+    case CosMlDataTypeFloat16:
+        return CosMlHalfToFloat(((USHORT *)pView->m_pData)[offset]);
+    case CosMlDataTypeUInt32:
+        return (float)((UINT *)pView->m_pData)[offset];
+    }
+
+    return 0.0f;
+}
+
+static inline void
+CosMlStoreElement(
+    const CosMlView *   pView,
+    INT64               offset,
+    float               value)
+{
+    switch (pView->m_dataType)
+    {
+    case CosMlDataTypeFloat32:
+        ((float *)pView->m_pData)[offset] = value;
+        break;
+    case CosMlDataTypeFloat16:
+        ((USHORT *)pView->m_pData)[offset] = CosMlFloatToHalf(value);
+        break;
+    case CosMlDataTypeUInt32:
+        ((UINT *)pView->m_pData)[offset] = (value > 0.0f) ? (UINT)value : 0;
+        break;
+    }
+}
+
+static void
+CosMlLoadRow(
+    const CosMlView *   pView,
+    INT64               offset,
+    INT64               stride,
+    UINT64              count,
+    float *             pDst)
+{
+    if ((CosMlDataTypeFloat32 == pView->m_dataType) && (1 == stride))
+    {
+        memcpy(pDst, ((float *)pView->m_pData) + offset, (SIZE_T)count*sizeof(float));
+    }
+    else if (CosMlDataTypeFloat32 == pView->m_dataType)
+    {
+        const float * pSrc = ((float *)pView->m_pData) + offset;
+
+        for (UINT64 i = 0; i < count; i++, pSrc += stride)
+        {
+            pDst[i] = *pSrc;
+        }
+    }
+    else if ((CosMlDataTypeFloat16 == pView->m_dataType) && (1 == stride))
+    {
+        const USHORT * pSrc = ((USHORT *)pView->m_pData) + offset;
+        UINT64 i = 0;
+
+#if COS_ML_SSE2
+        for (; i + 4 <= count; i += 4)
+        {
+            _mm_storeu_ps(pDst + i, CosMlHalfToFloat4(pSrc + i));
+        }
+#elif COS_ML_NEON
+        for (; i + 4 <= count; i += 4)
+        {
+            vst1q_f32(pDst + i, CosMlHalfToFloat4(pSrc + i));
+        }
+#endif
+
+        for (; i < count; i++)
+        {
+            pDst[i] = CosMlHalfToFloat(pSrc[i]);
+        }
+    }
+    else
+    {
+        for (UINT64 i = 0; i < count; i++, offset += stride)
+        {
+            pDst[i] = CosMlLoadElement(pView, offset);
+        }
+    }
+}
+
+static void
+CosMlStoreRow(
+    const CosMlView *   pView,
+    INT64               offset,
+    INT64               stride,
+    UINT64              count,
+    const float *       pSrc)
+{
+    if ((CosMlDataTypeFloat32 == pView->m_dataType) && (1 == stride))
+    {
+        memcpy(((float *)pView->m_pData) + offset, pSrc, (SIZE_T)count*sizeof(float));
+    }
+    else if ((CosMlDataTypeFloat16 == pView->m_dataType) && (1 == stride))
+    {
+        USHORT * pDst = ((USHORT *)pView->m_pData) + offset;
+        UINT64 i = 0;
+
+#if COS_ML_SSE2
+        for (; i + 4 <= count; i += 4)
+        {
+            CosMlFloatToHalf4(_mm_loadu_ps(pSrc + i), pDst + i);
+        }
+#elif COS_ML_NEON
+        for (; i + 4 <= count; i += 4)
+        {
+            CosMlFloatToHalf4(vld1q_f32(pSrc + i), pDst + i);
+        }
+#endif
+
+        for (; i < count; i++)
+        {
+            pDst[i] = CosMlFloatToHalf(pSrc[i]);
+        }
+    }
+    else
+    {
+        for (UINT64 i = 0; i < count; i++, offset += stride)
+        {
+            CosMlStoreElement(pView, offset, pSrc[i]);
+        }
+    }
+}
+
+//
+// Splits numItems units of work into work items for ParallelFor, a few per
+// worker so uneven items still balance
+//
+
+static UINT
+CosMlGetChunkSize(
+    CosMlContext *  pContext,
+    UINT64          numItems)
+{
+    UINT64 numChunks = pContext->GetNumWorkers()*4;
+
+    return (UINT)CosMlMax(1, (numItems + numChunks - 1)/numChunks);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// GEMM core
+//
+// Operands are supplied row by row through callbacks, which lets GEMM and
+// convolution (implicit im2col) share the blocked, packed kernel. Rows are
+// converted to FP32 by the callbacks and packed into MR/NR interleaved
+// panels for the micro kernel.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+struct CosMlGemmProblem
+{
+    UINT64  m_batchCount;
+    UINT64  m_m;
+    UINT64  m_n;
+    UINT64  m_k;
+
+    void *  m_pContext;
+
+    //
+    // Row "row" of the M x K matrix A, columns [k0, k0 + count)
+    //
+
+    void (*m_pfnLoadA)(void * pContext, UINT64 batch, UINT64 row, UINT64 k0, UINT64 count, float * pDst);
+
+    //
+    // Row "k" of the K x N matrix B, columns [n0, n0 + count)
+    //
+
+    void (*m_pfnLoadB)(void * pContext, UINT64 batch, UINT64 k, UINT64 n0, UINT64 count, float * pDst);
+
+    //
+    // Optional column loaders used instead of the row loaders when set, for
+    // operands stored transposed so the loads stay contiguous
+    //
+
+    void (*m_pfnLoadAColumn)(void * pContext, UINT64 batch, UINT64 k, UINT64 m0, UINT64 count, float * pDst);
+    void (*m_pfnLoadBColumn)(void * pContext, UINT64 batch, UINT64 n, UINT64 k0, UINT64 count, float * pDst);
+
+    //
+    // Row "row" of the result, columns [n0, n0 + count), pSrc may be modified
+    //
+
+    void (*m_pfnStore)(void * pContext, UINT64 batch, UINT64 row, UINT64 n0, UINT64 count, float * pSrc);
+};
+
+struct CosMlGemmWork
+{
+    const CosMlGemmProblem *    m_pProblem;
+
+    UINT64                      m_mBlocks;
+    UINT64                      m_nBlocks;
+
+    BYTE *                      m_pScratch;
+    SIZE_T                      m_scratchPerWorker;
+};
+
+#define kCosMlGemmScratchFloats (kCosMlGemmMC*kCosMlGemmKC + kCosMlGemmKC*kCosMlGemmNC + kCosMlGemmMC*kCosMlGemmNC + CosMlMax(kCosMlGemmKC, kCosMlGemmNC))
+
+static void
+CosMlGemmMicroKernel(
+    UINT64          kc,
+    const float *   pA,
+    const float *   pB,
+    float *         pC,
+    UINT64          ldc,
+    bool            bAccumulate)
+{
+#if COS_ML_SSE2
+    __m128 c00 = _mm_setzero_ps(), c01 = _mm_setzero_ps();
+    __m128 c10 = _mm_setzero_ps(), c11 = _mm_setzero_ps();
+    __m128 c20 = _mm_setzero_ps(), c21 = _mm_setzero_ps();
+    __m128 c30 = _mm_setzero_ps(), c31 = _mm_setzero_ps();
+
+    for (UINT64 k = 0; k < kc; k++, pA += kCosMlGemmMR, pB += kCosMlGemmNR)
+    {
+        __m128 b0 = _mm_loadu_ps(pB);
+        __m128 b1 = _mm_loadu_ps(pB + 4);
+        __m128 a;
+
+        a = _mm_set1_ps(pA[0]);
+        c00 = _mm_add_ps(c00, _mm_mul_ps(a, b0));
+        c01 = _mm_add_ps(c01, _mm_mul_ps(a, b1));
+
+        a = _mm_set1_ps(pA[1]);
+        c10 = _mm_add_ps(c10, _mm_mul_ps(a, b0));
+        c11 = _mm_add_ps(c11, _mm_mul_ps(a, b1));
+
+        a = _mm_set1_ps(pA[2]);
+        c20 = _mm_add_ps(c20, _mm_mul_ps(a, b0));
+        c21 = _mm_add_ps(c21, _mm_mul_ps(a, b1));
+
+        a = _mm_set1_ps(pA[3]);
+        c30 = _mm_add_ps(c30, _mm_mul_ps(a, b0));
+        c31 = _mm_add_ps(c31, _mm_mul_ps(a, b1));
+    }
+
+    if (bAccumulate)
+    {
+        c00 = _mm_add_ps(c00, _mm_loadu_ps(pC));
+        c01 = _mm_add_ps(c01, _mm_loadu_ps(pC + 4));
+        c10 = _mm_add_ps(c10, _mm_loadu_ps(pC + ldc));
+        c11 = _mm_add_ps(c11, _mm_loadu_ps(pC + ldc + 4));
+        c20 = _mm_add_ps(c20, _mm_loadu_ps(pC + 2*ldc));
+        c21 = _mm_add_ps(c21, _mm_loadu_ps(pC + 2*ldc + 4));
+        c30 = _mm_add_ps(c30, _mm_loadu_ps(pC + 3*ldc));
+        c31 = _mm_add_ps(c31, _mm_loadu_ps(pC + 3*ldc + 4));
+    }
+
+    _mm_storeu_ps(pC, c00);
+    _mm_storeu_ps(pC + 4, c01);
+    _mm_storeu_ps(pC + ldc, c10);
+    _mm_storeu_ps(pC + ldc + 4, c11);
+    _mm_storeu_ps(pC + 2*ldc, c20);
+    _mm_storeu_ps(pC + 2*ldc + 4, c21);
+    _mm_storeu_ps(pC + 3*ldc, c30);
+    _mm_storeu_ps(pC + 3*ldc + 4, c31);
+#else
+    float c[kCosMlGemmMR][kCosMlGemmNR] = {};
+
+    for (UINT64 k = 0; k < kc; k++, pA += kCosMlGemmMR, pB += kCosMlGemmNR)
+    {
+        for (UINT r = 0; r < kCosMlGemmMR; r++)
+        {
+            for (UINT j = 0; j < kCosMlGemmNR; j++)
+            {
+                c[r][j] += pA[r]*pB[j];
+            }
+        }
+    }
+
+    for (UINT r = 0; r < kCosMlGemmMR; r++, pC += ldc)
+    {
+        for (UINT j = 0; j < kCosMlGemmNR; j++)
+        {
+            pC[j] = bAccumulate ? (pC[j] + c[r][j]) : c[r][j];
+        }
+    }
+#endif
+}
+
+static void
+CosMlGemmWorkItem(
+    void *  pContext,
+    UINT    workerIndex,
+    UINT    itemIndex)
+{
+    CosMlGemmWork * pWork = (CosMlGemmWork *)pContext;
+    const CosMlGemmProblem * pProblem = pWork->m_pProblem;
+
+    UINT64 nBlock = itemIndex % pWork->m_nBlocks;
+    UINT64 mBlock = (itemIndex / pWork->m_nBlocks) % pWork->m_mBlocks;
+    UINT64 batch = itemIndex / (pWork->m_nBlocks*pWork->m_mBlocks);
+
+    UINT64 m0 = mBlock*kCosMlGemmMC;
+    UINT64 n0 = nBlock*kCosMlGemmNC;
+    UINT64 mc = CosMlMin(kCosMlGemmMC, pProblem->m_m - m0);
+    UINT64 nc = CosMlMin(kCosMlGemmNC, pProblem->m_n - n0);
+
+    UINT64 mPanels = (mc + kCosMlGemmMR - 1)/kCosMlGemmMR;
+    UINT64 nPanels = (nc + kCosMlGemmNR - 1)/kCosMlGemmNR;
+    UINT64 ldc = nPanels*kCosMlGemmNR;
+
+    float * pPackedA = (float *)(pWork->m_pScratch + workerIndex*pWork->m_scratchPerWorker);
+    float * pPackedB = pPackedA + kCosMlGemmMC*kCosMlGemmKC;
+    float * pC = pPackedB + kCosMlGemmKC*kCosMlGemmNC;
+    float * pRow = pC + kCosMlGemmMC*kCosMlGemmNC;
+
+    if (0 == pProblem->m_k)
+    {
+        memset(pC, 0, (SIZE_T)(mPanels*kCosMlGemmMR*ldc*sizeof(float)));
+    }
+
+    for (UINT64 k0 = 0; k0 < pProblem->m_k; k0 += kCosMlGemmKC)
+    {
+        UINT64 kc = CosMlMin(kCosMlGemmKC, pProblem->m_k - k0);
+
+        //
+        // Pack B rows into NR wide panels, zero padding the last panel
+        //
+
+        for (UINT64 j = 0; pProblem->m_pfnLoadBColumn && (j < nPanels*kCosMlGemmNR); j++)
+        {
+            float * pPanel = pPackedB + (j/kCosMlGemmNR)*kCosMlGemmNR*kc + (j % kCosMlGemmNR);
+
+            if (j < nc)
+            {
+                pProblem->m_pfnLoadBColumn(pProblem->m_pContext, batch, n0 + j, k0, kc, pRow);
+            }
+            else
+            {
+                memset(pRow, 0, (SIZE_T)(kc*sizeof(float)));
+            }
+
+            for (UINT64 k = 0; k < kc; k++)
+            {
+                pPanel[k*kCosMlGemmNR] = pRow[k];
+            }
+        }
+
+        for (UINT64 k = 0; !pProblem->m_pfnLoadBColumn && (k < kc); k++)
+        {
+            pProblem->m_pfnLoadB(pProblem->m_pContext, batch, k0 + k, n0, nc, pRow);
+
+            for (UINT64 j = nc; j < nPanels*kCosMlGemmNR; j++)
+            {
+                pRow[j] = 0.0f;
+            }
+
+            for (UINT64 panel = 0; panel < nPanels; panel++)
+            {
+                memcpy(
+                    pPackedB + panel*kCosMlGemmNR*kc + k*kCosMlGemmNR,
+                    pRow + panel*kCosMlGemmNR,
+                    kCosMlGemmNR*sizeof(float));
+            }
+        }
+
+        //
+        // Pack A rows into MR tall panels, zero padding the last panel
+        //
+
+        for (UINT64 k = 0; pProblem->m_pfnLoadAColumn && (k < kc); k++)
+        {
+            pProblem->m_pfnLoadAColumn(pProblem->m_pContext, batch, k0 + k, m0, mc, pRow);
+
+            for (UINT64 i = mc; i < mPanels*kCosMlGemmMR; i++)
+            {
+                pRow[i] = 0.0f;
+            }
+
+            for (UINT64 panel = 0; panel < mPanels; panel++)
+            {
+                memcpy(
+                    pPackedA + panel*kCosMlGemmMR*kc + k*kCosMlGemmMR,
+                    pRow + panel*kCosMlGemmMR,
+                    kCosMlGemmMR*sizeof(float));
+            }
+        }
+
+        for (UINT64 i = 0; !pProblem->m_pfnLoadAColumn && (i < mPanels*kCosMlGemmMR); i++)
+        {
+            float * pPanel = pPackedA + (i/kCosMlGemmMR)*kCosMlGemmMR*kc + (i % kCosMlGemmMR);
+
+            if (i < mc)
+            {
+                pProblem->m_pfnLoadA(pProblem->m_pContext, batch, m0 + i, k0, kc, pRow);
+
+                for (UINT64 k = 0; k < kc; k++)
+                {
+                    pPanel[k*kCosMlGemmMR] = pRow[k];
+                }
+            }
+            else
+            {
+                for (UINT64 k = 0; k < kc; k++)
+                {
+                    pPanel[k*kCosMlGemmMR] = 0.0f;
+                }
+            }
+        }
+
+        for (UINT64 mPanel = 0; mPanel < mPanels; mPanel++)
+        {
+            for (UINT64 nPanel = 0; nPanel < nPanels; nPanel++)
+            {
+                CosMlGemmMicroKernel(
+                    kc,
+                    pPackedA + mPanel*kCosMlGemmMR*kc,
+                    pPackedB + nPanel*kCosMlGemmNR*kc,
+                    pC + mPanel*kCosMlGemmMR*ldc + nPanel*kCosMlGemmNR,
+                    ldc,
+                    k0 != 0);
+            }
+        }
+    }
+
+    for (UINT64 i = 0; i < mc; i++)
+    {
+        pProblem->m_pfnStore(pProblem->m_pContext, batch, m0 + i, n0, nc, pC + i*ldc);
+    }
+}
+
+static bool
+CosMlRunGemm(
+    CosMlContext *              pContext,
+    const CosMlGemmProblem *    pProblem)
+{
+    CosMlGemmWork work;
+
+    work.m_pProblem = pProblem;
+    work.m_mBlocks = (pProblem->m_m + kCosMlGemmMC - 1)/kCosMlGemmMC;
+    work.m_nBlocks = (pProblem->m_n + kCosMlGemmNC - 1)/kCosMlGemmNC;
+
+    UINT64 numItems = pProblem->m_batchCount*work.m_mBlocks*work.m_nBlocks;
+
+    if (0 == numItems)
+    {
+        return true;
+    }
+
+    if (numItems > MAXUINT)
+    {
+        return false;
+    }
+
+    work.m_scratchPerWorker = kCosMlGemmScratchFloats*sizeof(float);
+    work.m_pScratch = (BYTE *)pContext->AllocateScratch(work.m_scratchPerWorker*pContext->GetNumWorkers());
+
+    if (NULL == work.m_pScratch)
+    {
+        return false;
+    }
+
+    pContext->ParallelFor((UINT)numItems, CosMlGemmWorkItem, &work);
+
+    pContext->FreeScratch(work.m_pScratch);
+
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Normalization rows
+//
+// Shared by the normalization operator and by GEMM and convolution when a
+// normalization is fused into their store. A fused normalization is applied
+// to every output row while it is still in cache instead of a second pass
+// that reads the whole intermediate tensor back.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+struct CosMlNormalizationParameters
+{
+    const CosMlNormalizationDesc *  m_pDesc;
+
+    CosMlView                       m_mean;
+    CosMlView                       m_variance;
+    CosMlView                       m_scale;
+    CosMlView                       m_bias;
+    bool                            m_bHasScale;
+    bool                            m_bHasBias;
+
+    //
+    // Mean, variance, scale and bias are constant along W
+    //
+
+    bool                            m_bConstantRow;
+};
+
+static inline float
+CosMlLoadParameter(
+    const CosMlView *   pView,
+    UINT64              n,
+    UINT64              c,
+    UINT64              h,
+    UINT64              w)
+{
+    return CosMlLoadElement(
+            pView,
+            (INT64)n*pView->m_stride[0] + (INT64)c*pView->m_stride[1] + (INT64)h*pView->m_stride[2] + (INT64)w*pView->m_stride[3]);
+}
+
+static bool
+CosMlGetParameterView(
+    const CosMlTensor * pTensor,
+    const CosMlView *   pTarget,
+    CosMlView *         pView)
+{
+    if (1 == pTensor->m_dimensionCount)
+    {
+        return CosMlGetChannelView(pTensor, pTarget->m_size[1], pView);
+    }
+
+    return CosMlGetView(pTensor, 4, pView) && CosMlIsBroadcastable(pView, pTarget, 4);
+}
+
+static bool
+CosMlGetNormalizationParameters(
+    const CosMlNormalizationDesc *  pDesc,
+    const CosMlView *               pOut,
+    CosMlNormalizationParameters *  pParameters)
+{
+    pParameters->m_pDesc = pDesc;
+    pParameters->m_bHasScale = (NULL != pDesc->m_scale.m_pData);
+    pParameters->m_bHasBias = (NULL != pDesc->m_bias.m_pData);
+
+    if (!CosMlGetParameterView(&pDesc->m_mean, pOut, &pParameters->m_mean) ||
+        !CosMlGetParameterView(&pDesc->m_variance, pOut, &pParameters->m_variance) ||
+        (pParameters->m_bHasScale && !CosMlGetParameterView(&pDesc->m_scale, pOut, &pParameters->m_scale)) ||
+        (pParameters->m_bHasBias && !CosMlGetParameterView(&pDesc->m_bias, pOut, &pParameters->m_bias)))
+    {
+        return false;
+    }
+
+    pParameters->m_bConstantRow = true;
+
+    const CosMlView * pViews[] = { &pParameters->m_mean, &pParameters->m_variance, &pParameters->m_scale, &pParameters->m_bias };
+    const bool bPresent[] = { true, true, pParameters->m_bHasScale, pParameters->m_bHasBias };
+
+    for (UINT i = 0; i < sizeof(pViews)/sizeof(pViews[0]); i++)
+    {
+        if (bPresent[i] && (pViews[i]->m_size[3] != 1))
+        {
+            pParameters->m_bConstantRow = false;
+        }
+    }
+
+    return true;
+}
+
+//
+// Normalizes and activates count elements of row (n, c, h) starting at w in place
+//
+
+static void
+CosMlNormalizeRow(
+    const CosMlNormalizationParameters *    pParameters,
+    UINT64                                  n,
+    UINT64                                  c,
+    UINT64                                  h,
+    UINT64                                  w,
+    UINT64                                  count,
+    float *                                 pRow)
+{
+    const CosMlNormalizationDesc * pDesc = pParameters->m_pDesc;
+
+    if (pParameters->m_bConstantRow)
+    {
+        //
+        // y = a*x + b with a = scale/sqrt(variance + epsilon), b = bias - a*mean
+        //
+
+        float a = 1.0f / CosMlSqrt(CosMlLoadParameter(&pParameters->m_variance, n, c, h, 0) + pDesc->m_epsilon);
+
+        if (pParameters->m_bHasScale)
+        {
+            a *= CosMlLoadParameter(&pParameters->m_scale, n, c, h, 0);
+        }
+
+        float b = -a*CosMlLoadParameter(&pParameters->m_mean, n, c, h, 0);
+
+        if (pParameters->m_bHasBias)
+        {
+            b += CosMlLoadParameter(&pParameters->m_bias, n, c, h, 0);
+        }
+
+        UINT64 i = 0;
+
+#if COS_ML_SSE2
+        __m128 a4 = _mm_set1_ps(a);
+        __m128 b4 = _mm_set1_ps(b);
+
+        for (; i + 4 <= count; i += 4)
+        {
+            _mm_storeu_ps(pRow + i, _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(pRow + i), a4), b4));
+        }
+#endif
+
+        for (; i < count; i++)
+        {
+            pRow[i] = pRow[i]*a + b;
+        }
+    }
+    else
+    {
+        for (UINT64 i = 0; i < count; i++)
+        {
+            float a = 1.0f / CosMlSqrt(CosMlLoadParameter(&pParameters->m_variance, n, c, h, w + i) + pDesc->m_epsilon);
+
+            if (pParameters->m_bHasScale)
+            {
+                a *= CosMlLoadParameter(&pParameters->m_scale, n, c, h, w + i);
+            }
+
+            pRow[i] = (pRow[i] - CosMlLoadParameter(&pParameters->m_mean, n, c, h, w + i))*a;
+
+            if (pParameters->m_bHasBias)
+            {
+                pRow[i] += CosMlLoadParameter(&pParameters->m_bias, n, c, h, w + i);
+            }
+        }
+    }
+
+    CosMlApplyActivation(&pDesc->m_activation, pRow, count);
+}
+
+struct CosMlFusedNormalization
+{
+    CosMlNormalizationParameters    m_parameters;
+    CosMlView                       m_out;
+
+    //
+    // False when the normalization overwrites the intermediate in place
+    //
+
+    bool                            m_bStoreIntermediate;
+};
+
+static bool
+CosMlGetFusedNormalization(
+    const CosMlNormalizationDesc *  pDesc,
+    const CosMlView *               pIntermediate,
+    CosMlFusedNormalization *       pFused)
+{
+    CosMlView * pOut = &pFused->m_out;
+
+    if (!CosMlGetView(&pDesc->m_out, 4, pOut) ||
+        !CosMlGetNormalizationParameters(pDesc, pOut, &pFused->m_parameters))
+    {
+        return false;
+    }
+
+    pFused->m_bStoreIntermediate = (pOut->m_pData != pIntermediate->m_pData) || (pOut->m_dataType != pIntermediate->m_dataType);
+
+    for (UINT i = 0; i < 4; i++)
+    {
+        if (pOut->m_size[i] != pIntermediate->m_size[i])
+        {
+            return false;
+        }
+
+        if (pOut->m_stride[i] != pIntermediate->m_stride[i])
+        {
+            pFused->m_bStoreIntermediate = true;
+        }
+    }
+
+    return true;
+}
+
+//
+// Normalizes count elements of the producer's output row (n, c, h) starting
+// at w in place and stores them to the normalization output
+//
+
+static void
+CosMlStoreFusedNormalization(
+    const CosMlFusedNormalization * pFused,
+    UINT64                          n,
+    UINT64                          c,
+    UINT64                          h,
+    UINT64                          w,
+    UINT64                          count,
+    float *                         pRow)
+{
+    const CosMlView * pOut = &pFused->m_out;
+
+    CosMlNormalizeRow(&pFused->m_parameters, n, c, h, w, count, pRow);
+
+    CosMlStoreRow(
+        pOut,
+        (INT64)n*pOut->m_stride[0] + (INT64)c*pOut->m_stride[1] + (INT64)h*pOut->m_stride[2] + (INT64)w*pOut->m_stride[3],
+        pOut->m_stride[3],
+        count,
+        pRow);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// GEMM
+//
+////////////////////////////////////////////////////////////////////////////////
+
+struct CosMlGemmContext
+{
+    const CosMlGemmDesc *   m_pDesc;
+
+    CosMlView               m_a;
+    CosMlView               m_b;
+    CosMlView               m_c;
+    CosMlView               m_out;
+    bool                    m_bHasC;
+
+    UINT64                  m_batchSize1;
+
+    bool                    m_bFused;
+    CosMlFusedNormalization m_fused;
+};
+
+static inline INT64
+CosMlGemmBatchOffset(
+    const CosMlGemmContext *    pGemm,
+    const CosMlView *           pView,
+    UINT64                      batch)
+{
+    return (INT64)(batch / pGemm->m_batchSize1)*pView->m_stride[0] + (INT64)(batch % pGemm->m_batchSize1)*pView->m_stride[1];
+}
+
+static void
+CosMlGemmLoadA(
+    void *  pContext,
+    UINT64  batch,
+    UINT64  row,
+    UINT64  k0,
+    UINT64  count,
+    float * pDst)
+{
+    CosMlGemmContext * pGemm = (CosMlGemmContext *)pContext;
+    const CosMlView * pA = &pGemm->m_a;
+
+    INT64 offset = CosMlGemmBatchOffset(pGemm, pA, batch);
+
+    CosMlLoadRow(pA, offset + (INT64)row*pA->m_stride[2] + (INT64)k0*pA->m_stride[3], pA->m_stride[3], count, pDst);
+}
+
+//
+// Column "k" of A stored transposed (K x M)
+//
+
+static void
+CosMlGemmLoadAColumn(
+    void *  pContext,
+    UINT64  batch,
+    UINT64  k,
+    UINT64  m0,
+    UINT64  count,
+    float * pDst)
+{
+    CosMlGemmContext * pGemm = (CosMlGemmContext *)pContext;
+    const CosMlView * pA = &pGemm->m_a;
+
+    INT64 offset = CosMlGemmBatchOffset(pGemm, pA, batch);
+
+    CosMlLoadRow(pA, offset + (INT64)k*pA->m_stride[2] + (INT64)m0*pA->m_stride[3], pA->m_stride[3], count, pDst);
+}
+
+static void
+CosMlGemmLoadB(
+    void *  pContext,
+    UINT64  batch,
+    UINT64  k,
+    UINT64  n0,
+    UINT64  count,
+    float * pDst)
+{
+    CosMlGemmContext * pGemm = (CosMlGemmContext *)pContext;
+    const CosMlView * pB = &pGemm->m_b;
+
+    INT64 offset = CosMlGemmBatchOffset(pGemm, pB, batch);
+
+    CosMlLoadRow(pB, offset + (INT64)k*pB->m_stride[2] + (INT64)n0*pB->m_stride[3], pB->m_stride[3], count, pDst);
+}
+
+//
+// Column "n" of B stored transposed (N x K)
+//
+
+static void
+CosMlGemmLoadBColumn(
+    void *  pContext,
+    UINT64  batch,
+    UINT64  n,
+    UINT64  k0,
+    UINT64  count,
+    float * pDst)
+{
+    CosMlGemmContext * pGemm = (CosMlGemmContext *)pContext;
+    const CosMlView * pB = &pGemm->m_b;
+
+    INT64 offset = CosMlGemmBatchOffset(pGemm, pB, batch);
+
+    CosMlLoadRow(pB, offset + (INT64)n*pB->m_stride[2] + (INT64)k0*pB->m_stride[3], pB->m_stride[3], count, pDst);
+}
+
+static void
+CosMlGemmStore(
+    void *  pContext,
+    UINT64  batch,
+    UINT64  row,
+    UINT64  n0,
+    UINT64  count,
+    float * pSrc)
+{
+    CosMlGemmContext * pGemm = (CosMlGemmContext *)pContext;
+    const CosMlGemmDesc * pDesc = pGemm->m_pDesc;
+    const CosMlView * pOut = &pGemm->m_out;
+
+    UINT64 i = 0;
+
+#if COS_ML_SSE2
+    __m128 alpha = _mm_set1_ps(pDesc->m_alpha);
+
+    for (; i + 4 <= count; i += 4)
+    {
+        _mm_storeu_ps(pSrc + i, _mm_mul_ps(_mm_loadu_ps(pSrc + i), alpha));
+    }
+#endif
+
+    for (; i < count; i++)
+    {
+        pSrc[i] *= pDesc->m_alpha;
+    }
+
+    if (pGemm->m_bHasC && (0.0f != pDesc->m_beta))
+    {
+        const CosMlView * pC = &pGemm->m_c;
+        INT64 offset = CosMlGemmBatchOffset(pGemm, pC, batch) + (INT64)row*pC->m_stride[2] + (INT64)n0*pC->m_stride[3];
+
+        for (i = 0; i < count; i++, offset += pC->m_stride[3])
+        {
+            pSrc[i] += pDesc->m_beta*CosMlLoadElement(pC, offset);
+        }
+    }
+
+    CosMlApplyActivation(&pDesc->m_activation, pSrc, count);
+
+    if (!pGemm->m_bFused || pGemm->m_fused.m_bStoreIntermediate)
+    {
+        CosMlStoreRow(
+            pOut,
+            CosMlGemmBatchOffset(pGemm, pOut, batch) + (INT64)row*pOut->m_stride[2] + (INT64)n0*pOut->m_stride[3],
+            pOut->m_stride[3],
+            count,
+            pSrc);
+    }
+
+    if (pGemm->m_bFused)
+    {
+        CosMlStoreFusedNormalization(&pGemm->m_fused, batch / pGemm->m_batchSize1, batch % pGemm->m_batchSize1, row, n0, count, pSrc);
+    }
+}
+
+bool
+CosMlGemm(
+    CosMlContext *          pContext,
+    const CosMlGemmDesc *   pDesc)
+{
+    CosMlGemmContext gemm;
+
+    gemm.m_pDesc = pDesc;
+    gemm.m_bHasC = (NULL != pDesc->m_c.m_pData);
+    gemm.m_bFused = (NULL != pDesc->m_pFusedNormalization);
+
+    if (!CosMlGetView(&pDesc->m_a, 4, &gemm.m_a) ||
+        !CosMlGetView(&pDesc->m_b, 4, &gemm.m_b) ||
+        !CosMlGetView(&pDesc->m_out, 4, &gemm.m_out) ||
+        (gemm.m_bHasC && !CosMlGetView(&pDesc->m_c, 4, &gemm.m_c)) ||
+        (gemm.m_bFused && !CosMlGetFusedNormalization(pDesc->m_pFusedNormalization, &gemm.m_out, &gemm.m_fused)))
+    {
+        return false;
+    }
+
+    UINT64 m = gemm.m_out.m_size[2];
+    UINT64 n = gemm.m_out.m_size[3];
+    UINT64 k = pDesc->m_transposeA ? gemm.m_a.m_size[2] : gemm.m_a.m_size[3];
+
+    UINT64 aRows = pDesc->m_transposeA ? gemm.m_a.m_size[3] : gemm.m_a.m_size[2];
+    UINT64 bRows = pDesc->m_transposeB ? gemm.m_b.m_size[3] : gemm.m_b.m_size[2];
+    UINT64 bCols = pDesc->m_transposeB ? gemm.m_b.m_size[2] : gemm.m_b.m_size[3];
+
+    if ((aRows != m) || (bRows != k) || (bCols != n) ||
+        !CosMlIsBroadcastable(&gemm.m_a, &gemm.m_out, 2) ||
+        !CosMlIsBroadcastable(&gemm.m_b, &gemm.m_out, 2) ||
+        (gemm.m_bHasC && !CosMlIsBroadcastable(&gemm.m_c, &gemm.m_out, 4)))
+    {
+        return false;
+    }
+
+    gemm.m_batchSize1 = gemm.m_out.m_size[1];
+
+    CosMlGemmProblem problem;
+
+    problem.m_batchCount = gemm.m_out.m_size[0]*gemm.m_out.m_size[1];
+    problem.m_m = m;
+    problem.m_n = n;
+    problem.m_k = k;
+    problem.m_pContext = &gemm;
+    problem.m_pfnLoadA = pDesc->m_transposeA ? NULL : CosMlGemmLoadA;
+    problem.m_pfnLoadB = pDesc->m_transposeB ? NULL : CosMlGemmLoadB;
+    problem.m_pfnLoadAColumn = pDesc->m_transposeA ? CosMlGemmLoadAColumn : NULL;
+    problem.m_pfnLoadBColumn = pDesc->m_transposeB ? CosMlGemmLoadBColumn : NULL;
+    problem.m_pfnStore = CosMlGemmStore;
+
+    return CosMlRunGemm(pContext, &problem);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Convolution
+//
+// Implicit im2col: for every batch and group the output is the GEMM of the
+// filter (OC/G x C/G*KH*KW) with the unfolded input (C/G*KH*KW x OH*OW).
+// The unfolded input is never materialized, B rows are gathered from the
+// input while packing.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+struct CosMlConvolutionContext
+{
+    const CosMlConvolutionDesc *    m_pDesc;
+
+    CosMlView                       m_input;
+    CosMlView                       m_filter;
+    CosMlView                       m_bias;
+    CosMlView                       m_out;
+    bool                            m_bHasBias;
+
+    UINT64                          m_groupCount;
+    UINT64                          m_inChannelsPerGroup;
+    UINT64                          m_outChannelsPerGroup;
+    UINT64                          m_kernelSize;       // KH*KW
+
+    bool                            m_bFused;
+    CosMlFusedNormalization         m_fused;
+};
+
+static void
+CosMlConvolutionLoadA(
+    void *  pContext,
+    UINT64  batch,
+    UINT64  row,
+    UINT64  k0,
+    UINT64  count,
+    float * pDst)
+{
+    CosMlConvolutionContext * pConv = (CosMlConvolutionContext *)pContext;
+    const CosMlView * pFilter = &pConv->m_filter;
+
+    UINT64 outChannel = (batch % pConv->m_groupCount)*pConv->m_outChannelsPerGroup + row;
+    UINT64 kernelW = pFilter->m_size[3];
+    UINT64 kernelH = pFilter->m_size[2];
+
+    INT64 channelOffset = (INT64)outChannel*pFilter->m_stride[0];
+
+    for (UINT64 i = 0; i < count; i++)
+    {
+        UINT64 k = k0 + i;
+        UINT64 c = k / pConv->m_kernelSize;
+        UINT64 kh = (k / kernelW) % kernelH;
+        UINT64 kw = k % kernelW;
+
+        if (!pConv->m_pDesc->m_crossCorrelation)
+        {
+            kh = kernelH - 1 - kh;
+            kw = kernelW - 1 - kw;
+        }
+
+        pDst[i] = CosMlLoadElement(
+                    pFilter,
+                    channelOffset + (INT64)c*pFilter->m_stride[1] + (INT64)kh*pFilter->m_stride[2] + (INT64)kw*pFilter->m_stride[3]);
+    }
+}
+
+static void
+CosMlConvolutionLoadB(
+    void *  pContext,
+    UINT64  batch,
+    UINT64  k,
+    UINT64  n0,
+    UINT64  count,
+    float * pDst)
+{
+    CosMlConvolutionContext * pConv = (CosMlConvolutionContext *)pContext;
+    const CosMlConvolutionDesc * pDesc = pConv->m_pDesc;
+    const CosMlView * pInput = &pConv->m_input;
+
+    UINT64 kernelW = pConv->m_filter.m_size[3];
+    UINT64 kernelH = pConv->m_filter.m_size[2];
+
+    UINT64 c = k / pConv->m_kernelSize;
+    UINT64 kh = (k / kernelW) % kernelH;
+    UINT64 kw = k % kernelW;
+
+    UINT64 n = batch / pConv->m_groupCount;
+    UINT64 inChannel = (batch % pConv->m_groupCount)*pConv->m_inChannelsPerGroup + c;
+
+    INT64 inputH = (INT64)pInput->m_size[2];
+    INT64 inputW = (INT64)pInput->m_size[3];
+    UINT64 outputW = pConv->m_out.m_size[3];
+
+    INT64 planeOffset = (INT64)n*pInput->m_stride[0] + (INT64)inChannel*pInput->m_stride[1];
+
+    UINT64 oh = n0 / outputW;
+    UINT64 ow = n0 % outputW;
+
+    for (UINT64 i = 0; i < count; i++)
+    {
+        INT64 ih = (INT64)(oh*pDesc->m_stride[0] + kh*pDesc->m_dilation[0]) - (INT64)pDesc->m_startPadding[0];
+        INT64 iw = (INT64)(ow*pDesc->m_stride[1] + kw*pDesc->m_dilation[1]) - (INT64)pDesc->m_startPadding[1];
+
+        if ((ih >= 0) && (ih < inputH) && (iw >= 0) && (iw < inputW))
+        {
+            pDst[i] = CosMlLoadElement(pInput, planeOffset + ih*pInput->m_stride[2] + iw*pInput->m_stride[3]);
+        }
+        else
+        {
+            pDst[i] = 0.0f;
+        }
+
+        if (++ow == outputW)
+        {
+            ow = 0;
+            oh++;
+        }
+    }
+}
+
+static void
+CosMlConvolutionStore(
+    void *  pContext,
+    UINT64  batch,
+    UINT64  row,
+    UINT64  n0,
+    UINT64  count,
+    float * pSrc)
+{
+    CosMlConvolutionContext * pConv = (CosMlConvolutionContext *)pContext;
+    const CosMlView * pOut = &pConv->m_out;
+
+    UINT64 n = batch / pConv->m_groupCount;
+    UINT64 outChannel = (batch % pConv->m_groupCount)*pConv->m_outChannelsPerGroup + row;
+    UINT64 outputW = pOut->m_size[3];
+
+    if (pConv->m_bHasBias)
+    {
+        float bias = CosMlLoadElement(&pConv->m_bias, (INT64)outChannel*pConv->m_bias.m_stride[1]);
+        UINT64 i = 0;
+
+#if COS_ML_SSE2
+        __m128 bias4 = _mm_set1_ps(bias);
+
+        for (; i + 4 <= count; i += 4)
+        {
+            _mm_storeu_ps(pSrc + i, _mm_add_ps(_mm_loadu_ps(pSrc + i), bias4));
+        }
+#endif
+
+        for (; i < count; i++)
+        {
+            pSrc[i] += bias;
+        }
+    }
+
+    CosMlApplyActivation(&pConv->m_pDesc->m_activation, pSrc, count);
+
+    //
+    // The output row may wrap across several output rows
+    //
+
+    INT64 planeOffset = (INT64)n*pOut->m_stride[0] + (INT64)outChannel*pOut->m_stride[1];
+
+    UINT64 oh = n0 / outputW;
+    UINT64 ow = n0 % outputW;
+
+    while (count > 0)
+    {
+        UINT64 span = CosMlMin(count, outputW - ow);
+
+        if (!pConv->m_bFused || pConv->m_fused.m_bStoreIntermediate)
+        {
+            CosMlStoreRow(pOut, planeOffset + (INT64)oh*pOut->m_stride[2] + (INT64)ow*pOut->m_stride[3], pOut->m_stride[3], span, pSrc);
+        }
+
+        if (pConv->m_bFused)
+        {
+            CosMlStoreFusedNormalization(&pConv->m_fused, n, outChannel, oh, ow, span, pSrc);
+        }
+
+        pSrc += span;
+        count -= span;
+        ow = 0;
+        oh++;
+    }
+}
+
+bool
+CosMlConvolution(
+    CosMlContext *                  pContext,
+    const CosMlConvolutionDesc *    pDesc)
+{
+    CosMlConvolutionContext conv;
+
+    conv.m_pDesc = pDesc;
+    conv.m_bHasBias = (NULL != pDesc->m_bias.m_pData);
+    conv.m_bFused = (NULL != pDesc->m_pFusedNormalization);
+
+    if (!CosMlGetView(&pDesc->m_input, 4, &conv.m_input) ||
+        !CosMlGetView(&pDesc->m_filter, 4, &conv.m_filter) ||
+        !CosMlGetView(&pDesc->m_out, 4, &conv.m_out) ||
+        (conv.m_bFused && !CosMlGetFusedNormalization(pDesc->m_pFusedNormalization, &conv.m_out, &conv.m_fused)))
+    {
+        return false;
+    }
+
+    UINT64 inChannels = conv.m_input.m_size[1];
+    UINT64 outChannels = conv.m_out.m_size[1];
+
+    conv.m_groupCount = pDesc->m_groupCount ? pDesc->m_groupCount : 1;
+
+    if ((0 != inChannels % conv.m_groupCount) ||
+        (0 != outChannels % conv.m_groupCount) ||
+        (conv.m_filter.m_size[0] != outChannels) ||
+        (conv.m_filter.m_size[1] != inChannels / conv.m_groupCount) ||
+        (conv.m_out.m_size[0] != conv.m_input.m_size[0]) ||
+        (conv.m_bHasBias && !CosMlGetChannelView(&pDesc->m_bias, outChannels, &conv.m_bias)))
+    {
+        return false;
+    }
+
+    //
+    // The output must not read past the padded input
+    //
+
+    for (UINT i = 0; i < 2; i++)
+    {
+        UINT64 paddedSize = conv.m_input.m_size[2 + i] + pDesc->m_startPadding[i] + pDesc->m_endPadding[i];
+        UINT64 windowSize = (conv.m_filter.m_size[2 + i] - 1)*pDesc->m_dilation[i] + 1;
+
+        if ((0 == pDesc->m_stride[i]) ||
+            (0 == pDesc->m_dilation[i]) ||
+            (windowSize > paddedSize) ||
+            (conv.m_out.m_size[2 + i] > (paddedSize - windowSize)/pDesc->m_stride[i] + 1))
+        {
+            return false;
+        }
+    }
+
+    conv.m_inChannelsPerGroup = inChannels / conv.m_groupCount;
+    conv.m_outChannelsPerGroup = outChannels / conv.m_groupCount;
+    conv.m_kernelSize = conv.m_filter.m_size[2]*conv.m_filter.m_size[3];
+
+    CosMlGemmProblem problem;
+
+    problem.m_batchCount = conv.m_input.m_size[0]*conv.m_groupCount;
+    problem.m_m = conv.m_outChannelsPerGroup;
+    problem.m_n = conv.m_out.m_size[2]*conv.m_out.m_size[3];
+    problem.m_k = conv.m_inChannelsPerGroup*conv.m_kernelSize;
+    problem.m_pContext = &conv;
+    problem.m_pfnLoadA = CosMlConvolutionLoadA;
+    problem.m_pfnLoadB = CosMlConvolutionLoadB;
+    problem.m_pfnLoadAColumn = NULL;
+    problem.m_pfnLoadBColumn = NULL;
+    problem.m_pfnStore = CosMlConvolutionStore;
+
+    return CosMlRunGemm(pContext, &problem);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Pooling
+//
+// Work items are output rows. The input rows under the window are combined
+// (max or sum) into a single padded FP32 column row first, 4 columns at a
+// time, which leaves only a 1 x windowW pass per output element.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+struct CosMlPoolingContext
+{
+    const CosMlPoolingDesc *    m_pDesc;
+
+    CosMlView                   m_input;
+    CosMlView                   m_out;
+
+    UINT64                      m_columnWidth;      // padded input row
+    UINT64                      m_rowsPerItem;
+    UINT64                      m_numRows;          // N*C*OH
+
+    BYTE *                      m_pScratch;
+    SIZE_T                      m_scratchPerWorker;
+};
+
+static void
+CosMlPoolingWorkItem(
+    void *  pContext,
+    UINT    workerIndex,
+    UINT    itemIndex)
+{
+    CosMlPoolingContext * pPool = (CosMlPoolingContext *)pContext;
+    const CosMlPoolingDesc * pDesc = pPool->m_pDesc;
+    const CosMlView * pInput = &pPool->m_input;
+    const CosMlView * pOut = &pPool->m_out;
+
+    UINT64 windowH = pDesc->m_windowSize[0];
+    UINT64 windowW = pDesc->m_windowSize[1];
+    UINT64 inputH = pInput->m_size[2];
+    UINT64 inputW = pInput->m_size[3];
+    UINT64 outputH = pOut->m_size[2];
+    UINT64 outputW = pOut->m_size[3];
+    UINT64 channels = pOut->m_size[1];
+    UINT64 strideW = pDesc->m_stride[1];
+    UINT64 padW = pDesc->m_startPadding[1];
+
+    bool bMax = (CosMlPoolingMax == pDesc->m_function);
+
+    float * pColumn = (float *)(pPool->m_pScratch + workerIndex*pPool->m_scratchPerWorker);
+    float * pRow = pColumn + CosMlAlignUp(pPool->m_columnWidth, 4);
+    float * pResult = pRow + CosMlAlignUp(inputW, 4);
+
+    float padValue = bMax ? -kCosMlFloatInfinity : 0.0f;
+
+    UINT64 firstRow = (UINT64)itemIndex*pPool->m_rowsPerItem;
+    UINT64 endRow = CosMlMin(firstRow + pPool->m_rowsPerItem, pPool->m_numRows);
+
+    for (UINT64 outRow = firstRow; outRow < endRow; outRow++)
+    {
+        UINT64 oh = outRow % outputH;
+        UINT64 c = (outRow / outputH) % channels;
+        UINT64 n = outRow / (outputH*channels);
+
+        INT64 inputPlane = (INT64)n*pInput->m_stride[0] + (INT64)c*pInput->m_stride[1];
+        UINT64 validRows = 0;
+
+        //
+        // Combine the window rows, padding rows and columns hold a value that
+        // doesn't change the result
+        //
+
+        for (UINT64 i = 0; i < pPool->m_columnWidth; i++)
+        {
+            pColumn[i] = padValue;
+        }
+
+        for (UINT64 kh = 0; kh < windowH; kh++)
+        {
+            INT64 ih = (INT64)(oh*pDesc->m_stride[0] + kh) - (INT64)pDesc->m_startPadding[0];
+
+            if ((ih < 0) || (ih >= (INT64)inputH))
+            {
+                continue;
+            }
+
+            CosMlLoadRow(pInput, inputPlane + ih*pInput->m_stride[2], pInput->m_stride[3], inputW, pRow);
+            validRows++;
+
+            if (CosMlPoolingLp == pDesc->m_function)
+            {
+                for (UINT64 i = 0; i < inputW; i++)
+                {
+                    pRow[i] = CosMlPow(CosMlAbs(pRow[i]), pDesc->m_p);
+                }
+            }
+
+            float * pDst = pColumn + padW;
+            UINT64 i = 0;
+
+#if COS_ML_SSE2
+            for (; i + 4 <= inputW; i += 4)
+            {
+                __m128 x = _mm_loadu_ps(pRow + i);
+                __m128 acc = _mm_loadu_ps(pDst + i);
+
+                _mm_storeu_ps(pDst + i, bMax ? _mm_max_ps(acc, x) : _mm_add_ps(acc, x));
+            }
+#endif
+
+            for (; i < inputW; i++)
+            {
+                pDst[i] = bMax ? ((pRow[i] > pDst[i]) ? pRow[i] : pDst[i]) : pDst[i] + pRow[i];
+            }
+        }
+
+        UINT64 ow = 0;
+
+#if COS_ML_SSE2
+        if (1 == strideW)
+        {
+            for (; ow + 4 <= outputW; ow += 4)
+            {
+                __m128 acc = _mm_loadu_ps(pColumn + ow);
+
+                for (UINT64 kw = 1; kw < windowW; kw++)
+                {
+                    __m128 x = _mm_loadu_ps(pColumn + ow + kw);
+
+                    acc = bMax ? _mm_max_ps(acc, x) : _mm_add_ps(acc, x);
+                }
+
+                _mm_storeu_ps(pResult + ow, acc);
+            }
+        }
+#endif
+
+        for (; ow < outputW; ow++)
+        {
+            const float * pWindow = pColumn + ow*strideW;
+            float acc = pWindow[0];
+
+            for (UINT64 kw = 1; kw < windowW; kw++)
+            {
+                acc = bMax ? ((pWindow[kw] > acc) ? pWindow[kw] : acc) : acc + pWindow[kw];
+            }
+
+            pResult[ow] = acc;
+        }
+
+        for (ow = 0; ow < outputW; ow++)
+        {
+            if (CosMlPoolingAverage == pDesc->m_function)
+            {
+                UINT64 divisor = windowH*windowW;
+
+                if (!pDesc->m_includePadding)
+                {
+                    INT64 iw = (INT64)(ow*strideW) - (INT64)padW;
+                    INT64 validStart = (iw < 0) ? 0 : iw;
+                    INT64 validEnd = iw + (INT64)windowW;
+
+                    if (validEnd > (INT64)inputW)
+                    {
+                        validEnd = (INT64)inputW;
+                    }
+
+                    divisor = validRows*(UINT64)((validEnd > validStart) ? (validEnd - validStart) : 0);
+                }
+
+                pResult[ow] = divisor ? pResult[ow] / (float)divisor : 0.0f;
+            }
+            else if (CosMlPoolingLp == pDesc->m_function)
+            {
+                if (2 == pDesc->m_p)
+                {
+                    pResult[ow] = CosMlSqrt(pResult[ow]);
+                }
+                else if ((pDesc->m_p > 1) && (pResult[ow] > 0.0f))
+                {
+                    pResult[ow] = CosMlExp(CosMlLog(pResult[ow]) / (float)pDesc->m_p);
+                }
+            }
+        }
+
+        CosMlApplyActivation(&pDesc->m_activation, pResult, outputW);
+
+        CosMlStoreRow(
+            pOut,
+            (INT64)n*pOut->m_stride[0] + (INT64)c*pOut->m_stride[1] + (INT64)oh*pOut->m_stride[2],
+            pOut->m_stride[3],
+            outputW,
+            pResult);
+    }
+}
+
+bool
+CosMlPooling(
+    CosMlContext *              pContext,
+    const CosMlPoolingDesc *    pDesc)
+{
+    CosMlPoolingContext pool;
+
+    pool.m_pDesc = pDesc;
+
+    if (!CosMlGetView(&pDesc->m_input, 4, &pool.m_input) ||
+        !CosMlGetView(&pDesc->m_out, 4, &pool.m_out) ||
+        (pool.m_input.m_size[0] != pool.m_out.m_size[0]) ||
+        (pool.m_input.m_size[1] != pool.m_out.m_size[1]) ||
+        ((CosMlPoolingLp == pDesc->m_function) && (0 == pDesc->m_p)))
+    {
+        return false;
+    }
+
+    for (UINT i = 0; i < 2; i++)
+    {
+        UINT64 paddedSize = pool.m_input.m_size[2 + i] + pDesc->m_startPadding[i] + pDesc->m_endPadding[i];
+
+        if ((0 == pDesc->m_stride[i]) ||
+            (0 == pDesc->m_windowSize[i]) ||
+            (pDesc->m_windowSize[i] > paddedSize) ||
+            (pool.m_out.m_size[2 + i] > (paddedSize - pDesc->m_windowSize[i])/pDesc->m_stride[i] + 1))
+        {
+            return false;
+        }
+    }
+
+    UINT64 outputW = pool.m_out.m_size[3];
+
+    //
+    // Room for the widest window position plus slack for the last 4 wide load
+    //
+
+    pool.m_columnWidth = CosMlMax(
+                            pool.m_input.m_size[3] + pDesc->m_startPadding[1] + pDesc->m_endPadding[1],
+                            (outputW - 1)*pDesc->m_stride[1] + pDesc->m_windowSize[1]) + 4;
+
+    pool.m_numRows = pool.m_out.m_size[0]*pool.m_out.m_size[1]*pool.m_out.m_size[2];
+    pool.m_rowsPerItem = CosMlGetChunkSize(pContext, pool.m_numRows);
+
+    pool.m_scratchPerWorker = (SIZE_T)((CosMlAlignUp(pool.m_columnWidth, 4) + CosMlAlignUp(pool.m_input.m_size[3], 4) + CosMlAlignUp(outputW, 4))*sizeof(float));
+    pool.m_pScratch = (BYTE *)pContext->AllocateScratch(pool.m_scratchPerWorker*pContext->GetNumWorkers());
+
+    if (NULL == pool.m_pScratch)
+    {
+        return false;
+    }
+
+    pContext->ParallelFor(
+        (UINT)((pool.m_numRows + pool.m_rowsPerItem - 1)/pool.m_rowsPerItem),
+        CosMlPoolingWorkItem,
+        &pool);
+
+    pContext->FreeScratch(pool.m_pScratch);
+
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Normalization (inference batch norm)
+//
+////////////////////////////////////////////////////////////////////////////////
+
+struct CosMlNormalizationContext
+{
+    CosMlNormalizationParameters    m_parameters;
+
+    CosMlView                       m_input;
+    CosMlView                       m_out;
+
+    UINT64                          m_planesPerItem;
+    UINT64                          m_numPlanes;
+
+    BYTE *                          m_pScratch;
+    SIZE_T                          m_scratchPerWorker;
+};
+
+static void
+CosMlNormalizationWorkItem(
+    void *  pContext,
+    UINT    workerIndex,
+    UINT    itemIndex)
+{
+    CosMlNormalizationContext * pNorm = (CosMlNormalizationContext *)pContext;
+    const CosMlView * pInput = &pNorm->m_input;
+    const CosMlView * pOut = &pNorm->m_out;
+
+    UINT64 channels = pOut->m_size[1];
+    UINT64 height = pOut->m_size[2];
+    UINT64 width = pOut->m_size[3];
+
+    float * pRow = (float *)(pNorm->m_pScratch + workerIndex*pNorm->m_scratchPerWorker);
+
+    UINT64 firstPlane = (UINT64)itemIndex*pNorm->m_planesPerItem;
+    UINT64 endPlane = CosMlMin(firstPlane + pNorm->m_planesPerItem, pNorm->m_numPlanes);
+
+    for (UINT64 plane = firstPlane; plane < endPlane; plane++)
+    {
+        UINT64 c = plane % channels;
+        UINT64 n = plane / channels;
+
+        for (UINT64 h = 0; h < height; h++)
+        {
+            CosMlLoadRow(
+                pInput,
+                (INT64)n*pInput->m_stride[0] + (INT64)c*pInput->m_stride[1] + (INT64)h*pInput->m_stride[2],
+                pInput->m_stride[3],
+                width,
+                pRow);
+
+            CosMlNormalizeRow(&pNorm->m_parameters, n, c, h, 0, width, pRow);
+
+            CosMlStoreRow(
+                pOut,
+                (INT64)n*pOut->m_stride[0] + (INT64)c*pOut->m_stride[1] + (INT64)h*pOut->m_stride[2],
+                pOut->m_stride[3],
+                width,
+                pRow);
+        }
+    }
+}
+
+bool
+CosMlNormalization(
+    CosMlContext *                  pContext,
+    const CosMlNormalizationDesc *  pDesc)
+{
+    CosMlNormalizationContext norm;
+
+    if (!CosMlGetView(&pDesc->m_input, 4, &norm.m_input) ||
+        !CosMlGetView(&pDesc->m_out, 4, &norm.m_out) ||
+        !CosMlIsBroadcastable(&norm.m_input, &norm.m_out, 4) ||
+        !CosMlGetNormalizationParameters(pDesc, &norm.m_out, &norm.m_parameters))
+    {
+        return false;
+    }
+
+    norm.m_numPlanes = norm.m_out.m_size[0]*norm.m_out.m_size[1];
+    norm.m_planesPerItem = CosMlGetChunkSize(pContext, norm.m_numPlanes);
+
+    norm.m_scratchPerWorker = (SIZE_T)(norm.m_out.m_size[3]*sizeof(float));
+    norm.m_pScratch = (BYTE *)pContext->AllocateScratch(norm.m_scratchPerWorker*pContext->GetNumWorkers());
+
+    if (NULL == norm.m_pScratch)
+    {
+        return false;
+    }
+
+    pContext->ParallelFor(
+        (UINT)((norm.m_numPlanes + norm.m_planesPerItem - 1)/norm.m_planesPerItem),
+        CosMlNormalizationWorkItem,
+        &norm);
+
+    pContext->FreeScratch(norm.m_pScratch);
+
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Mean variance normalization
+//
+////////////////////////////////////////////////////////////////////////////////
+
+struct CosMlMvnContext
+{
+    const CosMlMvnDesc *    m_pDesc;
+
+    CosMlView               m_input;
+    CosMlView               m_scale;
+    CosMlView               m_bias;
+    CosMlView               m_out;
+    bool                    m_bHasScale;
+    bool                    m_bHasBias;
+
+    UINT64                  m_channelsPerItem;      // C or 1
+
+    BYTE *                  m_pScratch;
+    SIZE_T                  m_scratchPerWorker;
+};
+
+static float
+CosMlSumRow(
+    const float *   pRow,
+    UINT64          count,
+    float *         pSumSquares)
+{
+    UINT64 i = 0;
+
+#if COS_ML_SSE2
+    __m128 sum = _mm_setzero_ps();
+    __m128 sumSquares = _mm_setzero_ps();
+
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128 x = _mm_loadu_ps(pRow + i);
+
+        sum = _mm_add_ps(sum, x);
+        sumSquares = _mm_add_ps(sumSquares, _mm_mul_ps(x, x));
+    }
+
+    float partial[4];
+    float partialSquares[4];
+
+    _mm_storeu_ps(partial, sum);
+    _mm_storeu_ps(partialSquares, sumSquares);
+
+    float result = partial[0] + partial[1] + partial[2] + partial[3];
+    float resultSquares = partialSquares[0] + partialSquares[1] + partialSquares[2] + partialSquares[3];
+#else
+    float result = 0.0f;
+    float resultSquares = 0.0f;
+#endif
+
+    for (; i < count; i++)
+    {
+        result += pRow[i];
+        resultSquares += pRow[i]*pRow[i];
+    }
+
+    *pSumSquares = resultSquares;
+
+    return result;
+}
+
+static void
+CosMlMvnWorkItem(
+    void *  pContext,
+    UINT    workerIndex,
+    UINT    itemIndex)
+{
+    CosMlMvnContext * pMvn = (CosMlMvnContext *)pContext;
+    const CosMlMvnDesc * pDesc = pMvn->m_pDesc;
+    const CosMlView * pInput = &pMvn->m_input;
+    const CosMlView * pOut = &pMvn->m_out;
+
+    UINT64 channels = pOut->m_size[1];
+    UINT64 height = pOut->m_size[2];
+    UINT64 width = pOut->m_size[3];
+
+    UINT64 itemsPerBatch = channels / pMvn->m_channelsPerItem;
+    UINT64 n = itemIndex / itemsPerBatch;
+    UINT64 firstChannel = (itemIndex % itemsPerBatch)*pMvn->m_channelsPerItem;
+    UINT64 endChannel = firstChannel + pMvn->m_channelsPerItem;
+
+    float * pRow = (float *)(pMvn->m_pScratch + workerIndex*pMvn->m_scratchPerWorker);
+
+    //
+    // Row sums are accumulated in double to keep large planes accurate
+    //
+
+    double sum = 0.0;
+    double sumSquares = 0.0;
+
+    for (UINT64 c = firstChannel; c < endChannel; c++)
+    {
+        for (UINT64 h = 0; h < height; h++)
+        {
+            float rowSquares;
+
+            CosMlLoadRow(
+                pInput,
+                (INT64)n*pInput->m_stride[0] + (INT64)c*pInput->m_stride[1] + (INT64)h*pInput->m_stride[2],
+                pInput->m_stride[3],
+                width,
+                pRow);
+
+            sum += CosMlSumRow(pRow, width, &rowSquares);
+            sumSquares += rowSquares;
+        }
+    }
+
+    double count = (double)(pMvn->m_channelsPerItem*height*width);
+    double mean = sum / count;
+    double variance = sumSquares / count - mean*mean;
+
+    float scale = 1.0f;
+
+    if (pDesc->m_normalizeVariance)
+    {
+        scale = 1.0f / CosMlSqrt((float)((variance > 0.0) ? variance : 0.0) + pDesc->m_epsilon);
+    }
+
+    for (UINT64 c = firstChannel; c < endChannel; c++)
+    {
+        float a = scale;
+        float b = -(float)mean*scale;
+
+        if (pMvn->m_bHasScale)
+        {
+            float channelScale = CosMlLoadParameter(&pMvn->m_scale, n, c, 0, 0);
+
+            a *= channelScale;
+            b *= channelScale;
+        }
+
+        if (pMvn->m_bHasBias)
+        {
+            b += CosMlLoadParameter(&pMvn->m_bias, n, c, 0, 0);
+        }
+
+#if COS_ML_SSE2
+        __m128 a4 = _mm_set1_ps(a);
+        __m128 b4 = _mm_set1_ps(b);
+#endif
+
+        for (UINT64 h = 0; h < height; h++)
+        {
+            CosMlLoadRow(
+                pInput,
+                (INT64)n*pInput->m_stride[0] + (INT64)c*pInput->m_stride[1] + (INT64)h*pInput->m_stride[2],
+                pInput->m_stride[3],
+                width,
+                pRow);
+
+            UINT64 w = 0;
+
+#if COS_ML_SSE2
+            for (; w + 4 <= width; w += 4)
+            {
+                _mm_storeu_ps(pRow + w, _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(pRow + w), a4), b4));
+            }
+#endif
+
+            for (; w < width; w++)
+            {
+                pRow[w] = pRow[w]*a + b;
+            }
+
+            CosMlApplyActivation(&pDesc->m_activation, pRow, width);
+
+            CosMlStoreRow(
+                pOut,
+                (INT64)n*pOut->m_stride[0] + (INT64)c*pOut->m_stride[1] + (INT64)h*pOut->m_stride[2],
+                pOut->m_stride[3],
+                width,
+                pRow);
+        }
+    }
+}
+
+bool
+CosMlMvn(
+    CosMlContext *          pContext,
+    const CosMlMvnDesc *    pDesc)
+{
+    CosMlMvnContext mvn;
+
+    mvn.m_pDesc = pDesc;
+    mvn.m_bHasScale = (NULL != pDesc->m_scale.m_pData);
+    mvn.m_bHasBias = (NULL != pDesc->m_bias.m_pData);
+
+    if (!CosMlGetView(&pDesc->m_input, 4, &mvn.m_input) ||
+        !CosMlGetView(&pDesc->m_out, 4, &mvn.m_out) ||
+        !CosMlIsBroadcastable(&mvn.m_input, &mvn.m_out, 4) ||
+        (mvn.m_bHasScale && !CosMlGetChannelView(&pDesc->m_scale, mvn.m_out.m_size[1], &mvn.m_scale)) ||
+        (mvn.m_bHasBias && !CosMlGetChannelView(&pDesc->m_bias, mvn.m_out.m_size[1], &mvn.m_bias)))
+    {
+        return false;
+    }
+
+    mvn.m_channelsPerItem = pDesc->m_acrossChannels ? mvn.m_out.m_size[1] : 1;
+
+    UINT64 numItems = mvn.m_out.m_size[0]*(mvn.m_out.m_size[1] / mvn.m_channelsPerItem);
+
+    if (numItems > MAXUINT)
+    {
+        return false;
+    }
+
+    mvn.m_scratchPerWorker = (SIZE_T)(mvn.m_out.m_size[3]*sizeof(float));
+    mvn.m_pScratch = (BYTE *)pContext->AllocateScratch(mvn.m_scratchPerWorker*pContext->GetNumWorkers());
+
+    if (NULL == mvn.m_pScratch)
+    {
+        return false;
+    }
+
+    pContext->ParallelFor((UINT)numItems, CosMlMvnWorkItem, &mvn);
+
+    pContext->FreeScratch(mvn.m_pScratch);
+
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Reduction
+//
+// Every output element reduces the sub-tensor spanned by the reduced
+// dimensions. The innermost reduced dimension is loaded as a row and
+// reduced with SSE where the function allows it.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+struct CosMlReductionContext
+{
+    const CosMlReductionDesc *  m_pDesc;
+
+    CosMlView                   m_input;
+    CosMlView                   m_out;
+
+    bool                        m_bReduced[kCosMlMaxDimensions];
+    UINT                        m_rowDimension;     // innermost reduced dimension
+    UINT64                      m_reducedCount;     // elements per output element
+
+    UINT64                      m_numOutputs;
+    UINT64                      m_outputsPerItem;
+
+    BYTE *                      m_pScratch;
+    SIZE_T                      m_scratchPerWorker;
+};
+
+struct CosMlReductionState
+{
+    double  m_sum;
+    float   m_product;
+    float   m_extreme;
+    UINT64  m_extremeIndex;
+    float   m_max;              // for LogSumExp
+};
+
+static void
+CosMlReduceRow(
+    CosMlReductionFunction  function,
+    const float *           pRow,
+    UINT64                  count,
+    UINT64                  firstIndex,
+    CosMlReductionState *   pState)
+{
+    UINT64 i = 0;
+
+    switch (function)
+    {
+    case CosMlReductionAverage:
+    case CosMlReductionSum:
+    case CosMlReductionLogSum:
+    case CosMlReductionL1:
+    case CosMlReductionL2:
+    case CosMlReductionSumSquare:
+        {
+#if COS_ML_SSE2
+            __m128 sum = _mm_setzero_ps();
+            __m128 signMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+            float partial[4];
+
+            for (; i + 4 <= count; i += 4)
+            {
+                __m128 x = _mm_loadu_ps(pRow + i);
+
+                if (CosMlReductionL1 == function)
+                {
+                    x = _mm_and_ps(x, signMask);
+                }
+                else if ((CosMlReductionL2 == function) || (CosMlReductionSumSquare == function))
+                {
+                    x = _mm_mul_ps(x, x);
+                }
+
+                sum = _mm_add_ps(sum, x);
+            }
+
+            _mm_storeu_ps(partial, sum);
+
+            float rowSum = partial[0] + partial[1] + partial[2] + partial[3];
+#else
+            float rowSum = 0.0f;
+#endif
+
+            for (; i < count; i++)
+            {
+                float x = pRow[i];
+
+                if (CosMlReductionL1 == function)
+                {
+                    x = CosMlAbs(x);
+                }
+                else if ((CosMlReductionL2 == function) || (CosMlReductionSumSquare == function))
+                {
+                    x = x*x;
+                }
+
+                rowSum += x;
+            }
+
+            pState->m_sum += rowSum;
+        }
+        break;
+
+    case CosMlReductionLogSumExp:
+        {
+#if COS_ML_SSE2
+            __m128 sum = _mm_setzero_ps();
+            __m128 max = _mm_set1_ps(pState->m_max);
+            float partial[4];
+
+            for (; i + 4 <= count; i += 4)
+            {
+                sum = _mm_add_ps(sum, CosMlExp4(_mm_sub_ps(_mm_loadu_ps(pRow + i), max)));
+            }
+
+            _mm_storeu_ps(partial, sum);
+
+            pState->m_sum += partial[0] + partial[1] + partial[2] + partial[3];
+#endif
+
+            for (; i < count; i++)
+            {
+                pState->m_sum += CosMlExp(pRow[i] - pState->m_max);
+            }
+        }
+        break;
+
+    case CosMlReductionMultiply:
+        for (; i < count; i++)
+        {
+            pState->m_product *= pRow[i];
+        }
+        break;
+
+    case CosMlReductionMax:
+    case CosMlReductionMin:
+        {
+            bool bMax = (CosMlReductionMax == function);
+
+#if COS_ML_SSE2
+            __m128 extreme = _mm_set1_ps(pState->m_extreme);
+            float partial[4];
+
+            for (; i + 4 <= count; i += 4)
+            {
+                __m128 x = _mm_loadu_ps(pRow + i);
+
+                extreme = bMax ? _mm_max_ps(extreme, x) : _mm_min_ps(extreme, x);
+            }
+
+            _mm_storeu_ps(partial, extreme);
+
+            for (UINT j = 0; j < 4; j++)
+            {
+                pState->m_extreme = bMax ? ((partial[j] > pState->m_extreme) ? partial[j] : pState->m_extreme) :
+                                           ((partial[j] < pState->m_extreme) ? partial[j] : pState->m_extreme);
+            }
+#endif
+
+            for (; i < count; i++)
+            {
+                pState->m_extreme = bMax ? ((pRow[i] > pState->m_extreme) ? pRow[i] : pState->m_extreme) :
+                                           ((pRow[i] < pState->m_extreme) ? pRow[i] : pState->m_extreme);
+            }
+        }
+        break;
+
+    case CosMlReductionArgMax:
+    case CosMlReductionArgMin:
+        for (; i < count; i++)
+        {
+            bool bBetter = (CosMlReductionArgMax == function) ? (pRow[i] > pState->m_extreme) : (pRow[i] < pState->m_extreme);
+
+            if (bBetter || (MAXUINT64 == pState->m_extremeIndex))
+            {
+                pState->m_extreme = pRow[i];
+                pState->m_extremeIndex = firstIndex + i;
+            }
+        }
+        break;
+    }
+}
+
+//
+// Runs pfnRow over every row of the reduced sub-tensor of the output element
+// at pOutIndex
+//
+
+static void
+CosMlReductionForEachRow(
+    CosMlReductionContext *     pReduction,
+    const UINT64 *              pOutIndex,
+    float *                     pRow,
+    CosMlReductionFunction      function,
+    CosMlReductionState *       pState)
+{
+    const CosMlView * pInput = &pReduction->m_input;
+    UINT rowDim = pReduction->m_rowDimension;
+    UINT64 rowLength = pInput->m_size[rowDim];
+
+    UINT64 index[kCosMlMaxDimensions];
+
+    for (UINT d = 0; d < kCosMlMaxDimensions; d++)
+    {
+        index[d] = pReduction->m_bReduced[d] ? 0 : pOutIndex[d];
+    }
+
+    UINT64 rowNumber = 0;
+
+    for (;;)
+    {
+        INT64 offset = 0;
+
+        for (UINT d = 0; d < kCosMlMaxDimensions; d++)
+        {
+            offset += (INT64)index[d]*pInput->m_stride[d];
+        }
+
+        CosMlLoadRow(pInput, offset, pInput->m_stride[rowDim], rowLength, pRow);
+        CosMlReduceRow(function, pRow, rowLength, rowNumber*rowLength, pState);
+
+        rowNumber++;
+
+        //
+        // Advance the reduced dimensions outside the row dimension
+        //
+
+        UINT d = rowDim;
+
+        for (;;)
+        {
+            if (0 == d)
+            {
+                return;
+            }
+
+            d--;
+
+            if (!pReduction->m_bReduced[d])
+            {
+                continue;
+            }
+
+            if (++index[d] < pInput->m_size[d])
+            {
+                break;
+            }
+
+            index[d] = 0;
+        }
+    }
+}
+
+static void
+CosMlReductionWorkItem(
+    void *  pContext,
+    UINT    workerIndex,
+    UINT    itemIndex)
+{
+    CosMlReductionContext * pReduction = (CosMlReductionContext *)pContext;
+    CosMlReductionFunction function = pReduction->m_pDesc->m_function;
+    const CosMlView * pOut = &pReduction->m_out;
+
+    float * pRow = (float *)(pReduction->m_pScratch + workerIndex*pReduction->m_scratchPerWorker);
+
+    UINT64 firstOutput = (UINT64)itemIndex*pReduction->m_outputsPerItem;
+    UINT64 endOutput = CosMlMin(firstOutput + pReduction->m_outputsPerItem, pReduction->m_numOutputs);
+
+    for (UINT64 output = firstOutput; output < endOutput; output++)
+    {
+        UINT64 outIndex[kCosMlMaxDimensions];
+        UINT64 remainder = output;
+        INT64 outOffset = 0;
+
+        for (UINT d = kCosMlMaxDimensions; d-- > 0;)
+        {
+            outIndex[d] = remainder % pOut->m_size[d];
+            remainder /= pOut->m_size[d];
+            outOffset += (INT64)outIndex[d]*pOut->m_stride[d];
+        }
+
+        CosMlReductionState state;
+
+        state.m_sum = 0.0;
+        state.m_product = 1.0f;
+        state.m_extreme = (CosMlReductionMax == function) ? -kCosMlFloatInfinity : kCosMlFloatInfinity;
+        state.m_extremeIndex = MAXUINT64;
+        state.m_max = -kCosMlFloatInfinity;
+
+        if (CosMlReductionLogSumExp == function)
+        {
+            //
+            // Shift by the maximum so exp() can't overflow
+            //
+
+            CosMlReductionState maxState = state;
+
+            maxState.m_extreme = -kCosMlFloatInfinity;
+
+            CosMlReductionForEachRow(pReduction, outIndex, pRow, CosMlReductionMax, &maxState);
+
+            state.m_max = maxState.m_extreme;
+        }
+
+        CosMlReductionForEachRow(pReduction, outIndex, pRow, function, &state);
+
+        float result;
+
+        switch (function)
+        {
+        case CosMlReductionArgMax:
+        case CosMlReductionArgMin:
+            if (CosMlDataTypeUInt32 == pOut->m_dataType)
+            {
+                ((UINT *)pOut->m_pData)[outOffset] = (UINT)state.m_extremeIndex;
+                continue;
+            }
+            result = (float)state.m_extremeIndex;
+            break;
+        case CosMlReductionAverage:
+            result = (float)(state.m_sum / (double)pReduction->m_reducedCount);
+            break;
+        case CosMlReductionL2:
+            result = CosMlSqrt((float)state.m_sum);
+            break;
+        case CosMlReductionLogSum:
+            result = CosMlLog((float)state.m_sum);
+            break;
+        case CosMlReductionLogSumExp:
+            result = CosMlLog((float)state.m_sum) + state.m_max;
+            break;
+        case CosMlReductionMax:
+        case CosMlReductionMin:
+            result = state.m_extreme;
+            break;
+        case CosMlReductionMultiply:
+            result = state.m_product;
+            break;
+        default:
+            result = (float)state.m_sum;
+            break;
+        }
+
+        CosMlStoreElement(pOut, outOffset, result);
+    }
+}
+
+bool
+CosMlReduction(
+    CosMlContext *              pContext,
+    const CosMlReductionDesc *  pDesc)
+{
+    CosMlReductionContext reduction;
+
+    reduction.m_pDesc = pDesc;
+
+    if (!CosMlGetView(&pDesc->m_input, kCosMlMaxDimensions, &reduction.m_input) ||
+        !CosMlGetView(&pDesc->m_out, kCosMlMaxDimensions, &reduction.m_out))
+    {
+        return false;
+    }
+
+    reduction.m_rowDimension = kCosMlMaxDimensions - 1;
+    reduction.m_reducedCount = 1;
+    reduction.m_numOutputs = 1;
+
+    bool bAnyReduced = false;
+
+    for (UINT d = 0; d < kCosMlMaxDimensions; d++)
+    {
+        UINT64 inSize = reduction.m_input.m_size[d];
+        UINT64 outSize = reduction.m_out.m_size[d];
+
+        reduction.m_bReduced[d] = (1 == outSize) && (inSize > 1);
+
+        if (!reduction.m_bReduced[d] && (inSize != outSize))
+        {
+            return false;
+        }
+
+        if (reduction.m_bReduced[d])
+        {
+            reduction.m_rowDimension = d;
+            reduction.m_reducedCount *= inSize;
+            bAnyReduced = true;
+        }
+
+        reduction.m_numOutputs *= outSize;
+    }
+
+    if (!bAnyReduced)
+    {
+        //
+        // Nothing to reduce, every output element reduces a single input
+        // element. Treat the innermost dimension as the (length 1) row.
+        //
+
+        reduction.m_bReduced[kCosMlMaxDimensions - 1] = true;
+    }
+
+    reduction.m_outputsPerItem = CosMlGetChunkSize(pContext, reduction.m_numOutputs);
+
+    reduction.m_scratchPerWorker = (SIZE_T)(reduction.m_input.m_size[reduction.m_rowDimension]*sizeof(float));
+    reduction.m_pScratch = (BYTE *)pContext->AllocateScratch(reduction.m_scratchPerWorker*pContext->GetNumWorkers());
+
+    if (NULL == reduction.m_pScratch)
+    {
+        return false;
+    }
+
+    pContext->ParallelFor(
+        (UINT)((reduction.m_numOutputs + reduction.m_outputsPerItem - 1)/reduction.m_outputsPerItem),
+        CosMlReductionWorkItem,
+        &reduction);
+
+    pContext->FreeScratch(reduction.m_pScratch);
+
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Recurrent networks
+//
+// The input projections of all timesteps do not depend on the hidden state,
+// they run up front through the GEMM core as one T*B x G*H x I product per
+// direction with the biases folded in. The recurrent part then walks the
+// timesteps for blocks of kCosMlGemmMR batch entries, multiplying the hidden
+// state with recurrence weights packed once into NR wide panels. Batch
+// blocks and directions are independent and run in parallel.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+struct CosMlRecurrentContext
+{
+    const CosMlRecurrentDesc *  m_pDesc;
+
+    CosMlView                   m_input;
+    CosMlView                   m_weight;
+    CosMlView                   m_recurrence;
+    CosMlView                   m_bias;
+    CosMlView                   m_hiddenInit;
+    CosMlView                   m_cellInit;
+    CosMlView                   m_seqLengths;
+    CosMlView                   m_peephole;
+    CosMlView                   m_outSingle;
+    CosMlView                   m_outSequence;
+    CosMlView                   m_outCellSingle;
+
+    UINT64                      m_seqLength;
+    UINT64                      m_batchSize;
+    UINT64                      m_inputSize;
+    UINT64                      m_hiddenSize;
+    UINT64                      m_numGates;
+    UINT64                      m_numDirections;
+
+    //
+    // Every gate is padded to m_gateStride (a multiple of NR) so gates start
+    // on a panel boundary
+    //
+
+    UINT64                      m_gateStride;
+    UINT64                      m_rowStride;
+    UINT64                      m_panelsPerGate;
+    UINT64                      m_batchBlocks;
+
+    float *                     m_pInputGates;          // D x T x B x m_rowStride
+    float *                     m_pPackedRecurrence;    // D x G x m_panelsPerGate x H x NR
+    float *                     m_pFoldedBias;          // D x m_rowStride
+    float *                     m_pRecurrenceBiasH;     // D x m_gateStride, GRU with linear before reset
+
+    BYTE *                      m_pScratch;
+    SIZE_T                      m_scratchPerWorker;
+};
+
+//
+// Optional tensors get a view with m_pData NULL
+//
+
+static bool
+CosMlGetOptionalView(
+    const CosMlTensor * pTensor,
+    UINT                dimensionCount,
+    CosMlView *         pView)
+{
+    if (NULL == pTensor->m_pData)
+    {
+        pView->m_pData = NULL;
+
+        return true;
+    }
+
+    return CosMlGetView(pTensor, dimensionCount, pView);
+}
+
+static bool
+CosMlHasShape(
+    const CosMlView *   pView,
+    UINT64              size0,
+    UINT64              size1,
+    UINT64              size2,
+    UINT64              size3)
+{
+    return (NULL == pView->m_pData) ||
+           ((pView->m_size[0] == size0) &&
+            (pView->m_size[1] == size1) &&
+            (pView->m_size[2] == size2) &&
+            (pView->m_size[3] == size3));
+}
+
+static inline void
+CosMlAddRows(
+    float *         pDst,
+    const float *   pA,
+    const float *   pB,
+    UINT64          count)
+{
+    UINT64 i = 0;
+
+#if COS_ML_SSE2
+    for (; i + 4 <= count; i += 4)
+    {
+        _mm_storeu_ps(pDst + i, _mm_add_ps(_mm_loadu_ps(pA + i), _mm_loadu_ps(pB + i)));
+    }
+#endif
+
+    for (; i < count; i++)
+    {
+        pDst[i] = pA[i] + pB[i];
+    }
+}
+
+static inline void
+CosMlClipRow(
+    float *         pValues,
+    UINT64          count,
+    float           clip)
+{
+    UINT64 i = 0;
+
+#if COS_ML_SSE2
+    __m128 high = _mm_set1_ps(clip);
+    __m128 low = _mm_set1_ps(-clip);
+
+    for (; i + 4 <= count; i += 4)
+    {
+        _mm_storeu_ps(pValues + i, _mm_max_ps(_mm_min_ps(_mm_loadu_ps(pValues + i), high), low));
+    }
+#endif
+
+    for (; i < count; i++)
+    {
+        pValues[i] = (pValues[i] > clip) ? clip : ((pValues[i] < -clip) ? -clip : pValues[i]);
+    }
+}
+
+//
+// Row "row" (timestep row / B, batch entry row % B) of the input
+//
+
+static void
+CosMlRecurrentLoadInput(
+    void *  pContext,
+    UINT64  direction,
+    UINT64  row,
+    UINT64  k0,
+    UINT64  count,
+    float * pDst)
+{
+    UNREFERENCED_PARAMETER(direction);
+
+    CosMlRecurrentContext * pRecurrent = (CosMlRecurrentContext *)pContext;
+    const CosMlView * pInput = &pRecurrent->m_input;
+
+    UINT64 t = row / pRecurrent->m_batchSize;
+    UINT64 b = row % pRecurrent->m_batchSize;
+
+    CosMlLoadRow(
+        pInput,
+        (INT64)t*pInput->m_stride[1] + (INT64)b*pInput->m_stride[2] + (INT64)k0*pInput->m_stride[3],
+        pInput->m_stride[3],
+        count,
+        pDst);
+}
+
+//
+// Column "n" of the transposed input weights is row "n" of Weight
+//
+
+static void
+CosMlRecurrentLoadWeight(
+    void *  pContext,
+    UINT64  direction,
+    UINT64  n,
+    UINT64  k0,
+    UINT64  count,
+    float * pDst)
+{
+    CosMlRecurrentContext * pRecurrent = (CosMlRecurrentContext *)pContext;
+    const CosMlView * pWeight = &pRecurrent->m_weight;
+
+    CosMlLoadRow(
+        pWeight,
+        (INT64)direction*pWeight->m_stride[1] + (INT64)n*pWeight->m_stride[2] + (INT64)k0*pWeight->m_stride[3],
+        pWeight->m_stride[3],
+        count,
+        pDst);
+}
+
+static void
+CosMlRecurrentStoreInputGates(
+    void *  pContext,
+    UINT64  direction,
+    UINT64  row,
+    UINT64  n0,
+    UINT64  count,
+    float * pSrc)
+{
+    CosMlRecurrentContext * pRecurrent = (CosMlRecurrentContext *)pContext;
+
+    UINT64 hiddenSize = pRecurrent->m_hiddenSize;
+    float * pRow = pRecurrent->m_pInputGates + (direction*pRecurrent->m_seqLength*pRecurrent->m_batchSize + row)*pRecurrent->m_rowStride;
+    const float * pBias = pRecurrent->m_pFoldedBias + direction*pRecurrent->m_rowStride;
+
+    //
+    // Split [n0, n0 + count) at gate boundaries, gates are padded in the
+    // destination
+    //
+
+    for (UINT64 i = 0; i < count;)
+    {
+        UINT64 gate = (n0 + i) / hiddenSize;
+        UINT64 j = (n0 + i) % hiddenSize;
+        UINT64 length = CosMlMin(count - i, hiddenSize - j);
+        UINT64 offset = gate*pRecurrent->m_gateStride + j;
+
+        CosMlAddRows(pRow + offset, pSrc + i, pBias + offset, length);
+
+        i += length;
+    }
+}
+
+//
+// Packs the rows of one gate panel of the recurrence weights so the hidden
+// state product streams through contiguous memory. Work items are in the
+// order of the packed panels.
+//
+
+static void
+CosMlRecurrentPackWorkItem(
+    void *  pContext,
+    UINT    workerIndex,
+    UINT    itemIndex)
+{
+    CosMlRecurrentContext * pRecurrent = (CosMlRecurrentContext *)pContext;
+    const CosMlView * pRecurrence = &pRecurrent->m_recurrence;
+
+    UINT64 hiddenSize = pRecurrent->m_hiddenSize;
+    UINT64 panel = itemIndex % pRecurrent->m_panelsPerGate;
+    UINT64 gate = (itemIndex / pRecurrent->m_panelsPerGate) % pRecurrent->m_numGates;
+    UINT64 direction = itemIndex / (pRecurrent->m_panelsPerGate*pRecurrent->m_numGates);
+
+    float * pPanel = pRecurrent->m_pPackedRecurrence + itemIndex*hiddenSize*kCosMlGemmNR;
+    float * pRow = (float *)(pRecurrent->m_pScratch + workerIndex*pRecurrent->m_scratchPerWorker);
+
+    for (UINT64 lane = 0; lane < kCosMlGemmNR; lane++)
+    {
+        UINT64 j = panel*kCosMlGemmNR + lane;
+
+        if (j < hiddenSize)
+        {
+            CosMlLoadRow(
+                pRecurrence,
+                (INT64)direction*pRecurrence->m_stride[1] + (INT64)(gate*hiddenSize + j)*pRecurrence->m_stride[2],
+                pRecurrence->m_stride[3],
+                hiddenSize,
+                pRow);
+        }
+        else
+        {
+            memset(pRow, 0, (SIZE_T)(hiddenSize*sizeof(float)));
+        }
+
+        for (UINT64 k = 0; k < hiddenSize; k++)
+        {
+            pPanel[k*kCosMlGemmNR + lane] = pRow[k];
+        }
+    }
+}
+
+//
+// pOut[row][firstGate..firstGate + numGates) = pState[row] * Recurrence^T for
+// the MR rows of the block, pPacked receives the interleaved state
+//
+
+static void
+CosMlRecurrentMultiply(
+    const CosMlRecurrentContext *   pRecurrent,
+    UINT64                          direction,
+    UINT64                          firstGate,
+    UINT64                          numGates,
+    const float *                   pState,
+    float *                         pPacked,
+    float *                         pOut)
+{
+    UINT64 hiddenSize = pRecurrent->m_hiddenSize;
+
+    for (UINT64 k = 0; k < hiddenSize; k++)
+    {
+        for (UINT64 row = 0; row < kCosMlGemmMR; row++)
+        {
+            pPacked[k*kCosMlGemmMR + row] = pState[row*pRecurrent->m_gateStride + k];
+        }
+    }
+
+    const float * pPanels = pRecurrent->m_pPackedRecurrence +
+        (direction*pRecurrent->m_numGates + firstGate)*pRecurrent->m_panelsPerGate*hiddenSize*kCosMlGemmNR;
+
+    for (UINT64 panel = 0; panel < numGates*pRecurrent->m_panelsPerGate; panel++)
+    {
+        CosMlGemmMicroKernel(
+            hiddenSize,
+            pPacked,
+            pPanels + panel*hiddenSize*kCosMlGemmNR,
+            pOut + firstGate*pRecurrent->m_gateStride + panel*kCosMlGemmNR,
+            pRecurrent->m_rowStride,
+            false);
+    }
+}
+
+static void
+CosMlRecurrentWorkItem(
+    void *  pContext,
+    UINT    workerIndex,
+    UINT    itemIndex)
+{
+    CosMlRecurrentContext * pRecurrent = (CosMlRecurrentContext *)pContext;
+    const CosMlRecurrentDesc * pDesc = pRecurrent->m_pDesc;
+
+    UINT64 hiddenSize = pRecurrent->m_hiddenSize;
+    UINT64 gateStride = pRecurrent->m_gateStride;
+    UINT64 rowStride = pRecurrent->m_rowStride;
+
+    UINT64 direction = itemIndex / pRecurrent->m_batchBlocks;
+    UINT64 b0 = (itemIndex % pRecurrent->m_batchBlocks)*kCosMlGemmMR;
+    UINT64 rows = CosMlMin(kCosMlGemmMR, pRecurrent->m_batchSize - b0);
+
+    bool bBackward = (1 == direction) || (CosMlRecurrentBackward == pDesc->m_direction);
+    bool bGru = (CosMlRecurrentCellGru == pDesc->m_cell);
+    bool bLstm = (CosMlRecurrentCellLstm == pDesc->m_cell);
+    bool bResetBeforeMultiply = bGru && !pDesc->m_linearBeforeReset;
+
+    const CosMlActivation * pActivations = pDesc->m_activations + direction*kCosMlMaxRecurrentActivations;
+
+    float * pPacked = (float *)(pRecurrent->m_pScratch + workerIndex*pRecurrent->m_scratchPerWorker);
+    float * pHidden = pPacked + hiddenSize*kCosMlGemmMR;
+    float * pCell = pHidden + kCosMlGemmMR*gateStride;
+    float * pTemp = pCell + kCosMlGemmMR*gateStride;
+    float * pPeephole = pTemp + kCosMlGemmMR*gateStride;
+    float * pGates = pPeephole + 3*gateStride;
+
+    memset(pHidden, 0, (SIZE_T)(kCosMlGemmMR*(3*gateStride + rowStride) + 3*gateStride)*sizeof(float));
+
+    UINT64 length[kCosMlGemmMR];
+    UINT64 maxLength = 0;
+
+    for (UINT64 row = 0; row < rows; row++)
+    {
+        INT64 offset = (INT64)direction*pRecurrent->m_hiddenInit.m_stride[1] + (INT64)(b0 + row)*pRecurrent->m_hiddenInit.m_stride[2];
+
+        length[row] = pRecurrent->m_seqLength;
+
+        if (NULL != pRecurrent->m_seqLengths.m_pData)
+        {
+            length[row] = CosMlMin(length[row], (UINT64)CosMlLoadElement(&pRecurrent->m_seqLengths, (INT64)(b0 + row)*pRecurrent->m_seqLengths.m_stride[3]));
+        }
+
+        maxLength = CosMlMax(maxLength, length[row]);
+
+        if (NULL != pRecurrent->m_hiddenInit.m_pData)
+        {
+            CosMlLoadRow(&pRecurrent->m_hiddenInit, offset, pRecurrent->m_hiddenInit.m_stride[3], hiddenSize, pHidden + row*gateStride);
+        }
+
+        offset = (INT64)direction*pRecurrent->m_cellInit.m_stride[1] + (INT64)(b0 + row)*pRecurrent->m_cellInit.m_stride[2];
+
+        if (bLstm && (NULL != pRecurrent->m_cellInit.m_pData))
+        {
+            CosMlLoadRow(&pRecurrent->m_cellInit, offset, pRecurrent->m_cellInit.m_stride[3], hiddenSize, pCell + row*gateStride);
+        }
+    }
+
+    if (bLstm && (NULL != pRecurrent->m_peephole.m_pData))
+    {
+        for (UINT64 gate = 0; gate < 3; gate++)
+        {
+            CosMlLoadRow(
+                &pRecurrent->m_peephole,
+                (INT64)direction*pRecurrent->m_peephole.m_stride[2] + (INT64)(gate*hiddenSize)*pRecurrent->m_peephole.m_stride[3],
+                pRecurrent->m_peephole.m_stride[3],
+                hiddenSize,
+                pPeephole + gate*gateStride);
+        }
+    }
+
+    for (UINT64 step = 0; step < maxLength; step++)
+    {
+        const float * pInputGates[kCosMlGemmMR];
+        UINT64 t[kCosMlGemmMR];
+
+        for (UINT64 row = 0; row < rows; row++)
+        {
+            t[row] = bBackward ? (length[row] - 1 - step) : step;
+            pInputGates[row] = (step < length[row]) ?
+                pRecurrent->m_pInputGates + ((direction*pRecurrent->m_seqLength + t[row])*pRecurrent->m_batchSize + b0 + row)*rowStride :
+                NULL;
+        }
+
+        CosMlRecurrentMultiply(pRecurrent, direction, 0, bResetBeforeMultiply ? 2 : pRecurrent->m_numGates, pHidden, pPacked, pGates);
+
+        if (bResetBeforeMultiply)
+        {
+            //
+            // The hidden gate multiplies the reset hidden state, r * h
+            //
+
+            for (UINT64 row = 0; row < rows; row++)
+            {
+                float * pRowGates = pGates + row*rowStride;
+
+                if (NULL == pInputGates[row])
+                {
+                    continue;
+                }
+
+                for (UINT64 gate = 0; gate < 2; gate++)
+                {
+                    CosMlAddRows(pRowGates + gate*gateStride, pRowGates + gate*gateStride, pInputGates[row] + gate*gateStride, hiddenSize);
+                    CosMlApplyActivation(&pActivations[0], pRowGates + gate*gateStride, hiddenSize);
+                }
+
+                for (UINT64 i = 0; i < hiddenSize; i++)
+                {
+                    pTemp[row*gateStride + i] = pRowGates[gateStride + i]*pHidden[row*gateStride + i];
+                }
+            }
+
+            CosMlRecurrentMultiply(pRecurrent, direction, 2, 1, pTemp, pPacked, pGates);
+        }
+
+        for (UINT64 row = 0; row < rows; row++)
+        {
+            float * pRowGates = pGates + row*rowStride;
+            float * pRowHidden = pHidden + row*gateStride;
+            float * pRowCell = pCell + row*gateStride;
+            float * pRowTemp = pTemp + row*gateStride;
+
+            if (NULL == pInputGates[row])
+            {
+                continue;
+            }
+
+            switch (pDesc->m_cell)
+            {
+            case CosMlRecurrentCellRnn:
+                CosMlAddRows(pRowHidden, pRowGates, pInputGates[row], hiddenSize);
+                CosMlApplyActivation(&pActivations[0], pRowHidden, hiddenSize);
+                break;
+
+            case CosMlRecurrentCellGru:
+                {
+                    float * pZ = pRowGates;
+                    float * pR = pRowGates + gateStride;
+                    float * pH = pRowGates + 2*gateStride;
+                    const float * pInputH = pInputGates[row] + 2*gateStride;
+
+                    if (bResetBeforeMultiply)
+                    {
+                        CosMlAddRows(pH, pH, pInputH, hiddenSize);
+                    }
+                    else
+                    {
+                        for (UINT64 gate = 0; gate < 2; gate++)
+                        {
+                            CosMlAddRows(pRowGates + gate*gateStride, pRowGates + gate*gateStride, pInputGates[row] + gate*gateStride, hiddenSize);
+                            CosMlApplyActivation(&pActivations[0], pRowGates + gate*gateStride, hiddenSize);
+                        }
+
+                        CosMlAddRows(pH, pH, pRecurrent->m_pRecurrenceBiasH + direction*gateStride, hiddenSize);
+
+                        for (UINT64 i = 0; i < hiddenSize; i++)
+                        {
+                            pH[i] = pInputH[i] + pR[i]*pH[i];
+                        }
+                    }
+
+                    CosMlApplyActivation(&pActivations[1], pH, hiddenSize);
+
+                    for (UINT64 i = 0; i < hiddenSize; i++)
+                    {
+                        pRowHidden[i] = (1.0f - pZ[i])*pH[i] + pZ[i]*pRowHidden[i];
+                    }
+                }
+                break;
+
+            case CosMlRecurrentCellLstm:
+                {
+                    float * pI = pRowGates;
+                    float * pO = pRowGates + gateStride;
+                    float * pF = pRowGates + 2*gateStride;
+                    float * pC = pRowGates + 3*gateStride;
+
+                    for (UINT64 gate = 0; gate < 4; gate++)
+                    {
+                        CosMlAddRows(pRowGates + gate*gateStride, pRowGates + gate*gateStride, pInputGates[row] + gate*gateStride, hiddenSize);
+                    }
+
+                    for (UINT64 i = 0; i < hiddenSize; i++)
+                    {
+                        pI[i] += pPeephole[i]*pRowCell[i];
+                        pF[i] += pPeephole[2*gateStride + i]*pRowCell[i];
+                    }
+
+                    if (pDesc->m_useClip)
+                    {
+                        CosMlClipRow(pI, hiddenSize, pDesc->m_clip);
+                        CosMlClipRow(pF, hiddenSize, pDesc->m_clip);
+                        CosMlClipRow(pC, hiddenSize, pDesc->m_clip);
+                    }
+
+                    CosMlApplyActivation(&pActivations[0], pI, hiddenSize);
+                    CosMlApplyActivation(&pActivations[0], pF, hiddenSize);
+                    CosMlApplyActivation(&pActivations[1], pC, hiddenSize);
+
+                    for (UINT64 i = 0; i < hiddenSize; i++)
+                    {
+                        float forget = pDesc->m_coupleInputForget ? (1.0f - pI[i]) : pF[i];
+
+                        pRowCell[i] = forget*pRowCell[i] + pI[i]*pC[i];
+                        pO[i] += pPeephole[gateStride + i]*pRowCell[i];
+                    }
+
+                    if (pDesc->m_useClip)
+                    {
+                        CosMlClipRow(pO, hiddenSize, pDesc->m_clip);
+                    }
+
+                    CosMlApplyActivation(&pActivations[0], pO, hiddenSize);
+
+                    memcpy(pRowTemp, pRowCell, (SIZE_T)(hiddenSize*sizeof(float)));
+                    CosMlApplyActivation(&pActivations[2], pRowTemp, hiddenSize);
+
+                    for (UINT64 i = 0; i < hiddenSize; i++)
+                    {
+                        pRowHidden[i] = pO[i]*pRowTemp[i];
+                    }
+                }
+                break;
+            }
+
+            if (NULL != pRecurrent->m_outSequence.m_pData)
+            {
+                const CosMlView * pOut = &pRecurrent->m_outSequence;
+
+                CosMlStoreRow(
+                    pOut,
+                    (INT64)t[row]*pOut->m_stride[0] + (INT64)direction*pOut->m_stride[1] + (INT64)(b0 + row)*pOut->m_stride[2],
+                    pOut->m_stride[3],
+                    hiddenSize,
+                    pRowHidden);
+            }
+        }
+    }
+
+    for (UINT64 row = 0; row < rows; row++)
+    {
+        const CosMlView * pOut = &pRecurrent->m_outSequence;
+
+        //
+        // Timesteps past the end of the sequence are zero
+        //
+
+        memset(pTemp, 0, (SIZE_T)(hiddenSize*sizeof(float)));
+
+        for (UINT64 t = length[row]; (NULL != pOut->m_pData) && (t < pRecurrent->m_seqLength); t++)
+        {
+            CosMlStoreRow(
+                pOut,
+                (INT64)t*pOut->m_stride[0] + (INT64)direction*pOut->m_stride[1] + (INT64)(b0 + row)*pOut->m_stride[2],
+                pOut->m_stride[3],
+                hiddenSize,
+                pTemp);
+        }
+
+        pOut = &pRecurrent->m_outSingle;
+
+        if (NULL != pOut->m_pData)
+        {
+            CosMlStoreRow(
+                pOut,
+                (INT64)direction*pOut->m_stride[1] + (INT64)(b0 + row)*pOut->m_stride[2],
+                pOut->m_stride[3],
+                hiddenSize,
+                pHidden + row*gateStride);
+        }
+
+        pOut = &pRecurrent->m_outCellSingle;
+
+        if (bLstm && (NULL != pOut->m_pData))
+        {
+            CosMlStoreRow(
+                pOut,
+                (INT64)direction*pOut->m_stride[1] + (INT64)(b0 + row)*pOut->m_stride[2],
+                pOut->m_stride[3],
+                hiddenSize,
+                pCell + row*gateStride);
+        }
+    }
+}
+
+bool
+CosMlRecurrent(
+    CosMlContext *              pContext,
+    const CosMlRecurrentDesc *  pDesc)
+{
+    CosMlRecurrentContext recurrent;
+
+    recurrent.m_pDesc = pDesc;
+
+    switch (pDesc->m_cell)
+    {
+    case CosMlRecurrentCellRnn:
+        recurrent.m_numGates = 1;
+        break;
+    case CosMlRecurrentCellGru:
+        recurrent.m_numGates = 3;
+        break;
+    case CosMlRecurrentCellLstm:
+        recurrent.m_numGates = 4;
+        break;
+    default:
+        return false;
+    }
+
+    bool bLstm = (CosMlRecurrentCellLstm == pDesc->m_cell);
+    CosMlTensor nullTensor = {};
+
+    recurrent.m_numDirections = (CosMlRecurrentBidirectional == pDesc->m_direction) ? 2 : 1;
+
+    if (!CosMlGetView(&pDesc->m_input, 4, &recurrent.m_input) ||
+        !CosMlGetView(&pDesc->m_weight, 4, &recurrent.m_weight) ||
+        !CosMlGetView(&pDesc->m_recurrence, 4, &recurrent.m_recurrence) ||
+        !CosMlGetOptionalView(&pDesc->m_bias, 4, &recurrent.m_bias) ||
+        !CosMlGetOptionalView(&pDesc->m_hiddenInit, 4, &recurrent.m_hiddenInit) ||
+        !CosMlGetOptionalView(bLstm ? &pDesc->m_cellInit : &nullTensor, 4, &recurrent.m_cellInit) ||
+        !CosMlGetOptionalView(&pDesc->m_seqLengths, 4, &recurrent.m_seqLengths) ||
+        !CosMlGetOptionalView(bLstm ? &pDesc->m_peephole : &nullTensor, 4, &recurrent.m_peephole) ||
+        !CosMlGetOptionalView(&pDesc->m_outSingle, 4, &recurrent.m_outSingle) ||
+        !CosMlGetOptionalView(&pDesc->m_outSequence, 4, &recurrent.m_outSequence) ||
+        !CosMlGetOptionalView(bLstm ? &pDesc->m_outCellSingle : &nullTensor, 4, &recurrent.m_outCellSingle))
+    {
+        return false;
+    }
+
+    UINT64 seqLength = recurrent.m_input.m_size[1];
+    UINT64 batchSize = recurrent.m_input.m_size[2];
+    UINT64 inputSize = recurrent.m_input.m_size[3];
+    UINT64 hiddenSize = recurrent.m_recurrence.m_size[3];
+    UINT64 numGates = recurrent.m_numGates;
+    UINT64 numDirections = recurrent.m_numDirections;
+
+    if ((recurrent.m_input.m_size[0] != 1) ||
+        !CosMlHasShape(&recurrent.m_weight, 1, numDirections, numGates*hiddenSize, inputSize) ||
+        !CosMlHasShape(&recurrent.m_recurrence, 1, numDirections, numGates*hiddenSize, hiddenSize) ||
+        !CosMlHasShape(&recurrent.m_bias, 1, 1, numDirections, 2*numGates*hiddenSize) ||
+        !CosMlHasShape(&recurrent.m_hiddenInit, 1, numDirections, batchSize, hiddenSize) ||
+        !CosMlHasShape(&recurrent.m_cellInit, 1, numDirections, batchSize, hiddenSize) ||
+        !CosMlHasShape(&recurrent.m_seqLengths, 1, 1, 1, batchSize) ||
+        !CosMlHasShape(&recurrent.m_peephole, 1, 1, numDirections, 3*hiddenSize) ||
+        !CosMlHasShape(&recurrent.m_outSingle, 1, numDirections, batchSize, hiddenSize) ||
+        !CosMlHasShape(&recurrent.m_outSequence, seqLength, numDirections, batchSize, hiddenSize) ||
+        !CosMlHasShape(&recurrent.m_outCellSingle, 1, numDirections, batchSize, hiddenSize))
+    {
+        return false;
+    }
+
+    recurrent.m_seqLength = seqLength;
+    recurrent.m_batchSize = batchSize;
+    recurrent.m_inputSize = inputSize;
+    recurrent.m_hiddenSize = hiddenSize;
+    recurrent.m_gateStride = CosMlAlignUp(hiddenSize, kCosMlGemmNR);
+    recurrent.m_rowStride = numGates*recurrent.m_gateStride;
+    recurrent.m_panelsPerGate = recurrent.m_gateStride/kCosMlGemmNR;
+    recurrent.m_batchBlocks = (batchSize + kCosMlGemmMR - 1)/kCosMlGemmMR;
+
+    UINT64 inputGatesSize = numDirections*seqLength*batchSize*recurrent.m_rowStride;
+    UINT64 packedSize = numDirections*numGates*recurrent.m_panelsPerGate*hiddenSize*kCosMlGemmNR;
+    UINT64 sharedSize = inputGatesSize + packedSize + numDirections*(recurrent.m_rowStride + recurrent.m_gateStride);
+
+    recurrent.m_scratchPerWorker = (SIZE_T)((hiddenSize*kCosMlGemmMR + kCosMlGemmMR*(3*recurrent.m_gateStride + recurrent.m_rowStride) + 3*recurrent.m_gateStride)*sizeof(float));
+
+    float * pShared = (float *)pContext->AllocateScratch((SIZE_T)(sharedSize*sizeof(float)));
+
+    if (NULL == pShared)
+    {
+        return false;
+    }
+
+    recurrent.m_pScratch = (BYTE *)pContext->AllocateScratch(recurrent.m_scratchPerWorker*pContext->GetNumWorkers());
+
+    if (NULL == recurrent.m_pScratch)
+    {
+        pContext->FreeScratch(pShared);
+
+        return false;
+    }
+
+    recurrent.m_pInputGates = pShared;
+    recurrent.m_pPackedRecurrence = recurrent.m_pInputGates + inputGatesSize;
+    recurrent.m_pFoldedBias = recurrent.m_pPackedRecurrence + packedSize;
+    recurrent.m_pRecurrenceBiasH = recurrent.m_pFoldedBias + numDirections*recurrent.m_rowStride;
+
+    //
+    // Input and recurrence biases are added to the input projection, except
+    // the GRU hidden gate recurrence bias with linear before reset which is
+    // applied before the reset gate
+    //
+
+    memset(recurrent.m_pFoldedBias, 0, (SIZE_T)(numDirections*(recurrent.m_rowStride + recurrent.m_gateStride)*sizeof(float)));
+
+    for (UINT64 direction = 0; (NULL != recurrent.m_bias.m_pData) && (direction < numDirections); direction++)
+    {
+        const CosMlView * pBias = &recurrent.m_bias;
+
+        for (UINT64 gate = 0; gate < numGates; gate++)
+        {
+            bool bSeparate = (CosMlRecurrentCellGru == pDesc->m_cell) && pDesc->m_linearBeforeReset && (2 == gate);
+
+            for (UINT64 i = 0; i < hiddenSize; i++)
+            {
+                INT64 offset = (INT64)direction*pBias->m_stride[2] + (INT64)(gate*hiddenSize + i)*pBias->m_stride[3];
+                float inputBias = CosMlLoadElement(pBias, offset);
+                float recurrenceBias = CosMlLoadElement(pBias, offset + (INT64)(numGates*hiddenSize)*pBias->m_stride[3]);
+
+                recurrent.m_pFoldedBias[direction*recurrent.m_rowStride + gate*recurrent.m_gateStride + i] =
+                    inputBias + (bSeparate ? 0.0f : recurrenceBias);
+
+                if (bSeparate)
+                {
+                    recurrent.m_pRecurrenceBiasH[direction*recurrent.m_gateStride + i] = recurrenceBias;
+                }
+            }
+        }
+    }
+
+    CosMlGemmProblem problem;
+
+    problem.m_batchCount = numDirections;
+    problem.m_m = seqLength*batchSize;
+    problem.m_n = numGates*hiddenSize;
+    problem.m_k = inputSize;
+    problem.m_pContext = &recurrent;
+    problem.m_pfnLoadA = CosMlRecurrentLoadInput;
+    problem.m_pfnLoadB = NULL;
+    problem.m_pfnLoadAColumn = NULL;
+    problem.m_pfnLoadBColumn = CosMlRecurrentLoadWeight;
+    problem.m_pfnStore = CosMlRecurrentStoreInputGates;
+
+    bool bSuccess = CosMlRunGemm(pContext, &problem);
+
+    if (bSuccess)
+    {
+        pContext->ParallelFor((UINT)(numDirections*numGates*recurrent.m_panelsPerGate), CosMlRecurrentPackWorkItem, &recurrent);
+        pContext->ParallelFor((UINT)(numDirections*recurrent.m_batchBlocks), CosMlRecurrentWorkItem, &recurrent);
+    }
+
+    pContext->FreeScratch(recurrent.m_pScratch);
+    pContext->FreeScratch(pShared);
+
+    return bSuccess;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Tensor copy
+//
+// Dimensions are first coalesced where both tensors are contiguous across
+// them, so packed copies collapse into a single row and rows of the same data
+// type are copied with memcpy. When the unit stride dimensions of the two
+// tensors differ (a layout change such as NCHW <-> NHWC) the copy goes
+// through square tiles so both the reads and the writes stay contiguous.
+// Rows of different data types are converted through FP32.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#define kCosMlCopyRowChunk  4096
+#define kCosMlCopyTile      32
+
+struct CosMlCopyContext
+{
+    CosMlView       m_src;
+    CosMlView       m_dst;
+
+    //
+    // Coalesced dimensions, m_size applies to both views
+    //
+
+    UINT            m_dimensionCount;
+    UINT64          m_size[kCosMlMaxDimensions];
+
+    bool            m_bConvert;
+    UINT            m_elementSize;
+    UINT            m_bufferElementSize;
+
+    //
+    // Rows run along m_rowDimension. For a transposing copy m_columnDimension
+    // is the unit stride dimension of the source, otherwise it is
+    // kCosMlMaxDimensions.
+    //
+
+    UINT            m_rowDimension;
+    UINT            m_columnDimension;
+
+    UINT64          m_blocksPerRow;
+    UINT64          m_numUnits;
+    UINT64          m_unitsPerItem;
+
+    BYTE *          m_pScratch;
+    SIZE_T          m_scratchPerWorker;
+};
+
+//
+// Copies count elements of the same data type, strides are in elements
+//
+
+static void
+CosMlCopyElements(
+    BYTE *          pDst,
+    INT64           dstStride,
+    const BYTE *    pSrc,
+    INT64           srcStride,
+    UINT64          count,
+    UINT            elementSize)
+{
+    if ((1 == dstStride) && (1 == srcStride))
+    {
+        memcpy(pDst, pSrc, (SIZE_T)(count*elementSize));
+    }
+    else if (2 == elementSize)
+    {
+        for (UINT64 i = 0; i < count; i++)
+        {
+            ((USHORT *)pDst)[(INT64)i*dstStride] = ((const USHORT *)pSrc)[(INT64)i*srcStride];
+        }
+    }
+    else
+    {
+        for (UINT64 i = 0; i < count; i++)
+        {
+            ((UINT *)pDst)[(INT64)i*dstStride] = ((const UINT *)pSrc)[(INT64)i*srcStride];
+        }
+    }
+}
+
+static void
+CosMlCopyLoad(
+    const CosMlCopyContext *    pCopy,
+    INT64                       offset,
+    INT64                       stride,
+    UINT64                      count,
+    BYTE *                      pBuffer)
+{
+    if (pCopy->m_bConvert)
+    {
+        CosMlLoadRow(&pCopy->m_src, offset, stride, count, (float *)pBuffer);
+    }
+    else
+    {
+        CosMlCopyElements(pBuffer, 1, pCopy->m_src.m_pData + offset*pCopy->m_elementSize, stride, count, pCopy->m_elementSize);
+    }
+}
+
+static void
+CosMlCopyStore(
+    const CosMlCopyContext *    pCopy,
+    INT64                       offset,
+    INT64                       stride,
+    UINT64                      count,
+    BYTE *                      pBuffer)
+{
+    if (pCopy->m_bConvert)
+    {
+        CosMlStoreRow(&pCopy->m_dst, offset, stride, count, (float *)pBuffer);
+    }
+    else
+    {
+        CosMlCopyElements(pCopy->m_dst.m_pData + offset*pCopy->m_elementSize, stride, pBuffer, 1, count, pCopy->m_elementSize);
+    }
+}
+
+//
+// Offsets of the outer index "outer" enumerating all dimensions other than
+// the row and column dimensions
+//
+
+static void
+CosMlCopyGetOffsets(
+    const CosMlCopyContext *    pCopy,
+    UINT64                      outer,
+    INT64 *                     pSrcOffset,
+    INT64 *                     pDstOffset)
+{
+    *pSrcOffset = 0;
+    *pDstOffset = 0;
+
+    for (UINT d = pCopy->m_dimensionCount; d-- > 0;)
+    {
+        if ((d == pCopy->m_rowDimension) || (d == pCopy->m_columnDimension))
+        {
+            continue;
+        }
+
+        UINT64 index = outer % pCopy->m_size[d];
+
+        outer /= pCopy->m_size[d];
+
+        *pSrcOffset += (INT64)index*pCopy->m_src.m_stride[d];
+        *pDstOffset += (INT64)index*pCopy->m_dst.m_stride[d];
+    }
+}
+
+static void
+CosMlCopyWorkItem(
+    void *  pContext,
+    UINT    workerIndex,
+    UINT    itemIndex)
+{
+    CosMlCopyContext * pCopy = (CosMlCopyContext *)pContext;
+
+    UINT r = pCopy->m_rowDimension;
+    UINT c = pCopy->m_columnDimension;
+    UINT bufferElementSize = pCopy->m_bufferElementSize;
+
+    BYTE * pBuffer = pCopy->m_pScratch + workerIndex*pCopy->m_scratchPerWorker;
+
+    UINT64 firstUnit = (UINT64)itemIndex*pCopy->m_unitsPerItem;
+    UINT64 lastUnit = CosMlMin(firstUnit + pCopy->m_unitsPerItem, pCopy->m_numUnits);
+
+    for (UINT64 unit = firstUnit; unit < lastUnit; unit++)
+    {
+        INT64 srcOffset;
+        INT64 dstOffset;
+
+        CosMlCopyGetOffsets(pCopy, unit / pCopy->m_blocksPerRow, &srcOffset, &dstOffset);
+
+        if (kCosMlMaxDimensions == c)
+        {
+            //
+            // A chunk of one row
+            //
+
+            UINT64 i0 = (unit % pCopy->m_blocksPerRow)*kCosMlCopyRowChunk;
+            UINT64 count = CosMlMin(kCosMlCopyRowChunk, pCopy->m_size[r] - i0);
+
+            srcOffset += (INT64)i0*pCopy->m_src.m_stride[r];
+            dstOffset += (INT64)i0*pCopy->m_dst.m_stride[r];
+
+            if (pCopy->m_bConvert)
+            {
+                CosMlLoadRow(&pCopy->m_src, srcOffset, pCopy->m_src.m_stride[r], count, (float *)pBuffer);
+                CosMlStoreRow(&pCopy->m_dst, dstOffset, pCopy->m_dst.m_stride[r], count, (float *)pBuffer);
+            }
+            else
+            {
+                CosMlCopyElements(
+                    pCopy->m_dst.m_pData + dstOffset*pCopy->m_elementSize,
+                    pCopy->m_dst.m_stride[r],
+                    pCopy->m_src.m_pData + srcOffset*pCopy->m_elementSize,
+                    pCopy->m_src.m_stride[r],
+                    count,
+                    pCopy->m_elementSize);
+            }
+        }
+        else
+        {
+            //
+            // A block of kCosMlCopyTile columns, walked down all rows one
+            // tile at a time. Tile rows are read along the source unit stride
+            // dimension and written transposed along the destination one.
+            //
+
+            UINT64 c0 = (unit % pCopy->m_blocksPerRow)*kCosMlCopyTile;
+            UINT64 columns = CosMlMin(kCosMlCopyTile, pCopy->m_size[c] - c0);
+
+            BYTE * pTile = pBuffer;
+            BYTE * pRow = pBuffer + kCosMlCopyTile*kCosMlCopyTile*bufferElementSize;
+
+            srcOffset += (INT64)c0*pCopy->m_src.m_stride[c];
+            dstOffset += (INT64)c0*pCopy->m_dst.m_stride[c];
+
+            for (UINT64 r0 = 0; r0 < pCopy->m_size[r]; r0 += kCosMlCopyTile)
+            {
+                UINT64 rows = CosMlMin(kCosMlCopyTile, pCopy->m_size[r] - r0);
+
+                for (UINT64 i = 0; i < rows; i++)
+                {
+                    CosMlCopyLoad(
+                        pCopy,
+                        srcOffset + (INT64)(r0 + i)*pCopy->m_src.m_stride[r],
+                        pCopy->m_src.m_stride[c],
+                        columns,
+                        pTile + i*kCosMlCopyTile*bufferElementSize);
+                }
+
+                for (UINT64 j = 0; j < columns; j++)
+                {
+                    CosMlCopyElements(pRow, 1, pTile + j*bufferElementSize, kCosMlCopyTile, rows, bufferElementSize);
+
+                    CosMlCopyStore(
+                        pCopy,
+                        dstOffset + (INT64)j*pCopy->m_dst.m_stride[c] + (INT64)r0*pCopy->m_dst.m_stride[r],
+                        pCopy->m_dst.m_stride[r],
+                        rows,
+                        pRow);
+                }
+            }
+        }
+    }
+}
+
+bool
+CosMlCopyTensor(
+    CosMlContext *                  pContext,
+    const CosMlCopyTensorDesc *     pDesc)
+{
+    CosMlCopyContext copy;
+
+    if (!CosMlGetView(&pDesc->m_input, kCosMlMaxDimensions, &copy.m_src) ||
+        !CosMlGetView(&pDesc->m_out, kCosMlMaxDimensions, &copy.m_dst) ||
+        !CosMlIsBroadcastable(&copy.m_src, &copy.m_dst, kCosMlMaxDimensions))
+    {
+        return false;
+    }
+
+    copy.m_bConvert = (copy.m_src.m_dataType != copy.m_dst.m_dataType);
+    copy.m_elementSize = (CosMlDataTypeFloat16 == copy.m_dst.m_dataType) ? 2 : 4;
+    copy.m_bufferElementSize = copy.m_bConvert ? sizeof(float) : copy.m_elementSize;
+
+    //
+    // Drop size 1 dimensions and merge a dimension into the previous one when
+    // both tensors step over it contiguously. Broadcast dimensions have a
+    // source stride of 0.
+    //
+
+    UINT count = 0;
+
+    for (UINT d = 0; d < kCosMlMaxDimensions; d++)
+    {
+        UINT64 size = copy.m_dst.m_size[d];
+        INT64 srcStride = copy.m_src.m_stride[d];
+        INT64 dstStride = copy.m_dst.m_stride[d];
+
+        if (1 == size)
+        {
+            continue;
+        }
+
+        if ((count > 0) &&
+            (copy.m_src.m_stride[count - 1] == srcStride*(INT64)size) &&
+            (copy.m_dst.m_stride[count - 1] == dstStride*(INT64)size))
+        {
+            copy.m_size[count - 1] *= size;
+        }
+        else
+        {
+            copy.m_size[count] = size;
+            count++;
+        }
+
+        copy.m_src.m_stride[count - 1] = srcStride;
+        copy.m_dst.m_stride[count - 1] = dstStride;
+    }
+
+    if (0 == count)
+    {
+        copy.m_size[0] = 1;
+        copy.m_src.m_stride[0] = copy.m_dst.m_stride[0] = 1;
+        count = 1;
+    }
+
+    copy.m_dimensionCount = count;
+    copy.m_rowDimension = count - 1;
+    copy.m_columnDimension = kCosMlMaxDimensions;
+
+    //
+    // Transpose when the destination and source unit stride dimensions are
+    // different ones
+    //
+
+    if ((1 != copy.m_src.m_stride[count - 1]) || (1 != copy.m_dst.m_stride[count - 1]))
+    {
+        UINT dstUnitDimension = kCosMlMaxDimensions;
+        UINT srcUnitDimension = kCosMlMaxDimensions;
+
+        for (UINT d = 0; d < count; d++)
+        {
+            if (1 == copy.m_dst.m_stride[d])
+            {
+                dstUnitDimension = d;
+            }
+
+            if (1 == copy.m_src.m_stride[d])
+            {
+                srcUnitDimension = d;
+            }
+        }
+
+        if ((kCosMlMaxDimensions != dstUnitDimension) &&
+            (kCosMlMaxDimensions != srcUnitDimension) &&
+            (dstUnitDimension != srcUnitDimension))
+        {
+            copy.m_rowDimension = dstUnitDimension;
+            copy.m_columnDimension = srcUnitDimension;
+        }
+    }
+
+    UINT64 outerCount = 1;
+
+    for (UINT d = 0; d < count; d++)
+    {
+        if ((d != copy.m_rowDimension) && (d != copy.m_columnDimension))
+        {
+            outerCount *= copy.m_size[d];
+        }
+    }
+
+    if (kCosMlMaxDimensions == copy.m_columnDimension)
+    {
+        copy.m_blocksPerRow = (copy.m_size[copy.m_rowDimension] + kCosMlCopyRowChunk - 1)/kCosMlCopyRowChunk;
+    }
+    else
+    {
+        copy.m_blocksPerRow = (copy.m_size[copy.m_columnDimension] + kCosMlCopyTile - 1)/kCosMlCopyTile;
+    }
+
+    copy.m_numUnits = outerCount*copy.m_blocksPerRow;
+    copy.m_unitsPerItem = CosMlGetChunkSize(pContext, copy.m_numUnits);
+
+    copy.m_scratchPerWorker = (SIZE_T)CosMlMax(
+        kCosMlCopyRowChunk*sizeof(float),
+        (kCosMlCopyTile*kCosMlCopyTile + kCosMlCopyTile)*sizeof(float));
+    copy.m_pScratch = (BYTE *)pContext->AllocateScratch(copy.m_scratchPerWorker*pContext->GetNumWorkers());
+
+    if (NULL == copy.m_pScratch)
+    {
+        return false;
+    }
+
+    pContext->ParallelFor(
+        (UINT)((copy.m_numUnits + copy.m_unitsPerItem - 1)/copy.m_unitsPerItem),
+        CosMlCopyWorkItem,
+        &copy);
+
+    pContext->FreeScratch(copy.m_pScratch);
+
+    return true;
+}
@@ -0,0 +1,305 @@
+#pragma once
+
+//
+// CPU implementations of the ML meta command operators
+//
+// The kernels work on plain tensor descriptions (data pointer, data type,
+// sizes and strides in elements) so they can be shared by the KMD software
+// adapter and user mode tests/benchmarks. The caller translates the
+// META_COMMAND_*_DESC structures and supplies a CosMlContext for worker
+// threads and scratch memory.
+//
+// All arithmetic is done in FP32, FP16 tensors are converted while packing
+// input tiles and when storing results.
+//
+// Tensors have up to kCosMlMaxDimensions dimensions with dimension 0 the
+// outermost (N, C, H, W for 4D). A stride of 0 broadcasts the dimension.
+//
+
+#define kCosMlMaxDimensions     5
+
+enum CosMlDataType
+{
+    CosMlDataTypeFloat32,
+    CosMlDataTypeFloat16,
+    CosMlDataTypeUInt32
+};
+
+struct CosMlTensor
+{
+    void *          m_pData;
+    CosMlDataType   m_dataType;
+    UINT            m_dimensionCount;
+    UINT64          m_size[kCosMlMaxDimensions];
+    UINT64          m_stride[kCosMlMaxDimensions];
+};
+
+enum CosMlActivationFunction
+{
+    CosMlActivationNone,
+    CosMlActivationIdentity,
+    CosMlActivationLinear,          // m_params[0] * x + m_params[1]
+    CosMlActivationRelu,
+    CosMlActivationLeakyRelu,       // m_params[0] is the slope for x < 0
+    CosMlActivationSigmoid,
+    CosMlActivationTanh,
+    CosMlActivationElu,             // m_params[0] is alpha
+    CosMlActivationSoftplus,
+};
+
+struct CosMlActivation
+{
+    CosMlActivationFunction m_function;
+    float                   m_params[2];
+};
+
+//
+// Execution environment supplied by the caller
+//
+
+class CosMlContext
+{
+public:
+
+    typedef void (*PFN_WORK_ITEM)(void * pContext, UINT workerIndex, UINT itemIndex);
+
+    virtual UINT GetNumWorkers() = 0;
+
+    //
+    // Runs pfnWorkItem for every item in [0, numItems) across the workers,
+    // workerIndex is in [0, GetNumWorkers()) and identifies per worker
+    // scratch memory. Returns when all items are done.
+    //
+
+    virtual void ParallelFor(UINT numItems, PFN_WORK_ITEM pfnWorkItem, void * pContext) = 0;
+
+    virtual void * AllocateScratch(SIZE_T size) = 0;
+    virtual void FreeScratch(void * pScratch) = 0;
+};
+
+struct CosMlNormalizationDesc;
+
+//
+// Out = Activation(Alpha * op(A) * op(B) + Beta * C)
+//
+// Matrices are the two innermost dimensions, outer dimensions are batches.
+// C is optional (m_pData NULL) and is broadcast according to its strides.
+//
+// GEMM and Convolution can apply a following Normalization to their result
+// while it is still in cache (m_pFusedNormalization, NULL otherwise). Its
+// m_input is ignored and its m_out must have the shape of the producer's
+// m_out. The producer's m_out still receives the intermediate result unless
+// the normalization writes the same memory.
+//
+
+struct CosMlGemmDesc
+{
+    CosMlTensor     m_a;
+    CosMlTensor     m_b;
+    CosMlTensor     m_c;
+    CosMlTensor     m_out;
+    bool            m_transposeA;
+    bool            m_transposeB;
+    float           m_alpha;
+    float           m_beta;
+    CosMlActivation m_activation;
+
+    const CosMlNormalizationDesc *  m_pFusedNormalization;
+};
+
+//
+// 2D convolution (or cross-correlation) of NCHW input with OIHW filter
+//
+
+struct CosMlConvolutionDesc
+{
+    CosMlTensor     m_input;
+    CosMlTensor     m_filter;
+    CosMlTensor     m_bias;             // optional, C or 1xCx1x1
+    CosMlTensor     m_out;
+    bool            m_crossCorrelation; // false flips the filter window
+    UINT            m_stride[2];
+    UINT            m_dilation[2];
+    UINT            m_startPadding[2];
+    UINT            m_endPadding[2];
+    UINT            m_groupCount;
+    CosMlActivation m_activation;
+
+    const CosMlNormalizationDesc *  m_pFusedNormalization;
+};
+
+enum CosMlPoolingFunction
+{
+    CosMlPoolingAverage,
+    CosMlPoolingLp,
+    CosMlPoolingMax
+};
+
+struct CosMlPoolingDesc
+{
+    CosMlTensor             m_input;
+    CosMlTensor             m_out;
+    CosMlPoolingFunction    m_function;
+    UINT                    m_stride[2];
+    UINT                    m_windowSize[2];
+    UINT                    m_startPadding[2];
+    UINT                    m_endPadding[2];
+    UINT                    m_p;
+    bool                    m_includePadding;   // average counts padding elements
+    CosMlActivation         m_activation;
+};
+
+//
+// Batch normalization for inference: Out = Scale * (In - Mean) / sqrt(Variance + Epsilon) + Bias
+//
+// Mean, Variance, Scale and Bias are broadcast to the input shape (1xCx1x1
+// for spatial normalization, 1xCxHxW otherwise). Scale and Bias are optional.
+//
+
+struct CosMlNormalizationDesc
+{
+    CosMlTensor     m_input;
+    CosMlTensor     m_mean;
+    CosMlTensor     m_variance;
+    CosMlTensor     m_scale;
+    CosMlTensor     m_bias;
+    CosMlTensor     m_out;
+    float           m_epsilon;
+    CosMlActivation m_activation;
+};
+
+//
+// Mean variance normalization over H and W (and C if m_acrossChannels) of
+// every batch (and channel)
+//
+
+struct CosMlMvnDesc
+{
+    CosMlTensor     m_input;
+    CosMlTensor     m_scale;            // optional
+    CosMlTensor     m_bias;             // optional
+    CosMlTensor     m_out;
+    bool            m_acrossChannels;
+    bool            m_normalizeVariance;
+    float           m_epsilon;
+    CosMlActivation m_activation;
+};
+
+enum CosMlReductionFunction
+{
+    CosMlReductionArgMax,
+    CosMlReductionArgMin,
+    CosMlReductionAverage,
+    CosMlReductionL1,
+    CosMlReductionL2,
+    CosMlReductionLogSum,
+    CosMlReductionLogSumExp,
+    CosMlReductionMax,
+    CosMlReductionMin,
+    CosMlReductionMultiply,
+    CosMlReductionSum,
+    CosMlReductionSumSquare
+};
+
+//
+// Dimensions where the output size is 1 and the input size is not are
+// reduced. ArgMax/ArgMin write the UINT32 index of the element within the
+// reduced dimensions (row major).
+//
+
+struct CosMlReductionDesc
+{
+    CosMlTensor             m_input;
+    CosMlTensor             m_out;
+    CosMlReductionFunction  m_function;
+};
+
+//
+// Copies In to Out element by element, converting the data type when they
+// differ. Sizes must match (In may broadcast size 1 dimensions), strides are
+// arbitrary so layout changes such as NCHW <-> NHWC are expressed through the
+// strides of the two tensors.
+//
+
+struct CosMlCopyTensorDesc
+{
+    CosMlTensor     m_input;
+    CosMlTensor     m_out;
+};
+
+enum CosMlRecurrentCell
+{
+    CosMlRecurrentCellRnn,          // 1 gate, activation f
+    CosMlRecurrentCellGru,          // gates z, r, h, activations f, g
+    CosMlRecurrentCellLstm          // gates i, o, f, c, activations f, g, h
+};
+
+enum CosMlRecurrentDirection
+{
+    CosMlRecurrentForward,
+    CosMlRecurrentBackward,
+    CosMlRecurrentBidirectional
+};
+
+#define kCosMlMaxRecurrentActivations   3
+
+//
+// RNN, GRU and LSTM layers with ONNX semantics
+//
+// Input is 1 x T x B x I, Weight is 1 x D x G*H x I and Recurrence is
+// 1 x D x G*H x H for T timesteps, batch B, D directions, G gates and hidden
+// size H. Bias is 1 x 1 x D x 2*G*H (input bias followed by recurrence
+// bias), HiddenInit, CellInit, OutSingle and OutCellSingle are 1 x D x B x H,
+// Peephole is 1 x 1 x D x 3*H (i, o, f) and OutSequence is T x D x B x H.
+//
+// SeqLengths (UINT32, B elements) limits the timesteps of every batch entry,
+// OutSequence is zero past the end of a sequence. All tensors other than
+// Input, Weight and Recurrence are optional.
+//
+// m_activations[d*kCosMlMaxRecurrentActivations + i] is activation i of
+// direction d, the backward direction is d = 1 only when bidirectional.
+//
+
+struct CosMlRecurrentDesc
+{
+    CosMlRecurrentCell      m_cell;
+    CosMlRecurrentDirection m_direction;
+
+    CosMlTensor             m_input;
+    CosMlTensor             m_weight;
+    CosMlTensor             m_recurrence;
+    CosMlTensor             m_bias;
+    CosMlTensor             m_hiddenInit;
+    CosMlTensor             m_cellInit;         // LSTM
+    CosMlTensor             m_seqLengths;
+    CosMlTensor             m_peephole;         // LSTM
+    CosMlTensor             m_outSingle;
+    CosMlTensor             m_outSequence;
+    CosMlTensor             m_outCellSingle;    // LSTM
+
+    CosMlActivation         m_activations[2*kCosMlMaxRecurrentActivations];
+
+    bool                    m_linearBeforeReset;    // GRU
+    bool                    m_useClip;              // LSTM
+    float                   m_clip;
+    bool                    m_coupleInputForget;    // LSTM
+};
+
+bool CosMlGemm(CosMlContext * pContext, const CosMlGemmDesc * pDesc);
+bool CosMlConvolution(CosMlContext * pContext, const CosMlConvolutionDesc * pDesc);
+bool CosMlPooling(CosMlContext * pContext, const CosMlPoolingDesc * pDesc);
+bool CosMlNormalization(CosMlContext * pContext, const CosMlNormalizationDesc * pDesc);
+bool CosMlMvn(CosMlContext * pContext, const CosMlMvnDesc * pDesc);
+bool CosMlReduction(CosMlContext * pContext, const CosMlReductionDesc * pDesc);
+bool CosMlRecurrent(CosMlContext * pContext, const CosMlRecurrentDesc * pDesc);
+bool CosMlCopyTensor(CosMlContext * pContext, const CosMlCopyTensorDesc * pDesc);
+
+//
+// Scalar helpers shared with tests
+//
+
+float CosMlHalfToFloat(USHORT value);
+USHORT CosMlFloatToHalf(float value);
+
+float CosMlExp(float x);
+float CosMlLog(float x);
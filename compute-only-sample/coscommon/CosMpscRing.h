@@ -0,0 +1,136 @@
+#pragma once
+
+//
+// Bounded lock-free ring for many producers and a single consumer
+//
+// Items live in the ring slots. A producer reserves a slot, fills the item in
+// place and publishes it. The consumer works on the item at the head in place
+// and releases the slot when done, so the item stays valid while it is being
+// processed.
+//
+// Every slot carries a sequence number: position p is free for a producer
+// when the sequence of its slot is p, holds a published item when it is p + 1
+// and is handed to position p + Capacity when the consumer releases it.
+// Producers only contend on the tail index (one compare exchange), the
+// consumer owns the head index. Head and tail are on separate cache lines.
+//
+// Shared by the KMD and the user mode stress test (cosringtest).
+//
+
+template <typename TItem, ULONG Capacity>
+class CosMpscRing
+{
+    static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of 2");
+
+public:
+
+    void Initialize()
+    {
+        for (ULONG i = 0; i < Capacity; i++)
+        {
+            m_slots[i].m_sequence = (LONG)i;
+        }
+
+        m_head.m_position = 0;
+        m_tail.m_position = 0;
+    }
+
+    //
+    // Returns the item to fill in, NULL when the ring is full. The item is
+    // handed to the consumer by Publish(*pPosition).
+    //
+
+    TItem * Reserve(ULONG * pPosition)
+    {
+        ULONG position = (ULONG)ReadNoFence(&m_tail.m_position);
+
+        for (;;)
+        {
+            Slot * pSlot = &m_slots[position & (Capacity - 1)];
+            LONG difference = (LONG)((ULONG)ReadAcquire(&pSlot->m_sequence) - position);
+
+            if (0 == difference)
+            {
+                ULONG current = (ULONG)InterlockedCompareExchange(&m_tail.m_position, (LONG)(position + 1), (LONG)position);
+
+                if (current == position)
+                {
+                    *pPosition = position;
+
+                    return &pSlot->m_item;
+                }
+
+                position = current;
+            }
+            else if (difference < 0)
+            {
+                //
+                // The slot still holds the item from one lap earlier
+                //
+
+                return NULL;
+            }
+            else
+            {
+                //
+                // Another producer took this position
+                //
+
+                position = (ULONG)ReadNoFence(&m_tail.m_position);
+            }
+        }
+    }
+
+    void Publish(ULONG position)
+    {
+        WriteRelease(&m_slots[position & (Capacity - 1)].m_sequence, (LONG)(position + 1));
+    }
+
+    //
+    // Consumer only: the oldest published item or NULL. Items published by
+    // one producer are consumed in the order they were reserved.
+    //
+
+    TItem * Peek()
+    {
+        ULONG position = (ULONG)m_head.m_position;
+        Slot * pSlot = &m_slots[position & (Capacity - 1)];
+
+        if ((ULONG)ReadAcquire(&pSlot->m_sequence) != position + 1)
+        {
+            return NULL;
+        }
+
+        return &pSlot->m_item;
+    }
+
+    //
+    // Consumer only: frees the slot of the item returned by Peek()
+    //
+
+    void Release()
+    {
+        ULONG position = (ULONG)m_head.m_position;
+
+        WriteRelease(&m_slots[position & (Capacity - 1)].m_sequence, (LONG)(position + Capacity));
+
+        m_head.m_position = (LONG)(position + 1);
+    }
+
+private:
+
+    struct DECLSPEC_CACHEALIGN Index
+    {
+        volatile LONG   m_position;
+    };
+
+    struct Slot
+    {
+        volatile LONG   m_sequence;
+        TItem           m_item;
+    };
+
+    Index   m_head;
+    Index   m_tail;
+    Slot    m_slots[Capacity];
+};
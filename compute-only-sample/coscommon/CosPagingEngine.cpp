@@ -0,0 +1,360 @@
+//
+// CPU paging engine for the software adapter
+//
+// Shared by the KMD software adapter and user mode tests, so only the
+// compiler intrinsics and memcpy are used from the runtime.
+//
+
+#ifdef _KERNEL_MODE
+#include <ntddk.h>
+#else
+#include <windows.h>
+#endif
+
+#if defined(_M_IX86) || defined(_M_X64)
+#include <emmintrin.h>
+#define COS_PAGING_SSE2     1
+#else
+#define COS_PAGING_SSE2     0
+#endif
+
+#include "CosPagingEngine.h"
+
+static inline UINT64
+CosPagingQueryTicks()
+{
+#ifdef _KERNEL_MODE
+    return (UINT64)KeQueryPerformanceCounter(NULL).QuadPart;
+#else
+    LARGE_INTEGER counter;
+
+    QueryPerformanceCounter(&counter);
+
+    return (UINT64)counter.QuadPart;
+#endif
+}
+
+static inline UINT64
+CosPagingQueryTickFrequency()
+{
+    LARGE_INTEGER frequency;
+
+#ifdef _KERNEL_MODE
+    KeQueryPerformanceCounter(&frequency);
+#else
+    QueryPerformanceFrequency(&frequency);
+#endif
+
+    return (UINT64)frequency.QuadPart;
+}
+
+static inline bool
+CosPagingRangesOverlap(
+    const BYTE *    pStartA,
+    SIZE_T          sizeA,
+    const BYTE *    pStartB,
+    SIZE_T          sizeB)
+{
+    return (pStartA < pStartB + sizeB) && (pStartB < pStartA + sizeA);
+}
+
+//
+// Stores the pattern with 16 byte SSE2 stores between the unaligned head and
+// tail, bNonTemporal bypasses the cache. Without SSE2 the whole range takes
+// the ULONG stores of the head and tail.
+//
+
+static void
+CosPagingFillRange(
+    BYTE *  pDestination,
+    SIZE_T  size,
+    ULONG   pattern,
+    bool    bNonTemporal)
+{
+    ULONG * pHead = (ULONG *)pDestination;
+
+    while (size && ((ULONG_PTR)pHead & 15))
+    {
+        *pHead++ = pattern;
+        size -= sizeof(ULONG);
+    }
+
+#if COS_PAGING_SSE2
+    __m128i value = _mm_set1_epi32((int)pattern);
+    __m128i * pVector = (__m128i *)pHead;
+    __m128i * pEndVector = pVector + size/sizeof(__m128i);
+
+    if (bNonTemporal)
+    {
+        for (; pVector + 4 <= pEndVector; pVector += 4)
+        {
+            _mm_stream_si128(pVector + 0, value);
+            _mm_stream_si128(pVector + 1, value);
+            _mm_stream_si128(pVector + 2, value);
+            _mm_stream_si128(pVector + 3, value);
+        }
+
+        for (; pVector < pEndVector; pVector++)
+        {
+            _mm_stream_si128(pVector, value);
+        }
+
+        _mm_sfence();
+    }
+    else
+    {
+        for (; pVector + 4 <= pEndVector; pVector += 4)
+        {
+            _mm_store_si128(pVector + 0, value);
+            _mm_store_si128(pVector + 1, value);
+            _mm_store_si128(pVector + 2, value);
+            _mm_store_si128(pVector + 3, value);
+        }
+
+        for (; pVector < pEndVector; pVector++)
+        {
+            _mm_store_si128(pVector, value);
+        }
+    }
+
+    pHead = (ULONG *)pEndVector;
+    size %= sizeof(__m128i);
+#else
+    UNREFERENCED_PARAMETER(bNonTemporal);
+#endif
+
+    for (; size; size -= sizeof(ULONG))
+    {
+        *pHead++ = pattern;
+    }
+}
+
+void
+CosPagingEngine::Initialize(
+    CosPagingWorkers *  pWorkers)
+{
+    m_pWorkers = pWorkers;
+
+    m_numQueuedCopies = 0;
+    m_queuedBytes = 0;
+
+    ResetStats();
+}
+
+void
+CosPagingEngine::ResetStats()
+{
+    memset(&m_stats, 0, sizeof(m_stats));
+
+    m_stats.m_tickFrequency = CosPagingQueryTickFrequency();
+}
+
+void
+CosPagingEngine::Fill(
+    void *  pDestination,
+    SIZE_T  size,
+    ULONG   pattern)
+{
+    if (OverlapsQueue((BYTE *)pDestination, size, true))
+    {
+        Flush();
+    }
+
+    UINT64 startTicks = CosPagingQueryTicks();
+
+    if ((size >= kParallelThreshold) && m_pWorkers && (m_pWorkers->GetNumWorkers() > 1))
+    {
+        m_pFillDestination = (BYTE *)pDestination;
+        m_fillSize = size;
+        m_fillPattern = pattern;
+
+        m_pWorkers->ParallelFor((UINT)((size + kParallelChunkSize - 1)/kParallelChunkSize), FillChunk, this);
+    }
+    else
+    {
+        CosPagingFillRange((BYTE *)pDestination, size, pattern, size >= kNonTemporalThreshold);
+    }
+
+    m_stats.m_numOperations[CosPagingOperationFill]++;
+    m_stats.m_numBytes[CosPagingOperationFill] += size;
+    m_stats.m_numTicks[CosPagingOperationFill] += CosPagingQueryTicks() - startTicks;
+}
+
+void
+CosPagingEngine::QueueCopy(
+    void *          pDestination,
+    const void *    pSource,
+    SIZE_T          size)
+{
+    BYTE * pDestinationBytes = (BYTE *)pDestination;
+    const BYTE * pSourceBytes = (const BYTE *)pSource;
+
+    m_stats.m_numOperations[CosPagingOperationTransfer]++;
+    m_stats.m_numBytes[CosPagingOperationTransfer] += size;
+
+    if (0 == size)
+    {
+        return;
+    }
+
+    if (OverlapsQueue(pSourceBytes, size, false) ||
+        OverlapsQueue(pDestinationBytes, size, true))
+    {
+        Flush();
+    }
+
+    //
+    // A copy onto itself is done in place, the chunks could not run in parallel
+    //
+
+    if (CosPagingRangesOverlap(pDestinationBytes, size, pSourceBytes, size))
+    {
+        UINT64 startTicks = CosPagingQueryTicks();
+
+        memmove(pDestinationBytes, pSourceBytes, size);
+
+        m_stats.m_numCopies++;
+        m_stats.m_numTicks[CosPagingOperationTransfer] += CosPagingQueryTicks() - startTicks;
+
+        return;
+    }
+
+    if (m_numQueuedCopies)
+    {
+        QueuedCopy * pLast = &m_queue[m_numQueuedCopies - 1];
+
+        if ((pLast->m_pDestination + pLast->m_size == pDestinationBytes) &&
+            (pLast->m_pSource + pLast->m_size == pSourceBytes))
+        {
+            pLast->m_size += size;
+            m_queuedBytes += size;
+
+            return;
+        }
+    }
+
+    if (IsQueueFull())
+    {
+        Flush();
+    }
+
+    QueuedCopy * pCopy = &m_queue[m_numQueuedCopies++];
+
+    pCopy->m_pDestination = pDestinationBytes;
+    pCopy->m_pSource = pSourceBytes;
+    pCopy->m_size = size;
+
+    m_queuedBytes += size;
+}
+
+void
+CosPagingEngine::Flush()
+{
+    if (0 == m_numQueuedCopies)
+    {
+        return;
+    }
+
+    UINT64 startTicks = CosPagingQueryTicks();
+
+    if ((m_queuedBytes >= kParallelThreshold) && m_pWorkers && (m_pWorkers->GetNumWorkers() > 1))
+    {
+        UINT numChunks = 0;
+
+        for (UINT i = 0; i < m_numQueuedCopies; i++)
+        {
+            m_queue[i].m_firstChunk = numChunks;
+            numChunks += (UINT)((m_queue[i].m_size + kParallelChunkSize - 1)/kParallelChunkSize);
+        }
+
+        m_pWorkers->ParallelFor(numChunks, CopyChunk, this);
+    }
+    else
+    {
+        for (UINT i = 0; i < m_numQueuedCopies; i++)
+        {
+            memcpy(m_queue[i].m_pDestination, m_queue[i].m_pSource, m_queue[i].m_size);
+        }
+    }
+
+    m_stats.m_numCopies += m_numQueuedCopies;
+    m_stats.m_numFlushes++;
+    m_stats.m_numTicks[CosPagingOperationTransfer] += CosPagingQueryTicks() - startTicks;
+
+    m_numQueuedCopies = 0;
+    m_queuedBytes = 0;
+}
+
+//
+// bWrite also checks against the sources of the queued copies, a read only
+// conflicts with their destinations
+//
+
+bool
+CosPagingEngine::OverlapsQueue(
+    const BYTE *    pStart,
+    SIZE_T          size,
+    bool            bWrite)
+{
+    for (UINT i = 0; i < m_numQueuedCopies; i++)
+    {
+        if (CosPagingRangesOverlap(pStart, size, m_queue[i].m_pDestination, m_queue[i].m_size) ||
+            (bWrite && CosPagingRangesOverlap(pStart, size, m_queue[i].m_pSource, m_queue[i].m_size)))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void
+CosPagingEngine::FillChunk(
+    void *  pContext,
+    UINT    workerIndex,
+    UINT    chunkIndex)
+{
+    CosPagingEngine * pEngine = (CosPagingEngine *)pContext;
+
+    UNREFERENCED_PARAMETER(workerIndex);
+
+    SIZE_T offset = (SIZE_T)chunkIndex*kParallelChunkSize;
+    SIZE_T size = pEngine->m_fillSize - offset;
+
+    if (size > kParallelChunkSize)
+    {
+        size = kParallelChunkSize;
+    }
+
+    CosPagingFillRange(pEngine->m_pFillDestination + offset, size, pEngine->m_fillPattern, true);
+}
+
+void
+CosPagingEngine::CopyChunk(
+    void *  pContext,
+    UINT    workerIndex,
+    UINT    chunkIndex)
+{
+    CosPagingEngine * pEngine = (CosPagingEngine *)pContext;
+
+    UNREFERENCED_PARAMETER(workerIndex);
+
+    UINT copyIndex = pEngine->m_numQueuedCopies - 1;
+
+    while (pEngine->m_queue[copyIndex].m_firstChunk > chunkIndex)
+    {
+        copyIndex--;
+    }
+
+    QueuedCopy * pCopy = &pEngine->m_queue[copyIndex];
+
+    SIZE_T offset = (SIZE_T)(chunkIndex - pCopy->m_firstChunk)*kParallelChunkSize;
+    SIZE_T size = pCopy->m_size - offset;
+
+    if (size > kParallelChunkSize)
+    {
+        size = kParallelChunkSize;
+    }
+
+    memcpy(pCopy->m_pDestination + offset, pCopy->m_pSource + offset, size);
+}
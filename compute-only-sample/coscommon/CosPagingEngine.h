@@ -0,0 +1,146 @@
+#pragma once
+
+//
+// CPU paging engine for the software adapter
+//
+// Executes the fills and transfers of paging buffers. Fills use SSE2 stores
+// on x86/x64, non-temporal ones above kNonTemporalThreshold so large fills do
+// not evict the working set from the cache.
+//
+// Transfers are queued instead of copied right away. A transfer that
+// continues the previous one in both source and destination extends it, so
+// the page runs VidMm emits for one allocation become one copy. Flush()
+// copies the queue, splitting it into kParallelChunkSize pieces across the
+// workers once it is larger than kParallelThreshold. A transfer or fill that
+// overlaps a queued transfer flushes the queue first, so the operations
+// still take effect in paging buffer order.
+//
+// Bytes and time are accumulated per operation type in CosPagingStats.
+//
+// The engine is shared by the KMD and the user mode test (cospagingtest),
+// workers are supplied through CosPagingWorkers.
+//
+
+enum CosPagingOperation
+{
+    CosPagingOperationFill,
+    CosPagingOperationTransfer,
+    CosPagingOperationCount
+};
+
+struct CosPagingStats
+{
+    UINT64  m_numOperations[CosPagingOperationCount];
+    UINT64  m_numBytes[CosPagingOperationCount];
+    UINT64  m_numTicks[CosPagingOperationCount];
+
+    UINT64  m_numCopies;            // transfers after coalescing
+    UINT64  m_numFlushes;
+
+    UINT64  m_tickFrequency;
+
+    UINT64 GetBytesPerSecond(CosPagingOperation operation) const
+    {
+        if (0 == m_numTicks[operation])
+        {
+            return 0;
+        }
+
+        return (UINT64)((double)m_numBytes[operation]*m_tickFrequency/m_numTicks[operation]);
+    }
+};
+
+class CosPagingWorkers
+{
+public:
+
+    typedef void (*PFN_WORK_ITEM)(void * pContext, UINT workerIndex, UINT itemIndex);
+
+    virtual UINT GetNumWorkers() = 0;
+
+    //
+    // Runs pfnWorkItem for every item in [0, numItems) and returns when all
+    // items are done
+    //
+
+    virtual void ParallelFor(UINT numItems, PFN_WORK_ITEM pfnWorkItem, void * pContext) = 0;
+};
+
+class CosPagingEngine
+{
+public:
+
+    static const UINT   kMaxQueuedCopies = 32;
+
+    static const SIZE_T kNonTemporalThreshold = 256*1024;
+    static const SIZE_T kParallelThreshold = 1024*1024;
+    static const SIZE_T kParallelChunkSize = 256*1024;
+
+    //
+    // pWorkers can be NULL, everything then runs on the calling thread
+    //
+
+    void Initialize(CosPagingWorkers * pWorkers);
+
+    void SetWorkers(CosPagingWorkers * pWorkers)
+    {
+        m_pWorkers = pWorkers;
+    }
+
+    //
+    // pDestination is ULONG aligned and size a multiple of sizeof(ULONG)
+    //
+
+    void Fill(void * pDestination, SIZE_T size, ULONG pattern);
+
+    //
+    // The memory must stay accessible until the copy is flushed
+    //
+
+    void QueueCopy(void * pDestination, const void * pSource, SIZE_T size);
+
+    bool IsQueueFull()
+    {
+        return (m_numQueuedCopies == kMaxQueuedCopies);
+    }
+
+    void Flush();
+
+    const CosPagingStats & GetStats()
+    {
+        return m_stats;
+    }
+
+    void ResetStats();
+
+private:
+
+    struct QueuedCopy
+    {
+        BYTE *          m_pDestination;
+        const BYTE *    m_pSource;
+        SIZE_T          m_size;
+        UINT            m_firstChunk;
+    };
+
+    bool OverlapsQueue(const BYTE * pStart, SIZE_T size, bool bWrite);
+
+    static void FillChunk(void * pContext, UINT workerIndex, UINT chunkIndex);
+    static void CopyChunk(void * pContext, UINT workerIndex, UINT chunkIndex);
+
+    CosPagingWorkers   *m_pWorkers;
+
+    QueuedCopy          m_queue[kMaxQueuedCopies];
+    UINT                m_numQueuedCopies;
+    SIZE_T              m_queuedBytes;
+
+    //
+    // Fill in flight while the workers run FillChunk()
+    //
+
+    BYTE *              m_pFillDestination;
+    SIZE_T              m_fillSize;
+    ULONG               m_fillPattern;
+
+    CosPagingStats      m_stats;
+};
@@ -0,0 +1,163 @@
+#pragma once
+
+#include "Vpu.h"
+
+//
+// Thread group distribution of a compute dispatch
+//
+// Every worker running the dispatch calls Run() with its own loaded copy of
+// the VPU image, so each has its own VpuThreadLocalStorage (thread id and UAV
+// descriptor block) and the shader code can run on all cores concurrently.
+// Thread groups are claimed in chunks from a shared counter, and the thread id
+// passed to the shader matches the serial enumeration order (group Z/Y/X,
+// then thread Z/Y/X). Images compiled with a SIMD entry point run up to
+// simdWidth consecutive threads per call, the last call of a chunk may have
+// fewer active lanes.
+//
+// The workers stop claiming chunks once *pPreemptionRequested is set. Claimed
+// chunks always finish, so the groups that ran are the ones below End() and
+// the dispatch resumes from there.
+//
+// The caller starts the workers and waits for all of them to return from
+// Run() before calling End(). Shared by the KMD dispatch engine and the user
+// mode test (vputest).
+//
+
+class CosThreadGroupDispatch
+{
+public:
+
+    //
+    // Returns the number of workers worth running the thread groups from
+    // firstThreadGroup on with, 0 when there is nothing to run
+    //
+
+    UINT Begin(
+        UINT                    numThreadGroups,
+        UINT                    numThreadsPerGroup,
+        UINT                    firstThreadGroup,
+        UINT                    numWorkers,
+        UINT                    maxThreadGroupChunk,
+        const volatile LONG *   pPreemptionRequested)
+    {
+        m_numThreadsPerGroup = numThreadsPerGroup;
+        m_numThreadGroups = (LONG)numThreadGroups;
+        m_nextThreadGroup = (LONG)firstThreadGroup;
+        m_pPreemptionRequested = pPreemptionRequested;
+
+        if ((0 == numThreadsPerGroup) || (firstThreadGroup >= numThreadGroups))
+        {
+            m_nextThreadGroup = (LONG)numThreadGroups;
+
+            return 0;
+        }
+
+        //
+        // Hand out a few chunks per worker to balance load without contending
+        // on the group counter for every thread group
+        //
+
+        UINT numRemainingGroups = numThreadGroups - firstThreadGroup;
+
+        if (numWorkers > numRemainingGroups)
+        {
+            numWorkers = numRemainingGroups;
+        }
+
+        if (0 == numWorkers)
+        {
+            numWorkers = 1;
+        }
+
+        UINT chunk = numRemainingGroups/(numWorkers*4);
+
+        if (chunk > maxThreadGroupChunk)
+        {
+            chunk = maxThreadGroupChunk;
+        }
+
+        m_threadGroupChunk = (LONG)((0 == chunk) ? 1 : chunk);
+
+        return numWorkers;
+    }
+
+    static void SetUavs(
+        uint8_t *                       pImageBase,
+        uint64_t                        tlsOffset,
+        const VpuResourceDescriptor *   pUavs,
+        UINT                            numUavs)
+    {
+        VpuThreadLocalStorage * tls = (VpuThreadLocalStorage *)(pImageBase + tlsOffset);
+
+        memcpy(tls->m_uavs, pUavs, numUavs*sizeof(VpuResourceDescriptor));
+    }
+
+    void Run(
+        uint8_t *   pImageBase,
+        uint64_t    tlsOffset,
+        uint64_t    entryOffset,
+        UINT        simdWidth)
+    {
+        VpuThreadLocalStorage * tls = (VpuThreadLocalStorage *)(pImageBase + tlsOffset);
+        void(*shader_main)() = (void(*)(void)) (pImageBase + entryOffset);
+        int32_t width = (int32_t)simdWidth;
+
+        for (;;)
+        {
+            if (m_pPreemptionRequested && ReadNoFence(m_pPreemptionRequested))
+            {
+                break;
+            }
+
+            LONG firstGroup = InterlockedExchangeAdd(&m_nextThreadGroup, m_threadGroupChunk);
+            if (firstGroup >= m_numThreadGroups)
+            {
+                break;
+            }
+
+            LONG endGroup = firstGroup + m_threadGroupChunk;
+
+            if (endGroup > m_numThreadGroups)
+            {
+                endGroup = m_numThreadGroups;
+            }
+
+            //
+            // Thread ids of consecutive groups are contiguous, so the whole
+            // chunk is run as one range
+            //
+
+            int32_t threadId = (int32_t)(firstGroup*m_numThreadsPerGroup);
+            int32_t endThreadId = (int32_t)(endGroup*m_numThreadsPerGroup);
+
+            for (; threadId < endThreadId; threadId += width)
+            {
+                tls->m_id = threadId;
+                tls->m_idCount = ((endThreadId - threadId) < width) ? (endThreadId - threadId) : width;
+                shader_main();
+            }
+        }
+    }
+
+    //
+    // Index of the first thread group that did not run, the number of thread
+    // groups once the dispatch is done
+    //
+
+    UINT End()
+    {
+        m_pPreemptionRequested = NULL;
+
+        return (UINT)((m_nextThreadGroup < m_numThreadGroups) ? m_nextThreadGroup : m_numThreadGroups);
+    }
+
+private:
+
+    UINT                    m_numThreadsPerGroup;
+    LONG                    m_numThreadGroups;
+    LONG                    m_threadGroupChunk;
+
+    volatile LONG           m_nextThreadGroup;
+
+    const volatile LONG    *m_pPreemptionRequested;
+};
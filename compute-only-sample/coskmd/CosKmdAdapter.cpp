@@ -42,6 +42,30 @@ BOOLEAN g_bTriggerEngineReset = false;
 
 BOOLEAN g_bTriggerTDR = false;
 
+//
+// Global variable to set in kernel debugger, before the adapter starts, for
+// the policy the compute nodes share the compute core with
+//
+
+CosComputeSchedulingPolicy g_ComputeSchedulingPolicy = CosComputeSchedulingPriority;
+
+static CosTimelinePagingCommand
+CosKmGetTimelinePagingCommand(
+    DXGK_BUILDPAGINGBUFFER_OPERATION    operation)
+{
+    switch (operation)
+    {
+    case DXGK_OPERATION_FILL:
+        return CosTimelinePagingFill;
+#if COS_GPUVA_SUPPORT
+    case DXGK_OPERATION_FLUSH_TLB:
+        return CosTimelinePagingFlushTlb;
+#endif
+    default:
+        return CosTimelinePagingTransfer;
+    }
+}
+
 void * CosKmAdapter::operator new(size_t size)
 {
     return ExAllocatePoolWithTag(NonPagedPoolNx, size, 'COSD');
@@ -106,14 +130,15 @@ CosKmAdapter::AddAdapter(
     return STATUS_SUCCESS;
 }
 
-void CosKmAdapter::WorkerThread(void * inThis)
+void CosKmAdapter::WorkerThread(void * inNode)
 {
-    CosKmAdapter  *pCosKmAdapter = CosKmAdapter::Cast(inThis);
+    EngineNode     *pNode = (EngineNode *)inNode;
+    CosKmAdapter   *pCosKmAdapter = CosKmAdapter::Cast(pNode->m_pAdapter);
 
-    pCosKmAdapter->DoWork();
+    pCosKmAdapter->DoWork(pNode);
 }
 
-void CosKmAdapter::DoWork(void)
+void CosKmAdapter::DoWork(EngineNode * pNode)
 {
     bool done = false;
     KEVENT dmaBufStallEvent;
@@ -125,9 +150,9 @@ void CosKmAdapter::DoWork(void)
         PVOID       waitEvents[3];
         NTSTATUS    status;
         
-        waitEvents[0] = &m_workerThreadEvent;
-        waitEvents[1] = &m_preemptionEvent;
-        waitEvents[2] = &m_resetRequestEvent;
+        waitEvents[0] = &pNode->m_workerThreadEvent;
+        waitEvents[1] = &pNode->m_preemptionEvent;
+        waitEvents[2] = &pNode->m_resetRequestEvent;
 
         status = KeWaitForMultipleObjects(
                     ARRAYSIZE(waitEvents),
@@ -145,19 +170,19 @@ void CosKmAdapter::DoWork(void)
             // Notify completion of Preemption request
             //
 
-            NotifyPreemptionCompletion();
+            NotifyPreemptionCompletion(pNode);
 
             continue;
         }
         if (STATUS_WAIT_2 == status)
         {
-            EmptyDmaBufferQueue();
+            EmptyDmaBufferQueue(pNode);
 
             //
             // Signal back to the waiting DDI thread
             //
 
-            KeSetEvent(&m_resetCompletionEvent, 0, FALSE);
+            KeSetEvent(&pNode->m_resetCompletionEvent, 0, FALSE);
 
             continue;
         }
@@ -172,7 +197,30 @@ void CosKmAdapter::DoWork(void)
 
         for (;;)
         {
-            COSDMABUFSUBMISSION *   pDmaBufSubmission = DequeueDmaBuffer(&m_dmaBufQueueLock);
+            //
+            // Honor a Preemption request between DMA buffers, the VidSch
+            // time-slices contexts of different priority on the node with it
+            //
+
+            LARGE_INTEGER   noWait;
+
+            noWait.QuadPart = 0;
+
+            status = KeWaitForSingleObject(
+                        &pNode->m_preemptionEvent,
+                        Executive,
+                        KernelMode,
+                        FALSE,
+                        &noWait);
+
+            if (STATUS_SUCCESS == status)
+            {
+                NotifyPreemptionCompletion(pNode);
+
+                break;
+            }
+
+            COSDMABUFSUBMISSION *   pDmaBufSubmission = pNode->m_dmaBufQueue.Peek();
             if (pDmaBufSubmission == NULL)
             {
                 break;
@@ -180,6 +228,8 @@ void CosKmAdapter::DoWork(void)
 
             COSDMABUFINFO * pDmaBufInfo = pDmaBufSubmission->m_pDmaBufInfo;
 
+            m_timeline.Record(CosTimelineEventStarted, pNode->m_nodeOrdinal, pDmaBufSubmission->m_SubmissionFenceId);
+
             if (0 != pDmaBufInfo->m_DmaBufStallDuration)
             {
                 LARGE_INTEGER   timeout, waitStart, waitEnd;
@@ -190,7 +240,7 @@ void CosKmAdapter::DoWork(void)
                 //
 
                 waitEvents[0] = &dmaBufStallEvent;
-                waitEvents[1] = &m_preemptionEvent;
+                waitEvents[1] = &pNode->m_preemptionEvent;
 
                 timeout.QuadPart = pDmaBufInfo->m_DmaBufStallDuration;
 
@@ -234,13 +284,15 @@ void CosKmAdapter::DoWork(void)
                         pDmaBufInfo->m_DmaBufStallDuration = 0;
                     }
 
-                    ExInterlockedInsertTailList(&m_dmaBufSubmissionFree, &pDmaBufSubmission->m_QueueEntry, &m_dmaBufQueueLock);
+                    m_timeline.Record(CosTimelineEventPreempted, pNode->m_nodeOrdinal, pDmaBufSubmission->m_SubmissionFenceId);
+
+                    pNode->m_dmaBufQueue.Release();
 
                     //
                     // Notify completion of Preemption request
                     //
 
-                    NotifyPreemptionCompletion();
+                    NotifyPreemptionCompletion(pNode);
 
                     break;
                 }
@@ -254,12 +306,44 @@ void CosKmAdapter::DoWork(void)
                 }
             }
 
+            bool bComputeNode = (pNode->m_nodeOrdinal < C_COS_COMPUTE_NODE_COUNT);
+
+            if (bComputeNode)
+            {
+                status = AcquireComputeCore(pNode, pDmaBufInfo->m_Priority);
+
+                if (STATUS_WAIT_1 == status)
+                {
+                    //
+                    // Preempted while waiting for the compute core
+                    //
+
+                    m_timeline.Record(CosTimelineEventPreempted, pNode->m_nodeOrdinal, pDmaBufSubmission->m_SubmissionFenceId);
+
+                    NotifyPreemptionCompletion(pNode);
+
+                    break;
+                }
+                if (STATUS_WAIT_2 == status)
+                {
+                    EmptyDmaBufferQueue(pNode);
+
+                    KeSetEvent(&pNode->m_resetCompletionEvent, 0, FALSE);
+
+                    break;
+                }
+
+                NT_ASSERT(STATUS_SUCCESS == status);
+            }
+
             if (pDmaBufInfo->m_DmaBufState.m_bPaging)
             {
                 //
-                // Run paging buffer in software
+                // Run paging buffer in software, paging only runs on the first compute node
                 //
 
+                NT_ASSERT(C_COS_COMPUTE_NODE_ORDINAL == pNode->m_nodeOrdinal);
+
                 ProcessPagingBuffer(pDmaBufSubmission);
 
             }
@@ -269,6 +353,10 @@ void CosKmAdapter::DoWork(void)
                 ProcessGpuVaRenderBuffer(pDmaBufSubmission);
             }
 #else
+            else if (C_COS_COPY_NODE_ORDINAL == pNode->m_nodeOrdinal)
+            {
+                ProcessCopyBuffer(pDmaBufSubmission);
+            }
             else if (pDmaBufInfo->m_DmaBufState.m_bSwCommandBuffer)
             {
                 //
@@ -283,55 +371,68 @@ void CosKmAdapter::DoWork(void)
             }
 #endif
 
-            NotifyDmaBufCompletion(pDmaBufSubmission);
+            if (bComputeNode)
+            {
+                ReleaseComputeCore(pNode);
+            }
 
-            ExInterlockedInsertTailList(&m_dmaBufSubmissionFree, &pDmaBufSubmission->m_QueueEntry, &m_dmaBufQueueLock);
-        }
-    }
-}
+            if (pDmaBufInfo->m_ResumeOffset)
+            {
+                //
+                // Preempted in the middle of a dispatch, the VidSch resubmits
+                // the DMA buffer. The Preemption request is handled here, so
+                // it must not wake the worker thread again.
+                //
+                // The dispatch stopped on m_preemptionRequested, which
+                // PreemptCommand() sets before m_preemptionEvent. Clearing
+                // the event could run before it is set, so wait for it
+                // instead, the wait consumes exactly this request's signal.
+                //
 
-COSDMABUFSUBMISSION *
-CosKmAdapter::DequeueDmaBuffer(
-    KSPIN_LOCK *pDmaBufQueueLock)
-{
-    LIST_ENTRY *pDmaEntry;
+                pDmaBufInfo->m_DmaBufState.m_bPreempted = 1;
 
-    if (pDmaBufQueueLock)
-    {
-        pDmaEntry = ExInterlockedRemoveHeadList(&m_dmaBufQueue, pDmaBufQueueLock);
-    }
-    else
-    {
-        if (!IsListEmpty(&m_dmaBufQueue))
-        {
-            pDmaEntry = RemoveHeadList(&m_dmaBufQueue);
-        }
-        else
-        {
-            pDmaEntry = NULL;
+                m_timeline.Record(
+                    CosTimelineEventPreempted,
+                    pNode->m_nodeOrdinal,
+                    pDmaBufSubmission->m_SubmissionFenceId,
+                    0,
+                    pDmaBufInfo->m_ResumeThreadGroup);
+
+                NT_ASSERT(ReadNoFence(&pNode->m_preemptionRequested));
+
+                KeWaitForSingleObject(
+                    &pNode->m_preemptionEvent,
+                    Executive,
+                    KernelMode,
+                    FALSE,
+                    NULL);
+
+                pNode->m_dmaBufQueue.Release();
+
+                NotifyPreemptionCompletion(pNode);
+
+                break;
+            }
+
+            NotifyDmaBufCompletion(pNode, pDmaBufSubmission);
+
+            pNode->m_dmaBufQueue.Release();
         }
     }
-
-    return CONTAINING_RECORD(pDmaEntry, COSDMABUFSUBMISSION, m_QueueEntry);
 }
 
 void
-CosKmAdapter::EmptyDmaBufferQueue()
+CosKmAdapter::EmptyDmaBufferQueue(
+    EngineNode * pNode)
 {
-    KIRQL                   OldIrql;
-
-    KeAcquireSpinLock(&m_dmaBufQueueLock, &OldIrql);
+    //
+    // Only called on the worker thread of the node, which is the consumer of the ring
+    //
 
-    while (!IsListEmpty(&m_dmaBufQueue))
+    while (pNode->m_dmaBufQueue.Peek())
     {
-        LIST_ENTRY *pQueueEntry;
-
-        pQueueEntry = RemoveHeadList(&m_dmaBufQueue);
-
-        InsertTailList(&m_dmaBufSubmissionFree, pQueueEntry);
+        pNode->m_dmaBufQueue.Release();
     }
-
-    KeReleaseSpinLock(&m_dmaBufQueueLock, OldIrql);
 }
 
 void
@@ -345,8 +446,26 @@ CosKmAdapter::ProcessPagingBuffer(
     DXGKARG_BUILDPAGINGBUFFER * pPagingBuffer = (DXGKARG_BUILDPAGINGBUFFER *)(pDmaBufInfo->m_pDmaBuffer + pDmaBufSubmission->m_StartOffset);
     DXGKARG_BUILDPAGINGBUFFER * pEndofBuffer = (DXGKARG_BUILDPAGINGBUFFER *)(pDmaBufInfo->m_pDmaBuffer + pDmaBufSubmission->m_EndOffset);
 
+    //
+    // Fills use SSE2 on this thread
+    //
+
+    KFLOATING_SAVE floatingSave;
+
+    KeSaveFloatingPointState(&floatingSave);
+
     for (; pPagingBuffer < pEndofBuffer; pPagingBuffer++)
     {
+        CosTimelinePagingCommand pagingCommand = CosKmGetTimelinePagingCommand(pPagingBuffer->Operation);
+        UINT pagingOffset = (UINT)((PBYTE)pPagingBuffer - pDmaBufInfo->m_pDmaBuffer);
+
+        m_timeline.Record(
+            CosTimelineEventPagingStart,
+            pDmaBufSubmission->m_NodeOrdinal,
+            pDmaBufSubmission->m_SubmissionFenceId,
+            pagingCommand,
+            pagingOffset);
+
         switch (pPagingBuffer->Operation)
         {
         case DXGK_OPERATION_FILL:
@@ -354,22 +473,17 @@ CosKmAdapter::ProcessPagingBuffer(
             NT_ASSERT(pPagingBuffer->Fill.Destination.SegmentId == COS_SEGMENT_VIDEO_MEMORY);
             NT_ASSERT(pPagingBuffer->Fill.FillSize % sizeof(ULONG) == 0);
 
-            ULONG * const startAddress = reinterpret_cast<ULONG*>(
-                (BYTE *)CosKmdGlobal::s_pVideoMemory +
-                pPagingBuffer->Fill.Destination.SegmentAddress.QuadPart);
-            for (ULONG * ptr = startAddress;
-                 ptr != (startAddress + pPagingBuffer->Fill.FillSize / sizeof(ULONG));
-                 ++ptr)
-            {
-                *ptr = pPagingBuffer->Fill.FillPattern;
-            }
+            m_pagingEngine.Fill(
+                (BYTE *)CosKmdGlobal::s_pVideoMemory + pPagingBuffer->Fill.Destination.SegmentAddress.QuadPart,
+                pPagingBuffer->Fill.FillSize,
+                pPagingBuffer->Fill.FillPattern);
         }
         break;
         case DXGK_OPERATION_TRANSFER:
         {
             //
-            // TODO: Improve paging operation efficiency for HW with DMA engine
-            //       for paging operation but not aperture segment.
+            // Transfers are queued so the engine can coalesce adjacent ones
+            // and split large copies across the workers
             //
 
             PBYTE   pSource, pDestination;
@@ -419,31 +533,102 @@ CosKmAdapter::ProcessPagingBuffer(
 
             if (pSource && pDestination)
             {
-                RtlCopyMemory(pDestination, pSource, pPagingBuffer->Transfer.TransferSize);
+                // Restore the state of the Mdl (for source or destionation) once the copy is done
+                if ((0 == (savedMdlFlags & MDL_MAPPED_TO_SYSTEM_VA)) && pKmAddrToUnmap)
+                {
+                    if (m_numPagingMappings == CosPagingEngine::kMaxQueuedCopies)
+                    {
+                        FlushPagingTransfers();
+                    }
+
+                    m_pagingMappings[m_numPagingMappings].m_pKmAddress = pKmAddrToUnmap;
+                    m_pagingMappings[m_numPagingMappings].m_pMdl = pMdlToRestore;
+                    m_numPagingMappings++;
+                }
+
+                m_pagingEngine.QueueCopy(pDestination, pSource, pPagingBuffer->Transfer.TransferSize);
             }
             else
             {
                 // TODO[indyz]: Propagate the error back to runtime
                 m_ErrorHit.m_PagingFailure = 1;
             }
+        }
+        break;
 
-            // Restore the state of the Mdl (for source or destionation)
-            if ((0 == (savedMdlFlags & MDL_MAPPED_TO_SYSTEM_VA)) && pKmAddrToUnmap)
-            {
-                MmUnmapLockedPages(pKmAddrToUnmap, pMdlToRestore);
-            }
+#if COS_GPUVA_SUPPORT
+
+        case DXGK_OPERATION_FLUSH_TLB:
+        {
+            m_gpuMmu.FlushTlb();
         }
         break;
 
+#endif
+
         default:
             NT_ASSERT(false);
         }
+
+        m_timeline.Record(
+            CosTimelineEventPagingEnd,
+            pDmaBufSubmission->m_NodeOrdinal,
+            pDmaBufSubmission->m_SubmissionFenceId,
+            pagingCommand,
+            pagingOffset);
     }
+
+    m_timeline.Record(
+        CosTimelineEventPagingStart,
+        pDmaBufSubmission->m_NodeOrdinal,
+        pDmaBufSubmission->m_SubmissionFenceId,
+        CosTimelinePagingFlush,
+        pDmaBufSubmission->m_EndOffset);
+
+    FlushPagingTransfers();
+
+    m_timeline.Record(
+        CosTimelineEventPagingEnd,
+        pDmaBufSubmission->m_NodeOrdinal,
+        pDmaBufSubmission->m_SubmissionFenceId,
+        CosTimelinePagingFlush,
+        pDmaBufSubmission->m_EndOffset);
+
+    KeRestoreFloatingPointState(&floatingSave);
+
+    const CosPagingStats & pagingStats = m_pagingEngine.GetStats();
+
+    DbgPrintEx(DPFLTR_IHVVIDEO_ID, DPFLTR_TRACE_LEVEL,
+        "Paging: fill %I64u bytes at %I64u MB/s, transfer %I64u bytes at %I64u MB/s in %I64u copies (%I64u transfers)\n",
+        pagingStats.m_numBytes[CosPagingOperationFill],
+        pagingStats.GetBytesPerSecond(CosPagingOperationFill) >> 20,
+        pagingStats.m_numBytes[CosPagingOperationTransfer],
+        pagingStats.GetBytesPerSecond(CosPagingOperationTransfer) >> 20,
+        pagingStats.m_numCopies,
+        pagingStats.m_numOperations[CosPagingOperationTransfer]);
+}
+
+//
+// Completes the queued transfers and releases the system memory mapped for them
+//
+
+void
+CosKmAdapter::FlushPagingTransfers()
+{
+    m_pagingEngine.Flush();
+
+    for (UINT i = 0; i < m_numPagingMappings; i++)
+    {
+        MmUnmapLockedPages(m_pagingMappings[i].m_pKmAddress, m_pagingMappings[i].m_pMdl);
+    }
+
+    m_numPagingMappings = 0;
 }
 
 void
 CosKmAdapter::NotifyDmaBufCompletion(
-    COSDMABUFSUBMISSION * pDmaBufSubmission)
+    EngineNode *            pNode,
+    COSDMABUFSUBMISSION *   pDmaBufSubmission)
 {
     COSDMABUFINFO * pDmaBufInfo = pDmaBufSubmission->m_pDmaBufInfo;
 
@@ -466,19 +651,19 @@ CosKmAdapter::NotifyDmaBufCompletion(
     //
     NTSTATUS    Status;
 
-    RtlZeroMemory(&m_interruptData, sizeof(m_interruptData));
+    RtlZeroMemory(&pNode->m_interruptData, sizeof(pNode->m_interruptData));
 
-    m_interruptData.InterruptType = DXGK_INTERRUPT_DMA_COMPLETED;
-    m_interruptData.DmaCompleted.SubmissionFenceId = pDmaBufSubmission->m_SubmissionFenceId;
-    m_interruptData.DmaCompleted.NodeOrdinal = 0;
-    m_interruptData.DmaCompleted.EngineOrdinal = 0;
+    pNode->m_interruptData.InterruptType = DXGK_INTERRUPT_DMA_COMPLETED;
+    pNode->m_interruptData.DmaCompleted.SubmissionFenceId = pDmaBufSubmission->m_SubmissionFenceId;
+    pNode->m_interruptData.DmaCompleted.NodeOrdinal = pNode->m_nodeOrdinal;
+    pNode->m_interruptData.DmaCompleted.EngineOrdinal = 0;
 
     BOOLEAN bRet;
 
     Status = m_DxgkInterface.DxgkCbSynchronizeExecution(
         m_DxgkInterface.DeviceHandle,
         SynchronizeNotifyInterrupt,
-        this,
+        pNode,
         0,
         &bRet);
 
@@ -487,21 +672,26 @@ CosKmAdapter::NotifyDmaBufCompletion(
         m_ErrorHit.m_NotifyDmaBufCompletion = 1;
     }
 
+    m_timeline.Record(CosTimelineEventCompleted, pNode->m_nodeOrdinal, pDmaBufSubmission->m_SubmissionFenceId);
+
     //
     // Keep track of last completed fence ID for Preemption request afterward
     //
 
-    m_lastCompletetdFenceId = pDmaBufSubmission->m_SubmissionFenceId;
+    pNode->m_lastCompletetdFenceId = pDmaBufSubmission->m_SubmissionFenceId;
 }
 
 void
-CosKmAdapter::NotifyPreemptionCompletion()
+CosKmAdapter::NotifyPreemptionCompletion(
+    EngineNode * pNode)
 {
+    InterlockedExchange(&pNode->m_preemptionRequested, 0);
+
     //
     // Remove the queued DMA buffers which will be submitted again
     //
 
-    EmptyDmaBufferQueue();
+    EmptyDmaBufferQueue(pNode);
 
     //
     // Notify the VidSch of the completion of the Preemption request
@@ -509,20 +699,20 @@ CosKmAdapter::NotifyPreemptionCompletion()
 
     NTSTATUS    Status;
 
-    RtlZeroMemory(&m_interruptData, sizeof(m_interruptData));
+    RtlZeroMemory(&pNode->m_interruptData, sizeof(pNode->m_interruptData));
 
-    m_interruptData.InterruptType = DXGK_INTERRUPT_DMA_PREEMPTED;
-    m_interruptData.DmaPreempted.PreemptionFenceId = m_preemptionRequest.PreemptionFenceId;
-    m_interruptData.DmaPreempted.LastCompletedFenceId = m_lastCompletetdFenceId;
-    m_interruptData.DmaPreempted.NodeOrdinal = m_preemptionRequest.NodeOrdinal;
-    m_interruptData.DmaPreempted.EngineOrdinal = m_preemptionRequest.EngineOrdinal;
+    pNode->m_interruptData.InterruptType = DXGK_INTERRUPT_DMA_PREEMPTED;
+    pNode->m_interruptData.DmaPreempted.PreemptionFenceId = pNode->m_preemptionRequest.PreemptionFenceId;
+    pNode->m_interruptData.DmaPreempted.LastCompletedFenceId = pNode->m_lastCompletetdFenceId;
+    pNode->m_interruptData.DmaPreempted.NodeOrdinal = pNode->m_preemptionRequest.NodeOrdinal;
+    pNode->m_interruptData.DmaPreempted.EngineOrdinal = pNode->m_preemptionRequest.EngineOrdinal;
 
     BOOLEAN bRet;
 
     Status = m_DxgkInterface.DxgkCbSynchronizeExecution(
         m_DxgkInterface.DeviceHandle,
         SynchronizeNotifyInterrupt,
-        this,
+        pNode,
         0,
         &bRet);
 
@@ -531,19 +721,20 @@ CosKmAdapter::NotifyPreemptionCompletion()
         m_ErrorHit.m_NotifyPreemptionCompletion = 1;
     }
 
-    m_lastCompeletedPreemptionFenceId = m_preemptionRequest.PreemptionFenceId;
+    pNode->m_lastCompeletedPreemptionFenceId = pNode->m_preemptionRequest.PreemptionFenceId;
 }
 
-BOOLEAN CosKmAdapter::SynchronizeNotifyInterrupt(PVOID inThis)
+BOOLEAN CosKmAdapter::SynchronizeNotifyInterrupt(PVOID inNode)
 {
-    CosKmAdapter  *pCosKmAdapter = CosKmAdapter::Cast(inThis);
+    EngineNode     *pNode = (EngineNode *)inNode;
+    CosKmAdapter   *pCosKmAdapter = CosKmAdapter::Cast(pNode->m_pAdapter);
 
-    return pCosKmAdapter->SynchronizeNotifyInterrupt();
+    return pCosKmAdapter->SynchronizeNotifyInterrupt(pNode);
 }
 
-BOOLEAN CosKmAdapter::SynchronizeNotifyInterrupt(void)
+BOOLEAN CosKmAdapter::SynchronizeNotifyInterrupt(EngineNode * pNode)
 {
-    m_DxgkInterface.DxgkCbNotifyInterrupt(m_DxgkInterface.DeviceHandle, &m_interruptData);
+    m_DxgkInterface.DxgkCbNotifyInterrupt(m_DxgkInterface.DeviceHandle, &pNode->m_interruptData);
 
     return m_DxgkInterface.DxgkCbQueueDpc(m_DxgkInterface.DeviceHandle);
 }
@@ -570,97 +761,97 @@ CosKmAdapter::Start(
     //
     m_WDDMVersion = DXGKDDI_WDDMv2_6;
 
-    m_NumNodes = C_COS_GPU_ENGINE_COUNT;
+    m_NumNodes = C_COS_NODE_COUNT;
 
-    //
-    // Initialize work thread and Preemption request events
-    //
+    for (UINT i = 0; i < m_NumNodes; i++)
+    {
+        EngineNode * pNode = &m_nodes[i];
 
-    KeInitializeEvent(&m_workerThreadEvent, SynchronizationEvent, FALSE);
-    KeInitializeEvent(&m_preemptionEvent, SynchronizationEvent, FALSE);
+        pNode->m_pAdapter = this;
+        pNode->m_nodeOrdinal = i;
 
-    //
-    // Intialize DMA buffer queue and lock
-    //
+        //
+        // Initialize work thread and Preemption request events
+        //
 
-    InitializeListHead(&m_dmaBufSubmissionFree);
-    for (UINT i = 0; i < m_maxDmaBufQueueLength; i++)
-    {
-        InsertHeadList(&m_dmaBufSubmissionFree, &m_dmaBufSubssions[i].m_QueueEntry);
-    }
+        KeInitializeEvent(&pNode->m_workerThreadEvent, SynchronizationEvent, FALSE);
+        KeInitializeEvent(&pNode->m_preemptionEvent, SynchronizationEvent, FALSE);
 
-    InitializeListHead(&m_dmaBufQueue);
-    KeInitializeSpinLock(&m_dmaBufQueueLock);
+        pNode->m_preemptionRequested = 0;
 
-    //
-    // Initialize HW DMA buffer compeletion DPC and event
-    //
+        //
+        // Intialize DMA buffer queue
+        //
 
-    KeInitializeEvent(&m_hwDmaBufCompletionEvent, SynchronizationEvent, FALSE);
-    KeInitializeDpc(&m_hwDmaBufCompletionDpc, HwDmaBufCompletionDpcRoutine, this);
+        pNode->m_dmaBufQueue.Initialize();
+
+        //
+        // Initialize Fence IDs
+        //
+
+        pNode->m_lastSubmittedFenceId = 0;
+        pNode->m_lastCompletetdFenceId = 0;
+
+        pNode->m_lastCompeletedPreemptionFenceId = 0;
+
+        //
+        // Initialize TDR related fields
+        //
+
+        pNode->m_bInHangState = false;
+
+        KeInitializeEvent(&pNode->m_resetRequestEvent, SynchronizationEvent, FALSE);
+        KeInitializeEvent(&pNode->m_resetCompletionEvent, SynchronizationEvent, FALSE);
+
+        KeInitializeEvent(&pNode->m_computeGrantEvent, SynchronizationEvent, FALSE);
+    }
+
+    KeInitializeSpinLock(&m_computeSchedulerLock);
+    m_computeScheduler.Initialize(C_COS_COMPUTE_NODE_COUNT, g_ComputeSchedulingPolicy);
 
     //
-    // Initialize Fence IDs
+    // Paging runs on the compute node worker thread alone until a subclass
+    // supplies workers
     //
 
-    m_lastSubmittedFenceId = 0;
-    m_lastCompletetdFenceId = 0;
+    m_pagingEngine.Initialize(NULL);
+    m_numPagingMappings = 0;
 
-    m_lastCompeletedPreemptionFenceId = 0;
+    m_timeline.Initialize();
 
     //
-    // Initialize TDR related fields
+    // Initialize HW DMA buffer compeletion DPC and event
     //
 
-    m_bInHangState = false;
+    KeInitializeEvent(&m_hwDmaBufCompletionEvent, SynchronizationEvent, FALSE);
+    KeInitializeDpc(&m_hwDmaBufCompletionDpc, HwDmaBufCompletionDpcRoutine, this);
 
-    KeInitializeEvent(&m_resetRequestEvent, SynchronizationEvent, FALSE);
-    KeInitializeEvent(&m_resetCompletionEvent, SynchronizationEvent, FALSE);
+#if COS_PHYSICAL_SUPPORT
+    m_residencyGeneration = 0;
+#endif
 
     m_workerExit = false;
 
     //
-    // Initialize worker thread
+    // Initialize a worker thread per node
     //
 
-    OBJECT_ATTRIBUTES   ObjectAttributes;
-    HANDLE              hWorkerThread;
-
-    InitializeObjectAttributes(&ObjectAttributes, NULL, OBJ_KERNEL_HANDLE, NULL, NULL);
-
-    NTSTATUS status = PsCreateSystemThread(
-        &hWorkerThread,
-        THREAD_ALL_ACCESS,
-        &ObjectAttributes,
-        NULL,
-        NULL,
-        (PKSTART_ROUTINE) CosKmAdapter::WorkerThread,
-        this);
+    NTSTATUS status;
 
-    if (status != STATUS_SUCCESS)
+    for (UINT i = 0; i < m_NumNodes; i++)
     {
-        COS_LOG_ERROR(
-            "PsCreateSystemThread(...) failed for CosKmAdapter::WorkerThread. (status=%!STATUS!)",
-            status);
-        return status;
-    }
-
-    status = ObReferenceObjectByHandle(
-        hWorkerThread,
-        THREAD_ALL_ACCESS,
-        *PsThreadType,
-        KernelMode,
-        (PVOID *)&m_pWorkerThread,
-        NULL);
+        status = StartWorkerThread(&m_nodes[i]);
+        if (!NT_SUCCESS(status))
+        {
+            m_workerExit = true;
 
-    ZwClose(hWorkerThread);
+            while (i--)
+            {
+                StopWorkerThread(&m_nodes[i]);
+            }
 
-    if (!NT_SUCCESS(status))
-    {
-        COS_LOG_ERROR(
-            "ObReferenceObjectByHandle(...) failed for worker thread. (status=%!STATUS!)",
-            status);
-        return status;
+            return status;
+        }
     }
 
     status = m_DxgkInterface.DxgkCbGetDeviceInformation(
@@ -708,6 +899,13 @@ CosKmAdapter::Start(
 
     memset(m_aperturePageTable, 0, sizeof(m_aperturePageTable));
 
+#if COS_GPUVA_SUPPORT
+
+    m_gpuMmuMemory.Initialize();
+    m_gpuMmu.Initialize(&m_gpuMmuMemory);
+
+#endif
+
     COS_LOG_TRACE("Adapter was successfully started.");
     return STATUS_SUCCESS;
 }
@@ -717,10 +915,88 @@ CosKmAdapter::Stop()
 {
     m_workerExit = true;
 
-    KeSetEvent(&m_workerThreadEvent, 0, FALSE);
+    for (UINT i = 0; i < m_NumNodes; i++)
+    {
+        StopWorkerThread(&m_nodes[i]);
+    }
+
+#if COS_GPUVA_SUPPORT
+
+    //
+    // Unmap the pages still held by the TLB
+    //
+
+    m_gpuMmu.FlushTlb();
+
+#endif
+
+    COS_LOG_TRACE("Adapter was successfully stopped.");
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+CosKmAdapter::StartWorkerThread(
+    EngineNode * pNode)
+{
+    OBJECT_ATTRIBUTES   ObjectAttributes;
+    HANDLE              hWorkerThread;
+
+    InitializeObjectAttributes(&ObjectAttributes, NULL, OBJ_KERNEL_HANDLE, NULL, NULL);
+
+    NTSTATUS status = PsCreateSystemThread(
+        &hWorkerThread,
+        THREAD_ALL_ACCESS,
+        &ObjectAttributes,
+        NULL,
+        NULL,
+        (PKSTART_ROUTINE) CosKmAdapter::WorkerThread,
+        pNode);
+
+    if (status != STATUS_SUCCESS)
+    {
+        COS_LOG_ERROR(
+            "PsCreateSystemThread(...) failed for CosKmAdapter::WorkerThread. (status=%!STATUS!, NodeOrdinal=%d)",
+            status,
+            pNode->m_nodeOrdinal);
+        return status;
+    }
+
+    status = ObReferenceObjectByHandle(
+        hWorkerThread,
+        THREAD_ALL_ACCESS,
+        *PsThreadType,
+        KernelMode,
+        (PVOID *)&pNode->m_pWorkerThread,
+        NULL);
+
+    ZwClose(hWorkerThread);
+
+    if (!NT_SUCCESS(status))
+    {
+        COS_LOG_ERROR(
+            "ObReferenceObjectByHandle(...) failed for worker thread. (status=%!STATUS!, NodeOrdinal=%d)",
+            status,
+            pNode->m_nodeOrdinal);
+        return status;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+//
+// m_workerExit must be set before the worker thread is stopped
+//
+
+void
+CosKmAdapter::StopWorkerThread(
+    EngineNode * pNode)
+{
+    NT_ASSERT(m_workerExit);
+
+    KeSetEvent(&pNode->m_workerThreadEvent, 0, FALSE);
 
     NTSTATUS status = KeWaitForSingleObject(
-        m_pWorkerThread,
+        pNode->m_pWorkerThread,
         Executive,
         KernelMode,
         FALSE,
@@ -729,10 +1005,114 @@ CosKmAdapter::Stop()
     status;
     NT_ASSERT(status == STATUS_SUCCESS);
 
-    ObDereferenceObject(m_pWorkerThread);
+    ObDereferenceObject(pNode->m_pWorkerThread);
+}
 
-    COS_LOG_TRACE("Adapter was successfully stopped.");
-    return STATUS_SUCCESS;
+//
+// Returns STATUS_SUCCESS once the node owns the compute core, STATUS_WAIT_1 or
+// STATUS_WAIT_2 when a Preemption or reset request came first. The request is
+// withdrawn in that case, the worker thread then handles the request the same
+// way as between DMA buffers.
+//
+
+NTSTATUS
+CosKmAdapter::AcquireComputeCore(
+    EngineNode *    pNode,
+    UINT            priority)
+{
+    KIRQL   oldIrql;
+    bool    bGranted;
+
+    KeAcquireSpinLock(&m_computeSchedulerLock, &oldIrql);
+    bGranted = m_computeScheduler.Request(pNode->m_nodeOrdinal, priority);
+    KeReleaseSpinLock(&m_computeSchedulerLock, oldIrql);
+
+    if (bGranted)
+    {
+        return STATUS_SUCCESS;
+    }
+
+    PVOID       waitEvents[3];
+    NTSTATUS    status;
+
+    waitEvents[0] = &pNode->m_computeGrantEvent;
+    waitEvents[1] = &pNode->m_preemptionEvent;
+    waitEvents[2] = &pNode->m_resetRequestEvent;
+
+    for (;;)
+    {
+        status = KeWaitForMultipleObjects(
+                    ARRAYSIZE(waitEvents),
+                    waitEvents,
+                    WaitAny,
+                    Executive,
+                    KernelMode,
+                    FALSE,          // Alertable
+                    NULL,
+                    NULL);
+
+        if (STATUS_WAIT_0 != status)
+        {
+            break;
+        }
+
+        //
+        // Only trust the grant event together with the scheduler, so a grant
+        // signaled for a request that was cancelled can't hand out the core
+        //
+
+        KeAcquireSpinLock(&m_computeSchedulerLock, &oldIrql);
+        bGranted = (m_computeScheduler.GetOwner() == pNode->m_nodeOrdinal);
+        KeReleaseSpinLock(&m_computeSchedulerLock, oldIrql);
+
+        if (bGranted)
+        {
+            return STATUS_SUCCESS;
+        }
+    }
+
+    NT_ASSERT((STATUS_WAIT_1 == status) || (STATUS_WAIT_2 == status));
+
+    KeAcquireSpinLock(&m_computeSchedulerLock, &oldIrql);
+    bool bCancelled = m_computeScheduler.Cancel(pNode->m_nodeOrdinal);
+    KeReleaseSpinLock(&m_computeSchedulerLock, oldIrql);
+
+    if (!bCancelled)
+    {
+        //
+        // The core was handed over at the same time, pass it on
+        //
+
+        KeClearEvent(&pNode->m_computeGrantEvent);
+
+        ReleaseComputeCore(pNode);
+    }
+
+    return status;
+}
+
+void
+CosKmAdapter::ReleaseComputeCore(
+    EngineNode * pNode)
+{
+    KIRQL   oldIrql;
+    UINT    nextNode;
+
+    KeAcquireSpinLock(&m_computeSchedulerLock, &oldIrql);
+
+    nextNode = m_computeScheduler.Release(pNode->m_nodeOrdinal);
+
+    //
+    // Signaled under the lock, so a node that finds its Cancel() too late in
+    // AcquireComputeCore() always clears the grant it is passing on
+    //
+
+    if (CosComputeScheduler::kNoNode != nextNode)
+    {
+        KeSetEvent(&m_nodes[nextNode].m_computeGrantEvent, 0, FALSE);
+    }
+
+    KeReleaseSpinLock(&m_computeSchedulerLock, oldIrql);
 }
 
 void CosKmAdapter::DpcRoutine(void)
@@ -812,6 +1192,15 @@ CosKmAdapter::BuildPagingBuffer(
             pArgs->Fill.FillPattern,
             pArgs->Fill.FillSize);
 
+#if COS_PHYSICAL_SUPPORT
+        //
+        // VidMm fills an allocation it just placed, so DMA buffers patched
+        // before it was evicted must be patched again
+        //
+
+        InterlockedIncrement(&m_residencyGeneration);
+#endif
+
         if (pArgs->DmaSize < sizeof(DXGKARG_BUILDPAGINGBUFFER))
         {
             COS_LOG_ERROR(
@@ -831,12 +1220,22 @@ CosKmAdapter::BuildPagingBuffer(
 
     case DXGK_OPERATION_DISCARD_CONTENT:
     {
-        // do nothing
+#if COS_PHYSICAL_SUPPORT
+        InterlockedIncrement(&m_residencyGeneration);
+#endif
     }
     break;
 
     case DXGK_OPERATION_TRANSFER:
     {
+#if COS_PHYSICAL_SUPPORT
+        //
+        // DMA buffers patched for the old placement must be patched again
+        //
+
+        InterlockedIncrement(&m_residencyGeneration);
+#endif
+
         if (pArgs->DmaSize < sizeof(DXGKARG_BUILDPAGINGBUFFER))
         {
             COS_LOG_ERROR(
@@ -866,6 +1265,14 @@ CosKmAdapter::BuildPagingBuffer(
         //
         UINT        osPteInc = pArgs->UpdatePageTable.Flags.Repeat ? 0 : 1;
 
+        //
+        // The software MMU reads the page table through the same CPU address
+        //
+
+        m_gpuMmuMemory.RegisterPageTable(
+            pArgs->UpdatePageTable.PageTableAddress.PhysicalAddress.SegmentOffset >> kPageShift,
+            (DXGK_PTE *)pArgs->UpdatePageTable.PageTableAddress.CpuVirtual);
+
         pHwPte += pArgs->UpdatePageTable.StartIndex;
 
         for (UINT i = 0; i < pArgs->UpdatePageTable.NumPageTableEntries; i++)
@@ -880,7 +1287,25 @@ CosKmAdapter::BuildPagingBuffer(
 
     case DXGK_OPERATION_FLUSH_TLB:
     {
-        // HW driver should flush the TLB
+        //
+        // The TLB is flushed when the paging buffer runs, in order with the
+        // DMA buffers using the old translations
+        //
+
+        if (pArgs->DmaSize < sizeof(DXGKARG_BUILDPAGINGBUFFER))
+        {
+            COS_LOG_ERROR(
+                "DXGK_OPERATION_FLUSH_TLB: DMA buffer is too small. (pArgs->DmaSize=%d, sizeof(DXGKARG_BUILDPAGINGBUFFER)=%d)",
+                pArgs->DmaSize,
+                sizeof(DXGKARG_BUILDPAGINGBUFFER));
+            return STATUS_GRAPHICS_INSUFFICIENT_DMA_BUFFER;
+        }
+        else
+        {
+            *((DXGKARG_BUILDPAGINGBUFFER *)pArgs->pDmaBuffer) = *pArgs;
+
+            pDmaBufPos += sizeof(DXGKARG_BUILDPAGINGBUFFER);
+        }
     }
     break;
 
@@ -906,6 +1331,8 @@ CosKmAdapter::BuildPagingBuffer(
     {
         pDmaBufInfo->m_DmaBufState.m_Value = 0;
         pDmaBufInfo->m_DmaBufState.m_bPaging = 1;
+        pDmaBufInfo->m_Priority = CosContextPriorityPaging;
+        pDmaBufInfo->m_ResumeOffset = 0;
 
         pDmaBufInfo->m_pDmaBuffer = pDmaBufStart;
         pDmaBufInfo->m_DmaBufferSize = pArgs->DmaSize;
@@ -940,7 +1367,7 @@ CosKmAdapter::SubmitCommand(
     //
     // Wake up the worker thread for the GPU node
     //
-    KeSetEvent(&m_workerThreadEvent, 0, FALSE);
+    KeSetEvent(&m_nodes[pSubmitCommand->NodeOrdinal].m_workerThreadEvent, 0, FALSE);
 
     return Status;
 }
@@ -957,15 +1384,40 @@ CosKmAdapter::Patch(
 
     pDmaBufInfo->m_DmaBufferPhysicalAddress = pPatch->DmaBufferPhysicalAddress;
 
-    PatchDmaBuffer(
-        pDmaBufInfo,
-        pPatch->pAllocationList,
-        pPatch->AllocationListSize,
-        pPatch->pPatchLocationList + pPatch->PatchLocationListSubmissionStart,
-        pPatch->PatchLocationListSubmissionLength);
+    ULONG   residencyGeneration = (ULONG)ReadAcquire(&m_residencyGeneration);
+
+    if (!IsDmaBufferPatchCurrent(
+            pDmaBufInfo,
+            residencyGeneration,
+            pPatch->pAllocationList,
+            pPatch->AllocationListSize))
+    {
+        PatchDmaBuffer(
+            pDmaBufInfo,
+            pPatch->pAllocationList,
+            pPatch->AllocationListSize,
+            pPatch->pPatchLocationList + pPatch->PatchLocationListSubmissionStart,
+            pPatch->PatchLocationListSubmissionLength);
+
+        //
+        // The placement describes the DMA buffer only when all of it was patched
+        //
+
+        if ((pPatch->PatchLocationListSubmissionStart == 0) &&
+            (pPatch->PatchLocationListSubmissionLength == pPatch->PatchLocationListSize))
+        {
+            RecordPatchedAllocations(pDmaBufInfo, pPatch->pAllocationList, pPatch->AllocationListSize);
+        }
+        else
+        {
+            pDmaBufInfo->m_DmaBufState.m_bPatchRecorded = 0;
+        }
+    }
 
     // Record DMA buffer information
     pDmaBufInfo->m_DmaBufState.m_bPatched = 1;
+    pDmaBufInfo->m_DmaBufState.m_bPatchResident = pDmaBufInfo->m_DmaBufState.m_bPatchRecorded;
+    pDmaBufInfo->m_PatchedResidencyGeneration = residencyGeneration;
 
     return STATUS_SUCCESS;
 }
@@ -1299,7 +1751,15 @@ CosKmAdapter::QueryAdapterInfo(
         //
 #if 1
         pDriverCaps->PreemptionCaps.GraphicsPreemptionGranularity = D3DKMDT_GRAPHICS_PREEMPTION_PRIMITIVE_BOUNDARY;
+#if COS_GPUVA_SUPPORT || COS_RS_2LEVEL_SUPPORT
         pDriverCaps->PreemptionCaps.ComputePreemptionGranularity = D3DKMDT_COMPUTE_PREEMPTION_DISPATCH_BOUNDARY;
+#else
+        //
+        // ProcessHWRenderBuffer() stops a dispatch between thread groups
+        //
+
+        pDriverCaps->PreemptionCaps.ComputePreemptionGranularity = D3DKMDT_COMPUTE_PREEMPTION_THREAD_GROUP_BOUNDARY;
+#endif
 #endif
 
         //
@@ -1590,12 +2050,33 @@ CosKmAdapter::GetNodeMetadata(
 {
     RtlZeroMemory(pGetNodeMetadata, sizeof(*pGetNodeMetadata));
 
-    pGetNodeMetadata->EngineType = DXGK_ENGINE_TYPE_3D;
+    if (C_COS_COPY_NODE_ORDINAL == NodeOrdinal)
+    {
+        pGetNodeMetadata->EngineType = DXGK_ENGINE_TYPE_COPY;
+
+        RtlStringCbPrintfW(pGetNodeMetadata->FriendlyName,
+            sizeof(pGetNodeMetadata->FriendlyName),
+            L"CopyNode%02X",
+            NodeOrdinal);
+    }
+    else if (C_COS_COMPUTE_NODE_ORDINAL != NodeOrdinal)
+    {
+        pGetNodeMetadata->EngineType = DXGK_ENGINE_TYPE_COMPUTE;
+
+        RtlStringCbPrintfW(pGetNodeMetadata->FriendlyName,
+            sizeof(pGetNodeMetadata->FriendlyName),
+            L"ComputeNode%02X",
+            NodeOrdinal);
+    }
+    else
+    {
+        pGetNodeMetadata->EngineType = DXGK_ENGINE_TYPE_3D;
 
-    RtlStringCbPrintfW(pGetNodeMetadata->FriendlyName,
-        sizeof(pGetNodeMetadata->FriendlyName),
-        L"3DNode%02X",
-        NodeOrdinal);
+        RtlStringCbPrintfW(pGetNodeMetadata->FriendlyName,
+            sizeof(pGetNodeMetadata->FriendlyName),
+            L"3DNode%02X",
+            NodeOrdinal);
+    }
 
 #if COS_GPUVA_SUPPORT
 
@@ -1628,6 +2109,17 @@ CosKmAdapter::SubmitCommandVirtual(
 
         pDmaBufInfo->m_DmaBufState.m_bPaging = pSubmitCommandVirtual->Flags.Paging;
 
+        if (pSubmitCommandVirtual->Flags.Paging)
+        {
+            pDmaBufInfo->m_Priority = CosContextPriorityPaging;
+        }
+        else
+        {
+            pDmaBufInfo->m_Priority = CosKmContext::Cast(pSubmitCommandVirtual->hContext)->GetPriority();
+        }
+
+        pDmaBufInfo->m_ResumeOffset = 0;
+
         pDmaBufInfo->m_DmaBufStallDuration = 0;
     }
 
@@ -1662,7 +2154,7 @@ CosKmAdapter::SubmitCommandVirtual(
     //
     // Wake up the worker thread for the GPU node
     //
-    KeSetEvent(&m_workerThreadEvent, 0, FALSE);
+    KeSetEvent(&m_nodes[submitCommand.NodeOrdinal].m_workerThreadEvent, 0, FALSE);
 
     return S_OK;
 }
@@ -1685,9 +2177,13 @@ CosKmAdapter::PreemptCommand(
     // DMA buffer private data or inside DMA buffer itself
     //
 
-    m_preemptionRequest = *pPreemptCommand;
+    EngineNode * pNode = &m_nodes[pPreemptCommand->NodeOrdinal];
+
+    pNode->m_preemptionRequest = *pPreemptCommand;
+
+    InterlockedExchange(&pNode->m_preemptionRequested, 1);
 
-    KeSetEvent(&m_preemptionEvent, 0, FALSE);
+    KeSetEvent(&pNode->m_preemptionEvent, 0, FALSE);
 
     return STATUS_SUCCESS;
 }
@@ -1714,24 +2210,34 @@ CosKmAdapter::ResetFromTimeout(void)
     // KMD should finish resetting the adapter before returning.
     //
 
-    KeSetEvent(&m_resetRequestEvent, 0, FALSE);
+    for (UINT i = 0; i < m_NumNodes; i++)
+    {
+        ResetNode(&m_nodes[i]);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+void
+CosKmAdapter::ResetNode(
+    EngineNode * pNode)
+{
+    KeSetEvent(&pNode->m_resetRequestEvent, 0, FALSE);
 
     KeWaitForSingleObject(
-        &m_resetCompletionEvent,
+        &pNode->m_resetCompletionEvent,
         Executive,
         KernelMode,
         FALSE,
         NULL);
 
-    m_bInHangState = false;
+    pNode->m_bInHangState = false;
 
     //
     // Implicitly sync up : Graphics runtime considers all submitted Fence Id as completed.
     //
 
-    m_lastCompletetdFenceId = m_lastSubmittedFenceId;
-
-    return STATUS_SUCCESS;
+    pNode->m_lastCompletetdFenceId = pNode->m_lastSubmittedFenceId;
 }
 
 NTSTATUS
@@ -1779,14 +2285,14 @@ NTSTATUS CosKmAdapter::QueryDependentEngineGroup(
     PAGED_CODE();
     COS_ASSERT_MAX_IRQL(PASSIVE_LEVEL);
 
-    NT_ASSERT(ArgsPtr->NodeOrdinal == 0);
+    NT_ASSERT(ArgsPtr->NodeOrdinal < m_NumNodes);
     NT_ASSERT(ArgsPtr->EngineOrdinal == 0);
 
     //
-    // COSD supports only a single node (please see C_COS_GPU_ENGINE_COUNT)
+    // Every node has a single engine and resets on its own
     //
 
-    ArgsPtr->DependentNodeOrdinalMask = 1;
+    ArgsPtr->DependentNodeOrdinalMask = 1 << ArgsPtr->NodeOrdinal;
 
     return STATUS_SUCCESS;
 }
@@ -1815,36 +2321,21 @@ NTSTATUS
 CosKmAdapter::ResetEngine(
     INOUT_PDXGKARG_RESETENGINE  pResetEngine)
 {
-    NT_ASSERT(pResetEngine->NodeOrdinal == 0);
+    NT_ASSERT(pResetEngine->NodeOrdinal < m_NumNodes);
     NT_ASSERT(pResetEngine->EngineOrdinal == 0);
 
+    EngineNode * pNode = &m_nodes[pResetEngine->NodeOrdinal];
+
     //
     // DdiResetEngine is blocking, 
     // KMD should finish resetting the engine before returning.
-    //
-
-    KeSetEvent(&m_resetRequestEvent, 0, FALSE);
-
-    KeWaitForSingleObject(
-        &m_resetCompletionEvent,
-        Executive,
-        KernelMode,
-        FALSE,
-        NULL);
-
-    m_bInHangState = false;
-
     //
     // Use the Fence Id for the last Submited but un-Completed DMA buffer
     //
 
-    pResetEngine->LastAbortedFenceId = m_lastSubmittedFenceId;
-
-    //
-    // Implicitly sync up : Graphics runtime considers all submitted Fence Id as completed.
-    //
+    pResetEngine->LastAbortedFenceId = pNode->m_lastSubmittedFenceId;
 
-    m_lastCompletetdFenceId = m_lastSubmittedFenceId;
+    ResetNode(pNode);
 
     //
     // Except for paging node, TDR (heavyweight reset) is attempted to recover
@@ -1930,9 +2421,12 @@ CosKmAdapter::Escape(
 
     UINT    EscapeId = *((UINT *)pEscape->pPrivateDriverData);
 
-#pragma warning( disable : 4065 )
     switch (EscapeId)
     {
+    case CosEscapeTimeline:
+
+        Status = TimelineEscape(pEscape);
+        break;
 
     default:
 
@@ -1941,8 +2435,59 @@ CosKmAdapter::Escape(
         break;
     }
 
-    COS_ASSERTION("Not implemented");
-    return STATUS_NOT_IMPLEMENTED;
+    return Status;
+}
+
+NTSTATUS
+CosKmAdapter::TimelineEscape(
+    IN_CONST_PDXGKARG_ESCAPE        pEscape)
+{
+    if (pEscape->PrivateDriverDataSize < FIELD_OFFSET(CosTimelineEscape, m_events))
+    {
+        COS_LOG_ERROR(
+            "PrivateDriverDataSize is too small. (pEscape->PrivateDriverDataSize=%d, FIELD_OFFSET(CosTimelineEscape, m_events)=%d)",
+            pEscape->PrivateDriverDataSize,
+            FIELD_OFFSET(CosTimelineEscape, m_events));
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+
+    CosTimelineEscape * pTimelineEscape = (CosTimelineEscape *)pEscape->pPrivateDriverData;
+
+    pTimelineEscape->m_tickFrequency = m_timeline.GetTickFrequency();
+    pTimelineEscape->m_numEvents = 0;
+
+    switch (pTimelineEscape->m_operation)
+    {
+    case CosTimelineStart:
+
+        m_timeline.Enable(true);
+        pTimelineEscape->m_position = m_timeline.GetPosition();
+        pTimelineEscape->m_numDropped = 0;
+        break;
+
+    case CosTimelineStop:
+
+        m_timeline.Enable(false);
+        break;
+
+    case CosTimelineRead:
+
+        pTimelineEscape->m_numEvents = m_timeline.Read(
+            &pTimelineEscape->m_position,
+            pTimelineEscape->m_events,
+            (pEscape->PrivateDriverDataSize - FIELD_OFFSET(CosTimelineEscape, m_events))/sizeof(CosTimelineEvent),
+            &pTimelineEscape->m_numDropped);
+        break;
+
+    default:
+
+        COS_LOG_ERROR(
+            "Invalid timeline operation. (m_operation=%d)",
+            pTimelineEscape->m_operation);
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    return STATUS_SUCCESS;
 }
 
 NTSTATUS
@@ -2061,6 +2606,65 @@ CosKmAdapter::PatchDmaBuffer(
         }
     }
 }
+
+void
+CosKmAdapter::RecordPatchedAllocations(
+    COSDMABUFINFO*                  pDmaBufInfo,
+    CONST DXGK_ALLOCATIONLIST*      pAllocationList,
+    UINT                            allocationListSize)
+{
+    if (allocationListSize > C_COS_ALLOCATION_LIST_SIZE)
+    {
+        pDmaBufInfo->m_DmaBufState.m_bPatchRecorded = 0;
+        return;
+    }
+
+    for (UINT i = 0; i < allocationListSize; i++)
+    {
+        pDmaBufInfo->m_PatchedAllocations[i].m_SegmentId = pAllocationList[i].SegmentId;
+        pDmaBufInfo->m_PatchedAllocations[i].m_PhysicalAddress = pAllocationList[i].PhysicalAddress;
+    }
+
+    pDmaBufInfo->m_PatchedAllocationCount = allocationListSize;
+    pDmaBufInfo->m_DmaBufState.m_bPatchRecorded = 1;
+}
+
+//
+// The DMA buffer needs no patching when its allocations are where they were
+// when it was patched. Without a paging operation since a Patch reported the
+// placement this is known without reading the allocation list, otherwise the
+// list is compared against the recorded placement.
+//
+bool
+CosKmAdapter::IsDmaBufferPatchCurrent(
+    COSDMABUFINFO*                  pDmaBufInfo,
+    ULONG                           residencyGeneration,
+    CONST DXGK_ALLOCATIONLIST*      pAllocationList,
+    UINT                            allocationListSize)
+{
+    if ((!pDmaBufInfo->m_DmaBufState.m_bPatchRecorded) ||
+        (pDmaBufInfo->m_PatchedAllocationCount != allocationListSize))
+    {
+        return false;
+    }
+
+    if (pDmaBufInfo->m_DmaBufState.m_bPatchResident &&
+        (pDmaBufInfo->m_PatchedResidencyGeneration == residencyGeneration))
+    {
+        return true;
+    }
+
+    for (UINT i = 0; i < allocationListSize; i++)
+    {
+        if ((pDmaBufInfo->m_PatchedAllocations[i].m_SegmentId != pAllocationList[i].SegmentId) ||
+            (pDmaBufInfo->m_PatchedAllocations[i].m_PhysicalAddress.QuadPart != pAllocationList[i].PhysicalAddress.QuadPart))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
 #endif
 
 //
@@ -2103,10 +2707,18 @@ CosKmAdapter::QueueDmaBuffer(
     IN_CONST_PDXGKARG_SUBMITCOMMAND pSubmitCommand)
 {
     COSDMABUFINFO *         pDmaBufInfo = (COSDMABUFINFO *)pSubmitCommand->pDmaBufferPrivateData;
-    KIRQL                   OldIrql;
     COSDMABUFSUBMISSION *   pDmaBufSubmission;
+    ULONG                   queuePosition;
+
+    NT_ASSERT(pSubmitCommand->NodeOrdinal < m_NumNodes);
 
-    KeAcquireSpinLock(&m_dmaBufQueueLock, &OldIrql);
+    EngineNode *            pNode = &m_nodes[pSubmitCommand->NodeOrdinal];
+
+    //
+    // Submissions to a node are serialized by the VidSch, so the bookkeeping
+    // below does not need a lock. The ring hands the submission to the worker
+    // thread of the node without blocking either side.
+    //
 
     //
     // Combination indicating preparation error, thus the DMA buffer should be discarded
@@ -2161,7 +2773,7 @@ CosKmAdapter::QueueDmaBuffer(
         {
             g_bTriggerEngineReset = false;
 
-            m_bInHangState = true;
+            pNode->m_bInHangState = true;
         }
     }
 
@@ -2174,30 +2786,45 @@ CosKmAdapter::QueueDmaBuffer(
     {
         g_bTriggerTDR = false;
 
-        m_bInHangState = true;
+        pNode->m_bInHangState = true;
     }
 
-    NT_ASSERT(!IsListEmpty(&m_dmaBufSubmissionFree));
+    pDmaBufSubmission = pNode->m_dmaBufQueue.Reserve(&queuePosition);
+    if (NULL == pDmaBufSubmission)
+    {
+        //
+        // The VidSch does not queue more than m_maxDmaBufQueueLength DMA buffers
+        //
 
-    pDmaBufSubmission = CONTAINING_RECORD(RemoveHeadList(&m_dmaBufSubmissionFree), COSDMABUFSUBMISSION, m_QueueEntry);
+        NT_ASSERT(false);
+
+        COS_LOG_ERROR("DMA buffer queue is full");
+
+        return;
+    }
 
     pDmaBufSubmission->m_pDmaBufInfo = pDmaBufInfo;
 
     pDmaBufSubmission->m_StartOffset = pSubmitCommand->DmaBufferSubmissionStartOffset;
     pDmaBufSubmission->m_EndOffset = pSubmitCommand->DmaBufferSubmissionEndOffset;
     pDmaBufSubmission->m_SubmissionFenceId = pSubmitCommand->SubmissionFenceId;
+    pDmaBufSubmission->m_NodeOrdinal = pSubmitCommand->NodeOrdinal;
+    pDmaBufSubmission->m_pPreemptionRequested = &pNode->m_preemptionRequested;
+#if COS_GPUVA_SUPPORT
+    pDmaBufSubmission->m_pContext = CosKmContext::Cast(pSubmitCommand->hContext);
+#endif
 
     //
     // Adapter remains in Hang state until reset (ResetEngine or ResetFromTimeout)
     //
 
-    pDmaBufSubmission->m_bSimulateHang = m_bInHangState;
+    pDmaBufSubmission->m_bSimulateHang = pNode->m_bInHangState;
 
-    InsertTailList(&m_dmaBufQueue, &pDmaBufSubmission->m_QueueEntry);
+    pNode->m_lastSubmittedFenceId = pSubmitCommand->SubmissionFenceId;
 
-    m_lastSubmittedFenceId = pSubmitCommand->SubmissionFenceId;
+    m_timeline.Record(CosTimelineEventQueued, pNode->m_nodeOrdinal, pSubmitCommand->SubmissionFenceId);
 
-    KeReleaseSpinLock(&m_dmaBufQueueLock, OldIrql);
+    pNode->m_dmaBufQueue.Publish(queuePosition);
 }
 
 void
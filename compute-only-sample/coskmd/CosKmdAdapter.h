@@ -5,6 +5,18 @@
 #include "CosKmdAllocation.h"
 #include "CosKmdGlobal.h"
 
+#include "CosMpscRing.h"
+#include "CosPagingEngine.h"
+#include "CosComputeScheduler.h"
+#include "CosGpuCommand.h"
+#include "CosTimeline.h"
+
+#if COS_GPUVA_SUPPORT
+#include "CosKmdGpuMmu.h"
+#endif
+
+class CosKmContext;
+
 #pragma warning(disable:4201)   // nameless struct/union
 
 typedef struct __COSKMERRORCONDITION
@@ -19,6 +31,7 @@ typedef struct __COSKMERRORCONDITION
             UINT    m_NotifyDmaBufFault             : 1;
             UINT    m_PreparationError              : 1;
             UINT    m_PagingFailure                 : 1;
+            UINT    m_GpuVaFault                    : 1;
         };
 
         UINT        m_Value;
@@ -36,6 +49,10 @@ typedef struct _COSDMABUFSTATE
             UINT    m_bPaging           : 1;
             UINT    m_bSwCommandBuffer  : 1;
             UINT    m_bPatched          : 1;
+#if COS_PHYSICAL_SUPPORT
+            UINT    m_bPatchRecorded    : 1;
+            UINT    m_bPatchResident    : 1;
+#endif
             UINT    m_bSubmittedOnce    : 1;
             UINT    m_bRun              : 1;
             UINT    m_bPreempted        : 1;
@@ -50,6 +67,16 @@ typedef struct _COSDMABUFSTATE
     };
 } COSDMABUFSTATE;
 
+#if COS_PHYSICAL_SUPPORT
+
+typedef struct _COSPATCHEDALLOCATION
+{
+    UINT                        m_SegmentId;
+    PHYSICAL_ADDRESS            m_PhysicalAddress;
+} COSPATCHEDALLOCATION;
+
+#endif
+
 typedef struct _COSDMABUFINFO
 {
     PBYTE                       m_pDmaBuffer;
@@ -62,16 +89,56 @@ typedef struct _COSDMABUFINFO
     COSDMABUFSTATE              m_DmaBufState;
 
     LONGLONG                    m_DmaBufStallDuration;
+
+    //
+    // CosContextPriority of the DMA buffer on the compute core
+    //
+
+    UINT                        m_Priority;
+
+    //
+    // Set when the DMA buffer was preempted in the middle of the dispatch at
+    // m_ResumeOffset (from m_pDmaBuffer, never 0 as the Header comes first).
+    // The resubmission restores the root state of the commands before it and
+    // resumes the dispatch at m_ResumeThreadGroup.
+    //
+
+    UINT                        m_ResumeOffset;
+    UINT                        m_ResumeThreadGroup;
+
+#if COS_PHYSICAL_SUPPORT
+
+    //
+    // Allocation placement the whole DMA buffer is patched for (valid with
+    // m_bPatchRecorded). With m_bPatchResident the placement was reported by
+    // Patch at m_PatchedResidencyGeneration, so a resubmission before any
+    // allocation moved does not look at the allocation list at all.
+    //
+
+    ULONG                       m_PatchedResidencyGeneration;
+    UINT                        m_PatchedAllocationCount;
+    COSPATCHEDALLOCATION        m_PatchedAllocations[C_COS_ALLOCATION_LIST_SIZE];
+
+#endif
 } COSDMABUFINFO;
 
 typedef struct _COSDMABUFSUBMISSION
 {
-    LIST_ENTRY      m_QueueEntry;
     COSDMABUFINFO * m_pDmaBufInfo;
     UINT            m_StartOffset;
     UINT            m_EndOffset;
     UINT            m_SubmissionFenceId;
+    UINT            m_NodeOrdinal;
     bool            m_bSimulateHang;
+
+    //
+    // Preemption request of the node, polled between thread groups
+    //
+
+    const volatile LONG *   m_pPreemptionRequested;
+#if COS_GPUVA_SUPPORT
+    CosKmContext *  m_pContext;
+#endif
 } COSDMABUFSUBMISSION;
 
 typedef union _CosKmAdapterFlags
@@ -270,6 +337,19 @@ public:
         UINT                            allocationListSize,
         CONST D3DDDI_PATCHLOCATIONLIST* pPatchLocationList,
         UINT                            patchAllocationList);
+
+    void
+    RecordPatchedAllocations(
+        COSDMABUFINFO*                  pDmaBufInfo,
+        CONST DXGK_ALLOCATIONLIST*      pAllocationList,
+        UINT                            allocationListSize);
+
+    bool
+    IsDmaBufferPatchCurrent(
+        COSDMABUFINFO*                  pDmaBufInfo,
+        ULONG                           residencyGeneration,
+        CONST DXGK_ALLOCATIONLIST*      pAllocationList,
+        UINT                            allocationListSize);
 #endif
 
 protected:
@@ -295,26 +375,93 @@ protected:
 
 protected:
 
+    // TODO[indyz]: Switch to use the m_DxgkStartInfo::RequiredDmaQueueEntry
+    const static UINT           m_maxDmaBufQueueLength = 32;
+
+    //
+    // Every engine node has its own DMA buffer queue and worker thread, so
+    // the copy node runs alongside the compute nodes. Submission fences,
+    // preemption and reset are per node, as the VidSch tracks them.
+    //
+
+    struct EngineNode
+    {
+        CosKmAdapter *              m_pAdapter;
+        UINT                        m_nodeOrdinal;
+
+        PKTHREAD                    m_pWorkerThread;
+        KEVENT                      m_workerThreadEvent;
+
+        //
+        // Submissions are filled in place by QueueDmaBuffer() and stay in the
+        // ring until the worker thread is done with them
+        //
+
+        CosMpscRing<COSDMABUFSUBMISSION, m_maxDmaBufQueueLength>    m_dmaBufQueue;
+
+        UINT                        m_lastSubmittedFenceId;
+        UINT                        m_lastCompletetdFenceId;
+        UINT                        m_lastCompeletedPreemptionFenceId;
+
+        DXGKARG_PREEMPTCOMMAND      m_preemptionRequest;
+        KEVENT                      m_preemptionEvent;
+
+        //
+        // Set along with m_preemptionEvent until the preemption completes,
+        // lets a dispatch stop at the next thread group
+        //
+
+        volatile LONG               m_preemptionRequested;
+
+        bool                        m_bInHangState;
+
+        KEVENT                      m_resetRequestEvent;
+        KEVENT                      m_resetCompletionEvent;
+
+        DXGKARGCB_NOTIFY_INTERRUPT_DATA m_interruptData;
+
+        //
+        // Set when m_computeScheduler hands the compute core to the node
+        //
+
+        KEVENT                      m_computeGrantEvent;
+    };
+
     virtual void ProcessRenderBuffer(COSDMABUFSUBMISSION * pDmaBufSubmission) = 0;
     virtual void ProcessHWRenderBuffer(COSDMABUFSUBMISSION * pDmaBufSubmission) = 0;
 #if COS_GPUVA_SUPPORT
 
     virtual void ProcessGpuVaRenderBuffer(COSDMABUFSUBMISSION * pDmaBufSubmission) = 0;
 
+#else
+
+    //
+    // Runs the DMA buffers of the copy node on its worker thread, concurrently
+    // with the buffers of the compute node
+    //
+
+    virtual void ProcessCopyBuffer(COSDMABUFSUBMISSION * pDmaBufSubmission) = 0;
+
 #endif
 
 private:
 
+    NTSTATUS StartWorkerThread(EngineNode * pNode);
+    void StopWorkerThread(EngineNode * pNode);
     static void WorkerThread(void * StartContext);
-    void DoWork(void);
+    void DoWork(EngineNode * pNode);
     void DpcRoutine(void);
-    void NotifyDmaBufCompletion(COSDMABUFSUBMISSION * pDmaBufSubmission);
-    void NotifyPreemptionCompletion();
+    void NotifyDmaBufCompletion(EngineNode * pNode, COSDMABUFSUBMISSION * pDmaBufSubmission);
+    void NotifyPreemptionCompletion(EngineNode * pNode);
     static BOOLEAN SynchronizeNotifyInterrupt(PVOID SynchronizeContext);
-    BOOLEAN SynchronizeNotifyInterrupt();
-    COSDMABUFSUBMISSION * DequeueDmaBuffer(KSPIN_LOCK * pDmaBufQueueLock);
-    void EmptyDmaBufferQueue();
+    BOOLEAN SynchronizeNotifyInterrupt(EngineNode * pNode);
+    void EmptyDmaBufferQueue(EngineNode * pNode);
+    void ResetNode(EngineNode * pNode);
+    NTSTATUS AcquireComputeCore(EngineNode * pNode, UINT priority);
+    void ReleaseComputeCore(EngineNode * pNode);
     void ProcessPagingBuffer(COSDMABUFSUBMISSION * pDmaBufSubmission);
+    NTSTATUS TimelineEscape(IN_CONST_PDXGKARG_ESCAPE pEscape);
+    void FlushPagingTransfers();
     static void HwDmaBufCompletionDpcRoutine(KDPC *, PVOID, PVOID, PVOID);
 
 protected:
@@ -365,37 +512,67 @@ protected:
 
     COSKMERRORCONDITION         m_ErrorHit;
 
-    PKTHREAD                    m_pWorkerThread;
-    KEVENT                      m_workerThreadEvent;
+    EngineNode                  m_nodes[C_COS_NODE_COUNT];
     bool                        m_workerExit;
 
-    // TODO[indyz]: Switch to use the m_DxgkStartInfo::RequiredDmaQueueEntry
-    const static UINT           m_maxDmaBufQueueLength = 32;
-    COSDMABUFSUBMISSION         m_dmaBufSubssions[m_maxDmaBufQueueLength];
+    //
+    // The compute nodes take turns on the compute core, one DMA buffer at a
+    // time. Paging buffers take it too as they run on the dispatch workers.
+    //
 
-    LIST_ENTRY                  m_dmaBufSubmissionFree;
-    LIST_ENTRY                  m_dmaBufQueue;
-    KSPIN_LOCK                  m_dmaBufQueueLock;
+    KSPIN_LOCK                  m_computeSchedulerLock;
+    CosComputeScheduler         m_computeScheduler;
 
-    UINT                        m_lastSubmittedFenceId;
-    UINT                        m_lastCompletetdFenceId;
+    //
+    // Runs the paging buffers on the compute node worker thread. System memory
+    // mapped for a queued transfer is unmapped by FlushPagingTransfers().
+    //
+
+    struct PagingMapping
+    {
+        PBYTE                   m_pKmAddress;
+        MDL *                   m_pMdl;
+    };
+
+    CosPagingEngine             m_pagingEngine;
+    PagingMapping               m_pagingMappings[CosPagingEngine::kMaxQueuedCopies];
+    UINT                        m_numPagingMappings;
+
+#if COS_GPUVA_SUPPORT
+
+    //
+    // Translates the GPU VA of DMA buffers and resources, only used on the
+    // worker thread. Page tables are registered by BuildPagingBuffer().
+    //
+
+    CosKmGpuMmuMemory           m_gpuMmuMemory;
+    CosGpuMmu                   m_gpuMmu;
 
-    UINT                        m_lastCompeletedPreemptionFenceId;
+#endif
+
+#if COS_PHYSICAL_SUPPORT
+
+    //
+    // Incremented by every paging operation that can move or drop an
+    // allocation, see IsDmaBufferPatchCurrent()
+    //
 
-    DXGKARG_PREEMPTCOMMAND      m_preemptionRequest;
+    volatile LONG               m_residencyGeneration;
 
-    KEVENT                      m_preemptionEvent;
+#endif
+
+    //
+    // Submissions and commands of all nodes, see CosTimeline.h. Stopped until
+    // started by the CosEscapeTimeline escape.
+    //
+
+    static const ULONG          kTimelineCapacity = 4096;
 
-    bool                        m_bInHangState;
-    
-    KEVENT                      m_resetRequestEvent;
-    KEVENT                      m_resetCompletionEvent;
+    CosTimeline<kTimelineCapacity>  m_timeline;
 
     KDPC                        m_hwDmaBufCompletionDpc;
     KEVENT                      m_hwDmaBufCompletionEvent;
 
-    DXGKARGCB_NOTIFY_INTERRUPT_DATA m_interruptData;
-
     BOOL                        m_bReadyToHandleInterrupt;
 
     DXGK_DEVICE_INFO            m_deviceInfo;
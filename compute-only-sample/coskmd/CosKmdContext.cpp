@@ -83,6 +83,8 @@ CosKmContext::DdiRender(
     pDmaBufInfo->m_DmaBufState.m_Value = 0;
     pDmaBufInfo->m_DmaBufState.m_bRender = 1;
     pDmaBufInfo->m_DmaBufState.m_bSwCommandBuffer = pCmdBufHeader->m_commandBufferHeader.m_swCommandBuffer;
+    pDmaBufInfo->m_Priority = pCosKmContext->m_Priority;
+    pDmaBufInfo->m_ResumeOffset = 0;
 
     pDmaBufInfo->m_pDmaBuffer = (PBYTE)pRender->pDmaBuffer;
 #if COS_PHYSICAL_SUPPORT
@@ -116,6 +118,15 @@ CosKmContext::DdiRender(
         pRender->AllocationListSize,
         pPatchLocationList,
         pRender->PatchLocationListInSize);
+
+    //
+    // Patch() leaves the DMA buffer alone if the allocations are still placed
+    // where the pre-patch assumed
+    //
+    pCosKmAdapter->RecordPatchedAllocations(
+        pDmaBufInfo,
+        pRender->pAllocationList,
+        pRender->AllocationListSize);
 #endif
 
     // Must update pDmaBuffer to reflect what space we used
@@ -149,6 +160,23 @@ CosKmContext::DdiCreateContext(
     pCosKmContext->m_Node = pCreateContext->NodeOrdinal;
     pCosKmContext->m_hRTContext = pCreateContext->hContext;
     pCosKmContext->m_Flags = pCreateContext->Flags;
+    pCosKmContext->m_Priority = CosContextPriorityNormal;
+
+    //
+    // System contexts come without private data. The UMD cannot ask for
+    // more than CosContextPriorityHigh, paging buffers are set apart.
+    //
+
+    if (pCreateContext->pPrivateDriverData &&
+        (pCreateContext->PrivateDriverDataSize >= sizeof(CosContextExchange)))
+    {
+        CosContextExchange * pCosContextExchange = (CosContextExchange *)pCreateContext->pPrivateDriverData;
+
+        if (CosContextPriorityHigh == pCosContextExchange->m_priority)
+        {
+            pCosKmContext->m_Priority = CosContextPriorityHigh;
+        }
+    }
 
     //
     // Set up info returned to runtime
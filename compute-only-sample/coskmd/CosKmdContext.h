@@ -44,6 +44,7 @@ protected:
     HANDLE                  m_hRTContext;
 
     DXGK_CREATECONTEXTFLAGS m_Flags;
+    UINT                    m_Priority;
 
 #if COS_GPUVA_SUPPORT
 
@@ -72,6 +73,12 @@ public:
         return m_Flags;
     }
 
+    UINT
+        GetPriority() const
+    {
+        return m_Priority;
+    }
+
     static CosKmContext * Cast(IN_CONST_HANDLE hContext)
     {
         CosKmContext * rosKmContext = reinterpret_cast<CosKmContext *>(hContext);
@@ -87,6 +94,18 @@ public:
         SetRootPageTable(
             IN_CONST_PDXGKARG_SETROOTPAGETABLE  pSetPageTable);
 
+    D3DGPU_PHYSICAL_ADDRESS
+        GetRootPageTableAddress() const
+    {
+        return m_rootPageTableAddress;
+    }
+
+    UINT
+        GetNumRootPageTableEntries() const
+    {
+        return m_numRootPageTableEntries;
+    }
+
 #endif
 
 private:
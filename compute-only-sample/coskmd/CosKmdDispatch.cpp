@@ -0,0 +1,527 @@
+#include "CosKmd.h"
+
+#include "CosKmdLogging.h"
+#include "CosKmdDispatch.tmh"
+
+#include "CosKmdDispatch.h"
+#include "CosKmdGlobal.h"
+
+NTSTATUS
+CosKmDispatchEngine::Start()
+{
+    m_workerExit = false;
+    m_pendingWorkers = 0;
+    m_pShader = NULL;
+    m_pfnWorkItem = NULL;
+
+    RtlZeroMemory(m_shaderCache, sizeof(m_shaderCache));
+    m_shaderCacheMemorySize = 0;
+    m_submissionId = 0;
+
+    KeInitializeEvent(&m_completionEvent, NotificationEvent, FALSE);
+
+    ULONG numProcessors = KeQueryActiveProcessorCountEx(ALL_PROCESSOR_GROUPS);
+
+    m_numWorkers = min(numProcessors, kMaxDispatchWorkers);
+    if (0 == m_numWorkers)
+    {
+        m_numWorkers = 1;
+    }
+
+    RtlZeroMemory(m_workers, sizeof(m_workers));
+
+    //
+    // Worker 0 is the thread calling Dispatch()
+    //
+
+    m_workers[0].m_pEngine = this;
+
+    OBJECT_ATTRIBUTES   ObjectAttributes;
+
+    InitializeObjectAttributes(&ObjectAttributes, NULL, OBJ_KERNEL_HANDLE, NULL, NULL);
+
+    for (UINT i = 1; i < m_numWorkers; i++)
+    {
+        DispatchWorker *    pWorker = &m_workers[i];
+        HANDLE              hWorkerThread;
+
+        pWorker->m_pEngine = this;
+        pWorker->m_index = i;
+        KeInitializeEvent(&pWorker->m_startEvent, SynchronizationEvent, FALSE);
+
+        NTSTATUS status = PsCreateSystemThread(
+            &hWorkerThread,
+            THREAD_ALL_ACCESS,
+            &ObjectAttributes,
+            NULL,
+            NULL,
+            (PKSTART_ROUTINE) CosKmDispatchEngine::WorkerThread,
+            pWorker);
+
+        if (status != STATUS_SUCCESS)
+        {
+            //
+            // Continue with the workers created so far, worker 0 alone is
+            // enough to run any dispatch
+            //
+
+            COS_LOG_WARNING(
+                "PsCreateSystemThread(...) failed for dispatch worker %d. (status=%!STATUS!)",
+                i,
+                status);
+
+            m_numWorkers = i;
+            break;
+        }
+
+        status = ObReferenceObjectByHandle(
+            hWorkerThread,
+            THREAD_ALL_ACCESS,
+            *PsThreadType,
+            KernelMode,
+            (PVOID *)&pWorker->m_pThread,
+            NULL);
+
+        if (!NT_SUCCESS(status))
+        {
+            COS_LOG_ERROR(
+                "ObReferenceObjectByHandle(...) failed for dispatch worker %d. (status=%!STATUS!)",
+                i,
+                status);
+
+            //
+            // Worker i is already running, have it exit and wait for it
+            // through the handle before Stop() takes down the others
+            //
+
+            m_workerExit = true;
+            KeSetEvent(&pWorker->m_startEvent, 0, FALSE);
+
+            ZwWaitForSingleObject(hWorkerThread, FALSE, NULL);
+            ZwClose(hWorkerThread);
+
+            m_numWorkers = i;
+            Stop();
+
+            return status;
+        }
+
+        ZwClose(hWorkerThread);
+    }
+
+    COS_LOG_TRACE("Dispatch engine started with %d workers.", m_numWorkers);
+
+    return STATUS_SUCCESS;
+}
+
+void
+CosKmDispatchEngine::Stop()
+{
+    m_workerExit = true;
+
+    for (UINT i = 1; i < m_numWorkers; i++)
+    {
+        DispatchWorker * pWorker = &m_workers[i];
+
+        KeSetEvent(&pWorker->m_startEvent, 0, FALSE);
+
+        NTSTATUS status = KeWaitForSingleObject(
+            pWorker->m_pThread,
+            Executive,
+            KernelMode,
+            FALSE,
+            NULL);
+
+        status;
+        NT_ASSERT(status == STATUS_SUCCESS);
+
+        ObDereferenceObject(pWorker->m_pThread);
+        pWorker->m_pThread = NULL;
+    }
+
+    for (UINT i = 0; i < kShaderCacheSize; i++)
+    {
+        if (m_shaderCache[i].m_bValid)
+        {
+            FreeShaderCacheEntry(&m_shaderCache[i]);
+        }
+    }
+
+    NT_ASSERT(0 == m_shaderCacheMemorySize);
+
+    m_numWorkers = 1;
+}
+
+CosKmDispatchEngine::ShaderCacheEntry *
+CosKmDispatchEngine::FindShaderImage(
+    const BYTE *    pShaderHash)
+{
+    for (UINT i = 0; i < kShaderCacheSize; i++)
+    {
+        ShaderCacheEntry * pEntry = &m_shaderCache[i];
+
+        if (pEntry->m_bValid &&
+            (kShaderHashSize == RtlCompareMemory(pEntry->m_shaderHash, pShaderHash, kShaderHashSize)))
+        {
+            pEntry->m_lastUsedSubmissionId = m_submissionId;
+
+            return pEntry;
+        }
+    }
+
+    return NULL;
+}
+
+//
+// Picks a free cache entry, evicting least recently used images to stay
+// within the VPU memory budget. Images used by the current submission are
+// never evicted since later dispatches in the same DMA buffer reference them.
+//
+
+CosKmDispatchEngine::ShaderCacheEntry *
+CosKmDispatchEngine::AllocateShaderCacheEntry(
+    SIZE_T  cacheMemorySize)
+{
+    for (;;)
+    {
+        ShaderCacheEntry *  pFreeEntry = NULL;
+        ShaderCacheEntry *  pVictim = NULL;
+
+        for (UINT i = 0; i < kShaderCacheSize; i++)
+        {
+            ShaderCacheEntry * pEntry = &m_shaderCache[i];
+
+            if (!pEntry->m_bValid)
+            {
+                if (NULL == pFreeEntry)
+                {
+                    pFreeEntry = pEntry;
+                }
+            }
+            else if (pEntry->m_lastUsedSubmissionId != m_submissionId)
+            {
+                if ((NULL == pVictim) ||
+                    (pEntry->m_lastUsedSubmissionId < pVictim->m_lastUsedSubmissionId))
+                {
+                    pVictim = pEntry;
+                }
+            }
+        }
+
+        bool bOverBudget = (m_shaderCacheMemorySize + cacheMemorySize) > CosKmdGlobal::s_vpuMemorySize;
+
+        if (pFreeEntry && !bOverBudget)
+        {
+            return pFreeEntry;
+        }
+
+        if (NULL == pVictim)
+        {
+            //
+            // Everything resident is in use by this submission, go over budget
+            // rather than fail the dispatch
+            //
+
+            return pFreeEntry;
+        }
+
+        FreeShaderCacheEntry(pVictim);
+    }
+}
+
+void
+CosKmDispatchEngine::FreeShaderCacheEntry(
+    ShaderCacheEntry *  pEntry)
+{
+    NT_ASSERT(pEntry->m_bValid);
+
+    ExFreePoolWithTag(pEntry->m_pImages, 'cosd');
+
+    m_shaderCacheMemorySize -= pEntry->m_imageSize*m_numWorkers;
+
+    RtlZeroMemory(pEntry, sizeof(*pEntry));
+}
+
+bool
+CosKmDispatchEngine::LoadShaderImage(
+    const BYTE *        pShaderHash,
+    VpuImageHeader *    pImage,
+    SIZE_T              imageBufferSize)
+{
+    if (FindShaderImage(pShaderHash))
+    {
+        return true;
+    }
+
+    if ((imageBufferSize < sizeof(VpuImageHeader)) ||
+        (imageBufferSize < pImage->GetSerializationSize()))
+    {
+        COS_LOG_ERROR(
+            "Shader image is truncated. (BufferSize=%lld)",
+            (ULONGLONG)imageBufferSize);
+        return false;
+    }
+
+    SIZE_T imageSize = (SIZE_T)pImage->GetImageSize();
+
+    if (imageSize > CosKmdGlobal::s_vpuMemorySize)
+    {
+        COS_LOG_ERROR(
+            "Shader image is too large. (ImageSize=%lld, VpuMemorySize=%lld)",
+            (ULONGLONG)imageSize,
+            (ULONGLONG)CosKmdGlobal::s_vpuMemorySize);
+        return false;
+    }
+
+    SIZE_T cacheMemorySize = imageSize*m_numWorkers;
+
+    ShaderCacheEntry * pEntry = AllocateShaderCacheEntry(cacheMemorySize);
+    if (NULL == pEntry)
+    {
+        COS_LOG_ERROR("Shader cache is full.");
+        return false;
+    }
+
+    pEntry->m_pImages = (uint8_t *)ExAllocatePoolWithTag(NonPagedPoolExecute, cacheMemorySize, 'cosd');
+    if (NULL == pEntry->m_pImages)
+    {
+        COS_LOG_LOW_MEMORY("Failed to allocate memory for shader image.");
+        return false;
+    }
+
+    //
+    // Load and relocate once, the relocations are PC-relative so the loaded
+    // image can be replicated for the other workers
+    //
+
+    if (!pImage->Load(pEntry->m_pImages, imageSize))
+    {
+        COS_LOG_ERROR("Failed to load shader image.");
+
+        ExFreePoolWithTag(pEntry->m_pImages, 'cosd');
+        pEntry->m_pImages = NULL;
+
+        return false;
+    }
+
+    for (UINT i = 1; i < m_numWorkers; i++)
+    {
+        RtlCopyMemory(pEntry->m_pImages + i*imageSize, pEntry->m_pImages, imageSize);
+    }
+
+    RtlCopyMemory(pEntry->m_shaderHash, pShaderHash, kShaderHashSize);
+    pEntry->m_imageSize = imageSize;
+    pEntry->m_tlsOffset = pImage->GetTlsOffset();
+    pEntry->m_entryOffset = pImage->GetEntryOffset();
+    pEntry->m_simdWidth = pImage->GetSimdWidth();
+    pEntry->m_lastUsedSubmissionId = m_submissionId;
+    pEntry->m_bValid = true;
+
+    m_shaderCacheMemorySize += cacheMemorySize;
+
+    return true;
+}
+
+UINT
+CosKmDispatchEngine::Dispatch(
+    const BYTE *            pShaderHash,
+    UINT                    threadGroupCountX,
+    UINT                    threadGroupCountY,
+    UINT                    threadGroupCountZ,
+    UINT                    threadCountX,
+    UINT                    threadCountY,
+    UINT                    threadCountZ,
+    VpuResourceDescriptor * pUavs,
+    UINT                    numUavs,
+    UINT                    firstThreadGroup,
+    const volatile LONG *   pPreemptionRequested)
+{
+    NT_ASSERT(numUavs <= kVpuMaxUAVs);
+
+    UINT numThreadGroups = threadGroupCountX*threadGroupCountY*threadGroupCountZ;
+
+    ShaderCacheEntry * pShader = FindShaderImage(pShaderHash);
+    if (NULL == pShader)
+    {
+        COS_LOG_ERROR("Dispatch references a shader image that is not resident.");
+        return numThreadGroups;
+    }
+
+    UINT numWorkers = m_threadGroups.Begin(
+                        numThreadGroups,
+                        threadCountX*threadCountY*threadCountZ,
+                        firstThreadGroup,
+                        m_numWorkers,
+                        kMaxThreadGroupChunk,
+                        pPreemptionRequested);
+
+    if (0 == numWorkers)
+    {
+        return m_threadGroups.End();
+    }
+
+    m_pShader = pShader;
+
+    for (UINT i = 0; i < numWorkers; i++)
+    {
+        CosThreadGroupDispatch::SetUavs(
+            pShader->m_pImages + i*pShader->m_imageSize,
+            pShader->m_tlsOffset,
+            pUavs,
+            numUavs);
+    }
+
+    RunWorkers(numWorkers);
+
+    m_pShader = NULL;
+
+    return m_threadGroups.End();
+}
+
+void
+CosKmDispatchEngine::ParallelFor(
+    UINT            numItems,
+    PFN_WORK_ITEM   pfnWorkItem,
+    void *          pContext)
+{
+    NT_ASSERT(NULL == m_pShader);
+    NT_ASSERT(numItems <= MAXLONG);
+
+    if (0 == numItems)
+    {
+        return;
+    }
+
+    m_pfnWorkItem = pfnWorkItem;
+    m_pWorkItemContext = pContext;
+    m_numWorkItems = (LONG)numItems;
+    m_nextWorkItem = 0;
+
+    RunWorkers(min(m_numWorkers, numItems));
+
+    m_pfnWorkItem = NULL;
+}
+
+//
+// Releases workers 1 to numWorkers - 1, runs worker 0 on the calling thread
+// and waits for the others to finish
+//
+
+void
+CosKmDispatchEngine::RunWorkers(
+    UINT    numWorkers)
+{
+    if (numWorkers > 1)
+    {
+        KeClearEvent(&m_completionEvent);
+        m_pendingWorkers = (LONG)(numWorkers - 1);
+
+        for (UINT i = 1; i < numWorkers; i++)
+        {
+            KeSetEvent(&m_workers[i].m_startEvent, 0, FALSE);
+        }
+    }
+
+    RunJob(&m_workers[0]);
+
+    if (numWorkers > 1)
+    {
+        KeWaitForSingleObject(
+            &m_completionEvent,
+            Executive,
+            KernelMode,
+            FALSE,
+            NULL);
+    }
+}
+
+void
+CosKmDispatchEngine::RunJob(
+    DispatchWorker *    pWorker)
+{
+    if (m_pShader)
+    {
+        RunThreadGroups(pWorker);
+    }
+    else
+    {
+        RunWorkItems(pWorker);
+    }
+}
+
+void
+CosKmDispatchEngine::WorkerThread(
+    void *  pContext)
+{
+    DispatchWorker * pWorker = (DispatchWorker *)pContext;
+
+    pWorker->m_pEngine->DoWork(pWorker);
+}
+
+void
+CosKmDispatchEngine::DoWork(
+    DispatchWorker *    pWorker)
+{
+    for (;;)
+    {
+        KeWaitForSingleObject(
+            &pWorker->m_startEvent,
+            Executive,
+            KernelMode,
+            FALSE,
+            NULL);
+
+        if (m_workerExit)
+        {
+            break;
+        }
+
+        RunJob(pWorker);
+
+        if (0 == InterlockedDecrement(&m_pendingWorkers))
+        {
+            KeSetEvent(&m_completionEvent, 0, FALSE);
+        }
+    }
+
+    PsTerminateSystemThread(STATUS_SUCCESS);
+}
+
+void
+CosKmDispatchEngine::RunThreadGroups(
+    DispatchWorker *    pWorker)
+{
+    KFLOATING_SAVE floatingSave;
+
+    KeSaveFloatingPointState(&floatingSave);
+
+    m_threadGroups.Run(
+        m_pShader->m_pImages + pWorker->m_index*m_pShader->m_imageSize,
+        m_pShader->m_tlsOffset,
+        m_pShader->m_entryOffset,
+        m_pShader->m_simdWidth);
+
+    KeRestoreFloatingPointState(&floatingSave);
+}
+
+void
+CosKmDispatchEngine::RunWorkItems(
+    DispatchWorker *    pWorker)
+{
+    KFLOATING_SAVE floatingSave;
+
+    KeSaveFloatingPointState(&floatingSave);
+
+    for (;;)
+    {
+        LONG item = InterlockedIncrement(&m_nextWorkItem) - 1;
+        if (item >= m_numWorkItems)
+        {
+            break;
+        }
+
+        m_pfnWorkItem(m_pWorkItemContext, pWorker->m_index, (UINT)item);
+    }
+
+    KeRestoreFloatingPointState(&floatingSave);
+}
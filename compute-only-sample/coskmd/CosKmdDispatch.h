@@ -0,0 +1,160 @@
+#pragma once
+
+#include "CosKmd.h"
+
+#include "VpuImage.h"
+#include "CosThreadGroupDispatch.h"
+
+//
+// Compute dispatch engine for the software adapter
+//
+// Thread groups of a ComputeShaderDispatch are spread across a pool of system
+// worker threads by CosThreadGroupDispatch. Every worker runs from a private
+// copy of the VPU image. The thread calling Dispatch() participates as
+// worker 0.
+//
+// Loaded images are kept in a residency cache keyed by the shader hash. A
+// ShaderImageLoad command loads and relocates the image once for all workers,
+// later dispatches only reference it by hash.
+//
+// A dispatch can be preempted at thread group granularity. Chunks are at most
+// kMaxThreadGroupChunk groups so the request is honored quickly even for a
+// huge dispatch.
+//
+// The same workers run the CPU meta command kernels through ParallelFor().
+//
+
+class CosKmDispatchEngine
+{
+public:
+
+    static const UINT kMaxDispatchWorkers = 16;
+    static const UINT kMaxThreadGroupChunk = 64;
+    static const UINT kShaderCacheSize = 32;
+    static const UINT kShaderHashSize = 16;
+
+    NTSTATUS Start();
+    void Stop();
+
+    //
+    // Called at the start of every DMA buffer, images loaded for the current
+    // submission are not evicted until the next one
+    //
+
+    void BeginSubmission()
+    {
+        m_submissionId++;
+    }
+
+    bool LoadShaderImage(
+        const BYTE *            pShaderHash,
+        VpuImageHeader *        pImage,
+        SIZE_T                  imageBufferSize);
+
+    //
+    // Runs the thread groups from firstThreadGroup on. Returns the index of
+    // the first thread group that did not run because *pPreemptionRequested
+    // got set, or the number of thread groups once the dispatch is done.
+    // pPreemptionRequested can be NULL.
+    //
+
+    UINT Dispatch(
+        const BYTE *            pShaderHash,
+        UINT                    threadGroupCountX,
+        UINT                    threadGroupCountY,
+        UINT                    threadGroupCountZ,
+        UINT                    threadCountX,
+        UINT                    threadCountY,
+        UINT                    threadCountZ,
+        VpuResourceDescriptor * pUavs,
+        UINT                    numUavs,
+        UINT                    firstThreadGroup,
+        const volatile LONG *   pPreemptionRequested);
+
+    UINT GetNumWorkers()
+    {
+        return m_numWorkers;
+    }
+
+    typedef void (*PFN_WORK_ITEM)(void * pContext, UINT workerIndex, UINT itemIndex);
+
+    //
+    // Runs pfnWorkItem for every item in [0, numItems), workerIndex is below
+    // GetNumWorkers(). Returns once all items are done.
+    //
+
+    void ParallelFor(
+        UINT                    numItems,
+        PFN_WORK_ITEM           pfnWorkItem,
+        void *                  pContext);
+
+private:
+
+    struct DispatchWorker
+    {
+        CosKmDispatchEngine    *m_pEngine;
+        UINT                    m_index;
+        PKTHREAD                m_pThread;
+        KEVENT                  m_startEvent;
+    };
+
+    struct ShaderCacheEntry
+    {
+        bool                    m_bValid;
+        BYTE                    m_shaderHash[kShaderHashSize];
+        ULONGLONG               m_lastUsedSubmissionId;
+
+        SIZE_T                  m_imageSize;
+        uint64_t                m_tlsOffset;
+        uint64_t                m_entryOffset;
+        UINT                    m_simdWidth;
+
+        //
+        // m_numWorkers copies of the loaded image, m_imageSize apart
+        //
+
+        uint8_t                *m_pImages;
+    };
+
+    static void WorkerThread(void * pContext);
+    void DoWork(DispatchWorker * pWorker);
+
+    void RunWorkers(UINT numWorkers);
+    void RunJob(DispatchWorker * pWorker);
+    void RunThreadGroups(DispatchWorker * pWorker);
+    void RunWorkItems(DispatchWorker * pWorker);
+
+    ShaderCacheEntry * FindShaderImage(const BYTE * pShaderHash);
+    ShaderCacheEntry * AllocateShaderCacheEntry(SIZE_T cacheMemorySize);
+    void FreeShaderCacheEntry(ShaderCacheEntry * pEntry);
+
+    UINT                        m_numWorkers;
+    DispatchWorker              m_workers[kMaxDispatchWorkers];
+    bool                        m_workerExit;
+
+    KEVENT                      m_completionEvent;
+    volatile LONG               m_pendingWorkers;
+
+    ShaderCacheEntry            m_shaderCache[kShaderCacheSize];
+    SIZE_T                      m_shaderCacheMemorySize;
+    ULONGLONG                   m_submissionId;
+
+    //
+    // State of the dispatch in flight, written by Dispatch() before the
+    // workers are released and read-only while they run
+    //
+
+    ShaderCacheEntry           *m_pShader;
+
+    CosThreadGroupDispatch      m_threadGroups;
+
+    //
+    // State of the ParallelFor() in flight, used when m_pShader is NULL
+    //
+
+    PFN_WORK_ITEM               m_pfnWorkItem;
+    void                       *m_pWorkItemContext;
+    LONG                        m_numWorkItems;
+
+    volatile LONG               m_nextWorkItem;
+};
@@ -19,7 +19,6 @@ void * CosKmdGlobal::s_pVideoMemory = NULL;
 PHYSICAL_ADDRESS CosKmdGlobal::s_videoMemoryPhysicalAddress;
 bool CosKmdGlobal::s_bRenderOnly;
 size_t CosKmdGlobal::s_vpuMemorySize = 0;
-void * CosKmdGlobal::s_pVpuMemory = NULL;
 
 void
 CosKmdGlobal::DdiUnload(
@@ -35,13 +34,6 @@ CosKmdGlobal::DdiUnload(
         s_videoMemorySize = 0;
     }
 
-	if (s_pVpuMemory != NULL)
-	{
-		ExFreePoolWithTag(s_pVpuMemory, 'cosd');
-		s_pVpuMemory = NULL;
-		s_vpuMemorySize = 0;
-	}
-
     NT_ASSERT(s_pDriverObject);
     WPP_CLEANUP(s_pDriverObject);
     s_pDriverObject = nullptr;
@@ -229,13 +221,11 @@ NTSTATUS CosKmdGlobal::DriverEntry(__in IN DRIVER_OBJECT* pDriverObject, __in IN
     } // RenderOnly
 
 	//
-	// Allocate vpu memory to be used to execute a shader
+	// Shader images are allocated by the dispatch engine's residency cache
+	// on demand, up to this much executable memory
 	//
 
-	s_vpuMemorySize = 1024 * 1024;
-	s_pVpuMemory = ExAllocatePoolWithTag(NonPagedPoolExecute, s_vpuMemorySize, 'cosd');
-	if (s_pVpuMemory == NULL)
-		return E_OUTOFMEMORY;
+	s_vpuMemorySize = 16 * 1024 * 1024;
 
     //
     // Fill in the DriverInitializationData structure and call DlInitialize()
@@ -24,7 +24,10 @@ public:
     static void * s_pVideoMemory;
     static PHYSICAL_ADDRESS s_videoMemoryPhysicalAddress;
 
-	static void * s_pVpuMemory;
+	//
+	// Budget for executable memory holding loaded shader images
+	//
+
 	static size_t s_vpuMemorySize;
 
 private:
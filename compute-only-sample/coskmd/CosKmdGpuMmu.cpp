@@ -0,0 +1,149 @@
+#include "CosKmd.h"
+
+#include "CosKmdLogging.h"
+#include "CosKmdGpuMmu.tmh"
+
+#include "CosKmdGpuMmu.h"
+
+#if COS_GPUVA_SUPPORT
+
+void
+CosKmGpuMmuMemory::Initialize()
+{
+    KeInitializeSpinLock(&m_lock);
+
+    RtlZeroMemory(m_pageTables, sizeof(m_pageTables));
+}
+
+void
+CosKmGpuMmuMemory::RegisterPageTable(
+    UINT64      pageTablePage,
+    DXGK_PTE *  pPageTable)
+{
+    KIRQL   oldIrql;
+    UINT    home = (UINT)(pageTablePage & (kMaxPageTables - 1));
+
+    KeAcquireSpinLock(&m_lock, &oldIrql);
+
+    //
+    // Records are never removed, a page table moving to another physical
+    // page leaves a stale record which no valid PTE refers to
+    //
+
+    PageTableRecord * pRecord = NULL;
+
+    for (UINT i = 0; i < kMaxPageTables; i++)
+    {
+        PageTableRecord * pCur = &m_pageTables[(home + i) & (kMaxPageTables - 1)];
+
+        if ((NULL == pCur->m_pPageTable) || (pCur->m_pageTablePage == pageTablePage))
+        {
+            pRecord = pCur;
+            break;
+        }
+    }
+
+    if (NULL == pRecord)
+    {
+        COS_LOG_ERROR(
+            "Page table registry is full, replacing a record. (pageTablePage=0x%I64x)",
+            pageTablePage);
+
+        pRecord = &m_pageTables[home];
+    }
+
+    pRecord->m_pageTablePage = pageTablePage;
+    pRecord->m_pPageTable = pPageTable;
+
+    KeReleaseSpinLock(&m_lock, oldIrql);
+}
+
+DXGK_PTE *
+CosKmGpuMmuMemory::GetPageTable(
+    UINT64      pageTablePage)
+{
+    KIRQL       oldIrql;
+    UINT        home = (UINT)(pageTablePage & (kMaxPageTables - 1));
+    DXGK_PTE *  pPageTable = NULL;
+
+    KeAcquireSpinLock(&m_lock, &oldIrql);
+
+    for (UINT i = 0; i < kMaxPageTables; i++)
+    {
+        PageTableRecord * pCur = &m_pageTables[(home + i) & (kMaxPageTables - 1)];
+
+        if (NULL == pCur->m_pPageTable)
+        {
+            break;
+        }
+
+        if (pCur->m_pageTablePage == pageTablePage)
+        {
+            pPageTable = pCur->m_pPageTable;
+            break;
+        }
+    }
+
+    KeReleaseSpinLock(&m_lock, oldIrql);
+
+    return pPageTable;
+}
+
+BYTE *
+CosKmGpuMmuMemory::MapPage(
+    UINT        segmentId,
+    UINT64      page,
+    void **     phMapping)
+{
+    //
+    // Allocations are only placed in the implicit system memory segment
+    //
+
+    if (segmentId != IMPLICIT_SYSTEM_MEMORY_SEGMENT_ID)
+    {
+        return NULL;
+    }
+
+    PMDL pMdl = IoAllocateMdl(NULL, PAGE_SIZE, FALSE, FALSE, NULL);
+
+    if (NULL == pMdl)
+    {
+        return NULL;
+    }
+
+    MmGetMdlPfnArray(pMdl)[0] = (PFN_NUMBER)page;
+    pMdl->MdlFlags |= MDL_PAGES_LOCKED;
+
+    BYTE * pCpuPage = (BYTE *)MmMapLockedPagesSpecifyCache(
+                                pMdl,
+                                KernelMode,
+                                MmCached,
+                                NULL,
+                                FALSE,
+                                HighPagePriority | MdlMappingNoExecute);
+
+    if (NULL == pCpuPage)
+    {
+        IoFreeMdl(pMdl);
+
+        return NULL;
+    }
+
+    *phMapping = pMdl;
+
+    return pCpuPage;
+}
+
+void
+CosKmGpuMmuMemory::UnmapPage(
+    BYTE *      pCpuPage,
+    void *      hMapping)
+{
+    PMDL pMdl = (PMDL)hMapping;
+
+    MmUnmapLockedPages(pCpuPage, pMdl);
+
+    IoFreeMdl(pMdl);
+}
+
+#endif  // COS_GPUVA_SUPPORT
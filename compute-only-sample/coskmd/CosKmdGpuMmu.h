@@ -0,0 +1,50 @@
+#pragma once
+
+#include "CosKmd.h"
+
+#if COS_GPUVA_SUPPORT
+
+#include "CosGpuMmu.h"
+
+//
+// Physical memory access for the software GPU MMU
+//
+// Page tables live in the implicit system memory segment and are only reached
+// by the CPU through the CpuVirtual address the OS passes with
+// DXGK_OPERATION_UPDATE_PAGE_TABLE, so every page table is registered by its
+// first physical page when it is updated. Data pages are mapped one at a time
+// through an MDL and stay mapped while their translation is in the TLB.
+//
+
+class CosKmGpuMmuMemory : public CosGpuMmuMemory
+{
+public:
+
+    static const UINT kMaxPageTables = 4096;
+
+    void Initialize();
+
+    void RegisterPageTable(UINT64 pageTablePage, DXGK_PTE * pPageTable);
+
+    virtual DXGK_PTE * GetPageTable(UINT64 pageTablePage);
+
+    virtual BYTE * MapPage(UINT segmentId, UINT64 page, void ** phMapping);
+    virtual void UnmapPage(BYTE * pCpuPage, void * hMapping);
+
+private:
+
+    struct PageTableRecord
+    {
+        UINT64      m_pageTablePage;
+        DXGK_PTE *  m_pPageTable;       // NULL for a free record
+    };
+
+    //
+    // BuildPagingBuffer registers page tables while the worker thread walks them
+    //
+
+    KSPIN_LOCK          m_lock;
+    PageTableRecord     m_pageTables[kMaxPageTables];
+};
+
+#endif  // COS_GPUVA_SUPPORT
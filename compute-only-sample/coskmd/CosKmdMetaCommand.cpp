@@ -1,150 +1,569 @@
 #include "CosKmd.h"
+
+#include "CosKmdLogging.h"
+#include "CosKmdMetaCommand.tmh"
+
 #include "CosKmdMetaCommand.h"
 #include "CosKmdGlobal.h"
 
 #if COS_MLMC_RS5_SUPPORT
 
-static UINT
-CosKmGetTensorElementSize(
-    META_COMMAND_TENSOR_DATA_TYPE   dstDataType,
-    META_COMMAND_TENSOR_DATA_TYPE   srcDataType)
+#include "CosMlKernels.h"
+
+//
+// Runs the CPU ML kernels on the dispatch engine workers
+//
+
+class CosKmMlContext : public CosMlContext
 {
-    // No support for type conversion
-    if (dstDataType != srcDataType)
+public:
+
+    CosKmMlContext(CosKmDispatchEngine * pDispatchEngine) :
+        m_pDispatchEngine(pDispatchEngine)
+    {
+        // do nothing
+    }
+
+    virtual UINT GetNumWorkers()
+    {
+        return m_pDispatchEngine->GetNumWorkers();
+    }
+
+    virtual void ParallelFor(UINT numItems, PFN_WORK_ITEM pfnWorkItem, void * pContext)
+    {
+        m_pDispatchEngine->ParallelFor(numItems, pfnWorkItem, pContext);
+    }
+
+    virtual void * AllocateScratch(SIZE_T size)
     {
-        return 0;
+        void * pScratch = ExAllocatePoolWithTag(NonPagedPoolNx, size, 'cosd');
+
+        if (NULL == pScratch)
+        {
+            COS_LOG_LOW_MEMORY("Failed to allocate meta command scratch memory. (Size=%lld)", (ULONGLONG)size);
+        }
+
+        return pScratch;
+    }
+
+    virtual void FreeScratch(void * pScratch)
+    {
+        ExFreePoolWithTag(pScratch, 'cosd');
     }
 
-    switch (dstDataType)
+private:
+
+    CosKmDispatchEngine    *m_pDispatchEngine;
+};
+
+static bool
+CosKmGetMlTensor(
+    const META_COMMAND_TENSOR_DESC *    pDesc,
+    D3D12_GPU_DESCRIPTOR_HANDLE         resource,
+    CosMlTensor *                       pTensor)
+{
+    RtlZeroMemory(pTensor, sizeof(*pTensor));
+
+    switch (pDesc->DataType)
     {
+    case META_COMMAND_TENSOR_DATA_TYPE_FLOAT32:
+        pTensor->m_dataType = CosMlDataTypeFloat32;
+        break;
     case META_COMMAND_TENSOR_DATA_TYPE_FLOAT16:
-        return 2;
+        pTensor->m_dataType = CosMlDataTypeFloat16;
         break;
-    case META_COMMAND_TENSOR_DATA_TYPE_FLOAT32:
     case META_COMMAND_TENSOR_DATA_TYPE_UINT32:
-        return 4;
+        pTensor->m_dataType = CosMlDataTypeUInt32;
+        break;
+    default:
+        return false;
+    }
+
+    if ((0 == resource.ptr) ||
+        (0 == pDesc->DimensionCount) ||
+        (pDesc->DimensionCount > kCosMlMaxDimensions))
+    {
+        return false;
+    }
+
+    pTensor->m_pData = (void *)resource.ptr;
+    pTensor->m_dimensionCount = pDesc->DimensionCount;
+
+    for (UINT i = 0; i < pDesc->DimensionCount; i++)
+    {
+        pTensor->m_size[i] = pDesc->Size[i];
+        pTensor->m_stride[i] = pDesc->Stride[i];
+    }
+
+    return true;
+}
+
+//
+// A null optional tensor is returned with m_pData NULL
+//
+
+static bool
+CosKmGetOptionalMlTensor(
+    const META_COMMAND_OPTIONAL_TENSOR_DESC *   pDesc,
+    D3D12_GPU_DESCRIPTOR_HANDLE                 resource,
+    CosMlTensor *                               pTensor)
+{
+    if (pDesc->IsNull)
+    {
+        RtlZeroMemory(pTensor, sizeof(*pTensor));
+
+        return true;
+    }
+
+    return CosKmGetMlTensor(pDesc, resource, pTensor);
+}
+
+static bool
+CosKmGetMlActivation(
+    const META_COMMAND_ACTIVATION_DESC *    pDesc,
+    CosMlActivation *                       pActivation)
+{
+    pActivation->m_params[0] = pDesc->Params[0];
+    pActivation->m_params[1] = pDesc->Params[1];
+
+    switch (pDesc->Function)
+    {
+    case META_COMMAND_ACTIVATION_FUNCTION_IDENTITY:
+        pActivation->m_function = CosMlActivationIdentity;
+        break;
+    case META_COMMAND_ACTIVATION_FUNCTION_LINEAR:
+        pActivation->m_function = CosMlActivationLinear;
+        break;
+    case META_COMMAND_ACTIVATION_FUNCTION_RELU:
+        pActivation->m_function = CosMlActivationRelu;
+        break;
+    case META_COMMAND_ACTIVATION_FUNCTION_LEAKY_RELU:
+        pActivation->m_function = CosMlActivationLeakyRelu;
+        break;
+    case META_COMMAND_ACTIVATION_FUNCTION_SIGMOID:
+        pActivation->m_function = CosMlActivationSigmoid;
+        break;
+    case META_COMMAND_ACTIVATION_FUNCTION_TANH:
+        pActivation->m_function = CosMlActivationTanh;
+        break;
+    case META_COMMAND_ACTIVATION_FUNCTION_ELU:
+        pActivation->m_function = CosMlActivationElu;
+        break;
+    case META_COMMAND_ACTIVATION_FUNCTION_SOFTPLUS:
+        pActivation->m_function = CosMlActivationSoftplus;
         break;
     default:
-        return 0;
+        COS_LOG_ERROR("Unsupported meta command activation function. (Function=%d)", pDesc->Function);
+        return false;
+    }
+
+    return true;
+}
+
+static bool
+CosKmGetOptionalMlActivation(
+    const META_COMMAND_OPTIONAL_ACTIVATION_DESC *   pDesc,
+    CosMlActivation *                               pActivation)
+{
+    if (pDesc->IsNull)
+    {
+        pActivation->m_function = CosMlActivationNone;
+        pActivation->m_params[0] = pActivation->m_params[1] = 0.0f;
+
+        return true;
+    }
+
+    return CosKmGetMlActivation(pDesc, pActivation);
+}
+
+//
+// Fills the direction and activations shared by RNN, GRU and LSTM and runs
+// the recurrent kernel. Without activations the ONNX defaults are used, a
+// single set of activations applies to both directions.
+//
+
+static void
+CosKmExecuteRecurrentNetwork(
+    CosMlContext *                          pMlContext,
+    CosMlRecurrentDesc *                    pDesc,
+    UINT                                    direction,
+    const META_COMMAND_ACTIVATION_DESC *    pActivationDescs,
+    UINT                                    activationDescCount)
+{
+    static const CosMlActivationFunction s_defaultActivations[][kCosMlMaxRecurrentActivations] =
+    {
+        { CosMlActivationTanh, CosMlActivationNone, CosMlActivationNone },          // RNN
+        { CosMlActivationSigmoid, CosMlActivationTanh, CosMlActivationNone },       // GRU
+        { CosMlActivationSigmoid, CosMlActivationTanh, CosMlActivationTanh },       // LSTM
+    };
+
+    static const UINT s_numActivations[] = { 1, 2, 3 };
+
+    switch (direction)
+    {
+    case META_COMMAND_RECURRENT_NETWORK_DIRECTION_FORWARD:
+        pDesc->m_direction = CosMlRecurrentForward;
+        break;
+    case META_COMMAND_RECURRENT_NETWORK_DIRECTION_BACKWARD:
+        pDesc->m_direction = CosMlRecurrentBackward;
         break;
+    case META_COMMAND_RECURRENT_NETWORK_DIRECTION_BIDIRECTIONAL:
+        pDesc->m_direction = CosMlRecurrentBidirectional;
+        break;
+    default:
+        COS_LOG_ERROR("Unsupported recurrent network direction. (Direction=%d)", direction);
+        return;
+    }
+
+    UINT numActivations = s_numActivations[pDesc->m_cell];
+
+    if ((0 != activationDescCount) &&
+        (numActivations != activationDescCount) &&
+        (2*numActivations != activationDescCount))
+    {
+        COS_LOG_ERROR("Unexpected recurrent network activation count. (ActivationDescCount=%d)", activationDescCount);
+        return;
+    }
+
+    for (UINT i = 0; i < 2*kCosMlMaxRecurrentActivations; i++)
+    {
+        UINT activation = i % kCosMlMaxRecurrentActivations;
+        UINT source = (i / kCosMlMaxRecurrentActivations)*numActivations + activation;
+
+        pDesc->m_activations[i].m_function = s_defaultActivations[pDesc->m_cell][activation];
+        pDesc->m_activations[i].m_params[0] = pDesc->m_activations[i].m_params[1] = 0.0f;
+
+        if ((activation >= numActivations) || (0 == activationDescCount))
+        {
+            continue;
+        }
+
+        if (!CosKmGetMlActivation(&pActivationDescs[source % activationDescCount], &pDesc->m_activations[i]))
+        {
+            return;
+        }
+    }
+
+    if (!CosMlRecurrent(pMlContext, pDesc))
+    {
+        COS_LOG_ERROR("Recurrent network meta command failed. (Cell=%d)", pDesc->m_cell);
     }
 }
 
+static bool
+CosKmGetMlNormalizationDesc(
+    META_COMMAND_CREATE_NORMALIZATION_DESC *  pCreateDesc,
+    META_COMMAND_EXECUTE_NORMALIZATION_DESC * pExecuteDesc,
+    CosMlNormalizationDesc *                  pDesc)
+{
+    pDesc->m_epsilon = pCreateDesc->Epsilon;
+
+    return CosKmGetMlTensor(&pCreateDesc->DescIn, pExecuteDesc->InputResource, &pDesc->m_input) &&
+           CosKmGetMlTensor(&pCreateDesc->DescMean, pExecuteDesc->MeanResource, &pDesc->m_mean) &&
+           CosKmGetMlTensor(&pCreateDesc->DescVariance, pExecuteDesc->VarianceResource, &pDesc->m_variance) &&
+           CosKmGetOptionalMlTensor(&pCreateDesc->DescScale, pExecuteDesc->ScaleResource, &pDesc->m_scale) &&
+           CosKmGetOptionalMlTensor(&pCreateDesc->DescBias, pExecuteDesc->BiasResource, &pDesc->m_bias) &&
+           CosKmGetMlTensor(&pCreateDesc->DescOut, pExecuteDesc->OutputResource, &pDesc->m_out) &&
+           CosKmGetOptionalMlActivation(&pCreateDesc->Activation, &pDesc->m_activation);
+}
+
 static void
 CosKmExecuteMetaCommandNormalization(
+    CosMlContext *                            pMlContext,
     META_COMMAND_CREATE_NORMALIZATION_DESC *  pCreateDesc,
     META_COMMAND_EXECUTE_NORMALIZATION_DESC * pExecuteDesc)
 {
-    UNREFERENCED_PARAMETER(pCreateDesc);
-    UNREFERENCED_PARAMETER(pExecuteDesc);
-
-    MetaCommandId   metaCommandId;
+    CosMlNormalizationDesc  desc;
 
-    metaCommandId = MetaCommandNormalization;
+    if (!CosKmGetMlNormalizationDesc(pCreateDesc, pExecuteDesc, &desc) ||
+        !CosMlNormalization(pMlContext, &desc))
+    {
+        COS_LOG_ERROR("Normalization meta command failed.");
+    }
 }
 
+//
+// pFusedNormalization is the normalization of a fused packet or NULL
+//
+
 static void
 CosKmExecuteMetaCommandConvolution(
+    CosMlContext *                          pMlContext,
     META_COMMAND_CREATE_CONVOLUTION_DESC *  pCreateDesc,
-    META_COMMAND_EXECUTE_CONVOLUTION_DESC * pExecuteDesc)
+    META_COMMAND_EXECUTE_CONVOLUTION_DESC * pExecuteDesc,
+    const CosMlNormalizationDesc *          pFusedNormalization)
 {
-    UNREFERENCED_PARAMETER(pCreateDesc);
-    UNREFERENCED_PARAMETER(pExecuteDesc);
+    //
+    // Only forward 2D convolution is implemented
+    //
 
-    MetaCommandId   metaCommandId;
+    if ((META_COMMAND_CONVOLUTION_DIRECTION_FORWARD != pCreateDesc->Direction) ||
+        (2 != pCreateDesc->DimensionCount))
+    {
+        COS_LOG_ERROR(
+            "Unsupported convolution meta command. (Direction=%d, DimensionCount=%d)",
+            pCreateDesc->Direction,
+            pCreateDesc->DimensionCount);
+        return;
+    }
+
+    CosMlConvolutionDesc    desc;
 
-    metaCommandId = MetaCommandConvolution;
+    desc.m_crossCorrelation = (META_COMMAND_CONVOLUTION_MODE_CROSS_CORRELATION == pCreateDesc->Mode);
+    desc.m_groupCount = pCreateDesc->GroupCount;
+    desc.m_pFusedNormalization = pFusedNormalization;
+
+    for (UINT i = 0; i < 2; i++)
+    {
+        desc.m_stride[i] = pCreateDesc->Stride[i];
+        desc.m_dilation[i] = pCreateDesc->Dilation[i];
+        desc.m_startPadding[i] = pCreateDesc->StartPadding[i];
+        desc.m_endPadding[i] = pCreateDesc->EndPadding[i];
+    }
+
+    if (!CosKmGetMlTensor(&pCreateDesc->DescIn, pExecuteDesc->InputResource, &desc.m_input) ||
+        !CosKmGetMlTensor(&pCreateDesc->DescFilter, pExecuteDesc->FilterResource, &desc.m_filter) ||
+        !CosKmGetOptionalMlTensor(&pCreateDesc->DescBias, pExecuteDesc->BiasResource, &desc.m_bias) ||
+        !CosKmGetMlTensor(&pCreateDesc->DescOut, pExecuteDesc->OutputResource, &desc.m_out) ||
+        !CosKmGetOptionalMlActivation(&pCreateDesc->Activation, &desc.m_activation) ||
+        !CosMlConvolution(pMlContext, &desc))
+    {
+        COS_LOG_ERROR("Convolution meta command failed.");
+    }
 }
 
 static void
 CosKmExecuteMetaCommandGEMM(
+    CosMlContext *                   pMlContext,
     META_COMMAND_CREATE_GEMM_DESC *  pCreateDesc,
-    META_COMMAND_EXECUTE_GEMM_DESC * pExecuteDesc)
+    META_COMMAND_EXECUTE_GEMM_DESC * pExecuteDesc,
+    const CosMlNormalizationDesc *   pFusedNormalization)
 {
-    UNREFERENCED_PARAMETER(pCreateDesc);
-    UNREFERENCED_PARAMETER(pExecuteDesc);
-
-    MetaCommandId   metaCommandId;
-
-    metaCommandId = MetaCommandGEMM;
+    CosMlGemmDesc   desc;
+
+    desc.m_transposeA = (META_COMMAND_MATRIX_TRANSFORM_TRANSPOSE == pCreateDesc->TransA);
+    desc.m_transposeB = (META_COMMAND_MATRIX_TRANSFORM_TRANSPOSE == pCreateDesc->TransB);
+    desc.m_alpha = pCreateDesc->Alpha;
+    desc.m_beta = pCreateDesc->Beta;
+    desc.m_pFusedNormalization = pFusedNormalization;
+
+    if (!CosKmGetMlTensor(&pCreateDesc->DescA, pExecuteDesc->AResource, &desc.m_a) ||
+        !CosKmGetMlTensor(&pCreateDesc->DescB, pExecuteDesc->BResource, &desc.m_b) ||
+        !CosKmGetOptionalMlTensor(&pCreateDesc->DescC, pExecuteDesc->CResource, &desc.m_c) ||
+        !CosKmGetMlTensor(&pCreateDesc->DescOut, pExecuteDesc->OutputResource, &desc.m_out) ||
+        !CosKmGetOptionalMlActivation(&pCreateDesc->Activation, &desc.m_activation) ||
+        !CosMlGemm(pMlContext, &desc))
+    {
+        COS_LOG_ERROR("GEMM meta command failed.");
+    }
 }
 
 static void
 CosKmExecuteMetaCommandGRU(
+    CosMlContext *                  pMlContext,
     META_COMMAND_CREATE_GRU_DESC *  pCreateDesc,
     META_COMMAND_EXECUTE_GRU_DESC * pExecuteDesc)
 {
-    UNREFERENCED_PARAMETER(pCreateDesc);
-    UNREFERENCED_PARAMETER(pExecuteDesc);
-
-    MetaCommandId   metaCommandId;
+    CosMlRecurrentDesc  desc = {};
+
+    desc.m_cell = CosMlRecurrentCellGru;
+    desc.m_linearBeforeReset = (FALSE != pCreateDesc->LinearBeforeReset);
+
+    if (!CosKmGetMlTensor(&pCreateDesc->DescIn, pExecuteDesc->InputResource, &desc.m_input) ||
+        !CosKmGetMlTensor(&pCreateDesc->DescWeight, pExecuteDesc->WeightResource, &desc.m_weight) ||
+        !CosKmGetMlTensor(&pCreateDesc->DescRecurrence, pExecuteDesc->RecurrenceResource, &desc.m_recurrence) ||
+        !CosKmGetOptionalMlTensor(&pCreateDesc->DescBias, pExecuteDesc->BiasResource, &desc.m_bias) ||
+        !CosKmGetOptionalMlTensor(&pCreateDesc->DescHiddenInit, pExecuteDesc->HiddenInitResource, &desc.m_hiddenInit) ||
+        !CosKmGetOptionalMlTensor(&pCreateDesc->DescSeqLengths, pExecuteDesc->SequenceLengthsResource, &desc.m_seqLengths) ||
+        !CosKmGetOptionalMlTensor(&pCreateDesc->DescOutSingle, pExecuteDesc->OutputSingleResource, &desc.m_outSingle) ||
+        !CosKmGetOptionalMlTensor(&pCreateDesc->DescOutSequence, pExecuteDesc->OutputSequenceResource, &desc.m_outSequence))
+    {
+        COS_LOG_ERROR("GRU meta command has invalid tensors.");
+        return;
+    }
 
-    metaCommandId = MetaCommandGRU;
+    CosKmExecuteRecurrentNetwork(
+        pMlContext,
+        &desc,
+        pCreateDesc->Direction,
+        pCreateDesc->ActivationDescs,
+        pCreateDesc->ActivationDescCount);
 }
 
 static void
 CosKmExecuteMetaCommandLSTM(
+    CosMlContext *                   pMlContext,
     META_COMMAND_CREATE_LSTM_DESC *  pCreateDesc,
     META_COMMAND_EXECUTE_LSTM_DESC * pExecuteDesc)
 {
-    UNREFERENCED_PARAMETER(pCreateDesc);
-    UNREFERENCED_PARAMETER(pExecuteDesc);
-
-    MetaCommandId   metaCommandId;
+    CosMlRecurrentDesc  desc = {};
+
+    desc.m_cell = CosMlRecurrentCellLstm;
+    desc.m_useClip = (FALSE != pCreateDesc->UseClipThreshold);
+    desc.m_clip = pCreateDesc->ClipThreshold;
+    desc.m_coupleInputForget = (FALSE != pCreateDesc->CoupleInputForget);
+
+    if (!CosKmGetMlTensor(&pCreateDesc->DescIn, pExecuteDesc->InputResource, &desc.m_input) ||
+        !CosKmGetMlTensor(&pCreateDesc->DescWeight, pExecuteDesc->WeightResource, &desc.m_weight) ||
+        !CosKmGetMlTensor(&pCreateDesc->DescRecurrence, pExecuteDesc->RecurrenceResource, &desc.m_recurrence) ||
+        !CosKmGetOptionalMlTensor(&pCreateDesc->DescBias, pExecuteDesc->BiasResource, &desc.m_bias) ||
+        !CosKmGetOptionalMlTensor(&pCreateDesc->DescHiddenInit, pExecuteDesc->HiddenInitResource, &desc.m_hiddenInit) ||
+        !CosKmGetOptionalMlTensor(&pCreateDesc->DescCellMemInit, pExecuteDesc->CellMemInitResource, &desc.m_cellInit) ||
+        !CosKmGetOptionalMlTensor(&pCreateDesc->DescSeqLengths, pExecuteDesc->SequenceLengthsResource, &desc.m_seqLengths) ||
+        !CosKmGetOptionalMlTensor(&pCreateDesc->DescPeephole, pExecuteDesc->PeepholeResource, &desc.m_peephole) ||
+        !CosKmGetOptionalMlTensor(&pCreateDesc->DescOutSingle, pExecuteDesc->OutputSingleResource, &desc.m_outSingle) ||
+        !CosKmGetOptionalMlTensor(&pCreateDesc->DescOutSequence, pExecuteDesc->OutputSequenceResource, &desc.m_outSequence) ||
+        !CosKmGetOptionalMlTensor(&pCreateDesc->DescOutCellSingle, pExecuteDesc->OutputCellSingleResource, &desc.m_outCellSingle))
+    {
+        COS_LOG_ERROR("LSTM meta command has invalid tensors.");
+        return;
+    }
 
-    metaCommandId = MetaCommandLSTM;
+    CosKmExecuteRecurrentNetwork(
+        pMlContext,
+        &desc,
+        pCreateDesc->Direction,
+        pCreateDesc->ActivationDescs,
+        pCreateDesc->ActivationDescCount);
 }
 
 static void
 CosKmExecuteMetaCommandMVN(
+    CosMlContext *                  pMlContext,
     META_COMMAND_CREATE_MVN_DESC *  pCreateDesc,
     META_COMMAND_EXECUTE_MVN_DESC * pExecuteDesc)
 {
-    UNREFERENCED_PARAMETER(pCreateDesc);
-    UNREFERENCED_PARAMETER(pExecuteDesc);
-
-    MetaCommandId   metaCommandId;
-
-    metaCommandId = MetaCommandMVN;
+    CosMlMvnDesc    desc;
+
+    desc.m_acrossChannels = (FALSE != pCreateDesc->AcrossChannels);
+    desc.m_normalizeVariance = (FALSE != pCreateDesc->NormalizeVariance);
+    desc.m_epsilon = pCreateDesc->Epsilon;
+
+    if (!CosKmGetMlTensor(&pCreateDesc->DescIn, pExecuteDesc->InputResource, &desc.m_input) ||
+        !CosKmGetOptionalMlTensor(&pCreateDesc->DescScale, pExecuteDesc->ScaleResource, &desc.m_scale) ||
+        !CosKmGetOptionalMlTensor(&pCreateDesc->DescBias, pExecuteDesc->BiasResource, &desc.m_bias) ||
+        !CosKmGetMlTensor(&pCreateDesc->DescOut, pExecuteDesc->OutputResource, &desc.m_out) ||
+        !CosKmGetOptionalMlActivation(&pCreateDesc->Activation, &desc.m_activation) ||
+        !CosMlMvn(pMlContext, &desc))
+    {
+        COS_LOG_ERROR("MVN meta command failed.");
+    }
 }
 
 static void
 CosKmExecuteMetaCommandPooling(
+    CosMlContext *                      pMlContext,
     META_COMMAND_CREATE_POOLING_DESC *  pCreateDesc,
     META_COMMAND_EXECUTE_POOLING_DESC * pExecuteDesc)
 {
-    UNREFERENCED_PARAMETER(pCreateDesc);
-    UNREFERENCED_PARAMETER(pExecuteDesc);
+    CosMlPoolingDesc    desc;
 
-    MetaCommandId   metaCommandId;
+    switch (pCreateDesc->Function)
+    {
+    case META_COMMAND_POOLING_FUNCTION_AVERAGE:
+        desc.m_function = CosMlPoolingAverage;
+        break;
+    case META_COMMAND_POOLING_FUNCTION_L_P:
+        desc.m_function = CosMlPoolingLp;
+        break;
+    case META_COMMAND_POOLING_FUNCTION_MAX:
+        desc.m_function = CosMlPoolingMax;
+        break;
+    default:
+        COS_LOG_ERROR("Unsupported pooling function. (Function=%d)", pCreateDesc->Function);
+        return;
+    }
+
+    if (2 != pCreateDesc->DimensionCount)
+    {
+        COS_LOG_ERROR("Unsupported pooling dimension count. (DimensionCount=%d)", pCreateDesc->DimensionCount);
+        return;
+    }
 
-    metaCommandId = MetaCommandPooling;
+    for (UINT i = 0; i < 2; i++)
+    {
+        desc.m_stride[i] = pCreateDesc->Stride[i];
+        desc.m_windowSize[i] = pCreateDesc->WindowSize[i];
+        desc.m_startPadding[i] = pCreateDesc->StartPadding[i];
+        desc.m_endPadding[i] = pCreateDesc->EndPadding[i];
+    }
+
+    desc.m_p = pCreateDesc->P;
+    desc.m_includePadding = (FALSE != pCreateDesc->IncludePaddingForAverage);
+
+    if (!CosKmGetMlTensor(&pCreateDesc->DescIn, pExecuteDesc->InputResource, &desc.m_input) ||
+        !CosKmGetMlTensor(&pCreateDesc->DescOut, pExecuteDesc->OutputResource, &desc.m_out) ||
+        !CosKmGetOptionalMlActivation(&pCreateDesc->Activation, &desc.m_activation) ||
+        !CosMlPooling(pMlContext, &desc))
+    {
+        COS_LOG_ERROR("Pooling meta command failed.");
+    }
 }
 
 static void
 CosKmExecuteMetaCommandReduction(
+    CosMlContext *                        pMlContext,
     META_COMMAND_CREATE_REDUCTION_DESC *  pCreateDesc,
     META_COMMAND_EXECUTE_REDUCTION_DESC * pExecuteDesc)
 {
-    UNREFERENCED_PARAMETER(pCreateDesc);
-    UNREFERENCED_PARAMETER(pExecuteDesc);
+    CosMlReductionDesc  desc;
 
-    MetaCommandId   metaCommandId;
+    switch (pCreateDesc->Function)
+    {
+    case META_COMMAND_REDUCE_FUNCTION_ARGMAX:       desc.m_function = CosMlReductionArgMax; break;
+    case META_COMMAND_REDUCE_FUNCTION_ARGMIN:       desc.m_function = CosMlReductionArgMin; break;
+    case META_COMMAND_REDUCE_FUNCTION_AVERAGE:      desc.m_function = CosMlReductionAverage; break;
+    case META_COMMAND_REDUCE_FUNCTION_L1:           desc.m_function = CosMlReductionL1; break;
+    case META_COMMAND_REDUCE_FUNCTION_L2:           desc.m_function = CosMlReductionL2; break;
+    case META_COMMAND_REDUCE_FUNCTION_LOG_SUM:      desc.m_function = CosMlReductionLogSum; break;
+    case META_COMMAND_REDUCE_FUNCTION_LOG_SUM_EXP:  desc.m_function = CosMlReductionLogSumExp; break;
+    case META_COMMAND_REDUCE_FUNCTION_MAX:          desc.m_function = CosMlReductionMax; break;
+    case META_COMMAND_REDUCE_FUNCTION_MIN:          desc.m_function = CosMlReductionMin; break;
+    case META_COMMAND_REDUCE_FUNCTION_MULTIPLY:     desc.m_function = CosMlReductionMultiply; break;
+    case META_COMMAND_REDUCE_FUNCTION_SUM:          desc.m_function = CosMlReductionSum; break;
+    case META_COMMAND_REDUCE_FUNCTION_SUM_SQUARE:   desc.m_function = CosMlReductionSumSquare; break;
+    default:
+        COS_LOG_ERROR("Unsupported reduce function. (Function=%d)", pCreateDesc->Function);
+        return;
+    }
 
-    metaCommandId = MetaCommandReduction;
+    if (!CosKmGetMlTensor(&pCreateDesc->DescIn, pExecuteDesc->InputResource, &desc.m_input) ||
+        !CosKmGetMlTensor(&pCreateDesc->DescOut, pExecuteDesc->OutputResource, &desc.m_out) ||
+        !CosMlReduction(pMlContext, &desc))
+    {
+        COS_LOG_ERROR("Reduction meta command failed.");
+    }
 }
 
 static void
 CosKmExecuteMetaCommandRNN(
+    CosMlContext *                  pMlContext,
     META_COMMAND_CREATE_RNN_DESC *  pCreateDesc,
     META_COMMAND_EXECUTE_RNN_DESC * pExecuteDesc)
 {
-    UNREFERENCED_PARAMETER(pCreateDesc);
-    UNREFERENCED_PARAMETER(pExecuteDesc);
-
-    MetaCommandId   metaCommandId;
+    CosMlRecurrentDesc  desc = {};
+
+    desc.m_cell = CosMlRecurrentCellRnn;
+
+    if (!CosKmGetMlTensor(&pCreateDesc->DescIn, pExecuteDesc->InputResource, &desc.m_input) ||
+        !CosKmGetMlTensor(&pCreateDesc->DescWeight, pExecuteDesc->WeightResource, &desc.m_weight) ||
+        !CosKmGetMlTensor(&pCreateDesc->DescRecurrence, pExecuteDesc->RecurrenceResource, &desc.m_recurrence) ||
+        !CosKmGetOptionalMlTensor(&pCreateDesc->DescBias, pExecuteDesc->BiasResource, &desc.m_bias) ||
+        !CosKmGetOptionalMlTensor(&pCreateDesc->DescHiddenInit, pExecuteDesc->HiddenInitResource, &desc.m_hiddenInit) ||
+        !CosKmGetOptionalMlTensor(&pCreateDesc->DescSeqLengths, pExecuteDesc->SequenceLengthsResource, &desc.m_seqLengths) ||
+        !CosKmGetOptionalMlTensor(&pCreateDesc->DescOutSingle, pExecuteDesc->OutputSingleResource, &desc.m_outSingle) ||
+        !CosKmGetOptionalMlTensor(&pCreateDesc->DescOutSequence, pExecuteDesc->OutputSequenceResource, &desc.m_outSequence))
+    {
+        COS_LOG_ERROR("RNN meta command has invalid tensors.");
+        return;
+    }
 
-    metaCommandId = MetaCommandRNN;
+    CosKmExecuteRecurrentNetwork(
+        pMlContext,
+        &desc,
+        pCreateDesc->Direction,
+        pCreateDesc->ActivationDescs,
+        pCreateDesc->ActivationDescCount);
 }
 
 static void
@@ -160,27 +579,28 @@ CosKmExecuteMetaCommandRoiPooling(
     metaCommandId = MetaCommandRoiPooling;
 }
 
+//
+// Strided copy between any two layouts of the same logical tensor, with data
+// type conversion when the descs differ
+//
+
 static void
 CosKmExecuteMetaCommandCopyTensor(
+    CosMlContext *                  pMlContext,
     HW_META_COMMAND_COPY_TENSOR *   pHwMetaCommand,
-    HW_IO_TABLE_COPY_TENSOR *   pHwIoTable)
+    HW_IO_TABLE_COPY_TENSOR *       pHwIoTable)
 {
-    UINT dataSize;
+    CosMlCopyTensorDesc desc;
 
-    if (pHwMetaCommand->DstDesc.Stride[0] != pHwMetaCommand->SrcDesc.Stride[0])
+    if (!CosKmGetMlTensor(&pHwMetaCommand->SrcDesc, pHwIoTable->SrcResource, &desc.m_input) ||
+        !CosKmGetMlTensor(&pHwMetaCommand->DstDesc, pHwIoTable->DstResource, &desc.m_out) ||
+        !CosMlCopyTensor(pMlContext, &desc))
     {
-        return;
+        COS_LOG_ERROR(
+            "Copy tensor meta command failed. (SrcDataType=%d, DstDataType=%d)",
+            pHwMetaCommand->SrcDesc.DataType,
+            pHwMetaCommand->DstDesc.DataType);
     }
-
-    dataSize = ((UINT)pHwMetaCommand->DstDesc.Stride[0])*
-               CosKmGetTensorElementSize(
-                pHwMetaCommand->DstDesc.DataType,
-                pHwMetaCommand->SrcDesc.DataType);
-
-    memcpy(
-        (BYTE*)pHwIoTable->DstResource.ptr,
-        (BYTE*)pHwIoTable->SrcResource.ptr,
-        dataSize);
 }
 
 void
@@ -200,11 +620,44 @@ CosKmFixupResourceCpuAddress(
     }
 }
 
+//
+// Normalization packet that follows the producer within a fused packet
+//
+
+static bool
+CosKmGetFusedNormalization(
+    GpuHwMetaCommand *          pMetaCommand,
+    GpuHwMetaCommand *          pNormalizationCommand,
+    CosMlNormalizationDesc *    pDesc)
+{
+    if ((((BYTE *)pNormalizationCommand) + pNormalizationCommand->m_commandSize != ((BYTE *)pMetaCommand) + pMetaCommand->m_commandSize) ||
+        (MetaCommandNormalization != pNormalizationCommand->m_metaCommandId))
+    {
+        COS_LOG_ERROR("Malformed fused meta command. (MetaCommandId=%d)", pMetaCommand->m_metaCommandId);
+        return false;
+    }
+
+    META_COMMAND_CREATE_NORMALIZATION_DESC *  pCreateDesc = (META_COMMAND_CREATE_NORMALIZATION_DESC *)(pNormalizationCommand + 1);
+    META_COMMAND_EXECUTE_NORMALIZATION_DESC * pExecuteDesc = (META_COMMAND_EXECUTE_NORMALIZATION_DESC *)(pCreateDesc + 1);
+
+    CosKmFixupResourceCpuAddress((D3D12_GPU_DESCRIPTOR_HANDLE *)pExecuteDesc, sizeof(*pExecuteDesc)/sizeof(D3D12_GPU_DESCRIPTOR_HANDLE));
+
+    if (!CosKmGetMlNormalizationDesc(pCreateDesc, pExecuteDesc, pDesc))
+    {
+        COS_LOG_ERROR("Fused normalization meta command failed.");
+        return false;
+    }
+
+    return true;
+}
+
 void
 CosKmExecuteMetaCommand(
-    GpuHwMetaCommand *  pMetaCommand)
+    GpuHwMetaCommand *      pMetaCommand,
+    CosKmDispatchEngine *   pDispatchEngine)
 {
-    KFLOATING_SAVE floatingSave;
+    CosKmMlContext  mlContext(pDispatchEngine);
+    KFLOATING_SAVE  floatingSave;
 
     KeSaveFloatingPointState(&floatingSave);
 
@@ -216,7 +669,7 @@ CosKmExecuteMetaCommand(
             META_COMMAND_EXECUTE_NORMALIZATION_DESC * pExecuteDesc = (META_COMMAND_EXECUTE_NORMALIZATION_DESC *)(pCreateDesc + 1);
 
             CosKmFixupResourceCpuAddress((D3D12_GPU_DESCRIPTOR_HANDLE *)pExecuteDesc, sizeof(*pExecuteDesc)/sizeof(D3D12_GPU_DESCRIPTOR_HANDLE));
-            CosKmExecuteMetaCommandNormalization(pCreateDesc, pExecuteDesc);
+            CosKmExecuteMetaCommandNormalization(&mlContext, pCreateDesc, pExecuteDesc);
         }
         break;
     case MetaCommandConvolution:
@@ -225,7 +678,7 @@ CosKmExecuteMetaCommand(
             META_COMMAND_EXECUTE_CONVOLUTION_DESC * pExecuteDesc = (META_COMMAND_EXECUTE_CONVOLUTION_DESC *)(pCreateDesc + 1);
 
             CosKmFixupResourceCpuAddress((D3D12_GPU_DESCRIPTOR_HANDLE *)pExecuteDesc, sizeof(*pExecuteDesc)/sizeof(D3D12_GPU_DESCRIPTOR_HANDLE));
-            CosKmExecuteMetaCommandConvolution(pCreateDesc, pExecuteDesc);
+            CosKmExecuteMetaCommandConvolution(&mlContext, pCreateDesc, pExecuteDesc, NULL);
         }
         break;
     case MetaCommandGEMM:
@@ -234,7 +687,7 @@ CosKmExecuteMetaCommand(
             META_COMMAND_EXECUTE_GEMM_DESC * pExecuteDesc = (META_COMMAND_EXECUTE_GEMM_DESC *)(pCreateDesc + 1);
 
             CosKmFixupResourceCpuAddress((D3D12_GPU_DESCRIPTOR_HANDLE *)pExecuteDesc, sizeof(*pExecuteDesc)/sizeof(D3D12_GPU_DESCRIPTOR_HANDLE));
-            CosKmExecuteMetaCommandGEMM(pCreateDesc, pExecuteDesc);
+            CosKmExecuteMetaCommandGEMM(&mlContext, pCreateDesc, pExecuteDesc, NULL);
         }
         break;
     case MetaCommandGRU:
@@ -243,7 +696,7 @@ CosKmExecuteMetaCommand(
             META_COMMAND_EXECUTE_GRU_DESC * pExecuteDesc = (META_COMMAND_EXECUTE_GRU_DESC *)(pCreateDesc + 1);
 
             CosKmFixupResourceCpuAddress((D3D12_GPU_DESCRIPTOR_HANDLE *)pExecuteDesc, sizeof(*pExecuteDesc)/sizeof(D3D12_GPU_DESCRIPTOR_HANDLE));
-            CosKmExecuteMetaCommandGRU(pCreateDesc, pExecuteDesc);
+            CosKmExecuteMetaCommandGRU(&mlContext, pCreateDesc, pExecuteDesc);
         }
         break;
     case MetaCommandLSTM:
@@ -252,7 +705,7 @@ CosKmExecuteMetaCommand(
             META_COMMAND_EXECUTE_LSTM_DESC * pExecuteDesc = (META_COMMAND_EXECUTE_LSTM_DESC *)(pCreateDesc + 1);
 
             CosKmFixupResourceCpuAddress((D3D12_GPU_DESCRIPTOR_HANDLE *)pExecuteDesc, sizeof(*pExecuteDesc)/sizeof(D3D12_GPU_DESCRIPTOR_HANDLE));
-            CosKmExecuteMetaCommandLSTM(pCreateDesc, pExecuteDesc);
+            CosKmExecuteMetaCommandLSTM(&mlContext, pCreateDesc, pExecuteDesc);
         }
         break;
     case MetaCommandMVN:
@@ -261,7 +714,7 @@ CosKmExecuteMetaCommand(
             META_COMMAND_EXECUTE_MVN_DESC * pExecuteDesc = (META_COMMAND_EXECUTE_MVN_DESC *)(pCreateDesc + 1);
 
             CosKmFixupResourceCpuAddress((D3D12_GPU_DESCRIPTOR_HANDLE *)pExecuteDesc, sizeof(*pExecuteDesc)/sizeof(D3D12_GPU_DESCRIPTOR_HANDLE));
-            CosKmExecuteMetaCommandMVN(pCreateDesc, pExecuteDesc);
+            CosKmExecuteMetaCommandMVN(&mlContext, pCreateDesc, pExecuteDesc);
         }
         break;
     case MetaCommandPooling:
@@ -270,7 +723,7 @@ CosKmExecuteMetaCommand(
             META_COMMAND_EXECUTE_POOLING_DESC * pExecuteDesc = (META_COMMAND_EXECUTE_POOLING_DESC *)(pCreateDesc + 1);
 
             CosKmFixupResourceCpuAddress((D3D12_GPU_DESCRIPTOR_HANDLE *)pExecuteDesc, sizeof(*pExecuteDesc)/sizeof(D3D12_GPU_DESCRIPTOR_HANDLE));
-            CosKmExecuteMetaCommandPooling(pCreateDesc, pExecuteDesc);
+            CosKmExecuteMetaCommandPooling(&mlContext, pCreateDesc, pExecuteDesc);
         }
         break;
     case MetaCommandReduction:
@@ -279,7 +732,7 @@ CosKmExecuteMetaCommand(
             META_COMMAND_EXECUTE_REDUCTION_DESC * pExecuteDesc = (META_COMMAND_EXECUTE_REDUCTION_DESC *)(pCreateDesc + 1);
 
             CosKmFixupResourceCpuAddress((D3D12_GPU_DESCRIPTOR_HANDLE *)pExecuteDesc, sizeof(*pExecuteDesc)/sizeof(D3D12_GPU_DESCRIPTOR_HANDLE));
-            CosKmExecuteMetaCommandReduction(pCreateDesc, pExecuteDesc);
+            CosKmExecuteMetaCommandReduction(&mlContext, pCreateDesc, pExecuteDesc);
         }
         break;
     case MetaCommandRNN:
@@ -288,7 +741,7 @@ CosKmExecuteMetaCommand(
             META_COMMAND_EXECUTE_RNN_DESC * pExecuteDesc = (META_COMMAND_EXECUTE_RNN_DESC *)(pCreateDesc + 1);
 
             CosKmFixupResourceCpuAddress((D3D12_GPU_DESCRIPTOR_HANDLE *)pExecuteDesc, sizeof(*pExecuteDesc)/sizeof(D3D12_GPU_DESCRIPTOR_HANDLE));
-            CosKmExecuteMetaCommandRNN(pCreateDesc, pExecuteDesc);
+            CosKmExecuteMetaCommandRNN(&mlContext, pCreateDesc, pExecuteDesc);
         }
         break;
     case MetaCommandRoiPooling:
@@ -306,7 +759,35 @@ CosKmExecuteMetaCommand(
             HW_IO_TABLE_COPY_TENSOR * pHwIoTable = (HW_IO_TABLE_COPY_TENSOR *)(pHwMetaCommand + 1);
 
             CosKmFixupResourceCpuAddress((D3D12_GPU_DESCRIPTOR_HANDLE *)pHwIoTable, sizeof(*pHwIoTable)/sizeof(D3D12_GPU_DESCRIPTOR_HANDLE));
-            CosKmExecuteMetaCommandCopyTensor(pHwMetaCommand, pHwIoTable);
+            CosKmExecuteMetaCommandCopyTensor(&mlContext, pHwMetaCommand, pHwIoTable);
+        }
+        break;
+    case MetaCommandConvolutionNormalization:
+        {
+            META_COMMAND_CREATE_CONVOLUTION_DESC *  pCreateDesc = (META_COMMAND_CREATE_CONVOLUTION_DESC *)(pMetaCommand + 1);
+            META_COMMAND_EXECUTE_CONVOLUTION_DESC * pExecuteDesc = (META_COMMAND_EXECUTE_CONVOLUTION_DESC *)(pCreateDesc + 1);
+            CosMlNormalizationDesc                  normalizationDesc;
+
+            CosKmFixupResourceCpuAddress((D3D12_GPU_DESCRIPTOR_HANDLE *)pExecuteDesc, sizeof(*pExecuteDesc)/sizeof(D3D12_GPU_DESCRIPTOR_HANDLE));
+
+            if (CosKmGetFusedNormalization(pMetaCommand, (GpuHwMetaCommand *)(pExecuteDesc + 1), &normalizationDesc))
+            {
+                CosKmExecuteMetaCommandConvolution(&mlContext, pCreateDesc, pExecuteDesc, &normalizationDesc);
+            }
+        }
+        break;
+    case MetaCommandGEMMNormalization:
+        {
+            META_COMMAND_CREATE_GEMM_DESC *  pCreateDesc = (META_COMMAND_CREATE_GEMM_DESC *)(pMetaCommand + 1);
+            META_COMMAND_EXECUTE_GEMM_DESC * pExecuteDesc = (META_COMMAND_EXECUTE_GEMM_DESC *)(pCreateDesc + 1);
+            CosMlNormalizationDesc           normalizationDesc;
+
+            CosKmFixupResourceCpuAddress((D3D12_GPU_DESCRIPTOR_HANDLE *)pExecuteDesc, sizeof(*pExecuteDesc)/sizeof(D3D12_GPU_DESCRIPTOR_HANDLE));
+
+            if (CosKmGetFusedNormalization(pMetaCommand, (GpuHwMetaCommand *)(pExecuteDesc + 1), &normalizationDesc))
+            {
+                CosKmExecuteMetaCommandGEMM(&mlContext, pCreateDesc, pExecuteDesc, &normalizationDesc);
+            }
         }
         break;
     default:
@@ -320,7 +801,8 @@ CosKmExecuteMetaCommand(
 
 void
 CosKmExecuteMetaCommand(
-    GpuHwMetaCommand *)
+    GpuHwMetaCommand *,
+    CosKmDispatchEngine *)
 {
 }
 
@@ -2,8 +2,14 @@
 
 #include "CosKmd.h"
 #include "CosGpuCommand.h"
+#include "CosKmdDispatch.h"
+
+//
+// ML meta commands run on the CPU, spread across the dispatch engine workers
+//
 
 void
 CosKmExecuteMetaCommand(
-    GpuHwMetaCommand *  pMetaCommand);
+    GpuHwMetaCommand *      pMetaCommand,
+    CosKmDispatchEngine *   pDispatchEngine);
 
@@ -4,8 +4,10 @@
 #include "CosKmdSoftAdapter.tmh"
 
 #include "CosKmdSoftAdapter.h"
+#include "CosKmdContext.h"
 #include "CosGpuCommand.h"
 #include "CosKmdMetaCommand.h"
+#include "CosDispatchReplay.h"
 
 #include "VpuImage.h"
 
@@ -26,7 +28,49 @@ CosKmdSoftAdapter::Start(
     OUT_PULONG              NumberOfVideoPresentSources,
     OUT_PULONG              NumberOfChildren)
 {
-    return CosKmAdapter::Start(DxgkStartInfo, DxgkInterface, NumberOfVideoPresentSources, NumberOfChildren);
+    NTSTATUS status = CosKmAdapter::Start(DxgkStartInfo, DxgkInterface, NumberOfVideoPresentSources, NumberOfChildren);
+    if (!NT_SUCCESS(status))
+    {
+        return status;
+    }
+
+#if COS_GPUVA_SUPPORT
+    m_gpuVaEngine.Initialize(
+        &m_gpuMmu,
+        &m_gpuVaShaderEngine,
+        m_gpuVaCommandBuffer,
+        sizeof(m_gpuVaCommandBuffer),
+        m_gpuVaUavStaging,
+        sizeof(m_gpuVaUavStaging));
+#else
+    m_copyEngine.Initialize((BYTE *)CosKmdGlobal::s_pVideoMemory, CosKmdGlobal::s_videoMemorySize);
+#endif
+
+    status = m_dispatchEngine.Start();
+    if (!NT_SUCCESS(status))
+    {
+        CosKmAdapter::Stop();
+    }
+    else
+    {
+        m_pagingEngine.SetWorkers(&m_pagingWorkers);
+    }
+
+    return status;
+}
+
+NTSTATUS
+CosKmdSoftAdapter::Stop()
+{
+    //
+    // Stop the node worker threads first, the compute nodes are the only clients of the dispatch engine
+    //
+
+    NTSTATUS status = CosKmAdapter::Stop();
+
+    m_dispatchEngine.Stop();
+
+    return status;
 }
 
 void
@@ -74,6 +118,34 @@ CosKmdSoftAdapter::ProcessHWRenderBuffer(
 
 #else
 
+void
+CosKmdSoftAdapter::ProcessCopyBuffer(
+    COSDMABUFSUBMISSION * pDmaBufSubmission)
+{
+    COSDMABUFINFO * pDmaBufInfo = pDmaBufSubmission->m_pDmaBufInfo;
+
+    NT_ASSERT(0 == (pDmaBufSubmission->m_EndOffset - pDmaBufSubmission->m_StartOffset) % sizeof(GpuCommand));
+
+    GpuCommand * pGpuCommand = (GpuCommand *)(pDmaBufInfo->m_pDmaBuffer + pDmaBufSubmission->m_StartOffset);
+    GpuCommand * pEndofCommand = (GpuCommand *)(pDmaBufInfo->m_pDmaBuffer + pDmaBufSubmission->m_EndOffset);
+
+    //
+    // Copy command lists only record SW commands, anything else would use
+    // the compute state owned by the compute node worker thread
+    //
+
+    if (!pDmaBufInfo->m_DmaBufState.m_bSwCommandBuffer ||
+        !m_copyEngine.Execute(pGpuCommand, pEndofCommand))
+    {
+        NT_ASSERT(false);
+
+        COS_LOG_ERROR(
+            "Copy node rejected DMA buffer. (pDmaBufInfo=0x%p, SubmissionFenceId=%d)",
+            pDmaBufInfo,
+            pDmaBufSubmission->m_SubmissionFenceId);
+    }
+}
+
 #if COS_RS_2LEVEL_SUPPORT
 
 void
@@ -203,11 +275,20 @@ CosKmdSoftAdapter::ProcessHWRenderBuffer(
                 commandSize = pCSDispatch->m_commandSize;
             }
             break;
+        case ShaderImageLoad:
+            {
+                //
+                // Hard-coded shaders are used in this configuration
+                //
+
+                commandSize = ((GpuHwShaderImageLoad *)pGpuCommand)->m_commandSize;
+            }
+            break;
         case MetaCommandExecute:
             {
                 GpuHwMetaCommand *  pMetaCommand = (GpuHwMetaCommand *)pGpuCommand;
 
-                CosKmExecuteMetaCommand(pMetaCommand);
+                CosKmExecuteMetaCommand(pMetaCommand, &m_dispatchEngine);
 
                 commandSize = pMetaCommand->m_commandSize;
             }
@@ -224,6 +305,64 @@ CosKmdSoftAdapter::ProcessHWRenderBuffer(
 
 #else
 
+bool
+CosKmdSoftAdapter::ApplyRootSignatureUpdate(
+    GpuHWRootSignatureUpdate * pRootSignatureUpdate)
+{
+    BYTE * pRange = (BYTE *)(pRootSignatureUpdate + 1);
+    BYTE * pEndOfUpdate = ((BYTE *)pRootSignatureUpdate) + pRootSignatureUpdate->m_commandSize;
+
+    for (UINT i = 0; i < pRootSignatureUpdate->m_numRanges; i++)
+    {
+        GpuHWRegisterRange * pRegisterRange = (GpuHWRegisterRange *)pRange;
+        BYTE * pRegisters;
+        UINT registerSize;
+        UINT numRegisters;
+
+        if ((pRange + sizeof(GpuHWRegisterRange)) > pEndOfUpdate)
+        {
+            return false;
+        }
+
+        switch (pRegisterRange->m_registerType)
+        {
+        case COS_HW_CBV_REGISTER:
+            pRegisters = (BYTE *)m_cbvRegisters;
+            registerSize = sizeof(GpuHWConstantDescriptor);
+            numRegisters = COS_MAX_HW_CBV_REGISTERS;
+            break;
+        case COS_HW_SRV_REGISTER:
+            pRegisters = (BYTE *)m_srvRegisters;
+            registerSize = sizeof(GpuHWDescriptor);
+            numRegisters = COS_MAX_HW_SRV_REGISTERS;
+            break;
+        case COS_HW_UAV_REGISTER:
+            pRegisters = (BYTE *)m_uavRegisters;
+            registerSize = sizeof(GpuHWDescriptor);
+            numRegisters = COS_MAX_HW_UAV_REGISTERS;
+            break;
+        default:
+            return false;
+        }
+
+        if ((pRegisterRange->m_firstRegister > numRegisters) ||
+            (pRegisterRange->m_numRegisters > (numRegisters - pRegisterRange->m_firstRegister)) ||
+            ((pRange + sizeof(GpuHWRegisterRange) + pRegisterRange->m_numRegisters*registerSize) > pEndOfUpdate))
+        {
+            return false;
+        }
+
+        memcpy(
+            pRegisters + pRegisterRange->m_firstRegister*registerSize,
+            pRegisterRange + 1,
+            pRegisterRange->m_numRegisters*registerSize);
+
+        pRange += sizeof(GpuHWRegisterRange) + pRegisterRange->m_numRegisters*registerSize;
+    }
+
+    return true;
+}
+
 void
 CosKmdSoftAdapter::ProcessHWRenderBuffer(
     COSDMABUFSUBMISSION * pDmaBufSubmission)
@@ -236,14 +375,53 @@ CosKmdSoftAdapter::ProcessHWRenderBuffer(
     BYTE * pEndofCommand = pDmaBufInfo->m_pDmaBuffer + pDmaBufSubmission->m_EndOffset;
     UINT64 commandSize;
 
-    BOOL bRootSignatureSet = false;
-    GpuHWConstantDescriptor * pCbvTable = NULL;
-    GpuHWDescriptor * pSrvTable = NULL;
-    GpuHWDescriptor * pUavTable = NULL;
+    //
+    // The root registers are copied out of the RootSignatureSet so later
+    // RootSignatureUpdate commands of the same command buffer can patch them,
+    // Root Signatures beyond the register limits are used in place
+    //
+
+    GpuHWConstantDescriptor * pCbvTable = m_cbvRegisters;
+    GpuHWDescriptor * pSrvTable = m_srvRegisters;
+    GpuHWDescriptor * pUavTable = m_uavRegisters;
+    bool bRootSignatureInPlace = false;
+
+    //
+    // Root registers don't carry over from the previous submission, whether
+    // or not the command buffer starts with a Header
+    //
+
+    m_bRootSignatureSet = false;
+
+    memset(m_cbvRegisters, 0, sizeof(m_cbvRegisters));
+    memset(m_srvRegisters, 0, sizeof(m_srvRegisters));
+    memset(m_uavRegisters, 0, sizeof(m_uavRegisters));
+
+    //
+    // A DMA buffer preempted in the middle of a dispatch runs again from the
+    // start, but only the commands setting up state take effect before the
+    // dispatch it was preempted in
+    //
+
+    CosDispatchReplay replay;
+
+    replay.Begin(&pDmaBufInfo->m_ResumeOffset, &pDmaBufInfo->m_ResumeThreadGroup);
+
+    m_dispatchEngine.BeginSubmission();
 
     for (; pGpuCommand < pEndofCommand; pGpuCommand += commandSize)
     {
-        switch (*((GpuCommandId *)pGpuCommand))
+        GpuCommandId commandId = *((GpuCommandId *)pGpuCommand);
+        UINT commandOffset = (UINT)(pGpuCommand - pDmaBufInfo->m_pDmaBuffer);
+
+        m_timeline.Record(
+            CosTimelineEventCommandStart,
+            pDmaBufSubmission->m_NodeOrdinal,
+            pDmaBufSubmission->m_SubmissionFenceId,
+            commandId,
+            commandOffset);
+
+        switch (commandId)
         {
         case Header:
         case Nop:
@@ -253,35 +431,76 @@ CosKmdSoftAdapter::ProcessHWRenderBuffer(
             {
                 GpuHWRootSignatureSet * pRootSignatureSet = (GpuHWRootSignatureSet *)pGpuCommand;
 
-                bRootSignatureSet = true;
+                m_bRootSignatureSet = true;
 
                 BYTE * pRSData = (BYTE *)(pRootSignatureSet + 1);
 
-                if (pRootSignatureSet->m_numCbvRegisters)
+                bRootSignatureInPlace = (pRootSignatureSet->m_numCbvRegisters > COS_MAX_HW_CBV_REGISTERS) ||
+                                        (pRootSignatureSet->m_numSrvRegisters > COS_MAX_HW_SRV_REGISTERS) ||
+                                        (pRootSignatureSet->m_numUavRegisters > COS_MAX_HW_UAV_REGISTERS);
+
+                if (bRootSignatureInPlace)
                 {
                     pCbvTable = (GpuHWConstantDescriptor *)pRSData;
-
-                    pRSData += (sizeof(GpuHWConstantDescriptor)*pRootSignatureSet->m_numCbvRegisters);
+                    pSrvTable = (GpuHWDescriptor *)(pCbvTable + pRootSignatureSet->m_numCbvRegisters);
+                    pUavTable = (GpuHWDescriptor *)(pSrvTable + pRootSignatureSet->m_numSrvRegisters);
                 }
-                if (pRootSignatureSet->m_numSrvRegisters)
+                else
                 {
-                    pSrvTable = (GpuHWDescriptor *)pRSData;
+                    pCbvTable = m_cbvRegisters;
+                    pSrvTable = m_srvRegisters;
+                    pUavTable = m_uavRegisters;
+
+                    memset(m_cbvRegisters, 0, sizeof(m_cbvRegisters));
+                    memset(m_srvRegisters, 0, sizeof(m_srvRegisters));
+                    memset(m_uavRegisters, 0, sizeof(m_uavRegisters));
+
+                    memcpy(m_cbvRegisters, pRSData, sizeof(GpuHWConstantDescriptor)*pRootSignatureSet->m_numCbvRegisters);
+                    pRSData += (sizeof(GpuHWConstantDescriptor)*pRootSignatureSet->m_numCbvRegisters);
 
+                    memcpy(m_srvRegisters, pRSData, sizeof(GpuHWDescriptor)*pRootSignatureSet->m_numSrvRegisters);
                     pRSData += (sizeof(GpuHWDescriptor)*pRootSignatureSet->m_numSrvRegisters);
+
+                    memcpy(m_uavRegisters, pRSData, sizeof(GpuHWDescriptor)*pRootSignatureSet->m_numUavRegisters);
                 }
-                if (pRootSignatureSet->m_numUavRegisters)
+
+                commandSize = pRootSignatureSet->m_commandSize;
+            }
+            break;
+        case RootSignatureUpdate:
+            {
+                GpuHWRootSignatureUpdate * pRootSignatureUpdate = (GpuHWRootSignatureUpdate *)pGpuCommand;
+
+                //
+                // UMD only sends updates after a RootSignatureSet within the register limits
+                //
+
+                if ((!m_bRootSignatureSet) ||
+                    bRootSignatureInPlace ||
+                    (pRootSignatureUpdate->m_commandSize > (UINT64)(pEndofCommand - pGpuCommand)) ||
+                    (!ApplyRootSignatureUpdate(pRootSignatureUpdate)))
                 {
-                    pUavTable = (GpuHWDescriptor *)pRSData;
+                    NT_ASSERT(false);
+                    COS_LOG_ERROR("Invalid RootSignatureUpdate. (pRootSignatureUpdate=0x%p)", pRootSignatureUpdate);
+                    commandSize = pEndofCommand - pGpuCommand;
+                    break;
                 }
 
-                commandSize = pRootSignatureSet->m_commandSize;
+                commandSize = pRootSignatureUpdate->m_commandSize;
             }
             break;
         case ComputeShaderDispatch:
             {
                 GpuHwComputeShaderDisptch * pCSDispatch = (GpuHwComputeShaderDisptch *)pGpuCommand;
+                UINT firstThreadGroup;
 
-                if (bRootSignatureSet)
+                if (!replay.BeginDispatch(commandOffset, &firstThreadGroup))
+                {
+                    commandSize = pCSDispatch->m_commandSize;
+                    break;
+                }
+
+                if (m_bRootSignatureSet)
                 {
                     uint8_t * uav[3];
 
@@ -292,33 +511,44 @@ CosKmdSoftAdapter::ProcessHWRenderBuffer(
                         uav[i] = (uint8_t *) CosKmdGlobal::s_pVideoMemory + offset;
                     }
 
-                    VpuImageHeader * image = (VpuImageHeader  *)(pCSDispatch + 1);
-
-                    if (image->GetImageSize() <= CosKmdGlobal::s_vpuMemorySize) {
-                        uint8_t * vpuBase = (uint8_t *)CosKmdGlobal::s_pVpuMemory;
-                        image->Load(vpuBase, image->GetImageSize());
-
-                        VpuThreadLocalStorage * tls = (VpuThreadLocalStorage *)(vpuBase + image->GetTlsOffset());
-                        for (int i = 0; i < 3; i++) {
-                            tls->m_uavs[i].m_elementSize = 8;
-                            tls->m_uavs[i].m_base = (int8_t*) uav[i];
-                        }
-
-                        void(*shader_main)() = (void(*)(void)) (vpuBase + image->GetEntryOffset());
-
-                        int threadId = 0;
-                        for(UINT gz = 0;  gz < pCSDispatch->m_threadGroupCountZ; gz++)
-                            for(UINT gy = 0; gy < pCSDispatch->m_threadGroupCountY; gy++)
-                                for (UINT gx = 0; gx < pCSDispatch->m_threadGroupCountX; gx++)
-                                    for (UINT tz = 0; tz < pCSDispatch->m_threadCountZ; tz++)
-                                        for (UINT ty = 0; ty < pCSDispatch->m_threadCountY; ty++)
-                                            for (UINT tx = 0; tx < pCSDispatch->m_threadCountX; tx++, threadId++) {
-                                                tls->m_id = threadId;
-                                                shader_main();
-                                            }
+                    VpuResourceDescriptor uavs[3];
+                    for (int i = 0; i < 3; i++) {
+                        uavs[i].m_elementSize = 8;
+                        uavs[i].m_base = (int8_t*) uav[i];
                     }
 
-
+                    UINT numThreadGroups = pCSDispatch->m_threadGroupCountX*
+                                           pCSDispatch->m_threadGroupCountY*
+                                           pCSDispatch->m_threadGroupCountZ;
+
+                    UINT nextThreadGroup = m_dispatchEngine.Dispatch(
+                        pCSDispatch->m_ShaderHash,
+                        pCSDispatch->m_threadGroupCountX,
+                        pCSDispatch->m_threadGroupCountY,
+                        pCSDispatch->m_threadGroupCountZ,
+                        pCSDispatch->m_threadCountX,
+                        pCSDispatch->m_threadCountY,
+                        pCSDispatch->m_threadCountZ,
+                        uavs,
+                        3,
+                        firstThreadGroup,
+                        pDmaBufSubmission->m_pPreemptionRequested);
+
+                    if (replay.EndDispatch(commandOffset, nextThreadGroup, numThreadGroups))
+                    {
+                        //
+                        // Preempted, DoWork() reports it once it sees m_ResumeOffset
+                        //
+
+                        m_timeline.Record(
+                            CosTimelineEventCommandEnd,
+                            pDmaBufSubmission->m_NodeOrdinal,
+                            pDmaBufSubmission->m_SubmissionFenceId,
+                            commandId,
+                            commandOffset);
+
+                        return;
+                    }
 
 #if ENABLE_FOR_COSTEST
                     KFLOATING_SAVE floatingSave;
@@ -347,11 +577,26 @@ CosKmdSoftAdapter::ProcessHWRenderBuffer(
                 commandSize = pCSDispatch->m_commandSize;
             }
             break;
+        case ShaderImageLoad:
+            {
+                GpuHwShaderImageLoad * pImageLoad = (GpuHwShaderImageLoad *)pGpuCommand;
+
+                m_dispatchEngine.LoadShaderImage(
+                    pImageLoad->m_ShaderHash,
+                    (VpuImageHeader *)(pImageLoad + 1),
+                    pImageLoad->m_commandSize - sizeof(GpuHwShaderImageLoad));
+
+                commandSize = pImageLoad->m_commandSize;
+            }
+            break;
         case MetaCommandExecute:
             {
                 GpuHwMetaCommand *  pMetaCommand = (GpuHwMetaCommand *)pGpuCommand;
 
-                CosKmExecuteMetaCommand(pMetaCommand);
+                if (!replay.IsReplaying())
+                {
+                    CosKmExecuteMetaCommand(pMetaCommand, &m_dispatchEngine);
+                }
 
                 commandSize = pMetaCommand->m_commandSize;
             }
@@ -363,6 +608,13 @@ CosKmdSoftAdapter::ProcessHWRenderBuffer(
             }
             break;
         }
+
+        m_timeline.Record(
+            CosTimelineEventCommandEnd,
+            pDmaBufSubmission->m_NodeOrdinal,
+            pDmaBufSubmission->m_SubmissionFenceId,
+            commandId,
+            commandOffset);
     }
 }
 
@@ -376,9 +628,55 @@ void
 CosKmdSoftAdapter::ProcessGpuVaRenderBuffer(
     COSDMABUFSUBMISSION *   pDmaBufSubmission)
 {
-    UNREFERENCED_PARAMETER(pDmaBufSubmission);
+    COSDMABUFINFO * pDmaBufInfo = pDmaBufSubmission->m_pDmaBufInfo;
+    CosKmContext *  pContext = pDmaBufSubmission->m_pContext;
+    UINT            commandBufferSize = pDmaBufSubmission->m_EndOffset - pDmaBufSubmission->m_StartOffset;
+
+    m_gpuMmu.SetRootPageTable(
+        pContext->GetRootPageTableAddress().SegmentOffset >> kPageShift,
+        pContext->GetNumRootPageTableEntries());
+
+    //
+    // The command buffer is fetched through its GPU VA, m_pDmaBuffer is only
+    // provided by the UMD for debugging
+    //
+
+    m_dispatchEngine.BeginSubmission();
+
+    UINT failedOffset;
+
+    if (!m_gpuVaEngine.Execute(
+            pDmaBufInfo->m_DmaBufferGpuVa + pDmaBufSubmission->m_StartOffset,
+            commandBufferSize,
+            &failedOffset))
+    {
+        if (failedOffset < commandBufferSize)
+        {
+            COS_LOG_ERROR(
+                "GPU VA command failed. (commandId=0x%x, commandOffset=0x%x)",
+                m_gpuVaEngine.GetCommandId(failedOffset),
+                failedOffset);
+        }
+        else
+        {
+            COS_LOG_ERROR(
+                "Failed to fetch GPU VA command buffer. (DmaBufferGpuVa=0x%I64x, commandBufferSize=%d)",
+                pDmaBufInfo->m_DmaBufferGpuVa,
+                commandBufferSize);
+        }
+
+        m_ErrorHit.m_GpuVaFault = 1;
+    }
+
+    const CosGpuMmuStats & mmuStats = m_gpuMmu.GetStats();
 
-    // TODO: emulate command buffer submitted with GPU VA from UMD
+    DbgPrintEx(DPFLTR_IHVVIDEO_ID, DPFLTR_TRACE_LEVEL,
+        "GPU MMU: TLB hits=%I64u misses=%I64u faults=%I64u flushes=%I64u dispatches=%I64u\n",
+        mmuStats.m_numTlbHits,
+        mmuStats.m_numTlbMisses,
+        mmuStats.m_numFaults,
+        mmuStats.m_numFlushes,
+        m_gpuVaEngine.GetStats().m_numDispatches);
 }
 
 #endif
@@ -1,6 +1,97 @@
 #pragma once
 
 #include "CosKmdAdapter.h"
+#include "CosKmdDispatch.h"
+
+#include "CosGpuCommand.h"
+#include "CosCopyEngine.h"
+
+#if COS_GPUVA_SUPPORT
+#include "CosGpuVaEngine.h"
+#endif
+
+//
+// Lets the paging engine split large fills and copies across the dispatch
+// engine workers, both are only used by the compute node worker thread that
+// owns the compute core
+//
+
+class CosKmPagingWorkers : public CosPagingWorkers
+{
+public:
+
+    CosKmPagingWorkers(CosKmDispatchEngine * pDispatchEngine) :
+        m_pDispatchEngine(pDispatchEngine)
+    {
+        // do nothing
+    }
+
+    virtual UINT GetNumWorkers()
+    {
+        return m_pDispatchEngine->GetNumWorkers();
+    }
+
+    virtual void ParallelFor(UINT numItems, PFN_WORK_ITEM pfnWorkItem, void * pContext)
+    {
+        m_pDispatchEngine->ParallelFor(numItems, pfnWorkItem, pContext);
+    }
+
+private:
+
+    CosKmDispatchEngine    *m_pDispatchEngine;
+};
+
+#if COS_GPUVA_SUPPORT
+
+//
+// Runs the dispatches of GPU VA command buffers on the dispatch engine. GPU
+// VA command buffers are not resumed in the middle of a dispatch, so the
+// thread groups always run to completion.
+//
+
+class CosKmGpuVaShaderEngine : public CosGpuVaShaderEngine
+{
+public:
+
+    CosKmGpuVaShaderEngine(CosKmDispatchEngine * pDispatchEngine) :
+        m_pDispatchEngine(pDispatchEngine)
+    {
+        // do nothing
+    }
+
+    virtual void LoadShaderImage(GpuHwShaderImageLoad * pImageLoad)
+    {
+        m_pDispatchEngine->LoadShaderImage(
+            pImageLoad->m_ShaderHash,
+            (VpuImageHeader *)(pImageLoad + 1),
+            pImageLoad->m_commandSize - sizeof(GpuHwShaderImageLoad));
+    }
+
+    virtual void Dispatch(
+        const GpuHwComputeShaderDisptch *   pDispatch,
+        VpuResourceDescriptor *             pUavs,
+        UINT                                numUavs)
+    {
+        m_pDispatchEngine->Dispatch(
+            pDispatch->m_ShaderHash,
+            pDispatch->m_threadGroupCountX,
+            pDispatch->m_threadGroupCountY,
+            pDispatch->m_threadGroupCountZ,
+            pDispatch->m_threadCountX,
+            pDispatch->m_threadCountY,
+            pDispatch->m_threadCountZ,
+            pUavs,
+            numUavs,
+            0,
+            NULL);
+    }
+
+private:
+
+    CosKmDispatchEngine    *m_pDispatchEngine;
+};
+
+#endif
 
 class CosKmdSoftAdapter : public CosKmAdapter
 {
@@ -9,9 +100,15 @@ private:
     friend class CosKmAdapter;
 
     CosKmdSoftAdapter(IN_CONST_PDEVICE_OBJECT PhysicalDeviceObject, OUT_PPVOID MiniportDeviceContext) :
-        CosKmAdapter(PhysicalDeviceObject, MiniportDeviceContext)
+        CosKmAdapter(PhysicalDeviceObject, MiniportDeviceContext),
+        m_pagingWorkers(&m_dispatchEngine)
+#if COS_GPUVA_SUPPORT
+        , m_gpuVaShaderEngine(&m_dispatchEngine)
+#endif
     {
-        // do nothing
+#if !COS_GPUVA_SUPPORT && !COS_RS_2LEVEL_SUPPORT
+        m_bRootSignatureSet = false;
+#endif
     }
 
     virtual ~CosKmdSoftAdapter()
@@ -30,6 +127,10 @@ protected:
 
     virtual void ProcessGpuVaRenderBuffer(COSDMABUFSUBMISSION * pDmaBufSubmission);
 
+#else
+
+    virtual void ProcessCopyBuffer(COSDMABUFSUBMISSION * pDmaBufSubmission);
+
 #endif
 
     virtual NTSTATUS Start(
@@ -38,6 +139,57 @@ protected:
         OUT_PULONG              NumberOfVideoPresentSources,
         OUT_PULONG              NumberOfChildren);
 
+    virtual NTSTATUS Stop();
+
     virtual BOOLEAN InterruptRoutine(
         IN_ULONG        MessageNumber);
+
+private:
+
+    CosKmDispatchEngine     m_dispatchEngine;
+    CosKmPagingWorkers      m_pagingWorkers;
+
+#if !COS_GPUVA_SUPPORT
+
+    //
+    // Only used by the copy node worker thread
+    //
+
+    CosCopyEngine           m_copyEngine;
+
+#endif
+
+#if !COS_GPUVA_SUPPORT && !COS_RS_2LEVEL_SUPPORT
+
+    //
+    // Root registers set by the last RootSignatureSet of the current command
+    // buffer, RootSignatureUpdate patches them in place between dispatches
+    //
+
+    bool                    m_bRootSignatureSet;
+    GpuHWConstantDescriptor m_cbvRegisters[COS_MAX_HW_CBV_REGISTERS];
+    GpuHWDescriptor         m_srvRegisters[COS_MAX_HW_SRV_REGISTERS];
+    GpuHWDescriptor         m_uavRegisters[COS_MAX_HW_UAV_REGISTERS];
+
+    bool ApplyRootSignatureUpdate(GpuHWRootSignatureUpdate * pRootSignatureUpdate);
+
+#endif
+
+#if COS_GPUVA_SUPPORT
+
+    //
+    // Only used by the compute node worker thread. GPU VA command buffers are
+    // fetched through the MMU into m_gpuVaCommandBuffer before they are
+    // parsed, the UAVs of a dispatch are staged in m_gpuVaUavStaging.
+    //
+
+    static const UINT       kGpuVaUavStagingSize = 1024*1024;
+
+    CosKmGpuVaShaderEngine  m_gpuVaShaderEngine;
+    CosGpuVaEngine          m_gpuVaEngine;
+
+    BYTE                    m_gpuVaCommandBuffer[COS_COMMAND_BUFFER_SIZE];
+    BYTE                    m_gpuVaUavStaging[kGpuVaUavStagingSize];
+
+#endif
 };
\ No newline at end of file
@@ -0,0 +1,1047 @@
+#include <windows.h>
+
+#include "CosMlKernels.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <initializer_list>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Benchmark and correctness test for the CPU ML meta command kernels
+//
+// Every operator runs once through the optimized kernel and once through a
+// straightforward reference implementation, the results are compared and the
+// throughput of both is reported in GFLOP/s.
+
+// Mirrors the KMD dispatch engine: a fixed set of workers pull work items
+// off a shared counter, the calling thread acts as worker 0.
+class ThreadPoolContext : public CosMlContext
+{
+public:
+
+	ThreadPoolContext(UINT numWorkers) : m_numWorkers(numWorkers ? numWorkers : 1), m_generation(0), m_exit(false), m_busyWorkers(0)
+	{
+		for (UINT i = 1; i < m_numWorkers; i++)
+			m_threads.push_back(std::thread(&ThreadPoolContext::WorkerThread, this, i));
+	}
+
+	~ThreadPoolContext()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_exit = true;
+		}
+
+		m_workAvailable.notify_all();
+
+		for (auto & thread : m_threads)
+			thread.join();
+	}
+
+	UINT GetNumWorkers() override { return m_numWorkers; }
+
+	void ParallelFor(UINT numItems, PFN_WORK_ITEM pfnWorkItem, void * pContext) override
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_numItems = numItems;
+			m_pfnWorkItem = pfnWorkItem;
+			m_pContext = pContext;
+			m_nextItem = 0;
+			m_busyWorkers = m_numWorkers - 1;
+			m_generation++;
+		}
+
+		m_workAvailable.notify_all();
+
+		RunItems(0);
+
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_workDone.wait(lock, [this] { return m_busyWorkers == 0; });
+	}
+
+	void * AllocateScratch(SIZE_T size) override { return _aligned_malloc(size, 64); }
+	void FreeScratch(void * pScratch) override { _aligned_free(pScratch); }
+
+private:
+
+	void RunItems(UINT workerIndex)
+	{
+		for (;;) {
+			UINT item = m_nextItem++;
+			if (item >= m_numItems)
+				return;
+			m_pfnWorkItem(m_pContext, workerIndex, item);
+		}
+	}
+
+	void WorkerThread(UINT workerIndex)
+	{
+		UINT64 generation = 0;
+
+		for (;;) {
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_workAvailable.wait(lock, [&] { return m_exit || m_generation != generation; });
+
+				if (m_exit)
+					return;
+
+				generation = m_generation;
+			}
+
+			RunItems(workerIndex);
+
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_busyWorkers--;
+			}
+
+			m_workDone.notify_one();
+		}
+	}
+
+	UINT m_numWorkers;
+	std::vector<std::thread> m_threads;
+	std::mutex m_mutex;
+	std::condition_variable m_workAvailable;
+	std::condition_variable m_workDone;
+	UINT64 m_generation;
+	bool m_exit;
+	UINT m_busyWorkers;
+
+	UINT m_numItems;
+	PFN_WORK_ITEM m_pfnWorkItem;
+	void * m_pContext;
+	std::atomic<UINT> m_nextItem;
+};
+
+// Densely packed tensor with row major strides
+class TestTensor
+{
+public:
+
+	TestTensor(CosMlDataType dataType, std::initializer_list<UINT64> sizes)
+	{
+		m_desc = {};
+		m_desc.m_dataType = dataType;
+		m_desc.m_dimensionCount = (UINT)sizes.size();
+
+		UINT d = 0;
+		for (UINT64 size : sizes)
+			m_desc.m_size[d++] = size;
+
+		m_elementCount = 1;
+		for (d = m_desc.m_dimensionCount; d-- > 0;) {
+			m_desc.m_stride[d] = m_elementCount;
+			m_elementCount *= m_desc.m_size[d];
+		}
+
+		m_storage.resize((size_t)(m_elementCount * ((dataType == CosMlDataTypeFloat16) ? 2 : 4)));
+		m_desc.m_pData = m_storage.data();
+	}
+
+	const CosMlTensor & Desc() { return m_desc; }
+	UINT64 Count() { return m_elementCount; }
+	UINT64 Size(UINT d) { return m_desc.m_size[d]; }
+
+	float Get(UINT64 i) { return GetElement(m_desc, i); }
+	void Set(UINT64 i, float value) { SetElement(m_desc, i, value); }
+
+	static float GetElement(const CosMlTensor & desc, UINT64 i)
+	{
+		switch (desc.m_dataType) {
+		case CosMlDataTypeFloat16: return CosMlHalfToFloat(((USHORT *)desc.m_pData)[i]);
+		case CosMlDataTypeUInt32: return (float)((UINT *)desc.m_pData)[i];
+		default: return ((float *)desc.m_pData)[i];
+		}
+	}
+
+	static void SetElement(const CosMlTensor & desc, UINT64 i, float value)
+	{
+		switch (desc.m_dataType) {
+		case CosMlDataTypeFloat16: ((USHORT *)desc.m_pData)[i] = CosMlFloatToHalf(value); break;
+		case CosMlDataTypeUInt32: ((UINT *)desc.m_pData)[i] = (UINT)value; break;
+		default: ((float *)desc.m_pData)[i] = value; break;
+		}
+	}
+
+	// Same storage seen with its dimensions reordered, dimension d of the
+	// view is dimension order[d] of the tensor
+	CosMlTensor Permuted(std::initializer_list<UINT> order)
+	{
+		CosMlTensor desc = m_desc;
+		UINT d = 0;
+		for (UINT source : order) {
+			desc.m_size[d] = m_desc.m_size[source];
+			desc.m_stride[d] = m_desc.m_stride[source];
+			d++;
+		}
+		return desc;
+	}
+
+	void Fill(float low, float high)
+	{
+		for (UINT64 i = 0; i < m_elementCount; i++)
+			Set(i, low + (high - low) * (float)rand() / (float)RAND_MAX);
+	}
+
+	float Get4(UINT64 n, UINT64 c, UINT64 h, UINT64 w)
+	{
+		return Get(((n * Size(1) + c) * Size(2) + h) * Size(3) + w);
+	}
+
+	void Set4(UINT64 n, UINT64 c, UINT64 h, UINT64 w, float value)
+	{
+		Set(((n * Size(1) + c) * Size(2) + h) * Size(3) + w, value);
+	}
+
+private:
+
+	CosMlTensor m_desc;
+	UINT64 m_elementCount;
+	std::vector<BYTE> m_storage;
+};
+
+static CosMlTensor NullTensor()
+{
+	CosMlTensor tensor = {};
+	return tensor;
+}
+
+static float Activate(const CosMlActivation & activation, float x)
+{
+	switch (activation.m_function) {
+	case CosMlActivationLinear: return activation.m_params[0] * x + activation.m_params[1];
+	case CosMlActivationRelu: return x > 0.0f ? x : 0.0f;
+	case CosMlActivationLeakyRelu: return x > 0.0f ? x : x * activation.m_params[0];
+	case CosMlActivationSigmoid: return 1.0f / (1.0f + expf(-x));
+	case CosMlActivationTanh: return tanhf(x);
+	case CosMlActivationElu: return x >= 0.0f ? x : activation.m_params[0] * (expf(x) - 1.0f);
+	case CosMlActivationSoftplus: return logf(1.0f + expf(x));
+	default: return x;
+	}
+}
+
+// Reference implementations, NCHW and packed only
+
+static void RefGemm(const CosMlGemmDesc & desc, TestTensor & a, TestTensor & b, TestTensor * c, TestTensor & out)
+{
+	UINT64 m = out.Size(2), n = out.Size(3);
+	UINT64 k = desc.m_transposeA ? a.Size(2) : a.Size(3);
+
+	for (UINT64 batch = 0; batch < out.Size(0) * out.Size(1); batch++) {
+		for (UINT64 i = 0; i < m; i++) {
+			for (UINT64 j = 0; j < n; j++) {
+				double sum = 0.0;
+				for (UINT64 l = 0; l < k; l++) {
+					float av = desc.m_transposeA ? a.Get(batch * m * k + l * m + i) : a.Get(batch * m * k + i * k + l);
+					float bv = desc.m_transposeB ? b.Get(batch * k * n + j * k + l) : b.Get(batch * k * n + l * n + j);
+					sum += (double)av * bv;
+				}
+
+				float result = desc.m_alpha * (float)sum;
+				if (c)
+					result += desc.m_beta * c->Get(batch * m * n + i * n + j);
+
+				out.Set(batch * m * n + i * n + j, Activate(desc.m_activation, result));
+			}
+		}
+	}
+}
+
+static void RefConvolution(const CosMlConvolutionDesc & desc, TestTensor & input, TestTensor & filter, TestTensor * bias, TestTensor & out)
+{
+	UINT64 groups = desc.m_groupCount;
+	UINT64 cg = input.Size(1) / groups, ocg = out.Size(1) / groups;
+	UINT64 kh = filter.Size(2), kw = filter.Size(3);
+
+	for (UINT64 n = 0; n < out.Size(0); n++)
+	for (UINT64 oc = 0; oc < out.Size(1); oc++)
+	for (UINT64 oh = 0; oh < out.Size(2); oh++)
+	for (UINT64 ow = 0; ow < out.Size(3); ow++) {
+		double sum = bias ? bias->Get(oc) : 0.0;
+		UINT64 g = oc / ocg;
+
+		for (UINT64 c = 0; c < cg; c++)
+		for (UINT64 y = 0; y < kh; y++)
+		for (UINT64 x = 0; x < kw; x++) {
+			INT64 ih = (INT64)(oh * desc.m_stride[0] + y * desc.m_dilation[0]) - desc.m_startPadding[0];
+			INT64 iw = (INT64)(ow * desc.m_stride[1] + x * desc.m_dilation[1]) - desc.m_startPadding[1];
+			if (ih < 0 || iw < 0 || ih >= (INT64)input.Size(2) || iw >= (INT64)input.Size(3))
+				continue;
+
+			UINT64 fy = desc.m_crossCorrelation ? y : kh - 1 - y;
+			UINT64 fx = desc.m_crossCorrelation ? x : kw - 1 - x;
+			sum += (double)input.Get4(n, g * cg + c, ih, iw) * filter.Get4(oc, c, fy, fx);
+		}
+
+		out.Set4(n, oc, oh, ow, Activate(desc.m_activation, (float)sum));
+	}
+}
+
+static void RefPooling(const CosMlPoolingDesc & desc, TestTensor & input, TestTensor & out)
+{
+	for (UINT64 n = 0; n < out.Size(0); n++)
+	for (UINT64 c = 0; c < out.Size(1); c++)
+	for (UINT64 oh = 0; oh < out.Size(2); oh++)
+	for (UINT64 ow = 0; ow < out.Size(3); ow++) {
+		float result = (desc.m_function == CosMlPoolingMax) ? -INFINITY : 0.0f;
+		UINT64 valid = 0;
+
+		for (UINT64 y = 0; y < desc.m_windowSize[0]; y++)
+		for (UINT64 x = 0; x < desc.m_windowSize[1]; x++) {
+			INT64 ih = (INT64)(oh * desc.m_stride[0] + y) - desc.m_startPadding[0];
+			INT64 iw = (INT64)(ow * desc.m_stride[1] + x) - desc.m_startPadding[1];
+			bool inside = ih >= 0 && iw >= 0 && ih < (INT64)input.Size(2) && iw < (INT64)input.Size(3);
+			float v = inside ? input.Get4(n, c, ih, iw) : 0.0f;
+
+			if (!inside && desc.m_function == CosMlPoolingMax)
+				continue;
+
+			valid += inside ? 1 : 0;
+
+			switch (desc.m_function) {
+			case CosMlPoolingMax: result = v > result ? v : result; break;
+			case CosMlPoolingAverage: result += v; break;
+			case CosMlPoolingLp: result += powf(fabsf(v), (float)desc.m_p); break;
+			}
+		}
+
+		if (desc.m_function == CosMlPoolingAverage)
+			result /= desc.m_includePadding ? (float)(desc.m_windowSize[0] * desc.m_windowSize[1]) : (float)valid;
+		else if (desc.m_function == CosMlPoolingLp)
+			result = powf(result, 1.0f / desc.m_p);
+
+		out.Set4(n, c, oh, ow, Activate(desc.m_activation, result));
+	}
+}
+
+static void RefNormalization(const CosMlNormalizationDesc & desc, TestTensor & input, TestTensor & mean, TestTensor & variance, TestTensor & scale, TestTensor & bias, TestTensor & out)
+{
+	for (UINT64 n = 0; n < out.Size(0); n++)
+	for (UINT64 c = 0; c < out.Size(1); c++)
+	for (UINT64 h = 0; h < out.Size(2); h++)
+	for (UINT64 w = 0; w < out.Size(3); w++) {
+		float x = (input.Get4(n, c, h, w) - mean.Get(c)) / sqrtf(variance.Get(c) + desc.m_epsilon);
+		out.Set4(n, c, h, w, Activate(desc.m_activation, x * scale.Get(c) + bias.Get(c)));
+	}
+}
+
+static void RefMvn(const CosMlMvnDesc & desc, TestTensor & input, TestTensor & out)
+{
+	UINT64 channelsPerGroup = desc.m_acrossChannels ? out.Size(1) : 1;
+
+	for (UINT64 n = 0; n < out.Size(0); n++)
+	for (UINT64 c0 = 0; c0 < out.Size(1); c0 += channelsPerGroup) {
+		double sum = 0.0, count = 0.0;
+		for (UINT64 c = c0; c < c0 + channelsPerGroup; c++)
+		for (UINT64 h = 0; h < out.Size(2); h++)
+		for (UINT64 w = 0; w < out.Size(3); w++, count++)
+			sum += input.Get4(n, c, h, w);
+
+		double mean = sum / count, variance = 0.0;
+		for (UINT64 c = c0; c < c0 + channelsPerGroup; c++)
+		for (UINT64 h = 0; h < out.Size(2); h++)
+		for (UINT64 w = 0; w < out.Size(3); w++) {
+			double d = input.Get4(n, c, h, w) - mean;
+			variance += d * d;
+		}
+		variance /= count;
+
+		for (UINT64 c = c0; c < c0 + channelsPerGroup; c++)
+		for (UINT64 h = 0; h < out.Size(2); h++)
+		for (UINT64 w = 0; w < out.Size(3); w++) {
+			double x = input.Get4(n, c, h, w) - mean;
+			if (desc.m_normalizeVariance)
+				x /= sqrt(variance + desc.m_epsilon);
+			out.Set4(n, c, h, w, Activate(desc.m_activation, (float)x));
+		}
+	}
+}
+
+// Reduces every dimension where out has size 1 and input does not, 4D only
+static void RefReduction(const CosMlReductionDesc & desc, TestTensor & input, TestTensor & out)
+{
+	UINT64 reduceSize[4];
+	for (UINT d = 0; d < 4; d++)
+		reduceSize[d] = (out.Size(d) == 1) ? input.Size(d) : 1;
+
+	for (UINT64 n = 0; n < out.Size(0); n++)
+	for (UINT64 c = 0; c < out.Size(1); c++)
+	for (UINT64 h = 0; h < out.Size(2); h++)
+	for (UINT64 w = 0; w < out.Size(3); w++) {
+		bool isMax = desc.m_function == CosMlReductionMax || desc.m_function == CosMlReductionArgMax;
+		bool isMin = desc.m_function == CosMlReductionMin || desc.m_function == CosMlReductionArgMin;
+		double acc = (desc.m_function == CosMlReductionMultiply) ? 1.0 : 0.0;
+		float extreme = isMax ? -INFINITY : INFINITY;
+		UINT64 extremeIndex = 0, index = 0;
+
+		for (UINT64 rn = 0; rn < reduceSize[0]; rn++)
+		for (UINT64 rc = 0; rc < reduceSize[1]; rc++)
+		for (UINT64 rh = 0; rh < reduceSize[2]; rh++)
+		for (UINT64 rw = 0; rw < reduceSize[3]; rw++, index++) {
+			float v = input.Get4(n + rn, c + rc, h + rh, w + rw);
+
+			if ((isMax && v > extreme) || (isMin && v < extreme)) {
+				extreme = v;
+				extremeIndex = index;
+			}
+
+			switch (desc.m_function) {
+			case CosMlReductionL1: acc += fabs(v); break;
+			case CosMlReductionL2:
+			case CosMlReductionSumSquare: acc += (double)v * v; break;
+			case CosMlReductionLogSumExp: acc += exp(v); break;
+			case CosMlReductionMultiply: acc *= v; break;
+			default: acc += v; break;
+			}
+		}
+
+		float result;
+		switch (desc.m_function) {
+		case CosMlReductionArgMax:
+		case CosMlReductionArgMin: result = (float)extremeIndex; break;
+		case CosMlReductionMax:
+		case CosMlReductionMin: result = extreme; break;
+		case CosMlReductionAverage: result = (float)(acc / index); break;
+		case CosMlReductionL2: result = (float)sqrt(acc); break;
+		case CosMlReductionLogSum:
+		case CosMlReductionLogSumExp: result = (float)log(acc); break;
+		default: result = (float)acc; break;
+		}
+
+		out.Set4(n, c, h, w, result);
+	}
+}
+
+// Straight per timestep ONNX formulas, gates i o f c (LSTM) and z r h (GRU)
+static void RefRecurrent(const CosMlRecurrentDesc & desc, TestTensor & input, TestTensor & weight, TestTensor & recurrence, TestTensor & bias, TestTensor * seqLengths,
+	TestTensor & outSequence, TestTensor & outSingle, TestTensor & outCellSingle)
+{
+	UINT64 seqLength = input.Size(1), batchSize = input.Size(2), inputSize = input.Size(3);
+	UINT64 hiddenSize = recurrence.Size(3);
+	UINT64 gates = recurrence.Size(2) / hiddenSize;
+	UINT64 directions = (desc.m_direction == CosMlRecurrentBidirectional) ? 2 : 1;
+
+	for (UINT64 i = 0; i < outSequence.Count(); i++)
+		outSequence.Set(i, 0.0f);
+
+	for (UINT64 d = 0; d < directions; d++)
+	for (UINT64 b = 0; b < batchSize; b++) {
+		const CosMlActivation * act = desc.m_activations + d * kCosMlMaxRecurrentActivations;
+		bool backward = (d == 1) || (desc.m_direction == CosMlRecurrentBackward);
+		UINT64 length = seqLengths ? (UINT64)seqLengths->Get(b) : seqLength;
+		std::vector<float> h(hiddenSize, 0.0f), c(hiddenSize, 0.0f), g(gates * hiddenSize), hNew(hiddenSize);
+
+		for (UINT64 step = 0; step < length; step++) {
+			UINT64 t = backward ? length - 1 - step : step;
+
+			for (UINT64 n = 0; n < gates * hiddenSize; n++) {
+				double sum = bias.Get(d * 2 * gates * hiddenSize + n);
+				for (UINT64 k = 0; k < inputSize; k++)
+					sum += (double)input.Get((t * batchSize + b) * inputSize + k) * weight.Get((d * gates * hiddenSize + n) * inputSize + k);
+
+				bool resetFirst = (desc.m_cell == CosMlRecurrentCellGru) && (n >= 2 * hiddenSize);
+				if (!resetFirst) {
+					sum += bias.Get(d * 2 * gates * hiddenSize + gates * hiddenSize + n);
+					for (UINT64 k = 0; k < hiddenSize; k++)
+						sum += (double)h[k] * recurrence.Get((d * gates * hiddenSize + n) * hiddenSize + k);
+				}
+				g[n] = (float)sum;
+			}
+
+			switch (desc.m_cell) {
+			case CosMlRecurrentCellRnn:
+				for (UINT64 i = 0; i < hiddenSize; i++)
+					hNew[i] = Activate(act[0], g[i]);
+				break;
+
+			case CosMlRecurrentCellGru:
+				for (UINT64 i = 0; i < hiddenSize; i++)
+					g[hiddenSize + i] = Activate(act[0], g[hiddenSize + i]);
+
+				for (UINT64 i = 0; i < hiddenSize; i++) {
+					float z = Activate(act[0], g[i]);
+					float r = g[hiddenSize + i];
+					UINT64 n = 2 * hiddenSize + i;
+					double rh = bias.Get(d * 2 * gates * hiddenSize + gates * hiddenSize + n);
+					for (UINT64 k = 0; k < hiddenSize; k++)
+						rh += (desc.m_linearBeforeReset ? h[k] : g[hiddenSize + k] * h[k]) * (double)recurrence.Get((d * gates * hiddenSize + n) * hiddenSize + k);
+					float candidate = Activate(act[1], g[n] + (desc.m_linearBeforeReset ? r * (float)rh : (float)rh));
+					hNew[i] = (1.0f - z) * candidate + z * h[i];
+				}
+				break;
+
+			case CosMlRecurrentCellLstm:
+				for (UINT64 i = 0; i < hiddenSize; i++) {
+					auto clip = [&](float x) { return desc.m_useClip ? fmaxf(-desc.m_clip, fminf(desc.m_clip, x)) : x; };
+					float ig = Activate(act[0], clip(g[i]));
+					float fg = desc.m_coupleInputForget ? 1.0f - ig : Activate(act[0], clip(g[2 * hiddenSize + i]));
+					c[i] = fg * c[i] + ig * Activate(act[1], clip(g[3 * hiddenSize + i]));
+					hNew[i] = Activate(act[0], clip(g[hiddenSize + i])) * Activate(act[2], c[i]);
+				}
+				break;
+			}
+
+			h = hNew;
+
+			for (UINT64 i = 0; i < hiddenSize; i++)
+				outSequence.Set(((t * directions + d) * batchSize + b) * hiddenSize + i, h[i]);
+		}
+
+		for (UINT64 i = 0; i < hiddenSize; i++) {
+			outSingle.Set((d * batchSize + b) * hiddenSize + i, h[i]);
+			outCellSingle.Set((d * batchSize + b) * hiddenSize + i, c[i]);
+		}
+	}
+}
+
+// Element by element in the logical NCHW order of the views
+static void RefCopyTensor(const CosMlTensor & input, const CosMlTensor & out)
+{
+	UINT64 index[4];
+
+	for (index[0] = 0; index[0] < out.m_size[0]; index[0]++)
+	for (index[1] = 0; index[1] < out.m_size[1]; index[1]++)
+	for (index[2] = 0; index[2] < out.m_size[2]; index[2]++)
+	for (index[3] = 0; index[3] < out.m_size[3]; index[3]++) {
+		UINT64 src = 0, dst = 0;
+		for (UINT d = 0; d < 4; d++) {
+			src += (input.m_size[d] == 1 ? 0 : index[d]) * input.m_stride[d];
+			dst += index[d] * out.m_stride[d];
+		}
+		TestTensor::SetElement(out, dst, TestTensor::GetElement(input, src));
+	}
+}
+
+static bool Compare(TestTensor & result, TestTensor & expected, float tolerance, float * maxError)
+{
+	*maxError = 0.0f;
+
+	for (UINT64 i = 0; i < result.Count(); i++) {
+		float error = fabsf(result.Get(i) - expected.Get(i)) / (1.0f + fabsf(expected.Get(i)));
+		if (!(error <= *maxError))
+			*maxError = error;
+	}
+
+	return *maxError <= tolerance;
+}
+
+template<typename Fn> static double TimeMs(Fn fn, int iterations)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+	for (int i = 0; i < iterations; i++)
+		fn();
+	auto end = std::chrono::high_resolution_clock::now();
+	return std::chrono::duration<double, std::milli>(end - start).count() / iterations;
+}
+
+static int s_failures = 0;
+
+// work is counted in units of 1e9 per second, GFLOP/s unless stated otherwise
+template<typename OptFn, typename RefFn>
+static void Run(const char * name, double work, const char * unit, TestTensor & out, TestTensor & expected, float tolerance, OptFn opt, RefFn ref)
+{
+	bool success = true;
+	double refMs = TimeMs([&] { ref(); }, 1);
+	double optMs = TimeMs([&] { success &= opt(); }, 3);
+
+	float maxError;
+	if (!success || !Compare(out, expected, tolerance, &maxError)) {
+		if (!success)
+			maxError = INFINITY;
+		s_failures++;
+		success = false;
+	}
+
+	printf("%-28s opt %9.3f ms %8.2f %-7s   naive %9.3f ms %8.2f %-7s   x%6.1f   err %.2g %s\n",
+		name,
+		optMs, work / (optMs * 1e6), unit,
+		refMs, work / (refMs * 1e6), unit,
+		refMs / optMs,
+		maxError,
+		success ? "" : "FAILED");
+}
+
+template<typename OptFn, typename RefFn>
+static void Run(const char * name, double flops, TestTensor & out, TestTensor & expected, float tolerance, OptFn opt, RefFn ref)
+{
+	Run(name, flops, "GFLOP/s", out, expected, tolerance, opt, ref);
+}
+
+static void GemmTest(CosMlContext * context, const char * name, CosMlDataType type, UINT64 batch, UINT64 m, UINT64 n, UINT64 k, bool transA, bool transB, bool withC, CosMlActivationFunction activation)
+{
+	TestTensor a(type, { 1, batch, transA ? k : m, transA ? m : k });
+	TestTensor b(type, { 1, batch, transB ? n : k, transB ? k : n });
+	TestTensor c(type, { 1, batch, m, n });
+	TestTensor out(type, { 1, batch, m, n });
+	TestTensor expected(CosMlDataTypeFloat32, { 1, batch, m, n });
+
+	a.Fill(-1.0f, 1.0f);
+	b.Fill(-1.0f, 1.0f);
+	c.Fill(-1.0f, 1.0f);
+
+	CosMlGemmDesc desc = {};
+	desc.m_a = a.Desc();
+	desc.m_b = b.Desc();
+	desc.m_c = withC ? c.Desc() : NullTensor();
+	desc.m_out = out.Desc();
+	desc.m_transposeA = transA;
+	desc.m_transposeB = transB;
+	desc.m_alpha = 0.5f;
+	desc.m_beta = withC ? 2.0f : 0.0f;
+	desc.m_activation.m_function = activation;
+	desc.m_activation.m_params[0] = 0.1f;
+
+	float tolerance = (type == CosMlDataTypeFloat16) ? 1e-2f : 1e-4f;
+
+	Run(name, 2.0 * batch * m * n * k, out, expected, tolerance,
+		[&] { return CosMlGemm(context, &desc); },
+		[&] { RefGemm(desc, a, b, withC ? &c : nullptr, expected); });
+}
+
+static void ConvolutionTest(CosMlContext * context, const char * name, CosMlDataType type, UINT64 batch, UINT64 channels, UINT64 size, UINT64 outChannels, UINT kernel, UINT stride, UINT padding, UINT groups, bool crossCorrelation)
+{
+	UINT64 outSize = (size + 2 * padding - kernel) / stride + 1;
+
+	TestTensor input(type, { batch, channels, size, size });
+	TestTensor filter(type, { outChannels, channels / groups, kernel, kernel });
+	TestTensor bias(type, { outChannels });
+	TestTensor out(type, { batch, outChannels, outSize, outSize });
+	TestTensor expected(CosMlDataTypeFloat32, { batch, outChannels, outSize, outSize });
+
+	input.Fill(-1.0f, 1.0f);
+	filter.Fill(-0.5f, 0.5f);
+	bias.Fill(-1.0f, 1.0f);
+
+	CosMlConvolutionDesc desc = {};
+	desc.m_input = input.Desc();
+	desc.m_filter = filter.Desc();
+	desc.m_bias = bias.Desc();
+	desc.m_out = out.Desc();
+	desc.m_crossCorrelation = crossCorrelation;
+	desc.m_stride[0] = desc.m_stride[1] = stride;
+	desc.m_dilation[0] = desc.m_dilation[1] = 1;
+	desc.m_startPadding[0] = desc.m_startPadding[1] = padding;
+	desc.m_endPadding[0] = desc.m_endPadding[1] = padding;
+	desc.m_groupCount = groups;
+	desc.m_activation.m_function = CosMlActivationRelu;
+
+	float tolerance = (type == CosMlDataTypeFloat16) ? 1e-2f : 1e-4f;
+
+	Run(name, 2.0 * batch * outChannels * outSize * outSize * (channels / groups) * kernel * kernel, out, expected, tolerance,
+		[&] { return CosMlConvolution(context, &desc); },
+		[&] { RefConvolution(desc, input, filter, &bias, expected); });
+}
+
+static void PoolingTest(CosMlContext * context, const char * name, CosMlPoolingFunction function, UINT64 channels, UINT64 size, UINT window, UINT stride, UINT padding, bool includePadding)
+{
+	UINT64 outSize = (size + 2 * padding - window) / stride + 1;
+
+	TestTensor input(CosMlDataTypeFloat32, { 1, channels, size, size });
+	TestTensor out(CosMlDataTypeFloat32, { 1, channels, outSize, outSize });
+	TestTensor expected(CosMlDataTypeFloat32, { 1, channels, outSize, outSize });
+
+	input.Fill(-1.0f, 1.0f);
+
+	CosMlPoolingDesc desc = {};
+	desc.m_input = input.Desc();
+	desc.m_out = out.Desc();
+	desc.m_function = function;
+	desc.m_stride[0] = desc.m_stride[1] = stride;
+	desc.m_windowSize[0] = desc.m_windowSize[1] = window;
+	desc.m_startPadding[0] = desc.m_startPadding[1] = padding;
+	desc.m_endPadding[0] = desc.m_endPadding[1] = padding;
+	desc.m_p = 2;
+	desc.m_includePadding = includePadding;
+
+	Run(name, (double)channels * outSize * outSize * window * window, out, expected, 1e-4f,
+		[&] { return CosMlPooling(context, &desc); },
+		[&] { RefPooling(desc, input, expected); });
+}
+
+static void NormalizationTest(CosMlContext * context, const char * name, CosMlDataType type, UINT64 batch, UINT64 channels, UINT64 size)
+{
+	TestTensor input(type, { batch, channels, size, size });
+	TestTensor mean(CosMlDataTypeFloat32, { 1, channels, 1, 1 });
+	TestTensor variance(CosMlDataTypeFloat32, { 1, channels, 1, 1 });
+	TestTensor scale(CosMlDataTypeFloat32, { channels });
+	TestTensor bias(CosMlDataTypeFloat32, { channels });
+	TestTensor out(type, { batch, channels, size, size });
+	TestTensor expected(CosMlDataTypeFloat32, { batch, channels, size, size });
+
+	input.Fill(-2.0f, 2.0f);
+	mean.Fill(-0.5f, 0.5f);
+	variance.Fill(0.5f, 2.0f);
+	scale.Fill(0.5f, 1.5f);
+	bias.Fill(-1.0f, 1.0f);
+
+	CosMlNormalizationDesc desc = {};
+	desc.m_input = input.Desc();
+	desc.m_mean = mean.Desc();
+	desc.m_variance = variance.Desc();
+	desc.m_scale = scale.Desc();
+	desc.m_bias = bias.Desc();
+	desc.m_out = out.Desc();
+	desc.m_epsilon = 1e-5f;
+	desc.m_activation.m_function = CosMlActivationRelu;
+
+	float tolerance = (type == CosMlDataTypeFloat16) ? 1e-2f : 1e-4f;
+
+	Run(name, 2.0 * input.Count(), out, expected, tolerance,
+		[&] { return CosMlNormalization(context, &desc); },
+		[&] { RefNormalization(desc, input, mean, variance, scale, bias, expected); });
+}
+
+// The fused kernel is checked and timed against the same two operators run
+// back to back through an intermediate tensor
+static void FusedConvolutionTest(CosMlContext * context, const char * name, UINT64 batch, UINT64 channels, UINT64 size, UINT64 outChannels, UINT kernel, bool inPlace)
+{
+	UINT64 outSize = size - kernel + 1;
+
+	TestTensor input(CosMlDataTypeFloat32, { batch, channels, size, size });
+	TestTensor filter(CosMlDataTypeFloat32, { outChannels, channels, kernel, kernel });
+	TestTensor mean(CosMlDataTypeFloat32, { 1, outChannels, 1, 1 });
+	TestTensor variance(CosMlDataTypeFloat32, { 1, outChannels, 1, 1 });
+	TestTensor scale(CosMlDataTypeFloat32, { outChannels });
+	TestTensor bias(CosMlDataTypeFloat32, { outChannels });
+	TestTensor intermediate(CosMlDataTypeFloat32, { batch, outChannels, outSize, outSize });
+	TestTensor out(CosMlDataTypeFloat32, { batch, outChannels, outSize, outSize });
+	TestTensor expectedIntermediate(CosMlDataTypeFloat32, { batch, outChannels, outSize, outSize });
+	TestTensor expected(CosMlDataTypeFloat32, { batch, outChannels, outSize, outSize });
+
+	input.Fill(-1.0f, 1.0f);
+	filter.Fill(-0.5f, 0.5f);
+	mean.Fill(-0.5f, 0.5f);
+	variance.Fill(0.5f, 2.0f);
+	scale.Fill(0.5f, 1.5f);
+	bias.Fill(-1.0f, 1.0f);
+
+	CosMlConvolutionDesc conv = {};
+	conv.m_input = input.Desc();
+	conv.m_filter = filter.Desc();
+	conv.m_bias = NullTensor();
+	conv.m_crossCorrelation = true;
+	conv.m_stride[0] = conv.m_stride[1] = 1;
+	conv.m_dilation[0] = conv.m_dilation[1] = 1;
+	conv.m_groupCount = 1;
+
+	CosMlNormalizationDesc norm = {};
+	norm.m_mean = mean.Desc();
+	norm.m_variance = variance.Desc();
+	norm.m_scale = scale.Desc();
+	norm.m_bias = bias.Desc();
+	norm.m_epsilon = 1e-5f;
+	norm.m_activation.m_function = CosMlActivationRelu;
+
+	CosMlConvolutionDesc fusedConv = conv;
+	CosMlNormalizationDesc fusedNorm = norm;
+	fusedConv.m_out = inPlace ? out.Desc() : intermediate.Desc();
+	fusedConv.m_pFusedNormalization = &fusedNorm;
+	fusedNorm.m_out = out.Desc();
+
+	conv.m_out = inPlace ? expected.Desc() : expectedIntermediate.Desc();
+	norm.m_input = conv.m_out;
+	norm.m_out = expected.Desc();
+
+	Run(name, 2.0 * batch * outChannels * outSize * outSize * channels * kernel * kernel, out, expected, 1e-4f,
+		[&] { return CosMlConvolution(context, &fusedConv); },
+		[&] { CosMlConvolution(context, &conv); CosMlNormalization(context, &norm); });
+
+	float maxError;
+	if (!inPlace && !Compare(intermediate, expectedIntermediate, 1e-4f, &maxError)) {
+		printf("%-28s intermediate err %.2g FAILED\n", name, maxError);
+		s_failures++;
+	}
+}
+
+// Normalization with parameters per GEMM output column (1x1x1xN)
+static void FusedGemmTest(CosMlContext * context, const char * name, UINT64 m, UINT64 n, UINT64 k)
+{
+	TestTensor a(CosMlDataTypeFloat32, { 1, 1, m, k });
+	TestTensor b(CosMlDataTypeFloat32, { 1, 1, k, n });
+	TestTensor mean(CosMlDataTypeFloat32, { 1, 1, 1, n });
+	TestTensor variance(CosMlDataTypeFloat32, { 1, 1, 1, n });
+	TestTensor intermediate(CosMlDataTypeFloat32, { 1, 1, m, n });
+	TestTensor out(CosMlDataTypeFloat32, { 1, 1, m, n });
+	TestTensor expectedIntermediate(CosMlDataTypeFloat32, { 1, 1, m, n });
+	TestTensor expected(CosMlDataTypeFloat32, { 1, 1, m, n });
+
+	a.Fill(-1.0f, 1.0f);
+	b.Fill(-1.0f, 1.0f);
+	mean.Fill(-0.5f, 0.5f);
+	variance.Fill(0.5f, 2.0f);
+
+	CosMlGemmDesc gemm = {};
+	gemm.m_a = a.Desc();
+	gemm.m_b = b.Desc();
+	gemm.m_c = NullTensor();
+	gemm.m_alpha = 1.0f;
+
+	CosMlNormalizationDesc norm = {};
+	norm.m_mean = mean.Desc();
+	norm.m_variance = variance.Desc();
+	norm.m_scale = NullTensor();
+	norm.m_bias = NullTensor();
+	norm.m_epsilon = 1e-5f;
+	norm.m_activation.m_function = CosMlActivationTanh;
+
+	CosMlGemmDesc fusedGemm = gemm;
+	CosMlNormalizationDesc fusedNorm = norm;
+	fusedGemm.m_out = intermediate.Desc();
+	fusedGemm.m_pFusedNormalization = &fusedNorm;
+	fusedNorm.m_out = out.Desc();
+
+	gemm.m_out = expectedIntermediate.Desc();
+	norm.m_input = gemm.m_out;
+	norm.m_out = expected.Desc();
+
+	Run(name, 2.0 * m * n * k, out, expected, 1e-4f,
+		[&] { return CosMlGemm(context, &fusedGemm); },
+		[&] { CosMlGemm(context, &gemm); CosMlNormalization(context, &norm); });
+}
+
+static void MvnTest(CosMlContext * context, const char * name, UINT64 batch, UINT64 channels, UINT64 size, bool acrossChannels)
+{
+	TestTensor input(CosMlDataTypeFloat32, { batch, channels, size, size });
+	TestTensor out(CosMlDataTypeFloat32, { batch, channels, size, size });
+	TestTensor expected(CosMlDataTypeFloat32, { batch, channels, size, size });
+
+	input.Fill(0.0f, 4.0f);
+
+	CosMlMvnDesc desc = {};
+	desc.m_input = input.Desc();
+	desc.m_scale = NullTensor();
+	desc.m_bias = NullTensor();
+	desc.m_out = out.Desc();
+	desc.m_acrossChannels = acrossChannels;
+	desc.m_normalizeVariance = true;
+	desc.m_epsilon = 1e-5f;
+
+	Run(name, 5.0 * input.Count(), out, expected, 1e-3f,
+		[&] { return CosMlMvn(context, &desc); },
+		[&] { RefMvn(desc, input, expected); });
+}
+
+static void ReductionTest(CosMlContext * context, const char * name, CosMlReductionFunction function, UINT64 batch, UINT64 channels, UINT64 size, bool reduceChannels)
+{
+	bool isArg = (function == CosMlReductionArgMax) || (function == CosMlReductionArgMin);
+	CosMlDataType outType = isArg ? CosMlDataTypeUInt32 : CosMlDataTypeFloat32;
+	UINT64 outChannels = reduceChannels ? 1 : channels;
+	UINT64 outSize = reduceChannels ? size : 1;
+
+	TestTensor input(CosMlDataTypeFloat32, { batch, channels, size, size });
+	TestTensor out(outType, { batch, outChannels, outSize, outSize });
+	TestTensor expected(outType, { batch, outChannels, outSize, outSize });
+
+	input.Fill(0.5f, 1.5f);
+
+	CosMlReductionDesc desc = {};
+	desc.m_input = input.Desc();
+	desc.m_out = out.Desc();
+	desc.m_function = function;
+
+	Run(name, (double)input.Count(), out, expected, 1e-4f,
+		[&] { return CosMlReduction(context, &desc); },
+		[&] { RefReduction(desc, input, expected); });
+}
+
+static void RecurrentTest(CosMlContext * context, const char * name, CosMlRecurrentCell cell, CosMlRecurrentDirection direction, CosMlDataType type,
+	UINT64 seqLength, UINT64 batchSize, UINT64 inputSize, UINT64 hiddenSize, bool variableLengths, bool linearBeforeReset = false)
+{
+	UINT64 gates = (cell == CosMlRecurrentCellLstm) ? 4 : (cell == CosMlRecurrentCellGru) ? 3 : 1;
+	UINT64 directions = (direction == CosMlRecurrentBidirectional) ? 2 : 1;
+
+	TestTensor input(type, { 1, seqLength, batchSize, inputSize });
+	TestTensor weight(type, { 1, directions, gates * hiddenSize, inputSize });
+	TestTensor recurrence(type, { 1, directions, gates * hiddenSize, hiddenSize });
+	TestTensor bias(type, { 1, 1, directions, 2 * gates * hiddenSize });
+	TestTensor seqLengths(CosMlDataTypeUInt32, { 1, 1, 1, batchSize });
+	TestTensor outSequence(type, { seqLength, directions, batchSize, hiddenSize });
+	TestTensor outSingle(type, { 1, directions, batchSize, hiddenSize });
+	TestTensor outCellSingle(type, { 1, directions, batchSize, hiddenSize });
+	TestTensor expected(CosMlDataTypeFloat32, { seqLength, directions, batchSize, hiddenSize });
+	TestTensor expectedSingle(CosMlDataTypeFloat32, { 1, directions, batchSize, hiddenSize });
+	TestTensor expectedCellSingle(CosMlDataTypeFloat32, { 1, directions, batchSize, hiddenSize });
+
+	float scale = 1.0f / sqrtf((float)(inputSize + hiddenSize));
+	input.Fill(-1.0f, 1.0f);
+	weight.Fill(-2.0f * scale, 2.0f * scale);
+	recurrence.Fill(-2.0f * scale, 2.0f * scale);
+	bias.Fill(-0.5f, 0.5f);
+
+	for (UINT64 b = 0; b < batchSize; b++)
+		seqLengths.Set(b, (float)(variableLengths ? seqLength - (b * 3) % seqLength : seqLength));
+
+	CosMlRecurrentDesc desc = {};
+	desc.m_cell = cell;
+	desc.m_direction = direction;
+	desc.m_input = input.Desc();
+	desc.m_weight = weight.Desc();
+	desc.m_recurrence = recurrence.Desc();
+	desc.m_bias = bias.Desc();
+	desc.m_seqLengths = variableLengths ? seqLengths.Desc() : NullTensor();
+	desc.m_outSequence = outSequence.Desc();
+	desc.m_outSingle = outSingle.Desc();
+	desc.m_outCellSingle = outCellSingle.Desc();
+	desc.m_linearBeforeReset = linearBeforeReset;
+	desc.m_useClip = (cell == CosMlRecurrentCellLstm);
+	desc.m_clip = 3.0f;
+
+	for (UINT64 d = 0; d < 2; d++) {
+		CosMlActivation * act = desc.m_activations + d * kCosMlMaxRecurrentActivations;
+		act[0].m_function = (cell == CosMlRecurrentCellRnn) ? CosMlActivationTanh : CosMlActivationSigmoid;
+		act[1].m_function = CosMlActivationTanh;
+		act[2].m_function = CosMlActivationTanh;
+	}
+
+	float tolerance = (type == CosMlDataTypeFloat16) ? 1e-2f : 1e-4f;
+
+	Run(name, 2.0 * directions * seqLength * batchSize * gates * hiddenSize * (inputSize + hiddenSize), outSequence, expected, tolerance,
+		[&] { return CosMlRecurrent(context, &desc); },
+		[&] { RefRecurrent(desc, input, weight, recurrence, bias, variableLengths ? &seqLengths : nullptr, expected, expectedSingle, expectedCellSingle); });
+
+	float maxError;
+	if (!Compare(outSingle, expectedSingle, tolerance, &maxError) ||
+		((cell == CosMlRecurrentCellLstm) && !Compare(outCellSingle, expectedCellSingle, tolerance, &maxError))) {
+		printf("%-28s final state err %.2g FAILED\n", name, maxError);
+		s_failures++;
+	}
+}
+
+static UINT ElementSize(CosMlDataType type)
+{
+	return (type == CosMlDataTypeFloat16) ? 2 : 4;
+}
+
+// The views select the layout of the tensors, expectedView describes the
+// expected tensor with the layout of outView
+static void CopyTensorTest(CosMlContext * context, const char * name, TestTensor & input, const CosMlTensor & inputView,
+	TestTensor & out, const CosMlTensor & outView, TestTensor & expected, const CosMlTensor & expectedView)
+{
+	if (inputView.m_dataType == CosMlDataTypeUInt32)
+		input.Fill(0.0f, 100000.0f);
+	else
+		input.Fill(-4.0f, 4.0f);
+
+	CosMlCopyTensorDesc desc = {};
+	desc.m_input = inputView;
+	desc.m_out = outView;
+
+	UINT64 count = outView.m_size[0] * outView.m_size[1] * outView.m_size[2] * outView.m_size[3];
+	double bytes = (double)count * (ElementSize(inputView.m_dataType) + ElementSize(outView.m_dataType));
+
+	Run(name, bytes, "GB/s", out, expected, 0.0f,
+		[&] { return CosMlCopyTensor(context, &desc); },
+		[&] { RefCopyTensor(inputView, expectedView); });
+}
+
+int main(int argc, char ** argv)
+{
+	UINT numWorkers = (argc > 1) ? atoi(argv[1]) : std::thread::hardware_concurrency();
+	ThreadPoolContext context(numWorkers);
+
+	printf("running with %u workers\n", context.GetNumWorkers());
+
+	GemmTest(&context, "gemm 512 fp32", CosMlDataTypeFloat32, 1, 512, 512, 512, false, false, false, CosMlActivationNone);
+	GemmTest(&context, "gemm 512 fp16", CosMlDataTypeFloat16, 1, 512, 512, 512, false, false, false, CosMlActivationNone);
+	GemmTest(&context, "gemm 4x 129x257x67 tA tB C", CosMlDataTypeFloat32, 4, 129, 257, 67, true, true, true, CosMlActivationLeakyRelu);
+	GemmTest(&context, "gemm 1x1000x1024 sigmoid", CosMlDataTypeFloat32, 1, 1, 1000, 1024, false, true, true, CosMlActivationSigmoid);
+
+	ConvolutionTest(&context, "conv 3x3 64ch 56x56", CosMlDataTypeFloat32, 1, 64, 56, 64, 3, 1, 1, 1, true);
+	ConvolutionTest(&context, "conv 3x3 64ch 56x56 fp16", CosMlDataTypeFloat16, 1, 64, 56, 64, 3, 1, 1, 1, true);
+	ConvolutionTest(&context, "conv 7x7/2 3ch 224x224", CosMlDataTypeFloat32, 1, 3, 224, 64, 7, 2, 3, 1, true);
+	ConvolutionTest(&context, "conv 1x1 256ch 28x28", CosMlDataTypeFloat32, 2, 256, 28, 128, 1, 1, 0, 1, true);
+	ConvolutionTest(&context, "conv 3x3 g4 flipped", CosMlDataTypeFloat32, 2, 32, 17, 16, 3, 2, 1, 4, false);
+
+	PoolingTest(&context, "maxpool 3x3/2 64ch 112x112", CosMlPoolingMax, 64, 112, 3, 2, 1, false);
+	PoolingTest(&context, "maxpool 3x3/1 32ch 57x57", CosMlPoolingMax, 32, 57, 3, 1, 1, false);
+	PoolingTest(&context, "avgpool 3x3/1 pad excl", CosMlPoolingAverage, 32, 57, 3, 1, 1, false);
+	PoolingTest(&context, "avgpool 2x2/2 pad incl", CosMlPoolingAverage, 64, 56, 2, 2, 1, true);
+	PoolingTest(&context, "l2pool 3x3/2", CosMlPoolingLp, 32, 56, 3, 2, 0, false);
+
+	NormalizationTest(&context, "batchnorm 64ch 112x112", CosMlDataTypeFloat32, 1, 64, 112);
+	NormalizationTest(&context, "batchnorm 64ch 56x56 fp16", CosMlDataTypeFloat16, 2, 64, 56);
+
+	FusedConvolutionTest(&context, "fused conv+bn 3x3 64ch 56x56", 1, 64, 58, 64, 3, false);
+	FusedConvolutionTest(&context, "fused conv+bn 1x1 in place", 2, 128, 28, 128, 1, true);
+	FusedGemmTest(&context, "fused gemm+bn 257x129x300", 257, 129, 300);
+
+	MvnTest(&context, "mvn per channel", 2, 64, 56, false);
+	MvnTest(&context, "mvn across channels", 4, 16, 31, true);
+
+	ReductionTest(&context, "reduce sum HW", CosMlReductionSum, 2, 256, 28, false);
+	ReductionTest(&context, "reduce max HW", CosMlReductionMax, 2, 256, 28, false);
+	ReductionTest(&context, "reduce l2 HW", CosMlReductionL2, 2, 256, 28, false);
+	ReductionTest(&context, "reduce logsumexp C", CosMlReductionLogSumExp, 2, 256, 28, true);
+	ReductionTest(&context, "reduce argmax C", CosMlReductionArgMax, 2, 1000, 7, true);
+	ReductionTest(&context, "reduce argmin HW", CosMlReductionArgMin, 2, 64, 28, false);
+
+	RecurrentTest(&context, "rnn bidir seqlens", CosMlRecurrentCellRnn, CosMlRecurrentBidirectional, CosMlDataTypeFloat32, 13, 6, 37, 45, true);
+	RecurrentTest(&context, "gru backward", CosMlRecurrentCellGru, CosMlRecurrentBackward, CosMlDataTypeFloat32, 9, 5, 33, 20, true);
+	RecurrentTest(&context, "gru linear before reset", CosMlRecurrentCellGru, CosMlRecurrentForward, CosMlDataTypeFloat32, 9, 5, 33, 20, false, true);
+	RecurrentTest(&context, "lstm bidir fp16", CosMlRecurrentCellLstm, CosMlRecurrentBidirectional, CosMlDataTypeFloat16, 7, 3, 24, 19, true);
+
+	{
+		TestTensor input(CosMlDataTypeFloat32, { 1, 64, 56, 56 });
+		TestTensor out(CosMlDataTypeFloat32, { 1, 56, 56, 64 });
+		TestTensor expected(CosMlDataTypeFloat32, { 1, 56, 56, 64 });
+		CopyTensorTest(&context, "copy nchw->nhwc", input, input.Desc(), out, out.Permuted({ 0, 3, 1, 2 }), expected, expected.Permuted({ 0, 3, 1, 2 }));
+	}
+	{
+		TestTensor input(CosMlDataTypeFloat16, { 2, 28, 28, 128 });
+		TestTensor out(CosMlDataTypeFloat32, { 2, 128, 28, 28 });
+		TestTensor expected(CosMlDataTypeFloat32, { 2, 128, 28, 28 });
+		CopyTensorTest(&context, "copy nhwc fp16->nchw fp32", input, input.Permuted({ 0, 3, 1, 2 }), out, out.Desc(), expected, expected.Desc());
+	}
+	{
+		TestTensor input(CosMlDataTypeFloat32, { 4, 256, 64, 64 });
+		TestTensor out(CosMlDataTypeFloat16, { 4, 256, 64, 64 });
+		TestTensor expected(CosMlDataTypeFloat16, { 4, 256, 64, 64 });
+		CopyTensorTest(&context, "copy fp32->fp16", input, input.Desc(), out, out.Desc(), expected, expected.Desc());
+	}
+	{
+		TestTensor input(CosMlDataTypeFloat32, { 4, 256, 64, 64 });
+		TestTensor out(CosMlDataTypeFloat32, { 4, 256, 64, 64 });
+		TestTensor expected(CosMlDataTypeFloat32, { 4, 256, 64, 64 });
+		CopyTensorTest(&context, "copy packed fp32", input, input.Desc(), out, out.Desc(), expected, expected.Desc());
+	}
+	{
+		TestTensor input(CosMlDataTypeUInt32, { 1, 32, 64, 72 });
+		TestTensor out(CosMlDataTypeUInt32, { 1, 32, 64, 64 });
+		TestTensor expected(CosMlDataTypeUInt32, { 1, 32, 64, 64 });
+		CosMlTensor inputView = input.Desc();
+		inputView.m_size[3] = 64;
+		CopyTensorTest(&context, "copy uint32 padded rows", input, inputView, out, out.Desc(), expected, expected.Desc());
+	}
+	{
+		TestTensor input(CosMlDataTypeFloat32, { 1, 64, 1, 1 });
+		TestTensor out(CosMlDataTypeFloat16, { 8, 64, 28, 28 });
+		TestTensor expected(CosMlDataTypeFloat16, { 8, 64, 28, 28 });
+		CopyTensorTest(&context, "copy broadcast fp16", input, input.Desc(), out, out.Desc(), expected, expected.Desc());
+	}
+
+	// Sequence length sweep, the input projection amortizes better as T grows
+	for (UINT64 seqLength : { 1, 8, 32, 128 }) {
+		char name[64];
+		sprintf(name, "lstm 256x256 b8 T=%u", (UINT)seqLength);
+		RecurrentTest(&context, name, CosMlRecurrentCellLstm, CosMlRecurrentForward, CosMlDataTypeFloat32, seqLength, 8, 256, 256, false);
+		sprintf(name, "gru 256x256 b8 T=%u", (UINT)seqLength);
+		RecurrentTest(&context, name, CosMlRecurrentCellGru, CosMlRecurrentForward, CosMlDataTypeFloat32, seqLength, 8, 256, 256, false);
+	}
+
+	if (s_failures) {
+		printf("%d tests failed\n", s_failures);
+		return 1;
+	}
+
+	printf("done\n");
+	return 0;
+}
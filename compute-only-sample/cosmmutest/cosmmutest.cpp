@@ -0,0 +1,763 @@
+#include <windows.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <map>
+#include <vector>
+
+//
+// DXGK_PTE as declared in d3dkmddi.h, which is not available to user mode
+//
+
+typedef struct _DXGK_PTE
+{
+	union
+	{
+		struct
+		{
+			ULONGLONG Valid                 : 1;
+			ULONGLONG Zero                  : 1;
+			ULONGLONG CacheCoherent         : 1;
+			ULONGLONG ReadOnly              : 1;
+			ULONGLONG NoExecute             : 1;
+			ULONGLONG Segment               : 5;
+			ULONGLONG LargePage             : 1;
+			ULONGLONG PhysicalAdapterIndex  : 6;
+			ULONGLONG PageTablePageSize     : 2;
+			ULONGLONG SystemReserved0       : 1;
+			ULONGLONG Reserved              : 44;
+		};
+		ULONGLONG Flags;
+	};
+	union
+	{
+		ULONGLONG PageAddress;
+		ULONGLONG PageTableAddress;
+	};
+} DXGK_PTE;
+
+#include "CosGpuMmu.h"
+
+//
+// The GPU VA command structures use these, declared as in d3d12umddi.h which
+// is part of the WDK rather than the SDK
+//
+
+#define COS_GPUVA_SUPPORT 1
+
+#include <dxgiformat.h>
+
+typedef enum D3D12DDI_RESOURCE_DIMENSION
+{
+	D3D12DDI_RD_UNKNOWN     = 0,
+	D3D12DDI_RD_BUFFER      = 1,
+	D3D12DDI_RD_TEXTURE1D   = 2,
+	D3D12DDI_RD_TEXTURE2D   = 3,
+	D3D12DDI_RD_TEXTURE3D   = 4,
+	D3D12DDI_RD_TEXTURECUBE = 5,
+} D3D12DDI_RESOURCE_DIMENSION;
+
+typedef struct D3D12DDIARG_BUFFER_UNORDERED_ACCESS_VIEW
+{
+	UINT64 FirstElement;
+	UINT NumElements;
+	UINT StructureByteStride;
+	UINT64 CounterOffsetInBytes;
+	UINT Flags;
+} D3D12DDIARG_BUFFER_UNORDERED_ACCESS_VIEW;
+
+#include "CosGpuCommand.h"
+#include "Vpu.h"
+#include "CosGpuVaEngine.h"
+
+// Test and benchmark for the software GPU MMU of the GPU VA configuration
+//
+// Builds two level DXGK_PTE page tables over simulated physical memory the
+// way the OS does through DXGK_OPERATION_UPDATE_PAGE_TABLE, then checks that
+// CosGpuMmu translates, faults, copies and flushes correctly and that every
+// page it maps is unmapped again. A dispatch is run through CosGpuVaEngine to
+// check that its command buffer and UAVs are translated by the MMU. The cost
+// of a translation is measured for a hot buffer that stays in the TLB and for
+// a cold one that is walked every time.
+
+static const UINT kSystemMemorySegmentId = 2;
+static const UINT kNumPhysicalPages = 8192;
+static const UINT kPageTableSize = (1 << kCosGpuMmuIndexBits) * sizeof(DXGK_PTE);
+static const UINT kPageTablePages = kPageTableSize / kCosGpuMmuPageSize;
+
+class SimulatedMemory : public CosGpuMmuMemory
+{
+public:
+
+	SimulatedMemory() :
+		m_memory((size_t)kNumPhysicalPages * kCosGpuMmuPageSize),
+		m_nextFreePage(1),
+		m_numMappedPages(0)
+	{
+	}
+
+	UINT64 AllocatePages(UINT numPages)
+	{
+		UINT64 page = m_nextFreePage;
+
+		m_nextFreePage += numPages;
+
+		if (m_nextFreePage > kNumPhysicalPages)
+		{
+			printf("out of simulated physical memory\n");
+			exit(1);
+		}
+
+		return page;
+	}
+
+	UINT64 AllocatePageTable()
+	{
+		UINT64 page = AllocatePages(kPageTablePages);
+
+		m_pageTables[page] = (DXGK_PTE *)GetPage(page);
+
+		return page;
+	}
+
+	BYTE * GetPage(UINT64 page)
+	{
+		return &m_memory[(size_t)page * kCosGpuMmuPageSize];
+	}
+
+	virtual DXGK_PTE * GetPageTable(UINT64 pageTablePage)
+	{
+		auto it = m_pageTables.find(pageTablePage);
+
+		return (it == m_pageTables.end()) ? NULL : it->second;
+	}
+
+	virtual BYTE * MapPage(UINT segmentId, UINT64 page, void ** phMapping)
+	{
+		if ((segmentId != kSystemMemorySegmentId) || (page >= kNumPhysicalPages))
+			return NULL;
+
+		*phMapping = (void *)(ULONG_PTR)page;
+		m_numMappedPages++;
+
+		return GetPage(page);
+	}
+
+	virtual void UnmapPage(BYTE * pCpuPage, void * hMapping)
+	{
+		if (pCpuPage != GetPage((UINT64)(ULONG_PTR)hMapping))
+			printf("unmapped page does not match its mapping\n");
+
+		m_numMappedPages--;
+	}
+
+	INT64 GetNumMappedPages() { return m_numMappedPages; }
+
+private:
+
+	std::vector<BYTE> m_memory;
+	std::map<UINT64, DXGK_PTE *> m_pageTables;
+	UINT64 m_nextFreePage;
+	INT64 m_numMappedPages;
+};
+
+//
+// One GPU VA space with a root page table, mirrors the PTEs for checking
+//
+
+class AddressSpace
+{
+public:
+
+	explicit AddressSpace(SimulatedMemory * pMemory) :
+		m_pMemory(pMemory)
+	{
+		m_rootPageTable = pMemory->AllocatePageTable();
+	}
+
+	UINT64 GetRootPageTable() { return m_rootPageTable; }
+
+	void MapPage(UINT64 gpuVa, UINT64 page, bool bReadOnly)
+	{
+		UINT64 virtualPage = gpuVa >> kCosGpuMmuPageShift;
+		UINT rootIndex = (UINT)(virtualPage >> kCosGpuMmuIndexBits);
+		UINT leafIndex = (UINT)(virtualPage & ((1 << kCosGpuMmuIndexBits) - 1));
+
+		DXGK_PTE * pRoot = m_pMemory->GetPageTable(m_rootPageTable);
+
+		if (!pRoot[rootIndex].Valid)
+		{
+			memset(&pRoot[rootIndex], 0, sizeof(DXGK_PTE));
+			pRoot[rootIndex].Valid = 1;
+			pRoot[rootIndex].Segment = kSystemMemorySegmentId;
+			pRoot[rootIndex].PageTableAddress = m_pMemory->AllocatePageTable();
+		}
+
+		DXGK_PTE * pLeaf = m_pMemory->GetPageTable(pRoot[rootIndex].PageTableAddress);
+
+		memset(&pLeaf[leafIndex], 0, sizeof(DXGK_PTE));
+		pLeaf[leafIndex].Valid = 1;
+		pLeaf[leafIndex].CacheCoherent = 1;
+		pLeaf[leafIndex].ReadOnly = bReadOnly ? 1 : 0;
+		pLeaf[leafIndex].Segment = kSystemMemorySegmentId;
+		pLeaf[leafIndex].PageAddress = page;
+
+		m_pages[virtualPage] = page;
+	}
+
+	//
+	// Maps numPages virtual pages at gpuVa to scattered physical pages
+	//
+
+	void MapBuffer(UINT64 gpuVa, UINT numPages, bool bReadOnly)
+	{
+		UINT64 firstPage = m_pMemory->AllocatePages(numPages);
+
+		for (UINT i = 0; i < numPages; i++)
+		{
+			UINT64 page = firstPage + ((i * 7) % numPages);
+
+			MapPage(gpuVa + (UINT64)i * kCosGpuMmuPageSize, page, bReadOnly);
+		}
+	}
+
+	BYTE * GetExpected(UINT64 gpuVa)
+	{
+		auto it = m_pages.find(gpuVa >> kCosGpuMmuPageShift);
+
+		if (it == m_pages.end())
+			return NULL;
+
+		return m_pMemory->GetPage(it->second) + (gpuVa & (kCosGpuMmuPageSize - 1));
+	}
+
+private:
+
+	SimulatedMemory * m_pMemory;
+	UINT64 m_rootPageTable;
+	std::map<UINT64, UINT64> m_pages;
+};
+
+static const UINT kNumRootEntries = 1 << kCosGpuMmuIndexBits;
+
+static bool TestTranslation(CosGpuMmu * pMmu, AddressSpace * pSpace)
+{
+	bool passed = true;
+
+	srand(1);
+
+	for (UINT i = 0; i < 100000; i++)
+	{
+		UINT64 gpuVa = (((UINT64)rand() << 15) ^ rand()) & 0x0FFFFFFF;
+		UINT bytesInPage = 0;
+
+		BYTE * pCpu = pMmu->Translate(gpuVa, false, &bytesInPage);
+		BYTE * pExpected = pSpace->GetExpected(gpuVa);
+
+		if (pCpu != pExpected)
+		{
+			printf("translation of 0x%llx is %p, expected %p\n", gpuVa, pCpu, pExpected);
+			passed = false;
+			break;
+		}
+
+		if (pCpu && (bytesInPage != kCosGpuMmuPageSize - (gpuVa & (kCosGpuMmuPageSize - 1))))
+		{
+			printf("translation of 0x%llx reports %u bytes in page\n", gpuVa, bytesInPage);
+			passed = false;
+			break;
+		}
+	}
+
+	//
+	// Beyond the root page table
+	//
+
+	UINT bytesInPage;
+
+	if (pMmu->Translate(0x100000000ull, false, &bytesInPage))
+	{
+		printf("address beyond the root page table translated\n");
+		passed = false;
+	}
+
+	return passed;
+}
+
+static bool TestReadOnly(CosGpuMmu * pMmu, UINT64 readOnlyVa)
+{
+	UINT bytesInPage;
+	UINT64 numFaults = pMmu->GetStats().m_numFaults;
+
+	bool passed = (NULL != pMmu->Translate(readOnlyVa, false, &bytesInPage)) &&
+	              (NULL == pMmu->Translate(readOnlyVa, true, &bytesInPage)) &&
+	              (pMmu->GetStats().m_numFaults == numFaults + 1);
+
+	if (!passed)
+		printf("read-only page is not enforced\n");
+
+	return passed;
+}
+
+static bool TestCopy(CosGpuMmu * pMmu, AddressSpace * pSpace, UINT64 srcVa, UINT64 dstVa, UINT size)
+{
+	std::vector<BYTE> pattern(size);
+
+	for (UINT i = 0; i < size; i++)
+		pattern[i] = (BYTE)(i * 13 + 5);
+
+	//
+	// Misaligned source and destination so chunks split at both page boundaries
+	//
+
+	srcVa += 123;
+	dstVa += 2011;
+
+	if (!pMmu->Write(srcVa, pattern.data(), size) ||
+		!pMmu->Copy(dstVa, srcVa, size))
+	{
+		printf("copy faulted\n");
+		return false;
+	}
+
+	for (UINT i = 0; i < size; i++)
+	{
+		if (*pSpace->GetExpected(dstVa + i) != pattern[i])
+		{
+			printf("copy mismatch at byte %u\n", i);
+			return false;
+		}
+	}
+
+	std::vector<BYTE> readBack(size);
+
+	if (!pMmu->Read(dstVa, readBack.data(), size) || (readBack != pattern))
+	{
+		printf("read back mismatch\n");
+		return false;
+	}
+
+	return true;
+}
+
+static bool TestFlush(CosGpuMmu * pMmu, SimulatedMemory * pMemory, AddressSpace * pSpace, UINT64 gpuVa)
+{
+	UINT bytesInPage;
+	BYTE * pOld = pMmu->Translate(gpuVa, false, &bytesInPage);
+
+	pSpace->MapPage(gpuVa, pMemory->AllocatePages(1), false);
+
+	//
+	// The TLB keeps the old translation until it is flushed
+	//
+
+	if (pMmu->Translate(gpuVa, false, &bytesInPage) != pOld)
+	{
+		printf("translation changed without a TLB flush\n");
+		return false;
+	}
+
+	pMmu->FlushTlb();
+
+	if (pMmu->Translate(gpuVa, false, &bytesInPage) != pSpace->GetExpected(gpuVa))
+	{
+		printf("translation is stale after a TLB flush\n");
+		return false;
+	}
+
+	return true;
+}
+
+static bool TestAddressSpaceSwitch(CosGpuMmu * pMmu, SimulatedMemory * pMemory, AddressSpace * pSpace, UINT64 gpuVa)
+{
+	AddressSpace other(pMemory);
+	UINT bytesInPage;
+
+	other.MapBuffer(gpuVa, 1, false);
+
+	pMmu->SetRootPageTable(other.GetRootPageTable(), kNumRootEntries);
+	BYTE * pOther = pMmu->Translate(gpuVa, false, &bytesInPage);
+
+	pMmu->SetRootPageTable(pSpace->GetRootPageTable(), kNumRootEntries);
+	BYTE * pOriginal = pMmu->Translate(gpuVa, false, &bytesInPage);
+
+	if ((pOther != other.GetExpected(gpuVa)) || (pOriginal != pSpace->GetExpected(gpuVa)))
+	{
+		printf("translation leaked across address spaces\n");
+		return false;
+	}
+
+	return true;
+}
+
+//
+// Stands in for the dispatch engine, u2 = u0 + u1 over pairs of INT32
+//
+
+static const BYTE kTestShaderHash[16] = { 0x43, 0x53, 0x44, 0x50, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c };
+static const UINT kTestImageSize = 256;
+
+static const UINT kUavPages = 2;
+static const UINT kUavSize = kUavPages * kCosGpuMmuPageSize;
+static const UINT kUavElementSize = 2 * sizeof(INT32);
+static const UINT kUavElements = kUavSize / kUavElementSize;
+static const UINT kNumUavs = 3;
+
+class TestShaderEngine : public CosGpuVaShaderEngine
+{
+public:
+
+	TestShaderEngine() :
+		m_bImageLoaded(false),
+		m_bBadDispatch(false),
+		m_numDispatches(0)
+	{
+	}
+
+	virtual void LoadShaderImage(GpuHwShaderImageLoad * pImageLoad)
+	{
+		const BYTE * pImage = (const BYTE *)(pImageLoad + 1);
+
+		m_bImageLoaded = (pImageLoad->m_commandSize == sizeof(GpuHwShaderImageLoad) + kTestImageSize) &&
+		                 (0 == memcmp(pImageLoad->m_ShaderHash, kTestShaderHash, sizeof(kTestShaderHash)));
+
+		for (UINT i = 0; m_bImageLoaded && (i < kTestImageSize); i++)
+			m_bImageLoaded = (pImage[i] == (BYTE)(i * 31 + 7));
+	}
+
+	virtual void Dispatch(const GpuHwComputeShaderDisptch * pDispatch, VpuResourceDescriptor * pUavs, UINT numUavs)
+	{
+		m_numDispatches++;
+
+		if (!m_bImageLoaded ||
+			(0 != memcmp(pDispatch->m_ShaderHash, kTestShaderHash, sizeof(kTestShaderHash))) ||
+			(numUavs != kNumUavs))
+		{
+			m_bBadDispatch = true;
+			return;
+		}
+
+		UINT numThreads = pDispatch->m_threadGroupCountX * pDispatch->m_threadCountX;
+
+		for (UINT i = 0; i < numThreads; i++)
+		{
+			INT32 * pA = (INT32 *)(pUavs[0].m_base + i * pUavs[0].m_elementSize);
+			INT32 * pB = (INT32 *)(pUavs[1].m_base + i * pUavs[1].m_elementSize);
+			INT32 * pOut = (INT32 *)(pUavs[2].m_base + i * pUavs[2].m_elementSize);
+
+			pOut[0] = pA[0] + pB[0];
+			pOut[1] = pA[1] + pB[1];
+		}
+	}
+
+	bool m_bImageLoaded;
+	bool m_bBadDispatch;
+	UINT m_numDispatches;
+};
+
+//
+// Header, image load and a dispatch over kNumUavs UAVs, the way the UMD
+// writes them. Returns the size of the command buffer.
+//
+
+static UINT BuildDispatchCommandBuffer(BYTE * pCommandBuffer, const UINT64 * pUavVas, UINT * pDispatchOffset)
+{
+	BYTE * pCur = pCommandBuffer;
+
+	GpuCommand * pHeader = (GpuCommand *)pCur;
+
+	memset(pHeader, 0, sizeof(*pHeader));
+	pHeader->m_commandId = Header;
+	pHeader->m_commandBufferHeader.m_gpuVaCommandBuffer = 1;
+	pCur += sizeof(GpuCommand);
+
+	GpuHwShaderImageLoad * pImageLoad = (GpuHwShaderImageLoad *)pCur;
+	BYTE * pImage = (BYTE *)(pImageLoad + 1);
+
+	pImageLoad->m_commandId = ShaderImageLoad;
+	pImageLoad->m_commandSize = sizeof(GpuHwShaderImageLoad) + kTestImageSize;
+	memcpy(pImageLoad->m_ShaderHash, kTestShaderHash, sizeof(kTestShaderHash));
+
+	for (UINT i = 0; i < kTestImageSize; i++)
+		pImage[i] = (BYTE)(i * 31 + 7);
+
+	pCur += pImageLoad->m_commandSize;
+
+	GpuHwComputeShaderDisptch * pDispatch = (GpuHwComputeShaderDisptch *)pCur;
+	GpuHwUavBinding * pUavBindings = (GpuHwUavBinding *)(pDispatch + 1);
+
+	memset(pDispatch, 0, sizeof(*pDispatch));
+	pDispatch->m_commandId = ComputeShaderDispatch;
+	pDispatch->m_commandSize = sizeof(GpuHwComputeShaderDisptch) + kNumUavs * sizeof(GpuHwUavBinding);
+	pDispatch->m_threadCountX = 4;
+	pDispatch->m_threadCountY = 1;
+	pDispatch->m_threadCountZ = 1;
+	pDispatch->m_threadGroupCountX = kUavElements / 4;
+	pDispatch->m_threadGroupCountY = 1;
+	pDispatch->m_threadGroupCountZ = 1;
+	memcpy(pDispatch->m_ShaderHash, kTestShaderHash, sizeof(kTestShaderHash));
+
+	for (UINT i = 0; i < kNumUavs; i++)
+	{
+		pUavBindings[i].m_gpuVa.QuadPart = pUavVas[i];
+		pUavBindings[i].m_sizeBytes = kUavSize;
+		pUavBindings[i].m_elementSize = kUavElementSize;
+	}
+
+	*pDispatchOffset = (UINT)(pCur - pCommandBuffer);
+	pCur += pDispatch->m_commandSize;
+
+	return (UINT)(pCur - pCommandBuffer);
+}
+
+static bool CheckDispatchStats(CosGpuMmu * pMmu, UINT64 expectedHits, UINT64 expectedMisses, const char * pName)
+{
+	const CosGpuMmuStats & stats = pMmu->GetStats();
+
+	if ((stats.m_numTlbHits != expectedHits) || (stats.m_numTlbMisses != expectedMisses) || (stats.m_numFaults != 0))
+	{
+		printf("%s dispatch: TLB hits=%llu misses=%llu faults=%llu, expected hits=%llu misses=%llu\n",
+			pName, stats.m_numTlbHits, stats.m_numTlbMisses, stats.m_numFaults, expectedHits, expectedMisses);
+		return false;
+	}
+
+	return true;
+}
+
+//
+// Runs one dispatch from a command buffer at gpuVa, its UAVs follow it
+//
+
+static bool TestDispatch(CosGpuMmu * pMmu, AddressSpace * pSpace, UINT64 gpuVa)
+{
+	UINT64 commandBufferVa = gpuVa;
+	UINT64 uavVas[kNumUavs];
+	UINT64 readOnlyUavVa = gpuVa + (UINT64)(1 + kNumUavs * kUavPages) * kCosGpuMmuPageSize;
+
+	pSpace->MapBuffer(commandBufferVa, 1, false);
+
+	for (UINT i = 0; i < kNumUavs; i++)
+	{
+		uavVas[i] = gpuVa + (UINT64)(1 + i * kUavPages) * kCosGpuMmuPageSize;
+		pSpace->MapBuffer(uavVas[i], kUavPages, false);
+	}
+
+	pSpace->MapBuffer(readOnlyUavVa, kUavPages, true);
+
+	std::vector<BYTE> gpuCommands(kCosGpuMmuPageSize);
+	UINT dispatchOffset;
+	UINT commandBufferSize = BuildDispatchCommandBuffer(gpuCommands.data(), uavVas, &dispatchOffset);
+
+	std::vector<INT32> a(kUavElements * 2), b(kUavElements * 2), out(kUavElements * 2);
+
+	for (UINT i = 0; i < kUavElements * 2; i++)
+	{
+		a[i] = (INT32)(i * 3 + 1);
+		b[i] = 1000 - (INT32)i;
+	}
+
+	if (!pMmu->Write(commandBufferVa, gpuCommands.data(), commandBufferSize) ||
+		!pMmu->Write(uavVas[0], a.data(), kUavSize) ||
+		!pMmu->Write(uavVas[1], b.data(), kUavSize))
+	{
+		printf("dispatch setup faulted\n");
+		return false;
+	}
+
+	TestShaderEngine shaderEngine;
+	CosGpuVaEngine engine;
+	std::vector<BYTE> commandBuffer(kCosGpuMmuPageSize);
+	std::vector<BYTE> staging(kNumUavs * kUavSize);
+	UINT failedOffset;
+	bool passed = true;
+
+	engine.Initialize(pMmu, &shaderEngine, commandBuffer.data(), (UINT)commandBuffer.size(), staging.data(), staging.size());
+
+	//
+	// The command buffer page and every UAV page miss once when they are
+	// staged, writing the UAVs back hits
+	//
+
+	pMmu->FlushTlb();
+	pMmu->ResetStats();
+
+	if (!engine.Execute(commandBufferVa, commandBufferSize, &failedOffset))
+	{
+		printf("dispatch failed at offset %u\n", failedOffset);
+		return false;
+	}
+
+	passed &= CheckDispatchStats(pMmu, kNumUavs * kUavPages, 1 + kNumUavs * kUavPages, "cold");
+
+	if (shaderEngine.m_bBadDispatch || (shaderEngine.m_numDispatches != 1) || (engine.GetStats().m_numDispatches != 1))
+	{
+		printf("dispatch did not run with its image and UAVs\n");
+		passed = false;
+	}
+
+	if (!pMmu->Read(uavVas[2], out.data(), kUavSize))
+	{
+		printf("dispatch output faulted\n");
+		return false;
+	}
+
+	for (UINT i = 0; i < kUavElements * 2; i++)
+	{
+		if (out[i] != a[i] + b[i])
+		{
+			printf("dispatch output mismatch at %u\n", i);
+			passed = false;
+			break;
+		}
+	}
+
+	//
+	// Run again with the TLB warm
+	//
+
+	pMmu->ResetStats();
+
+	if (!engine.Execute(commandBufferVa, commandBufferSize, &failedOffset))
+	{
+		printf("second dispatch failed at offset %u\n", failedOffset);
+		return false;
+	}
+
+	passed &= CheckDispatchStats(pMmu, 1 + 2 * kNumUavs * kUavPages, 0, "warm");
+
+	//
+	// Writing the output back to a read-only UAV faults the dispatch
+	//
+
+	GpuHwUavBinding * pUavBindings = (GpuHwUavBinding *)(gpuCommands.data() + dispatchOffset + sizeof(GpuHwComputeShaderDisptch));
+
+	pUavBindings[2].m_gpuVa.QuadPart = readOnlyUavVa;
+
+	if (!pMmu->Write(commandBufferVa, gpuCommands.data(), commandBufferSize))
+	{
+		printf("dispatch setup faulted\n");
+		return false;
+	}
+
+	pMmu->ResetStats();
+
+	if (engine.Execute(commandBufferVa, commandBufferSize, &failedOffset) ||
+		(failedOffset != dispatchOffset) ||
+		(engine.GetCommandId(failedOffset) != ComputeShaderDispatch) ||
+		(pMmu->GetStats().m_numFaults != 1))
+	{
+		printf("dispatch to a read-only UAV did not fault\n");
+		passed = false;
+	}
+
+	return passed;
+}
+
+//
+// ns per page translated when touching numPages consecutive pages
+//
+
+static double TimeTranslation(CosGpuMmu * pMmu, UINT64 gpuVa, UINT numPages, UINT numPasses, bool bFlushEveryPass)
+{
+	volatile BYTE sink = 0;
+	UINT bytesInPage;
+
+	auto start = std::chrono::high_resolution_clock::now();
+
+	for (UINT pass = 0; pass < numPasses; pass++)
+	{
+		if (bFlushEveryPass)
+			pMmu->FlushTlb();
+
+		for (UINT i = 0; i < numPages; i++)
+			sink += *pMmu->Translate(gpuVa + (UINT64)i * kCosGpuMmuPageSize, false, &bytesInPage);
+	}
+
+	auto end = std::chrono::high_resolution_clock::now();
+
+	return std::chrono::duration<double, std::nano>(end - start).count() / ((double)numPages * numPasses);
+}
+
+int main(int argc, char ** argv)
+{
+	UINT numPasses = (argc > 1) ? atoi(argv[1]) : 2000;
+	bool passed = true;
+
+	SimulatedMemory * pMemory = new SimulatedMemory();
+	AddressSpace space(pMemory);
+	CosGpuMmu * pMmu = new CosGpuMmu();
+
+	//
+	// A 1MB hot buffer, a 4MB buffer straddling a root entry, a read-only page
+	//
+
+	const UINT64 kHotVa = 0x00100000;
+	const UINT kHotPages = CosGpuMmu::kTlbSets * CosGpuMmu::kTlbWays;
+	const UINT64 kLargeVa = 0x003F0000;
+	const UINT kLargePages = 1024;
+	const UINT64 kReadOnlyVa = 0x08000000;
+	const UINT64 kDispatchVa = 0x04000000;
+
+	space.MapBuffer(kHotVa, kHotPages, false);
+	space.MapBuffer(kLargeVa, kLargePages, false);
+	space.MapBuffer(kReadOnlyVa, 1, true);
+
+	pMmu->Initialize(pMemory);
+	pMmu->SetRootPageTable(space.GetRootPageTable(), kNumRootEntries);
+
+	passed &= TestTranslation(pMmu, &space);
+	passed &= TestReadOnly(pMmu, kReadOnlyVa);
+	passed &= TestCopy(pMmu, &space, kLargeVa, kLargeVa + 2 * 1024 * 1024, 1024 * 1024);
+	passed &= TestFlush(pMmu, pMemory, &space, kHotVa);
+	passed &= TestAddressSpaceSwitch(pMmu, pMemory, &space, kHotVa);
+	passed &= TestDispatch(pMmu, &space, kDispatchVa);
+
+	//
+	// Hot buffer fits the TLB and only misses on the first pass, the cold
+	// pass walks the page tables for every page
+	//
+
+	pMmu->FlushTlb();
+	pMmu->ResetStats();
+
+	double hotTime = TimeTranslation(pMmu, kHotVa, kHotPages, numPasses, false);
+	CosGpuMmuStats hotStats = pMmu->GetStats();
+
+	pMmu->ResetStats();
+
+	double coldTime = TimeTranslation(pMmu, kHotVa, kHotPages, numPasses / 10 + 1, true);
+	CosGpuMmuStats coldStats = pMmu->GetStats();
+
+	if (hotStats.m_numTlbMisses != kHotPages)
+	{
+		printf("hot buffer missed %llu times, expected %u\n", hotStats.m_numTlbMisses, kHotPages);
+		passed = false;
+	}
+
+	if (coldStats.m_numTlbHits != 0)
+	{
+		printf("cold buffer hit the TLB %llu times\n", coldStats.m_numTlbHits);
+		passed = false;
+	}
+
+	printf("%-6s %12s %12s %12s\n", "", "ns/page", "TLB hits", "TLB misses");
+	printf("%-6s %12.2f %12llu %12llu\n", "hot", hotTime, hotStats.m_numTlbHits, hotStats.m_numTlbMisses);
+	printf("%-6s %12.2f %12llu %12llu\n", "cold", coldTime, coldStats.m_numTlbHits, coldStats.m_numTlbMisses);
+
+	pMmu->FlushTlb();
+
+	if (pMemory->GetNumMappedPages() != 0)
+	{
+		printf("%lld pages still mapped after the final flush\n", pMemory->GetNumMappedPages());
+		passed = false;
+	}
+
+	delete pMmu;
+	delete pMemory;
+
+	printf("%s\n", passed ? "all tests passed" : "TESTS FAILED");
+
+	return passed ? 0 : 1;
+}
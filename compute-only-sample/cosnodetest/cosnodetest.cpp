@@ -0,0 +1,592 @@
+#include <windows.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Cos.h"
+#include "CosContext.h"
+#include "CosGpuCommand.h"
+#include "CosCopyEngine.h"
+#include "CosMpscRing.h"
+
+// Test and benchmark for the copy node of the software adapter
+//
+// Models the engine nodes of the KMD: every node has a CosMpscRing of
+// submissions drained by its own worker thread. The copy node runs its
+// command buffers through CosCopyEngine, the compute node runs a dispatch
+// kernel as well as copies, like the compute node runs SW command buffers.
+//
+// Checks that the copy engine rejects command buffers it cannot run, that
+// copies and dispatches submitted to the two nodes execute concurrently and
+// that work waiting on a fence of the other node sees its results, the way
+// the VidSch holds back a submission waiting on a monitored fence. The same
+// work is timed on the compute node alone and on both nodes.
+
+typedef std::chrono::high_resolution_clock Clock;
+
+static const ULONG kQueueLength = 32;
+static const SIZE_T kVideoMemorySize = 64 * 1024 * 1024;
+
+struct Interval
+{
+	Clock::time_point m_start;
+	Clock::time_point m_end;
+};
+
+class EngineNode;
+
+struct Submission
+{
+	//
+	// Copy command buffer, or a dispatch when m_numCommands is 0
+	//
+
+	const GpuCommand * m_pCommands;
+	UINT m_numCommands;
+
+	SIZE_T m_dispatchSrcOffset;
+	SIZE_T m_dispatchDstOffset;
+	UINT m_numElements;
+	UINT m_numIterations;
+
+	UINT m_fenceId;
+	EngineNode * m_pWaitNode;
+	UINT m_waitFenceId;
+
+	Interval * m_pInterval;
+};
+
+class EngineNode
+{
+public:
+
+	EngineNode(BYTE * pVideoMemory, UINT nodeOrdinal) :
+		m_pVideoMemory(pVideoMemory),
+		m_nodeOrdinal(nodeOrdinal),
+		m_lastSubmittedFenceId(0),
+		m_completedFenceId(0),
+		m_exit(false),
+		m_bRejected(false)
+	{
+		m_ring.Initialize();
+		m_copyEngine.Initialize(pVideoMemory, kVideoMemorySize);
+		m_thread = std::thread(&EngineNode::DoWork, this);
+	}
+
+	~EngineNode()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_exit = true;
+		}
+
+		m_event.notify_one();
+		m_thread.join();
+	}
+
+	//
+	// Returns the fence id of the submission
+	//
+
+	UINT Submit(Submission submission)
+	{
+		ULONG position;
+		Submission * pSubmission;
+
+		while ((pSubmission = m_ring.Reserve(&position)) == NULL)
+			std::this_thread::yield();
+
+		submission.m_fenceId = ++m_lastSubmittedFenceId;
+		*pSubmission = submission;
+		m_ring.Publish(position);
+
+		//
+		// The worker checks the ring under the lock before it sleeps
+		//
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+		}
+
+		m_event.notify_one();
+
+		return submission.m_fenceId;
+	}
+
+	UINT GetCompletedFenceId() const
+	{
+		return m_completedFenceId.load();
+	}
+
+	void WaitForIdle() const
+	{
+		while (m_completedFenceId.load() != m_lastSubmittedFenceId)
+			std::this_thread::yield();
+	}
+
+	const CosCopyEngineStats & GetCopyStats()
+	{
+		return m_copyEngine.GetStats();
+	}
+
+	bool HasRejected() const
+	{
+		return m_bRejected;
+	}
+
+private:
+
+	void DoWork()
+	{
+		for (;;)
+		{
+			Submission * pSubmission = m_ring.Peek();
+
+			if (pSubmission == NULL)
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+
+				if (m_exit)
+					return;
+
+				m_event.wait(lock, [&] { return m_exit || (m_ring.Peek() != NULL); });
+
+				continue;
+			}
+
+			if (pSubmission->m_pWaitNode)
+			{
+				while (pSubmission->m_pWaitNode->GetCompletedFenceId() < pSubmission->m_waitFenceId)
+					std::this_thread::yield();
+			}
+
+			if (pSubmission->m_pInterval)
+				pSubmission->m_pInterval->m_start = Clock::now();
+
+			if (pSubmission->m_numCommands)
+			{
+				if (!m_copyEngine.Execute(pSubmission->m_pCommands, pSubmission->m_pCommands + pSubmission->m_numCommands))
+				{
+					printf("node %u rejected the command buffer of fence %u\n", m_nodeOrdinal, pSubmission->m_fenceId);
+					m_bRejected = true;
+				}
+			}
+			else
+			{
+				Dispatch(pSubmission);
+			}
+
+			if (pSubmission->m_pInterval)
+				pSubmission->m_pInterval->m_end = Clock::now();
+
+			m_completedFenceId.store(pSubmission->m_fenceId);
+			m_ring.Release();
+		}
+	}
+
+	void Dispatch(const Submission * pSubmission)
+	{
+		const UINT * pSrc = (const UINT *)(m_pVideoMemory + pSubmission->m_dispatchSrcOffset);
+		UINT * pDst = (UINT *)(m_pVideoMemory + pSubmission->m_dispatchDstOffset);
+
+		for (UINT i = 0; i < pSubmission->m_numElements; i++)
+			pDst[i] = Kernel(pSrc[i], pSubmission->m_numIterations);
+	}
+
+public:
+
+	static UINT Kernel(UINT value, UINT numIterations)
+	{
+		for (UINT i = 0; i < numIterations; i++)
+			value = value * 1664525 + 1013904223;
+
+		return value;
+	}
+
+private:
+
+	BYTE * m_pVideoMemory;
+	UINT m_nodeOrdinal;
+
+	CosMpscRing<Submission, kQueueLength> m_ring;
+	UINT m_lastSubmittedFenceId;
+	std::atomic<UINT> m_completedFenceId;
+
+	std::mutex m_mutex;
+	std::condition_variable m_event;
+	bool m_exit;
+
+	CosCopyEngine m_copyEngine;
+	bool m_bRejected;
+
+	std::thread m_thread;
+};
+
+static void SetCopy(GpuCommand * pCommand, SIZE_T dstOffset, SIZE_T srcOffset, UINT size)
+{
+	memset(pCommand, 0, sizeof(*pCommand));
+
+	pCommand->m_commandId = ResourceCopy;
+	pCommand->m_resourceCopy.m_dstGpuAddress.QuadPart = (LONGLONG)dstOffset;
+	pCommand->m_resourceCopy.m_srcGpuAddress.QuadPart = (LONGLONG)srcOffset;
+	pCommand->m_resourceCopy.m_sizeBytes = size;
+}
+
+static void SetHeader(GpuCommand * pCommand)
+{
+	memset(pCommand, 0, sizeof(*pCommand));
+
+	pCommand->m_commandId = Header;
+	pCommand->m_commandBufferHeader.m_swCommandBuffer = 1;
+}
+
+static Submission CopySubmission(const GpuCommand * pCommands, UINT numCommands, Interval * pInterval = NULL)
+{
+	Submission submission = {};
+
+	submission.m_pCommands = pCommands;
+	submission.m_numCommands = numCommands;
+	submission.m_pInterval = pInterval;
+
+	return submission;
+}
+
+static Submission DispatchSubmission(SIZE_T srcOffset, SIZE_T dstOffset, UINT numElements, UINT numIterations, Interval * pInterval = NULL)
+{
+	Submission submission = {};
+
+	submission.m_dispatchSrcOffset = srcOffset;
+	submission.m_dispatchDstOffset = dstOffset;
+	submission.m_numElements = numElements;
+	submission.m_numIterations = numIterations;
+	submission.m_pInterval = pInterval;
+
+	return submission;
+}
+
+static bool TestCopyEngine(BYTE * pVideoMemory)
+{
+	CosCopyEngine copyEngine;
+	GpuCommand commands[4];
+	bool passed = true;
+
+	copyEngine.Initialize(pVideoMemory, kVideoMemorySize);
+
+	for (UINT i = 0; i < 4096; i++)
+		pVideoMemory[i] = (BYTE)i;
+
+	memset(pVideoMemory + 4096, 0, 4096);
+
+	//
+	// Header and Nop are skipped, copies run in order
+	//
+
+	SetHeader(&commands[0]);
+	SetCopy(&commands[1], 4096, 0, 2048);
+	commands[2].m_commandId = Nop;
+	SetCopy(&commands[3], 4096 + 2048, 4096, 2048);
+
+	if (!copyEngine.Execute(commands, commands + 4) ||
+		memcmp(pVideoMemory + 4096, pVideoMemory, 2048) ||
+		memcmp(pVideoMemory + 4096 + 2048, pVideoMemory, 2048))
+	{
+		printf("copy command buffer is wrong\n");
+		passed = false;
+	}
+
+	//
+	// Command buffers the copy node cannot run have no effect at all
+	//
+
+	memset(pVideoMemory + 4096, 0, 4096);
+
+	SetCopy(&commands[1], 4096, 0, 1024);
+	commands[2].m_commandId = ComputeShaderDispatch;
+
+	if (copyEngine.Execute(commands, commands + 3))
+	{
+		printf("dispatch accepted by the copy engine\n");
+		passed = false;
+	}
+
+	SetCopy(&commands[2], kVideoMemorySize - 1024, 0, 1025);
+
+	if (copyEngine.Execute(commands, commands + 3))
+	{
+		printf("copy past the end of video memory accepted\n");
+		passed = false;
+	}
+
+	SetCopy(&commands[2], 0, (SIZE_T)-4096, 1024);
+
+	if (copyEngine.Execute(commands, commands + 3))
+	{
+		printf("copy from a negative address accepted\n");
+		passed = false;
+	}
+
+	for (UINT i = 4096; i < 8192; i++)
+	{
+		if (pVideoMemory[i] != 0)
+		{
+			printf("rejected command buffer was partially run\n");
+			passed = false;
+			break;
+		}
+	}
+
+	const CosCopyEngineStats & stats = copyEngine.GetStats();
+
+	if ((stats.m_numCommandBuffers != 1) || (stats.m_numRejected != 3) ||
+		(stats.m_numCopies != 2) || (stats.m_numBytes != 4096))
+	{
+		printf("copy engine stats are wrong\n");
+		passed = false;
+	}
+
+	return passed;
+}
+
+//
+// Uploads through the copy node, transforms on the compute node after the
+// upload fence and reads back on the copy node after the dispatch fence
+//
+
+static bool TestCrossNodeFences(BYTE * pVideoMemory)
+{
+	const UINT kNumBatches = 64;
+	const UINT kNumElements = 4096;
+	const UINT kBatchSize = kNumElements * sizeof(UINT);
+	const UINT kIterations = 16;
+
+	const SIZE_T kStagingBase = 0;
+	const SIZE_T kInputBase = kStagingBase + kNumBatches * kBatchSize;
+	const SIZE_T kOutputBase = kInputBase + kNumBatches * kBatchSize;
+	const SIZE_T kReadbackBase = kOutputBase + kNumBatches * kBatchSize;
+
+	memset(pVideoMemory, 0, kReadbackBase + kNumBatches * kBatchSize);
+
+	UINT * pStaging = (UINT *)(pVideoMemory + kStagingBase);
+
+	for (UINT i = 0; i < kNumBatches * kNumElements; i++)
+		pStaging[i] = i * 2654435761u;
+
+	std::vector<GpuCommand> uploads(kNumBatches), readbacks(kNumBatches);
+	bool passed = true;
+
+	{
+		EngineNode computeNode(pVideoMemory, C_COS_COMPUTE_NODE_ORDINAL);
+		EngineNode copyNode(pVideoMemory, C_COS_COPY_NODE_ORDINAL);
+
+		for (UINT batch = 0; batch < kNumBatches; batch++)
+		{
+			SIZE_T offset = (SIZE_T)batch * kBatchSize;
+
+			SetCopy(&uploads[batch], kInputBase + offset, kStagingBase + offset, kBatchSize);
+			SetCopy(&readbacks[batch], kReadbackBase + offset, kOutputBase + offset, kBatchSize);
+
+			UINT uploadFence = copyNode.Submit(CopySubmission(&uploads[batch], 1));
+
+			Submission dispatch = DispatchSubmission(kInputBase + offset, kOutputBase + offset, kNumElements, kIterations);
+
+			dispatch.m_pWaitNode = &copyNode;
+			dispatch.m_waitFenceId = uploadFence;
+
+			UINT dispatchFence = computeNode.Submit(dispatch);
+
+			Submission readback = CopySubmission(&readbacks[batch], 1);
+
+			readback.m_pWaitNode = &computeNode;
+			readback.m_waitFenceId = dispatchFence;
+
+			copyNode.Submit(readback);
+		}
+
+		copyNode.WaitForIdle();
+		computeNode.WaitForIdle();
+
+		passed = !copyNode.HasRejected() && !computeNode.HasRejected();
+	}
+
+	const UINT * pReadback = (const UINT *)(pVideoMemory + kReadbackBase);
+
+	for (UINT i = 0; passed && (i < kNumBatches * kNumElements); i++)
+	{
+		if (pReadback[i] != EngineNode::Kernel(pStaging[i], kIterations))
+		{
+			printf("element %u read back before its dispatch or upload completed\n", i);
+			passed = false;
+		}
+	}
+
+	return passed;
+}
+
+struct WorkloadResult
+{
+	double m_seconds;
+	double m_overlapSeconds;
+	UINT64 m_copyBytes;
+};
+
+//
+// Independent uploads and dispatches, on the compute node alone or split
+// between the copy and the compute node
+//
+
+static bool RunWorkload(BYTE * pVideoMemory, bool bCopyNode, UINT numCopies, UINT numDispatches, WorkloadResult * pResult)
+{
+	const UINT kCopySize = 1024 * 1024;
+	const UINT kNumElements = 64 * 1024;
+	const UINT kIterations = 256;
+
+	const SIZE_T kCopyBase = 0;
+	const SIZE_T kCopySpan = 16 * kCopySize;
+	const SIZE_T kDispatchBase = 2 * kCopySpan;
+	const SIZE_T kDispatchSize = kNumElements * sizeof(UINT);
+
+	std::vector<GpuCommand> commands(numCopies * 2);
+	std::vector<Interval> copyIntervals(numCopies), dispatchIntervals(numDispatches);
+
+	UINT * pDispatchSrc = (UINT *)(pVideoMemory + kDispatchBase);
+
+	for (UINT i = 0; i < kNumElements; i++)
+		pDispatchSrc[i] = i;
+
+	for (UINT i = 0; i < numCopies; i++)
+	{
+		SIZE_T offset = (SIZE_T)(i % 16) * kCopySize;
+
+		SetHeader(&commands[i * 2]);
+		SetCopy(&commands[i * 2 + 1], kCopyBase + kCopySpan + offset, kCopyBase + offset, kCopySize);
+	}
+
+	bool passed = true;
+	auto start = Clock::now();
+
+	{
+		EngineNode computeNode(pVideoMemory, C_COS_COMPUTE_NODE_ORDINAL);
+		EngineNode copyNode(pVideoMemory, C_COS_COPY_NODE_ORDINAL);
+		EngineNode * pCopyNode = bCopyNode ? &copyNode : &computeNode;
+
+		for (UINT i = 0; i < std::max(numCopies, numDispatches); i++)
+		{
+			if (i < numCopies)
+				pCopyNode->Submit(CopySubmission(&commands[i * 2], 2, &copyIntervals[i]));
+
+			if (i < numDispatches)
+			{
+				SIZE_T dstOffset = kDispatchBase + (1 + (i % 8)) * kDispatchSize;
+
+				computeNode.Submit(DispatchSubmission(kDispatchBase, dstOffset, kNumElements, kIterations, &dispatchIntervals[i]));
+			}
+		}
+
+		copyNode.WaitForIdle();
+		computeNode.WaitForIdle();
+
+		pResult->m_seconds = std::chrono::duration<double>(Clock::now() - start).count();
+		pResult->m_copyBytes = pCopyNode->GetCopyStats().m_numBytes;
+
+		passed = !copyNode.HasRejected() && !computeNode.HasRejected() &&
+			(pResult->m_copyBytes == (UINT64)numCopies * kCopySize);
+	}
+
+	//
+	// Time during which a copy and a dispatch were running at once, the
+	// intervals of one node do not overlap each other
+	//
+
+	pResult->m_overlapSeconds = 0;
+
+	for (const Interval & copy : copyIntervals)
+	{
+		for (const Interval & dispatch : dispatchIntervals)
+		{
+			auto overlapStart = std::max(copy.m_start, dispatch.m_start);
+			auto overlapEnd = std::min(copy.m_end, dispatch.m_end);
+
+			if (overlapStart < overlapEnd)
+				pResult->m_overlapSeconds += std::chrono::duration<double>(overlapEnd - overlapStart).count();
+		}
+	}
+
+	if (memcmp(pVideoMemory + kCopyBase + kCopySpan, pVideoMemory + kCopyBase, std::min<SIZE_T>(numCopies, 16) * kCopySize))
+	{
+		printf("uploaded data is wrong\n");
+		passed = false;
+	}
+
+	for (UINT i = 0; passed && (i < std::min(numDispatches, 8u)); i++)
+	{
+		const UINT * pDst = (const UINT *)(pVideoMemory + kDispatchBase + (1 + i) * kDispatchSize);
+
+		for (UINT j = 0; j < kNumElements; j++)
+		{
+			if (pDst[j] != EngineNode::Kernel(j, kIterations))
+			{
+				printf("dispatch result is wrong\n");
+				passed = false;
+				break;
+			}
+		}
+	}
+
+	return passed;
+}
+
+static bool TestConcurrency(BYTE * pVideoMemory, UINT numCopies, UINT numDispatches)
+{
+	WorkloadResult oneNode, twoNodes;
+	bool passed = true;
+
+	passed &= RunWorkload(pVideoMemory, false, numCopies, numDispatches, &oneNode);
+	passed &= RunWorkload(pVideoMemory, true, numCopies, numDispatches, &twoNodes);
+
+	if (oneNode.m_overlapSeconds != 0)
+	{
+		printf("copies and dispatches overlap on a single node\n");
+		passed = false;
+	}
+
+	if (twoNodes.m_overlapSeconds == 0)
+	{
+		printf("copy node did not run concurrently with the compute node\n");
+		passed = false;
+	}
+
+	printf("%-24s %10s %10s %12s\n", "", "wall ms", "overlap ms", "copy MB/s");
+	printf("%-24s %10.1f %10.1f %12.0f\n", "compute node only",
+		oneNode.m_seconds * 1000, oneNode.m_overlapSeconds * 1000, oneNode.m_copyBytes / oneNode.m_seconds / (1024 * 1024));
+	printf("%-24s %10.1f %10.1f %12.0f\n", "copy + compute node",
+		twoNodes.m_seconds * 1000, twoNodes.m_overlapSeconds * 1000, twoNodes.m_copyBytes / twoNodes.m_seconds / (1024 * 1024));
+
+	return passed;
+}
+
+int main(int argc, char ** argv)
+{
+	UINT numCopies = (argc > 1) ? atoi(argv[1]) : 256;
+	UINT numDispatches = (argc > 2) ? atoi(argv[2]) : 64;
+	bool passed = true;
+
+	BYTE * pVideoMemory = (BYTE *)_aligned_malloc(kVideoMemorySize, 4096);
+
+	passed &= TestCopyEngine(pVideoMemory);
+	passed &= TestCrossNodeFences(pVideoMemory);
+	passed &= TestConcurrency(pVideoMemory, numCopies, numDispatches);
+
+	_aligned_free(pVideoMemory);
+
+	printf("%s\n", passed ? "all tests passed" : "TESTS FAILED");
+
+	return passed ? 0 : 1;
+}
@@ -0,0 +1,346 @@
+#include <windows.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "CosPagingEngine.h"
+
+// Test and benchmark for the paging engine of the software adapter
+//
+// Checks SSE2 fills at every alignment, coalescing of adjacent transfers,
+// paging buffer ordering between dependent operations and large copies split
+// across worker threads. The benchmark compares the engine against the scalar
+// fill loop and per transfer memcpy that ProcessPagingBuffer used before.
+
+class ThreadWorkers : public CosPagingWorkers
+{
+public:
+
+	explicit ThreadWorkers(UINT numWorkers) :
+		m_numWorkers(numWorkers)
+	{
+	}
+
+	virtual UINT GetNumWorkers()
+	{
+		return m_numWorkers;
+	}
+
+	virtual void ParallelFor(UINT numItems, PFN_WORK_ITEM pfnWorkItem, void * pContext)
+	{
+		std::atomic<UINT> nextItem(0);
+		std::vector<std::thread> threads;
+
+		auto work = [&](UINT workerIndex)
+		{
+			for (UINT item = nextItem++; item < numItems; item = nextItem++)
+				pfnWorkItem(pContext, workerIndex, item);
+		};
+
+		for (UINT i = 1; i < m_numWorkers; i++)
+			threads.emplace_back(work, i);
+
+		work(0);
+
+		for (auto & thread : threads)
+			thread.join();
+	}
+
+private:
+
+	UINT m_numWorkers;
+};
+
+static bool CheckPattern(const BYTE * pMemory, SIZE_T size, ULONG pattern)
+{
+	for (SIZE_T i = 0; i < size; i += sizeof(ULONG))
+	{
+		ULONG value;
+
+		memcpy(&value, pMemory + i, sizeof(value));
+
+		if (value != pattern)
+			return false;
+	}
+
+	return true;
+}
+
+static bool TestFill(CosPagingEngine * pEngine)
+{
+	std::vector<BYTE> memory(4 * 1024 * 1024 + 64);
+	BYTE * pBase = (BYTE *)(((ULONG_PTR)memory.data() + 15) & ~(ULONG_PTR)15);
+
+	for (SIZE_T offset = 0; offset < 16; offset += sizeof(ULONG))
+	{
+		for (SIZE_T size = 0; size < 512; size += sizeof(ULONG))
+		{
+			memset(pBase, 0xCC, size + 64);
+
+			pEngine->Fill(pBase + offset, size, 0x12345678);
+
+			if (!CheckPattern(pBase + offset, size, 0x12345678) ||
+				!CheckPattern(pBase + offset + size, 4, 0xCCCCCCCC) ||
+				((offset != 0) && !CheckPattern(pBase, offset, 0xCCCCCCCC)))
+			{
+				printf("fill of %zu bytes at offset %zu is wrong\n", size, offset);
+				return false;
+			}
+		}
+	}
+
+	//
+	// Non-temporal and, with workers, split across threads
+	//
+
+	SIZE_T largeSize = 3 * 1024 * 1024 + 12;
+
+	memset(pBase, 0xCC, largeSize + 64);
+
+	pEngine->Fill(pBase + 4, largeSize, 0xA5A5F00D);
+
+	if (!CheckPattern(pBase + 4, largeSize, 0xA5A5F00D) ||
+		!CheckPattern(pBase + 4 + largeSize, 4, 0xCCCCCCCC) ||
+		!CheckPattern(pBase, 4, 0xCCCCCCCC))
+	{
+		printf("large fill is wrong\n");
+		return false;
+	}
+
+	return true;
+}
+
+static bool TestCoalescing(CosPagingEngine * pEngine)
+{
+	const SIZE_T kPage = 4096;
+	const UINT kNumPages = 64;
+
+	std::vector<BYTE> source(kPage * kNumPages), destination(kPage * kNumPages);
+
+	for (SIZE_T i = 0; i < source.size(); i++)
+		source[i] = (BYTE)(i * 7 + 3);
+
+	pEngine->ResetStats();
+
+	for (UINT i = 0; i < kNumPages; i++)
+		pEngine->QueueCopy(&destination[i * kPage], &source[i * kPage], kPage);
+
+	pEngine->Flush();
+
+	const CosPagingStats & stats = pEngine->GetStats();
+
+	if ((stats.m_numCopies != 1) || (stats.m_numOperations[CosPagingOperationTransfer] != kNumPages))
+	{
+		printf("%u adjacent transfers became %llu copies\n", kNumPages, stats.m_numCopies);
+		return false;
+	}
+
+	if (destination != source)
+	{
+		printf("coalesced copy is wrong\n");
+		return false;
+	}
+
+	//
+	// Scattered transfers fill the queue, which flushes itself
+	//
+
+	std::fill(destination.begin(), destination.end(), (BYTE)0);
+
+	for (UINT i = 0; i < kNumPages; i++)
+	{
+		UINT page = (i * 5) % kNumPages;
+
+		pEngine->QueueCopy(&destination[page * kPage], &source[page * kPage], kPage);
+	}
+
+	pEngine->Flush();
+
+	if (destination != source)
+	{
+		printf("scattered copies are wrong\n");
+		return false;
+	}
+
+	return true;
+}
+
+static bool TestOrdering(CosPagingEngine * pEngine)
+{
+	const SIZE_T kSize = 64 * 1024;
+
+	std::vector<BYTE> a(kSize), b(kSize), c(kSize);
+
+	for (SIZE_T i = 0; i < kSize; i++)
+		a[i] = (BYTE)(i * 13);
+
+	//
+	// B is read after it is written and then filled after it is read
+	//
+
+	pEngine->QueueCopy(b.data(), a.data(), kSize);
+	pEngine->QueueCopy(c.data(), b.data(), kSize);
+	pEngine->Fill(b.data(), kSize, 0xFFFFFFFF);
+	pEngine->Flush();
+
+	if ((c != a) || !CheckPattern(b.data(), kSize, 0xFFFFFFFF))
+	{
+		printf("dependent paging operations ran out of order\n");
+		return false;
+	}
+
+	//
+	// Overlapping move within one buffer
+	//
+
+	std::vector<BYTE> expected(a);
+
+	memmove(&expected[100], &expected[0], kSize - 100);
+
+	pEngine->QueueCopy(&a[100], &a[0], kSize - 100);
+	pEngine->Flush();
+
+	if (a != expected)
+	{
+		printf("overlapping transfer is wrong\n");
+		return false;
+	}
+
+	return true;
+}
+
+static bool TestLargeCopy(CosPagingEngine * pEngine)
+{
+	const SIZE_T kSize = 16 * 1024 * 1024 + 100;
+
+	std::vector<BYTE> source(kSize), destination(kSize);
+
+	for (SIZE_T i = 0; i < kSize; i++)
+		source[i] = (BYTE)((i >> 12) ^ i);
+
+	pEngine->QueueCopy(destination.data(), source.data(), kSize / 2);
+	pEngine->QueueCopy(destination.data() + kSize / 2, source.data() + kSize / 2, kSize - kSize / 2);
+	pEngine->Flush();
+
+	if (destination != source)
+	{
+		printf("large copy is wrong\n");
+		return false;
+	}
+
+	return true;
+}
+
+static double MegabytesPerSecond(SIZE_T bytes, std::chrono::high_resolution_clock::duration duration)
+{
+	return (double)bytes / (1024.0 * 1024.0) / std::chrono::duration<double>(duration).count();
+}
+
+static void Benchmark(UINT numWorkers, UINT numPasses)
+{
+	const SIZE_T kSize = 64 * 1024 * 1024;
+	const SIZE_T kTransferSize = 64 * 1024;
+
+	BYTE * pSource = (BYTE *)_aligned_malloc(kSize, 4096);
+	BYTE * pDestination = (BYTE *)_aligned_malloc(kSize, 4096);
+
+	memset(pSource, 1, kSize);
+	memset(pDestination, 2, kSize);
+
+	//
+	// Previous ProcessPagingBuffer: scalar fill, one memcpy per transfer
+	//
+
+	auto start = std::chrono::high_resolution_clock::now();
+
+	for (UINT pass = 0; pass < numPasses; pass++)
+	{
+		volatile ULONG * pFill = (volatile ULONG *)pDestination;
+
+		for (SIZE_T i = 0; i < kSize / sizeof(ULONG); i++)
+			pFill[i] = pass;
+	}
+
+	double scalarFill = MegabytesPerSecond(kSize * numPasses, std::chrono::high_resolution_clock::now() - start);
+
+	start = std::chrono::high_resolution_clock::now();
+
+	for (UINT pass = 0; pass < numPasses; pass++)
+	{
+		for (SIZE_T offset = 0; offset < kSize; offset += kTransferSize)
+			memcpy(pDestination + offset, pSource + offset, kTransferSize);
+	}
+
+	double serialTransfer = MegabytesPerSecond(kSize * numPasses, std::chrono::high_resolution_clock::now() - start);
+
+	printf("%-24s %12s %12s\n", "", "fill MB/s", "xfer MB/s");
+	printf("%-24s %12.0f %12.0f\n", "scalar/memcpy", scalarFill, serialTransfer);
+
+	for (UINT workers = 1; workers <= numWorkers; workers *= 2)
+	{
+		ThreadWorkers threadWorkers(workers);
+		CosPagingEngine engine;
+
+		engine.Initialize(&threadWorkers);
+
+		for (UINT pass = 0; pass < numPasses; pass++)
+		{
+			engine.Fill(pDestination, kSize, pass);
+
+			for (SIZE_T offset = 0; offset < kSize; offset += kTransferSize)
+				engine.QueueCopy(pDestination + offset, pSource + offset, kTransferSize);
+
+			engine.Flush();
+		}
+
+		const CosPagingStats & stats = engine.GetStats();
+		char label[32];
+
+		snprintf(label, sizeof(label), "engine, %u worker%s", workers, (workers > 1) ? "s" : "");
+
+		printf("%-24s %12llu %12llu\n", label,
+			stats.GetBytesPerSecond(CosPagingOperationFill) >> 20,
+			stats.GetBytesPerSecond(CosPagingOperationTransfer) >> 20);
+	}
+
+	_aligned_free(pSource);
+	_aligned_free(pDestination);
+}
+
+int main(int argc, char ** argv)
+{
+	UINT numPasses = (argc > 1) ? atoi(argv[1]) : 8;
+	UINT numWorkers = std::thread::hardware_concurrency();
+	bool passed = true;
+
+	if (numWorkers == 0)
+		numWorkers = 1;
+
+	ThreadWorkers serialWorkers(1);
+	ThreadWorkers parallelWorkers(std::max(numWorkers, 4u));
+	CosPagingWorkers * workerSets[] = { NULL, &serialWorkers, &parallelWorkers };
+
+	for (CosPagingWorkers * pWorkers : workerSets)
+	{
+		CosPagingEngine engine;
+
+		engine.Initialize(pWorkers);
+
+		passed &= TestFill(&engine);
+		passed &= TestCoalescing(&engine);
+		passed &= TestOrdering(&engine);
+		passed &= TestLargeCopy(&engine);
+	}
+
+	Benchmark(numWorkers, numPasses);
+
+	printf("%s\n", passed ? "all tests passed" : "TESTS FAILED");
+
+	return passed ? 0 : 1;
+}
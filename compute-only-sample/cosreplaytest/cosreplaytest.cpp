@@ -0,0 +1,304 @@
+#include <windows.h>
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#define NT_ASSERT(e) assert(e)
+
+#include "Cos.h"
+#include "CosGpuCommand.h"
+#include "CosDispatchReplay.h"
+
+// Test for the resumption of DMA buffers preempted in a dispatch
+//
+// Models ProcessHWRenderBuffer() running a command buffer through
+// CosDispatchReplay, state commands first and then dispatch and meta
+// commands. The Preemption request is raised once a given thread group of a
+// dispatch ran and stays set, like m_preemptionRequested, so the dispatch
+// stops claiming thread groups and any later dispatch stops before its first
+// one. The command buffer is then run
+// again the way the VidSch resubmits it, until it completes. Checks the
+// resume offset and thread group saved in the DMA buffer private data, that
+// every thread group and meta command ran exactly once across the
+// submissions, and that the state commands ran on every submission.
+
+static const UINT kCommandSize = 64;
+
+static bool Check(bool condition, const char * pMessage)
+{
+	if (!condition)
+		printf("%s\n", pMessage);
+
+	return condition;
+}
+
+struct Command
+{
+	GpuCommandId m_id;
+	UINT m_numThreadGroups;
+
+	std::vector<UINT> m_runs;	// per thread group for a dispatch, else one entry
+};
+
+struct Preemption
+{
+	UINT m_command;
+	UINT m_threadGroup;
+};
+
+class CommandBuffer
+{
+public:
+
+	CommandBuffer() :
+		m_resumeOffset(0),
+		m_resumeThreadGroup(0),
+		m_bPreemptionRequested(false)
+	{
+		Add(Header, 0);
+		Add(RootSignatureSet, 0);
+		Add(ShaderImageLoad, 0);
+	}
+
+	UINT Add(GpuCommandId id, UINT numThreadGroups)
+	{
+		Command command;
+
+		command.m_id = id;
+		command.m_numThreadGroups = numThreadGroups;
+		command.m_runs.resize((ComputeShaderDispatch == id) ? numThreadGroups : 1, 0);
+
+		m_commands.push_back(command);
+
+		return (UINT)(m_commands.size() - 1);
+	}
+
+	//
+	// Returns true when the submission was preempted
+	//
+
+	bool Submit(const Preemption * pPreemption)
+	{
+		CosDispatchReplay replay;
+
+		replay.Begin(&m_resumeOffset, &m_resumeThreadGroup);
+
+		m_bPreemptionRequested = false;
+
+		for (UINT i = 0; i < m_commands.size(); i++)
+		{
+			Command * pCommand = &m_commands[i];
+			UINT commandOffset = i*kCommandSize;
+
+			switch (pCommand->m_id)
+			{
+			case Header:
+			case RootSignatureSet:
+			case ShaderImageLoad:
+				pCommand->m_runs[0]++;
+				break;
+			case MetaCommandExecute:
+				if (!replay.IsReplaying())
+					pCommand->m_runs[0]++;
+				break;
+			case ComputeShaderDispatch:
+				{
+					UINT firstThreadGroup;
+
+					if (!replay.BeginDispatch(commandOffset, &firstThreadGroup))
+						break;
+
+					UINT nextThreadGroup = firstThreadGroup;
+
+					for (; (nextThreadGroup < pCommand->m_numThreadGroups) && !m_bPreemptionRequested; nextThreadGroup++)
+					{
+						pCommand->m_runs[nextThreadGroup]++;
+
+						if (pPreemption && (pPreemption->m_command == i) && (pPreemption->m_threadGroup == nextThreadGroup))
+							m_bPreemptionRequested = true;
+					}
+
+					if (replay.EndDispatch(commandOffset, nextThreadGroup, pCommand->m_numThreadGroups))
+						return true;
+				}
+				break;
+			default:
+				assert(false);
+				break;
+			}
+		}
+
+		return false;
+	}
+
+	bool CheckRuns(UINT numSubmissions)
+	{
+		bool passed = true;
+
+		for (UINT i = 0; i < m_commands.size(); i++)
+		{
+			const Command & command = m_commands[i];
+			UINT expected = ((ComputeShaderDispatch == command.m_id) || (MetaCommandExecute == command.m_id)) ? 1 : numSubmissions;
+
+			for (UINT j = 0; j < command.m_runs.size(); j++)
+			{
+				if (command.m_runs[j] != expected)
+				{
+					printf("command %u (id %d) entry %u ran %u times, expected %u\n", i, command.m_id, j, command.m_runs[j], expected);
+					passed = false;
+					break;
+				}
+			}
+		}
+
+		return passed;
+	}
+
+	UINT m_resumeOffset;
+	UINT m_resumeThreadGroup;
+
+private:
+
+	std::vector<Command> m_commands;
+	bool m_bPreemptionRequested;
+};
+
+//
+// Runs the command buffer with the given Preemption requests, one per
+// submission, and then without until it completes
+//
+
+static bool RunPreempted(
+	CommandBuffer * pBuffer,
+	const Preemption * pPreemptions,
+	UINT numPreemptions,
+	const UINT (*pExpectedResume)[2])
+{
+	bool passed = true;
+	UINT numSubmissions = 0;
+
+	for (UINT i = 0; i < numPreemptions; i++)
+	{
+		numSubmissions++;
+
+		passed &= Check(pBuffer->Submit(&pPreemptions[i]), "submission was not preempted");
+		passed &= Check(pExpectedResume[i][0] == pBuffer->m_resumeOffset, "wrong resume offset");
+		passed &= Check(pExpectedResume[i][1] == pBuffer->m_resumeThreadGroup, "wrong resume thread group");
+	}
+
+	numSubmissions++;
+
+	passed &= Check(!pBuffer->Submit(NULL), "resubmission was preempted");
+	passed &= Check(0 == pBuffer->m_resumeOffset, "resume offset was not consumed");
+	passed &= pBuffer->CheckRuns(numSubmissions);
+
+	return passed;
+}
+
+int main()
+{
+	bool passed = true;
+
+	//
+	// Not preempted, or requested after the last thread group ran
+	//
+
+	{
+		CommandBuffer buffer;
+
+		buffer.Add(ComputeShaderDispatch, 100);
+		buffer.Add(MetaCommandExecute, 0);
+
+		passed &= Check(!buffer.Submit(NULL), "submission was preempted");
+		passed &= Check(0 == buffer.m_resumeOffset, "resume offset set without preemption");
+		passed &= buffer.CheckRuns(1);
+	}
+
+	{
+		CommandBuffer buffer;
+
+		UINT dispatch = buffer.Add(ComputeShaderDispatch, 100);
+		Preemption preemption = { dispatch, 99 };
+
+		passed &= Check(!buffer.Submit(&preemption), "completed dispatch was preempted");
+		passed &= buffer.CheckRuns(1);
+	}
+
+	//
+	// Preempted in the middle of a dispatch, the earlier dispatch and meta
+	// command are skipped on the resubmission
+	//
+
+	{
+		CommandBuffer buffer;
+
+		buffer.Add(ComputeShaderDispatch, 8);
+		buffer.Add(MetaCommandExecute, 0);
+		UINT dispatch = buffer.Add(ComputeShaderDispatch, 1000);
+		buffer.Add(MetaCommandExecute, 0);
+		buffer.Add(ComputeShaderDispatch, 10);
+
+		Preemption preemption = { dispatch, 299 };
+		UINT expected[][2] = { { dispatch*kCommandSize, 300 } };
+
+		passed &= RunPreempted(&buffer, &preemption, 1, expected);
+	}
+
+	//
+	// Preempted in the first thread group, and twice in the same dispatch
+	//
+
+	{
+		CommandBuffer buffer;
+
+		buffer.Add(MetaCommandExecute, 0);
+		UINT dispatch = buffer.Add(ComputeShaderDispatch, 1000);
+
+		Preemption preemptions[] = { { dispatch, 0 }, { dispatch, 1 }, { dispatch, 700 } };
+		UINT expected[][2] = { { dispatch*kCommandSize, 1 }, { dispatch*kCommandSize, 2 }, { dispatch*kCommandSize, 701 } };
+
+		passed &= RunPreempted(&buffer, preemptions, ARRAYSIZE(preemptions), expected);
+	}
+
+	//
+	// Preempted in one dispatch, then in a later one on the resubmission
+	//
+
+	{
+		CommandBuffer buffer;
+
+		UINT first = buffer.Add(ComputeShaderDispatch, 64);
+		buffer.Add(MetaCommandExecute, 0);
+		UINT second = buffer.Add(ComputeShaderDispatch, 64);
+
+		Preemption preemptions[] = { { first, 10 }, { second, 20 } };
+		UINT expected[][2] = { { first*kCommandSize, 11 }, { second*kCommandSize, 21 } };
+
+		passed &= RunPreempted(&buffer, preemptions, ARRAYSIZE(preemptions), expected);
+	}
+
+	//
+	// Requested in the last thread group, the meta command after the dispatch
+	// still runs and the next dispatch stops before its first thread group
+	//
+
+	{
+		CommandBuffer buffer;
+
+		UINT first = buffer.Add(ComputeShaderDispatch, 16);
+		buffer.Add(MetaCommandExecute, 0);
+		UINT second = buffer.Add(ComputeShaderDispatch, 16);
+
+		Preemption preemption = { first, 15 };
+		UINT expected[][2] = { { second*kCommandSize, 0 } };
+
+		passed &= RunPreempted(&buffer, &preemption, 1, expected);
+	}
+
+	printf("%s\n", passed ? "all tests passed" : "TESTS FAILED");
+
+	return passed ? 0 : 1;
+}
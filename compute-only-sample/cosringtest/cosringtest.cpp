@@ -0,0 +1,213 @@
+#include <windows.h>
+
+#include "CosMpscRing.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Stress test and benchmark for the DMA buffer submission ring
+//
+// Producer threads submit numbered items while a single consumer thread
+// takes them off the ring, the way QueueDmaBuffer() and the KMD worker thread
+// use it. The consumer checks that every item arrives exactly once and in
+// order per producer. The same traffic is run through a free list and a FIFO
+// guarded by one lock, which is how the KMD queued DMA buffers before, and
+// the throughput of both is reported in submissions/s.
+
+static const ULONG kQueueLength = 32;
+
+struct TestItem
+{
+	UINT m_producer;
+	UINT m_sequence;
+};
+
+class RingQueue
+{
+public:
+
+	RingQueue() { m_ring.Initialize(); }
+
+	bool Submit(const TestItem & item)
+	{
+		ULONG position;
+		TestItem * pItem = m_ring.Reserve(&position);
+
+		if (pItem == NULL)
+			return false;
+
+		*pItem = item;
+		m_ring.Publish(position);
+
+		return true;
+	}
+
+	TestItem * Peek() { return m_ring.Peek(); }
+	void Release() { m_ring.Release(); }
+
+private:
+
+	CosMpscRing<TestItem, kQueueLength> m_ring;
+};
+
+class LockedQueue
+{
+public:
+
+	LockedQueue() : m_numFree(kQueueLength), m_head(0), m_count(0)
+	{
+		for (ULONG i = 0; i < kQueueLength; i++)
+			m_free[i] = &m_items[i];
+	}
+
+	bool Submit(const TestItem & item)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		if (m_numFree == 0)
+			return false;
+
+		TestItem * pItem = m_free[--m_numFree];
+		*pItem = item;
+		m_queue[(m_head + m_count++) % kQueueLength] = pItem;
+
+		return true;
+	}
+
+	TestItem * Peek()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		if (m_count == 0)
+			return NULL;
+
+		TestItem * pItem = m_queue[m_head];
+		m_head = (m_head + 1) % kQueueLength;
+		m_count--;
+		m_pCurrent = pItem;
+
+		return pItem;
+	}
+
+	void Release()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		m_free[m_numFree++] = m_pCurrent;
+	}
+
+private:
+
+	std::mutex m_mutex;
+	TestItem m_items[kQueueLength];
+	TestItem * m_free[kQueueLength];
+	ULONG m_numFree;
+	TestItem * m_queue[kQueueLength];
+	ULONG m_head;
+	ULONG m_count;
+	TestItem * m_pCurrent;
+};
+
+template <typename TQueue>
+static bool RunStress(const char * name, UINT numProducers, UINT itemsPerProducer)
+{
+	TQueue queue;
+	TQueue * pQueue = &queue;
+	std::atomic<bool> start(false);
+	std::vector<std::thread> producers;
+	std::vector<UINT> nextSequence(numProducers, 0);
+	UINT64 total = (UINT64)numProducers * itemsPerProducer;
+	UINT64 received = 0;
+	UINT64 idlePolls = 0;
+	bool passed = true;
+
+	for (UINT p = 0; p < numProducers; p++)
+	{
+		producers.push_back(std::thread([=, &start] {
+			while (!start.load())
+				std::this_thread::yield();
+
+			for (UINT i = 0; i < itemsPerProducer; i++)
+			{
+				TestItem item = { p, i };
+
+				while (!pQueue->Submit(item))
+					std::this_thread::yield();
+			}
+		}));
+	}
+
+	auto begin = std::chrono::high_resolution_clock::now();
+	start = true;
+
+	while (received < total)
+	{
+		TestItem * pItem = pQueue->Peek();
+
+		if (pItem == NULL)
+		{
+			idlePolls++;
+			std::this_thread::yield();
+			continue;
+		}
+
+		if (pItem->m_producer >= numProducers || pItem->m_sequence != nextSequence[pItem->m_producer])
+		{
+			if (passed)
+				printf("  %s: unexpected item %u:%u\n", name, pItem->m_producer, pItem->m_sequence);
+			passed = false;
+		}
+		else
+		{
+			nextSequence[pItem->m_producer]++;
+		}
+
+		pQueue->Release();
+		received++;
+	}
+
+	auto end = std::chrono::high_resolution_clock::now();
+
+	for (auto & thread : producers)
+		thread.join();
+
+	if (pQueue->Peek() != NULL)
+	{
+		printf("  %s: queue not empty after the last item\n", name);
+		passed = false;
+	}
+
+	double seconds = std::chrono::duration<double>(end - begin).count();
+
+	printf("%-8s %2u producers %10.0f submissions/s %10llu idle polls %s\n",
+		name, numProducers, total / seconds, (unsigned long long)idlePolls, passed ? "passed" : "FAILED");
+
+	return passed;
+}
+
+int main(int argc, char ** argv)
+{
+	UINT itemsPerProducer = (argc > 1) ? atoi(argv[1]) : 200000;
+	UINT maxProducers = (argc > 2) ? atoi(argv[2]) : 2 * std::thread::hardware_concurrency();
+	bool passed = true;
+
+	if (maxProducers == 0)
+		maxProducers = 1;
+
+	printf("%u items per producer, ring of %u\n", itemsPerProducer, kQueueLength);
+
+	for (UINT numProducers = 1; numProducers <= maxProducers; numProducers *= 2)
+	{
+		passed &= RunStress<RingQueue>("ring", numProducers, itemsPerProducer);
+		passed &= RunStress<LockedQueue>("locked", numProducers, itemsPerProducer);
+	}
+
+	printf("%s\n", passed ? "all tests passed" : "TESTS FAILED");
+
+	return passed ? 0 : 1;
+}
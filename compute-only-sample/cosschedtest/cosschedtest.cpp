@@ -0,0 +1,464 @@
+#include <windows.h>
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define NT_ASSERT(e) assert(e)
+
+#include "Cos.h"
+#include "CosContext.h"
+#include "CosComputeScheduler.h"
+#include "CosMpscRing.h"
+
+// Test and benchmark for the compute core scheduler of the software adapter
+//
+// Checks the round robin and priority policies of CosComputeScheduler, the
+// starvation limit and cancelled requests. Then models the compute nodes of
+// the KMD: every node drains its own CosMpscRing on its own worker thread and
+// takes the compute core for each DMA buffer, like DoWork() does. Two
+// processes keep their queues full of long DMA buffers while a third one
+// submits short high priority buffers, the latency of those is measured with
+// every process on a single node and with a node per process under both
+// policies.
+
+typedef std::chrono::high_resolution_clock Clock;
+
+static const ULONG kQueueLength = 32;
+
+static bool Check(bool condition, const char * pMessage)
+{
+	if (!condition)
+		printf("%s\n", pMessage);
+
+	return condition;
+}
+
+static bool TestPolicies()
+{
+	CosComputeScheduler scheduler;
+	bool passed = true;
+
+	//
+	// The first request gets the free core, later ones wait
+	//
+
+	scheduler.Initialize(3, CosComputeSchedulingPriority);
+
+	passed &= Check(scheduler.Request(0, CosContextPriorityNormal), "free core was not granted");
+	passed &= Check(!scheduler.Request(1, CosContextPriorityNormal), "busy core was granted");
+	passed &= Check(!scheduler.Request(2, CosContextPriorityHigh), "busy core was granted");
+
+	passed &= Check(2 == scheduler.Release(0), "high priority node did not win");
+	passed &= Check(1 == scheduler.Release(2), "waiting node did not get the core");
+	passed &= Check(CosComputeScheduler::kNoNode == scheduler.Release(1), "core went to a node that is not waiting");
+	passed &= Check(CosComputeScheduler::kNoNode == scheduler.GetOwner(), "released core still has an owner");
+
+	//
+	// Round robin ignores priority and starts after the last owner
+	//
+
+	scheduler.Initialize(3, CosComputeSchedulingRoundRobin);
+
+	scheduler.Request(1, CosContextPriorityNormal);
+	scheduler.Request(0, CosContextPriorityHigh);
+	scheduler.Request(2, CosContextPriorityNormal);
+
+	passed &= Check(2 == scheduler.Release(1), "round robin did not pick the next node");
+	passed &= Check(0 == scheduler.Release(2), "round robin did not wrap around");
+
+	scheduler.Request(1, CosContextPriorityNormal);
+	scheduler.Request(2, CosContextPriorityNormal);
+
+	passed &= Check(1 == scheduler.Release(0), "round robin did not pick the next node");
+	passed &= Check(2 == scheduler.Release(1), "round robin did not pick the next node");
+	scheduler.Release(2);
+
+	//
+	// Equal priorities are served round robin too
+	//
+
+	scheduler.Initialize(3, CosComputeSchedulingPriority);
+
+	scheduler.Request(0, CosContextPriorityHigh);
+	scheduler.Request(1, CosContextPriorityHigh);
+	scheduler.Request(2, CosContextPriorityHigh);
+
+	passed &= Check(1 == scheduler.Release(0), "tie was not broken round robin");
+	scheduler.Request(0, CosContextPriorityHigh);
+	passed &= Check(2 == scheduler.Release(1), "tie was not broken round robin");
+	passed &= Check(0 == scheduler.Release(2), "tie was not broken round robin");
+	scheduler.Release(0);
+
+	//
+	// A normal priority node passed over kStarvationLimit times wins
+	//
+
+	scheduler.Initialize(3, CosComputeSchedulingPriority);
+
+	scheduler.Request(0, CosContextPriorityHigh);
+	scheduler.Request(2, CosContextPriorityNormal);
+
+	UINT numHighGrants = 0;
+	UINT owner = 0;
+
+	for (;;)
+	{
+		scheduler.Request((owner == 0) ? 1 : 0, CosContextPriorityHigh);
+
+		UINT next = scheduler.Release(owner);
+
+		if (2 == next)
+			break;
+
+		owner = next;
+		numHighGrants++;
+
+		if (numHighGrants > CosComputeScheduler::kStarvationLimit)
+			break;
+	}
+
+	passed &= Check(numHighGrants == CosComputeScheduler::kStarvationLimit, "starving node was not served at the limit");
+	passed &= Check(1 == scheduler.GetStats().m_numStarvationGrants, "starvation grant was not counted");
+
+	//
+	// Cancelled requests are skipped, a request cannot be cancelled once it
+	// has been granted
+	//
+
+	scheduler.Initialize(3, CosComputeSchedulingPriority);
+
+	scheduler.Request(0, CosContextPriorityNormal);
+	scheduler.Request(1, CosContextPriorityHigh);
+	scheduler.Request(2, CosContextPriorityNormal);
+
+	passed &= Check(scheduler.Cancel(1), "waiting request was not cancelled");
+	passed &= Check(2 == scheduler.Release(0), "core went to a cancelled node");
+	passed &= Check(!scheduler.Cancel(2), "granted request was cancelled");
+	passed &= Check(CosComputeScheduler::kNoNode == scheduler.Release(2), "core went to a cancelled node");
+	passed &= Check(1 == scheduler.GetStats().m_numCancels, "cancel was not counted");
+
+	return passed;
+}
+
+//
+// The compute core, handed between the node worker threads
+//
+
+class ComputeCore
+{
+public:
+
+	ComputeCore(UINT numNodes, CosComputeSchedulingPolicy policy) :
+		m_numInCore(0),
+		m_bOverlap(false)
+	{
+		m_scheduler.Initialize(numNodes, policy);
+
+		for (UINT i = 0; i < CosComputeScheduler::kMaxNodes; i++)
+			m_bGranted[i] = false;
+	}
+
+	void Acquire(UINT node, UINT priority)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+
+		if (!m_scheduler.Request(node, priority))
+		{
+			m_grantEvents[node].wait(lock, [&] { return m_bGranted[node]; });
+			m_bGranted[node] = false;
+		}
+
+		if (++m_numInCore != 1)
+			m_bOverlap = true;
+	}
+
+	void Release(UINT node)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		m_numInCore--;
+
+		UINT next = m_scheduler.Release(node);
+
+		if (CosComputeScheduler::kNoNode != next)
+		{
+			m_bGranted[next] = true;
+			m_grantEvents[next].notify_one();
+		}
+	}
+
+	bool HasOverlapped() const
+	{
+		return m_bOverlap;
+	}
+
+private:
+
+	std::mutex m_mutex;
+	std::condition_variable m_grantEvents[CosComputeScheduler::kMaxNodes];
+	bool m_bGranted[CosComputeScheduler::kMaxNodes];
+
+	CosComputeScheduler m_scheduler;
+
+	UINT m_numInCore;
+	bool m_bOverlap;
+};
+
+struct Submission
+{
+	UINT m_durationUs;
+	UINT m_priority;
+	UINT m_fenceId;
+
+	Clock::time_point m_submitTime;
+	double * m_pLatency;
+};
+
+class ComputeNode
+{
+public:
+
+	ComputeNode(ComputeCore * pCore, UINT nodeOrdinal) :
+		m_pCore(pCore),
+		m_nodeOrdinal(nodeOrdinal),
+		m_lastSubmittedFenceId(0),
+		m_completedFenceId(0),
+		m_bOutOfOrder(false),
+		m_exit(false)
+	{
+		m_ring.Initialize();
+		m_thread = std::thread(&ComputeNode::DoWork, this);
+	}
+
+	~ComputeNode()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_exit = true;
+		}
+
+		m_event.notify_one();
+		m_thread.join();
+	}
+
+	//
+	// Several processes submit to one node, the VidSch serializes them
+	//
+
+	UINT Submit(UINT durationUs, UINT priority, double * pLatency)
+	{
+		std::lock_guard<std::mutex> submitLock(m_submitMutex);
+
+		ULONG position;
+		Submission * pSubmission;
+
+		while ((pSubmission = m_ring.Reserve(&position)) == NULL)
+			std::this_thread::yield();
+
+		pSubmission->m_durationUs = durationUs;
+		pSubmission->m_priority = priority;
+		pSubmission->m_fenceId = ++m_lastSubmittedFenceId;
+		pSubmission->m_submitTime = Clock::now();
+		pSubmission->m_pLatency = pLatency;
+
+		UINT fenceId = pSubmission->m_fenceId;
+
+		m_ring.Publish(position);
+
+		//
+		// The worker checks the ring under the lock before it sleeps
+		//
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+		}
+
+		m_event.notify_one();
+
+		return fenceId;
+	}
+
+	void WaitForFence(UINT fenceId) const
+	{
+		while (m_completedFenceId.load() < fenceId)
+			std::this_thread::yield();
+	}
+
+	void WaitForIdle()
+	{
+		UINT fenceId;
+
+		{
+			std::lock_guard<std::mutex> submitLock(m_submitMutex);
+			fenceId = m_lastSubmittedFenceId;
+		}
+
+		WaitForFence(fenceId);
+	}
+
+	bool HasCompletedOutOfOrder() const
+	{
+		return m_bOutOfOrder;
+	}
+
+private:
+
+	void DoWork()
+	{
+		for (;;)
+		{
+			Submission * pSubmission = m_ring.Peek();
+
+			if (pSubmission == NULL)
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+
+				if (m_exit)
+					return;
+
+				m_event.wait(lock, [&] { return m_exit || (m_ring.Peek() != NULL); });
+
+				continue;
+			}
+
+			m_pCore->Acquire(m_nodeOrdinal, pSubmission->m_priority);
+
+			auto end = Clock::now() + std::chrono::microseconds(pSubmission->m_durationUs);
+
+			while (Clock::now() < end)
+				;
+
+			m_pCore->Release(m_nodeOrdinal);
+
+			if (pSubmission->m_pLatency)
+				*pSubmission->m_pLatency = std::chrono::duration<double, std::milli>(Clock::now() - pSubmission->m_submitTime).count();
+
+			if (pSubmission->m_fenceId != m_completedFenceId.load() + 1)
+				m_bOutOfOrder = true;
+
+			m_completedFenceId.store(pSubmission->m_fenceId);
+			m_ring.Release();
+		}
+	}
+
+	ComputeCore * m_pCore;
+	UINT m_nodeOrdinal;
+
+	CosMpscRing<Submission, kQueueLength> m_ring;
+	std::mutex m_submitMutex;
+	UINT m_lastSubmittedFenceId;
+	std::atomic<UINT> m_completedFenceId;
+	bool m_bOutOfOrder;
+
+	std::mutex m_mutex;
+	std::condition_variable m_event;
+	bool m_exit;
+
+	std::thread m_thread;
+};
+
+struct LatencyResult
+{
+	double m_meanMs;
+	double m_maxMs;
+};
+
+//
+// Two background processes queue long normal priority DMA buffers while an
+// interactive process submits short high priority ones, one at a time
+//
+
+static bool RunWorkload(UINT numNodes, CosComputeSchedulingPolicy policy, LatencyResult * pResult)
+{
+	const UINT kNumBackgroundProcesses = 2;
+	const UINT kNumBackgroundBuffers = 12;
+	const UINT kBackgroundDurationUs = 4000;
+
+	const UINT kNumInteractiveBuffers = 16;
+	const UINT kInteractiveDurationUs = 200;
+
+	std::vector<double> latencies(kNumInteractiveBuffers);
+	bool passed = true;
+
+	{
+		//
+		// Only the first numNodes nodes get work
+		//
+
+		ComputeCore core(numNodes, policy);
+		ComputeNode node0(&core, 0), node1(&core, 1), node2(&core, 2);
+		ComputeNode * nodes[] = { &node0, &node1, &node2 };
+
+		assert(numNodes <= ARRAYSIZE(nodes));
+
+		for (UINT i = 0; i < kNumBackgroundBuffers; i++)
+		{
+			for (UINT process = 0; process < kNumBackgroundProcesses; process++)
+				nodes[process % numNodes]->Submit(kBackgroundDurationUs, CosContextPriorityNormal, NULL);
+		}
+
+		ComputeNode * pInteractiveNode = nodes[kNumBackgroundProcesses % numNodes];
+
+		for (UINT i = 0; i < kNumInteractiveBuffers; i++)
+		{
+			UINT fenceId = pInteractiveNode->Submit(kInteractiveDurationUs, CosContextPriorityHigh, &latencies[i]);
+
+			pInteractiveNode->WaitForFence(fenceId);
+
+			std::this_thread::sleep_for(std::chrono::milliseconds(2));
+		}
+
+		for (ComputeNode * pNode : nodes)
+		{
+			pNode->WaitForIdle();
+
+			passed &= Check(!pNode->HasCompletedOutOfOrder(), "node completed DMA buffers out of order");
+		}
+
+		passed &= Check(!core.HasOverlapped(), "two nodes ran on the compute core at once");
+	}
+
+	pResult->m_meanMs = 0;
+	pResult->m_maxMs = 0;
+
+	for (double latency : latencies)
+	{
+		pResult->m_meanMs += latency / kNumInteractiveBuffers;
+		pResult->m_maxMs = std::max(pResult->m_maxMs, latency);
+	}
+
+	return passed;
+}
+
+int main()
+{
+	bool passed = true;
+
+	passed &= TestPolicies();
+
+	LatencyResult singleNode, roundRobin, priority;
+
+	passed &= RunWorkload(1, CosComputeSchedulingPriority, &singleNode);
+	passed &= RunWorkload(3, CosComputeSchedulingRoundRobin, &roundRobin);
+	passed &= RunWorkload(3, CosComputeSchedulingPriority, &priority);
+
+	printf("%-28s %12s %12s\n", "high priority latency", "mean ms", "max ms");
+	printf("%-28s %12.2f %12.2f\n", "1 node", singleNode.m_meanMs, singleNode.m_maxMs);
+	printf("%-28s %12.2f %12.2f\n", "3 nodes, round robin", roundRobin.m_meanMs, roundRobin.m_maxMs);
+	printf("%-28s %12.2f %12.2f\n", "3 nodes, priority", priority.m_meanMs, priority.m_maxMs);
+
+	passed &= Check(priority.m_meanMs < singleNode.m_meanMs, "high priority work is stuck behind other processes");
+
+	printf("%s\n", passed ? "all tests passed" : "TESTS FAILED");
+
+	return passed ? 0 : 1;
+}
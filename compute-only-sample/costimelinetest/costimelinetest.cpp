@@ -0,0 +1,320 @@
+#include <windows.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "Cos.h"
+#include "CosGpuCommand.h"
+#include "CosTimeline.h"
+
+// Test and benchmark for the submission timeline of the software adapter
+//
+// Checks that CosTimeline returns the recorded events in order, counts the
+// ones overwritten before they were read, and never returns a torn event
+// while producer threads keep recording into it, the way the node worker
+// threads and QueueDmaBuffer() record while the timeline escape reads. Then
+// exports a timeline with CosTimelineWriteChromeTrace() and checks the JSON.
+// The cost of recording an event is reported with the timeline stopped, with
+// one thread and with several threads recording.
+
+typedef std::chrono::high_resolution_clock Clock;
+
+static const ULONG kSmallCapacity = 16;
+static const ULONG kCapacity = 1024;
+
+static CosTimeline<kSmallCapacity> s_smallTimeline;
+static CosTimeline<kCapacity> s_timeline;
+
+static bool Check(bool condition, const char * pMessage)
+{
+	if (!condition)
+		printf("%s\n", pMessage);
+
+	return condition;
+}
+
+static bool TestRecordAndRead()
+{
+	CosTimeline<kSmallCapacity> & timeline = s_smallTimeline;
+	CosTimelineEvent events[kSmallCapacity];
+	UINT64 position = 0;
+	UINT64 numDropped = 0;
+	bool passed = true;
+
+	timeline.Initialize();
+
+	//
+	// Nothing is recorded until the timeline is started
+	//
+
+	timeline.Record(CosTimelineEventQueued, 0, 1);
+
+	passed &= Check(0 == timeline.GetPosition(), "stopped timeline recorded an event");
+
+	timeline.Enable(true);
+
+	for (UINT i = 0; i < 10; i++)
+		timeline.Record(CosTimelineEventCommandStart, 1, 100 + i, ComputeShaderDispatch, i);
+
+	UINT numEvents = timeline.Read(&position, events, 4, &numDropped);
+
+	passed &= Check(4 == numEvents, "read did not stop at maxEvents");
+	passed &= Check(4 == position, "read did not move the position");
+
+	numEvents += timeline.Read(&position, events + 4, kSmallCapacity, &numDropped);
+
+	passed &= Check(10 == numEvents, "read did not return all events");
+	passed &= Check(0 == timeline.Read(&position, events, kSmallCapacity, &numDropped), "read returned events twice");
+	passed &= Check(0 == numDropped, "events were dropped");
+
+	for (UINT i = 0; i < numEvents; i++)
+	{
+		passed &= Check(CosTimelineEventCommandStart == events[i].m_type &&
+		                1 == events[i].m_nodeOrdinal &&
+		                100 + i == events[i].m_fenceId &&
+		                ComputeShaderDispatch == events[i].m_command &&
+		                i == events[i].m_data, "event was not read back as recorded");
+
+		if (i > 0)
+			passed &= Check(events[i - 1].m_timestamp <= events[i].m_timestamp, "timestamps went backwards");
+	}
+
+	//
+	// Only the last kSmallCapacity events are kept
+	//
+
+	position = timeline.GetPosition();
+
+	for (UINT i = 0; i < 40; i++)
+		timeline.Record(CosTimelineEventCompleted, 0, i);
+
+	numEvents = timeline.Read(&position, events, kSmallCapacity, &numDropped);
+
+	passed &= Check(kSmallCapacity == numEvents, "read did not return the kept events");
+	passed &= Check(40 - kSmallCapacity == numDropped, "overwritten events were not counted");
+	passed &= Check(40 - kSmallCapacity == events[0].m_fenceId, "read did not start at the oldest kept event");
+
+	timeline.Enable(false);
+
+	return passed;
+}
+
+//
+// The event fields are derived from each other so a torn event is detected
+//
+
+static void RecordChecked(UINT producer, UINT sequence)
+{
+	s_timeline.Record(CosTimelineEventCommandStart, producer, sequence, sequence * 2654435761u, ~sequence);
+}
+
+static bool IsChecked(const CosTimelineEvent & event)
+{
+	return (event.m_command == event.m_fenceId * 2654435761u) && (event.m_data == ~event.m_fenceId);
+}
+
+static bool TestConcurrentRead()
+{
+	const UINT kNumProducers = 4;
+	const UINT kNumEventsPerProducer = 200000;
+
+	std::vector<CosTimelineEvent> events(kCapacity);
+	std::vector<UINT> nextSequence(kNumProducers, 0);
+	std::atomic<UINT> numDone(0);
+	UINT64 position = 0;
+	UINT64 numDropped = 0;
+	UINT64 numRead = 0;
+	bool passed = true;
+
+	s_timeline.Initialize();
+	s_timeline.Enable(true);
+
+	std::vector<std::thread> producers;
+
+	for (UINT producer = 0; producer < kNumProducers; producer++)
+	{
+		producers.push_back(std::thread([producer, &numDone]()
+		{
+			for (UINT sequence = 0; sequence < kNumEventsPerProducer; sequence++)
+				RecordChecked(producer, sequence);
+
+			numDone++;
+		}));
+	}
+
+	for (bool bDone = false; !bDone;)
+	{
+		bDone = (kNumProducers == numDone.load());
+
+		UINT numEvents = s_timeline.Read(&position, events.data(), kCapacity, &numDropped);
+
+		for (UINT i = 0; i < numEvents; i++)
+		{
+			const CosTimelineEvent & event = events[i];
+
+			if (!IsChecked(event) || (event.m_nodeOrdinal >= kNumProducers))
+			{
+				passed &= Check(false, "read returned a torn event");
+				continue;
+			}
+
+			//
+			// Events of one producer are read in the order they were recorded
+			//
+
+			passed &= Check(event.m_fenceId >= nextSequence[event.m_nodeOrdinal], "events of a producer were read out of order");
+
+			nextSequence[event.m_nodeOrdinal] = event.m_fenceId + 1;
+		}
+
+		numRead += numEvents;
+	}
+
+	for (std::thread & producer : producers)
+		producer.join();
+
+	numRead += s_timeline.Read(&position, events.data(), kCapacity, &numDropped);
+
+	passed &= Check(numRead + numDropped == (UINT64)kNumProducers * kNumEventsPerProducer, "events were lost without being counted as dropped");
+
+	printf("concurrent read: %llu events read, %llu dropped\n", numRead, numDropped);
+
+	s_timeline.Enable(false);
+
+	return passed;
+}
+
+static bool TestChromeTrace()
+{
+	//
+	// Ticks are microseconds
+	//
+
+	const UINT64 kTickFrequency = 1000000;
+
+	const CosTimelineEvent events[] =
+	{
+		{ 1000, CosTimelineEventQueued, 0, 7, 0, 0 },
+		{ 1002, CosTimelineEventStarted, 0, 7, 0, 0 },
+		{ 1003, CosTimelineEventCommandStart, 0, 7, ComputeShaderDispatch, 64 },
+		{ 1010, CosTimelineEventCommandEnd, 0, 7, ComputeShaderDispatch, 64 },
+		{ 1010, CosTimelineEventPreempted, 0, 7, 0, 12 },
+		{ 1011, CosTimelineEventStarted, 2, 3, 0, 0 },
+		{ 1012, CosTimelineEventPagingStart, 2, 3, CosTimelinePagingFill, 0 },
+		{ 1020, CosTimelineEventPagingEnd, 2, 3, CosTimelinePagingFill, 0 },
+		{ 1021, CosTimelineEventCompleted, 2, 3, 0, 0 },
+	};
+
+	bool passed = true;
+
+	SIZE_T length = CosTimelineWriteChromeTrace(events, ARRAYSIZE(events), kTickFrequency, NULL, 0);
+
+	std::vector<char> json(length + 2, '#');
+
+	passed &= Check(length == CosTimelineWriteChromeTrace(events, ARRAYSIZE(events), kTickFrequency, json.data(), length + 1), "sized and written traces differ");
+	passed &= Check((0 == json[length]) && ('#' == json[length + 1]), "trace was not terminated within the buffer");
+
+	//
+	// A buffer too small is not written past its end
+	//
+
+	std::vector<char> small(17, '#');
+
+	CosTimelineWriteChromeTrace(events, ARRAYSIZE(events), kTickFrequency, small.data(), 16);
+
+	passed &= Check('#' == small[16], "trace was written past the buffer");
+
+	const char * pTrace = json.data();
+
+	const char * expected[] =
+	{
+		"{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,\"args\":{\"name\":\"Node 2\"}}",
+		"{\"name\":\"Queued\",\"ph\":\"b\",\"pid\":1,\"tid\":0,\"ts\":0.000,\"cat\":\"queue\",\"id\":7,",
+		"{\"name\":\"Queued\",\"ph\":\"e\",\"pid\":1,\"tid\":0,\"ts\":2.000,\"cat\":\"queue\",\"id\":7,",
+		"{\"name\":\"DMA buffer\",\"ph\":\"B\",\"pid\":1,\"tid\":0,\"ts\":2.000,\"args\":{\"fence\":7}}",
+		"{\"name\":\"ComputeShaderDispatch\",\"ph\":\"B\",\"pid\":1,\"tid\":0,\"ts\":3.000,\"args\":{\"offset\":64}}",
+		"{\"name\":\"Preempted\",\"ph\":\"i\",\"pid\":1,\"tid\":0,\"ts\":10.000,\"s\":\"t\",\"args\":{\"fence\":7,\"threadGroup\":12}}",
+		"\"id\":8589934595,",
+		"{\"name\":\"Fill\",\"ph\":\"B\",\"pid\":1,\"tid\":2,\"ts\":12.000,",
+		"{\"ph\":\"E\",\"pid\":1,\"tid\":2,\"ts\":21.000}",
+	};
+
+	for (const char * pExpected : expected)
+	{
+		if (!strstr(pTrace, pExpected))
+		{
+			printf("trace is missing %s\n", pExpected);
+			passed = false;
+		}
+	}
+
+	//
+	// Every slice that begins also ends
+	//
+
+	UINT numBegin = 0;
+	UINT numEnd = 0;
+
+	for (const char * p = pTrace; (p = strstr(p, "\"ph\":\"")) != NULL; p++)
+	{
+		numBegin += ('B' == p[6]);
+		numEnd += ('E' == p[6]);
+	}
+
+	passed &= Check((4 == numBegin) && (4 == numEnd), "trace slices do not match");
+
+	return passed;
+}
+
+static double MeasureRecord(UINT numThreads, bool bEnabled)
+{
+	const UINT kNumEventsPerThread = 1000000;
+
+	s_timeline.Initialize();
+	s_timeline.Enable(bEnabled);
+
+	std::vector<std::thread> threads;
+
+	auto start = Clock::now();
+
+	for (UINT thread = 0; thread < numThreads; thread++)
+	{
+		threads.push_back(std::thread([thread]()
+		{
+			for (UINT sequence = 0; sequence < kNumEventsPerThread; sequence++)
+				RecordChecked(thread, sequence);
+		}));
+	}
+
+	for (std::thread & thread : threads)
+		thread.join();
+
+	double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+	s_timeline.Enable(false);
+
+	return seconds * 1e9 / kNumEventsPerThread;
+}
+
+int main()
+{
+	bool passed = true;
+
+	passed &= TestRecordAndRead();
+	passed &= TestConcurrentRead();
+	passed &= TestChromeTrace();
+
+	printf("%-28s %12s\n", "record", "ns/event");
+	printf("%-28s %12.1f\n", "stopped", MeasureRecord(1, false));
+	printf("%-28s %12.1f\n", "1 thread", MeasureRecord(1, true));
+	printf("%-28s %12.1f\n", "4 threads", MeasureRecord(4, true));
+
+	printf("%s\n", passed ? "all tests passed" : "TESTS FAILED");
+
+	return passed ? 0 : 1;
+}
@@ -50,6 +50,7 @@ void UnexpectedDdi(const char * function, const char * file, int line);
 #if COS_GPUVA_SUPPORT
 #include "CosUmd12CommandBufferGpuVa.h"
 #else
+#include "CosUmd12AllocationIndex.h"
 #include "CosUmd12CommandBuffer.h"
 #endif
 
@@ -3,6 +3,8 @@
 #include "CosUmd12Adapter.h"
 #include "CosUmd12Device.h"
 
+#include "VpuCompiler.h"
+
 CosUmd12Adapter::CosUmd12Adapter()
 {
     // do nothing
@@ -74,6 +76,14 @@ HRESULT APIENTRY CosUmd12Adapter::CloseAdapter( D3D12DDI_HADAPTER hAdapter )
     pAdapter->Close();
     delete pAdapter;
 
+    //
+    // The compiler thread pool can't be stopped from DllMain, stop it while
+    // the runtime still holds the driver. Shaders of other adapters restart
+    // it on their next submission.
+    //
+
+    vpu_compiler_shutdown();
+
     return S_OK;
 }
 
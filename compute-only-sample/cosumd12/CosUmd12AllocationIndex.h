@@ -0,0 +1,92 @@
+#pragma once
+
+//
+// Open addressed hash map from allocation handle to allocation list index
+//
+// Entries are stamped with the epoch they were added in. Reset() starts a new
+// epoch, which empties the map in O(1) when the command buffer is rewound.
+//
+// The map has 2^CapacityLog2 entries and must stay at most half full, so it
+// is sized to twice the allocation list it indexes.
+//
+// Kept free of D3D headers so cosalloctest can benchmark it.
+//
+
+template <UINT CapacityLog2>
+class CosUmd12AllocationIndex
+{
+public:
+
+    static const UINT kCapacity = 1 << CapacityLog2;
+
+    CosUmd12AllocationIndex()
+    {
+        memset(m_entries, 0, sizeof(m_entries));
+        m_epoch = 1;
+        m_numEntries = 0;
+    }
+
+    void Reset()
+    {
+        m_epoch++;
+        m_numEntries = 0;
+
+        if (0 == m_epoch)
+        {
+            //
+            // Stamps from 2^32 epochs ago would look current again
+            //
+
+            memset(m_entries, 0, sizeof(m_entries));
+            m_epoch = 1;
+        }
+    }
+
+    //
+    // Returns the index of hAllocation, or adds it with newIndex and returns
+    // newIndex when it is not in the map yet
+    //
+
+    UINT FindOrAdd(UINT hAllocation, UINT newIndex)
+    {
+        UINT slot = (hAllocation * 0x9E3779B1u) >> (32 - CapacityLog2);
+
+        for (;;)
+        {
+            Entry * pEntry = &m_entries[slot];
+
+            if (pEntry->m_epoch != m_epoch)
+            {
+                assert(m_numEntries < kCapacity / 2);
+
+                pEntry->m_hAllocation = hAllocation;
+                pEntry->m_index = newIndex;
+                pEntry->m_epoch = m_epoch;
+
+                m_numEntries++;
+
+                return newIndex;
+            }
+
+            if (pEntry->m_hAllocation == hAllocation)
+            {
+                return pEntry->m_index;
+            }
+
+            slot = (slot + 1) & (kCapacity - 1);
+        }
+    }
+
+private:
+
+    struct Entry
+    {
+        UINT    m_hAllocation;
+        UINT    m_index;
+        UINT    m_epoch;
+    };
+
+    Entry   m_entries[kCapacity];
+    UINT    m_epoch;
+    UINT    m_numEntries;
+};
@@ -12,6 +12,8 @@
 
 #if !COS_GPUVA_SUPPORT
 
+static_assert((1 << C_COS_ALLOCATION_LIST_SIZE_LOG2) == C_COS_ALLOCATION_LIST_SIZE, "Allocation index is sized from C_COS_ALLOCATION_LIST_SIZE_LOG2");
+
 CosUmd12CommandBuffer * CosUmd12CommandBuffer::Create()
 {
     UINT size;
@@ -49,10 +51,22 @@ CosUmd12CommandBuffer::CosUmd12CommandBuffer(
     m_pPatchLocationList = (D3DDDI_PATCHLOCATIONLIST *)(m_pAllocationList + m_allocationListSize);
     m_patchLocationListSize = PatchLocationListSize;
 
+    m_pNextPooled = NULL;
+
+    Reset();
+}
+
+void
+CosUmd12CommandBuffer::Reset()
+{
     m_commandBufferPos = 0;
     m_allocationListPos = 0;
     m_patchLocationListPos = 0;
 
+    m_allocationIndex.Reset();
+
+    m_numLoadedShaderImages = 0;
+
     //
     // Write header into command buffer (for KMD)
     //
@@ -137,7 +151,7 @@ CosUmd12CommandBuffer::CommitCommandBufferSpace(
 
 //
 // D3D12 resource can be referenced by multiple Command List/Buffer,
-// so a search of the Allocation List is necessary
+// so the Allocation List is searched through m_allocationIndex
 //
 
 UINT
@@ -153,16 +167,13 @@ CosUmd12CommandBuffer::UseAllocation(
     D3DKMT_HANDLE   hAllocation,
     BOOL            bWriteOperation)
 {
-    UINT i;
+    UINT i = m_allocationIndex.FindOrAdd(hAllocation, m_allocationListPos);
 
-    for (i = 0; i < m_allocationListPos; i++)
+    if (i < m_allocationListPos)
     {
-        if (hAllocation == m_pAllocationList[i].hAllocation)
-        {
-            m_pAllocationList[i].WriteOperation = bWriteOperation;
+        m_pAllocationList[i].WriteOperation = bWriteOperation;
 
-            return i;
-        }
+        return i;
     }
 
     auto pAllocationEntry = m_pAllocationList + i;
@@ -197,6 +208,35 @@ CosUmd12CommandBuffer::RecordGpuAddressReference(
         allocationOffset);
 }
 
+bool
+CosUmd12CommandBuffer::IsShaderImageLoaded(
+    const D3D12DDI_SHADERCACHE_HASH & shaderHash)
+{
+    for (UINT i = 0; i < m_numLoadedShaderImages; i++)
+    {
+        if (0 == memcmp(&m_loadedShaderImages[i], &shaderHash, sizeof(shaderHash)))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void
+CosUmd12CommandBuffer::RecordShaderImageLoad(
+    const D3D12DDI_SHADERCACHE_HASH & shaderHash)
+{
+    //
+    // When the table is full the image is simply sent again
+    //
+
+    if (m_numLoadedShaderImages < MAX_SHADER_IMAGES)
+    {
+        m_loadedShaderImages[m_numLoadedShaderImages++] = shaderHash;
+    }
+}
+
 HRESULT
 CosUmd12CommandBuffer::Execute(CosUmd12CommandQueue * pCommandQueue)
 {
@@ -17,6 +17,12 @@ public:
     HRESULT Standup();
     void Teardown();
 
+    //
+    // Rewinds the command buffer for reuse by the Command Pool
+    //
+
+    void Reset();
+
     void
     ReserveCommandBufferSpace(
         bool                        bSwCommand,
@@ -78,11 +84,33 @@ public:
         UINT commandBufferOffset,
         D3DDDI_PATCHLOCATIONLIST * &pPatchLocations);
 
+    //
+    // Shader images are sent to KMD once per command buffer, later dispatches
+    // reference the resident image by shader hash
+    //
+
+    bool IsShaderImageLoaded(const D3D12DDI_SHADERCACHE_HASH & shaderHash);
+    void RecordShaderImageLoad(const D3D12DDI_SHADERCACHE_HASH & shaderHash);
+
     // Interface for Command Queue
     HRESULT Execute(CosUmd12CommandQueue * pCommandQueue);
 
+    //
+    // Contents are copied to the kernel runtime's DMA buffer when executed, so
+    // the command buffer can be reused as soon as its Command List is reset
+    //
+
+    bool IsIdle()
+    {
+        return true;
+    }
+
 private:
 
+    friend class CosUmd12CommandPool;
+
+    CosUmd12CommandBuffer *             m_pNextPooled;
+
     BYTE *                              m_pCommandBuffer;
     UINT                                m_commandBufferSize;
     UINT                                m_commandBufferPos;
@@ -91,12 +119,22 @@ private:
     UINT                                m_allocationListSize;
     UINT                                m_allocationListPos;
 
+    //
+    // Allocation list index of every allocation referenced by the command buffer
+    //
+
+    CosUmd12AllocationIndex<C_COS_ALLOCATION_LIST_SIZE_LOG2 + 1>  m_allocationIndex;
+
     D3DDDI_PATCHLOCATIONLIST *          m_pPatchLocationList;
     UINT                                m_patchLocationListSize;
     UINT                                m_patchLocationListPos;
 
     GpuCommand *                        m_pCmdBufHeader;
 
+    static const UINT                   MAX_SHADER_IMAGES = 32;
+    D3D12DDI_SHADERCACHE_HASH           m_loadedShaderImages[MAX_SHADER_IMAGES];
+    UINT                                m_numLoadedShaderImages;
+
     bool IsSwCommandBuffer();
 
     CONST UINT  COMMAND_BUFFER_FLUSH_THRESHOLD = 512;
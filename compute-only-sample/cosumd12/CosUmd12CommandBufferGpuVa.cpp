@@ -54,6 +54,10 @@ CosUmd12CommandBuffer::CosUmd12CommandBuffer(
     m_commandBufferSize = (UINT)pHeapDesc->ByteSize;
 
     m_commandBufferPos = 0;
+
+    m_pNextPooled = NULL;
+    m_pSubmissionFence = NULL;
+    m_submissionFenceValue = 0;
 }
 
 HRESULT CosUmd12CommandBuffer::Standup()
@@ -72,6 +76,28 @@ HRESULT CosUmd12CommandBuffer::Standup()
         return hr;
     }
 
+    Reset();
+
+    return hr;
+}
+
+void CosUmd12CommandBuffer::Teardown()
+{
+    if (m_pSubmissionFence)
+    {
+        m_pSubmissionFence->Release();
+        m_pSubmissionFence = NULL;
+    }
+
+    m_commandHeap.Teardown();
+}
+
+void CosUmd12CommandBuffer::Reset()
+{
+    m_commandBufferPos = 0;
+
+    m_numLoadedShaderImages = 0;
+
     //
     // Write header into command buffer (for KMD)
     //
@@ -82,13 +108,16 @@ HRESULT CosUmd12CommandBuffer::Standup()
     m_pCmdBufHeader->m_commandBufferHeader.m_gpuVaCommandBuffer = 1;
 
     m_commandBufferPos += sizeof(GpuCommand);
-
-    return hr;
 }
 
-void CosUmd12CommandBuffer::Teardown()
+bool CosUmd12CommandBuffer::IsIdle()
 {
-    m_commandHeap.Teardown();
+    if (NULL == m_pSubmissionFence)
+    {
+        return true;
+    }
+
+    return m_pSubmissionFence->IsCompleted(m_submissionFenceValue);
 }
 
 CosUmd12CommandBuffer::~CosUmd12CommandBuffer()
@@ -124,6 +153,35 @@ CosUmd12CommandBuffer::CommitCommandBufferSpace(
     assert((m_commandBufferPos + COMMAND_BUFFER_FLUSH_THRESHOLD) < m_commandBufferSize);
 }
 
+bool
+CosUmd12CommandBuffer::IsShaderImageLoaded(
+    const D3D12DDI_SHADERCACHE_HASH & shaderHash)
+{
+    for (UINT i = 0; i < m_numLoadedShaderImages; i++)
+    {
+        if (0 == memcmp(&m_loadedShaderImages[i], &shaderHash, sizeof(shaderHash)))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void
+CosUmd12CommandBuffer::RecordShaderImageLoad(
+    const D3D12DDI_SHADERCACHE_HASH & shaderHash)
+{
+    //
+    // When the table is full the image is simply sent again
+    //
+
+    if (m_numLoadedShaderImages < MAX_SHADER_IMAGES)
+    {
+        m_loadedShaderImages[m_numLoadedShaderImages++] = shaderHash;
+    }
+}
+
 HRESULT
 CosUmd12CommandBuffer::Execute(CosUmd12CommandQueue * pCommandQueue)
 {
@@ -132,10 +190,37 @@ CosUmd12CommandBuffer::Execute(CosUmd12CommandQueue * pCommandQueue)
         return S_OK;
     }
 
-    return pCommandQueue->ExecuteCommandBuffer(
+    HRESULT hr;
+
+    hr = pCommandQueue->ExecuteCommandBuffer(
                             m_commandHeap.GetGpuVa(),
                             m_commandBufferPos,
                             m_pCommandBuffer);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    //
+    // The GPU reads the command heap in place, remember the last submission
+    // so the Command Pool does not reuse it before the queue fence passes it
+    //
+
+    CosUmd12SubmissionFence * pSubmissionFence = pCommandQueue->GetSubmissionFence();
+
+    if (pSubmissionFence != m_pSubmissionFence)
+    {
+        pSubmissionFence->AddRef();
+
+        if (m_pSubmissionFence)
+        {
+            m_pSubmissionFence->Release();
+        }
+
+        m_pSubmissionFence = pSubmissionFence;
+    }
+
+    m_submissionFenceValue = pCommandQueue->GetPendingFenceValue();
 
     return S_OK;
 }
@@ -18,6 +18,12 @@ public:
     HRESULT Standup();
     void Teardown();
 
+    //
+    // Rewinds the command buffer for reuse by the Command Pool
+    //
+
+    void Reset();
+
     void
     ReserveCommandBufferSpace(
         UINT                        commandSize,
@@ -29,11 +35,32 @@ public:
 
     bool IsCommandBufferEmpty();
 
+    //
+    // Shader images are sent to KMD once per command buffer, later dispatches
+    // reference the resident image by shader hash
+    //
+
+    bool IsShaderImageLoaded(const D3D12DDI_SHADERCACHE_HASH & shaderHash);
+    void RecordShaderImageLoad(const D3D12DDI_SHADERCACHE_HASH & shaderHash);
+
     // Interface for Command Queue
     HRESULT Execute(CosUmd12CommandQueue * pCommandQueue);
 
+    //
+    // True once the queue fence has passed the last submission of the command buffer
+    //
+
+    bool IsIdle();
+
 private:
 
+    friend class CosUmd12CommandPool;
+
+    CosUmd12CommandBuffer *             m_pNextPooled;
+
+    CosUmd12SubmissionFence *           m_pSubmissionFence;
+    UINT64                              m_submissionFenceValue;
+
     CosUmd12Heap                        m_commandHeap;
 
     BYTE *                              m_pCommandBuffer;
@@ -42,5 +69,9 @@ private:
 
     GpuCommand *                        m_pCmdBufHeader;
 
+    static const UINT                   MAX_SHADER_IMAGES = 32;
+    D3D12DDI_SHADERCACHE_HASH           m_loadedShaderImages[MAX_SHADER_IMAGES];
+    UINT                                m_numLoadedShaderImages;
+
     CONST UINT  COMMAND_BUFFER_FLUSH_THRESHOLD = 512;
 };
@@ -37,6 +37,10 @@ HRESULT CosUmd12CommandList::StandUp()
 void
 CosUmd12CommandList::Close()
 {
+#if COS_MLMC_RS5_SUPPORT && !COS_RS_2LEVEL_SUPPORT
+    FuseMlMetaCommands();
+#endif
+
     if (m_pCurCommandBuffer->IsCommandBufferEmpty())
     {
         return;
@@ -71,6 +75,14 @@ CosUmd12CommandList::Reset(
         m_pCurCommandBuffer = 0;
     }
 
+#if COS_MLMC_RS5_SUPPORT && !COS_RS_2LEVEL_SUPPORT
+    m_numMlMetaCommandRecords = 0;
+#endif
+
+    m_dirtyRootParameters = ~0ull;
+    m_pHwRootSignature = NULL;
+    m_pHwRootSignatureCommandBuffer = NULL;
+
     m_pCommandPool = NULL;
 
     CosUmd12CommandRecorder * pCommandRecorder = CosUmd12CommandRecorder::CastFrom(pReset->hDrvCommandRecorder);
@@ -332,6 +344,8 @@ CosUmd12CommandList::SetDescriptorHeaps(
 
         m_pDescriptorHeaps[pDescriptorHeap->GetHeapType()] = pDescriptorHeap;
     }
+
+    m_dirtyRootParameters = ~0ull;
 }
 
 void
@@ -346,6 +360,8 @@ CosUmd12CommandList::SetRootDescriptorTable(
                         m_pDescriptorHeaps,
                         rootParameterIndex,
                         baseDescriptor);
+
+    MarkRootParameterDirty(rootParameterIndex);
 }
 
 void
@@ -358,6 +374,8 @@ CosUmd12CommandList::SetRoot32BitConstants(
     CosUmd12RootSignature * pRootSignature = CosUmd12RootSignature::CastFrom(m_pPipelineState->m_args.hRootSignature);
 
     pRootSignature->SetRoot32BitConstants(m_rootValues, rootParameterIndex, num32BitValuesToSet, pSrcData, destOffsetIn32BitValues);
+
+    MarkRootParameterDirty(rootParameterIndex);
 }
 
 void
@@ -368,6 +386,8 @@ CosUmd12CommandList::SetRootView(
     CosUmd12RootSignature * pRootSignature = CosUmd12RootSignature::CastFrom(m_pPipelineState->m_args.hRootSignature);
 
     pRootSignature->SetRootView(m_rootValues, rootParameterIndex, bufferLocation);
+
+    MarkRootParameterDirty(rootParameterIndex);
 }
 
 void
@@ -378,22 +398,28 @@ CosUmd12CommandList::Dispatch(
 {
     CosUmd12RootSignature * pRootSignature = CosUmd12RootSignature::CastFrom(m_pPipelineState->m_args.hRootSignature);
     CosUmd12Shader * pComputeShader = CosUmd12Shader::CastFrom(m_pPipelineState->m_args.hComputeShader);
-    UINT commandSize, hwRootSignatureSetCommandSize;
-    UINT numPatchLocations;
+    UINT commandSize, hwRootSignatureSetCommandSize, imageLoadCommandSize;
+    UINT numPatchLocations, numPatchLocationsUsed;
+    UINT64 dirtyRootParameters;
     BYTE * pCommandBuf;
     UINT curCommandOffset;
     D3DDDI_PATCHLOCATIONLIST * pPatchLocationList;
 
     // TODO: How should we deal with getting called when a shader is not in a good state?
-    assert(pComputeShader->m_image != nullptr);
+    ID3DBlob * pImage = pComputeShader->GetImage();
+    assert(pImage != nullptr);
 
     //
     // State setup and Dispatch command have to be in the same command buffer, so the space for them
     // in the command buffer is reserved at once
     //
+    // Space for the shader image load is always reserved since the reservation can move on to a
+    // new command buffer, which won't have the image yet
+    //
 
     hwRootSignatureSetCommandSize = commandSize = pRootSignature->GetHwRootSignatureSize(&numPatchLocations);
-    commandSize += sizeof(GpuHwComputeShaderDisptch) + pComputeShader->m_image->GetBufferSize();
+    imageLoadCommandSize = sizeof(GpuHwShaderImageLoad) + (UINT)pImage->GetBufferSize();
+    commandSize += imageLoadCommandSize + sizeof(GpuHwComputeShaderDisptch);
 
     ReserveCommandBufferSpace(
         false,                          // HW command
@@ -409,19 +435,83 @@ CosUmd12CommandList::Dispatch(
     }
 
     //
-    // Write the Root Signature into the command list
+    // The KMD keeps the root registers for the rest of the command buffer, once the Root Signature
+    // has been set in this command buffer only the registers of the changed root parameters are sent.
+    // The update is skipped entirely when no root parameter changed.
     //
 
-    pRootSignature->WriteHWRootSignature(m_rootValues, m_pDescriptorHeaps, m_pCurCommandBuffer, pCommandBuf, curCommandOffset, pPatchLocationList);
+    dirtyRootParameters = m_dirtyRootParameters | pRootSignature->GetVolatileRootParameters();
+
+    if ((pRootSignature == m_pHwRootSignature) &&
+        (m_pCurCommandBuffer == m_pHwRootSignatureCommandBuffer) &&
+        pRootSignature->IsHwRootSignatureUpdateSupported() &&
+        (pRootSignature->GetHwRootSignatureUpdateSize(dirtyRootParameters) <= hwRootSignatureSetCommandSize))
+    {
+        D3DDDI_PATCHLOCATIONLIST * pCurPatchLocation = pPatchLocationList;
+
+        hwRootSignatureSetCommandSize = 0;
+
+        if (dirtyRootParameters)
+        {
+            hwRootSignatureSetCommandSize = pRootSignature->WriteHWRootSignatureUpdate(
+                                                m_rootValues,
+                                                m_pDescriptorHeaps,
+                                                m_pCurCommandBuffer,
+                                                pCommandBuf,
+                                                curCommandOffset,
+                                                dirtyRootParameters,
+                                                pCurPatchLocation);
+        }
+
+        numPatchLocationsUsed = (UINT)(pCurPatchLocation - pPatchLocationList);
+    }
+    else
+    {
+        //
+        // Write the Root Signature into the command list
+        //
+
+        pRootSignature->WriteHWRootSignature(m_rootValues, m_pDescriptorHeaps, m_pCurCommandBuffer, pCommandBuf, curCommandOffset, pPatchLocationList);
+
+        numPatchLocationsUsed = numPatchLocations;
+
+        m_pHwRootSignature = pRootSignature;
+        m_pHwRootSignatureCommandBuffer = m_pCurCommandBuffer;
+    }
+
+    m_dirtyRootParameters = 0;
+
+    //
+    // Send the shader image only the first time it is used in this command buffer
+    //
+
+    if (m_pCurCommandBuffer->IsShaderImageLoaded(pComputeShader->m_shaderCodeHash))
+    {
+        imageLoadCommandSize = 0;
+    }
+    else
+    {
+        GpuHwShaderImageLoad * pImageLoad = (GpuHwShaderImageLoad *)(pCommandBuf + hwRootSignatureSetCommandSize);
+
+        pImageLoad->m_commandId = ShaderImageLoad;
+        pImageLoad->m_commandSize = imageLoadCommandSize;
+
+        memcpy(pImageLoad->m_ShaderHash, pComputeShader->m_shaderCodeHash.Hash, sizeof(pImageLoad->m_ShaderHash));
+        memcpy(pImageLoad + 1, pImage->GetBufferPointer(), pImage->GetBufferSize());
+
+        m_pCurCommandBuffer->RecordShaderImageLoad(pComputeShader->m_shaderCodeHash);
+    }
+
+    commandSize = hwRootSignatureSetCommandSize + imageLoadCommandSize + sizeof(GpuHwComputeShaderDisptch);
 
     //
     // Write Dispatch command into the Command List
     //
 
-    GpuHwComputeShaderDisptch * pCSDispath = (GpuHwComputeShaderDisptch *)(pCommandBuf + hwRootSignatureSetCommandSize);
+    GpuHwComputeShaderDisptch * pCSDispath = (GpuHwComputeShaderDisptch *)(pCommandBuf + hwRootSignatureSetCommandSize + imageLoadCommandSize);
 
     pCSDispath->m_commandId = ComputeShaderDispatch;
-    pCSDispath->m_commandSize = commandSize - hwRootSignatureSetCommandSize;
+    pCSDispath->m_commandSize = sizeof(GpuHwComputeShaderDisptch);
 
     //
     // TODO: Retrieve num threads per group from shader
@@ -435,13 +525,226 @@ CosUmd12CommandList::Dispatch(
     pCSDispath->m_threadGroupCountZ = ThreadGroupCountZ;
 
     memcpy(pCSDispath->m_ShaderHash, pComputeShader->m_shaderCodeHash.Hash, sizeof(pCSDispath->m_ShaderHash));
-    memcpy(pCSDispath + 1, pComputeShader->m_image->GetBufferPointer(), pComputeShader->m_image->GetBufferSize());
 
     //
     // Commit both commands into the command buffer
     //
 
-    m_pCurCommandBuffer->CommitCommandBufferSpace(commandSize, numPatchLocations);
+    m_pCurCommandBuffer->CommitCommandBufferSpace(commandSize, numPatchLocationsUsed);
+}
+
+#if COS_MLMC_RS5_SUPPORT && !COS_RS_2LEVEL_SUPPORT
+
+//
+// Index of an io table field in MlMetaCommandRecord::m_bindings
+//
+
+#define COS_ML_BINDING_INDEX(TExecuteDesc, field)    (FIELD_OFFSET(TExecuteDesc, field)/sizeof(D3D12_GPU_DESCRIPTOR_HANDLE))
+
+void
+CosUmd12CommandList::RecordMlMetaCommand(
+    GpuHwMetaCommand *                  pHwMetaCommand,
+    const D3D12_GPU_DESCRIPTOR_HANDLE * pIoTable,
+    UINT                                numBindings)
+{
+    switch (pHwMetaCommand->m_metaCommandId)
+    {
+    case MetaCommandConvolution:
+    case MetaCommandGEMM:
+    case MetaCommandNormalization:
+        break;
+    default:
+        return;
+    }
+
+    if ((kMaxMlMetaCommandRecords == m_numMlMetaCommandRecords) ||
+        (numBindings > kMaxMlMetaCommandBindings))
+    {
+        return;
+    }
+
+    MlMetaCommandRecord *       pRecord = &m_mlMetaCommandRecords[m_numMlMetaCommandRecords++];
+    CosUmd12DescriptorHeap *    pUavHeap = m_pDescriptorHeaps[D3D12DDI_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV];
+
+    pRecord->m_pHwMetaCommand = pHwMetaCommand;
+    pRecord->m_pCommandBuffer = m_pCurCommandBuffer;
+
+    memset(pRecord->m_bindings, 0, sizeof(pRecord->m_bindings));
+
+    //
+    // Resolve the resources now, the descriptors can be rewritten before Close()
+    //
+
+    for (UINT i = 0; i < numBindings; i++)
+    {
+        if (pIoTable[i].ptr)
+        {
+            UINT descriptorIndex = (UINT)((pIoTable[i].ptr - pUavHeap->GetGpuAddress())/
+                                          sizeof(CosUmd12Descriptor));
+
+            CosUmd12Descriptor * pDescriptor = pUavHeap->GetCpuAddress() + descriptorIndex;
+
+            pRecord->m_bindings[i].m_pResource = pDescriptor->GetBufferUav(&pRecord->m_bindings[i].m_offset);
+        }
+    }
+}
+
+static bool
+CosUmd12IsSameTensorDesc(
+    const META_COMMAND_TENSOR_DESC *    pDesc0,
+    const META_COMMAND_TENSOR_DESC *    pDesc1)
+{
+    if ((pDesc0->DataType != pDesc1->DataType) ||
+        (pDesc0->DimensionCount != pDesc1->DimensionCount) ||
+        (pDesc0->DimensionCount > _countof(pDesc0->Size)))
+    {
+        return false;
+    }
+
+    for (UINT i = 0; i < pDesc0->DimensionCount; i++)
+    {
+        if ((pDesc0->Size[i] != pDesc1->Size[i]) ||
+            (pDesc0->Stride[i] != pDesc1->Stride[i]))
+        {
+            return false;
+        }
+    }
+
+    return true;
 }
 
+//
+// The fused packet interleaves the two meta commands row by row, so the
+// Normalization must read exactly the producer's output, must not read
+// anything else the producer writes and must not write anything the
+// producer reads. Normalizing the producer's output in place is allowed.
+//
+
+bool
+CosUmd12CommandList::CanFuseMlMetaCommands(
+    const MlMetaCommandRecord * pProducer,
+    const MlMetaCommandRecord * pNormalization)
+{
+    GpuHwMetaCommand *  pProducerCommand = pProducer->m_pHwMetaCommand;
+    GpuHwMetaCommand *  pNormalizationCommand = pNormalization->m_pHwMetaCommand;
+
+    if ((MetaCommandNormalization != pNormalizationCommand->m_metaCommandId) ||
+        (pProducer->m_pCommandBuffer != pNormalization->m_pCommandBuffer) ||
+        (((BYTE *)pProducerCommand) + pProducerCommand->m_commandSize != (BYTE *)pNormalizationCommand))
+    {
+        return false;
+    }
+
+    const META_COMMAND_TENSOR_DESC *    pProducerOut;
+    UINT                                producerOutIndex;
+
+    switch (pProducerCommand->m_metaCommandId)
+    {
+    case MetaCommandConvolution:
+        {
+            META_COMMAND_CREATE_CONVOLUTION_DESC * pCreateDesc = (META_COMMAND_CREATE_CONVOLUTION_DESC *)(pProducerCommand + 1);
+
+            if ((META_COMMAND_CONVOLUTION_DIRECTION_FORWARD != pCreateDesc->Direction) ||
+                (2 != pCreateDesc->DimensionCount))
+            {
+                return false;
+            }
+
+            pProducerOut = &pCreateDesc->DescOut;
+            producerOutIndex = COS_ML_BINDING_INDEX(META_COMMAND_EXECUTE_CONVOLUTION_DESC, OutputResource);
+        }
+        break;
+    case MetaCommandGEMM:
+        {
+            META_COMMAND_CREATE_GEMM_DESC * pCreateDesc = (META_COMMAND_CREATE_GEMM_DESC *)(pProducerCommand + 1);
+
+            pProducerOut = &pCreateDesc->DescOut;
+            producerOutIndex = COS_ML_BINDING_INDEX(META_COMMAND_EXECUTE_GEMM_DESC, OutputResource);
+        }
+        break;
+    default:
+        return false;
+    }
+
+    META_COMMAND_CREATE_NORMALIZATION_DESC * pNormalizationDesc = (META_COMMAND_CREATE_NORMALIZATION_DESC *)(pNormalizationCommand + 1);
+
+    const MlMetaCommandBinding * pIntermediate = &pProducer->m_bindings[producerOutIndex];
+    const MlMetaCommandBinding * pNormalizationIn = &pNormalization->m_bindings[COS_ML_BINDING_INDEX(META_COMMAND_EXECUTE_NORMALIZATION_DESC, InputResource)];
+    const MlMetaCommandBinding * pNormalizationOut = &pNormalization->m_bindings[COS_ML_BINDING_INDEX(META_COMMAND_EXECUTE_NORMALIZATION_DESC, OutputResource)];
+
+    if ((NULL == pIntermediate->m_pResource) ||
+        (pIntermediate->m_pResource != pNormalizationIn->m_pResource) ||
+        (pIntermediate->m_offset != pNormalizationIn->m_offset) ||
+        !CosUmd12IsSameTensorDesc(pProducerOut, &pNormalizationDesc->DescIn) ||
+        (pNormalizationDesc->DescOut.DimensionCount != pNormalizationDesc->DescIn.DimensionCount))
+    {
+        return false;
+    }
+
+    for (UINT i = 0; i < pNormalizationDesc->DescIn.DimensionCount; i++)
+    {
+        if (pNormalizationDesc->DescOut.Size[i] != pNormalizationDesc->DescIn.Size[i])
+        {
+            return false;
+        }
+    }
+
+    if ((pNormalizationOut->m_pResource == pIntermediate->m_pResource) &&
+        ((pNormalizationOut->m_offset != pIntermediate->m_offset) ||
+         !CosUmd12IsSameTensorDesc(&pNormalizationDesc->DescOut, &pNormalizationDesc->DescIn)))
+    {
+        return false;
+    }
+
+    for (UINT i = 0; i < kMaxMlMetaCommandBindings; i++)
+    {
+        if ((i != producerOutIndex) &&
+            (NULL != pProducer->m_bindings[i].m_pResource) &&
+            (pProducer->m_bindings[i].m_pResource == pNormalizationOut->m_pResource))
+        {
+            return false;
+        }
+
+        if ((&pNormalization->m_bindings[i] != pNormalizationIn) &&
+            (&pNormalization->m_bindings[i] != pNormalizationOut) &&
+            (pNormalization->m_bindings[i].m_pResource == pIntermediate->m_pResource))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+//
+// Rewrites the header of every fusable producer packet, the packets
+// themselves and their patch locations do not move
+//
+
+void
+CosUmd12CommandList::FuseMlMetaCommands()
+{
+    for (UINT i = 1; i < m_numMlMetaCommandRecords; i++)
+    {
+        MlMetaCommandRecord * pProducer = &m_mlMetaCommandRecords[i - 1];
+        MlMetaCommandRecord * pNormalization = &m_mlMetaCommandRecords[i];
+
+        if (!CanFuseMlMetaCommands(pProducer, pNormalization))
+        {
+            continue;
+        }
+
+        GpuHwMetaCommand * pProducerCommand = pProducer->m_pHwMetaCommand;
+
+        pProducerCommand->m_metaCommandId = (MetaCommandConvolution == pProducerCommand->m_metaCommandId) ?
+                                                MetaCommandConvolutionNormalization :
+                                                MetaCommandGEMMNormalization;
+        pProducerCommand->m_commandSize += pNormalization->m_pHwMetaCommand->m_commandSize;
+    }
+
+    m_numMlMetaCommandRecords = 0;
+}
+
+#endif
+
 #endif // !COS_GPUVA_SUPPORT
@@ -18,6 +18,12 @@ public:
         memset(m_pDescriptorHeaps, 0, sizeof(m_pDescriptorHeaps));
         m_pCommandPool = NULL;
         m_numFilledCommandBuffers = 0;
+        m_dirtyRootParameters = ~0ull;
+        m_pHwRootSignature = NULL;
+        m_pHwRootSignatureCommandBuffer = NULL;
+#if COS_MLMC_RS5_SUPPORT && !COS_RS_2LEVEL_SUPPORT
+        m_numMlMetaCommandRecords = 0;
+#endif
     }
 
     ~CosUmd12CommandList()
@@ -275,6 +281,10 @@ public:
 
         // Commit the command into command buffer
         m_pCurCommandBuffer->CommitCommandBufferSpace(commandSize, numPatchLocationsUsed);
+
+#if COS_MLMC_RS5_SUPPORT
+        RecordMlMetaCommand(pMetaCommand, (D3D12_GPU_DESCRIPTOR_HANDLE *)pHwIoTable, numPatchLocations);
+#endif
     }
 
 #endif
@@ -296,6 +306,27 @@ private:
 
     BYTE m_rootValues[SIZE_ROOT_SIGNATURE];
 
+    //
+    // One bit per root parameter changed since the last dispatch, and the Root Signature
+    // last sent in full to the KMD together with the command buffer it was sent in
+    //
+
+    UINT64 m_dirtyRootParameters;
+    CosUmd12RootSignature * m_pHwRootSignature;
+    CosUmd12CommandBuffer * m_pHwRootSignatureCommandBuffer;
+
+    void MarkRootParameterDirty(UINT rootParameterIndex)
+    {
+        //
+        // Root Signatures with more parameters always send the full Root Signature
+        //
+
+        if (rootParameterIndex < 64)
+        {
+            m_dirtyRootParameters |= 1ull << rootParameterIndex;
+        }
+    }
+
     CosUmd12CommandPool * m_pCommandPool;
 
     CosUmd12CommandBuffer * m_pCurCommandBuffer;
@@ -303,6 +334,48 @@ private:
     UINT m_numFilledCommandBuffers;
     CosUmd12CommandBuffer * m_filledCommandBuffers[COS_MAX_NUM_COMMAND_BUFFERS];
 
+#if COS_MLMC_RS5_SUPPORT && !COS_RS_2LEVEL_SUPPORT
+
+    //
+    // Convolution, GEMM and Normalization packets are remembered until Close(),
+    // where a Convolution or GEMM directly followed by a Normalization of its
+    // output is fused into a single packet (see MetaCommandConvolutionNormalization)
+    //
+
+    static const UINT kMaxMlMetaCommandRecords = 256;
+    static const UINT kMaxMlMetaCommandBindings = 8;
+
+    struct MlMetaCommandBinding
+    {
+        CosUmd12Resource *  m_pResource;    // NULL if not bound to a buffer UAV
+        UINT64              m_offset;
+    };
+
+    struct MlMetaCommandRecord
+    {
+        GpuHwMetaCommand *      m_pHwMetaCommand;
+        CosUmd12CommandBuffer * m_pCommandBuffer;
+        MlMetaCommandBinding    m_bindings[kMaxMlMetaCommandBindings];  // In THwIoTable order
+    };
+
+    UINT m_numMlMetaCommandRecords;
+    MlMetaCommandRecord m_mlMetaCommandRecords[kMaxMlMetaCommandRecords];
+
+    void
+    RecordMlMetaCommand(
+        GpuHwMetaCommand *                  pHwMetaCommand,
+        const D3D12_GPU_DESCRIPTOR_HANDLE * pIoTable,
+        UINT                                numBindings);
+
+    bool
+    CanFuseMlMetaCommands(
+        const MlMetaCommandRecord * pProducer,
+        const MlMetaCommandRecord * pNormalization);
+
+    void FuseMlMetaCommands();
+
+#endif
+
     void
     ReserveCommandBufferSpace(
         bool                        bSwCommand,
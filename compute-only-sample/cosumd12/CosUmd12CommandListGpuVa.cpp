@@ -289,21 +289,27 @@ CosUmd12CommandList::Dispatch(
 {
     CosUmd12RootSignature * pRootSignature = CosUmd12RootSignature::CastFrom(m_pPipelineState->m_args.hRootSignature);
     CosUmd12Shader * pComputeShader = CosUmd12Shader::CastFrom(m_pPipelineState->m_args.hComputeShader);
-    UINT commandSize, hwRootSignatureSetCommandSize;
-    UINT numPatchLocations;
+    UINT commandSize, hwRootSignatureSetCommandSize, imageLoadCommandSize, dispatchCommandSize;
+    UINT numUavBindings;
     BYTE * pCommandBuf;
-    UINT curCommandOffset;
-    D3DDDI_PATCHLOCATIONLIST * pPatchLocationList;
 
     // TODO : Disallow Dispatch without Descriptor Heap
 
+    // TODO: How should we deal with getting called when a shader is not in a good state?
+    ID3DBlob * pImage = pComputeShader->GetImage();
+    assert(pImage != nullptr);
+
     //
     // State setup and Dispatch command have to be in the same command buffer, so the space for them
     // in the command buffer is reserved at once
     //
+    // Space for the shader image load is always reserved since the reservation can move on to a
+    // new command buffer, which won't have the image yet
+    //
 
     hwRootSignatureSetCommandSize = commandSize = pRootSignature->GetHwRootSignatureSize();
-    commandSize += sizeof(GpuHwComputeShaderDisptch) + pComputeShader->m_args.pShaderCode[1]*sizeof(UINT);
+    imageLoadCommandSize = sizeof(GpuHwShaderImageLoad) + (UINT)pImage->GetBufferSize();
+    commandSize += imageLoadCommandSize + sizeof(GpuHwComputeShaderDisptch) + sizeof(GpuHwUavBinding)*COS_MAX_HW_UAV_BINDINGS;
 
     ReserveCommandBufferSpace(
         commandSize,
@@ -320,30 +326,57 @@ CosUmd12CommandList::Dispatch(
     pRootSignature->WriteHWRootSignature(m_rootValues, m_pDescriptorHeaps, pCommandBuf);
 
     //
-    // Write Dispatch command into the Command List
+    // Send the shader image only the first time it is used in this command buffer
+    //
+
+    if (m_pCurCommandBuffer->IsShaderImageLoaded(pComputeShader->m_shaderCodeHash))
+    {
+        imageLoadCommandSize = 0;
+    }
+    else
+    {
+        GpuHwShaderImageLoad * pImageLoad = (GpuHwShaderImageLoad *)(pCommandBuf + hwRootSignatureSetCommandSize);
+
+        pImageLoad->m_commandId = ShaderImageLoad;
+        pImageLoad->m_commandSize = imageLoadCommandSize;
+
+        memcpy(pImageLoad->m_ShaderHash, pComputeShader->m_shaderCodeHash.Hash, sizeof(pImageLoad->m_ShaderHash));
+        memcpy(pImageLoad + 1, pImage->GetBufferPointer(), pImage->GetBufferSize());
+
+        m_pCurCommandBuffer->RecordShaderImageLoad(pComputeShader->m_shaderCodeHash);
+    }
+
+    //
+    // Write Dispatch command into the Command List, followed by the UAVs it binds
     //
 
-    GpuHwComputeShaderDisptch * pCSDispath = (GpuHwComputeShaderDisptch *)(pCommandBuf + hwRootSignatureSetCommandSize);
+    GpuHwComputeShaderDisptch * pCSDispath = (GpuHwComputeShaderDisptch *)(pCommandBuf + hwRootSignatureSetCommandSize + imageLoadCommandSize);
+
+    numUavBindings = pRootSignature->WriteHwUavBindings(m_rootValues, m_pDescriptorHeaps, (GpuHwUavBinding *)(pCSDispath + 1));
+    dispatchCommandSize = sizeof(GpuHwComputeShaderDisptch) + sizeof(GpuHwUavBinding)*numUavBindings;
 
     pCSDispath->m_commandId = ComputeShaderDispatch;
-    pCSDispath->m_commandSize = commandSize - hwRootSignatureSetCommandSize;
+    pCSDispath->m_commandSize = dispatchCommandSize;
 
     //
     // TODO: Retrieve num threads per group from shader
     //
 
-    pCSDispath->m_numThreadPerGroup = 4;
+    pCSDispath->m_threadCountX = 4;
+    pCSDispath->m_threadCountY = 1;
+    pCSDispath->m_threadCountZ = 1;
     pCSDispath->m_threadGroupCountX = ThreadGroupCountX;
     pCSDispath->m_threadGroupCountY = ThreadGroupCountY;
     pCSDispath->m_threadGroupCountZ = ThreadGroupCountZ;
 
-    memcpy(pCSDispath->m_ShaderHash, pComputeShader->m_args.ShaderCodeHash.Hash, sizeof(pCSDispath->m_ShaderHash));
-    memcpy(pCSDispath + 1, pComputeShader->m_args.pShaderCode, pComputeShader->m_args.pShaderCode[1] * sizeof(UINT));
+    memcpy(pCSDispath->m_ShaderHash, pComputeShader->m_shaderCodeHash.Hash, sizeof(pCSDispath->m_ShaderHash));
 
     //
-    // Commit both commands into the command buffer
+    // Commit all commands into the command buffer
     //
 
+    commandSize = hwRootSignatureSetCommandSize + imageLoadCommandSize + dispatchCommandSize;
+
     m_pCurCommandBuffer->CommitCommandBufferSpace(commandSize);
 }
 
@@ -2,19 +2,158 @@
 //
 // Command Pool implementation
 //
+// Command buffers released by a Command List are retired to the pool and reused once the GPU is done with them, so
+// recording does not allocate once the pool holds the working set of its Command Lists
+//
 // Copyright (C) Microsoft Corporation
 //
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 #include "CosUmd12.h"
 
+#include <stdio.h>
+
+UINT g_commandPoolHighWaterMark = 64;
+
+CosUmd12CommandPool::~CosUmd12CommandPool()
+{
+    //
+    // D3D12 requires the GPU to be done with the command lists of the pool
+    //
+
+    FreeCommandBufferList(m_pFreeBuffers);
+    FreeCommandBufferList(m_pRetiredBuffers);
+}
+
 //
-// TODO: Support Reset and proper Command Buffer reuse behavior
+// Called by ResetCommandAllocator(), which D3D12 only allows after the GPU has
+// finished all command lists recorded from the pool
 //
 
+void
+CosUmd12CommandPool::Reset()
+{
+    ReclaimRetiredBuffers(true);
+
+    while (m_numFreeBuffers > m_highWaterMark)
+    {
+        CosUmd12CommandBuffer * pCommandBuffer = m_pFreeBuffers;
+
+        m_pFreeBuffers = pCommandBuffer->m_pNextPooled;
+        m_numFreeBuffers--;
+
+        DestroyCommandBuffer(pCommandBuffer);
+
+        m_frameStats.m_numFrees++;
+    }
+
+#if _DEBUG
+    if (m_frameStats.m_numAllocations)
+    {
+        char output[256];
+
+        snprintf(
+            output,
+            sizeof(output),
+            "Command pool %p allocated %u command buffers (%u reused, %u freed)\n",
+            this,
+            m_frameStats.m_numAllocations,
+            m_frameStats.m_numReuses,
+            m_frameStats.m_numFrees);
+
+        OutputDebugStringA(output);
+    }
+#endif
+
+    m_lastFrameStats = m_frameStats;
+    memset(&m_frameStats, 0, sizeof(m_frameStats));
+}
+
 CosUmd12CommandBuffer *
 CosUmd12CommandPool::AcquireCommandBuffer(
     D3D12DDI_COMMAND_QUEUE_FLAGS queueFlags)
+{
+    if (NULL == m_pFreeBuffers)
+    {
+        ReclaimRetiredBuffers(false);
+    }
+
+    CosUmd12CommandBuffer * pCommandBuffer = m_pFreeBuffers;
+
+    if (pCommandBuffer)
+    {
+        m_pFreeBuffers = pCommandBuffer->m_pNextPooled;
+        m_numFreeBuffers--;
+
+        pCommandBuffer->m_pNextPooled = NULL;
+        pCommandBuffer->Reset();
+
+        m_frameStats.m_numReuses++;
+
+        return pCommandBuffer;
+    }
+
+    //
+    // Every command buffer of the pool is in use or still executing
+    //
+
+    pCommandBuffer = CreateCommandBuffer();
+    if (pCommandBuffer)
+    {
+        m_frameStats.m_numAllocations++;
+    }
+
+    return pCommandBuffer;
+}
+
+void
+CosUmd12CommandPool::ReleaseCommandBuffer(CosUmd12CommandBuffer * pCommandBuffer)
+{
+    if (pCommandBuffer->IsIdle())
+    {
+        pCommandBuffer->m_pNextPooled = m_pFreeBuffers;
+        m_pFreeBuffers = pCommandBuffer;
+        m_numFreeBuffers++;
+    }
+    else
+    {
+        pCommandBuffer->m_pNextPooled = m_pRetiredBuffers;
+        m_pRetiredBuffers = pCommandBuffer;
+    }
+}
+
+//
+// Moves retired command buffers whose last submission has completed to the
+// free list, bAll when the caller knows the GPU is done with all of them
+//
+
+void
+CosUmd12CommandPool::ReclaimRetiredBuffers(
+    bool bAll)
+{
+    CosUmd12CommandBuffer ** ppLink = &m_pRetiredBuffers;
+
+    while (*ppLink)
+    {
+        CosUmd12CommandBuffer * pCommandBuffer = *ppLink;
+
+        if (bAll || pCommandBuffer->IsIdle())
+        {
+            *ppLink = pCommandBuffer->m_pNextPooled;
+
+            pCommandBuffer->m_pNextPooled = m_pFreeBuffers;
+            m_pFreeBuffers = pCommandBuffer;
+            m_numFreeBuffers++;
+        }
+        else
+        {
+            ppLink = &pCommandBuffer->m_pNextPooled;
+        }
+    }
+}
+
+CosUmd12CommandBuffer *
+CosUmd12CommandPool::CreateCommandBuffer()
 {
 #if COS_GPUVA_SUPPORT
 
@@ -28,10 +167,12 @@ CosUmd12CommandPool::AcquireCommandBuffer(
 }
 
 void
-CosUmd12CommandPool::ReleaseCommandBuffer(CosUmd12CommandBuffer * pCommandBuffer)
+CosUmd12CommandPool::DestroyCommandBuffer(CosUmd12CommandBuffer * pCommandBuffer)
 {
 #if COS_GPUVA_SUPPORT
 
+    pCommandBuffer->Teardown();
+
     delete pCommandBuffer;
 
 #else
@@ -40,3 +181,16 @@ CosUmd12CommandPool::ReleaseCommandBuffer(CosUmd12CommandBuffer * pCommandBuffer
 
 #endif
 }
+
+void
+CosUmd12CommandPool::FreeCommandBufferList(CosUmd12CommandBuffer * pCommandBuffers)
+{
+    while (pCommandBuffers)
+    {
+        CosUmd12CommandBuffer * pCommandBuffer = pCommandBuffers;
+
+        pCommandBuffers = pCommandBuffer->m_pNextPooled;
+
+        DestroyCommandBuffer(pCommandBuffer);
+    }
+}
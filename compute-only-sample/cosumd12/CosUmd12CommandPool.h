@@ -4,6 +4,24 @@
 
 class CosUmd12CommandBuffer;
 
+//
+// Number of idle command buffers a Command Pool keeps across Reset(), can be
+// changed from the debugger
+//
+
+extern UINT g_commandPoolHighWaterMark;
+
+//
+// Command buffer counters of a Command Pool between two Reset() calls
+//
+
+struct CosUmd12CommandPoolStats
+{
+    UINT    m_numAllocations;       // New command buffers created
+    UINT    m_numReuses;            // Command buffers recycled from the pool
+    UINT    m_numFrees;             // Idle command buffers freed above the high-water mark
+};
+
 class CosUmd12CommandPool
 {
 public:
@@ -11,17 +29,21 @@ public:
     {
         m_pDevice = pDevice;
         m_args = *pArgs;
-    }
 
-    ~CosUmd12CommandPool()
-    {
-    }
+        m_pFreeBuffers = NULL;
+        m_numFreeBuffers = 0;
+        m_pRetiredBuffers = NULL;
 
-    void Reset()
-    {
-        // do nothing
+        m_highWaterMark = g_commandPoolHighWaterMark;
+
+        memset(&m_frameStats, 0, sizeof(m_frameStats));
+        memset(&m_lastFrameStats, 0, sizeof(m_lastFrameStats));
     }
 
+    ~CosUmd12CommandPool();
+
+    void Reset();
+
     static int CalculateSize(const D3D12DDIARG_CREATE_COMMAND_POOL_0040 * pArgs)
     {
         return sizeof(CosUmd12CommandPool);
@@ -36,11 +58,49 @@ public:
     CosUmd12CommandBuffer * AcquireCommandBuffer(D3D12DDI_COMMAND_QUEUE_FLAGS queueFlags);
     void ReleaseCommandBuffer(CosUmd12CommandBuffer * pCommandBuffer);
 
+    void SetHighWaterMark(UINT highWaterMark)
+    {
+        m_highWaterMark = highWaterMark;
+    }
+
+    //
+    // Counters of the last completed Reset() interval, m_numAllocations stays
+    // 0 once the pool covers the working set of the recorded command lists
+    //
+
+    const CosUmd12CommandPoolStats & GetLastFrameStats() const
+    {
+        return m_lastFrameStats;
+    }
+
 private:
 
+    CosUmd12CommandBuffer * CreateCommandBuffer();
+    void DestroyCommandBuffer(CosUmd12CommandBuffer * pCommandBuffer);
+    void ReclaimRetiredBuffers(bool bAll);
+
+    void FreeCommandBufferList(CosUmd12CommandBuffer * pCommandBuffers);
+
     CosUmd12Device * m_pDevice;
     D3D12DDIARG_CREATE_COMMAND_POOL_0040 m_args;
 
+    //
+    // Idle command buffers ready for reuse
+    //
+
+    CosUmd12CommandBuffer * m_pFreeBuffers;
+    UINT m_numFreeBuffers;
+
+    //
+    // Command buffers released by a Command List that may still be executing
+    //
+
+    CosUmd12CommandBuffer * m_pRetiredBuffers;
+
+    UINT m_highWaterMark;
+
+    CosUmd12CommandPoolStats m_frameStats;
+    CosUmd12CommandPoolStats m_lastFrameStats;
 };
 
 inline CosUmd12CommandPool* CosUmd12CommandPool::CastFrom(D3D12DDI_HCOMMANDPOOL_0040 hCommandPool)
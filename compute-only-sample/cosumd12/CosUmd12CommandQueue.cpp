@@ -10,6 +10,13 @@
 
 #if !COS_GPUVA_SUPPORT
 
+//
+// Compute queues created by this process so far, they are spread across the
+// compute nodes round robin
+//
+
+static volatile LONG s_numComputeQueues = 0;
+
 HRESULT 
 CosUmd12CommandQueue::Standup()
 {
@@ -17,7 +24,28 @@ CosUmd12CommandQueue::Standup()
 
     ZeroMemory(&m_createContext, sizeof(m_createContext));
 
-    m_createContext.NodeOrdinal = 0;
+    //
+    // Copy queues run on the copy node so uploads overlap with compute work,
+    // the VidSch orders fences between the nodes.
+    //
+    // Other queues go round robin to the compute nodes, starting from a node
+    // picked by the process id so that processes don't all queue up behind
+    // each other on the first one.
+    //
+
+    if (m_args.QueueFlags & D3D12DDI_COMMAND_QUEUE_FLAG_COPY)
+    {
+        m_createContext.NodeOrdinal = C_COS_COPY_NODE_ORDINAL;
+    }
+    else
+    {
+        UINT queueIndex = (UINT)InterlockedIncrement(&s_numComputeQueues) - 1;
+
+        m_createContext.NodeOrdinal = C_COS_COMPUTE_NODE_ORDINAL + (GetCurrentProcessId() + queueIndex) % C_COS_COMPUTE_NODE_COUNT;
+    }
+
+    cosContextExchange.m_priority = (m_args.Priority >= D3D12_COMMAND_QUEUE_PRIORITY_HIGH) ? CosContextPriorityHigh : CosContextPriorityNormal;
+
     m_createContext.EngineAffinity = 1;
     m_createContext.Flags.Value = 0;
     m_createContext.pPrivateDriverData = &cosContextExchange;
@@ -17,12 +17,14 @@ CosUmd12CommandQueue::Standup()
 
     ZeroMemory(&m_createContext, sizeof(m_createContext));
 
-    m_createContext.NodeOrdinal = 0;
+    m_createContext.NodeOrdinal = C_COS_COMPUTE_NODE_ORDINAL;
     m_createContext.EngineAffinity = 1;
     m_createContext.Flags.Value = 0;
     m_createContext.pPrivateDriverData = &cosContextExchange;
     m_createContext.PrivateDriverDataSize = sizeof(cosContextExchange);
 
+    cosContextExchange.m_priority = (m_args.Priority >= D3D12_COMMAND_QUEUE_PRIORITY_HIGH) ? CosContextPriorityHigh : CosContextPriorityNormal;
+
     HRESULT hr;
 
     //
@@ -30,13 +32,29 @@ CosUmd12CommandQueue::Standup()
     //
 
     hr = m_pDevice->m_pUMCallbacks->pfnCreateContextVirtualCb(m_hRTCommandQueue, &m_createContext);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    m_pSubmissionFence = CosUmd12SubmissionFence::Create(m_pDevice, m_createContext.hContext);
+    if (NULL == m_pSubmissionFence)
+    {
+        return E_OUTOFMEMORY;
+    }
 
-    return hr;
+    return S_OK;
 }
 
 void
 CosUmd12CommandQueue::Teardown()
 {
+    if (m_pSubmissionFence)
+    {
+        m_pSubmissionFence->Release();
+        m_pSubmissionFence = NULL;
+    }
+
     if (NULL == m_createContext.hContext)
     {
         return;
@@ -66,6 +84,17 @@ CosUmd12CommandQueue::ExecuteCommandLists(
 
         pCommandList->Execute(this);
     }
+
+    //
+    // Retire the command buffers submitted above
+    //
+
+    HRESULT hr;
+
+    hr = m_pSubmissionFence->Signal(m_createContext.hContext, GetPendingFenceValue());
+    ASSERT(S_OK == hr);
+
+    m_lastSubmissionFenceValue++;
 }
 
 HRESULT
@@ -96,5 +125,71 @@ CosUmd12CommandQueue::ExecuteCommandBuffer(
     return m_pDevice->m_pKMCallbacks->pfnSubmitCommandCb(m_pDevice->m_hRTDevice.handle, &submitCommand);
 }
 
+CosUmd12SubmissionFence *
+CosUmd12SubmissionFence::Create(
+    CosUmd12Device *    pDevice,
+    HANDLE              hContext)
+{
+    D3DDDICB_CREATESYNCHRONIZATIONOBJECT2 createSyncObject;
+
+    ZeroMemory(&createSyncObject, sizeof(createSyncObject));
+
+    createSyncObject.hContext = hContext;
+    createSyncObject.Info.Type = D3DDDI_MONITORED_FENCE;
+    createSyncObject.Info.MonitoredFence.InitialFenceValue = 0;
+
+    HRESULT hr;
+
+    hr = pDevice->m_pKMCallbacks->pfnCreateSynchronizationObject2Cb(pDevice->m_hRTDevice.handle, &createSyncObject);
+    if (FAILED(hr))
+    {
+        return NULL;
+    }
+
+    return new CosUmd12SubmissionFence(pDevice, &createSyncObject);
+}
+
+CosUmd12SubmissionFence::CosUmd12SubmissionFence(
+    CosUmd12Device *                                pDevice,
+    const D3DDDICB_CREATESYNCHRONIZATIONOBJECT2 *   pSyncObject)
+{
+    m_pDevice = pDevice;
+    m_hSyncObject = pSyncObject->hSyncObject;
+    m_pCompletedFenceValue = (volatile UINT64 *)pSyncObject->Info.MonitoredFence.FenceValueCPUVirtualAddress;
+    m_refCount = 1;
+}
+
+void
+CosUmd12SubmissionFence::Release()
+{
+    if (InterlockedDecrement(&m_refCount))
+    {
+        return;
+    }
+
+    D3DDDICB_DESTROYSYNCHRONIZATIONOBJECT destroySyncObject;
+
+    destroySyncObject.hSyncObject = m_hSyncObject;
+
+    m_pDevice->m_pKMCallbacks->pfnDestroySynchronizationObjectCb(m_pDevice->m_hRTDevice.handle, &destroySyncObject);
+
+    delete this;
+}
+
+HRESULT
+CosUmd12SubmissionFence::Signal(
+    HANDLE  hContext,
+    UINT64  fenceValue)
+{
+    D3DDDICB_SIGNALSYNCHRONIZATIONOBJECTFROMGPU signalFromGpu = { 0 };
+
+    signalFromGpu.hContext = hContext;
+    signalFromGpu.ObjectCount = 1;
+    signalFromGpu.ObjectHandleArray = &m_hSyncObject;
+    signalFromGpu.MonitoredFenceValueArray = &fenceValue;
+
+    return m_pDevice->m_pKMCallbacks->pfnSignalSynchronizationObjectFromGpuCb(m_pDevice->m_hRTDevice.handle, &signalFromGpu);
+}
+
 #endif  // COS_GPUVA_SUPPORT
 
@@ -2,6 +2,42 @@
 
 class CosUmd12Device;
 
+//
+// Monitored fence signaled by a Command Queue after every ExecuteCommandLists()
+//
+// Executed command buffers hold a reference so the fence stays readable until
+// the Command Pool has reclaimed them, even if the queue is destroyed first.
+//
+
+class CosUmd12SubmissionFence
+{
+public:
+    static CosUmd12SubmissionFence * Create(CosUmd12Device * pDevice, HANDLE hContext);
+
+    void AddRef()
+    {
+        InterlockedIncrement(&m_refCount);
+    }
+
+    void Release();
+
+    HRESULT Signal(HANDLE hContext, UINT64 fenceValue);
+
+    bool IsCompleted(UINT64 fenceValue) const
+    {
+        return *m_pCompletedFenceValue >= fenceValue;
+    }
+
+private:
+
+    CosUmd12SubmissionFence(CosUmd12Device * pDevice, const D3DDDICB_CREATESYNCHRONIZATIONOBJECT2 * pSyncObject);
+
+    CosUmd12Device *        m_pDevice;
+    D3DKMT_HANDLE           m_hSyncObject;
+    volatile UINT64 *       m_pCompletedFenceValue;
+    volatile LONG           m_refCount;
+};
+
 class CosUmd12CommandQueue
 {
 public:
@@ -10,6 +46,8 @@ public:
         m_pDevice = pDevice;
         m_args = *pArgs;
         m_hRTCommandQueue = hRTCommandQueue;
+        m_pSubmissionFence = NULL;
+        m_lastSubmissionFenceValue = 0;
     }
 
     ~CosUmd12CommandQueue()
@@ -37,6 +75,21 @@ public:
         UINT                    commandBufferLength,
         BYTE *                  pCommandBuffer);
 
+    //
+    // Command buffers executed by the current ExecuteCommandLists() are
+    // complete once the submission fence reaches GetPendingFenceValue()
+    //
+
+    CosUmd12SubmissionFence * GetSubmissionFence()
+    {
+        return m_pSubmissionFence;
+    }
+
+    UINT64 GetPendingFenceValue()
+    {
+        return m_lastSubmissionFenceValue + 1;
+    }
+
 private:
 
     CosUmd12Device * m_pDevice;
@@ -44,6 +97,9 @@ private:
     D3D12DDI_HRTCOMMANDQUEUE m_hRTCommandQueue;
 
     D3DDDICB_CREATECONTEXTVIRTUAL m_createContext;
+
+    CosUmd12SubmissionFence * m_pSubmissionFence;
+    UINT64 m_lastSubmissionFenceValue;
 };
 
 inline CosUmd12CommandQueue* CosUmd12CommandQueue::CastFrom(D3D12DDI_HCOMMANDQUEUE hRootSignature)
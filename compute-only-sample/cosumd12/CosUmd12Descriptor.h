@@ -53,6 +53,22 @@ public:
         UINT hwDescriptorOffset,
         D3DDDI_PATCHLOCATIONLIST * &pPatchLocations) const;
 
+    //
+    // Resource and byte offset of a buffer UAV, NULL for other views
+    //
+
+    CosUmd12Resource * GetBufferUav(UINT64 * pOffset) const
+    {
+        if ((COS_UAV != m_type) || (D3D12DDI_RD_BUFFER != m_uav.ResourceDimension))
+        {
+            return NULL;
+        }
+
+        *pOffset = m_uav.Buffer.FirstElement * m_uav.Buffer.StructureByteStride;
+
+        return CosUmd12Resource::CastFrom(m_uav.hDrvResource);
+    }
+
 private:
     Type    m_type;
     union
@@ -48,6 +48,31 @@ public:
 
 #endif
 
+    //
+    // Byte range of a buffer UAV and the stride the shader indexes it with
+    //
+
+    void WriteHWUavBinding(
+        GpuHwUavBinding * pUavBinding) const
+    {
+        ASSERT(COS_UAV == m_type);
+
+        UINT elementSize = m_uav.m_buffer.StructureByteStride;
+
+        if (0 == elementSize)
+        {
+            //
+            // TODO : Derive the element size of typed buffers from m_uav.m_format
+            //
+
+            elementSize = sizeof(UINT);
+        }
+
+        pUavBinding->m_gpuVa.QuadPart = m_resourceGpuAddress.QuadPart + m_uav.m_buffer.FirstElement*elementSize;
+        pUavBinding->m_sizeBytes = m_uav.m_buffer.NumElements*elementSize;
+        pUavBinding->m_elementSize = (m_uav.m_buffer.Flags & D3D12DDI_BUFFER_UAV_FLAG_RAW) ? 1 : elementSize;
+    }
+
 private:
     friend class CosUmd12RootSignature;
     friend class CosUmd12CommandList;
@@ -78,6 +78,7 @@ CosUmd12RootSignature::PrepareHWRootSignature()
     memset(&m_hwRootSignature, 0, sizeof(m_hwRootSignature));
 
     m_numRegistersToPatch = 0;
+    m_volatileRootParameters = 0;
 
     const D3D12DDI_ROOT_PARAMETER_0013 * pRootParameter = m_rootSignature.pRootParameters;
 
@@ -90,6 +91,17 @@ CosUmd12RootSignature::PrepareHWRootSignature()
             {
                 const D3D12DDI_DESCRIPTOR_RANGE_0013 * pDescriptorRange = pRootParameter->DescriptorTable.pDescriptorRanges + j;
 
+                //
+                // Descriptors are read when the table is written to the command buffer,
+                // volatile ones may change between dispatches without a new SetRootDescriptorTable
+                //
+
+                if ((pDescriptorRange->Flags & D3D12DDI_DESCRIPTOR_RANGE_FLAG_DESCRIPTORS_VOLATILE) &&
+                    (i < 64))
+                {
+                    m_volatileRootParameters |= 1ull << i;
+                }
+
                 switch (pDescriptorRange->RangeType)
                 {
                 case D3D12DDI_DESCRIPTOR_RANGE_TYPE_SRV:
@@ -159,6 +171,15 @@ CosUmd12RootSignature::PrepareHWRootSignature()
 
     m_hwRootSignature.m_commandId = RootSignatureSet;
     m_hwRootSignature.m_commandSize = GetHwRootSignatureSize(nullptr);
+
+    //
+    // KMD keeps the registers of a Root Signature that can be updated across dispatches
+    //
+
+    m_bHwUpdateSupported = (m_rootSignature.NumParameters <= 64) &&
+                           (m_hwRootSignature.m_numCbvRegisters <= COS_MAX_HW_CBV_REGISTERS) &&
+                           (m_hwRootSignature.m_numSrvRegisters <= COS_MAX_HW_SRV_REGISTERS) &&
+                           (m_hwRootSignature.m_numUavRegisters <= COS_MAX_HW_UAV_REGISTERS);
 }
 
 UINT CosUmd12RootSignature::GetHwRootSignatureSize(
@@ -196,6 +217,33 @@ void CosUmd12RootSignature::WriteHWRootDescriptor(
 #endif
 }
 
+void CosUmd12RootSignature::WriteHWDescriptorRange(
+    BYTE * pRootValues,
+    CosUmd12DescriptorHeap * pDescriptorHeaps[D3D12DDI_DESCRIPTOR_HEAP_TYPE_NUM_TYPES],
+    UINT rootParameterIndex,
+    const D3D12DDI_DESCRIPTOR_RANGE_0013 * pDescriptorRange,
+    CosUmd12CommandBuffer * pCurCommandBuffer,
+    UINT hwDescriptorOffset,
+    UINT hwDescriptorSize,
+    D3DDDI_PATCHLOCATIONLIST * &pPatchLocations)
+{
+    const CosUmd12DescriptorHeap * pDescriptorHeap = pDescriptorHeaps[D3D12DDI_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV];
+
+    UINT tableOffset = *((UINT *)(pRootValues + m_pRootValueOffsets[rootParameterIndex]));
+
+    UINT descriptorIndex = (tableOffset / sizeof(CosUmd12Descriptor)) + pDescriptorRange->OffsetInDescriptorsFromTableStart;
+
+    for (UINT k = 0; k < pDescriptorRange->NumDescriptors; k++, descriptorIndex++)
+    {
+        const CosUmd12Descriptor * pDescriptor = pDescriptorHeap->m_pDescriptors + descriptorIndex;
+
+        pDescriptor->WriteHWDescriptor(
+                        pCurCommandBuffer,
+                        hwDescriptorOffset + k * hwDescriptorSize,
+                        pPatchLocations);
+    }
+}
+
 void CosUmd12RootSignature::WriteHWRootSignature(
     BYTE * pRootValues,
     CosUmd12DescriptorHeap * pDescriptorHeaps[D3D12DDI_DESCRIPTOR_HEAP_TYPE_NUM_TYPES],
@@ -227,14 +275,12 @@ void CosUmd12RootSignature::WriteHWRootSignature(
             for (UINT j = 0; j < pRootParameter->DescriptorTable.NumDescriptorRanges; j++)
             {
                 const D3D12DDI_DESCRIPTOR_RANGE_0013 * pDescriptorRange = pRootParameter->DescriptorTable.pDescriptorRanges + j;
-                const CosUmd12DescriptorHeap * pDescriptorHeap = NULL;
 
                 switch (pDescriptorRange->RangeType)
                 {
                 case D3D12DDI_DESCRIPTOR_RANGE_TYPE_SRV:
                     hwViewTableOffset = hwSrvTableOffset;
                     hwDescriptorSize = sizeof(GpuHWDescriptor);
-                    pDescriptorHeap = pDescriptorHeaps[D3D12DDI_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV];
                     break;
                 case D3D12DDI_DESCRIPTOR_RANGE_TYPE_UAV:
                     //
@@ -242,41 +288,26 @@ void CosUmd12RootSignature::WriteHWRootSignature(
                     //
                     hwViewTableOffset = hwUavTableOffset;
                     hwDescriptorSize = sizeof(GpuHWDescriptor);
-                    pDescriptorHeap = pDescriptorHeaps[D3D12DDI_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV];
                     break;
                 case D3D12DDI_DESCRIPTOR_RANGE_TYPE_CBV:
                     hwViewTableOffset = hwCbvTableOffset;
                     hwDescriptorSize = sizeof(GpuHWConstantDescriptor);
-                    pDescriptorHeap = pDescriptorHeaps[D3D12DDI_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV];
                     break;
                 case D3D12DDI_DESCRIPTOR_RANGE_TYPE_SAMPLER:
                     // TODO :
                     ASSERT(false);
-                    break;
+                    continue;
                 }
 
-                switch (pDescriptorRange->RangeType)
-                {
-                case D3D12DDI_DESCRIPTOR_RANGE_TYPE_SRV:
-                case D3D12DDI_DESCRIPTOR_RANGE_TYPE_UAV:
-                case D3D12DDI_DESCRIPTOR_RANGE_TYPE_CBV:
-                    {
-                        UINT tableOffset = *((UINT *)(pRootValues + m_pRootValueOffsets[i]));
-
-                        UINT descriptorIndex = (tableOffset / sizeof(CosUmd12Descriptor)) + pDescriptorRange->OffsetInDescriptorsFromTableStart;
-
-                        for (UINT k = 0; k < pDescriptorRange->NumDescriptors; k++, descriptorIndex++)
-                        {
-                            const CosUmd12Descriptor * pDescriptor = pDescriptorHeap->m_pDescriptors + descriptorIndex;
-
-                            pDescriptor->WriteHWDescriptor(
-                                            pCurCommandBuffer,
-                                            hwViewTableOffset + (pDescriptorRange->BaseShaderRegister + k) * hwDescriptorSize,
-                                            pPatchLocations);
-                        }
-                    }
-                    break;
-                }
+                WriteHWDescriptorRange(
+                    pRootValues,
+                    pDescriptorHeaps,
+                    i,
+                    pDescriptorRange,
+                    pCurCommandBuffer,
+                    hwViewTableOffset + pDescriptorRange->BaseShaderRegister * hwDescriptorSize,
+                    hwDescriptorSize,
+                    pPatchLocations);
             }
             break;
         case D3D12DDI_ROOT_PARAMETER_TYPE_32BIT_CONSTANTS:
@@ -324,5 +355,208 @@ void CosUmd12RootSignature::WriteHWRootSignature(
     }
 }
 
+static bool GetHWRegisterRange(
+    D3D12DDI_DESCRIPTOR_RANGE_TYPE rangeType,
+    GpuHWRegisterType * pRegisterType,
+    UINT * pHwDescriptorSize)
+{
+    switch (rangeType)
+    {
+    case D3D12DDI_DESCRIPTOR_RANGE_TYPE_SRV:
+        *pRegisterType = COS_HW_SRV_REGISTER;
+        *pHwDescriptorSize = sizeof(GpuHWDescriptor);
+        return true;
+    case D3D12DDI_DESCRIPTOR_RANGE_TYPE_UAV:
+        *pRegisterType = COS_HW_UAV_REGISTER;
+        *pHwDescriptorSize = sizeof(GpuHWDescriptor);
+        return true;
+    case D3D12DDI_DESCRIPTOR_RANGE_TYPE_CBV:
+        *pRegisterType = COS_HW_CBV_REGISTER;
+        *pHwDescriptorSize = sizeof(GpuHWConstantDescriptor);
+        return true;
+    default:
+        return false;
+    }
+}
+
+UINT CosUmd12RootSignature::GetHwRootSignatureUpdateSize(
+    UINT64 dirtyRootParameters)
+{
+    UINT updateSize = sizeof(GpuHWRootSignatureUpdate);
+
+    const D3D12DDI_ROOT_PARAMETER_0013 * pRootParameter = m_rootSignature.pRootParameters;
+
+    for (UINT i = 0; i < m_rootSignature.NumParameters; i++, pRootParameter++)
+    {
+        if (0 == (dirtyRootParameters & (1ull << i)))
+        {
+            continue;
+        }
+
+        switch (pRootParameter->ParameterType)
+        {
+        case D3D12DDI_ROOT_PARAMETER_TYPE_DESCRIPTOR_TABLE:
+            for (UINT j = 0; j < pRootParameter->DescriptorTable.NumDescriptorRanges; j++)
+            {
+                const D3D12DDI_DESCRIPTOR_RANGE_0013 * pDescriptorRange = pRootParameter->DescriptorTable.pDescriptorRanges + j;
+
+                GpuHWRegisterType registerType;
+                UINT hwDescriptorSize;
+
+                if (GetHWRegisterRange(pDescriptorRange->RangeType, &registerType, &hwDescriptorSize))
+                {
+                    updateSize += sizeof(GpuHWRegisterRange) + pDescriptorRange->NumDescriptors * hwDescriptorSize;
+                }
+            }
+            break;
+        case D3D12DDI_ROOT_PARAMETER_TYPE_32BIT_CONSTANTS:
+            updateSize += sizeof(GpuHWRegisterRange) +
+                          ((pRootParameter->Constants.Num32BitValues + 3) / 4) * sizeof(GpuHWConstantDescriptor);
+            break;
+        case D3D12DDI_ROOT_PARAMETER_TYPE_CBV:
+            updateSize += sizeof(GpuHWRegisterRange) + sizeof(GpuHWConstantDescriptor);
+            break;
+        case D3D12DDI_ROOT_PARAMETER_TYPE_SRV:
+        case D3D12DDI_ROOT_PARAMETER_TYPE_UAV:
+            updateSize += sizeof(GpuHWRegisterRange) + sizeof(GpuHWDescriptor);
+            break;
+        }
+    }
+
+    return updateSize;
+}
+
+UINT CosUmd12RootSignature::WriteHWRootSignatureUpdate(
+    BYTE * pRootValues,
+    CosUmd12DescriptorHeap * pDescriptorHeaps[D3D12DDI_DESCRIPTOR_HEAP_TYPE_NUM_TYPES],
+    CosUmd12CommandBuffer * pCurCommandBuffer,
+    BYTE * pCommandBuf,
+    UINT curCommandOffset,
+    UINT64 dirtyRootParameters,
+    D3DDDI_PATCHLOCATIONLIST * &pPatchLocations)
+{
+    ASSERT(m_bHwUpdateSupported);
+
+    GpuHWRootSignatureUpdate * pHwRootSignatureUpdate = (GpuHWRootSignatureUpdate *)pCommandBuf;
+    BYTE * pCurRange = (BYTE *)(pHwRootSignatureUpdate + 1);
+
+    pHwRootSignatureUpdate->m_commandId = RootSignatureUpdate;
+    pHwRootSignatureUpdate->m_numRanges = 0;
+    pHwRootSignatureUpdate->m_reserved = 0;
+
+    const D3D12DDI_ROOT_PARAMETER_0013 * pRootParameter = m_rootSignature.pRootParameters;
+
+    for (UINT i = 0; i < m_rootSignature.NumParameters; i++, pRootParameter++)
+    {
+        if (0 == (dirtyRootParameters & (1ull << i)))
+        {
+            continue;
+        }
+
+        GpuHWRegisterRange * pRange;
+        UINT hwDescriptorSize;
+
+        switch (pRootParameter->ParameterType)
+        {
+        case D3D12DDI_ROOT_PARAMETER_TYPE_DESCRIPTOR_TABLE:
+            for (UINT j = 0; j < pRootParameter->DescriptorTable.NumDescriptorRanges; j++)
+            {
+                const D3D12DDI_DESCRIPTOR_RANGE_0013 * pDescriptorRange = pRootParameter->DescriptorTable.pDescriptorRanges + j;
+
+                pRange = (GpuHWRegisterRange *)pCurRange;
+
+                if (!GetHWRegisterRange(pDescriptorRange->RangeType, &pRange->m_registerType, &hwDescriptorSize))
+                {
+                    // TODO : Sampler
+                    ASSERT(false);
+                    continue;
+                }
+
+                pRange->m_firstRegister = pDescriptorRange->BaseShaderRegister;
+                pRange->m_numRegisters = pDescriptorRange->NumDescriptors;
+                pRange->m_reserved = 0;
+
+                memset(pRange + 1, 0, pRange->m_numRegisters * hwDescriptorSize);
+
+                WriteHWDescriptorRange(
+                    pRootValues,
+                    pDescriptorHeaps,
+                    i,
+                    pDescriptorRange,
+                    pCurCommandBuffer,
+                    curCommandOffset + (UINT)((BYTE *)(pRange + 1) - pCommandBuf),
+                    hwDescriptorSize,
+                    pPatchLocations);
+
+                pCurRange = (BYTE *)(pRange + 1) + pRange->m_numRegisters * hwDescriptorSize;
+                pHwRootSignatureUpdate->m_numRanges++;
+            }
+            break;
+        case D3D12DDI_ROOT_PARAMETER_TYPE_32BIT_CONSTANTS:
+            pRange = (GpuHWRegisterRange *)pCurRange;
+
+            pRange->m_registerType = COS_HW_CBV_REGISTER;
+            pRange->m_firstRegister = pRootParameter->Constants.ShaderRegister;
+            pRange->m_numRegisters = (pRootParameter->Constants.Num32BitValues + 3) / 4;
+            pRange->m_reserved = 0;
+
+            memset(pRange + 1, 0, pRange->m_numRegisters * sizeof(GpuHWConstantDescriptor));
+
+            memcpy(
+                pRange + 1,
+                pRootValues + m_pRootValueOffsets[i],
+                pRootParameter->Constants.Num32BitValues * sizeof(FLOAT));
+
+            pCurRange = (BYTE *)(pRange + 1) + pRange->m_numRegisters * sizeof(GpuHWConstantDescriptor);
+            pHwRootSignatureUpdate->m_numRanges++;
+            break;
+        case D3D12DDI_ROOT_PARAMETER_TYPE_CBV:
+        case D3D12DDI_ROOT_PARAMETER_TYPE_SRV:
+        case D3D12DDI_ROOT_PARAMETER_TYPE_UAV:
+            {
+                pRange = (GpuHWRegisterRange *)pCurRange;
+
+                switch (pRootParameter->ParameterType)
+                {
+                case D3D12DDI_ROOT_PARAMETER_TYPE_CBV:
+                    pRange->m_registerType = COS_HW_CBV_REGISTER;
+                    hwDescriptorSize = sizeof(GpuHWConstantDescriptor);
+                    break;
+                case D3D12DDI_ROOT_PARAMETER_TYPE_SRV:
+                    pRange->m_registerType = COS_HW_SRV_REGISTER;
+                    hwDescriptorSize = sizeof(GpuHWDescriptor);
+                    break;
+                default:
+                    pRange->m_registerType = COS_HW_UAV_REGISTER;
+                    hwDescriptorSize = sizeof(GpuHWDescriptor);
+                    break;
+                }
+
+                pRange->m_firstRegister = pRootParameter->Descriptor.ShaderRegister;
+                pRange->m_numRegisters = 1;
+                pRange->m_reserved = 0;
+
+                memset(pRange + 1, 0, hwDescriptorSize);
+
+                D3D12DDI_GPU_VIRTUAL_ADDRESS resourceGpuVA = *((D3D12DDI_GPU_VIRTUAL_ADDRESS *)(pRootValues + m_pRootValueOffsets[i]));
+
+                WriteHWRootDescriptor(
+                    pCurCommandBuffer,
+                    resourceGpuVA,
+                    curCommandOffset + (UINT)((BYTE *)(pRange + 1) - pCommandBuf),
+                    pPatchLocations);
+
+                pCurRange = (BYTE *)(pRange + 1) + hwDescriptorSize;
+                pHwRootSignatureUpdate->m_numRanges++;
+            }
+            break;
+        }
+    }
+
+    pHwRootSignatureUpdate->m_commandSize = (UINT)(pCurRange - pCommandBuf);
+
+    return pHwRootSignatureUpdate->m_commandSize;
+}
+
 #endif  // !(COS_GPUVA_SUPPORT || COS_RS_2LEVEL_SUPPORT)
 
@@ -141,6 +141,38 @@ public:
         UINT curCommandOffset,
         D3DDDI_PATCHLOCATIONLIST * pPatchLocations);
 
+    //
+    // Root parameters are tracked with one dirty bit each, a command buffer
+    // that already has this Root Signature set only gets the registers of the
+    // dirty root parameters through a RootSignatureUpdate
+    //
+
+    bool IsHwRootSignatureUpdateSupported()
+    {
+        return m_bHwUpdateSupported;
+    }
+
+    //
+    // Root parameters with volatile descriptor ranges have to be written for every dispatch
+    //
+
+    UINT64 GetVolatileRootParameters()
+    {
+        return m_volatileRootParameters;
+    }
+
+    UINT GetHwRootSignatureUpdateSize(
+        UINT64 dirtyRootParameters);
+
+    UINT WriteHWRootSignatureUpdate(
+        BYTE * pRootValues,
+        CosUmd12DescriptorHeap * pDescriptorHeaps[D3D12DDI_DESCRIPTOR_HEAP_TYPE_NUM_TYPES],
+        CosUmd12CommandBuffer * pCurCommandBuffer,
+        BYTE * pCommandBuf,
+        UINT curCommandOffset,
+        UINT64 dirtyRootParameters,
+        D3DDDI_PATCHLOCATIONLIST * &pPatchLocations);
+
 private:
 
     friend class CosUmd12CommandList;
@@ -155,8 +187,21 @@ private:
     GpuHWRootSignatureSet m_hwRootSignature;
     UINT m_numRegistersToPatch;
 
+    bool m_bHwUpdateSupported;
+    UINT64 m_volatileRootParameters;
+
     void PrepareHWRootSignature();
 
+    void WriteHWDescriptorRange(
+        BYTE * pRootValues,
+        CosUmd12DescriptorHeap * pDescriptorHeaps[D3D12DDI_DESCRIPTOR_HEAP_TYPE_NUM_TYPES],
+        UINT rootParameterIndex,
+        const D3D12DDI_DESCRIPTOR_RANGE_0013 * pDescriptorRange,
+        CosUmd12CommandBuffer * pCurCommandBuffer,
+        UINT hwDescriptorOffset,
+        UINT hwDescriptorSize,
+        D3DDDI_PATCHLOCATIONLIST * &pPatchLocations);
+
     void WriteHWRootDescriptor(
         CosUmd12CommandBuffer * pCurCommandBuffer,
         D3D12DDI_GPU_VIRTUAL_ADDRESS resourceGpuVA,
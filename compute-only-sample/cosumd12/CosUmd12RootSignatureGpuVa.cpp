@@ -122,5 +122,66 @@ void CosUmd12RootSignature::WriteHWRootSignature(
     memcpy(pHwRootSignatureSet->m_rootValues, pRootValues, m_sizeOfRootValues);
 }
 
+UINT CosUmd12RootSignature::WriteHwUavBindings(
+    BYTE * pRootValues,
+    CosUmd12DescriptorHeap * pDescriptorHeaps[D3D12DDI_DESCRIPTOR_HEAP_TYPE_NUM_TYPES],
+    GpuHwUavBinding * pUavBindings)
+{
+    const CosUmd12DescriptorHeap * pDescriptorHeap = pDescriptorHeaps[D3D12DDI_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV];
+    UINT numUavBindings = 0;
+
+    memset(pUavBindings, 0, sizeof(GpuHwUavBinding)*COS_MAX_HW_UAV_BINDINGS);
+
+    const D3D12DDI_ROOT_PARAMETER_0013 * pRootParameter = m_rootSignature.pRootParameters;
+
+    for (UINT i = 0; i < m_rootSignature.NumParameters; i++, pRootParameter++)
+    {
+        switch (pRootParameter->ParameterType)
+        {
+        case D3D12DDI_ROOT_PARAMETER_TYPE_DESCRIPTOR_TABLE:
+            for (UINT j = 0; j < pRootParameter->DescriptorTable.NumDescriptorRanges; j++)
+            {
+                const D3D12DDI_DESCRIPTOR_RANGE_0013 * pDescriptorRange = pRootParameter->DescriptorTable.pDescriptorRanges + j;
+
+                if ((D3D12DDI_DESCRIPTOR_RANGE_TYPE_UAV != pDescriptorRange->RangeType) || (NULL == pDescriptorHeap))
+                {
+                    continue;
+                }
+
+                UINT tableOffset = *((UINT *)(pRootValues + m_pRootValueOffsets[i]));
+                UINT descriptorIndex = (tableOffset / sizeof(CosUmd12Descriptor)) + pDescriptorRange->OffsetInDescriptorsFromTableStart;
+                const CosUmd12Descriptor * pDescriptor = pDescriptorHeap->GetCpuAddress() + descriptorIndex;
+
+                for (UINT k = 0; k < pDescriptorRange->NumDescriptors; k++, pDescriptor++)
+                {
+                    UINT shaderRegister = pDescriptorRange->BaseShaderRegister + k;
+
+                    ASSERT(shaderRegister < COS_MAX_HW_UAV_BINDINGS);
+                    if (shaderRegister >= COS_MAX_HW_UAV_BINDINGS)
+                    {
+                        break;
+                    }
+
+                    pDescriptor->WriteHWUavBinding(pUavBindings + shaderRegister);
+
+                    if (shaderRegister >= numUavBindings)
+                    {
+                        numUavBindings = shaderRegister + 1;
+                    }
+                }
+            }
+            break;
+        case D3D12DDI_ROOT_PARAMETER_TYPE_UAV:
+            //
+            // TODO : Root UAVs carry no size, they are left unbound
+            //
+            ASSERT(false);
+            break;
+        }
+    }
+
+    return numUavBindings;
+}
+
 #endif  // COS_GPUVA_SUPPORT
 
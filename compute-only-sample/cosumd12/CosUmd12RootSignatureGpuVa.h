@@ -137,6 +137,16 @@ public:
         CosUmd12DescriptorHeap * pDescriptorHeaps[D3D12DDI_DESCRIPTOR_HEAP_TYPE_NUM_TYPES],
         BYTE * pCommandBuf);
 
+    //
+    // Resolves the UAVs of the descriptor tables into pUavBindings, indexed by
+    // shader register. Returns the number of bindings written.
+    //
+
+    UINT WriteHwUavBindings(
+        BYTE * pRootValues,
+        CosUmd12DescriptorHeap * pDescriptorHeaps[D3D12DDI_DESCRIPTOR_HEAP_TYPE_NUM_TYPES],
+        GpuHwUavBinding * pUavBindings);
+
 private:
 
     friend class CosUmd12CommandList;
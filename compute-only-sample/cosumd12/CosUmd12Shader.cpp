@@ -2,6 +2,10 @@
 #include "d3dcompiler.h"
 #include "VpuCompiler.h"
 
+// Threads run per call of the shader entry point on the software adapter,
+// shaders the compiler can't vectorize fall back to one thread per call
+const UINT kShaderSimdWidth = 8;
+
 CosUmd12Shader::CosUmd12Shader(CosUmd12Device* pDevice, const D3D12DDIARG_CREATE_SHADER_0026* pArgs)
 {
 	m_pDevice = pDevice;
@@ -29,8 +33,17 @@ CosUmd12Shader::CosUmd12Shader(CosUmd12Device* pDevice, const D3D12DDIARG_CREATE
 	if (m_ioSignatures.pOutputSignature)
 		memcpy(m_ioSignatures.pOutputSignature, pArgs->IOSignatures.Standard->pOutputSignature, size);
 
-	if (!vpu_compiler(m_byteCode, &m_image))
-		m_image = nullptr;
+	// Compilation runs on the compiler thread pool so shader creation does
+	// not stall, the image is only waited for at the first Dispatch
+	m_image = nullptr;
+	m_compileJob = nullptr;
+	InitializeSRWLock(&m_imageLock);
+
+	VpuCompilerOptions options;
+	options.m_simdWidth = kShaderSimdWidth;
+
+	if (m_byteCode != nullptr)
+		m_compileJob = vpu_compiler_submit(m_byteCode, &options);
 
 	// TODO: How should we deal with errors here?  Put the device in an error state?
 
@@ -38,11 +51,33 @@ CosUmd12Shader::CosUmd12Shader(CosUmd12Device* pDevice, const D3D12DDIARG_CREATE
 
 CosUmd12Shader::~CosUmd12Shader()
 {
+	if (m_compileJob != nullptr) GetImage();
+	if (m_image != nullptr) m_image->Release();
 	if (m_byteCode != nullptr) m_byteCode->Release();
 	if (m_ioSignatures.pInputSignature != nullptr) free(m_ioSignatures.pInputSignature);
 	if (m_ioSignatures.pOutputSignature != nullptr) free(m_ioSignatures.pOutputSignature);
 }
 
+ID3DBlob * CosUmd12Shader::GetImage()
+{
+	// Pipeline states can be created from the same shader on several threads,
+	// the job must be waited on and released exactly once
+	AcquireSRWLockExclusive(&m_imageLock);
+
+	if (m_compileJob != nullptr) {
+		if (!vpu_compiler_wait(m_compileJob, &m_image))
+			m_image = nullptr;
+
+		m_compileJob = nullptr;
+	}
+
+	ID3DBlob * image = m_image;
+
+	ReleaseSRWLockExclusive(&m_imageLock);
+
+	return image;
+}
+
 int CosUmd12Shader::CalculateSize(const D3D12DDIARG_CREATE_SHADER_0026 * pArgs)
 {
 	return sizeof(CosUmd12Shader);
@@ -5,6 +5,7 @@
 #include "CosUmd12.h"
 
 class CosUmd12Device;
+struct VpuCompileJob;
 
 class CosUmd12Shader
 {
@@ -31,6 +32,12 @@ private:
 	D3D12DDI_LIBRARY_REFERENCE_0010 m_libraryReference;
 	D3D12DDI_SHADERCACHE_HASH m_shaderCodeHash;
 
+	// Compiled asynchronously by the VPU compiler service, GetImage() blocks
+	// until the compile finishes the first time it is called
+	ID3DBlob * GetImage();
+
+	SRWLOCK m_imageLock;        // guards m_compileJob and m_image
+	VpuCompileJob * m_compileJob;
 	ID3DBlob * m_image;
 
 };
@@ -35,6 +35,7 @@ typedef struct {
 
 typedef struct {
     int32_t m_id;
+    int32_t m_idCount;  // threads from m_id on run by a SIMD entry point
     VpuResourceDescriptor m_uavs[kVpuMaxUAVs];
 } VpuThreadLocalStorage;
 
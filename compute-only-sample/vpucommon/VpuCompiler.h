@@ -3,4 +3,25 @@
 #include <Windows.h>
 #include <d3dcommon.h>
 
+#include "VpuCompilerOptions.h"
+
 extern "C"  __declspec(dllimport) bool vpu_compiler(ID3DBlob * inDxilByteCode, ID3DBlob ** outVpuImage);
+extern "C"  __declspec(dllimport) bool vpu_compiler_ex(ID3DBlob * inDxilByteCode, const VpuCompilerOptions * options, ID3DBlob ** outVpuImage);
+
+//
+// Asynchronous compilation on the compiler thread pool. vpu_compiler_wait
+// blocks until the job is done and releases it, every submitted job must be
+// waited on exactly once.
+//
+
+extern "C"  __declspec(dllimport) VpuCompileJob * vpu_compiler_submit(ID3DBlob * inDxilByteCode, const VpuCompilerOptions * options);
+extern "C"  __declspec(dllimport) bool vpu_compiler_is_done(VpuCompileJob * job);
+extern "C"  __declspec(dllimport) bool vpu_compiler_wait(VpuCompileJob * job, ID3DBlob ** outVpuImage);
+
+// Resizes the thread pool, 0 picks one thread per core
+extern "C"  __declspec(dllimport) void vpu_compiler_set_thread_count(UINT threadCount);
+
+// Finishes the queued jobs and stops the thread pool, the next submission
+// starts it again. Must be called before the compiler DLL is unloaded since
+// the pool can't be stopped from DllMain.
+extern "C"  __declspec(dllimport) void vpu_compiler_shutdown();
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <Windows.h>
+
+#define kVpuOptLevelDefault 0xFFFFFFFF
+
+// A value-initialized VpuCompilerOptions{} gives the defaults, m_optLevel
+// is not left at 0 which would build at -O0
+typedef struct {
+	UINT m_optLevel = kVpuOptLevelDefault;  // LLVM code generation level 0-3, anything else uses the default
+	bool m_bypassCache = false;             // don't read or write the on-disk shader cache
+	UINT m_simdWidth = 0;                   // threads per entry point call: 4, 8 or 16, anything else is scalar
+} VpuCompilerOptions;
+
+// Handle for a compilation submitted to the compiler thread pool
+typedef struct VpuCompileJob VpuCompileJob;
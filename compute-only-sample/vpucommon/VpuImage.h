@@ -10,6 +10,14 @@ public:
 	uint64_t m_entryOffset;
 	uint64_t m_tlsSize;
 	uint16_t m_relocationCount;
+	uint16_t m_simdWidth;  // 0 if the entry point runs a single thread
+
+	// Threads run per call of the entry point. A SIMD entry point runs
+	// m_idCount (at most GetSimdWidth()) consecutive threads starting at m_id.
+	uint32_t GetSimdWidth(void)
+	{
+		return (m_simdWidth > 1) ? m_simdWidth : 1;
+	}
 
 	uint64_t GetSerializationSize(void)
 	{
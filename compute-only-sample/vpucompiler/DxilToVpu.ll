@@ -15,6 +15,7 @@ declare void @dx_op_bufferLoad_i32(%dx.types.ResRet.i32*, %dx.types.Handle, i32,
 declare void @dx_op_bufferStore_f32(%dx.types.Handle, i32, i32, float, float, float, float, i8 zeroext) #0
 declare void @dx_op_bufferStore_i32(%dx.types.Handle, i32, i32, i32, i32, i32, i32, i8 zeroext) #0
 declare i32 @dx_op_threadId_i32() #0
+declare i32 @vpu_threadCount_i32() #0
 
 define i8* @dx.op.createHandle(i32, i8, i32, i32, i1) #1 {
 	%non_uniform = zext i1 %4 to i8
@@ -51,5 +52,11 @@ define i32 @dx.op.threadId.i32(i32, i32) {
 	ret i32 %result
 }
 
+; Number of threads run by a SIMD entry point, see VpuVectorizer
+define i32 @vpu.threadCount.i32() {
+	%result = call i32 @vpu_threadCount_i32()
+	ret i32 %result
+}
+
 attributes #0 = { noinline nounwind optnone uwtable "correctly-rounded-divide-sqrt-fp-math"="false" "disable-tail-calls"="false" "less-precise-fpmad"="false" "no-frame-pointer-elim"="false" "no-infs-fp-math"="false" "no-jump-tables"="false" "no-nans-fp-math"="false" "no-signed-zeros-fp-math"="false" "no-trapping-math"="false" "stack-protector-buffer-size"="8" "target-cpu"="x86-64" "target-features"="+fxsr,+mmx,+sse,+sse2,+x87" "unsafe-fp-math"="false" "use-soft-float"="false" }
 attributes #1 = { nounwind readonly }
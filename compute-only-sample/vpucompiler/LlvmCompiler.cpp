@@ -39,6 +39,7 @@
 #include "llvm/Target/TargetMachine.h"
 #include "llvm/Transforms/Utils/Cloning.h"
 #include <memory>
+#include <mutex>
 using namespace llvm;
 
 // General options for llc.  Other pass-specific options are specified
@@ -157,7 +158,7 @@ static cl::opt<RunPassOption, true, cl::parser<std::string>> RunPass(
     cl::desc("Run compiler only for specified passes (comma separated list)"),
     cl::value_desc("pass-name"), cl::ZeroOrMore, cl::location(RunPassOpt));
 
-static int compileModule(char *, LLVMContext &);
+static int compileModuleToStream(char *, LLVMContext &, std::unique_ptr<Module>, const LlvmCompileOptions &, raw_pwrite_stream &);
 
 static std::unique_ptr<ToolOutputFile> GetOutputStream(void) {
 
@@ -210,13 +211,15 @@ static void InlineAsmDiagHandler(const SMDiagnostic &SMD, void *Context,
         WithColor::note() << "!srcloc = " << LocCookie << "\n";
 }
 
-// Compile .ll or .bc to .obj
-int llvm_compile(char * progName, char * input, char * output) {
+// One time initialization of LLVM, everything after it only reads the
+// global option values so compilations can run concurrently as long as each
+// one uses its own LLVMContext.
+static std::once_flag InitializeOnce;
+
+static void initializeCompilerOnce(void) {
     // Enable debug stream buffering.
     EnableDebugBuffering = true;
 
-    LLVMContext Context;
-
     // Initialize targets first, so that --version shows registered targets.
     InitializeAllTargets();
     InitializeAllTargetMCs();
@@ -246,13 +249,18 @@ int llvm_compile(char * progName, char * input, char * output) {
     cl::AddExtraVersionPrinter(TargetRegistry::printRegisteredTargetsForVersion);
 
     FileType = TargetMachine::CGFT_ObjectFile;
-    InputFilename = std::string(input);
-    OutputFilename = std::string(output);
 #ifdef _M_IX86
  	MArch = std::string("x86");
 #else
 	MArch = std::string("x86-64");
 #endif
+}
+
+static void initializeCompiler(void) {
+    std::call_once(InitializeOnce, initializeCompilerOnce);
+}
+
+static int compileModule(char * progName, LLVMContext &Context, std::unique_ptr<Module> M, const LlvmCompileOptions &CompileOptions, raw_pwrite_stream &OS) {
 
     Context.setDiscardValueNames(DiscardValueNames);
 
@@ -288,7 +296,7 @@ int llvm_compile(char * progName, char * input, char * output) {
         return 1;
     }
 
-    if (int RetVal = compileModule(progName, Context))
+    if (int RetVal = compileModuleToStream(progName, Context, std::move(M), CompileOptions, OS))
         return RetVal;
 
     if (YamlFile)
@@ -297,6 +305,51 @@ int llvm_compile(char * progName, char * input, char * output) {
     return 0;
 }
 
+// Compile .ll or .bc to .obj
+int llvm_compile(char * progName, char * input, char * output) {
+    initializeCompiler();
+
+    InputFilename = std::string(input);
+    OutputFilename = std::string(output);
+
+    LLVMContext Context;
+    SMDiagnostic Err;
+
+    std::unique_ptr<Module> M = parseIRFile(InputFilename, Err, Context, false);
+    if (!M) {
+        Err.print(progName, WithColor::error(errs(), progName));
+        return 1;
+    }
+
+    // Figure out where we are going to send the output.
+    std::unique_ptr<ToolOutputFile> Out = GetOutputStream();
+    if (!Out) return 1;
+
+    LlvmCompileOptions CompileOptions;
+    CompileOptions.m_optLevel = OptLevel;
+    CompileOptions.m_verify = !NoVerify;
+
+    if (int RetVal = compileModule(progName, Context, std::move(M), CompileOptions, Out->os()))
+        return RetVal;
+
+    // Declare success.
+    Out->keep();
+
+    return 0;
+}
+
+// Compile an in memory module to an object in memory
+//
+// Reentrant, options come from the caller instead of the global command line
+// options, and all state lives in the caller's context
+int llvm_compile_module(char * progName, LLVMContext & Context, std::unique_ptr<Module> M, const LlvmCompileOptions & CompileOptions, SmallVectorImpl<char> & Object) {
+    initializeCompiler();
+
+    raw_svector_ostream OS(Object);
+
+    return compileModule(progName, Context, std::move(M), CompileOptions, OS);
+}
+
 static bool addPass(PassManagerBase &PM, const char *progName,
     StringRef PassName, TargetPassConfig &TPC) {
     if (PassName == "none")
@@ -325,20 +378,10 @@ static bool addPass(PassManagerBase &PM, const char *progName,
     return false;
 }
 
-static int compileModule(char * progName, LLVMContext &Context) {
-    // Load the module to be compiled...
-    SMDiagnostic Err;
-    std::unique_ptr<Module> M;
+static int compileModuleToStream(char * progName, LLVMContext &Context, std::unique_ptr<Module> M, const LlvmCompileOptions &CompileOptions, raw_pwrite_stream &Out) {
     std::unique_ptr<MIRParser> MIR;
     Triple TheTriple;
 
-    M = parseIRFile(InputFilename, Err, Context, false);
-
-    if (!M) {
-        Err.print(progName, WithColor::error(errs(), progName));
-        return 1;
-    }
-
     // If we are supposed to override the target triple, do so now.
     assert(TargetTriple.empty());
     if (!TargetTriple.empty())
@@ -361,7 +404,7 @@ static int compileModule(char * progName, LLVMContext &Context) {
     std::string CPUStr = getCPUStr(), FeaturesStr = getFeaturesStr();
 
     CodeGenOpt::Level OLvl = CodeGenOpt::Default;
-    switch (OptLevel) {
+    switch (CompileOptions.m_optLevel) {
     default:
         WithColor::error(errs(), progName) << "invalid optimization level.\n";
         return 1;
@@ -391,10 +434,6 @@ static int compileModule(char * progName, LLVMContext &Context) {
     if (FloatABIForCalls != FloatABI::Default)
         Options.FloatABIType = FloatABIForCalls;
 
-    // Figure out where we are going to send the output.
-    std::unique_ptr<ToolOutputFile> Out = GetOutputStream();
-    if (!Out) return 1;
-
     std::unique_ptr<ToolOutputFile> DwoOut;
     if (!SplitDwarfOutputFile.empty()) {
         std::error_code EC;
@@ -426,9 +465,9 @@ static int compileModule(char * progName, LLVMContext &Context) {
 
     // Verify module immediately to catch problems before doInitialization() is
     // called on any passes.
-    if (!NoVerify && verifyModule(*M, &errs())) {
+    if (CompileOptions.m_verify && verifyModule(*M, &errs())) {
         std::string Prefix =
-            (Twine(progName) + Twine(": ") + Twine(InputFilename)).str();
+            (Twine(progName) + Twine(": ") + M->getModuleIdentifier()).str();
         WithColor::error(errs(), Prefix) << "input module is broken!\n";
         return 1;
     }
@@ -443,14 +482,14 @@ static int compileModule(char * progName, LLVMContext &Context) {
         << ": warning: ignoring -mc-relax-all because filetype != obj";
 
     {
-        raw_pwrite_stream *OS = &Out->os();
+        raw_pwrite_stream *OS = &Out;
 
         // Manually do the buffering rather than using buffer_ostream,
         // so we can memcmp the contents in CompileTwice mode
         SmallVector<char, 0> Buffer;
         std::unique_ptr<raw_svector_ostream> BOS;
         if ((FileType != TargetMachine::CGFT_AssemblyFile &&
-            !Out->os().supportsSeeking()) ||
+            !Out.supportsSeeking()) ||
             CompileTwice) {
             BOS = make_unique<raw_svector_ostream>(Buffer);
             OS = BOS.get();
@@ -475,7 +514,7 @@ static int compileModule(char * progName, LLVMContext &Context) {
                 return 1;
             }
 
-            TPC.setDisableVerify(NoVerify);
+            TPC.setDisableVerify(!CompileOptions.m_verify);
             PM.add(&TPC);
             PM.add(MMI);
             TPC.printAndVerify("");
@@ -489,7 +528,7 @@ static int compileModule(char * progName, LLVMContext &Context) {
         }
         else if (Target->addPassesToEmitFile(PM, *OS,
             DwoOut ? &DwoOut->os() : nullptr,
-            FileType, NoVerify, MMI)) {
+            FileType, !CompileOptions.m_verify, MMI)) {
             WithColor::warning(errs(), progName)
                 << "target does not support generation of this"
                 << " file type!\n";
@@ -534,19 +573,17 @@ static int compileModule(char * progName, LLVMContext &Context) {
                     "Writing the result of the second run to the specified output\n"
                     "To generate the one-run comparison binary, just run without\n"
                     "the compile-twice option\n";
-                Out->os() << Buffer;
-                Out->keep();
+                Out << Buffer;
                 return 1;
             }
         }
 
         if (BOS) {
-            Out->os() << Buffer;
+            Out << Buffer;
         }
     }
 
     // Declare success.
-    Out->keep();
     if (DwoOut)
         DwoOut->keep();
 
@@ -1,4 +1,17 @@
 #pragma once
 
-int llvm_compile(char * exe, char * input, char * output);
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+
+#include <memory>
 
+// Per invocation code generation options
+struct LlvmCompileOptions
+{
+    char m_optLevel = ' ';      // ' ' (default), '0', '1', '2' or '3'
+    bool m_verify = true;       // verify the module before code generation
+};
+
+int llvm_compile(char * exe, char * input, char * output);
+int llvm_compile_module(char * exe, llvm::LLVMContext & context, std::unique_ptr<llvm::Module> module, const LlvmCompileOptions & options, llvm::SmallVectorImpl<char> & object);
@@ -397,3 +397,51 @@ int llvm_linker(char * exe, char * input_a, char * input_b, char * input_c, char
 
     return 0;
 }
+
+// Link modules that are already loaded, without going through files. The
+// modules are linked in order, the first one being the destination.
+//
+// Reentrant as long as each caller uses its own context, the global options
+// are only read.
+std::unique_ptr<Module> llvm_link_modules(char * exe, LLVMContext & Context, std::vector<std::unique_ptr<Module>> & Inputs) {
+
+    Context.setDiagnosticHandler(
+        llvm::make_unique<LLVMLinkDiagnosticHandler>(), true);
+
+    if (!DisableDITypeMap)
+        Context.enableDebugTypeODRUniquing();
+
+    auto Composite = make_unique<Module>("llvm-link", Context);
+    Linker L(*Composite);
+
+    unsigned Flags = Linker::Flags::None;
+    if (OnlyNeeded)
+        Flags |= Linker::Flags::LinkOnlyNeeded;
+
+    // Filter out flags that don't apply to the first module.
+    unsigned ApplicableFlags = Flags & Linker::Flags::OverrideFromSrc;
+
+    for (auto & M : Inputs) {
+        if (!M) {
+            errs() << exe << ": ";
+            WithColor::error() << "missing input module\n";
+            return nullptr;
+        }
+
+        if (Verbose)
+            errs() << "Linking in '" << M->getModuleIdentifier() << "'\n";
+
+        if (L.linkInModule(std::move(M), ApplicableFlags))
+            return nullptr;
+
+        ApplicableFlags = Flags;
+    }
+
+    if (verifyModule(*Composite, &errs())) {
+        errs() << exe << ": ";
+        WithColor::error() << "linked module is broken!\n";
+        return nullptr;
+    }
+
+    return Composite;
+}
@@ -1,3 +1,10 @@
 #pragma once
 
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+
+#include <memory>
+#include <vector>
+
 int llvm_linker(char * exe, char * input_a, char * input_b, char * input_c, char * output);
+std::unique_ptr<llvm::Module> llvm_link_modules(char * exe, llvm::LLVMContext & context, std::vector<std::unique_ptr<llvm::Module>> & inputs);
@@ -68,6 +68,25 @@ bool VpuObject::Open(const char * filePath)
 
 	m_binary = std::move(*binaryOrErr);
 
+	return Load();
+}
+
+bool VpuObject::Open(StringRef contents, StringRef name)
+{
+	std::unique_ptr<MemoryBuffer> buffer = MemoryBuffer::getMemBufferCopy(contents, name);
+
+	Expected<std::unique_ptr<Binary>> binaryOrErr = createBinary(buffer->getMemBufferRef());
+
+	if (!binaryOrErr)
+		return false;
+
+	m_binary = OwningBinary<Binary>(std::move(*binaryOrErr), std::move(buffer));
+
+	return Load();
+}
+
+bool VpuObject::Load()
+{
 	Binary * binary = m_binary.getBinary();
 	m_obj = dyn_cast<ObjectFile>(binary);
 
@@ -25,6 +25,7 @@ public:
 	~VpuObject() { assert(!m_loaded);  }
 
 	bool Open(const char * filePath);
+	bool Open(llvm::StringRef contents, llvm::StringRef name);
 	void Close();
 
 	bool GetSymbolValue(const char * name, uint64_t & value)
@@ -47,6 +48,7 @@ public:
 
 private:
 
+	bool Load();
 	bool LoadSymbolTable();
 	bool LoadRelocations();
 
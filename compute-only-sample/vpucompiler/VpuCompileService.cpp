@@ -0,0 +1,198 @@
+#include <Windows.h>
+#include <d3dcommon.h>
+
+#include "VpuCompilerOptions.h"
+
+#include <assert.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+extern "C" __declspec(dllexport) bool vpu_compiler_ex(ID3DBlob * inDxilByteCode, const VpuCompilerOptions * options, ID3DBlob ** outVpuImage);
+
+// Compiler thread pool
+//
+// Shader creation submits a job and returns right away, the image is picked
+// up with vpu_compiler_wait() the first time it is needed. Jobs run in
+// submission order on a fixed set of worker threads.
+
+struct VpuCompileJob
+{
+	ID3DBlob * m_dxilByteCode;
+	VpuCompilerOptions m_options;
+
+	bool m_done;
+	bool m_success;
+	ID3DBlob * m_image;
+};
+
+class VpuCompileService
+{
+public:
+
+	VpuCompileService() : m_exit(false) {}
+
+	// Runs at DLL_PROCESS_DETACH under the loader lock, joining the workers
+	// there would deadlock so vpu_compiler_shutdown() has to stop them first.
+	// Workers still around at process exit were already terminated, detach
+	// them so the std::thread destructors don't abort.
+	~VpuCompileService()
+	{
+		for (auto & thread : m_threads)
+			thread.detach();
+	}
+
+	void Start(unsigned int threadCount)
+	{
+		if (threadCount == 0)
+			threadCount = std::thread::hardware_concurrency();
+		if (threadCount == 0)
+			threadCount = 1;
+
+		m_exit = false;
+
+		for (unsigned int i = 0; i < threadCount; i++)
+			m_threads.push_back(std::thread(&VpuCompileService::WorkerThread, this));
+	}
+
+	// Finishes all queued jobs before the threads exit
+	void Stop()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_exit = true;
+		}
+
+		m_workAvailable.notify_all();
+
+		for (auto & thread : m_threads)
+			thread.join();
+
+		m_threads.clear();
+	}
+
+	bool IsStarted() { return !m_threads.empty(); }
+
+	void Submit(VpuCompileJob * job)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_queue.push_back(job);
+		}
+
+		m_workAvailable.notify_one();
+	}
+
+	bool IsDone(VpuCompileJob * job)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return job->m_done;
+	}
+
+	void Wait(VpuCompileJob * job)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_jobDone.wait(lock, [job] { return job->m_done; });
+	}
+
+private:
+
+	void WorkerThread()
+	{
+		for (;;) {
+			VpuCompileJob * job;
+
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_workAvailable.wait(lock, [this] { return m_exit || !m_queue.empty(); });
+
+				if (m_queue.empty())
+					return;
+
+				job = m_queue.front();
+				m_queue.pop_front();
+			}
+
+			ID3DBlob * image = nullptr;
+			bool success = vpu_compiler_ex(job->m_dxilByteCode, &job->m_options, &image);
+
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				job->m_image = image;
+				job->m_success = success;
+				job->m_done = true;
+			}
+
+			m_jobDone.notify_all();
+		}
+	}
+
+	std::mutex m_mutex;
+	std::condition_variable m_workAvailable;
+	std::condition_variable m_jobDone;
+	std::deque<VpuCompileJob *> m_queue;
+	std::vector<std::thread> m_threads;
+	bool m_exit;
+};
+
+static VpuCompileService s_compileService;
+static std::mutex s_compileServiceMutex;
+
+extern "C" __declspec(dllexport) void vpu_compiler_set_thread_count(UINT threadCount)
+{
+	std::lock_guard<std::mutex> lock(s_compileServiceMutex);
+
+	s_compileService.Stop();
+	s_compileService.Start(threadCount);
+}
+
+extern "C" __declspec(dllexport) void vpu_compiler_shutdown()
+{
+	std::lock_guard<std::mutex> lock(s_compileServiceMutex);
+
+	s_compileService.Stop();
+}
+
+extern "C" __declspec(dllexport) VpuCompileJob * vpu_compiler_submit(ID3DBlob * inDxilByteCode, const VpuCompilerOptions * options)
+{
+	VpuCompileJob * job = new VpuCompileJob();
+
+	inDxilByteCode->AddRef();
+
+	job->m_dxilByteCode = inDxilByteCode;
+	job->m_options = options ? *options : VpuCompilerOptions{};
+	job->m_done = false;
+	job->m_success = false;
+	job->m_image = nullptr;
+
+	{
+		std::lock_guard<std::mutex> lock(s_compileServiceMutex);
+
+		if (!s_compileService.IsStarted())
+			s_compileService.Start(0);
+
+		s_compileService.Submit(job);
+	}
+
+	return job;
+}
+
+extern "C" __declspec(dllexport) bool vpu_compiler_is_done(VpuCompileJob * job)
+{
+	return s_compileService.IsDone(job);
+}
+
+extern "C" __declspec(dllexport) bool vpu_compiler_wait(VpuCompileJob * job, ID3DBlob ** outVpuImage)
+{
+	s_compileService.Wait(job);
+
+	bool success = job->m_success;
+	*outVpuImage = job->m_image;
+
+	job->m_dxilByteCode->Release();
+	delete job;
+
+	return success;
+}
@@ -3,6 +3,12 @@
 #include "llvm/Object/ObjectFile.h"
 #include "llvm/Object/COFF.h"
 #include "llvm/Object/ELF.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/raw_ostream.h"
 
 #include <Windows.h>
 #include <d3dcommon.h>
@@ -10,21 +16,160 @@
 #include "LlvmLinker.h"
 #include "LlvmCompiler.h"
 #include "VpuImage.h"
+#include "VpuShaderCache.h"
+#include "VpuVectorizer.h"
 
 #include "LlvmObject.h"
+#include "VpuCompilerOptions.h"
 
 #include <dxcapi.h>
 #include <d3dcompiler.h>
 
 #include <assert.h>
+#include <mutex>
 
 using namespace llvm;
 using namespace object;
 
 #define TLS_SYMBOL "g_tls"
 
-extern "C" __declspec(dllexport) bool vpu_compiler(ID3DBlob * inDxilByteCode, ID3DBlob ** outVpuImage)
+// VPU runtime library linked into every shader. It is parsed once and kept
+// as bitcode in memory, so each compilation only has to load bitcode from
+// memory instead of reading and parsing the files again.
+static const char * s_runtimeFiles[] = { "VpuShaderLib.bc", "DxilToVpu.ll" };
+static const int kRuntimeModuleCount = sizeof(s_runtimeFiles) / sizeof(s_runtimeFiles[0]);
+
+static SmallVector<char, 0> s_runtimeBitcode[kRuntimeModuleCount];
+static std::string s_runtimeBitcodeAll;
+static bool s_runtimeLoaded;
+static std::once_flag s_runtimeOnce;
+
+static VpuShaderCache * s_shaderCache;
+
+static void load_runtime(void)
+{
+	LLVMContext context;
+
+	for (int i = 0; i < kRuntimeModuleCount; i++) {
+		SMDiagnostic err;
+
+		std::unique_ptr<Module> module = parseIRFile(s_runtimeFiles[i], err, context);
+		if (!module) {
+			err.print("vpu_compiler", errs());
+			return;
+		}
+
+		raw_svector_ostream os(s_runtimeBitcode[i]);
+		WriteBitcodeToFile(*module, os);
+
+		s_runtimeBitcodeAll.append(s_runtimeBitcode[i].data(), s_runtimeBitcode[i].size());
+	}
+
+	s_shaderCache = new VpuShaderCache();
+	s_runtimeLoaded = true;
+}
+
+static std::unique_ptr<Module> load_runtime_module(int index, LLVMContext & context)
+{
+	StringRef bitcode(s_runtimeBitcode[index].data(), s_runtimeBitcode[index].size());
+
+	Expected<std::unique_ptr<Module>> moduleOrErr = parseBitcodeFile(MemoryBufferRef(bitcode, s_runtimeFiles[index]), context);
+	if (!moduleOrErr) {
+		consumeError(moduleOrErr.takeError());
+		return nullptr;
+	}
+
+	return std::move(*moduleOrErr);
+}
+
+static bool build_image(VpuObject & obj, uint16_t simdWidth, ID3DBlob ** outVpuImage)
+{
+	VpuImageHeader header;
+
+	header.m_simdWidth = simdWidth;
+
+	if (!obj.GetSymbolValue("main", header.m_entryOffset) ||
+		!obj.GetSymbolValue(TLS_SYMBOL, header.m_tlsSize))
+		return false;
+
+	header.m_codeSize = obj.GetCodeSize();
+	header.m_relocationCount = obj.GetRelocations().size();
+
+	HRESULT hr = D3DCreateBlob(header.GetSerializationSize(), outVpuImage);
+	if (hr != S_OK)
+		return false;
+
+	VpuImageHeader * image = (VpuImageHeader*) (*outVpuImage)->GetBufferPointer();
+
+	memcpy(image, &header, sizeof(header));
+
+	const std::vector<VpuObjRelocation> & objRelocations = obj.GetRelocations();
+
+	VpuRelocation * relocations = (VpuRelocation *)(image + 1);
+
+	bool success = true;
+	int relocationCount = 0;
+	for (auto & objr : objRelocations) {
+		VpuRelocation & r = relocations[relocationCount++];
+
+		r.m_fixupOffset = objr.m_fixupOffset;
+		r.m_type = objr.m_type;
+
+		if (objr.m_symbolName == TLS_SYMBOL)
+			r.m_referenceOffset = header.GetTlsOffset();
+		else {
+
+			std::string name = objr.m_symbolName;
+
+			if (!obj.GetSymbolValue(name.c_str(), r.m_referenceOffset)) {
+				success = false;
+				break;
+			}
+		}
+	}
+
+	if (success) {
+		assert(relocationCount == header.m_relocationCount);
+		uint8_t * code = (uint8_t *)&relocations[header.m_relocationCount];
+		success = obj.GetCode(code, header.m_codeSize);
+	}
+
+	if (!success) {
+		(*outVpuImage)->Release();
+		*outVpuImage = nullptr;
+	}
+
+	return success;
+}
+
+// Safe to call from multiple threads, every compilation has its own
+// LLVMContext and options
+extern "C" __declspec(dllexport) bool vpu_compiler_ex(ID3DBlob * inDxilByteCode, const VpuCompilerOptions * options, ID3DBlob ** outVpuImage)
 {
+	*outVpuImage = nullptr;
+
+	std::call_once(s_runtimeOnce, load_runtime);
+
+	if (!s_runtimeLoaded)
+		return false;
+
+	VpuCompilerOptions defaultOptions;
+	if (options == nullptr)
+		options = &defaultOptions;
+
+	UINT simdWidth = options->m_simdWidth;
+	if (simdWidth != 4 && simdWidth != 8 && simdWidth != 16)
+		simdWidth = 0;
+
+	UINT keyOptions[] = { options->m_optLevel, simdWidth };
+
+	std::string cacheKey = s_shaderCache->ComputeKey(inDxilByteCode,
+		s_runtimeBitcodeAll.data(), s_runtimeBitcodeAll.size(),
+		keyOptions, sizeof(keyOptions));
+
+	if (!options->m_bypassCache && s_shaderCache->Lookup(cacheKey, outVpuImage))
+		return true;
+
 	IDxcCompiler * pCompiler;
 	HRESULT hr = DxcCreateInstance(CLSID_DxcCompiler, __uuidof(IDxcCompiler), (void **)& pCompiler);
 	assert(hr == S_OK);
@@ -33,78 +178,67 @@ extern "C" __declspec(dllexport) bool vpu_compiler(ID3DBlob * inDxilByteCode, ID
 	hr = pCompiler->Disassemble((IDxcBlob *)inDxilByteCode, &pDisassembly);
 	assert(hr == S_OK);
 
+	pCompiler->Release();
+
 	char * assembly = (char *) pDisassembly->GetBufferPointer();
 	uint64_t assemblyLength = pDisassembly->GetBufferSize();
 
-	if (assembly == nullptr || assemblyLength == 0)
+	if (assembly == nullptr || assemblyLength == 0) {
+		pDisassembly->Release();
 		return false;
+	}
 
-	hr = D3DWriteBlobToFile((ID3DBlob *)pDisassembly, L"temp.dxil", TRUE);
-	assert(hr == S_OK);
-
-	pDisassembly->Release();
-	pCompiler->Release();
-
-	llvm_linker("vpu_compiler",
-		"VpuShaderLib.bc",
-		"DxilToVpu.ll",
-		"temp.dxil",
-		"VpuShader.bc");
-
-	llvm_compile("vpu_compiler", "VpuShader.bc", "VpuShader.obj");
+	// The disassembly may include the terminating null
+	StringRef dxil(assembly, strnlen(assembly, (size_t)assemblyLength));
 
-	bool success = true;
-	VpuObject obj;
+	LLVMContext context;
+	SMDiagnostic err;
 
-	VpuImageHeader header;
+	std::vector<std::unique_ptr<Module>> modules;
 
-	success = obj.Open("VpuShader.obj") &&
-		obj.GetSymbolValue("main", header.m_entryOffset) &&
-		obj.GetSymbolValue(TLS_SYMBOL, header.m_tlsSize);
+	for (int i = 0; i < kRuntimeModuleCount; i++)
+		modules.push_back(load_runtime_module(i, context));
 
-	if (success) {
-		header.m_codeSize = obj.GetCodeSize();
-		header.m_relocationCount = obj.GetRelocations().size();
+	modules.push_back(parseIR(MemoryBufferRef(dxil, "shader.dxil"), err, context));
 
-		hr = D3DCreateBlob(header.GetSerializationSize(), outVpuImage);
-		assert(hr == S_OK);
+	pDisassembly->Release();
 
-		VpuImageHeader * image = (VpuImageHeader*) (*outVpuImage)->GetBufferPointer();
+	if (!modules.back()) {
+		err.print("vpu_compiler", errs());
+		return false;
+	}
 
-		memcpy(image, &header, sizeof(header));
+	// Shaders the vectorizer can't handle keep the scalar entry point
+	if (simdWidth != 0 && !vpu_vectorize(*modules.back(), simdWidth))
+		simdWidth = 0;
 
-		const std::vector<VpuObjRelocation> & objRelocations = obj.GetRelocations();
+	std::unique_ptr<Module> linked = llvm_link_modules("vpu_compiler", context, modules);
+	if (!linked)
+		return false;
 
-		VpuRelocation * relocations = (VpuRelocation *)(image + 1);
+	LlvmCompileOptions compileOptions;
+	if (options->m_optLevel <= 3)
+		compileOptions.m_optLevel = (char)('0' + options->m_optLevel);
 
-		int relocationCount = 0;
-		for (auto & objr : objRelocations) {
-			VpuRelocation & r = relocations[relocationCount++];
+	SmallVector<char, 0> object;
 
-			r.m_fixupOffset = objr.m_fixupOffset;
-			r.m_type = objr.m_type;
+	if (llvm_compile_module("vpu_compiler", context, std::move(linked), compileOptions, object) != 0)
+		return false;
 
-			if (objr.m_symbolName == TLS_SYMBOL)
-				r.m_referenceOffset = header.GetTlsOffset();
-			else {
+	VpuObject obj;
 
-				std::string name = objr.m_symbolName;
+	bool success = obj.Open(StringRef(object.data(), object.size()), "VpuShader.obj") &&
+		build_image(obj, (uint16_t)simdWidth, outVpuImage);
 
-				if (!obj.GetSymbolValue(name.c_str(), r.m_referenceOffset)) {
-					success = false;
-					break;
-				}
-			}
-		}
+	obj.Close();
 
-		if (success) {
-			assert(relocationCount == header.m_relocationCount);
-			uint8_t * code = (uint8_t *)&relocations[header.m_relocationCount];
-			obj.GetCode(code, header.m_codeSize);
-		}
-	}
+	if (success && !options->m_bypassCache)
+		s_shaderCache->Store(cacheKey, *outVpuImage);
 
-	obj.Close();
+	return success;
+}
 
-	return true;
+extern "C" __declspec(dllexport) bool vpu_compiler(ID3DBlob * inDxilByteCode, ID3DBlob ** outVpuImage)
+{
+	return vpu_compiler_ex(inDxilByteCode, nullptr, outVpuImage);
 }
@@ -0,0 +1,118 @@
+#include "VpuShaderCache.h"
+#include "VpuImage.h"
+
+#include "llvm/Support/MD5.h"
+
+#include <d3dcompiler.h>
+
+#include <assert.h>
+
+using namespace llvm;
+
+// Bump whenever code generation changes in a way the runtime library hash
+// does not capture (compiler options, image layout, ...)
+#define VPU_COMPILER_VERSION "VpuCompiler 1.1"
+
+VpuShaderCache::VpuShaderCache()
+{
+	wchar_t path[MAX_PATH];
+
+	DWORD length = GetEnvironmentVariableW(L"VPU_SHADER_CACHE_DIR", path, MAX_PATH);
+	if (length != 0 && length < MAX_PATH) {
+		m_directory = path;
+	}
+	else {
+		length = GetEnvironmentVariableW(L"LOCALAPPDATA", path, MAX_PATH);
+		if (length == 0 || length >= MAX_PATH)
+			return;
+
+		m_directory = std::wstring(path) + L"\\VpuShaderCache";
+	}
+
+	if (!CreateDirectoryW(m_directory.c_str(), NULL) && GetLastError() != ERROR_ALREADY_EXISTS)
+		m_directory.clear();
+}
+
+std::string VpuShaderCache::ComputeKey(ID3DBlob * dxilByteCode, const void * runtime, size_t runtimeSize, const void * options, size_t optionsSize)
+{
+	MD5 hash;
+
+	hash.update(VPU_COMPILER_VERSION);
+	hash.update(ArrayRef<uint8_t>((const uint8_t *)runtime, runtimeSize));
+	hash.update(ArrayRef<uint8_t>((const uint8_t *)options, optionsSize));
+	hash.update(ArrayRef<uint8_t>((const uint8_t *)dxilByteCode->GetBufferPointer(), dxilByteCode->GetBufferSize()));
+
+	MD5::MD5Result result;
+	hash.final(result);
+
+	return result.digest().str();
+}
+
+std::wstring VpuShaderCache::GetEntryPath(const std::string & key)
+{
+	return m_directory + L"\\" + std::wstring(key.begin(), key.end()) + L".vpu";
+}
+
+bool VpuShaderCache::Lookup(const std::string & key, ID3DBlob ** outVpuImage)
+{
+	if (!IsEnabled())
+		return false;
+
+	HANDLE file = CreateFileW(GetEntryPath(key).c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+
+	bool success = false;
+	LARGE_INTEGER fileSize;
+
+	if (GetFileSizeEx(file, &fileSize) &&
+		fileSize.QuadPart >= sizeof(VpuImageHeader) &&
+		fileSize.QuadPart < MAXDWORD) {
+
+		ID3DBlob * image;
+		HRESULT hr = D3DCreateBlob((SIZE_T)fileSize.QuadPart, &image);
+
+		if (hr == S_OK) {
+			DWORD bytesRead;
+			VpuImageHeader * header = (VpuImageHeader *)image->GetBufferPointer();
+
+			// A truncated or otherwise corrupted entry is treated as a miss
+			// and gets overwritten by the next Store
+			if (ReadFile(file, header, (DWORD)fileSize.QuadPart, &bytesRead, NULL) &&
+				bytesRead == fileSize.QuadPart &&
+				header->GetSerializationSize() == (uint64_t)fileSize.QuadPart) {
+				*outVpuImage = image;
+				success = true;
+			}
+			else {
+				image->Release();
+			}
+		}
+	}
+
+	CloseHandle(file);
+
+	return success;
+}
+
+void VpuShaderCache::Store(const std::string & key, ID3DBlob * vpuImage)
+{
+	if (!IsEnabled())
+		return;
+
+	std::wstring path = GetEntryPath(key);
+	std::wstring tempPath = path + L"." + std::to_wstring(GetCurrentProcessId()) + L"." + std::to_wstring(GetCurrentThreadId()) + L".tmp";
+
+	HANDLE file = CreateFileW(tempPath.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return;
+
+	DWORD bytesWritten;
+	bool written = WriteFile(file, vpuImage->GetBufferPointer(), (DWORD)vpuImage->GetBufferSize(), &bytesWritten, NULL) &&
+		bytesWritten == vpuImage->GetBufferSize();
+
+	CloseHandle(file);
+
+	if (!written || !MoveFileExW(tempPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING))
+		DeleteFileW(tempPath.c_str());
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <Windows.h>
+#include <d3dcommon.h>
+
+#include <string>
+
+// Content addressed on-disk cache of compiled VPU images.
+//
+// Images are stored as <key>.vpu where the key is the MD5 of the compiler
+// version, the VPU runtime library, the compile options and the DXIL byte
+// code, so any change to one of them misses the cache instead of returning a
+// stale image. Entries are written to a temporary file and renamed into
+// place, which keeps concurrent writers (multiple processes creating the
+// same shader) from exposing partially written files.
+//
+// The cache lives in %VPU_SHADER_CACHE_DIR% if set, or in
+// %LOCALAPPDATA%\VpuShaderCache otherwise.
+
+class VpuShaderCache
+{
+public:
+
+	VpuShaderCache();
+
+	bool IsEnabled() { return !m_directory.empty(); }
+
+	std::string ComputeKey(ID3DBlob * dxilByteCode, const void * runtime, size_t runtimeSize, const void * options, size_t optionsSize);
+
+	bool Lookup(const std::string & key, ID3DBlob ** outVpuImage);
+	void Store(const std::string & key, ID3DBlob * vpuImage);
+
+private:
+
+	std::wstring GetEntryPath(const std::string & key);
+
+	std::wstring m_directory;
+};
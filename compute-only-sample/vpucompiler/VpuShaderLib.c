@@ -103,3 +103,8 @@ uint32_t dx_op_threadId_i32(void)
 {
     return g_tls.m_id;
 }
+
+uint32_t vpu_threadCount_i32(void)
+{
+    return g_tls.m_idCount;
+}
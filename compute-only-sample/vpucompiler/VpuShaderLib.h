@@ -46,3 +46,5 @@ void dx_op_bufferStore_i32(
 	uint8_t mask);
 
 uint32_t dx_op_threadId_i32(void);
+
+uint32_t vpu_threadCount_i32(void);
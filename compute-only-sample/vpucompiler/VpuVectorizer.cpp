@@ -0,0 +1,400 @@
+#include "VpuVectorizer.h"
+
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DerivedTypes.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+
+#include <map>
+#include <vector>
+
+using namespace llvm;
+
+#define ENTRY_NAME "main"
+#define THREAD_ID_NAME "dx.op.threadId.i32"
+#define THREAD_COUNT_NAME "vpu.threadCount.i32"
+
+#define DXIL_OP_THREAD_ID 93
+
+namespace {
+
+class VpuVectorizer
+{
+public:
+
+	VpuVectorizer(Module & module, unsigned width) :
+		m_module(module),
+		m_context(module.getContext()),
+		m_builder(module.getContext()),
+		m_width(width)
+	{
+	}
+
+	bool Run();
+
+private:
+
+	enum DxOp
+	{
+		kDxOpNone,
+		kDxOpCreateHandle,
+		kDxOpThreadId,
+		kDxOpBufferLoad,
+		kDxOpBufferStore,
+		kDxOpUnsupported
+	};
+
+	DxOp GetDxOp(Instruction & inst);
+
+	bool VectorizeInstruction(Instruction & inst);
+	bool VectorizeBufferLoad(CallInst & call);
+	bool VectorizeBufferStore(CallInst & call);
+	bool VectorizeExtractValue(ExtractValueInst & extract);
+
+	void CloneUniform(Instruction & inst);
+
+	bool IsVarying(Value * value) { return m_varying.count(value) != 0; }
+	Value * GetUniform(Value * value);
+	Value * GetVector(Value * value);
+
+	Value * GetElementAddresses(Value * handle, Value * index, Value * offset, Type * elementType);
+
+	Function * GetFunction(const char * name, FunctionType * type);
+	void RemoveUnusedDeclarations();
+
+	Module & m_module;
+	LLVMContext & m_context;
+	IRBuilder<> m_builder;
+	unsigned m_width;
+
+	// Original value to its scalar copy or to its vector form
+	std::map<Value *, Value *> m_uniform;
+	std::map<Value *, Value *> m_varying;
+
+	std::vector<Function *> m_declarations;
+
+	Value * m_laneIds;
+	Value * m_laneMask;
+};
+
+Function * VpuVectorizer::GetFunction(const char * name, FunctionType * type)
+{
+	Function * function = m_module.getFunction(name);
+
+	if (function == nullptr) {
+		function = Function::Create(type, GlobalValue::ExternalLinkage, name, &m_module);
+		m_declarations.push_back(function);
+	}
+
+	return (function->getFunctionType() == type) ? function : nullptr;
+}
+
+void VpuVectorizer::RemoveUnusedDeclarations()
+{
+	for (Function * function : m_declarations)
+		if (function->use_empty())
+			function->eraseFromParent();
+
+	m_declarations.clear();
+}
+
+VpuVectorizer::DxOp VpuVectorizer::GetDxOp(Instruction & inst)
+{
+	CallInst * call = dyn_cast<CallInst>(&inst);
+	if (call == nullptr)
+		return kDxOpNone;
+
+	Function * callee = call->getCalledFunction();
+	if (callee == nullptr)
+		return kDxOpUnsupported;
+
+	StringRef name = callee->getName();
+
+	if (name == "dx.op.createHandle")
+		return kDxOpCreateHandle;
+	if (name == THREAD_ID_NAME)
+		return kDxOpThreadId;
+	if (name == "dx.op.bufferLoad.i32" || name == "dx.op.bufferLoad.f32")
+		return kDxOpBufferLoad;
+	if (name == "dx.op.bufferStore.i32" || name == "dx.op.bufferStore.f32")
+		return kDxOpBufferStore;
+
+	return kDxOpUnsupported;
+}
+
+Value * VpuVectorizer::GetUniform(Value * value)
+{
+	auto it = m_uniform.find(value);
+	return (it != m_uniform.end()) ? it->second : value;
+}
+
+Value * VpuVectorizer::GetVector(Value * value)
+{
+	auto it = m_varying.find(value);
+	if (it != m_varying.end())
+		return it->second;
+
+	return m_builder.CreateVectorSplat(m_width, GetUniform(value));
+}
+
+void VpuVectorizer::CloneUniform(Instruction & inst)
+{
+	Instruction * clone = inst.clone();
+
+	for (unsigned i = 0; i < clone->getNumOperands(); i++)
+		clone->setOperand(i, GetUniform(clone->getOperand(i)));
+
+	m_builder.Insert(clone, inst.getName());
+	m_uniform[&inst] = clone;
+}
+
+// Per lane address of an element, computed the same way as the scalar
+// runtime: m_base + index * m_elementSize + offset
+Value * VpuVectorizer::GetElementAddresses(Value * handle, Value * index, Value * offset, Type * elementType)
+{
+	Value * descriptor = GetUniform(handle);
+
+	if (descriptor->getType()->isStructTy())
+		descriptor = m_builder.CreateExtractValue(descriptor, 0);
+
+	Type * int8Type = Type::getInt8Ty(m_context);
+	Type * int32Type = Type::getInt32Ty(m_context);
+	StructType * descriptorType = StructType::get(m_context, { int8Type->getPointerTo(), int32Type });
+
+	descriptor = m_builder.CreateBitCast(descriptor, descriptorType->getPointerTo());
+
+	Value * base = m_builder.CreateLoad(m_builder.CreateStructGEP(descriptorType, descriptor, 0));
+	Value * elementSize = m_builder.CreateLoad(m_builder.CreateStructGEP(descriptorType, descriptor, 1));
+
+	Value * byteOffset = m_builder.CreateAdd(
+		m_builder.CreateMul(GetVector(index), m_builder.CreateVectorSplat(m_width, elementSize)),
+		GetVector(offset));
+
+	Type * intPtrType = m_module.getDataLayout().getIntPtrType(m_context);
+	byteOffset = m_builder.CreateZExt(byteOffset, VectorType::get(intPtrType, m_width));
+
+	Value * addresses = m_builder.CreateGEP(int8Type, m_builder.CreateVectorSplat(m_width, base), byteOffset);
+
+	return m_builder.CreateBitCast(addresses, VectorType::get(elementType->getPointerTo(), m_width));
+}
+
+// The scalar runtime only reads component 0, the other components and the
+// status are zero
+bool VpuVectorizer::VectorizeBufferLoad(CallInst & call)
+{
+	StructType * resultType = dyn_cast<StructType>(call.getType());
+	if (resultType == nullptr || IsVarying(call.getArgOperand(1)))
+		return false;
+
+	Type * elementType = resultType->getElementType(0);
+	VectorType * vectorType = VectorType::get(elementType, m_width);
+
+	Value * addresses = GetElementAddresses(call.getArgOperand(1), call.getArgOperand(2), call.getArgOperand(3), elementType);
+
+	m_varying[&call] = m_builder.CreateMaskedGather(addresses, 4, m_laneMask, Constant::getNullValue(vectorType), call.getName());
+
+	return true;
+}
+
+bool VpuVectorizer::VectorizeExtractValue(ExtractValueInst & extract)
+{
+	Value * aggregate = extract.getAggregateOperand();
+
+	if (extract.getNumIndices() != 1 ||
+		!isa<Instruction>(aggregate) ||
+		GetDxOp(*cast<Instruction>(aggregate)) != kDxOpBufferLoad)
+		return false;
+
+	if (extract.getIndices()[0] == 0)
+		m_varying[&extract] = m_varying[aggregate];
+	else
+		m_uniform[&extract] = Constant::getNullValue(extract.getType());
+
+	return true;
+}
+
+// The scalar runtime only writes component 0 and requires a mask of 1
+bool VpuVectorizer::VectorizeBufferStore(CallInst & call)
+{
+	ConstantInt * mask = dyn_cast<ConstantInt>(call.getArgOperand(8));
+	if (mask == nullptr || mask->getZExtValue() != 1 || IsVarying(call.getArgOperand(1)))
+		return false;
+
+	Value * value = call.getArgOperand(4);
+
+	Value * addresses = GetElementAddresses(call.getArgOperand(1), call.getArgOperand(2), call.getArgOperand(3), value->getType());
+
+	m_builder.CreateMaskedScatter(GetVector(value), addresses, 4, m_laneMask);
+
+	return true;
+}
+
+bool VpuVectorizer::VectorizeInstruction(Instruction & inst)
+{
+	DxOp op = GetDxOp(inst);
+
+	if (op == kDxOpUnsupported || isa<PHINode>(inst))
+		return false;
+
+	if (isa<ReturnInst>(inst)) {
+		m_builder.CreateRetVoid();
+		return true;
+	}
+
+	if (op == kDxOpThreadId) {
+		m_varying[&inst] = m_laneIds;
+		return true;
+	}
+
+	bool varying = false;
+	for (Value * operand : inst.operands())
+		varying |= IsVarying(operand);
+
+	// Thread invariant work runs once for all lanes. A uniform store writes
+	// the same value to the same location from every thread, doing it once
+	// is equivalent.
+	if (!varying) {
+		if (op == kDxOpNone && inst.mayReadOrWriteMemory())
+			return false;
+
+		CloneUniform(inst);
+		return true;
+	}
+
+	if (op == kDxOpBufferLoad)
+		return VectorizeBufferLoad(*cast<CallInst>(&inst));
+
+	if (op == kDxOpBufferStore)
+		return VectorizeBufferStore(*cast<CallInst>(&inst));
+
+	if (op != kDxOpNone || !VectorType::isValidElementType(inst.getType()))
+		return false;
+
+	Value * result;
+
+	if (BinaryOperator * binary = dyn_cast<BinaryOperator>(&inst)) {
+		Value * lhs = GetVector(binary->getOperand(0));
+		Value * rhs = GetVector(binary->getOperand(1));
+
+		// Inactive lanes hold garbage, keep them from trapping on a zero
+		// divisor
+		switch (binary->getOpcode()) {
+		case Instruction::UDiv:
+		case Instruction::SDiv:
+		case Instruction::URem:
+		case Instruction::SRem:
+			rhs = m_builder.CreateSelect(m_laneMask, rhs, m_builder.CreateVectorSplat(m_width, ConstantInt::get(binary->getType(), 1)));
+			break;
+		default:
+			break;
+		}
+
+		result = m_builder.CreateBinOp(binary->getOpcode(), lhs, rhs, inst.getName());
+
+		if (Instruction * resultInst = dyn_cast<Instruction>(result))
+			resultInst->copyIRFlags(binary);
+	}
+	else if (CmpInst * compare = dyn_cast<CmpInst>(&inst)) {
+		Value * lhs = GetVector(compare->getOperand(0));
+		Value * rhs = GetVector(compare->getOperand(1));
+
+		if (compare->isFPPredicate())
+			result = m_builder.CreateFCmp(compare->getPredicate(), lhs, rhs, inst.getName());
+		else
+			result = m_builder.CreateICmp(compare->getPredicate(), lhs, rhs, inst.getName());
+	}
+	else if (CastInst * castInst = dyn_cast<CastInst>(&inst)) {
+		result = m_builder.CreateCast(castInst->getOpcode(), GetVector(castInst->getOperand(0)),
+			VectorType::get(castInst->getType(), m_width), inst.getName());
+	}
+	else if (SelectInst * select = dyn_cast<SelectInst>(&inst)) {
+		Value * condition = select->getCondition();
+
+		condition = IsVarying(condition) ? GetVector(condition) : GetUniform(condition);
+
+		result = m_builder.CreateSelect(condition, GetVector(select->getTrueValue()), GetVector(select->getFalseValue()), inst.getName());
+	}
+	else if (ExtractValueInst * extract = dyn_cast<ExtractValueInst>(&inst)) {
+		return VectorizeExtractValue(*extract);
+	}
+	else {
+		return false;
+	}
+
+	m_varying[&inst] = result;
+
+	return true;
+}
+
+bool VpuVectorizer::Run()
+{
+	Function * scalarEntry = m_module.getFunction(ENTRY_NAME);
+
+	if (scalarEntry == nullptr ||
+		scalarEntry->isDeclaration() ||
+		scalarEntry->size() != 1 ||
+		!scalarEntry->arg_empty() ||
+		!scalarEntry->getReturnType()->isVoidTy())
+		return false;
+
+	Type * int32Type = Type::getInt32Ty(m_context);
+
+	Function * threadId = GetFunction(THREAD_ID_NAME, FunctionType::get(int32Type, { int32Type, int32Type }, false));
+	Function * threadCount = GetFunction(THREAD_COUNT_NAME, FunctionType::get(int32Type, false));
+
+	if (threadId == nullptr || threadCount == nullptr) {
+		RemoveUnusedDeclarations();
+		return false;
+	}
+
+	Function * vectorEntry = Function::Create(scalarEntry->getFunctionType(), scalarEntry->getLinkage(), ENTRY_NAME ".simd", &m_module);
+	vectorEntry->copyAttributesFrom(scalarEntry);
+
+	m_builder.SetInsertPoint(BasicBlock::Create(m_context, "entry", vectorEntry));
+
+	// Lane i runs thread m_id + i and is active if i < m_idCount
+	std::vector<Constant *> lanes;
+	for (unsigned i = 0; i < m_width; i++)
+		lanes.push_back(ConstantInt::get(int32Type, i));
+
+	Constant * laneIndex = ConstantVector::get(lanes);
+
+	Value * firstId = m_builder.CreateCall(threadId, { ConstantInt::get(int32Type, DXIL_OP_THREAD_ID), ConstantInt::get(int32Type, 0) });
+	Value * count = m_builder.CreateCall(threadCount, {});
+
+	m_laneIds = m_builder.CreateAdd(m_builder.CreateVectorSplat(m_width, firstId), laneIndex, "lane.id");
+	m_laneMask = m_builder.CreateICmpULT(laneIndex, m_builder.CreateVectorSplat(m_width, count), "lane.mask");
+
+	bool success = true;
+
+	for (Instruction & inst : scalarEntry->front()) {
+		if (!VectorizeInstruction(inst)) {
+			success = false;
+			break;
+		}
+	}
+
+	if (!success) {
+		vectorEntry->eraseFromParent();
+		RemoveUnusedDeclarations();
+		return false;
+	}
+
+	// Metadata (dx.entryPoints) and any other reference now point at the
+	// vector entry point
+	scalarEntry->replaceAllUsesWith(vectorEntry);
+	scalarEntry->eraseFromParent();
+	vectorEntry->setName(ENTRY_NAME);
+
+	return true;
+}
+
+}
+
+bool vpu_vectorize(Module & module, unsigned simdWidth)
+{
+	VpuVectorizer vectorizer(module, simdWidth);
+
+	return vectorizer.Run();
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include "llvm/IR/Module.h"
+
+// SIMD across threads code generation
+//
+// Rewrites the compute shader entry point of a DXIL module so that a single
+// call runs simdWidth consecutive threads, starting at g_tls.m_id, with every
+// per thread value held in a vector lane. Only the first g_tls.m_idCount
+// lanes are active, buffer accesses of the inactive lanes are masked off so
+// a partial batch at the end of a dispatch is safe.
+//
+// Values that do not depend on the thread id (resource handles, constants)
+// stay scalar. Buffer loads and stores with a per thread address become
+// masked gathers and scatters.
+//
+// Only straight line shaders built from the operations the VPU runtime
+// implements are handled. For anything else the module is left untouched
+// and false is returned, the caller then keeps the scalar entry point.
+
+bool vpu_vectorize(llvm::Module & module, unsigned simdWidth);
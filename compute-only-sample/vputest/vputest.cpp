@@ -4,11 +4,298 @@
 //#include <dxcapi.h>
 #include <d3dcompiler.h>
 
+#include "CosThreadGroupDispatch.h"
+
 #include <assert.h>
 #include <malloc.h>
 #include <stdio.h>
 #include <memory.h>
 #include <sstream>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+typedef struct {
+	int32_t i;
+	float f;
+} uavElement;
+
+// Same limit as CosKmDispatchEngine::kMaxThreadGroupChunk
+static const UINT kMaxThreadGroupChunk = 64;
+
+// Loaded copy of an image for one worker, the KMD keeps one per worker in
+// its shader cache entry so every worker has a private thread local storage
+// block.
+class WorkerImage
+{
+public:
+
+	WorkerImage(VpuImageHeader * header) : m_header(header)
+	{
+		m_imageSize = header->GetImageSize();
+		m_imageBase = (uint8_t *)VirtualAlloc(NULL, m_imageSize, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE);
+		m_loaded = (m_imageBase != NULL) && header->Load(m_imageBase, m_imageSize);
+	}
+
+	~WorkerImage()
+	{
+		if (m_imageBase != NULL)
+			VirtualFree(m_imageBase, 0, MEM_RELEASE);
+	}
+
+	bool IsLoaded() { return m_loaded; }
+
+	void SetUavs(uavElement ** uavs, int uavCount)
+	{
+		VpuResourceDescriptor descriptors[kVpuMaxUAVs];
+		for (int i = 0; i < uavCount; i++) {
+			descriptors[i].m_base = (int8_t *)uavs[i];
+			descriptors[i].m_elementSize = sizeof(uavElement);
+		}
+
+		CosThreadGroupDispatch::SetUavs(m_imageBase, m_header->GetTlsOffset(), descriptors, uavCount);
+	}
+
+	void Run(CosThreadGroupDispatch * dispatch)
+	{
+		dispatch->Run(m_imageBase, m_header->GetTlsOffset(), m_header->GetEntryOffset(), m_header->GetSimdWidth());
+	}
+
+private:
+
+	VpuImageHeader * m_header;
+	uint8_t * m_imageBase;
+	uint64_t m_imageSize;
+	bool m_loaded;
+};
+
+// Runs the thread groups from firstGroup on through CosThreadGroupDispatch
+// on up to workerCount threads, like CosKmDispatchEngine::Dispatch(). Returns
+// the first thread group that did not run.
+static UINT RunDispatch(VpuImageHeader * header, uavElement ** uavs, int32_t groupCount, int32_t threadsPerGroup,
+	int32_t firstGroup, int workerCount, const volatile LONG * preemptionRequested, double * time)
+{
+	CosThreadGroupDispatch dispatch;
+
+	UINT numWorkers = dispatch.Begin(groupCount, threadsPerGroup, firstGroup, workerCount, kMaxThreadGroupChunk, preemptionRequested);
+
+	std::vector<WorkerImage *> images;
+	for (UINT i = 0; i < numWorkers; i++) {
+		WorkerImage * image = new WorkerImage(header);
+		if (!image->IsLoaded()) {
+			printf("error loading binary\n");
+			exit(1);
+		}
+		image->SetUavs(uavs, 3);
+		images.push_back(image);
+	}
+
+	auto start = std::chrono::high_resolution_clock::now();
+
+	// Worker 0 is the calling thread
+	std::vector<std::thread> threads;
+	for (UINT i = 1; i < numWorkers; i++) {
+		WorkerImage * image = images[i];
+		threads.push_back(std::thread([&dispatch, image]() { image->Run(&dispatch); }));
+	}
+
+	if (numWorkers > 0)
+		images[0]->Run(&dispatch);
+
+	for (auto & thread : threads)
+		thread.join();
+
+	auto end = std::chrono::high_resolution_clock::now();
+
+	for (auto image : images)
+		delete image;
+
+	if (time)
+		*time = std::chrono::duration<double, std::milli>(end - start).count();
+
+	return dispatch.End();
+}
+
+// Runs the same image on one worker and across all cores and verifies both
+// produce the same output buffer.
+static bool DispatchTest(VpuImageHeader * header, int32_t groupCount)
+{
+	const int32_t threadsPerGroup = 4;
+	const int32_t elementCount = groupCount * threadsPerGroup;
+
+	std::vector<uavElement> in0(elementCount), in1(elementCount);
+	std::vector<uavElement> serialOut(elementCount), parallelOut(elementCount);
+
+	for (int32_t i = 0; i < elementCount; i++) {
+		in0[i].i = i;
+		in0[i].f = (float)i * 0.5f;
+		in1[i].i = elementCount - i;
+		in1[i].f = (float)(i % 97) * 0.25f;
+	}
+
+	memset(serialOut.data(), 0xcd, elementCount * sizeof(uavElement));
+	memset(parallelOut.data(), 0xcd, elementCount * sizeof(uavElement));
+
+	uavElement * serialUavs[3] = { in0.data(), in1.data(), serialOut.data() };
+	uavElement * parallelUavs[3] = { in0.data(), in1.data(), parallelOut.data() };
+
+	int workerCount = (int)std::thread::hardware_concurrency();
+	if (workerCount < 1)
+		workerCount = 1;
+
+	double serialTime;
+	double parallelTime;
+
+	UINT serialEnd = RunDispatch(header, serialUavs, groupCount, threadsPerGroup, 0, 1, NULL, &serialTime);
+	UINT parallelEnd = RunDispatch(header, parallelUavs, groupCount, threadsPerGroup, 0, workerCount, NULL, &parallelTime);
+
+	bool match = (memcmp(serialOut.data(), parallelOut.data(), elementCount * sizeof(uavElement)) == 0);
+	bool done = (serialEnd == (UINT)groupCount) && (parallelEnd == (UINT)groupCount);
+
+	printf("dispatch %d groups: serial %.3f ms, parallel (%d workers) %.3f ms, %s%s\n",
+		groupCount, serialTime, workerCount, parallelTime, match ? "outputs match" : "OUTPUTS DIFFER",
+		done ? "" : ", NOT ALL GROUPS RAN");
+
+	return match && done;
+}
+
+// Preempts a dispatch before it starts and resumes it from a thread group in
+// the middle, the groups below the resume point must be left untouched and
+// the ones after it must match an uninterrupted dispatch.
+static bool PreemptionTest(VpuImageHeader * header, int32_t groupCount, int32_t resumeGroup)
+{
+	const int32_t threadsPerGroup = 4;
+	const int32_t elementCount = groupCount * threadsPerGroup;
+
+	std::vector<uavElement> in0(elementCount), in1(elementCount);
+	std::vector<uavElement> expectedOut(elementCount), resumedOut(elementCount);
+
+	for (int32_t i = 0; i < elementCount; i++) {
+		in0[i].i = i * 5;
+		in0[i].f = (float)i * 0.125f;
+		in1[i].i = i - 17;
+		in1[i].f = (float)(i % 31);
+	}
+
+	memset(expectedOut.data(), 0xcd, elementCount * sizeof(uavElement));
+	memset(resumedOut.data(), 0xcd, elementCount * sizeof(uavElement));
+
+	uavElement * expectedUavs[3] = { in0.data(), in1.data(), expectedOut.data() };
+	uavElement * resumedUavs[3] = { in0.data(), in1.data(), resumedOut.data() };
+
+	int workerCount = (int)std::thread::hardware_concurrency();
+	if (workerCount < 1)
+		workerCount = 1;
+
+	RunDispatch(header, expectedUavs, groupCount, threadsPerGroup, 0, workerCount, NULL, NULL);
+
+	bool passed = true;
+	volatile LONG preemptionRequested = 1;
+
+	if (RunDispatch(header, resumedUavs, groupCount, threadsPerGroup, resumeGroup, workerCount, &preemptionRequested, NULL) != (UINT)resumeGroup) {
+		printf("preempted dispatch did not stop at thread group %d\n", resumeGroup);
+		passed = false;
+	}
+
+	preemptionRequested = 0;
+
+	if (RunDispatch(header, resumedUavs, groupCount, threadsPerGroup, resumeGroup, workerCount, &preemptionRequested, NULL) != (UINT)groupCount) {
+		printf("resumed dispatch did not finish\n");
+		passed = false;
+	}
+
+	int32_t resumeElement = resumeGroup * threadsPerGroup;
+
+	for (int32_t i = 0; i < resumeElement; i++) {
+		const uint8_t * bytes = (const uint8_t *)&resumedOut[i];
+		for (size_t b = 0; b < sizeof(uavElement); b++)
+			passed &= (bytes[b] == 0xcd);
+	}
+
+	passed &= (memcmp(&expectedOut[resumeElement], &resumedOut[resumeElement], (elementCount - resumeElement) * sizeof(uavElement)) == 0);
+
+	printf("preempt %d groups, resume at %d: %s\n", groupCount, resumeGroup, passed ? "passed" : "FAILED");
+
+	return passed;
+}
+
+// Runs a SIMD image against the scalar one over threadCount threads, which
+// is not a multiple of the SIMD width so the masked tail is exercised, and
+// verifies both produce the same output buffer.
+static bool SimdTest(VpuImageHeader * scalarHeader, VpuImageHeader * simdHeader, int32_t threadCount)
+{
+	std::vector<uavElement> in0(threadCount), in1(threadCount);
+	std::vector<uavElement> scalarOut(threadCount + 1), simdOut(threadCount + 1);
+
+	for (int32_t i = 0; i < threadCount; i++) {
+		in0[i].i = i * 3;
+		in0[i].f = (float)i * 0.75f;
+		in1[i].i = -i;
+		in1[i].f = (float)(i % 13) * 2.0f;
+	}
+
+	// One guard element past the end catches stores from inactive lanes
+	memset(scalarOut.data(), 0xcd, (threadCount + 1) * sizeof(uavElement));
+	memset(simdOut.data(), 0xcd, (threadCount + 1) * sizeof(uavElement));
+
+	uavElement * scalarUavs[3] = { in0.data(), in1.data(), scalarOut.data() };
+	uavElement * simdUavs[3] = { in0.data(), in1.data(), simdOut.data() };
+
+	// A single group of threadCount threads on one worker
+	double scalarTime;
+	double simdTime;
+
+	RunDispatch(scalarHeader, scalarUavs, 1, threadCount, 0, 1, NULL, &scalarTime);
+	RunDispatch(simdHeader, simdUavs, 1, threadCount, 0, 1, NULL, &simdTime);
+
+	bool match = (memcmp(scalarOut.data(), simdOut.data(), (threadCount + 1) * sizeof(uavElement)) == 0);
+
+	printf("simd x%d, %d threads: scalar %.3f ms, simd %.3f ms, %s\n",
+		simdHeader->GetSimdWidth(), threadCount, scalarTime, simdTime,
+		match ? "outputs match" : "OUTPUTS DIFFER");
+
+	return match;
+}
+
+// Submits shaderCount compilations to the compiler thread pool for every
+// pool size from 1 to shaderCount threads and reports the wall time until
+// all images are ready. The cache is bypassed so every job is a full compile.
+static bool CompileBenchmark(ID3DBlob ** byteCodes, int byteCodeCount, int shaderCount)
+{
+	VpuCompilerOptions options = {};
+	options.m_optLevel = 2;
+	options.m_bypassCache = true;
+
+	std::vector<VpuCompileJob *> jobs(shaderCount);
+	bool success = true;
+
+	for (int threadCount = 1; threadCount <= shaderCount; threadCount++) {
+		vpu_compiler_set_thread_count(threadCount);
+
+		auto start = std::chrono::high_resolution_clock::now();
+
+		for (int i = 0; i < shaderCount; i++)
+			jobs[i] = vpu_compiler_submit(byteCodes[i % byteCodeCount], &options);
+
+		for (int i = 0; i < shaderCount; i++) {
+			ID3DBlob * image;
+			if (vpu_compiler_wait(jobs[i], &image))
+				image->Release();
+			else
+				success = false;
+		}
+
+		auto end = std::chrono::high_resolution_clock::now();
+
+		printf("compile %d shaders on %d threads: %.3f ms\n",
+			shaderCount, threadCount, std::chrono::duration<double, std::milli>(end - start).count());
+	}
+
+	vpu_compiler_set_thread_count(0);
+
+	return success;
+}
 
 int main(int argc, char ** argv)
 {
@@ -32,11 +319,6 @@ int main(int argc, char ** argv)
 		exit(1);
 	}
 
-	typedef struct {
-		int32_t i;
-		float f;
-	} uavElement;
-
 	uavElement uavData[3][4] = {
 		{ { 4, 4.0 }, { 2, 2.0 }, { 7, 7.0 }, { 10, 10.0} },
 		{ { 2, 2.0 }, { 8, 8.0 }, { 3, 3.0 }, { 2, 2.0 } },
@@ -80,6 +362,74 @@ int main(int argc, char ** argv)
 		printf("{ %d %f } ", uavData[2][i].i, uavData[2][i].f);
 	printf("\n");
 
+	printf("running dispatch test\n");
+
+	const int32_t groupCounts[] = { 1, 3, 64, 4096, 65536 };
+	bool passed = true;
+
+	for (int32_t groupCount : groupCounts)
+		passed &= DispatchTest(header, groupCount);
+
+	if (!passed) {
+		printf("dispatch test failed\n");
+		exit(1);
+	}
+
+	printf("running preemption test\n");
+
+	passed &= PreemptionTest(header, 4096, 1000);
+	passed &= PreemptionTest(header, 64, 63);
+
+	if (!passed) {
+		printf("preemption test failed\n");
+		exit(1);
+	}
+
+	printf("running simd test\n");
+
+	const UINT simdWidths[] = { 4, 8, 16 };
+	const int32_t threadCounts[] = { 1, 7, 4099, 262147 };
+
+	for (UINT simdWidth : simdWidths) {
+		VpuCompilerOptions options;
+		options.m_simdWidth = simdWidth;
+
+		ID3DBlob *pSimdImage;
+		if (!vpu_compiler_ex(pByteCode, &options, &pSimdImage)) {
+			printf("failed to compile simd byte code\n");
+			exit(1);
+		}
+
+		VpuImageHeader * simdHeader = (VpuImageHeader *)pSimdImage->GetBufferPointer();
+
+		if (simdHeader->GetSimdWidth() != simdWidth) {
+			printf("shader was not vectorized\n");
+			exit(1);
+		}
+
+		for (int32_t threadCount : threadCounts)
+			passed &= SimdTest(header, simdHeader, threadCount);
+
+		pSimdImage->Release();
+	}
+
+	if (!passed) {
+		printf("simd test failed\n");
+		exit(1);
+	}
+
+	printf("running compile benchmark\n");
+
+	int shaderCount = (argc > 1) ? atoi(argv[1]) : 8;
+	ID3DBlob * byteCodes[] = { pByteCode, pNullByteCode };
+
+	if (shaderCount < 1 || !CompileBenchmark(byteCodes, 2, shaderCount)) {
+		printf("compile benchmark failed\n");
+		exit(1);
+	}
+
+	vpu_compiler_shutdown();
+
 	printf("done \n");
 
 }
@@ -0,0 +1,473 @@
+#pragma once
+
+//
+// Timeline of the DMA buffer submissions of the render-only adapter
+//
+// The KMD records when a submission is queued by QueueDmaBuffer(), when the
+// worker thread takes it, when every command of a software command buffer,
+// every paging operation and the binning and rendering control lists of a HW
+// command buffer start and end, and when its fence is reported to the VidSch.
+// Events go into a ring that keeps the last Capacity of them. Recording costs
+// an interlocked increment and a performance counter read, and a single load
+// while the timeline is stopped.
+//
+// A slot carries the position of the event it holds, cleared while the event
+// is written, so a reader copying the ring while the worker keeps recording
+// skips the events overwritten under it instead of returning torn ones.
+//
+// The KMD hands the events out through the RosEscapeTimeline escape.
+// RosTimelineWriteChromeTrace() turns them into the Chrome trace event JSON
+// format, which chrome://tracing and Perfetto load. GpuCommandId comes from
+// RosGpuCommand.h, included first.
+//
+
+enum RosTimelineEventType
+{
+    RosTimelineEventQueued,             // QueueDmaBuffer()
+    RosTimelineEventStarted,            // worker thread took the submission
+    RosTimelineEventCommandStart,       // m_command is a GpuCommandId
+    RosTimelineEventCommandEnd,
+    RosTimelineEventPagingStart,        // m_command is a RosTimelinePagingCommand
+    RosTimelineEventPagingEnd,
+    RosTimelineEventControlListStart,   // m_command is a RosTimelineControlList
+    RosTimelineEventControlListEnd,
+    RosTimelineEventCompleted           // fence reported to the VidSch
+};
+
+enum RosTimelinePagingCommand
+{
+    RosTimelinePagingFill,
+    RosTimelinePagingTransfer
+};
+
+enum RosTimelineControlList
+{
+    RosTimelineControlListBinning,
+    RosTimelineControlListRendering
+};
+
+struct RosTimelineEvent
+{
+    UINT64  m_timestamp;            // performance counter ticks
+    UINT    m_type;                 // RosTimelineEventType
+    UINT    m_fenceId;              // SubmissionFenceId
+    UINT    m_command;
+    UINT    m_data;                 // DMA buffer offset of the command, of the submission for a control list
+};
+
+static inline UINT64
+RosTimelineQueryTicks()
+{
+#ifdef _KERNEL_MODE
+    return (UINT64)KeQueryPerformanceCounter(NULL).QuadPart;
+#else
+    LARGE_INTEGER counter;
+
+    QueryPerformanceCounter(&counter);
+
+    return (UINT64)counter.QuadPart;
+#endif
+}
+
+static inline UINT64
+RosTimelineQueryTickFrequency()
+{
+    LARGE_INTEGER frequency;
+
+#ifdef _KERNEL_MODE
+    KeQueryPerformanceCounter(&frequency);
+#else
+    QueryPerformanceFrequency(&frequency);
+#endif
+
+    return (UINT64)frequency.QuadPart;
+}
+
+template <ULONG Capacity>
+class RosTimeline
+{
+    static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of 2");
+
+public:
+
+    void Initialize()
+    {
+        for (ULONG i = 0; i < Capacity; i++)
+        {
+            m_slots[i].m_sequence = 0;
+        }
+
+        m_position = 0;
+        m_bEnabled = 0;
+
+        m_tickFrequency = RosTimelineQueryTickFrequency();
+    }
+
+    void Enable(bool bEnable)
+    {
+        WriteRelease(&m_bEnabled, bEnable ? 1 : 0);
+    }
+
+    //
+    // Position of the next event, where a reader starts to only get the
+    // events recorded from now on
+    //
+
+    UINT64 GetPosition() const
+    {
+        return (UINT64)ReadAcquire64(&m_position);
+    }
+
+    UINT64 GetTickFrequency() const
+    {
+        return m_tickFrequency;
+    }
+
+    void Record(
+        RosTimelineEventType    type,
+        UINT                    fenceId,
+        UINT                    command = 0,
+        UINT                    data = 0)
+    {
+        if (!ReadNoFence(&m_bEnabled))
+        {
+            return;
+        }
+
+        UINT64 position = (UINT64)InterlockedIncrement64(&m_position) - 1;
+        Slot * pSlot = &m_slots[position & (Capacity - 1)];
+
+        InterlockedExchange64(&pSlot->m_sequence, 0);
+
+        pSlot->m_event.m_timestamp = RosTimelineQueryTicks();
+        pSlot->m_event.m_type = type;
+        pSlot->m_event.m_fenceId = fenceId;
+        pSlot->m_event.m_command = command;
+        pSlot->m_event.m_data = data;
+
+        WriteRelease64(&pSlot->m_sequence, (LONG64)(position + 1));
+    }
+
+    //
+    // Copies up to maxEvents events from *pPosition on, oldest first, and
+    // moves *pPosition past them. Stops at an event still being recorded.
+    // Events overwritten before they were copied are added to *pNumDropped.
+    //
+
+    UINT Read(
+        UINT64 *            pPosition,
+        RosTimelineEvent *  pEvents,
+        UINT                maxEvents,
+        UINT64 *            pNumDropped)
+    {
+        UINT64 position = *pPosition;
+        UINT64 end = (UINT64)ReadAcquire64(&m_position);
+        UINT numEvents = 0;
+
+        if (end - position > Capacity)
+        {
+            *pNumDropped += end - Capacity - position;
+            position = end - Capacity;
+        }
+
+        for (; (position < end) && (numEvents < maxEvents); position++)
+        {
+            Slot * pSlot = &m_slots[position & (Capacity - 1)];
+            UINT64 sequence = (UINT64)ReadAcquire64(&pSlot->m_sequence);
+
+            if (sequence < position + 1)
+            {
+                //
+                // Not written yet (0 while any event is written to the slot)
+                //
+
+                break;
+            }
+
+            pEvents[numEvents] = pSlot->m_event;
+
+            MemoryBarrier();
+
+            if ((sequence != position + 1) ||
+                ((UINT64)ReadNoFence64(&pSlot->m_sequence) != sequence))
+            {
+                (*pNumDropped)++;
+                continue;
+            }
+
+            numEvents++;
+        }
+
+        *pPosition = position;
+
+        return numEvents;
+    }
+
+private:
+
+    struct Slot
+    {
+        volatile LONG64     m_sequence;
+        RosTimelineEvent    m_event;
+    };
+
+    DECLSPEC_CACHEALIGN volatile LONG64 m_position;
+    volatile LONG                       m_bEnabled;
+    UINT64                              m_tickFrequency;
+
+    DECLSPEC_CACHEALIGN Slot            m_slots[Capacity];
+};
+
+//
+// Escape the timeline is started, stopped and read with. RosTimelineRead
+// fills the private driver data after the header with the events from
+// m_position on, and moves m_position past them. RosTimelineStart returns the
+// position to start reading at.
+//
+
+enum RosEscapeId
+{
+    RosEscapeTimeline = 1
+};
+
+enum RosTimelineOperation
+{
+    RosTimelineStart,
+    RosTimelineStop,
+    RosTimelineRead
+};
+
+struct RosTimelineEscape
+{
+    UINT                m_escapeId;         // RosEscapeTimeline
+    UINT                m_operation;        // RosTimelineOperation
+
+    UINT64              m_tickFrequency;
+    UINT64              m_position;
+    UINT64              m_numDropped;
+    UINT                m_numEvents;
+
+    RosTimelineEvent    m_events[1];
+};
+
+//
+// Chrome trace export
+//
+// The adapter has a single node, the one thread of the trace. A DMA buffer is
+// a slice from the worker thread taking it until its fence is reported, with
+// its commands nested in it. The time spent in the queue is an async slice.
+//
+
+class RosTimelineJsonWriter
+{
+public:
+
+    RosTimelineJsonWriter(char * pBuffer, SIZE_T bufferSize) :
+        m_pBuffer(pBuffer),
+        m_bufferSize(bufferSize),
+        m_length(0)
+    {
+        // do nothing
+    }
+
+    void Append(const char * pString)
+    {
+        for (; *pString; pString++)
+        {
+            Append(*pString);
+        }
+    }
+
+    void Append(char c)
+    {
+        if (m_length < m_bufferSize)
+        {
+            m_pBuffer[m_length] = c;
+        }
+
+        m_length++;
+    }
+
+    void AppendNumber(UINT64 value)
+    {
+        char digits[20];
+        UINT numDigits = 0;
+
+        do
+        {
+            digits[numDigits++] = (char)('0' + value % 10);
+            value /= 10;
+        } while (value);
+
+        while (numDigits)
+        {
+            Append(digits[--numDigits]);
+        }
+    }
+
+    //
+    // Microseconds with 3 decimals, the unit of the trace timestamps
+    //
+
+    void AppendMicroseconds(UINT64 ticks, UINT64 tickFrequency)
+    {
+        UINT64 nanoseconds = (ticks / tickFrequency)*1000000000 + (ticks % tickFrequency)*1000000000/tickFrequency;
+
+        AppendNumber(nanoseconds/1000);
+        Append('.');
+        Append((char)('0' + nanoseconds/100 % 10));
+        Append((char)('0' + nanoseconds/10 % 10));
+        Append((char)('0' + nanoseconds % 10));
+    }
+
+    SIZE_T GetLength() const
+    {
+        return m_length;
+    }
+
+private:
+
+    char *  m_pBuffer;
+    SIZE_T  m_bufferSize;
+    SIZE_T  m_length;
+};
+
+static inline const char *
+RosTimelineCommandName(
+    const RosTimelineEvent * pEvent)
+{
+    switch (pEvent->m_type)
+    {
+    case RosTimelineEventPagingStart:
+    case RosTimelineEventPagingEnd:
+        return (RosTimelinePagingFill == pEvent->m_command) ? "Fill" : "Transfer";
+
+    case RosTimelineEventControlListStart:
+    case RosTimelineEventControlListEnd:
+        return (RosTimelineControlListBinning == pEvent->m_command) ? "Binning" : "Rendering";
+
+    default:
+        break;
+    }
+
+    switch (pEvent->m_command)
+    {
+    case Nop: return "Nop";
+    case ResourceCopy: return "ResourceCopy";
+    case Header: return "Header";
+    default: return "Command";
+    }
+}
+
+//
+// Opens the JSON object of a trace event, the caller adds the rest
+//
+
+static inline void
+RosTimelineWriteEvent(
+    RosTimelineJsonWriter *     pWriter,
+    const char *                pName,
+    const char *                pPhase,
+    const RosTimelineEvent *    pEvent,
+    UINT64                      startTimestamp,
+    UINT64                      tickFrequency)
+{
+    pWriter->Append("{");
+
+    if (pName)
+    {
+        pWriter->Append("\"name\":\"");
+        pWriter->Append(pName);
+        pWriter->Append("\",");
+    }
+
+    pWriter->Append("\"ph\":\"");
+    pWriter->Append(pPhase);
+    pWriter->Append("\",\"pid\":1,\"tid\":0,\"ts\":");
+    pWriter->AppendMicroseconds(pEvent->m_timestamp - startTimestamp, tickFrequency);
+}
+
+//
+// Writes the events, as returned by RosTimeline::Read(), as a Chrome trace
+// JSON object. Returns its length, also when it did not fit in bufferSize, so
+// a NULL buffer sizes it. The string is NUL terminated when there is room.
+//
+
+static inline SIZE_T
+RosTimelineWriteChromeTrace(
+    const RosTimelineEvent *    pEvents,
+    UINT                        numEvents,
+    UINT64                      tickFrequency,
+    char *                      pBuffer,
+    SIZE_T                      bufferSize)
+{
+    RosTimelineJsonWriter writer(pBuffer, bufferSize);
+    UINT64 startTimestamp = MAXUINT64;
+
+    for (UINT i = 0; i < numEvents; i++)
+    {
+        if (pEvents[i].m_timestamp < startTimestamp)
+        {
+            startTimestamp = pEvents[i].m_timestamp;
+        }
+    }
+
+    writer.Append("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    writer.Append("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"GPU\"}}");
+
+    for (UINT i = 0; i < numEvents; i++)
+    {
+        const RosTimelineEvent * pEvent = &pEvents[i];
+
+        writer.Append(",\n");
+
+        switch (pEvent->m_type)
+        {
+        case RosTimelineEventQueued:
+        case RosTimelineEventStarted:
+            {
+                bool bQueued = (RosTimelineEventQueued == pEvent->m_type);
+
+                RosTimelineWriteEvent(&writer, "Queued", bQueued ? "b" : "e", pEvent, startTimestamp, tickFrequency);
+                writer.Append(",\"cat\":\"queue\",\"id\":");
+                writer.AppendNumber(pEvent->m_fenceId);
+                writer.Append(",\"args\":{\"fence\":");
+                writer.AppendNumber(pEvent->m_fenceId);
+                writer.Append("}}");
+
+                if (!bQueued)
+                {
+                    writer.Append(",\n");
+                    RosTimelineWriteEvent(&writer, "DMA buffer", "B", pEvent, startTimestamp, tickFrequency);
+                    writer.Append(",\"args\":{\"fence\":");
+                    writer.AppendNumber(pEvent->m_fenceId);
+                    writer.Append("}}");
+                }
+            }
+            break;
+        case RosTimelineEventCommandStart:
+        case RosTimelineEventPagingStart:
+        case RosTimelineEventControlListStart:
+            RosTimelineWriteEvent(&writer, RosTimelineCommandName(pEvent), "B", pEvent, startTimestamp, tickFrequency);
+            writer.Append(",\"args\":{\"offset\":");
+            writer.AppendNumber(pEvent->m_data);
+            writer.Append("}}");
+            break;
+        default:
+            RosTimelineWriteEvent(&writer, NULL, "E", pEvent, startTimestamp, tickFrequency);
+            writer.Append("}");
+            break;
+        }
+    }
+
+    writer.Append("\n]}\n");
+
+    SIZE_T length = writer.GetLength();
+
+    if (length < bufferSize)
+    {
+        pBuffer[length] = 0;
+    }
+
+    return length;
+}
@@ -1,8 +1,16 @@
 #pragma once
+
+//
+// The instruction set defines are shared with the KMD (software VC4 emulator),
+// the assembler/disassembler helpers below are user mode only.
+//
+
+#if !defined(_KERNEL_MODE)
 #include <stdio.h>
 #include <stdint.h>
 #include <tchar.h>
 #include <windows.h>
+#endif // !defined(_KERNEL_MODE)
 
 //
 // Video Core IV - QPU instruction set define
@@ -475,6 +483,8 @@ typedef unsigned __int64 VC4_QPU_INSTRUCTION; // every QPU instruction is 64bits
 #define VC4_QPU_IS_OPCODE_BRANCH(Inst)  (VC4_QPU_GET_SIG(Inst) == VC4_QPU_SIG_BRANCH)
 #define VC4_QPU_IS_OPCODE_SEMAPHORE(Inst) ((VC4_QPU_IS_OPCODE_LOAD_IM(Inst) && VC4_QPU_GET_IMMEDIATE_TYPE(Inst) == VC4_QPU_IMMEDIATE_TYPE_SEMAPHORE))
 
+#if !defined(_KERNEL_MODE)
+
 //
 // Helper for Assembler/Disassembler
 //
@@ -897,3 +907,4 @@ _declspec(selectany) VC4QPU_TOKENLOOKUP_TABLE VC4_QPU_BRANCH_COND_LOOKUP[] =
     { VC4_QPU_END_OF_LOOKUPTABLE, NULL }
 };
 
+#endif // !defined(_KERNEL_MODE)
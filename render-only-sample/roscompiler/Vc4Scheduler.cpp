@@ -0,0 +1,957 @@
+#include "precomp.h"
+#include "roscompiler.h"
+
+#if VC4
+
+//
+// Resources tracked for dependencies.
+//
+// Register reads/writes get read-after-write, write-after-read and
+// write-after-write edges. Peripherals with a FIFO or an ordering
+// requirement are modelled as a single resource every access writes, so
+// their accesses keep the original order.
+//
+#define VC4_SCHEDULER_RESOURCE_REGFILE_A    0   // 0~31
+#define VC4_SCHEDULER_RESOURCE_REGFILE_B    32  // 32~63
+#define VC4_SCHEDULER_RESOURCE_ACC0         64  // 64~67 (r0~r3)
+#define VC4_SCHEDULER_RESOURCE_R4           68
+#define VC4_SCHEDULER_RESOURCE_R5           69
+#define VC4_SCHEDULER_RESOURCE_FLAGS        70
+#define VC4_SCHEDULER_RESOURCE_UNIFORM      71
+#define VC4_SCHEDULER_RESOURCE_VARYING      72
+#define VC4_SCHEDULER_RESOURCE_VPM          73
+#define VC4_SCHEDULER_RESOURCE_TMU          74
+#define VC4_SCHEDULER_RESOURCE_TLB          75
+#define VC4_SCHEDULER_RESOURCE_SFU          76
+
+#define VC4_SCHEDULER_LATENCY_REGFILE       2
+#define VC4_SCHEDULER_LATENCY_ACC           1
+#define VC4_SCHEDULER_LATENCY_SFU           3
+#define VC4_SCHEDULER_LATENCY_ORDER         1
+
+#define VC4_SCHEDULER_FILE_A                0
+#define VC4_SCHEDULER_FILE_B                1
+#define VC4_SCHEDULER_FILE_ANY              2
+
+static VC4_QPU_INSTRUCTION Vc4Scheduler_Nop()
+{
+    VC4_QPU_INSTRUCTION Inst = 0;
+    VC4_QPU_SET_SIG(Inst, VC4_QPU_SIG_NO_SIGNAL);
+    VC4_QPU_SET_COND_ADD(Inst, VC4_QPU_COND_NEVER);
+    VC4_QPU_SET_COND_MUL(Inst, VC4_QPU_COND_NEVER);
+    VC4_QPU_SET_WADDR_ADD(Inst, VC4_QPU_WADDR_NOP);
+    VC4_QPU_SET_WADDR_MUL(Inst, VC4_QPU_WADDR_NOP);
+    VC4_QPU_SET_OPCODE_ADD(Inst, VC4_QPU_OPCODE_ADD_NOP);
+    VC4_QPU_SET_OPCODE_MUL(Inst, VC4_QPU_OPCODE_MUL_NOP);
+    VC4_QPU_SET_RADDR_A(Inst, VC4_QPU_RADDR_NOP);
+    VC4_QPU_SET_RADDR_B(Inst, VC4_QPU_RADDR_NOP);
+    return Inst;
+}
+
+static boolean Vc4Scheduler_IsNop(VC4_QPU_INSTRUCTION Inst)
+{
+    return (VC4_QPU_GET_SIG(Inst) == VC4_QPU_SIG_NO_SIGNAL) &&
+           VC4_QPU_IS_OPCODE_NOP(Inst) &&
+           (VC4_QPU_GET_WADDR_ADD(Inst) == VC4_QPU_WADDR_NOP) &&
+           (VC4_QPU_GET_WADDR_MUL(Inst) == VC4_QPU_WADDR_NOP) &&
+           (VC4_QPU_GET_RADDR_A(Inst) == VC4_QPU_RADDR_NOP) &&
+           (VC4_QPU_GET_RADDR_B(Inst) == VC4_QPU_RADDR_NOP) &&
+           !VC4_QPU_IS_SETFLAGS_SET(Inst);
+}
+
+static boolean Vc4Scheduler_UsesAdd(VC4_QPU_INSTRUCTION Inst)
+{
+    return (VC4_QPU_GET_OPCODE_ADD(Inst) != VC4_QPU_OPCODE_ADD_NOP) ||
+           (VC4_QPU_GET_WADDR_ADD(Inst) != VC4_QPU_WADDR_NOP);
+}
+
+static boolean Vc4Scheduler_UsesMul(VC4_QPU_INSTRUCTION Inst)
+{
+    return (VC4_QPU_GET_OPCODE_MUL(Inst) != VC4_QPU_OPCODE_MUL_NOP) ||
+           (VC4_QPU_GET_WADDR_MUL(Inst) != VC4_QPU_WADDR_NOP);
+}
+
+static boolean Vc4Scheduler_ReadsMux(VC4_QPU_INSTRUCTION Inst, uint8_t mux)
+{
+    if ((VC4_QPU_GET_OPCODE_ADD(Inst) != VC4_QPU_OPCODE_ADD_NOP) &&
+        ((VC4_QPU_GET_ADD_A(Inst) == mux) || (VC4_QPU_GET_ADD_B(Inst) == mux)))
+    {
+        return true;
+    }
+    if ((VC4_QPU_GET_OPCODE_MUL(Inst) != VC4_QPU_OPCODE_MUL_NOP) &&
+        ((VC4_QPU_GET_MUL_A(Inst) == mux) || (VC4_QPU_GET_MUL_B(Inst) == mux)))
+    {
+        return true;
+    }
+    return false;
+}
+
+static boolean Vc4Scheduler_HasPack(VC4_QPU_INSTRUCTION Inst)
+{
+    return (VC4_QPU_GET_PACK(Inst) != 0) || (VC4_QPU_GET_UNPACK(Inst) != 0);
+}
+
+static boolean Vc4Scheduler_IsSpecialWaddr(uint64_t waddr)
+{
+    return (waddr == VC4_QPU_WADDR_TMU_NOSWAP) ||
+           ((waddr >= VC4_QPU_WADDR_TLB_STENCIL_SETUP) && (waddr <= VC4_QPU_WADDR_TLB_ALPHA_MASK)) ||
+           ((waddr >= VC4_QPU_WADDR_SFU_RECIP) && (waddr <= VC4_QPU_WADDR_TMU1_B));
+}
+
+static boolean Vc4Scheduler_IsSfuWaddr(uint64_t waddr)
+{
+    return (waddr >= VC4_QPU_WADDR_SFU_RECIP) && (waddr <= VC4_QPU_WADDR_SFU_LOG);
+}
+
+// Write address whose meaning depends on regfile A or B.
+static boolean Vc4Scheduler_IsFileSpecificWaddr(uint64_t waddr)
+{
+    return (waddr < 32) ||
+           (waddr == VC4_QPU_WADDR_ACC5) ||
+           (waddr == VC4_QPU_WADDR_QUAD_X) ||
+           (waddr == VC4_QPU_WADDR_MS_FLAGS) ||
+           (waddr == VC4_QPU_WADDR_VPMVCD_RD_SETUP) ||
+           (waddr == VC4_QPU_WADDR_VPM_LD_ADDR);
+}
+
+// Read address which means same from regfile A and B.
+static boolean Vc4Scheduler_IsExchangeableRaddr(uint64_t raddr)
+{
+    return (raddr == VC4_QPU_RADDR_UNIFORM) ||
+           (raddr == VC4_QPU_RADDR_VERYING) ||
+           (raddr == VC4_QPU_RADDR_VPM);
+}
+
+// Number of accesses to TMU/TLB/SFU, only one is allowed per instruction.
+static uint8_t Vc4Scheduler_SpecialAccesses(VC4_QPU_INSTRUCTION Inst)
+{
+    uint8_t c = 0;
+    if (Vc4Scheduler_UsesAdd(Inst) && Vc4Scheduler_IsSpecialWaddr(VC4_QPU_GET_WADDR_ADD(Inst)))
+    {
+        c++;
+    }
+    if (Vc4Scheduler_UsesMul(Inst) && Vc4Scheduler_IsSpecialWaddr(VC4_QPU_GET_WADDR_MUL(Inst)))
+    {
+        c++;
+    }
+    if ((VC4_QPU_GET_SIG(Inst) == VC4_QPU_SIG_LOAD_TMU0) ||
+        (VC4_QPU_GET_SIG(Inst) == VC4_QPU_SIG_LOAD_TMU1))
+    {
+        c++;
+    }
+    return c;
+}
+
+static boolean Vc4Scheduler_WritesR4(VC4_QPU_INSTRUCTION Inst)
+{
+    return (Vc4Scheduler_UsesAdd(Inst) && Vc4Scheduler_IsSfuWaddr(VC4_QPU_GET_WADDR_ADD(Inst))) ||
+           (Vc4Scheduler_UsesMul(Inst) && Vc4Scheduler_IsSfuWaddr(VC4_QPU_GET_WADDR_MUL(Inst))) ||
+           (VC4_QPU_GET_SIG(Inst) == VC4_QPU_SIG_LOAD_TMU0) ||
+           (VC4_QPU_GET_SIG(Inst) == VC4_QPU_SIG_LOAD_TMU1);
+}
+
+// Regfile the add pipe has to write to.
+static uint8_t Vc4Scheduler_AddWriteFile(VC4_QPU_INSTRUCTION Inst)
+{
+    uint64_t waddr = VC4_QPU_GET_WADDR_ADD(Inst);
+    if (!Vc4Scheduler_UsesAdd(Inst) || (waddr == VC4_QPU_WADDR_NOP))
+    {
+        return VC4_SCHEDULER_FILE_ANY;
+    }
+    if (!Vc4Scheduler_IsFileSpecificWaddr(waddr) &&
+        !(Vc4Scheduler_HasPack(Inst) && !VC4_QPU_IS_PM_SET(Inst)))
+    {
+        return VC4_SCHEDULER_FILE_ANY;
+    }
+    return VC4_QPU_IS_WRITESWAP_SET(Inst) ? VC4_SCHEDULER_FILE_B : VC4_SCHEDULER_FILE_A;
+}
+
+// Regfile the mul pipe has to write to.
+static uint8_t Vc4Scheduler_MulWriteFile(VC4_QPU_INSTRUCTION Inst)
+{
+    uint64_t waddr = VC4_QPU_GET_WADDR_MUL(Inst);
+    if (!Vc4Scheduler_UsesMul(Inst) || (waddr == VC4_QPU_WADDR_NOP))
+    {
+        return VC4_SCHEDULER_FILE_ANY;
+    }
+    if (!Vc4Scheduler_IsFileSpecificWaddr(waddr) &&
+        !(Vc4Scheduler_HasPack(Inst) && !VC4_QPU_IS_PM_SET(Inst)))
+    {
+        return VC4_SCHEDULER_FILE_ANY;
+    }
+    return VC4_QPU_IS_WRITESWAP_SET(Inst) ? VC4_SCHEDULER_FILE_A : VC4_SCHEDULER_FILE_B;
+}
+
+static boolean Vc4Scheduler_WritesRegfileA(VC4_QPU_INSTRUCTION Inst, boolean ws)
+{
+    return (Vc4Scheduler_UsesAdd(Inst) && (VC4_QPU_GET_WADDR_ADD(Inst) != VC4_QPU_WADDR_NOP) && !ws) ||
+           (Vc4Scheduler_UsesMul(Inst) && (VC4_QPU_GET_WADDR_MUL(Inst) != VC4_QPU_WADDR_NOP) && ws);
+}
+
+//
+// Pair 2 instructions into one, fails if they compete for a pipe, a read
+// port, the signal field, pack/unpack or the write swap.
+//
+static boolean Vc4Scheduler_Merge(VC4_QPU_INSTRUCTION a, VC4_QPU_INSTRUCTION b, VC4_QPU_INSTRUCTION *pMerged)
+{
+    if ((Vc4Scheduler_UsesAdd(a) && Vc4Scheduler_UsesAdd(b)) ||
+        (Vc4Scheduler_UsesMul(a) && Vc4Scheduler_UsesMul(b)))
+    {
+        return false;
+    }
+
+    if ((Vc4Scheduler_SpecialAccesses(a) + Vc4Scheduler_SpecialAccesses(b)) > 1)
+    {
+        return false;
+    }
+
+    if ((Vc4Scheduler_WritesR4(a) && Vc4Scheduler_ReadsMux(b, VC4_QPU_ALU_R4)) ||
+        (Vc4Scheduler_WritesR4(b) && Vc4Scheduler_ReadsMux(a, VC4_QPU_ALU_R4)))
+    {
+        return false;
+    }
+
+    // Signal.
+    uint64_t sigA = VC4_QPU_GET_SIG(a);
+    uint64_t sigB = VC4_QPU_GET_SIG(b);
+    boolean bSmallImmediateA = (sigA == VC4_QPU_SIG_ALU_WITH_RADDR_B);
+    boolean bSmallImmediateB = (sigB == VC4_QPU_SIG_ALU_WITH_RADDR_B);
+    if ((sigA != VC4_QPU_SIG_NO_SIGNAL) && (sigB != VC4_QPU_SIG_NO_SIGNAL) && (sigA != sigB))
+    {
+        return false;
+    }
+    if ((sigA == sigB) && (sigA != VC4_QPU_SIG_NO_SIGNAL) && !bSmallImmediateA)
+    {
+        return false;
+    }
+    uint64_t sig = (sigA != VC4_QPU_SIG_NO_SIGNAL) ? sigA : sigB;
+
+    // Read ports.
+    uint64_t raddr_a = VC4_QPU_GET_RADDR_A(a);
+    if (VC4_QPU_GET_RADDR_A(b) != VC4_QPU_RADDR_NOP)
+    {
+        if ((raddr_a != VC4_QPU_RADDR_NOP) && (raddr_a != VC4_QPU_GET_RADDR_A(b)))
+        {
+            return false;
+        }
+        raddr_a = VC4_QPU_GET_RADDR_A(b);
+    }
+
+    uint64_t raddr_b = VC4_QPU_GET_RADDR_B(a);
+    if (bSmallImmediateA != bSmallImmediateB)
+    {
+        // small immediate takes over raddr_b.
+        if (VC4_QPU_GET_RADDR_B(bSmallImmediateA ? b : a) != VC4_QPU_RADDR_NOP)
+        {
+            return false;
+        }
+        raddr_b = VC4_QPU_GET_RADDR_B(bSmallImmediateA ? a : b);
+    }
+    else if (VC4_QPU_GET_RADDR_B(b) != VC4_QPU_RADDR_NOP)
+    {
+        if ((raddr_b != VC4_QPU_RADDR_NOP) && (raddr_b != VC4_QPU_GET_RADDR_B(b)))
+        {
+            return false;
+        }
+        raddr_b = VC4_QPU_GET_RADDR_B(b);
+    }
+
+    // Write swap, add writes to regfile A when ws is 0, mul writes to A when ws is 1.
+    VC4_QPU_INSTRUCTION Add = Vc4Scheduler_UsesAdd(a) ? a : (Vc4Scheduler_UsesAdd(b) ? b : Vc4Scheduler_Nop());
+    VC4_QPU_INSTRUCTION Mul = Vc4Scheduler_UsesMul(a) ? a : (Vc4Scheduler_UsesMul(b) ? b : Vc4Scheduler_Nop());
+    uint8_t ws = VC4_SCHEDULER_FILE_ANY;
+    uint8_t addFile = Vc4Scheduler_AddWriteFile(Add);
+    uint8_t mulFile = Vc4Scheduler_MulWriteFile(Mul);
+    if (addFile != VC4_SCHEDULER_FILE_ANY)
+    {
+        ws = (addFile == VC4_SCHEDULER_FILE_B) ? 1 : 0;
+    }
+    if (mulFile != VC4_SCHEDULER_FILE_ANY)
+    {
+        uint8_t mulWs = (mulFile == VC4_SCHEDULER_FILE_A) ? 1 : 0;
+        if ((ws != VC4_SCHEDULER_FILE_ANY) && (ws != mulWs))
+        {
+            return false;
+        }
+        ws = mulWs;
+    }
+    if (ws == VC4_SCHEDULER_FILE_ANY)
+    {
+        ws = 0;
+    }
+
+    // Pack/unpack is shared by both pipes, only one may use it and it must not
+    // apply to the other.
+    VC4_QPU_INSTRUCTION Pack = Vc4Scheduler_Nop();
+    if (Vc4Scheduler_HasPack(a) || Vc4Scheduler_HasPack(b))
+    {
+        if (Vc4Scheduler_HasPack(a) && Vc4Scheduler_HasPack(b))
+        {
+            return false;
+        }
+
+        Pack = Vc4Scheduler_HasPack(a) ? a : b;
+        VC4_QPU_INSTRUCTION Other = Vc4Scheduler_HasPack(a) ? b : a;
+
+        if (VC4_QPU_IS_PM_SET(Pack))
+        {
+            // unpack applies to r4 read, pack applies to mul output.
+            if (VC4_QPU_GET_UNPACK(Pack) && Vc4Scheduler_ReadsMux(Other, VC4_QPU_ALU_R4))
+            {
+                return false;
+            }
+            if (VC4_QPU_GET_PACK(Pack) && !Vc4Scheduler_UsesMul(Pack))
+            {
+                return false;
+            }
+        }
+        else
+        {
+            // unpack applies to regfile A read, pack applies to regfile A write.
+            if (VC4_QPU_GET_UNPACK(Pack) && Vc4Scheduler_ReadsMux(Other, VC4_QPU_ALU_REG_A))
+            {
+                return false;
+            }
+            if (VC4_QPU_GET_PACK(Pack) && Vc4Scheduler_WritesRegfileA(Other, ws ? true : false))
+            {
+                return false;
+            }
+        }
+    }
+
+    VC4_QPU_INSTRUCTION Merged = Vc4Scheduler_Nop();
+    VC4_QPU_SET_SIG(Merged, sig);
+    VC4_QPU_SET_UNPACK(Merged, VC4_QPU_GET_UNPACK(Pack));
+    VC4_QPU_SET_PM(Merged, VC4_QPU_IS_PM_SET(Pack));
+    VC4_QPU_SET_PACK(Merged, VC4_QPU_GET_PACK(Pack));
+    VC4_QPU_SET_WRITESWAP(Merged, ws);
+    VC4_QPU_SET_COND_ADD(Merged, VC4_QPU_GET_COND_ADD(Add));
+    VC4_QPU_SET_WADDR_ADD(Merged, VC4_QPU_GET_WADDR_ADD(Add));
+    VC4_QPU_SET_OPCODE_ADD(Merged, VC4_QPU_GET_OPCODE_ADD(Add));
+    VC4_QPU_SET_ADD_A(Merged, VC4_QPU_GET_ADD_A(Add));
+    VC4_QPU_SET_ADD_B(Merged, VC4_QPU_GET_ADD_B(Add));
+    VC4_QPU_SET_COND_MUL(Merged, VC4_QPU_GET_COND_MUL(Mul));
+    VC4_QPU_SET_WADDR_MUL(Merged, VC4_QPU_GET_WADDR_MUL(Mul));
+    VC4_QPU_SET_OPCODE_MUL(Merged, VC4_QPU_GET_OPCODE_MUL(Mul));
+    VC4_QPU_SET_MUL_A(Merged, VC4_QPU_GET_MUL_A(Mul));
+    VC4_QPU_SET_MUL_B(Merged, VC4_QPU_GET_MUL_B(Mul));
+    VC4_QPU_SET_RADDR_A(Merged, raddr_a);
+    VC4_QPU_SET_RADDR_B(Merged, raddr_b);
+
+    *pMerged = Merged;
+    return true;
+}
+
+//
+// Move a uniform/varying/vpm read to the other regfile read port.
+//
+static boolean Vc4Scheduler_SwapReadPort(VC4_QPU_INSTRUCTION Inst, VC4_QPU_INSTRUCTION *pSwapped)
+{
+    if ((VC4_QPU_GET_SIG(Inst) == VC4_QPU_SIG_ALU_WITH_RADDR_B) || Vc4Scheduler_HasPack(Inst))
+    {
+        return false;
+    }
+
+    uint64_t raddr_a = VC4_QPU_GET_RADDR_A(Inst);
+    uint64_t raddr_b = VC4_QPU_GET_RADDR_B(Inst);
+    uint8_t from, to;
+    if ((raddr_a != VC4_QPU_RADDR_NOP) && (raddr_b == VC4_QPU_RADDR_NOP) && Vc4Scheduler_IsExchangeableRaddr(raddr_a))
+    {
+        from = VC4_QPU_ALU_REG_A;
+        to = VC4_QPU_ALU_REG_B;
+        VC4_QPU_SET_RADDR_A(Inst, VC4_QPU_RADDR_NOP);
+        VC4_QPU_SET_RADDR_B(Inst, raddr_a);
+    }
+    else if ((raddr_b != VC4_QPU_RADDR_NOP) && (raddr_a == VC4_QPU_RADDR_NOP) && Vc4Scheduler_IsExchangeableRaddr(raddr_b))
+    {
+        from = VC4_QPU_ALU_REG_B;
+        to = VC4_QPU_ALU_REG_A;
+        VC4_QPU_SET_RADDR_B(Inst, VC4_QPU_RADDR_NOP);
+        VC4_QPU_SET_RADDR_A(Inst, raddr_b);
+    }
+    else
+    {
+        return false;
+    }
+
+    if (VC4_QPU_GET_ADD_A(Inst) == from) VC4_QPU_SET_ADD_A(Inst, to);
+    if (VC4_QPU_GET_ADD_B(Inst) == from) VC4_QPU_SET_ADD_B(Inst, to);
+    if (VC4_QPU_GET_MUL_A(Inst) == from) VC4_QPU_SET_MUL_A(Inst, to);
+    if (VC4_QPU_GET_MUL_B(Inst) == from) VC4_QPU_SET_MUL_B(Inst, to);
+
+    *pSwapped = Inst;
+    return true;
+}
+
+void Vc4Scheduler::AddRead(Vc4SchedulerNode &Node, uint8_t Resource)
+{
+    assert(Node.cRead < VC4_SCHEDULER_MAX_RESOURCES);
+    Node.Read[Node.cRead++] = Resource;
+}
+
+void Vc4Scheduler::AddWrite(Vc4SchedulerNode &Node, uint8_t Resource, uint8_t Latency)
+{
+    assert(Node.cWrite < VC4_SCHEDULER_MAX_RESOURCES);
+    Node.Write[Node.cWrite] = Resource;
+    Node.WriteLatency[Node.cWrite++] = Latency;
+}
+
+void Vc4Scheduler::DecodeRead(Vc4SchedulerNode &Node, uint8_t raddr, boolean bRegfileA)
+{
+    if (raddr < 32)
+    {
+        AddRead(Node, (bRegfileA ? VC4_SCHEDULER_RESOURCE_REGFILE_A : VC4_SCHEDULER_RESOURCE_REGFILE_B) + raddr);
+        return;
+    }
+
+    switch (raddr)
+    {
+    case VC4_QPU_RADDR_UNIFORM:
+        AddWrite(Node, VC4_SCHEDULER_RESOURCE_UNIFORM, VC4_SCHEDULER_LATENCY_ORDER);
+        break;
+    case VC4_QPU_RADDR_VERYING:
+        // C coefficient comes up at r5.
+        AddWrite(Node, VC4_SCHEDULER_RESOURCE_VARYING, VC4_SCHEDULER_LATENCY_ORDER);
+        AddWrite(Node, VC4_SCHEDULER_RESOURCE_R5, VC4_SCHEDULER_LATENCY_ACC);
+        break;
+    case VC4_QPU_RADDR_VPM:
+        AddWrite(Node, VC4_SCHEDULER_RESOURCE_VPM, VC4_SCHEDULER_LATENCY_ORDER);
+        break;
+    case VC4_QPU_RADDR_ELEMENT_NUMBER:
+    case VC4_QPU_RADDR_PIXEL_COORD_X:
+    case VC4_QPU_RADDR_MS_FLAGS:
+    case VC4_QPU_RADDR_NOP:
+        break;
+    default:
+        Node.bBarrier = true;
+    }
+}
+
+void Vc4Scheduler::DecodeWrite(Vc4SchedulerNode &Node, uint8_t waddr, boolean bRegfileA)
+{
+    if (waddr < 32)
+    {
+        AddWrite(Node, (bRegfileA ? VC4_SCHEDULER_RESOURCE_REGFILE_A : VC4_SCHEDULER_RESOURCE_REGFILE_B) + waddr, VC4_SCHEDULER_LATENCY_REGFILE);
+        return;
+    }
+
+    switch (waddr)
+    {
+    case VC4_QPU_WADDR_ACC0:
+    case VC4_QPU_WADDR_ACC1:
+    case VC4_QPU_WADDR_ACC2:
+    case VC4_QPU_WADDR_ACC3:
+        AddWrite(Node, VC4_SCHEDULER_RESOURCE_ACC0 + (waddr - VC4_QPU_WADDR_ACC0), VC4_SCHEDULER_LATENCY_ACC);
+        break;
+    case VC4_QPU_WADDR_ACC5:
+        AddWrite(Node, VC4_SCHEDULER_RESOURCE_R5, VC4_SCHEDULER_LATENCY_ACC);
+        break;
+    case VC4_QPU_WADDR_NOP:
+        break;
+    case VC4_QPU_WADDR_TLB_STENCIL_SETUP:
+    case VC4_QPU_WADDR_TLB_Z:
+    case VC4_QPU_WADDR_TLB_COLOUR_MS:
+    case VC4_QPU_WADDR_TLB_COLOUR_ALL:
+    case VC4_QPU_WADDR_TLB_ALPHA_MASK:
+        AddWrite(Node, VC4_SCHEDULER_RESOURCE_TLB, VC4_SCHEDULER_LATENCY_ORDER);
+        break;
+    case VC4_QPU_WADDR_VPM:
+    case VC4_QPU_WADDR_VPMVCD_RD_SETUP:
+    case VC4_QPU_WADDR_VPM_LD_ADDR:
+        AddWrite(Node, VC4_SCHEDULER_RESOURCE_VPM, VC4_SCHEDULER_LATENCY_ORDER);
+        break;
+    case VC4_QPU_WADDR_SFU_RECIP:
+    case VC4_QPU_WADDR_SFU_RECIPSQRT:
+    case VC4_QPU_WADDR_SFU_EXP:
+    case VC4_QPU_WADDR_SFU_LOG:
+        AddWrite(Node, VC4_SCHEDULER_RESOURCE_SFU, VC4_SCHEDULER_LATENCY_ORDER);
+        AddWrite(Node, VC4_SCHEDULER_RESOURCE_R4, VC4_SCHEDULER_LATENCY_SFU);
+        break;
+    case VC4_QPU_WADDR_TMU_NOSWAP:
+        AddWrite(Node, VC4_SCHEDULER_RESOURCE_TMU, VC4_SCHEDULER_LATENCY_ORDER);
+        break;
+    case VC4_QPU_WADDR_TMU0_S:
+    case VC4_QPU_WADDR_TMU0_T:
+    case VC4_QPU_WADDR_TMU0_R:
+    case VC4_QPU_WADDR_TMU0_B:
+    case VC4_QPU_WADDR_TMU1_S:
+    case VC4_QPU_WADDR_TMU1_T:
+    case VC4_QPU_WADDR_TMU1_R:
+    case VC4_QPU_WADDR_TMU1_B:
+        // TMU setup reads its configuration from uniform stream.
+        AddWrite(Node, VC4_SCHEDULER_RESOURCE_TMU, VC4_SCHEDULER_LATENCY_ORDER);
+        AddWrite(Node, VC4_SCHEDULER_RESOURCE_UNIFORM, VC4_SCHEDULER_LATENCY_ORDER);
+        break;
+    default:
+        Node.bBarrier = true;
+    }
+}
+
+void Vc4Scheduler::DecodeNode(Vc4SchedulerNode &Node)
+{
+    VC4_QPU_INSTRUCTION Inst = Node.Instruction;
+    uint8_t sig = (uint8_t)VC4_QPU_GET_SIG(Inst);
+    boolean ws = VC4_QPU_IS_WRITESWAP_SET(Inst);
+
+    if (sig == VC4_QPU_SIG_BRANCH)
+    {
+        Node.bBarrier = true;
+        return;
+    }
+
+    if (sig == VC4_QPU_SIG_LOAD_IMMEDIATE)
+    {
+        if (VC4_QPU_GET_IMMEDIATE_TYPE(Inst) != VC4_QPU_IMMEDIATE_TYPE_32)
+        {
+            Node.bBarrier = true;
+            return;
+        }
+        DecodeWrite(Node, (uint8_t)VC4_QPU_GET_WADDR_ADD(Inst), !ws);
+        DecodeWrite(Node, (uint8_t)VC4_QPU_GET_WADDR_MUL(Inst), ws);
+        if (VC4_QPU_IS_SETFLAGS_SET(Inst))
+        {
+            AddWrite(Node, VC4_SCHEDULER_RESOURCE_FLAGS, VC4_SCHEDULER_LATENCY_ACC);
+        }
+        return;
+    }
+
+    boolean bSmallImmediate = (sig == VC4_QPU_SIG_ALU_WITH_RADDR_B);
+
+    for (uint8_t i = 0; i < 2; i++)
+    {
+        boolean bAdd = (i == 0);
+        if (bAdd ? !Vc4Scheduler_UsesAdd(Inst) : !Vc4Scheduler_UsesMul(Inst))
+        {
+            continue;
+        }
+
+        if (bAdd ? (VC4_QPU_GET_OPCODE_ADD(Inst) != VC4_QPU_OPCODE_ADD_NOP) :
+                   (VC4_QPU_GET_OPCODE_MUL(Inst) != VC4_QPU_OPCODE_MUL_NOP))
+        {
+            uint8_t mux[2];
+            mux[0] = (uint8_t)(bAdd ? VC4_QPU_GET_ADD_A(Inst) : VC4_QPU_GET_MUL_A(Inst));
+            mux[1] = (uint8_t)(bAdd ? VC4_QPU_GET_ADD_B(Inst) : VC4_QPU_GET_MUL_B(Inst));
+            for (uint8_t j = 0; j < 2; j++)
+            {
+                if (mux[j] <= VC4_QPU_ALU_R5)
+                {
+                    AddRead(Node, VC4_SCHEDULER_RESOURCE_ACC0 + mux[j]); // r0~r5 are contiguous.
+                }
+            }
+        }
+
+        uint8_t cond = (uint8_t)(bAdd ? VC4_QPU_GET_COND_ADD(Inst) : VC4_QPU_GET_COND_MUL(Inst));
+        if ((cond != VC4_QPU_COND_NEVER) && (cond != VC4_QPU_COND_ALWAYS))
+        {
+            AddRead(Node, VC4_SCHEDULER_RESOURCE_FLAGS);
+        }
+
+        if (bAdd)
+        {
+            DecodeWrite(Node, (uint8_t)VC4_QPU_GET_WADDR_ADD(Inst), !ws);
+        }
+        else
+        {
+            DecodeWrite(Node, (uint8_t)VC4_QPU_GET_WADDR_MUL(Inst), ws);
+        }
+    }
+
+    DecodeRead(Node, (uint8_t)VC4_QPU_GET_RADDR_A(Inst), true);
+    if (!bSmallImmediate)
+    {
+        DecodeRead(Node, (uint8_t)VC4_QPU_GET_RADDR_B(Inst), false);
+    }
+
+    if (VC4_QPU_IS_SETFLAGS_SET(Inst))
+    {
+        AddWrite(Node, VC4_SCHEDULER_RESOURCE_FLAGS, VC4_SCHEDULER_LATENCY_ACC);
+    }
+
+    switch (sig)
+    {
+    case VC4_QPU_SIG_NO_SIGNAL:
+        break;
+    case VC4_QPU_SIG_ALU_WITH_RADDR_B:
+        // vector rotate is not paired.
+        if (VC4_QPU_GET_SMALL_IMMEDIATE(Inst) >= 48)
+        {
+            return;
+        }
+        break;
+    case VC4_QPU_SIG_LOAD_TMU0:
+    case VC4_QPU_SIG_LOAD_TMU1:
+        AddWrite(Node, VC4_SCHEDULER_RESOURCE_TMU, VC4_SCHEDULER_LATENCY_ORDER);
+        AddWrite(Node, VC4_SCHEDULER_RESOURCE_R4, VC4_SCHEDULER_LATENCY_ACC);
+        break;
+    default:
+        Node.bBarrier = true;
+    }
+
+    Node.bMergeable = !Node.bBarrier && !VC4_QPU_IS_SETFLAGS_SET(Inst);
+}
+
+HRESULT Vc4Scheduler::BuildNodes(const VC4_QPU_INSTRUCTION *pCode, uint32_t cCode)
+{
+    this->pNode = new Vc4SchedulerNode[cCode];
+    if (this->pNode == NULL)
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    boolean bEnd = false;
+    for (uint32_t i = 0; i < cCode; i++)
+    {
+        // Padding NOPs are dropped, but thrend and its delay slots are kept as is.
+        if (VC4_QPU_GET_SIG(pCode[i]) == VC4_QPU_SIG_PROGRAM_END)
+        {
+            bEnd = true;
+        }
+        if (!bEnd && Vc4Scheduler_IsNop(pCode[i]))
+        {
+            continue;
+        }
+
+        Vc4SchedulerNode &Node = this->pNode[this->cNode++];
+        memset(&Node, 0, sizeof(Node));
+        Node.Instruction = pCode[i];
+        Node.FirstEdge = VC4_SCHEDULER_NONE;
+        Node.Cycle = VC4_SCHEDULER_NONE;
+        DecodeNode(Node);
+        if (bEnd)
+        {
+            Node.bBarrier = true;
+            Node.bMergeable = false;
+        }
+    }
+
+    return S_OK;
+}
+
+HRESULT Vc4Scheduler::AddEdge(uint32_t From, uint32_t To, uint32_t Latency)
+{
+    assert(From < To);
+
+    if (this->cEdge == this->cEdgeStorage)
+    {
+        uint32_t NewSize = this->cEdgeStorage + max(this->cEdgeStorage, this->cNode * 4);
+        Vc4SchedulerEdge *pNew = new Vc4SchedulerEdge[NewSize];
+        if (pNew == NULL)
+        {
+            return E_OUTOFMEMORY;
+        }
+        if (this->pEdge)
+        {
+            memcpy(pNew, this->pEdge, this->cEdge * sizeof(Vc4SchedulerEdge));
+            delete[] this->pEdge;
+        }
+        this->pEdge = pNew;
+        this->cEdgeStorage = NewSize;
+    }
+
+    Vc4SchedulerEdge &Edge = this->pEdge[this->cEdge];
+    Edge.Node = To;
+    Edge.Latency = Latency;
+    Edge.Next = this->pNode[From].FirstEdge;
+    this->pNode[From].FirstEdge = this->cEdge++;
+    this->pNode[To].cPredecessor++;
+
+    return S_OK;
+}
+
+HRESULT Vc4Scheduler::BuildGraph()
+{
+    HRESULT hr = S_OK;
+    uint32_t LastBarrier = VC4_SCHEDULER_NONE;
+
+    for (uint32_t j = 0; j < this->cNode; j++)
+    {
+        Vc4SchedulerNode &Node = this->pNode[j];
+
+        // Barriers keep their position against everything.
+        if (Node.bBarrier)
+        {
+            for (uint32_t i = (LastBarrier == VC4_SCHEDULER_NONE ? 0 : LastBarrier); i < j; i++)
+            {
+                hr = AddEdge(i, j, VC4_SCHEDULER_LATENCY_ORDER);
+                if (FAILED(hr))
+                {
+                    return hr;
+                }
+            }
+            LastBarrier = j;
+        }
+        else if (LastBarrier != VC4_SCHEDULER_NONE)
+        {
+            hr = AddEdge(LastBarrier, j, VC4_SCHEDULER_LATENCY_ORDER);
+            if (FAILED(hr))
+            {
+                return hr;
+            }
+        }
+
+        // Read after write.
+        for (uint8_t r = 0; r < Node.cRead; r++)
+        {
+            for (uint32_t i = j; i-- > 0;)
+            {
+                Vc4SchedulerNode &Prev = this->pNode[i];
+                uint8_t w;
+                for (w = 0; w < Prev.cWrite; w++)
+                {
+                    if (Prev.Write[w] == Node.Read[r])
+                    {
+                        break;
+                    }
+                }
+                if (w < Prev.cWrite)
+                {
+                    hr = AddEdge(i, j, Prev.WriteLatency[w]);
+                    if (FAILED(hr))
+                    {
+                        return hr;
+                    }
+                    break;
+                }
+            }
+        }
+
+        // Write after read, write after write.
+        for (uint8_t w = 0; w < Node.cWrite; w++)
+        {
+            for (uint32_t i = j; i-- > 0;)
+            {
+                Vc4SchedulerNode &Prev = this->pNode[i];
+                boolean bRead = false;
+                for (uint8_t r = 0; r < Prev.cRead; r++)
+                {
+                    if (Prev.Read[r] == Node.Write[w])
+                    {
+                        bRead = true;
+                        break;
+                    }
+                }
+                if (bRead)
+                {
+                    // reads are done before writes in an instruction, so it can be paired.
+                    hr = AddEdge(i, j, 0);
+                    if (FAILED(hr))
+                    {
+                        return hr;
+                    }
+                }
+
+                uint8_t pw;
+                for (pw = 0; pw < Prev.cWrite; pw++)
+                {
+                    if (Prev.Write[pw] == Node.Write[w])
+                    {
+                        break;
+                    }
+                }
+                if (pw < Prev.cWrite)
+                {
+                    // previous result must land first.
+                    uint32_t Latency = max(1, (int)Prev.WriteLatency[pw] - (int)Node.WriteLatency[w] + 1);
+                    hr = AddEdge(i, j, Latency);
+                    if (FAILED(hr))
+                    {
+                        return hr;
+                    }
+                    break;
+                }
+            }
+        }
+    }
+
+    return hr;
+}
+
+void Vc4Scheduler::ComputeHeight()
+{
+    for (uint32_t i = this->cNode; i-- > 0;)
+    {
+        Vc4SchedulerNode &Node = this->pNode[i];
+        Node.Height = 1;
+        for (uint32_t e = Node.FirstEdge; e != VC4_SCHEDULER_NONE; e = this->pEdge[e].Next)
+        {
+            Node.Height = max(Node.Height, this->pEdge[e].Latency + this->pNode[this->pEdge[e].Node].Height);
+        }
+    }
+}
+
+void Vc4Scheduler::ScheduleNode(uint32_t iNode, uint32_t Cycle, uint32_t *pReady, uint32_t &cReady)
+{
+    Vc4SchedulerNode &Node = this->pNode[iNode];
+    assert(Node.Cycle == VC4_SCHEDULER_NONE);
+    assert(Node.Earliest <= Cycle);
+    Node.Cycle = Cycle;
+
+    for (uint32_t i = 0; i < cReady; i++)
+    {
+        if (pReady[i] == iNode)
+        {
+            pReady[i] = pReady[--cReady];
+            break;
+        }
+    }
+
+    for (uint32_t e = Node.FirstEdge; e != VC4_SCHEDULER_NONE; e = this->pEdge[e].Next)
+    {
+        Vc4SchedulerNode &Succ = this->pNode[this->pEdge[e].Node];
+        Succ.Earliest = max(Succ.Earliest, Cycle + this->pEdge[e].Latency);
+        assert(Succ.cPredecessor);
+        if (--Succ.cPredecessor == 0)
+        {
+            pReady[cReady++] = this->pEdge[e].Node;
+        }
+    }
+}
+
+//
+// Pick the ready node with the longest critical path, in original order for
+// a tie. With bMergeOnly, only nodes which can be paired into Bundle.
+//
+uint32_t Vc4Scheduler::PickNode(uint32_t *pReady, uint32_t cReady, uint32_t Cycle, boolean bMergeOnly, VC4_QPU_INSTRUCTION Bundle, VC4_QPU_INSTRUCTION *pMerged)
+{
+    uint32_t Best = VC4_SCHEDULER_NONE;
+
+    for (uint32_t i = 0; i < cReady; i++)
+    {
+        uint32_t iNode = pReady[i];
+        Vc4SchedulerNode &Node = this->pNode[iNode];
+
+        if (Node.Earliest > Cycle)
+        {
+            continue;
+        }
+
+        if ((Best != VC4_SCHEDULER_NONE) &&
+            ((Node.Height < this->pNode[Best].Height) ||
+             ((Node.Height == this->pNode[Best].Height) && (iNode > Best))))
+        {
+            continue;
+        }
+
+        if (bMergeOnly)
+        {
+            VC4_QPU_INSTRUCTION Merged, Swapped;
+            if (!Node.bMergeable)
+            {
+                continue;
+            }
+            if (!Vc4Scheduler_Merge(Bundle, Node.Instruction, &Merged) &&
+                !(Vc4Scheduler_SwapReadPort(Node.Instruction, &Swapped) && Vc4Scheduler_Merge(Bundle, Swapped, &Merged)))
+            {
+                continue;
+            }
+            *pMerged = Merged;
+        }
+
+        Best = iNode;
+    }
+
+    return Best;
+}
+
+HRESULT Vc4Scheduler::Schedule()
+{
+    uint32_t *pReady = new uint32_t[this->cNode];
+    if (pReady == NULL)
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    // Every node waits at most for the longest latency.
+    this->pOutput = new VC4_QPU_INSTRUCTION[this->cNode * VC4_SCHEDULER_LATENCY_SFU + 1];
+    if (this->pOutput == NULL)
+    {
+        delete[] pReady;
+        return E_OUTOFMEMORY;
+    }
+
+    uint32_t cReady = 0;
+    for (uint32_t i = 0; i < this->cNode; i++)
+    {
+        if (this->pNode[i].cPredecessor == 0)
+        {
+            pReady[cReady++] = i;
+        }
+    }
+
+    uint32_t cScheduled = 0;
+    for (uint32_t Cycle = 0; cScheduled < this->cNode; Cycle++)
+    {
+        VC4_QPU_INSTRUCTION Bundle;
+        uint32_t iNode = PickNode(pReady, cReady, Cycle, false, 0, NULL);
+        if (iNode == VC4_SCHEDULER_NONE)
+        {
+            // Nothing is ready, wait with NOP.
+            this->pOutput[this->cOutput++] = Vc4Scheduler_Nop();
+            continue;
+        }
+
+        Bundle = this->pNode[iNode].Instruction;
+        ScheduleNode(iNode, Cycle, pReady, cReady);
+        cScheduled++;
+
+        if (this->pNode[iNode].bMergeable)
+        {
+            // Fill the other pipe/signal with what else is ready in this cycle.
+            VC4_QPU_INSTRUCTION Merged;
+            while ((iNode = PickNode(pReady, cReady, Cycle, true, Bundle, &Merged)) != VC4_SCHEDULER_NONE)
+            {
+                Bundle = Merged;
+                ScheduleNode(iNode, Cycle, pReady, cReady);
+                cScheduled++;
+            }
+        }
+
+        this->pOutput[this->cOutput++] = Bundle;
+    }
+
+    delete[] pReady;
+
+    return S_OK;
+}
+
+HRESULT Vc4Scheduler::Run(Vc4ShaderStorage *Storage)
+{
+    HRESULT hr;
+
+    Reset();
+
+    this->cInput = Storage->GetUsedSize<VC4_QPU_INSTRUCTION>();
+
+    hr = BuildNodes(Storage->GetStorage<VC4_QPU_INSTRUCTION>(), this->cInput);
+    if (SUCCEEDED(hr))
+    {
+        hr = BuildGraph();
+    }
+    if (SUCCEEDED(hr))
+    {
+        ComputeHeight();
+        hr = Schedule();
+    }
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    if (this->cOutput < this->cInput)
+    {
+        Storage->Clear();
+        for (uint32_t i = 0; i < this->cOutput; i++)
+        {
+            Storage->Store<VC4_QPU_INSTRUCTION>(this->pOutput[i]);
+        }
+    }
+    else
+    {
+        // Keep original code if it can't be shortened.
+        this->cOutput = this->cInput;
+    }
+
+    return S_OK;
+}
+
+#endif // VC4
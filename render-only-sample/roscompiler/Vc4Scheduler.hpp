@@ -0,0 +1,139 @@
+#pragma once
+
+#include "..\roscommon\Vc4Qpu.h"
+#include "roscompilerdebug.h"
+
+#if VC4
+
+class Vc4ShaderStorage;
+
+//
+// Post-pass QPU instruction scheduler.
+//
+// Vc4Shader emits one ALU operation per instruction and pads every HLSL
+// instruction with a NOP. The scheduler drops those NOPs, builds a dependency
+// DAG over the remaining instructions and list-schedules it, pairing
+// independent add pipe and mul pipe operations into a single instruction.
+// NOPs are only re-inserted where a read latency requires them:
+//
+//   regfile A/B : written value can be read 2 instructions later.
+//   r0~r3, r5   : written value can be read by the next instruction.
+//   r4 (SFU)    : result can be read 3 instructions after the SFU write.
+//   r4 (TMU)    : result can be read by the instruction after ldtmu.
+//
+// Uniform, varying, VPM, TMU, TLB and SFU accesses keep their original
+// order. Signals other than ldtmu/small immediate, and everything from
+// 'thrend' on, are barriers and emitted as is.
+//
+
+#define VC4_SCHEDULER_MAX_RESOURCES 16
+#define VC4_SCHEDULER_NONE          0xffffffff
+
+struct Vc4SchedulerNode
+{
+    VC4_QPU_INSTRUCTION Instruction;
+
+    boolean bBarrier;       // must stay in original order against all others.
+    boolean bMergeable;     // can be paired with other instructions.
+
+    uint8_t cRead;
+    uint8_t cWrite;
+    uint8_t Read[VC4_SCHEDULER_MAX_RESOURCES];
+    uint8_t Write[VC4_SCHEDULER_MAX_RESOURCES];
+    uint8_t WriteLatency[VC4_SCHEDULER_MAX_RESOURCES];
+
+    uint32_t FirstEdge;     // successor list.
+    uint32_t cPredecessor;  // number of unscheduled predecessors.
+    uint32_t Earliest;      // earliest cycle allowed by scheduled predecessors.
+    uint32_t Height;        // critical path to the end of shader.
+    uint32_t Cycle;         // VC4_SCHEDULER_NONE until scheduled.
+};
+
+struct Vc4SchedulerEdge
+{
+    uint32_t Node;
+    uint32_t Latency;
+    uint32_t Next;
+};
+
+class Vc4Scheduler
+{
+public:
+
+    Vc4Scheduler() :
+        pNode(NULL),
+        cNode(0),
+        pEdge(NULL),
+        cEdge(0),
+        cEdgeStorage(0),
+        pOutput(NULL),
+        cOutput(0),
+        cInput(0)
+    { ; }
+
+    ~Vc4Scheduler()
+    {
+        Reset();
+    }
+
+    // Schedule h/w shader code in place.
+    HRESULT Run(Vc4ShaderStorage *Storage);
+
+    uint32_t GetInputInstructionCount()
+    {
+        return cInput;
+    }
+
+    uint32_t GetOutputInstructionCount()
+    {
+        return cOutput;
+    }
+
+private:
+
+    void Reset()
+    {
+        delete[] this->pNode;
+        this->pNode = NULL;
+        this->cNode = 0;
+        delete[] this->pEdge;
+        this->pEdge = NULL;
+        this->cEdge = 0;
+        this->cEdgeStorage = 0;
+        delete[] this->pOutput;
+        this->pOutput = NULL;
+        this->cOutput = 0;
+        this->cInput = 0;
+    }
+
+    HRESULT BuildNodes(const VC4_QPU_INSTRUCTION *pCode, uint32_t cCode);
+    void DecodeNode(Vc4SchedulerNode &Node);
+    void DecodeRead(Vc4SchedulerNode &Node, uint8_t raddr, boolean bRegfileA);
+    void DecodeWrite(Vc4SchedulerNode &Node, uint8_t waddr, boolean bRegfileA);
+
+    void AddRead(Vc4SchedulerNode &Node, uint8_t Resource);
+    void AddWrite(Vc4SchedulerNode &Node, uint8_t Resource, uint8_t Latency);
+
+    HRESULT BuildGraph();
+    HRESULT AddEdge(uint32_t From, uint32_t To, uint32_t Latency);
+    void ComputeHeight();
+
+    HRESULT Schedule();
+    void ScheduleNode(uint32_t iNode, uint32_t Cycle, uint32_t *pReady, uint32_t &cReady);
+    uint32_t PickNode(uint32_t *pReady, uint32_t cReady, uint32_t Cycle, boolean bMergeOnly, VC4_QPU_INSTRUCTION Bundle, VC4_QPU_INSTRUCTION *pMerged);
+
+private:
+
+    Vc4SchedulerNode *pNode;
+    uint32_t cNode;
+
+    Vc4SchedulerEdge *pEdge;
+    uint32_t cEdge;
+    uint32_t cEdgeStorage;
+
+    VC4_QPU_INSTRUCTION *pOutput;
+    uint32_t cOutput;
+    uint32_t cInput;
+};
+
+#endif // VC4
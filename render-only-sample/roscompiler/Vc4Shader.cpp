@@ -823,6 +823,21 @@ void Vc4Shader::Emit_Sample(CInstruction &Inst)
     }
 }
 
+void Vc4Shader::Schedule(Vc4ShaderStorage *Storage, TCHAR *pTitle)
+{
+    Vc4Scheduler Scheduler;
+    VC4_THROW(Scheduler.Run(Storage)); // throw RosCompilerException on failure.
+
+#if DBG
+    xprintf(TEXT("----------- %s : %d -> %d instructions ----------\n"),
+        pTitle,
+        Scheduler.GetInputInstructionCount(),
+        Scheduler.GetOutputInstructionCount());
+#else
+    pTitle;
+#endif // DBG
+}
+
 void Vc4Shader::HLSL_ParseDecl()
 {
     assert(this->uShaderType == D3D10_SB_PIXEL_SHADER ||
@@ -941,16 +956,12 @@ void Vc4Shader::HLSL_ParseDecl()
         case D3D10_SB_OPCODE_DCL_TEMPS:
             HLSL_GetShaderInstruction(this->HLSLParser, Inst);
             // Temp register doesn't have swizzle mask, so assume all 4 components to be used.
-            // TODO: AllocateRegister(); Currently temps are allocated at ra16~ra31.
-            //       since currently reserve temp to ra16~31, so only upto 4 temps are allowed.
-            VC4_ASSERT(Inst.m_TempsDecl.NumTemps <= 4);
+            // Register of each component is assigned later by HLSL_AllocateRegister().
+            VC4_ASSERT(Inst.m_TempsDecl.NumTemps <= VC4_HLSL_MAX_TEMPS);
             for (uint8_t i = 0; i < Inst.m_TempsDecl.NumTemps * 4; i++)
             {
-                VC4_ASSERT((ROS_VC4_TEMP_REGISTER_FILE_START + cTemp) <= ROS_VC4_TEMP_REGISTER_FILE_END);
                 this->TempRegister[i / 4][i % 4].flags.valid = true;
                 this->TempRegister[i / 4][i % 4].flags.temp = true;
-                this->TempRegister[i / 4][i % 4].addr = ROS_VC4_TEMP_REGISTER_FILE_START + cTemp++;
-                this->TempRegister[i / 4][i % 4].mux = ROS_VC4_TEMP_REGISTER_FILE;
                 this->TempRegister[i / 4][i % 4].swizzleMask = D3D10_SB_OPERAND_4_COMPONENT_MASK_X << (i % 4);
             }
             break;
@@ -1022,60 +1033,528 @@ void Vc4Shader::HLSL_Link_PS()
     }
 }
 
-HRESULT Vc4Shader::Translate_VS()
+void Vc4Shader::HLSL_AddSourceUsage(COperandBase &c, uint8_t swizzleIndex, VC4_HLSL_INSTRUCTION_USAGE &Usage)
 {
-    assert(this->uShaderType == D3D10_SB_VERTEX_SHADER);
+    // Only temps carry values between instructions.
+    if (c.m_Type != D3D10_SB_OPERAND_TYPE_TEMP)
+    {
+        return;
+    }
 
-    this->SetCurrentStorage(this->ShaderStorage, this->ShaderUniform);
-    this->HLSL_ParseDecl();
-    this->HLSL_Link_PS();  
-    this->Emit_Prologue_VS();
+    VC4_ASSERT(c.m_Index[0].m_RegIndex < ARRAYSIZE(Usage.SrcTempMask));
+
+    uint8_t aMask;
+    switch (c.m_ComponentSelection)
+    {
+    case D3D10_SB_OPERAND_4_COMPONENT_SWIZZLE_MODE:
+        aMask = (uint8_t)D3D10_SB_OPERAND_4_COMPONENT_MASK(c.m_Swizzle[swizzleIndex]);
+        break;
+    case D3D10_SB_OPERAND_4_COMPONENT_SELECT_1_MODE:
+        aMask = (uint8_t)D3D10_SB_OPERAND_4_COMPONENT_MASK(c.m_ComponentName);
+        break;
+    default:
+        aMask = D3D10_SB_OPERAND_4_COMPONENT_MASK_MASK;
+    }
+
+    Usage.SrcTempMask[c.m_Index[0].m_RegIndex] |= aMask;
+}
+
+void Vc4Shader::HLSL_GetUsage(CInstruction &Inst, VC4_HLSL_INSTRUCTION_USAGE &Usage)
+{
+    memset(&Usage, 0, sizeof(Usage));
+
+    switch (Inst.m_OpCode)
+    {
+    case D3D10_SB_OPCODE_ADD:
+    case D3D10_SB_OPCODE_MAX:
+    case D3D10_SB_OPCODE_MIN:
+    case D3D10_SB_OPCODE_IADD:
+    case D3D10_SB_OPCODE_MAD:
+    case D3D10_SB_OPCODE_MOV:
+    case D3D10_SB_OPCODE_MUL:
+        // Each component of dst is computed from same component of sources.
+        for (uint8_t i = 0, aCurrent = D3D10_SB_OPERAND_4_COMPONENT_MASK_X; i < 4; i++)
+        {
+            if (Inst.m_Operands[0].m_WriteMask & aCurrent)
+            {
+                for (uint8_t j = 1; j < Inst.m_NumOperands; j++)
+                {
+                    HLSL_AddSourceUsage(Inst.m_Operands[j], i, Usage);
+                }
+            }
+            aCurrent <<= 1;
+        }
+        break;
+    case D3D10_SB_OPCODE_DP2:
+    case D3D10_SB_OPCODE_DP3:
+    case D3D10_SB_OPCODE_DP4:
+        // Every component of dst is computed from first 2/3/4 components of sources.
+        for (uint8_t i = 0; i < (uint8_t)(Inst.m_OpCode - 13); i++)
+        {
+            for (uint8_t j = 1; j < Inst.m_NumOperands; j++)
+            {
+                HLSL_AddSourceUsage(Inst.m_Operands[j], i, Usage);
+            }
+        }
+        break;
+    case D3D10_SB_OPCODE_SAMPLE:
+        // Texture coordinate is read from first 1/2/3 components of source.
+        VC4_ASSERT(Inst.m_Operands[2].m_Index[0].m_RegIndex < ARRAYSIZE(this->ResourceDimension));
+        switch (this->ResourceDimension[Inst.m_Operands[2].m_Index[0].m_RegIndex])
+        {
+        case D3D10_SB_RESOURCE_DIMENSION_TEXTURECUBE:
+            HLSL_AddSourceUsage(Inst.m_Operands[1], 2, Usage);
+            __fallthrough;
+        case D3D10_SB_RESOURCE_DIMENSION_TEXTURE2D:
+            HLSL_AddSourceUsage(Inst.m_Operands[1], 1, Usage);
+            __fallthrough;
+        default:
+            HLSL_AddSourceUsage(Inst.m_Operands[1], 0, Usage);
+        }
+        break;
+    default:
+        // Keep anything else (e.g. ret).
+        Usage.bLive = true;
+        return;
+    }
+
+    VC4_ASSERT(Inst.m_Operands[0].m_IndexDimension == D3D10_SB_OPERAND_INDEX_1D);
+    VC4_ASSERT(Inst.m_Operands[0].m_Index[0].m_RegIndex < 8);
+
+    Usage.DstType = Inst.m_Operands[0].m_Type;
+    Usage.DstIndex = (uint8_t)Inst.m_Operands[0].m_Index[0].m_RegIndex;
+    Usage.DstMask = (uint8_t)(Inst.m_Operands[0].m_WriteMask & D3D10_SB_OPERAND_4_COMPONENT_MASK_MASK);
+}
+
+void Vc4Shader::HLSL_Liveness_CS(Vc4ShaderStorage &Usage)
+{
+    assert(this->uShaderType == D3D10_SB_VERTEX_SHADER);
 
     {
         CInstruction Inst;
-        assert(Inst.m_bSaturate == false); // saturate is not supported.
         while (HLSL_GetShaderInstruction(this->HLSLParser, Inst))
         {
-            // Need to add support for D3D10_SB_OPCODE_IADD - Issue #38
+            VC4_HLSL_INSTRUCTION_USAGE u;
+            HLSL_GetUsage(Inst, u);
+            Usage.Store<VC4_HLSL_INSTRUCTION_USAGE>(u);
+        }
+    }
+
+    // Coordinate shader only outputs position.
+    uint8_t LiveOutput[8] = { 0 };
+    uint8_t LiveTemp[VC4_HLSL_MAX_TEMPS] = { 0 };
+    for (uint8_t i = 0; i < 8; i++)
+    {
+        for (uint8_t j = 0; j < 4; j++)
+        {
+            if (this->OutputRegister[i][j].GetFlags().position)
+            {
+                LiveOutput[i] |= this->OutputRegister[i][j].GetSwizzleMask();
+            }
+        }
+    }
+
+    // Walk backward, an instruction is live when it writes any live component.
+    VC4_HLSL_INSTRUCTION_USAGE *pUsage = Usage.GetStorage<VC4_HLSL_INSTRUCTION_USAGE>();
+    for (uint32_t i = Usage.GetUsedSize<VC4_HLSL_INSTRUCTION_USAGE>(); i-- > 0;)
+    {
+        uint8_t *pLive = NULL;
+        switch (pUsage[i].DstType)
+        {
+        case D3D10_SB_OPERAND_TYPE_OUTPUT:
+            pLive = &LiveOutput[pUsage[i].DstIndex];
+            break;
+        case D3D10_SB_OPERAND_TYPE_TEMP:
+            VC4_ASSERT(pUsage[i].DstIndex < ARRAYSIZE(LiveTemp));
+            pLive = &LiveTemp[pUsage[i].DstIndex];
+            break;
+        default:
+            break;
+        }
+
+        if (pLive && (*pLive & pUsage[i].DstMask))
+        {
+            pUsage[i].bLive = true;
+        }
+
+        if (pUsage[i].bLive)
+        {
+            if (pLive)
+            {
+                *pLive &= (uint8_t)~pUsage[i].DstMask;
+            }
+            for (uint8_t j = 0; j < ARRAYSIZE(LiveTemp); j++)
+            {
+                LiveTemp[j] |= pUsage[i].SrcTempMask[j];
+            }
+        }
+    }
+}
+
+uint8_t Vc4Shader::HLSL_GetScratchUsage(CInstruction &Inst)
+{
+    // Accumulators written as scratch while this instruction is translated,
+    // see Setup_SourceRegister(s), Resolve_Modifier and Emit_XXX.
+    uint8_t Scratch = 0;
+
+    for (uint8_t j = 1; j < Inst.m_NumOperands; j++)
+    {
+        COperandBase &c = Inst.m_Operands[j];
+        if (c.m_Modifier == D3D10_SB_OPERAND_MODIFIER_ABSNEG)
+        {
+            Scratch |= VC4_ACCUMULATOR_BIT(0);
+        }
+        if ((c.m_Type == D3D10_SB_OPERAND_TYPE_IMMEDIATE32) || (c.m_Modifier != D3D10_SB_OPERAND_MODIFIER_NONE))
+        {
+            // source is moved to r1/r2 by operand position in QPU instruction.
+            Scratch |= VC4_ACCUMULATOR_BIT((j == 2) ? 2 : 1);
+        }
+    }
+
+    switch (Inst.m_OpCode)
+    {
+    case D3D10_SB_OPCODE_ADD:
+    case D3D10_SB_OPCODE_MAX:
+    case D3D10_SB_OPCODE_MIN:
+    case D3D10_SB_OPCODE_IADD:
+        if ((Inst.m_Operands[0].m_Type == D3D10_SB_OPERAND_TYPE_OUTPUT) &&
+            (this->OutputRegister[Inst.m_Operands[0].m_Index[0].m_RegIndex][0].GetFlags().packed))
+        {
+            Scratch |= VC4_ACCUMULATOR_BIT(3);
+        }
+        __fallthrough;
+    case D3D10_SB_OPCODE_MUL:
+        Scratch |= VC4_ACCUMULATOR_BIT(2); // regfile conflict between sources.
+        break;
+    case D3D10_SB_OPCODE_MAD:
+        Scratch |= VC4_ACCUMULATOR_BIT(2) | VC4_ACCUMULATOR_BIT(3);
+        break;
+    case D3D10_SB_OPCODE_DP2:
+    case D3D10_SB_OPCODE_DP3:
+    case D3D10_SB_OPCODE_DP4:
+        Scratch |= VC4_ACCUMULATOR_BIT(1) | VC4_ACCUMULATOR_BIT(2) | VC4_ACCUMULATOR_BIT(3);
+        break;
+    default:
+        break;
+    }
+
+    return Scratch;
+}
+
+uint8_t Vc4Shader::HLSL_GetSourceComponent(COperandBase &c, uint8_t swizzleIndex)
+{
+    uint8_t Component;
+    switch (c.m_ComponentSelection)
+    {
+    case D3D10_SB_OPERAND_4_COMPONENT_SWIZZLE_MODE:
+        Component = (uint8_t)c.m_Swizzle[swizzleIndex];
+        break;
+    case D3D10_SB_OPERAND_4_COMPONENT_SELECT_1_MODE:
+        Component = (uint8_t)c.m_ComponentName;
+        break;
+    default:
+        return VC4_HLSL_NO_COMPONENT;
+    }
+
+    switch (c.m_Type)
+    {
+    case D3D10_SB_OPERAND_TYPE_TEMP:
+        VC4_ASSERT(c.m_Index[0].m_RegIndex < VC4_HLSL_MAX_TEMPS);
+        return (uint8_t)(c.m_Index[0].m_RegIndex * 4 + Component);
+    case D3D10_SB_OPERAND_TYPE_INPUT:
+        assert(ROS_VC4_INPUT_REGISTER_FILE == VC4_QPU_ALU_REG_A);
+        return VC4_HLSL_INPUT_COMPONENT;
+    default:
+        return VC4_HLSL_NO_COMPONENT;
+    }
+}
+
+void Vc4Shader::HLSL_AllocateRegister()
+{
+    assert(this->uShaderType == D3D10_SB_PIXEL_SHADER ||
+           this->uShaderType == D3D10_SB_VERTEX_SHADER);
+
+    // Live range of each temp component in HLSL instruction index, and
+    // accumulators used as scratch by any instruction within the range.
+    uint32_t Start[VC4_HLSL_MAX_TEMP_COMPONENTS];
+    uint32_t End[VC4_HLSL_MAX_TEMP_COMPONENTS];
+    uint8_t Scratch[VC4_HLSL_MAX_TEMP_COMPONENTS] = { 0 };
+    uint8_t ScratchSinceStart[VC4_HLSL_MAX_TEMP_COMPONENTS] = { 0 };
+
+    // How often 2 components are read by same QPU instruction, only 1 register
+    // per regfile can be read at a time, so they prefer different regfile.
+    uint8_t Pair[VC4_HLSL_MAX_TEMP_COMPONENTS][VC4_HLSL_MAX_TEMP_COMPONENTS] = { 0 };
+    uint8_t InputPair[VC4_HLSL_MAX_TEMP_COMPONENTS] = { 0 };
+
+    for (uint8_t t = 0; t < VC4_HLSL_MAX_TEMP_COMPONENTS; t++)
+    {
+        Start[t] = End[t] = VC4_HLSL_NO_INSTRUCTION;
+    }
+
+    {
+        CInstruction Inst;
+        for (uint32_t n = 0; HLSL_GetShaderInstruction(this->HLSLParser, Inst); n++)
+        {
+            VC4_HLSL_INSTRUCTION_USAGE Usage;
+            HLSL_GetUsage(Inst, Usage);
+
+            uint8_t InstScratch = HLSL_GetScratchUsage(Inst);
+
+            for (uint8_t t = 0; t < VC4_HLSL_MAX_TEMP_COMPONENTS; t++)
+            {
+                uint8_t aMask = (uint8_t)(D3D10_SB_OPERAND_4_COMPONENT_MASK_X << (t % 4));
+                boolean bReferenced = (Usage.SrcTempMask[t / 4] & aMask) ||
+                    ((Usage.DstType == D3D10_SB_OPERAND_TYPE_TEMP) && (Usage.DstIndex == t / 4) && (Usage.DstMask & aMask));
+
+                if (bReferenced && (Start[t] == VC4_HLSL_NO_INSTRUCTION))
+                {
+                    Start[t] = n;
+                }
+
+                if (Start[t] != VC4_HLSL_NO_INSTRUCTION)
+                {
+                    ScratchSinceStart[t] |= InstScratch;
+                }
+
+                if (bReferenced)
+                {
+                    End[t] = n;
+                    Scratch[t] = ScratchSinceStart[t];
+                }
+            }
+
+            // Source pairs read by same QPU instruction.
+            uint8_t cPair = 0, aMask = 0;
             switch (Inst.m_OpCode)
             {
             case D3D10_SB_OPCODE_ADD:
             case D3D10_SB_OPCODE_MAX:
             case D3D10_SB_OPCODE_MIN:
             case D3D10_SB_OPCODE_IADD:
-                this->Emit_with_Add_pipe(Inst);
+            case D3D10_SB_OPCODE_MUL:
+            case D3D10_SB_OPCODE_MAD:
+                cPair = 4;
+                aMask = (uint8_t)Inst.m_Operands[0].m_WriteMask;
                 break;
             case D3D10_SB_OPCODE_DP2:
             case D3D10_SB_OPCODE_DP3:
             case D3D10_SB_OPCODE_DP4:
-                this->Emit_DPx(Inst);
-                break;
-            case D3D10_SB_OPCODE_MAD:
-                this->Emit_Mad(Inst);
-                break;
-            case D3D10_SB_OPCODE_MOV:
-                this->Emit_Mov(Inst);
-                break;
-            case D3D10_SB_OPCODE_MUL:
-                this->Emit_with_Mul_pipe(Inst);
-                break;
-            case D3D10_SB_OPCODE_RET:
+                cPair = (uint8_t)(Inst.m_OpCode - 13);
+                aMask = D3D10_SB_OPERAND_4_COMPONENT_MASK_MASK;
                 break;
             default:
-                VC4_ASSERT(false);
+                break;
+            }
+
+            for (uint8_t i = 0; i < cPair; i++)
+            {
+                if ((aMask & (D3D10_SB_OPERAND_4_COMPONENT_MASK_X << i)) == 0)
+                {
+                    continue;
+                }
+
+                uint8_t a = HLSL_GetSourceComponent(Inst.m_Operands[1], i);
+                uint8_t b = HLSL_GetSourceComponent(Inst.m_Operands[2], i);
+                if ((a < VC4_HLSL_MAX_TEMP_COMPONENTS) && (b < VC4_HLSL_MAX_TEMP_COMPONENTS))
+                {
+                    if ((a != b) && (Pair[a][b] < 0xff))
+                    {
+                        Pair[a][b]++;
+                        Pair[b][a]++;
+                    }
+                }
+                else if ((a < VC4_HLSL_MAX_TEMP_COMPONENTS) && (b == VC4_HLSL_INPUT_COMPONENT) && (InputPair[a] < 0xff))
+                {
+                    InputPair[a]++;
+                }
+                else if ((b < VC4_HLSL_MAX_TEMP_COMPONENTS) && (a == VC4_HLSL_INPUT_COMPONENT) && (InputPair[b] < 0xff))
+                {
+                    InputPair[b]++;
+                }
             }
         }
     }
 
-    this->ShaderStorageAux->CopyFrom(*this->ShaderStorage); // Copy VS to CS.
-    this->ShaderUniformAux->CopyFrom(*this->ShaderUniform); // Copy VS uniform to CS.
+    // Shader code is straight line, so interference graph of live ranges is
+    // an interval graph and coloring in order of range start is optimal.
+    // Components whose ranges end and start at same instruction interfere,
+    // as each component of dst is written before next component of sources
+    // are read. Accumulators are tried first, then the regfile less
+    // contended by the other sources read together.
+    const uint8_t RegFile[2] = { ROS_VC4_TEMP_REGISTER_FILE_A, ROS_VC4_TEMP_REGISTER_FILE_B };
+    const uint8_t RegFileStart[2] = { ROS_VC4_TEMP_REGISTER_FILE_A_START, ROS_VC4_TEMP_REGISTER_FILE_B_START };
+    const uint8_t RegFileEnd[2] = { ROS_VC4_TEMP_REGISTER_FILE_A_END, ROS_VC4_TEMP_REGISTER_FILE_B_END };
+
+    uint32_t AccumulatorFree[4] = { 0 }; // first instruction register is available.
+    uint32_t RegFileFree[2][32] = { 0 };
+    uint8_t Mux[VC4_HLSL_MAX_TEMP_COMPONENTS] = { 0 };
+    boolean bAllocated[VC4_HLSL_MAX_TEMP_COMPONENTS] = { 0 };
+
+    this->cTemp = 0;
+    for (;;)
+    {
+        uint8_t t = VC4_HLSL_NO_COMPONENT;
+        for (uint8_t u = 0; u < VC4_HLSL_MAX_TEMP_COMPONENTS; u++)
+        {
+            if (!bAllocated[u] &&
+                (Start[u] != VC4_HLSL_NO_INSTRUCTION) &&
+                ((t == VC4_HLSL_NO_COMPONENT) || (Start[u] < Start[t])))
+            {
+                t = u;
+            }
+        }
+        if (t == VC4_HLSL_NO_COMPONENT)
+        {
+            break;
+        }
+        bAllocated[t] = true;
 
+        Vc4Register &reg = this->TempRegister[t / 4][t % 4];
+        VC4_ASSERT(reg.GetFlags().valid && reg.GetFlags().temp); // must be declared.
+
+        boolean bFound = false;
+
+        for (uint8_t i = 0; (i < ARRAYSIZE(AccumulatorFree)) && !bFound; i++)
+        {
+            if (((Scratch[t] & VC4_ACCUMULATOR_BIT(i)) == 0) && (AccumulatorFree[i] <= Start[t]))
+            {
+                reg.mux = VC4_QPU_ALU_R0 + i;
+                reg.addr = VC4_QPU_WADDR_ACC0 + i;
+                AccumulatorFree[i] = End[t] + 1;
+                bFound = true;
+            }
+        }
+
+        if (!bFound)
+        {
+            uint32_t Cost[2] = { InputPair[t], 0 };
+            for (uint8_t u = 0; u < VC4_HLSL_MAX_TEMP_COMPONENTS; u++)
+            {
+                if (Mux[u] == RegFile[0])
+                {
+                    Cost[0] += Pair[t][u];
+                }
+                else if (Mux[u] == RegFile[1])
+                {
+                    Cost[1] += Pair[t][u];
+                }
+            }
+
+            uint8_t iFirst = (Cost[1] < Cost[0]) ? 1 : 0;
+            for (uint8_t f = 0; (f < 2) && !bFound; f++)
+            {
+                uint8_t iFile = (iFirst + f) % 2;
+                for (uint8_t addr = RegFileStart[iFile]; (addr <= RegFileEnd[iFile]) && !bFound; addr++)
+                {
+                    if (RegFileFree[iFile][addr] <= Start[t])
+                    {
+                        reg.mux = RegFile[iFile];
+                        reg.addr = addr;
+                        RegFileFree[iFile][addr] = End[t] + 1;
+                        bFound = true;
+                    }
+                }
+            }
+        }
+
+        // At most VC4_HLSL_MAX_TEMP_COMPONENTS - 1 other components are live at
+        // Start[t], so a regfile entry is always free.
+        VC4_ASSERT(bFound);
+
+        Mux[t] = reg.mux;
+        this->cTemp++;
+
+#if DBG
+        xprintf(TEXT("r%d.%c [%d - %d] -> %s%d\n"),
+            t / 4,
+            TEXT("xyzw")[t % 4],
+            Start[t],
+            End[t],
+            (reg.mux == VC4_QPU_ALU_REG_A) ? TEXT("ra") : (reg.mux == VC4_QPU_ALU_REG_B) ? TEXT("rb") : TEXT("r"),
+            (reg.mux == VC4_QPU_ALU_REG_A || reg.mux == VC4_QPU_ALU_REG_B) ? reg.addr : reg.mux);
+#endif // DBG
+    }
+}
+
+void Vc4Shader::Emit_ShaderCode_VS(const VC4_HLSL_INSTRUCTION_USAGE *pUsage)
+{
+    assert(this->uShaderType == D3D10_SB_VERTEX_SHADER);
+
+    CInstruction Inst;
+    assert(Inst.m_bSaturate == false); // saturate is not supported.
+    for (uint32_t i = 0; HLSL_GetShaderInstruction(this->HLSLParser, Inst); i++)
+    {
+        // Skip dead instruction for coordinate shader.
+        if (pUsage && !pUsage[i].bLive)
+        {
+            continue;
+        }
+
+        // Need to add support for D3D10_SB_OPCODE_IADD - Issue #38
+        switch (Inst.m_OpCode)
+        {
+        case D3D10_SB_OPCODE_ADD:
+        case D3D10_SB_OPCODE_MAX:
+        case D3D10_SB_OPCODE_MIN:
+        case D3D10_SB_OPCODE_IADD:
+            this->Emit_with_Add_pipe(Inst);
+            break;
+        case D3D10_SB_OPCODE_DP2:
+        case D3D10_SB_OPCODE_DP3:
+        case D3D10_SB_OPCODE_DP4:
+            this->Emit_DPx(Inst);
+            break;
+        case D3D10_SB_OPCODE_MAD:
+            this->Emit_Mad(Inst);
+            break;
+        case D3D10_SB_OPCODE_MOV:
+            this->Emit_Mov(Inst);
+            break;
+        case D3D10_SB_OPCODE_MUL:
+            this->Emit_with_Mul_pipe(Inst);
+            break;
+        case D3D10_SB_OPCODE_RET:
+            break;
+        default:
+            VC4_ASSERT(false);
+        }
+    }
+}
+
+HRESULT Vc4Shader::Translate_VS()
+{
+    assert(this->uShaderType == D3D10_SB_VERTEX_SHADER);
+
+    this->SetCurrentStorage(this->ShaderStorage, this->ShaderUniform);
+    this->HLSL_ParseDecl();
+    this->HLSL_Link_PS();  
+
+    // Both VS and CS are translated from here.
+    ParserPositionToken CodeStart = this->HLSLParser.GetCurrentToken();
+
+    // CS uses subset of VS instructions, so same allocation works for both.
+    this->HLSL_AllocateRegister();
+    this->HLSLParser.SetCurrentToken(CodeStart);
+
+    this->Emit_Prologue_VS(); // VS
+    this->Emit_ShaderCode_VS(NULL); // VS
     this->Emit_ShaderOutput_VS(true);  // VS
     this->Emit_Epilogue(); // VS
 
+    // CS only runs instructions contributing to position, with own uniforms.
+    Vc4ShaderStorage Usage;
+    this->HLSLParser.SetCurrentToken(CodeStart);
+    this->HLSL_Liveness_CS(Usage);
+    this->HLSLParser.SetCurrentToken(CodeStart);
+
     this->SetCurrentStorage(this->ShaderStorageAux, this->ShaderUniformAux); // switch to CS storage.
+    this->Emit_Prologue_VS(); // CS
+    this->Emit_ShaderCode_VS(Usage.GetStorage<VC4_HLSL_INSTRUCTION_USAGE>()); // CS
     this->Emit_ShaderOutput_VS(false); // CS
     this->Emit_Epilogue(); // CS
+
+    this->Schedule(this->ShaderStorage, TEXT("VC4 Vertex shader"));
+    this->Schedule(this->ShaderStorageAux, TEXT("VC4 Coordinate shader"));
     
     return S_OK;
 }
@@ -1086,6 +1565,13 @@ HRESULT Vc4Shader::Translate_PS()
 
     this->SetCurrentStorage(this->ShaderStorage, this->ShaderUniform);
     this->HLSL_ParseDecl();
+
+    {
+        ParserPositionToken CodeStart = this->HLSLParser.GetCurrentToken();
+        this->HLSL_AllocateRegister();
+        this->HLSLParser.SetCurrentToken(CodeStart);
+    }
+
     this->Emit_Prologue_PS();
 
     {
@@ -1127,6 +1613,8 @@ HRESULT Vc4Shader::Translate_PS()
         
     this->Emit_Epilogue();
 
+    this->Schedule(this->ShaderStorage, TEXT("VC4 Pixel shader"));
+
     return S_OK;
 }
 
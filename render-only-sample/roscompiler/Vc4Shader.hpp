@@ -102,6 +102,13 @@ public:
         this->cUsed = 0;
     }
 
+    // Discard stored data, but keep allocated storage.
+    void Clear()
+    {
+        this->pCurrent = this->pStorage;
+        this->cUsed = 0;
+    }
+
     void CopyFrom(Vc4ShaderStorage &Storage)
     {
         VC4_THROW(this->Ensure(Storage.GetUsedSize())); // throw RosCompilerException on failure.
@@ -188,6 +195,27 @@ typedef enum
     vc4_reg_temp,
 } vc4_register_usage;
 
+#define VC4_HLSL_MAX_TEMPS          7 // all components fit in ra16~ra31 + rb0~rb14, see C_ASSERT below.
+#define VC4_HLSL_MAX_TEMP_COMPONENTS (VC4_HLSL_MAX_TEMPS * 4)
+#define VC4_HLSL_NO_COMPONENT       0xff
+#define VC4_HLSL_INPUT_COMPONENT    0xfe // any component of input, lives in regfile A.
+#define VC4_HLSL_NO_INSTRUCTION     0xffffffff
+
+// Accumulator bit in scratch mask, bit n for rn.
+#define VC4_ACCUMULATOR_BIT(n)      ((uint8_t)(1 << (n)))
+
+// Registers written and read by an HLSL instruction, used to find
+// instructions not contributing to position for the coordinate shader
+// and to compute live range of temps for register allocation.
+typedef struct _VC4_HLSL_INSTRUCTION_USAGE
+{
+    D3D10_SB_OPERAND_TYPE DstType;
+    uint8_t DstIndex;
+    uint8_t DstMask;
+    uint8_t SrcTempMask[VC4_HLSL_MAX_TEMPS]; // components read from each temp.
+    boolean bLive;
+} VC4_HLSL_INSTRUCTION_USAGE;
+
 class Vc4Shader
 {
 public:
@@ -300,9 +328,16 @@ private:
 
     void HLSL_ParseDecl();
     void HLSL_Link_PS();
+    void HLSL_GetUsage(CInstruction &Inst, VC4_HLSL_INSTRUCTION_USAGE &Usage);
+    void HLSL_AddSourceUsage(COperandBase &c, uint8_t swizzleIndex, VC4_HLSL_INSTRUCTION_USAGE &Usage);
+    void HLSL_Liveness_CS(Vc4ShaderStorage &Usage);
+    uint8_t HLSL_GetScratchUsage(CInstruction &Inst);
+    uint8_t HLSL_GetSourceComponent(COperandBase &c, uint8_t swizzleIndex);
+    void HLSL_AllocateRegister();
 
     void Emit_Prologue_VS();
     void Emit_Prologue_PS();
+    void Emit_ShaderCode_VS(const VC4_HLSL_INSTRUCTION_USAGE *pUsage);
     void Emit_Epilogue();
 
     void Emit_Blending_PS();
@@ -317,6 +352,8 @@ private:
 
     void Emit_Sample(CInstruction &Inst);
 
+    void Schedule(Vc4ShaderStorage *Storage, TCHAR *pTitle);
+
     Vc4Register Find_Vc4Register_M(COperandBase c, uint8_t swizzleMask)
     {
         Vc4Register ret;
@@ -470,6 +507,14 @@ private:
 
     void Modifier_Abs(Vc4Register &dst, Vc4Register src)
     {
+        if (src.GetMux() == VC4_QPU_ALU_REG_B)
+        { // the small immediate below takes raddr_b, so read regfile B via dst.
+            Vc4Instruction Vc4Inst;
+            Vc4Inst.Vc4_a_MOV(dst, src);
+            Vc4Inst.Emit(CurrentStorage);
+            src = dst;
+        }
+
         { // perform fmaxabs(src, 0) for abs(src).
             Vc4Register zero(VC4_QPU_ALU_REG_B, 0); // 0 as small immediate in raddr_b
             Vc4Instruction Vc4Inst(vc4_alu_small_immediate);
@@ -696,18 +741,21 @@ private:
     Vc4Register OutputRegister[8][4];
 
     uint8_t cTemp;
-    Vc4Register TempRegister[4][4];
+    Vc4Register TempRegister[VC4_HLSL_MAX_TEMPS][4];
 
      uint32_t ResourceDimension[16];
 
     // TEMPORARY Register Usage Map
     //
-    // r0 - scratch. 
+    // r0 - scratch for ABSNEG modifier. 
     // r1/2 - temporary for source setup. r1 = src1, r2 = src2.
-    // r3 - scratch.
+    // r3 - scratch for mad, dpX and packed output.
     // r4 - Special register.
     // r5 - C coefficient in pixel shader.
     //
+    // r0~r3 are also given to temps by HLSL_AllocateRegister() when no
+    // instruction in live range of temp uses them as scratch.
+    //
     // ra0 ~ ra14  : Input (15 floats)
 #define ROS_VC4_INPUT_REGISTER_FILE         VC4_QPU_ALU_REG_A
 #define ROS_VC4_INPUT_REGISTER_FILE_START   0
@@ -715,17 +763,20 @@ private:
     // VC4 VPM limitation, max 15 float(s) input.
     C_ASSERT((ROS_VC4_INPUT_REGISTER_FILE_END - ROS_VC4_INPUT_REGISTER_FILE_START + 1) < 16);
     // ra15        : Reserved - W (in pixel shader only)
-    // ra16 ~ ra31 : Temp (4x4, up to 4 temps)
-#define ROS_VC4_TEMP_REGISTER_FILE          VC4_QPU_ALU_REG_A
-#define ROS_VC4_TEMP_REGISTER_FILE_START    16
-#define ROS_VC4_TEMP_REGISTER_FILE_END      31
-    C_ASSERT((ROS_VC4_TEMP_REGISTER_FILE_END - ROS_VC4_TEMP_REGISTER_FILE_START + 1) == (4*4));
-    // rb16 ~ rb31 : Scratch (15 floats)
-#define ROS_VC4_SCRATCH_REGISTER_FILE       VC4_QPU_ALU_REG_B
-#define ROS_VC4_SCRATCH_REGISTER_FILE_START 0
-#define ROS_VC4_SCRATCH_REGISTER_FILE_END   14
+    // ra16 ~ ra31 : Temp (16 floats)
+#define ROS_VC4_TEMP_REGISTER_FILE_A        VC4_QPU_ALU_REG_A
+#define ROS_VC4_TEMP_REGISTER_FILE_A_START  16
+#define ROS_VC4_TEMP_REGISTER_FILE_A_END    31
+    // rb0 ~ rb14  : Temp (15 floats)
+#define ROS_VC4_TEMP_REGISTER_FILE_B        VC4_QPU_ALU_REG_B
+#define ROS_VC4_TEMP_REGISTER_FILE_B_START  0
+#define ROS_VC4_TEMP_REGISTER_FILE_B_END    14
+    // All temp components live at once must still fit in regfile, as there is no spill.
+    C_ASSERT(VC4_HLSL_MAX_TEMP_COMPONENTS <=
+        (ROS_VC4_TEMP_REGISTER_FILE_A_END - ROS_VC4_TEMP_REGISTER_FILE_A_START + 1) +
+        (ROS_VC4_TEMP_REGISTER_FILE_B_END - ROS_VC4_TEMP_REGISTER_FILE_B_START + 1));
     // rb15        : Reserved - Z (in pixel shader only)
-    // rb0 ~ rb14  : Output (up to 16 floats)
+    // rb16 ~ rb31 : Output (up to 16 floats)
 #define ROS_VC4_OUTPUT_REGISTER_FILE        VC4_QPU_ALU_REG_B
 #define ROS_VC4_OUTPUT_REGISTER_FILE_START  16
 #define ROS_VC4_OUTPUT_REGISTER_FILE_END    31 
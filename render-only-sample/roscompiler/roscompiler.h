@@ -10,6 +10,7 @@
 #include "Vc4Disasm.hpp"
 #include "Vc4Emit.hpp"
 #include "Vc4Shader.hpp"
+#include "Vc4Scheduler.hpp"
 #endif // VC4
 
 class RosUmdDevice;
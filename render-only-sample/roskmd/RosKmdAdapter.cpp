@@ -158,6 +158,8 @@ void RosKmAdapter::DoWork(void)
 
             ROSDMABUFINFO * pDmaBufInfo = pDmaBufSubmission->m_pDmaBufInfo;
 
+            m_timeline.Record(RosTimelineEventStarted, pDmaBufSubmission->m_SubmissionFenceId);
+
             if (pDmaBufInfo->m_DmaBufState.m_bPaging)
             {
                 //
@@ -222,6 +224,15 @@ RosKmAdapter::ProcessPagingBuffer(
 
     for (; pPagingBuffer < pEndofBuffer; pPagingBuffer++)
     {
+        RosTimelinePagingCommand pagingCommand = (DXGK_OPERATION_FILL == pPagingBuffer->Operation) ? RosTimelinePagingFill : RosTimelinePagingTransfer;
+        UINT pagingOffset = (UINT)((BYTE *)pPagingBuffer - pDmaBufInfo->m_pDmaBuffer);
+
+        m_timeline.Record(
+            RosTimelineEventPagingStart,
+            pDmaBufSubmission->m_SubmissionFenceId,
+            pagingCommand,
+            pagingOffset);
+
         switch (pPagingBuffer->Operation)
         {
         case DXGK_OPERATION_FILL:
@@ -306,6 +317,12 @@ RosKmAdapter::ProcessPagingBuffer(
         default:
             NT_ASSERT(false);
         }
+
+        m_timeline.Record(
+            RosTimelineEventPagingEnd,
+            pDmaBufSubmission->m_SubmissionFenceId,
+            pagingCommand,
+            pagingOffset);
     }
 }
 
@@ -320,6 +337,8 @@ RosKmAdapter::NotifyDmaBufCompletion(
         pDmaBufInfo->m_DmaBufState.m_bCompleted = 1;
     }
 
+    m_timeline.Record(RosTimelineEventCompleted, pDmaBufSubmission->m_SubmissionFenceId);
+
     //
     // Notify the VidSch of the completion of the DMA buffer
     //
@@ -385,6 +404,8 @@ RosKmAdapter::Start(
 
     m_NumNodes = C_ROSD_GPU_ENGINE_COUNT;
 
+    m_timeline.Initialize();
+
     //
     // Initialize worker
     //
@@ -525,6 +546,190 @@ RosKmAdapter::Stop()
     return STATUS_SUCCESS;
 }
 
+#if VC4
+
+void
+RosKmAdapter::InitializeVc4MemoryPools()
+{
+    m_localVidMemSegmentSize = ((UINT)RosKmdGlobal::s_videoMemorySize) -
+        (VC4_RENDERING_CTRL_LIST_POOL_SIZE +
+            VC4_TILE_ALLOCATION_MEMORY_SIZE +
+            VC4_TILE_STATE_DATA_ARRAY_SIZE);
+
+    m_pControlListPool = ((PBYTE)RosKmdGlobal::s_pVideoMemory) + m_localVidMemSegmentSize;
+
+    NT_ASSERT(0 == RosKmdGlobal::s_videoMemoryPhysicalAddress.HighPart);
+    m_controlListPoolPhysicalAddress = RosKmdGlobal::s_videoMemoryPhysicalAddress.LowPart + m_localVidMemSegmentSize;
+    m_tileAllocPoolPhysicalAddress = m_controlListPoolPhysicalAddress + VC4_RENDERING_CTRL_LIST_POOL_SIZE;
+    m_tileStatePoolPhysicalAddress = m_tileAllocPoolPhysicalAddress + VC4_TILE_ALLOCATION_MEMORY_SIZE;
+
+    m_pRenderingControlList = m_pControlListPool;
+    m_renderingControlListPhysicalAddress = m_controlListPoolPhysicalAddress;
+
+    m_tileAllocationMemoryPhysicalAddress = m_tileAllocPoolPhysicalAddress;
+    m_tileStateDataArrayPhysicalAddress = m_tileStatePoolPhysicalAddress;
+}
+
+UINT
+RosKmAdapter::GenerateRenderingControlList(
+    ROSDMABUFINFO *pDmaBufInfo)
+{
+    RosKmdAllocation *pRenderTarget = pDmaBufInfo->m_pRenderTarget;
+
+    // Write Clear Colors command from UMD
+    VC4ClearColors *pVC4ClearColors;
+    VC4WaitOnSemaphore *pVC4WaitOnSempahore;
+
+    if (pDmaBufInfo->m_DmaBufState.m_HasVC4ClearColors)
+    {
+        pVC4ClearColors = (VC4ClearColors *)m_pRenderingControlList;
+
+        *pVC4ClearColors = pDmaBufInfo->m_VC4ClearColors;
+
+        MoveToNextCommand(pVC4ClearColors, pVC4WaitOnSempahore);
+    }
+    else
+    {
+        pVC4WaitOnSempahore = (VC4WaitOnSemaphore *)m_pRenderingControlList;
+    }
+
+    // Wait binning to be done.
+
+    VC4WaitOnSemaphore waitOnSemaphore = vc4WaitOnSemaphore;
+    *pVC4WaitOnSempahore = waitOnSemaphore;
+
+    VC4TileRenderingModeConfig *pVC4TileRenderingModeConfig;
+    MoveToNextCommand(pVC4WaitOnSempahore, pVC4TileRenderingModeConfig);
+
+    // Write Tile Rendering Mode Config command
+
+    VC4TileRenderingModeConfig  tileRenderingModeConfig = vc4TileRenderingModeConfig;
+
+    tileRenderingModeConfig.MemoryAddress = pDmaBufInfo->m_RenderTargetPhysicalAddress + m_busAddressOffset;
+
+    tileRenderingModeConfig.WidthInPixels = (USHORT)pRenderTarget->m_mip0Info.TexelWidth;
+    tileRenderingModeConfig.HeightInPixels = (USHORT)pRenderTarget->m_mip0Info.TexelHeight;
+
+    tileRenderingModeConfig.NonHDRFrameBufferColorFormat = static_cast<USHORT>(
+        Vc4FrameBufferColorFormatFromDxgiFormat(pRenderTarget->m_format));
+
+    tileRenderingModeConfig.MemoryFormat = static_cast<USHORT>(
+        Vc4MemoryFormatFromRosHwLayout(pRenderTarget->m_hwLayout));
+
+    *pVC4TileRenderingModeConfig = tileRenderingModeConfig;
+
+    // Clear the tile buffer by store the 1st tile
+    VC4TileCoordinates *pVC4TileCoordinates = NULL;
+    VC4StoreTileBufferGeneral  *pVC4StoreTileBufferGeneral = NULL;
+
+    if (pDmaBufInfo->m_DmaBufState.m_HasVC4ClearColors)
+    {
+        MoveToNextCommand(pVC4TileRenderingModeConfig, pVC4TileCoordinates);
+
+        *pVC4TileCoordinates = vc4TileCoordinates;
+
+        MoveToNextCommand(pVC4TileCoordinates, pVC4StoreTileBufferGeneral);
+
+        *pVC4StoreTileBufferGeneral = vc4StoreTileBufferGeneral;
+    }
+
+    //
+    // Calling control list generated by the Binning Control List
+    //
+    UINT    widthInTiles = pRenderTarget->m_hwWidthPixels / VC4_BINNING_TILE_PIXELS;
+    UINT    heightInTiles = pRenderTarget->m_hwHeightPixels / VC4_BINNING_TILE_PIXELS;
+
+    VC4TileCoordinates  tileCoordinates = vc4TileCoordinates;
+    VC4BranchToSubList  branchToSubList = vc4BranchToSubList;
+    VC4LoadTileBufferGeneral    loadTileBufColor = vc4LoadTileBufferGeneral;
+    UINT    tileAllocationPhysicalAddress = m_tileAllocationMemoryPhysicalAddress + m_busAddressOffset;
+    VC4LoadTileBufferGeneral    *pVC4LoadTileBufGeneral = NULL;
+    VC4BranchToSubList *pVC4BranchToSubList = NULL;
+    VC4StoreMSResolvedTileColorBuf *pVC4StoreMSResolvedTileColorBuf = NULL;
+    VC4StoreMSResolvedTileColorBufAndSignalEndOfFrame  *pVC4StoreMSResolvedTileColorBufAndSignalEndOfFrame = NULL;
+
+    if (pDmaBufInfo->m_DmaBufState.m_HasVC4ClearColors)
+    {
+        MoveToNextCommand(pVC4StoreTileBufferGeneral, pVC4TileCoordinates);
+        pVC4StoreMSResolvedTileColorBufAndSignalEndOfFrame = (VC4StoreMSResolvedTileColorBufAndSignalEndOfFrame *)pVC4TileCoordinates;
+    }
+    else
+    {
+        if (pDmaBufInfo->m_pRenderTarget)
+        {
+            loadTileBufColor.BufferToLoad = VC4_TILE_BUFFER_COLOR;
+
+            loadTileBufColor.Fortmat = static_cast<USHORT>(
+                Vc4MemoryFormatFromRosHwLayout(
+                    pDmaBufInfo->m_pRenderTarget->m_hwLayout));
+
+            loadTileBufColor.PixelColorFormat = static_cast<USHORT>(
+                Vc4TileBufferPixelFormatFromDxgiFormat(
+                    pDmaBufInfo->m_pRenderTarget->m_format));
+
+            loadTileBufColor.MemoryBaseAddress = (pDmaBufInfo->m_RenderTargetPhysicalAddress + m_busAddressOffset) >> 4;
+
+            MoveToNextCommand(pVC4TileRenderingModeConfig, pVC4LoadTileBufGeneral);
+        }
+    }
+
+    for (UINT x = 0; x < widthInTiles; x++)
+    {
+        for (UINT y = 0; y < heightInTiles; y++)
+        {
+            if (! pDmaBufInfo->m_DmaBufState.m_HasVC4ClearColors)
+            {
+                if (pDmaBufInfo->m_pRenderTarget)
+                {
+                    *pVC4LoadTileBufGeneral = loadTileBufColor;
+
+                    MoveToNextCommand(pVC4LoadTileBufGeneral, pVC4TileCoordinates);
+                }
+            }
+
+            tileCoordinates.TileColumnNumber = (BYTE)x;
+            tileCoordinates.TileRowNumber = (BYTE)y;
+
+            *pVC4TileCoordinates = tileCoordinates;
+
+            MoveToNextCommand(pVC4TileCoordinates, pVC4BranchToSubList);
+
+            branchToSubList.BranchAddress = tileAllocationPhysicalAddress + (y*widthInTiles + x)*VC4_TILE_ALLOCATION_BLOCK_SIZE;
+
+            *pVC4BranchToSubList = branchToSubList;
+
+            if ((x == (widthInTiles - 1)) &&
+                (y == (heightInTiles - 1)))
+            {
+                MoveToNextCommand(pVC4BranchToSubList, pVC4StoreMSResolvedTileColorBufAndSignalEndOfFrame);
+
+                *pVC4StoreMSResolvedTileColorBufAndSignalEndOfFrame = vc4StoreMSResolvedTileColorBufAndSignalEndOfFrame;
+
+                pVC4StoreMSResolvedTileColorBufAndSignalEndOfFrame++;
+            }
+            else
+            {
+                MoveToNextCommand(pVC4BranchToSubList, pVC4StoreMSResolvedTileColorBuf);
+
+                *pVC4StoreMSResolvedTileColorBuf = vc4StoreMSResolvedTileColorBuf;
+
+                if (pDmaBufInfo->m_DmaBufState.m_HasVC4ClearColors)
+                {
+                    MoveToNextCommand(pVC4StoreMSResolvedTileColorBuf, pVC4TileCoordinates);
+                }
+                else
+                {
+                    MoveToNextCommand(pVC4StoreMSResolvedTileColorBuf, pVC4LoadTileBufGeneral);
+                }
+            }
+        }
+    }
+
+    return ((UINT)(((PBYTE)pVC4StoreMSResolvedTileColorBufAndSignalEndOfFrame) - m_pRenderingControlList));
+}
+
+#endif // VC4
+
 void RosKmAdapter::DpcRoutine(void)
 {
     // dp nothing other than calling back into dxgk
@@ -1480,9 +1685,12 @@ RosKmAdapter::Escape(
 
     UINT    EscapeId = *((UINT *)pEscape->pPrivateDriverData);
 
-#pragma warning( disable : 4065 )
     switch (EscapeId)
     {
+    case RosEscapeTimeline:
+
+        Status = TimelineEscape(pEscape);
+        break;
 
     default:
 
@@ -1491,8 +1699,59 @@ RosKmAdapter::Escape(
         break;
     }
 
-    ROS_LOG_ASSERTION("Not implemented");
-    return STATUS_NOT_IMPLEMENTED;
+    return Status;
+}
+
+NTSTATUS
+RosKmAdapter::TimelineEscape(
+    IN_CONST_PDXGKARG_ESCAPE        pEscape)
+{
+    if (pEscape->PrivateDriverDataSize < FIELD_OFFSET(RosTimelineEscape, m_events))
+    {
+        ROS_LOG_ERROR(
+            "PrivateDriverDataSize is too small. (pEscape->PrivateDriverDataSize=%d, FIELD_OFFSET(RosTimelineEscape, m_events)=%d)",
+            pEscape->PrivateDriverDataSize,
+            FIELD_OFFSET(RosTimelineEscape, m_events));
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+
+    RosTimelineEscape * pTimelineEscape = (RosTimelineEscape *)pEscape->pPrivateDriverData;
+
+    pTimelineEscape->m_tickFrequency = m_timeline.GetTickFrequency();
+    pTimelineEscape->m_numEvents = 0;
+
+    switch (pTimelineEscape->m_operation)
+    {
+    case RosTimelineStart:
+
+        m_timeline.Enable(true);
+        pTimelineEscape->m_position = m_timeline.GetPosition();
+        pTimelineEscape->m_numDropped = 0;
+        break;
+
+    case RosTimelineStop:
+
+        m_timeline.Enable(false);
+        break;
+
+    case RosTimelineRead:
+
+        pTimelineEscape->m_numEvents = m_timeline.Read(
+            &pTimelineEscape->m_position,
+            pTimelineEscape->m_events,
+            (pEscape->PrivateDriverDataSize - FIELD_OFFSET(RosTimelineEscape, m_events))/sizeof(RosTimelineEvent),
+            &pTimelineEscape->m_numDropped);
+        break;
+
+    default:
+
+        ROS_LOG_ERROR(
+            "Invalid timeline operation. (m_operation=%d)",
+            pTimelineEscape->m_operation);
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    return STATUS_SUCCESS;
 }
 
 NTSTATUS
@@ -1779,6 +2038,8 @@ RosKmAdapter::QueueDmaBuffer(
     pDmaBufSubmission->m_EndOffset = pSubmitCommand->DmaBufferSubmissionEndOffset;
     pDmaBufSubmission->m_SubmissionFenceId = pSubmitCommand->SubmissionFenceId;
 
+    m_timeline.Record(RosTimelineEventQueued, pSubmitCommand->SubmissionFenceId);
+
     InsertTailList(&m_dmaBufQueue, &pDmaBufSubmission->m_QueueEntry);
 
     KeReleaseSpinLock(&m_dmaBufQueueLock, OldIrql);
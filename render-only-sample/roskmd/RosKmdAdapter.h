@@ -12,6 +12,8 @@
 #include "RosKmdAllocation.h"
 #include "RosKmdGlobal.h"
 #include "Vc4Display.h"
+#include "RosGpuCommand.h"
+#include "RosTimeline.h"
 
 #pragma warning(disable:4201)   // nameless struct/union
 
@@ -27,6 +29,7 @@ typedef struct __ROSKMERRORCONDITION
             UINT    m_NotifyDmaBufFault             : 1;
             UINT    m_PreparationError              : 1;
             UINT    m_PagingFailure                 : 1;
+            UINT    m_EmulationFailure              : 1;
         };
 
         UINT        m_Value;
@@ -320,6 +323,51 @@ protected:
 
     virtual void ProcessRenderBuffer(ROSDMABUFSUBMISSION * pDmaBufSubmission) = 0;
 
+#if VC4
+
+    //
+    // Control list pool, tile allocation memory and tile state data array
+    // are carved out of the end of video memory, shared by the HW and the
+    // emulated VC4
+    //
+    void InitializeVc4MemoryPools();
+
+    UINT GenerateRenderingControlList(ROSDMABUFINFO *pDmaBufInf);
+
+    void MoveToNextBinnerRenderMemChunk(UINT controlListLength)
+    {
+        controlListLength = (controlListLength + (kPageSize - 1)) & (~(kPageSize - 1));
+
+#if BINNER_DBG
+
+        m_pRenderingControlList += controlListLength;
+        m_renderingControlListPhysicalAddress += controlListLength;
+
+        if ((m_renderingControlListPhysicalAddress + 64 * kPageSize) > (m_controlListPoolPhysicalAddress + VC4_RENDERING_CTRL_LIST_POOL_SIZE))
+        {
+            m_pRenderingControlList = m_pControlListPool;
+            m_renderingControlListPhysicalAddress = m_controlListPoolPhysicalAddress;
+        }
+
+        m_tileAllocationMemoryPhysicalAddress += 64 * kPageSize;
+
+        if ((m_tileAllocationMemoryPhysicalAddress + 64 * kPageSize) >= m_tileStatePoolPhysicalAddress)
+        {
+            m_tileAllocationMemoryPhysicalAddress = m_tileAllocPoolPhysicalAddress;
+        }
+
+        m_tileStateDataArrayPhysicalAddress += 64 * kPageSize;
+
+        if ((m_tileStateDataArrayPhysicalAddress + 64 * kPageSize) >= (RosKmdGlobal::s_videoMemoryPhysicalAddress.LowPart + RosKmdGlobal::s_videoMemorySize))
+        {
+            m_tileStateDataArrayPhysicalAddress = m_tileStatePoolPhysicalAddress;
+        }
+
+#endif
+    }
+
+#endif
+
 private:
 
     static void WorkerThread(void * StartContext);
@@ -330,6 +378,7 @@ private:
     BOOLEAN SynchronizeNotifyInterrupt();
     ROSDMABUFSUBMISSION * DequeueDmaBuffer(KSPIN_LOCK * pDmaBufQueueLock);
     void ProcessPagingBuffer(ROSDMABUFSUBMISSION * pDmaBufSubmission);
+    NTSTATUS TimelineEscape(IN_CONST_PDXGKARG_ESCAPE pEscape);
     static void HwDmaBufCompletionDpcRoutine(KDPC *, PVOID, PVOID, PVOID);
 
 protected:
@@ -392,6 +441,15 @@ protected:
     LIST_ENTRY                  m_dmaBufQueue;
     KSPIN_LOCK                  m_dmaBufQueueLock;
 
+    //
+    // Submissions and commands run by the worker thread, see RosTimeline.h.
+    // Stopped until started by the RosEscapeTimeline escape.
+    //
+
+    static const ULONG          kTimelineCapacity = 4096;
+
+    RosTimeline<kTimelineCapacity>  m_timeline;
+
     KDPC                        m_hwDmaBufCompletionDpc;
     KEVENT                      m_hwDmaBufCompletionEvent;
 
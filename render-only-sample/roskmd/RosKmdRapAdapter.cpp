@@ -191,23 +191,7 @@ RosKmdRapAdapter::Start(
 
 #endif // USE_SIMPENROSE
 
-    m_localVidMemSegmentSize = ((UINT)RosKmdGlobal::s_videoMemorySize) -
-        (VC4_RENDERING_CTRL_LIST_POOL_SIZE +
-            VC4_TILE_ALLOCATION_MEMORY_SIZE +
-            VC4_TILE_STATE_DATA_ARRAY_SIZE);
-
-    m_pControlListPool = ((PBYTE)RosKmdGlobal::s_pVideoMemory) + m_localVidMemSegmentSize;
-
-    NT_ASSERT(0 == RosKmdGlobal::s_videoMemoryPhysicalAddress.HighPart);
-    m_controlListPoolPhysicalAddress = RosKmdGlobal::s_videoMemoryPhysicalAddress.LowPart + m_localVidMemSegmentSize;
-    m_tileAllocPoolPhysicalAddress = m_controlListPoolPhysicalAddress + VC4_RENDERING_CTRL_LIST_POOL_SIZE;
-    m_tileStatePoolPhysicalAddress = m_tileAllocPoolPhysicalAddress + VC4_TILE_ALLOCATION_MEMORY_SIZE;
-
-    m_pRenderingControlList = m_pControlListPool;
-    m_renderingControlListPhysicalAddress = m_controlListPoolPhysicalAddress;
-
-    m_tileAllocationMemoryPhysicalAddress = m_tileAllocPoolPhysicalAddress;
-    m_tileStateDataArrayPhysicalAddress = m_tileStatePoolPhysicalAddress;
+    InitializeVc4MemoryPools();
 
 #endif // VC4
 
@@ -347,6 +331,14 @@ RosKmdRapAdapter::ProcessRenderBuffer(
 
         for (; pGpuCommand < pEndofCommand; pGpuCommand++)
         {
+            UINT commandOffset = (UINT)((BYTE *)pGpuCommand - pDmaBufInfo->m_pDmaBuffer);
+
+            m_timeline.Record(
+                RosTimelineEventCommandStart,
+                pDmaBufSubmission->m_SubmissionFenceId,
+                pGpuCommand->m_commandId,
+                commandOffset);
+
             switch (pGpuCommand->m_commandId)
             {
             case Header:
@@ -363,6 +355,12 @@ RosKmdRapAdapter::ProcessRenderBuffer(
             default:
                 break;
             }
+
+            m_timeline.Record(
+                RosTimelineEventCommandEnd,
+                pDmaBufSubmission->m_SubmissionFenceId,
+                pGpuCommand->m_commandId,
+                commandOffset);
         }
     }
     else
@@ -482,18 +480,36 @@ RosKmdRapAdapter::ProcessRenderBuffer(
 
 #endif
 
+            m_timeline.Record(
+                RosTimelineEventControlListStart,
+                pDmaBufSubmission->m_SubmissionFenceId,
+                RosTimelineControlListBinning,
+                pDmaBufSubmission->m_StartOffset);
+
             // Skip the command buffer header at the beginning
             SubmitControlList(
                 true,
                 dmaBufBaseAddress + pDmaBufSubmission->m_StartOffset + sizeof(GpuCommand),
                 dmaBufBaseAddress + pDmaBufSubmission->m_EndOffset);
 
+            m_timeline.Record(
+                RosTimelineEventControlListEnd,
+                pDmaBufSubmission->m_SubmissionFenceId,
+                RosTimelineControlListBinning,
+                pDmaBufSubmission->m_StartOffset);
+
 #if DBG
 
             m_pVC4RegFile->V3D_PCTRC = ((1 << V3D_NUM_PERF_COUNTERS) - 1);
 
 #endif
 
+            m_timeline.Record(
+                RosTimelineEventControlListStart,
+                pDmaBufSubmission->m_SubmissionFenceId,
+                RosTimelineControlListRendering,
+                pDmaBufSubmission->m_StartOffset);
+
             //
             // Submit the Rendering Control List to the GPU
             //
@@ -502,6 +518,12 @@ RosKmdRapAdapter::ProcessRenderBuffer(
                 m_renderingControlListPhysicalAddress + m_busAddressOffset,
                 m_renderingControlListPhysicalAddress + m_busAddressOffset + renderingControlListLength);
 
+            m_timeline.Record(
+                RosTimelineEventControlListEnd,
+                pDmaBufSubmission->m_SubmissionFenceId,
+                RosTimelineControlListRendering,
+                pDmaBufSubmission->m_StartOffset);
+
             ROS_LOG_TRACE(
                 "Completed rendering to 0x%p",
                 pDmaBufInfo->m_RenderTargetVirtualAddress);
@@ -633,164 +655,6 @@ RosKmdRapAdapter::SubmitControlList(
     }
 }
 
-UINT
-RosKmdRapAdapter::GenerateRenderingControlList(
-    ROSDMABUFINFO *pDmaBufInfo)
-{
-    RosKmdAllocation *pRenderTarget = pDmaBufInfo->m_pRenderTarget;
-
-    // Write Clear Colors command from UMD
-    VC4ClearColors *pVC4ClearColors;
-    VC4WaitOnSemaphore *pVC4WaitOnSempahore;
-
-    if (pDmaBufInfo->m_DmaBufState.m_HasVC4ClearColors)
-    {
-        pVC4ClearColors = (VC4ClearColors *)m_pRenderingControlList;
-
-        *pVC4ClearColors = pDmaBufInfo->m_VC4ClearColors;
-
-        MoveToNextCommand(pVC4ClearColors, pVC4WaitOnSempahore);
-    }
-    else
-    {
-        pVC4WaitOnSempahore = (VC4WaitOnSemaphore *)m_pRenderingControlList;
-    }
-
-    // Wait binning to be done.
-
-    VC4WaitOnSemaphore waitOnSemaphore = vc4WaitOnSemaphore;
-    *pVC4WaitOnSempahore = waitOnSemaphore;
-
-    VC4TileRenderingModeConfig *pVC4TileRenderingModeConfig;
-    MoveToNextCommand(pVC4WaitOnSempahore, pVC4TileRenderingModeConfig);
-
-    // Write Tile Rendering Mode Config command
-
-    VC4TileRenderingModeConfig  tileRenderingModeConfig = vc4TileRenderingModeConfig;
-
-    tileRenderingModeConfig.MemoryAddress = pDmaBufInfo->m_RenderTargetPhysicalAddress + m_busAddressOffset;
-
-    tileRenderingModeConfig.WidthInPixels = (USHORT)pRenderTarget->m_mip0Info.TexelWidth;
-    tileRenderingModeConfig.HeightInPixels = (USHORT)pRenderTarget->m_mip0Info.TexelHeight;
-
-    tileRenderingModeConfig.NonHDRFrameBufferColorFormat = static_cast<USHORT>(
-        Vc4FrameBufferColorFormatFromDxgiFormat(pRenderTarget->m_format));
-
-    tileRenderingModeConfig.MemoryFormat = static_cast<USHORT>(
-        Vc4MemoryFormatFromRosHwLayout(pRenderTarget->m_hwLayout));
-
-    *pVC4TileRenderingModeConfig = tileRenderingModeConfig;
-
-    // Clear the tile buffer by store the 1st tile
-    VC4TileCoordinates *pVC4TileCoordinates = NULL;
-    VC4StoreTileBufferGeneral  *pVC4StoreTileBufferGeneral = NULL;
-
-    if (pDmaBufInfo->m_DmaBufState.m_HasVC4ClearColors)
-    {
-        MoveToNextCommand(pVC4TileRenderingModeConfig, pVC4TileCoordinates);
-
-        *pVC4TileCoordinates = vc4TileCoordinates;
-
-        MoveToNextCommand(pVC4TileCoordinates, pVC4StoreTileBufferGeneral);
-
-        *pVC4StoreTileBufferGeneral = vc4StoreTileBufferGeneral;
-    }
-
-    //
-    // Calling control list generated by the Binning Control List
-    //
-    UINT    widthInTiles = pRenderTarget->m_hwWidthPixels / VC4_BINNING_TILE_PIXELS;
-    UINT    heightInTiles = pRenderTarget->m_hwHeightPixels / VC4_BINNING_TILE_PIXELS;
-
-    VC4TileCoordinates  tileCoordinates = vc4TileCoordinates;
-    VC4BranchToSubList  branchToSubList = vc4BranchToSubList;
-    VC4LoadTileBufferGeneral    loadTileBufColor = vc4LoadTileBufferGeneral;
-    UINT    tileAllocationPhysicalAddress = m_tileAllocationMemoryPhysicalAddress + m_busAddressOffset;
-    VC4LoadTileBufferGeneral    *pVC4LoadTileBufGeneral = NULL;
-    VC4BranchToSubList *pVC4BranchToSubList = NULL;
-    VC4StoreMSResolvedTileColorBuf *pVC4StoreMSResolvedTileColorBuf = NULL;
-    VC4StoreMSResolvedTileColorBufAndSignalEndOfFrame  *pVC4StoreMSResolvedTileColorBufAndSignalEndOfFrame = NULL;
-
-    if (pDmaBufInfo->m_DmaBufState.m_HasVC4ClearColors)
-    {
-        MoveToNextCommand(pVC4StoreTileBufferGeneral, pVC4TileCoordinates);
-        pVC4StoreMSResolvedTileColorBufAndSignalEndOfFrame = (VC4StoreMSResolvedTileColorBufAndSignalEndOfFrame *)pVC4TileCoordinates;
-    }
-    else
-    {
-        if (pDmaBufInfo->m_pRenderTarget)
-        {
-            loadTileBufColor.BufferToLoad = VC4_TILE_BUFFER_COLOR;
-
-            loadTileBufColor.Fortmat = static_cast<USHORT>(
-                Vc4MemoryFormatFromRosHwLayout(
-                    pDmaBufInfo->m_pRenderTarget->m_hwLayout));
-
-            loadTileBufColor.PixelColorFormat = static_cast<USHORT>(
-                Vc4TileBufferPixelFormatFromDxgiFormat(
-                    pDmaBufInfo->m_pRenderTarget->m_format));
-
-            loadTileBufColor.MemoryBaseAddress = (pDmaBufInfo->m_RenderTargetPhysicalAddress + m_busAddressOffset) >> 4;
-
-            MoveToNextCommand(pVC4TileRenderingModeConfig, pVC4LoadTileBufGeneral);
-        }
-    }
-
-    for (UINT x = 0; x < widthInTiles; x++)
-    {
-        for (UINT y = 0; y < heightInTiles; y++)
-        {
-            if (! pDmaBufInfo->m_DmaBufState.m_HasVC4ClearColors)
-            {
-                if (pDmaBufInfo->m_pRenderTarget)
-                {
-                    *pVC4LoadTileBufGeneral = loadTileBufColor;
-
-                    MoveToNextCommand(pVC4LoadTileBufGeneral, pVC4TileCoordinates);
-                }
-            }
-
-            tileCoordinates.TileColumnNumber = (BYTE)x;
-            tileCoordinates.TileRowNumber = (BYTE)y;
-
-            *pVC4TileCoordinates = tileCoordinates;
-
-            MoveToNextCommand(pVC4TileCoordinates, pVC4BranchToSubList);
-
-            branchToSubList.BranchAddress = tileAllocationPhysicalAddress + (y*widthInTiles + x)*VC4_TILE_ALLOCATION_BLOCK_SIZE;
-
-            *pVC4BranchToSubList = branchToSubList;
-
-            if ((x == (widthInTiles - 1)) &&
-                (y == (heightInTiles - 1)))
-            {
-                MoveToNextCommand(pVC4BranchToSubList, pVC4StoreMSResolvedTileColorBufAndSignalEndOfFrame);
-
-                *pVC4StoreMSResolvedTileColorBufAndSignalEndOfFrame = vc4StoreMSResolvedTileColorBufAndSignalEndOfFrame;
-
-                pVC4StoreMSResolvedTileColorBufAndSignalEndOfFrame++;
-            }
-            else
-            {
-                MoveToNextCommand(pVC4BranchToSubList, pVC4StoreMSResolvedTileColorBuf);
-
-                *pVC4StoreMSResolvedTileColorBuf = vc4StoreMSResolvedTileColorBuf;
-
-                if (pDmaBufInfo->m_DmaBufState.m_HasVC4ClearColors)
-                {
-                    MoveToNextCommand(pVC4StoreMSResolvedTileColorBuf, pVC4TileCoordinates);
-                }
-                else
-                {
-                    MoveToNextCommand(pVC4StoreMSResolvedTileColorBuf, pVC4LoadTileBufGeneral);
-                }
-            }
-        }
-    }
-
-    return ((UINT)(((PBYTE)pVC4StoreMSResolvedTileColorBufAndSignalEndOfFrame) - m_pRenderingControlList));
-}
-
 NTSTATUS
 RosKmdRapAdapter::SetVC4Power(
         bool    bOn)
@@ -38,41 +38,8 @@ private:
     VC4_REGISTER_FILE          *m_pVC4RegFile;
 
     void SubmitControlList(bool bBinningControlist, UINT startAddress, UINT endAddress);
-    UINT GenerateRenderingControlList(ROSDMABUFINFO *pDmaBufInf);
 
     NTSTATUS SetVC4Power(bool bOn);
-
-    void MoveToNextBinnerRenderMemChunk(UINT controlListLength)
-    {
-        controlListLength = (controlListLength + (kPageSize - 1)) & (~(kPageSize - 1));
-
-#if BINNER_DBG
-
-        m_pRenderingControlList += controlListLength;
-        m_renderingControlListPhysicalAddress += controlListLength;
-
-        if ((m_renderingControlListPhysicalAddress + 64 * kPageSize) > (m_controlListPoolPhysicalAddress + VC4_RENDERING_CTRL_LIST_POOL_SIZE))
-        {
-            m_pRenderingControlList = m_pControlListPool;
-            m_renderingControlListPhysicalAddress = m_controlListPoolPhysicalAddress;
-        }
-
-        m_tileAllocationMemoryPhysicalAddress += 64 * kPageSize;
-
-        if ((m_tileAllocationMemoryPhysicalAddress + 64 * kPageSize) >= m_tileStatePoolPhysicalAddress)
-        {
-            m_tileAllocationMemoryPhysicalAddress = m_tileAllocPoolPhysicalAddress;
-        }
-
-        m_tileStateDataArrayPhysicalAddress += 64 * kPageSize;
-
-        if ((m_tileStateDataArrayPhysicalAddress + 64 * kPageSize) >= (RosKmdGlobal::s_videoMemoryPhysicalAddress.LowPart + RosKmdGlobal::s_videoMemorySize))
-        {
-            m_tileStateDataArrayPhysicalAddress = m_tileStatePoolPhysicalAddress;
-        }
-
-#endif
-    }
     
 private: // NONPAGED
     
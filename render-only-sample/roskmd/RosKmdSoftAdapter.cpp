@@ -23,7 +23,81 @@ RosKmdSoftAdapter::Start(
     OUT_PULONG              NumberOfVideoPresentSources,
     OUT_PULONG              NumberOfChildren)
 {
-    return RosKmAdapter::Start(DxgkStartInfo, DxgkInterface, NumberOfVideoPresentSources, NumberOfChildren);
+    NTSTATUS status = RosKmAdapter::Start(
+            DxgkStartInfo,
+            DxgkInterface,
+            NumberOfVideoPresentSources,
+            NumberOfChildren);
+    if (!NT_SUCCESS(status))
+    {
+        ROS_LOG_ERROR(
+            "RosKmAdapter::Start(...) failed. (status=%!STATUS!)",
+            status);
+        return status;
+    }
+
+#if VC4
+
+    auto stopKmAdapter = ROS_FINALLY::DoUnless([&]
+    {
+        PAGED_CODE();
+        NTSTATUS tempStatus = RosKmAdapter::Stop();
+        UNREFERENCED_PARAMETER(tempStatus);
+        NT_ASSERT(NT_SUCCESS(tempStatus));
+    });
+
+    //
+    // The emulated VC4 uses the same memory pools as the HW
+    //
+
+    InitializeVc4MemoryPools();
+
+    status = m_workerPool.Start();
+    if (!NT_SUCCESS(status))
+    {
+        ROS_LOG_ERROR(
+            "Failed to start VC4 emulator worker threads. (status=%!STATUS!)",
+            status);
+        return status;
+    }
+
+    auto stopWorkerPool = ROS_FINALLY::DoUnless([&]
+    {
+        PAGED_CODE();
+        m_workerPool.Stop();
+    });
+
+    status = m_vc4Emulator.Initialize(&m_workerPool);
+    if (!NT_SUCCESS(status))
+    {
+        ROS_LOG_ERROR(
+            "Failed to initialize VC4 emulator. (status=%!STATUS!)",
+            status);
+        return status;
+    }
+
+    stopKmAdapter.DoNot();
+    stopWorkerPool.DoNot();
+
+#endif
+
+    ROS_LOG_TRACE("RosKmdSoftAdapter successfully started.");
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+RosKmdSoftAdapter::Stop()
+{
+    ROS_LOG_TRACE("Stopping RosKmdSoftAdapter");
+
+#if VC4
+
+    m_vc4Emulator.Uninitialize();
+    m_workerPool.Stop();
+
+#endif
+
+    return RosKmAdapter::Stop();
 }
 
 void
@@ -32,31 +106,158 @@ RosKmdSoftAdapter::ProcessRenderBuffer(
 {
     ROSDMABUFINFO * pDmaBufInfo = pDmaBufSubmission->m_pDmaBufInfo;
 
-    NT_ASSERT(pDmaBufInfo->m_DmaBufState.m_bSwCommandBuffer);
+    if (pDmaBufInfo->m_DmaBufState.m_bSwCommandBuffer)
+    {
+        NT_ASSERT(0 == (pDmaBufSubmission->m_EndOffset - pDmaBufSubmission->m_StartOffset) % sizeof(GpuCommand));
+
+        GpuCommand * pGpuCommand = (GpuCommand *)(pDmaBufInfo->m_pDmaBuffer + pDmaBufSubmission->m_StartOffset);
+        GpuCommand * pEndofCommand = (GpuCommand *)(pDmaBufInfo->m_pDmaBuffer + pDmaBufSubmission->m_EndOffset);
+
+        for (; pGpuCommand < pEndofCommand; pGpuCommand++)
+        {
+            UINT commandOffset = (UINT)((BYTE *)pGpuCommand - pDmaBufInfo->m_pDmaBuffer);
 
-    NT_ASSERT(0 == (pDmaBufSubmission->m_EndOffset - pDmaBufSubmission->m_StartOffset) % sizeof(GpuCommand));
+            m_timeline.Record(
+                RosTimelineEventCommandStart,
+                pDmaBufSubmission->m_SubmissionFenceId,
+                pGpuCommand->m_commandId,
+                commandOffset);
 
-    GpuCommand * pGpuCommand = (GpuCommand *)(pDmaBufInfo->m_pDmaBuffer + pDmaBufSubmission->m_StartOffset);
-    GpuCommand * pEndofCommand = (GpuCommand *)(pDmaBufInfo->m_pDmaBuffer + pDmaBufSubmission->m_EndOffset);
+            switch (pGpuCommand->m_commandId)
+            {
+            case Header:
+            case Nop:
+                break;
+            case ResourceCopy:
+            {
+                RtlCopyMemory(
+                    ((BYTE *)RosKmdGlobal::s_pVideoMemory) + pGpuCommand->m_resourceCopy.m_dstGpuAddress.QuadPart,
+                    ((BYTE *)RosKmdGlobal::s_pVideoMemory) + pGpuCommand->m_resourceCopy.m_srcGpuAddress.QuadPart,
+                    pGpuCommand->m_resourceCopy.m_sizeBytes);
+            }
+            break;
+            default:
+                break;
+            }
 
-    for (; pGpuCommand < pEndofCommand; pGpuCommand++)
+            m_timeline.Record(
+                RosTimelineEventCommandEnd,
+                pDmaBufSubmission->m_SubmissionFenceId,
+                pGpuCommand->m_commandId,
+                commandOffset);
+        }
+    }
+    else
     {
-        switch (pGpuCommand->m_commandId)
+#if VC4
+
+        //
+        // Run the HW command buffer on the emulated VC4, the same way
+        // RosKmdRapAdapter submits it to the GPU
+        //
+
+#if defined(_X86_)
+
+        KFLOATING_SAVE  floatingSave;
+
+        if (!NT_SUCCESS(KeSaveFloatingPointState(&floatingSave)))
         {
-        case Header:
-        case Nop:
-            break;
-        case ResourceCopy:
+            ROS_LOG_ERROR("Failed to save floating point state for VC4 emulator.");
+            return;
+        }
+
+#endif
+
+        NT_ASSERT(pDmaBufInfo->m_DmaBufferPhysicalAddress.HighPart == 0);
+
+        UINT dmaBufBaseAddress;
+
+        dmaBufBaseAddress = GetAperturePhysicalAddress(pDmaBufInfo->m_DmaBufferPhysicalAddress.LowPart);
+        dmaBufBaseAddress += m_busAddressOffset;
+
+        m_vc4Emulator.SetMemoryRegion(
+            Vc4EmuRegionVideoMemory,
+            RosKmdGlobal::s_videoMemoryPhysicalAddress.LowPart + m_busAddressOffset,
+            (UINT)RosKmdGlobal::s_videoMemorySize,
+            (BYTE *)RosKmdGlobal::s_pVideoMemory);
+
+        m_vc4Emulator.SetMemoryRegion(
+            Vc4EmuRegionDmaBuffer,
+            dmaBufBaseAddress,
+            pDmaBufInfo->m_DmaBufferSize,
+            pDmaBufInfo->m_pDmaBuffer);
+
+        m_timeline.Record(
+            RosTimelineEventControlListStart,
+            pDmaBufSubmission->m_SubmissionFenceId,
+            RosTimelineControlListBinning,
+            pDmaBufSubmission->m_StartOffset);
+
+        // Skip the command buffer header at the beginning
+        bool bBinned = m_vc4Emulator.ExecuteBinningControlList(
+            dmaBufBaseAddress + pDmaBufSubmission->m_StartOffset + sizeof(GpuCommand),
+            dmaBufBaseAddress + pDmaBufSubmission->m_EndOffset);
+
+        m_timeline.Record(
+            RosTimelineEventControlListEnd,
+            pDmaBufSubmission->m_SubmissionFenceId,
+            RosTimelineControlListBinning,
+            pDmaBufSubmission->m_StartOffset);
+
+        if (bBinned)
         {
-            RtlCopyMemory(
-                ((BYTE *)RosKmdGlobal::s_pVideoMemory) + pGpuCommand->m_resourceCopy.m_dstGpuAddress.QuadPart,
-                ((BYTE *)RosKmdGlobal::s_pVideoMemory) + pGpuCommand->m_resourceCopy.m_srcGpuAddress.QuadPart,
-                pGpuCommand->m_resourceCopy.m_sizeBytes);
+            UINT    renderingControlListLength;
+            renderingControlListLength = GenerateRenderingControlList(pDmaBufInfo);
+
+            m_timeline.Record(
+                RosTimelineEventControlListStart,
+                pDmaBufSubmission->m_SubmissionFenceId,
+                RosTimelineControlListRendering,
+                pDmaBufSubmission->m_StartOffset);
+
+            if (!m_vc4Emulator.ExecuteRenderingControlList(
+                    m_renderingControlListPhysicalAddress + m_busAddressOffset,
+                    m_renderingControlListPhysicalAddress + m_busAddressOffset + renderingControlListLength))
+            {
+                ROS_LOG_ERROR(
+                    "VC4 emulator failed to render to 0x%p",
+                    pDmaBufInfo->m_RenderTargetVirtualAddress);
+
+                m_ErrorHit.m_EmulationFailure = 1;
+            }
+
+            m_timeline.Record(
+                RosTimelineEventControlListEnd,
+                pDmaBufSubmission->m_SubmissionFenceId,
+                RosTimelineControlListRendering,
+                pDmaBufSubmission->m_StartOffset);
+
+            ROS_LOG_TRACE(
+                "Completed rendering to 0x%p",
+                pDmaBufInfo->m_RenderTargetVirtualAddress);
+
+            MoveToNextBinnerRenderMemChunk(renderingControlListLength);
         }
-        break;
-        default:
-            break;
+        else
+        {
+            //
+            // The tile lists are not terminated, the frame is dropped
+            //
+
+            ROS_LOG_ERROR(
+                "VC4 emulator failed to bin, rendering to 0x%p is skipped",
+                pDmaBufInfo->m_RenderTargetVirtualAddress);
+
+            m_ErrorHit.m_EmulationFailure = 1;
         }
+
+#if defined(_X86_)
+
+        KeRestoreFloatingPointState(&floatingSave);
+
+#endif
+
+#endif  // VC4
     }
 }
 
@@ -68,3 +269,236 @@ BOOLEAN RosKmdSoftAdapter::InterruptRoutine(
     return false;
 }
 
+#if VC4
+
+NTSTATUS
+RosKmdSoftWorkerPool::Start()
+{
+    m_numWorkers = min(KeQueryActiveProcessorCount(NULL), VC4EMU_MAX_WORKERS);
+    m_workerExit = false;
+    m_numBusyWorkers = 0;
+
+    KeInitializeEvent(&m_doneEvent, NotificationEvent, FALSE);
+
+    //
+    // The thread calling Run() is worker 0
+    //
+
+    m_workers[0].m_pPool = this;
+    m_workers[0].m_index = 0;
+    m_workers[0].m_pThread = NULL;
+
+    for (UINT i = 1; i < m_numWorkers; i++)
+    {
+        Worker *pWorker = &m_workers[i];
+
+        pWorker->m_pPool = this;
+        pWorker->m_index = i;
+        pWorker->m_pThread = NULL;
+
+        KeInitializeEvent(&pWorker->m_startEvent, SynchronizationEvent, FALSE);
+
+        OBJECT_ATTRIBUTES   ObjectAttributes;
+        HANDLE              hWorkerThread;
+
+        InitializeObjectAttributes(&ObjectAttributes, NULL, OBJ_KERNEL_HANDLE, NULL, NULL);
+
+        NTSTATUS status = PsCreateSystemThread(
+            &hWorkerThread,
+            THREAD_ALL_ACCESS,
+            &ObjectAttributes,
+            NULL,
+            NULL,
+            (PKSTART_ROUTINE) RosKmdSoftWorkerPool::WorkerThread,
+            pWorker);
+
+        if (status != STATUS_SUCCESS)
+        {
+            ROS_LOG_ERROR(
+                "PsCreateSystemThread(...) failed for RosKmdSoftWorkerPool::WorkerThread. (status=%!STATUS!)",
+                status);
+            m_numWorkers = i;
+            Stop();
+            return status;
+        }
+
+        status = ObReferenceObjectByHandle(
+            hWorkerThread,
+            THREAD_ALL_ACCESS,
+            *PsThreadType,
+            KernelMode,
+            (PVOID *)&pWorker->m_pThread,
+            NULL);
+
+        ZwClose(hWorkerThread);
+
+        if (!NT_SUCCESS(status))
+        {
+            ROS_LOG_ERROR(
+                "ObReferenceObjectByHandle(...) failed for VC4 emulator worker thread. (status=%!STATUS!)",
+                status);
+
+            //
+            // The thread is running, Stop() signals it to exit
+            //
+
+            m_numWorkers = i + 1;
+            Stop();
+            return status;
+        }
+    }
+
+    return STATUS_SUCCESS;
+}
+
+void
+RosKmdSoftWorkerPool::Stop()
+{
+    m_workerExit = true;
+
+    for (UINT i = 1; i < m_numWorkers; i++)
+    {
+        Worker *pWorker = &m_workers[i];
+
+        KeSetEvent(&pWorker->m_startEvent, 0, FALSE);
+
+        if (pWorker->m_pThread)
+        {
+            NTSTATUS status = KeWaitForSingleObject(
+                pWorker->m_pThread,
+                Executive,
+                KernelMode,
+                FALSE,
+                NULL);
+
+            status;
+            NT_ASSERT(status == STATUS_SUCCESS);
+
+            ObDereferenceObject(pWorker->m_pThread);
+            pWorker->m_pThread = NULL;
+        }
+    }
+
+    m_numWorkers = 0;
+}
+
+void
+RosKmdSoftWorkerPool::Run(
+    PFN_VC4EMU_JOB  pfnJob,
+    void           *pContext,
+    UINT            numItems)
+{
+    m_pfnJob = pfnJob;
+    m_pContext = pContext;
+    m_numItems = numItems;
+    m_nextItem = 0;
+
+    //
+    // Wake up only as many workers as there are items for
+    //
+
+    UINT numHelpers = min(m_numWorkers, numItems);
+
+    numHelpers = numHelpers ? (numHelpers - 1) : 0;
+
+    if (numHelpers)
+    {
+        m_numBusyWorkers = numHelpers;
+
+        KeClearEvent(&m_doneEvent);
+
+        for (UINT i = 1; i <= numHelpers; i++)
+        {
+            KeSetEvent(&m_workers[i].m_startEvent, 0, FALSE);
+        }
+    }
+
+    RunItems(0);
+
+    if (numHelpers)
+    {
+        NTSTATUS status = KeWaitForSingleObject(
+            &m_doneEvent,
+            Executive,
+            KernelMode,
+            FALSE,
+            NULL);
+
+        status;
+        NT_ASSERT(status == STATUS_SUCCESS);
+    }
+}
+
+void
+RosKmdSoftWorkerPool::RunItems(
+    UINT    worker)
+{
+    for (;;)
+    {
+        UINT item = (UINT)InterlockedIncrement(&m_nextItem) - 1;
+
+        if (item >= m_numItems)
+        {
+            break;
+        }
+
+        m_pfnJob(m_pContext, item, worker);
+    }
+}
+
+void
+RosKmdSoftWorkerPool::WorkerThread(
+    void   *StartContext)
+{
+    Worker                 *pWorker = (Worker *)StartContext;
+    RosKmdSoftWorkerPool   *pPool = pWorker->m_pPool;
+
+    for (;;)
+    {
+        NTSTATUS status = KeWaitForSingleObject(
+            &pWorker->m_startEvent,
+            Executive,
+            KernelMode,
+            FALSE,
+            NULL);
+
+        status;
+        NT_ASSERT(status == STATUS_SUCCESS);
+
+        if (pPool->m_workerExit)
+        {
+            break;
+        }
+
+#if defined(_X86_)
+
+        KFLOATING_SAVE  floatingSave;
+        bool            bFloatingSaved = NT_SUCCESS(KeSaveFloatingPointState(&floatingSave));
+
+        //
+        // Leave the items to the other workers if the state can't be saved
+        //
+
+        if (bFloatingSaved)
+        {
+            pPool->RunItems(pWorker->m_index);
+
+            KeRestoreFloatingPointState(&floatingSave);
+        }
+
+#else
+
+        pPool->RunItems(pWorker->m_index);
+
+#endif
+
+        if (0 == InterlockedDecrement(&pPool->m_numBusyWorkers))
+        {
+            KeSetEvent(&pPool->m_doneEvent, 0, FALSE);
+        }
+    }
+
+    PsTerminateSystemThread(STATUS_SUCCESS);
+}
+
+#endif
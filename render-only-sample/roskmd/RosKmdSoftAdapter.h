@@ -2,6 +2,56 @@
 
 #include "RosKmdAdapter.h"
 
+#if VC4
+
+#include "Vc4Emulator.h"
+
+//
+// Kernel threads the VC4 emulator splits binning and rendering work on,
+// one per processor
+//
+
+class RosKmdSoftWorkerPool : public Vc4EmuWorkerPool
+{
+public:
+
+    NTSTATUS Start();
+    void Stop();
+
+    virtual UINT GetWorkerCount() override
+    {
+        return m_numWorkers;
+    }
+
+    virtual void Run(PFN_VC4EMU_JOB pfnJob, void * pContext, UINT numItems) override;
+
+private:
+
+    struct Worker
+    {
+        RosKmdSoftWorkerPool   *m_pPool;
+        UINT                    m_index;
+        PKTHREAD                m_pThread;
+        KEVENT                  m_startEvent;
+    };
+
+    static void WorkerThread(void * StartContext);
+    void RunItems(UINT worker);
+
+    UINT                m_numWorkers;
+    Worker              m_workers[VC4EMU_MAX_WORKERS];
+    KEVENT              m_doneEvent;
+    bool                m_workerExit;
+
+    PFN_VC4EMU_JOB      m_pfnJob;
+    void               *m_pContext;
+    UINT                m_numItems;
+    volatile LONG       m_nextItem;
+    volatile LONG       m_numBusyWorkers;
+};
+
+#endif
+
 class RosKmdSoftAdapter : public RosKmAdapter
 {
 private:
@@ -32,6 +82,17 @@ protected:
         OUT_PULONG              NumberOfVideoPresentSources,
         OUT_PULONG              NumberOfChildren);
 
+    virtual NTSTATUS Stop() override;
+
     virtual BOOLEAN InterruptRoutine(
         IN_ULONG        MessageNumber);
-};
\ No newline at end of file
+
+#if VC4
+
+private:
+
+    RosKmdSoftWorkerPool    m_workerPool;
+    Vc4Emulator             m_vc4Emulator;
+
+#endif
+};
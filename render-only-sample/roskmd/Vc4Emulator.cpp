@@ -0,0 +1,2540 @@
+#ifdef _KERNEL_MODE
+
+#include "precomp.h"
+
+#include "RosKmdLogging.h"
+#include "Vc4Emulator.tmh"
+
+#else
+
+#include "vc4emutest.h"
+
+#endif
+
+#include "Vc4Emulator.h"
+
+#include <math.h>
+
+//
+// Emulator private primitive packets in the tile lists, see Vc4Emulator.h
+//
+
+const UINT kPrimitivePacketSize = 1 + 3 * sizeof(UINT);
+const UINT kClippedPrimitivePacketSize = kPrimitivePacketSize + sizeof(UINT);
+
+const UINT kNoTileJob = MAXUINT;
+
+//
+// Vertices are clipped against W > kMinW and a guard band that keeps the
+// screen coordinates (in 1/16th of pixel) within 16 bits
+//
+
+const float kMinW = 1e-5f;
+const float kGuardBand = 32000.0f;
+
+static UINT ReadUint(const BYTE * pData)
+{
+    UINT value;
+
+    RtlCopyMemory(&value, pData, sizeof(value));
+
+    return value;
+}
+
+static UINT GetPacketSize(BYTE command)
+{
+    switch (command)
+    {
+    case VC4_CMD_HALT:
+    case VC4_CMD_NOP:
+    case VC4_CMD_FLUSH:
+    case VC4_CMD_FLUSH_ALL_STATE:
+    case VC4_CMD_START_TILE_BINNING:
+    case VC4_CMD_INCREMENT_SEMAPHORE:
+    case VC4_CMD_WAIT_ON_SEMAPHORE:
+    case VC4_CMD_RETURN_FROM_SUB_LIST:
+    case VC4_CMD_STORE_MS_RESOLVED_TILE_COLOR_BUF:
+    case VC4_CMD_STORE_MS_RESOLVED_TILE_COLOR_BUF_AND_SIGNAL_END_OF_FRAME:
+        return 1;
+    case VC4_CMD_BRANCH:
+        return sizeof(VC4Branch);
+    case VC4_CMD_BRANCH_TO_SUB_LIST:
+        return sizeof(VC4BranchToSubList);
+    case VC4_CMD_STORE_FULL_RESOLUTION_TILE_BUFFER:
+    case VC4_CMD_LOAD_FULL_RESOLUTION_TILE_BUFFER:
+        return 5;
+    case VC4_CMD_STORE_TILE_BUF_GENERAL:
+        return sizeof(VC4StoreTileBufferGeneral);
+    case VC4_CMD_LOAD_TILE_BUF_GENERAL:
+        return sizeof(VC4LoadTileBufferGeneral);
+    case VC4_CMD_INDEXED_PRIMITIVE_LIST:
+        return sizeof(VC4IndexedPrimitiveList);
+    case VC4_CMD_VERTEX_ARRAY_PRIMITIVES:
+        return sizeof(VC4VertexArrayPrimitives);
+    case VC4_CMD_COMPRESSED_PRIMITIVE_LIST:
+        return kPrimitivePacketSize;
+    case VC4_CMD_CLIPPED_PRIMITVE_WITH_COMPRESSED_PRIMITIVE_LIST:
+        return kClippedPrimitivePacketSize;
+    case VC4_CMD_PRIMITIVE_LIST_FORMAT:
+        return sizeof(VC4PrimitiveListFormat);
+    case VC4_CMD_GL_SHADER_STATE:
+        return sizeof(VC4GLShaderState);
+    case VC4_CMD_NV_SHADER_STATE:
+        return sizeof(VC4NVShaderState);
+    case VC4_CMD_CONFIG_BITS:
+        return sizeof(VC4ConfigBits);
+    case VC4_CMD_FLAT_SHADE_FLAGS:
+        return sizeof(VC4FlatShadeFlags);
+    case VC4_CMD_POINT_SIZE:
+        return sizeof(VC4PointSize);
+    case VC4_CMD_LINE_WIDTH:
+        return sizeof(VC4LineWidth);
+    case VC4_CMD_RHT_X_BOUNDARY:
+        return 3;
+    case VC4_CMD_DEPTH_OFFSET:
+        return sizeof(VC4DepthOffset);
+    case VC4_CMD_CLIP_WINDOW:
+        return sizeof(VC4ClipWindow);
+    case VC4_CMD_VIEWPORT_OFFSET:
+        return sizeof(VC4ViewportOffset);
+    case VC4_CMD_Z_MIN_AND_MAX_CLIPPING_PLANES:
+        return sizeof(VC4ZClippingPlanes);
+    case VC4_CMD_CLIPPER_XY_SCALING:
+        return sizeof(VC4ClipperXYScaling);
+    case VC4_CMD_CLIPPER_Z_SCALE_AND_OFFSET:
+        return sizeof(VC4ClipperZScaleAndOffset);
+    case VC4_CMD_TILE_BINNING_MODE_CONFIG:
+        return sizeof(VC4TileBinningModeConfig);
+    case VC4_CMD_TILE_RENDERING_MODE_CONFIG:
+        return sizeof(VC4TileRenderingModeConfig);
+    case VC4_CMD_CLEAR_COLOR:
+        return sizeof(VC4ClearColors);
+    case VC4_CMD_TILE_COORDINATES:
+        return sizeof(VC4TileCoordinates);
+    default:
+        return 0;
+    }
+}
+
+static void InitializeState(Vc4EmuState * pState)
+{
+    RtlZeroMemory(pState, sizeof(*pState));
+
+    pState->m_configBits = vc4ConfigBits;
+    pState->m_flatShadeFlags = vc4FlatShadeFlags;
+    pState->m_clipWindow = vc4ClipWindow;
+    pState->m_viewportOffset = vc4ViewportOffset;
+    pState->m_clipperXYScaling = vc4ClipperXYScaling;
+    pState->m_clipperZScaleAndOffset = vc4ClipperZScaleAndOffset;
+}
+
+static bool UpdateState(Vc4EmuState * pState, const BYTE * pPacket)
+{
+    switch (pPacket[0])
+    {
+    case VC4_CMD_GL_SHADER_STATE:
+    case VC4_CMD_NV_SHADER_STATE:
+        pState->m_shaderStateCommand = (VC4_COMMAND_ID)pPacket[0];
+        pState->m_shaderState = ReadUint(pPacket + 1);
+        break;
+    case VC4_CMD_CONFIG_BITS:
+        RtlCopyMemory(&pState->m_configBits, pPacket, sizeof(pState->m_configBits));
+        break;
+    case VC4_CMD_FLAT_SHADE_FLAGS:
+        RtlCopyMemory(&pState->m_flatShadeFlags, pPacket, sizeof(pState->m_flatShadeFlags));
+        break;
+    case VC4_CMD_CLIP_WINDOW:
+        RtlCopyMemory(&pState->m_clipWindow, pPacket, sizeof(pState->m_clipWindow));
+        break;
+    case VC4_CMD_VIEWPORT_OFFSET:
+        RtlCopyMemory(&pState->m_viewportOffset, pPacket, sizeof(pState->m_viewportOffset));
+        break;
+    case VC4_CMD_CLIPPER_XY_SCALING:
+        RtlCopyMemory(&pState->m_clipperXYScaling, pPacket, sizeof(pState->m_clipperXYScaling));
+        break;
+    case VC4_CMD_CLIPPER_Z_SCALE_AND_OFFSET:
+        RtlCopyMemory(&pState->m_clipperZScaleAndOffset, pPacket, sizeof(pState->m_clipperZScaleAndOffset));
+        break;
+    default:
+        return false;
+    }
+
+    return true;
+}
+
+NTSTATUS
+Vc4Emulator::Initialize(
+    Vc4EmuWorkerPool   *pWorkerPool)
+{
+    RtlZeroMemory(this, sizeof(*this));
+
+    m_pWorkerPool = pWorkerPool;
+    m_numWorkers = min(pWorkerPool->GetWorkerCount(), VC4EMU_MAX_WORKERS);
+
+    for (UINT i = 0; i < m_numWorkers; i++)
+    {
+        m_pWorkers[i] = (WorkerScratch *)ExAllocatePoolWithTag(NonPagedPoolNx, sizeof(WorkerScratch), 'ROSD');
+
+        if (!m_pWorkers[i])
+        {
+            ROS_LOG_ERROR(
+                "Failed to allocate VC4 emulator worker scratch. (worker=%d)",
+                i);
+
+            Uninitialize();
+
+            return STATUS_NO_MEMORY;
+        }
+
+        RtlZeroMemory(m_pWorkers[i], sizeof(WorkerScratch));
+    }
+
+    //
+    // Vertex cache entries are valid for the generation they were shaded in
+    //
+
+    m_generation = 1;
+
+    //
+    // Clear colors are kept between frames like in the V3D registers, a frame
+    // without VC4_CMD_CLEAR_COLOR starts with depth at the far plane
+    //
+
+    m_clearColors = vc4ClearColors;
+    m_clearColors.ClearZ = 0xFFFFFF;
+
+    return STATUS_SUCCESS;
+}
+
+void
+Vc4Emulator::Uninitialize()
+{
+    for (UINT i = 0; i < VC4EMU_MAX_WORKERS; i++)
+    {
+        if (m_pWorkers[i])
+        {
+            ExFreePool(m_pWorkers[i]);
+            m_pWorkers[i] = NULL;
+        }
+    }
+
+    void * pBuffers[] =
+    {
+        m_pBinVertices,
+        m_pBinPrimitives,
+        m_pTileJobs,
+        m_pFirstTileJob,
+        m_pLastTileJob,
+        m_pUsedTiles
+    };
+
+    for (UINT i = 0; i < ARRAYSIZE(pBuffers); i++)
+    {
+        if (pBuffers[i])
+        {
+            ExFreePool(pBuffers[i]);
+        }
+    }
+
+    m_pBinVertices = NULL;
+    m_binVertexCapacity = 0;
+    m_pBinPrimitives = NULL;
+    m_binPrimitiveCapacity = 0;
+    m_pTileJobs = NULL;
+    m_tileJobCapacity = 0;
+    m_pFirstTileJob = NULL;
+    m_pLastTileJob = NULL;
+    m_pUsedTiles = NULL;
+    m_tileCapacity = 0;
+}
+
+void
+Vc4Emulator::SetMemoryRegion(
+    Vc4EmuMemoryRegion  region,
+    UINT                busAddress,
+    UINT                size,
+    BYTE               *pCpuAddress)
+{
+    NT_ASSERT(region < Vc4EmuRegionCount);
+
+    m_regions[region].m_busAddress = busAddress;
+    m_regions[region].m_size = size;
+    m_regions[region].m_pCpuAddress = pCpuAddress;
+}
+
+BYTE *
+Vc4Emulator::Translate(
+    UINT    busAddress,
+    UINT    size,
+    UINT   *pAvailable)
+{
+    for (UINT i = 0; i < Vc4EmuRegionCount; i++)
+    {
+        const MemoryRegion *pRegion = &m_regions[i];
+        UINT                offset = busAddress - pRegion->m_busAddress;
+
+        if ((busAddress >= pRegion->m_busAddress) &&
+            (offset < pRegion->m_size) &&
+            (size <= pRegion->m_size - offset))
+        {
+            if (pAvailable)
+            {
+                *pAvailable = pRegion->m_size - offset;
+            }
+
+            return pRegion->m_pCpuAddress + offset;
+        }
+    }
+
+    return NULL;
+}
+
+BYTE *
+Vc4Emulator::TranslatePacket(
+    UINT    address,
+    UINT   *pSize)
+{
+    BYTE   *pPacket = Translate(address, 1);
+
+    if (!pPacket)
+    {
+        if (Warn(WarningBadAddress))
+        {
+            ROS_LOG_ERROR(
+                "Control list runs into invalid address. (address=0x%x)",
+                address);
+        }
+
+        return NULL;
+    }
+
+    *pSize = GetPacketSize(*pPacket);
+
+    if (0 == *pSize)
+    {
+        if (Warn(WarningBadPacket))
+        {
+            ROS_LOG_ERROR(
+                "Invalid control list packet. (address=0x%x, command=%d)",
+                address,
+                *pPacket);
+        }
+
+        return NULL;
+    }
+
+    pPacket = Translate(address, *pSize);
+
+    if (!pPacket && Warn(WarningBadAddress))
+    {
+        ROS_LOG_ERROR(
+            "Control list packet crosses invalid address. (address=0x%x)",
+            address);
+    }
+
+    return pPacket;
+}
+
+bool
+Vc4Emulator::LoadShaderRecord(
+    const Vc4EmuState  *pState,
+    Vc4EmuShaderRecord *pShaderRecord)
+{
+    if (VC4_CMD_GL_SHADER_STATE == pState->m_shaderStateCommand)
+    {
+        VC4GLShaderState    shaderState = vc4GLShaderState;
+
+        shaderState.UInt1 = pState->m_shaderState;
+
+        if (shaderState.ExtendedShaderRecord)
+        {
+            if (Warn(WarningUnsupportedPacket))
+            {
+                ROS_LOG_ERROR("Extended shader record is not supported");
+            }
+
+            return false;
+        }
+
+        UINT    address = shaderState.UInt1 & ~0xF;
+        UINT    numAttributes = shaderState.NumberOfAttributeArrays ? shaderState.NumberOfAttributeArrays : 8;
+        BYTE   *pRecord = Translate(address, sizeof(VC4GLShaderStateRecord) + numAttributes*sizeof(VC4VertexAttribute));
+
+        if (!pRecord)
+        {
+            if (Warn(WarningBadAddress))
+            {
+                ROS_LOG_ERROR(
+                    "Invalid GL shader record address. (address=0x%x)",
+                    address);
+            }
+
+            return false;
+        }
+
+        pShaderRecord->m_address = address;
+        pShaderRecord->m_bNoVertexShading = false;
+
+        RtlCopyMemory(&pShaderRecord->m_gl, pRecord, sizeof(VC4GLShaderStateRecord));
+        RtlCopyMemory(pShaderRecord->m_attributes, pRecord + sizeof(VC4GLShaderStateRecord), numAttributes*sizeof(VC4VertexAttribute));
+
+        pShaderRecord->m_numAttributes = numAttributes;
+        pShaderRecord->m_numVaryings = pShaderRecord->m_gl.FragmentShaderNumberOfVaryings;
+        pShaderRecord->m_fragmentShaderCode = pShaderRecord->m_gl.FragmentShaderCodeAddress;
+        pShaderRecord->m_fragmentShaderUniforms = pShaderRecord->m_gl.FragmentShaderUniformsAddress;
+    }
+    else if (VC4_CMD_NV_SHADER_STATE == pState->m_shaderStateCommand)
+    {
+        UINT    address = pState->m_shaderState;
+        BYTE   *pRecord = Translate(address, sizeof(VC4NVShaderStateRecord));
+
+        if (!pRecord)
+        {
+            if (Warn(WarningBadAddress))
+            {
+                ROS_LOG_ERROR(
+                    "Invalid NV shader record address. (address=0x%x)",
+                    address);
+            }
+
+            return false;
+        }
+
+        pShaderRecord->m_address = address;
+        pShaderRecord->m_bNoVertexShading = true;
+
+        RtlCopyMemory(&pShaderRecord->m_nv, pRecord, sizeof(VC4NVShaderStateRecord));
+
+        pShaderRecord->m_numAttributes = 0;
+        pShaderRecord->m_numVaryings = pShaderRecord->m_nv.FragmentShaderNumberOfVaryings;
+        pShaderRecord->m_fragmentShaderCode = pShaderRecord->m_nv.FragmentShaderCodeAddress;
+        pShaderRecord->m_fragmentShaderUniforms = pShaderRecord->m_nv.FragmentShaderUniformsAddress;
+    }
+    else
+    {
+        if (Warn(WarningNoShaderState))
+        {
+            ROS_LOG_ERROR("Primitives without shader state");
+        }
+
+        return false;
+    }
+
+    pShaderRecord->m_numVaryings = min(pShaderRecord->m_numVaryings, VC4EMU_MAX_VARYINGS);
+
+    return true;
+}
+
+//
+// Binning
+//
+
+bool
+Vc4Emulator::ExecuteBinningControlList(
+    UINT    startAddress,
+    UINT    endAddress)
+{
+    UINT    returnAddress[2];
+    UINT    depth = 0;
+    UINT    address = startAddress;
+
+    m_warnings = 0;
+    m_bFailed = 0;
+    m_bBinning = false;
+    m_binningConfig = vc4TileBinningModeConfig;
+
+    InitializeState(&m_state);
+    m_stateVersion = 1;
+
+    for (UINT numPackets = 0; address != endAddress; numPackets++)
+    {
+        if (kMaxPackets == numPackets)
+        {
+            ROS_LOG_ERROR(
+                "Binning control list does not end. (startAddress=0x%x)",
+                startAddress);
+            Fail();
+            break;
+        }
+
+        UINT    size;
+        BYTE   *pPacket = TranslatePacket(address, &size);
+
+        if (!pPacket)
+        {
+            Fail();
+            break;
+        }
+
+        UINT    nextAddress = address + size;
+
+        switch (pPacket[0])
+        {
+        case VC4_CMD_HALT:
+            nextAddress = endAddress;
+            break;
+
+        case VC4_CMD_NOP:
+        case VC4_CMD_PRIMITIVE_LIST_FORMAT:
+        case VC4_CMD_POINT_SIZE:
+        case VC4_CMD_LINE_WIDTH:
+        case VC4_CMD_DEPTH_OFFSET:
+        case VC4_CMD_Z_MIN_AND_MAX_CLIPPING_PLANES:
+            break;
+
+        case VC4_CMD_FLUSH:
+        case VC4_CMD_FLUSH_ALL_STATE:
+            CloseTileLists();
+            break;
+
+        case VC4_CMD_TILE_BINNING_MODE_CONFIG:
+            RtlCopyMemory(&m_binningConfig, pPacket, sizeof(m_binningConfig));
+            break;
+
+        case VC4_CMD_START_TILE_BINNING:
+            StartBinning(&m_binningConfig);
+            break;
+
+        case VC4_CMD_INCREMENT_SEMAPHORE:
+            m_semaphore++;
+            break;
+
+        case VC4_CMD_BRANCH:
+            nextAddress = ReadUint(pPacket + 1);
+            break;
+
+        case VC4_CMD_BRANCH_TO_SUB_LIST:
+            if (depth == ARRAYSIZE(returnAddress))
+            {
+                if (Warn(WarningBadPacket))
+                {
+                    ROS_LOG_ERROR(
+                        "Sub-lists nested too deep. (address=0x%x)",
+                        address);
+                }
+                break;
+            }
+
+            returnAddress[depth++] = nextAddress;
+            nextAddress = ReadUint(pPacket + 1);
+            break;
+
+        case VC4_CMD_RETURN_FROM_SUB_LIST:
+            nextAddress = depth ? returnAddress[--depth] : endAddress;
+            break;
+
+        case VC4_CMD_INDEXED_PRIMITIVE_LIST:
+            {
+                VC4IndexedPrimitiveList primitiveList;
+
+                RtlCopyMemory(&primitiveList, pPacket, sizeof(primitiveList));
+
+                UINT    indexSize = primitiveList.IndexType ? sizeof(USHORT) : sizeof(BYTE);
+                BYTE   *pIndices = NULL;
+
+                if (primitiveList.Length <= kMaxDrawVertices)
+                {
+                    pIndices = Translate(primitiveList.AddressOfIndicesList, primitiveList.Length*indexSize);
+                }
+
+                if (!pIndices)
+                {
+                    if (Warn(WarningBadAddress))
+                    {
+                        ROS_LOG_ERROR(
+                            "Invalid index list. (address=0x%x, length=%d)",
+                            primitiveList.AddressOfIndicesList,
+                            primitiveList.Length);
+                    }
+                    break;
+                }
+
+                BinDraw(primitiveList.PrimitiveMode, pIndices, indexSize, primitiveList.Length, 0);
+            }
+            break;
+
+        case VC4_CMD_VERTEX_ARRAY_PRIMITIVES:
+            {
+                VC4VertexArrayPrimitives    vertexArray;
+
+                RtlCopyMemory(&vertexArray, pPacket, sizeof(vertexArray));
+
+                BinDraw(vertexArray.PrimitiveMode, NULL, 0, vertexArray.Length, vertexArray.IndexOfFirstVertex);
+            }
+            break;
+
+        default:
+            if (UpdateState(&m_state, pPacket))
+            {
+                m_stateVersion++;
+            }
+            else if (Warn(WarningUnsupportedPacket))
+            {
+                ROS_LOG_ERROR(
+                    "Unsupported binning control list packet. (address=0x%x, command=%d)",
+                    address,
+                    pPacket[0]);
+            }
+            break;
+        }
+
+        if (m_bFailed)
+        {
+            break;
+        }
+
+        address = nextAddress;
+    }
+
+    if (m_bBinning)
+    {
+        CloseTileLists();
+    }
+
+    if (m_bFailed)
+    {
+        //
+        // The frame is not rendered, so nothing waits on the semaphore
+        //
+
+        m_semaphore = 0;
+
+        return false;
+    }
+
+    return true;
+}
+
+void
+Vc4Emulator::StartBinning(
+    const VC4TileBinningModeConfig *pConfig)
+{
+    UINT    numTiles = pConfig->WidthInTiles*pConfig->HeightInTiles;
+    UINT    initialBlockSize = 32 << pConfig->TileAllocationInitialBlockSize;
+
+    m_bBinning = false;
+
+    m_pTileState = (Vc4EmuTileState *)Translate(pConfig->TileStateDataArrayBaseAddress, numTiles*sizeof(Vc4EmuTileState));
+
+    if ((0 == numTiles) ||
+        (!m_pTileState) ||
+        (pConfig->TileAllocationMemorySize < numTiles*initialBlockSize) ||
+        (!Translate(pConfig->TileAllocationMemoryAddress, pConfig->TileAllocationMemorySize)))
+    {
+        ROS_LOG_ERROR(
+            "Invalid tile binning mode config. (tiles=%dx%d, tileAllocationMemory=0x%x, size=0x%x, tileStateDataArray=0x%x)",
+            pConfig->WidthInTiles,
+            pConfig->HeightInTiles,
+            pConfig->TileAllocationMemoryAddress,
+            pConfig->TileAllocationMemorySize,
+            pConfig->TileStateDataArrayBaseAddress);
+        Fail();
+        return;
+    }
+
+    m_tileAllocationAddress = pConfig->TileAllocationMemoryAddress;
+    m_tileAllocationSize = pConfig->TileAllocationMemorySize;
+    m_tileAllocationUsed = numTiles*initialBlockSize;
+    m_blockSize = 32 << pConfig->TileAllocationBlockSize;
+
+    //
+    // Tile lists start in the initial blocks, laid out in raster order, which
+    // is where GenerateRenderingControlList() branches to
+    //
+
+    for (UINT i = 0; i < numTiles; i++)
+    {
+        Vc4EmuTileState    *pTile = &m_pTileState[i];
+
+        pTile->m_writeAddress = m_tileAllocationAddress + i*initialBlockSize;
+        pTile->m_blockEnd = pTile->m_writeAddress + initialBlockSize - sizeof(VC4Branch);
+        pTile->m_stateVersion = 0;
+        pTile->m_bClosed = false;
+    }
+
+    m_bBinning = true;
+}
+
+UINT
+Vc4Emulator::AllocateTileMemory(
+    UINT    size)
+{
+    size = (size + 15) & ~15;
+
+    UINT    offset = (UINT)InterlockedExchangeAdd(&m_tileAllocationUsed, (LONG)size);
+
+    if ((offset > m_tileAllocationSize) || (size > m_tileAllocationSize - offset))
+    {
+        if (Warn(WarningTileAllocationOverflow))
+        {
+            ROS_LOG_ERROR(
+                "Tile allocation memory overflow, primitives are dropped. (size=0x%x)",
+                m_tileAllocationSize);
+        }
+
+        return 0;
+    }
+
+    return m_tileAllocationAddress + offset;
+}
+
+//
+// Tile lists stay within the tile allocation memory StartBinning() checked,
+// a tile list that cannot be written fails the binning
+//
+
+BYTE *
+Vc4Emulator::TranslateTileList(
+    Vc4EmuTileState    *pTile,
+    UINT                size)
+{
+    BYTE   *pData = Translate(pTile->m_writeAddress, size);
+
+    if (!pData)
+    {
+        if (Warn(WarningBadAddress))
+        {
+            ROS_LOG_ERROR(
+                "Tile list outside of the tile allocation memory. (address=0x%x)",
+                pTile->m_writeAddress);
+        }
+
+        pTile->m_bClosed = true;
+        Fail();
+    }
+
+    return pData;
+}
+
+bool
+Vc4Emulator::WriteTileList(
+    Vc4EmuTileState    *pTile,
+    const void         *pData,
+    UINT                size)
+{
+    if (pTile->m_bClosed)
+    {
+        return false;
+    }
+
+    if (pTile->m_writeAddress + size > pTile->m_blockEnd)
+    {
+        BYTE   *pBranch = TranslateTileList(pTile, sizeof(VC4Branch));
+
+        if (!pBranch)
+        {
+            return false;
+        }
+
+        UINT    block = AllocateTileMemory(m_blockSize);
+
+        if (!block)
+        {
+            //
+            // Terminate the tile list in the space kept for the branch
+            //
+
+            *pBranch = VC4_CMD_RETURN_FROM_SUB_LIST;
+            pTile->m_bClosed = true;
+
+            return false;
+        }
+
+        VC4Branch   branch = vc4Branch;
+
+        branch.BranchAddress = block;
+
+        RtlCopyMemory(pBranch, &branch, sizeof(branch));
+
+        pTile->m_writeAddress = block;
+        pTile->m_blockEnd = block + m_blockSize - sizeof(VC4Branch);
+    }
+
+    BYTE   *pWrite = TranslateTileList(pTile, size);
+
+    if (!pWrite)
+    {
+        return false;
+    }
+
+    RtlCopyMemory(pWrite, pData, size);
+
+    pTile->m_writeAddress += size;
+
+    return true;
+}
+
+void
+Vc4Emulator::WritePrimitive(
+    Vc4EmuTileState    *pTile,
+    const BinPrimitive *pPrimitive)
+{
+    //
+    // State packets are written to a tile list before its first primitive
+    // and again after the state changed
+    //
+
+    if (pTile->m_stateVersion != m_stateVersion)
+    {
+        BYTE    shaderState[sizeof(VC4GLShaderState)];
+
+        shaderState[0] = m_state.m_shaderStateCommand;
+        RtlCopyMemory(shaderState + 1, &m_state.m_shaderState, sizeof(UINT));
+
+        if (!WriteTileList(pTile, shaderState, sizeof(shaderState)) ||
+            !WriteTileList(pTile, &m_state.m_configBits, sizeof(m_state.m_configBits)) ||
+            !WriteTileList(pTile, &m_state.m_flatShadeFlags, sizeof(m_state.m_flatShadeFlags)) ||
+            !WriteTileList(pTile, &m_state.m_clipWindow, sizeof(m_state.m_clipWindow)) ||
+            !WriteTileList(pTile, &m_state.m_viewportOffset, sizeof(m_state.m_viewportOffset)) ||
+            !WriteTileList(pTile, &m_state.m_clipperZScaleAndOffset, sizeof(m_state.m_clipperZScaleAndOffset)))
+        {
+            return;
+        }
+
+        pTile->m_stateVersion = m_stateVersion;
+    }
+
+    BYTE    packet[kClippedPrimitivePacketSize];
+    UINT    size = kPrimitivePacketSize;
+
+    packet[0] = VC4_CMD_COMPRESSED_PRIMITIVE_LIST;
+    RtlCopyMemory(packet + 1, pPrimitive->m_index, sizeof(pPrimitive->m_index));
+
+    if (pPrimitive->m_clippedPolygon)
+    {
+        packet[0] = VC4_CMD_CLIPPED_PRIMITVE_WITH_COMPRESSED_PRIMITIVE_LIST;
+        RtlCopyMemory(packet + kPrimitivePacketSize, &pPrimitive->m_clippedPolygon, sizeof(UINT));
+
+        size = kClippedPrimitivePacketSize;
+    }
+
+    WriteTileList(pTile, packet, size);
+}
+
+void
+Vc4Emulator::CloseTileLists()
+{
+    if (!m_bBinning)
+    {
+        return;
+    }
+
+    UINT    numTiles = m_binningConfig.WidthInTiles*m_binningConfig.HeightInTiles;
+
+    for (UINT i = 0; i < numTiles; i++)
+    {
+        Vc4EmuTileState    *pTile = &m_pTileState[i];
+
+        if (!pTile->m_bClosed)
+        {
+            BYTE   *pReturn = TranslateTileList(pTile, 1);
+
+            if (pReturn)
+            {
+                *pReturn = VC4_CMD_RETURN_FROM_SUB_LIST;
+                pTile->m_bClosed = true;
+            }
+        }
+    }
+
+    m_bBinning = false;
+}
+
+UINT
+Vc4Emulator::GetVertexIndex(
+    UINT    vertex)
+{
+    if (!m_draw.m_pIndices)
+    {
+        return m_draw.m_firstVertex + vertex;
+    }
+
+    if (sizeof(USHORT) == m_draw.m_indexSize)
+    {
+        USHORT  index;
+
+        RtlCopyMemory(&index, m_draw.m_pIndices + vertex*sizeof(USHORT), sizeof(index));
+
+        return index;
+    }
+
+    return m_draw.m_pIndices[vertex];
+}
+
+void
+Vc4Emulator::BinDraw(
+    UINT        mode,
+    const BYTE *pIndices,
+    UINT        indexSize,
+    UINT        length,
+    UINT        firstVertex)
+{
+    if (!m_bBinning)
+    {
+        if (Warn(WarningBadPacket))
+        {
+            ROS_LOG_ERROR("Primitives outside of tile binning");
+        }
+
+        return;
+    }
+
+    UINT    numPrimitives;
+
+    switch (mode)
+    {
+    case VC4_TRIANGLES:
+        numPrimitives = length / 3;
+        break;
+    case VC4_TRIANGLE_STRIP:
+    case VC4_TRIANGLE_FAN:
+        numPrimitives = (length >= 3) ? (length - 2) : 0;
+        break;
+    default:
+        if (Warn(WarningUnsupportedPrimitive))
+        {
+            ROS_LOG_ERROR(
+                "Unsupported primitive mode. (mode=%d)",
+                mode);
+        }
+        return;
+    }
+
+    if ((0 == numPrimitives) || (length > kMaxDrawVertices))
+    {
+        return;
+    }
+
+    Draw   *pDraw = &m_draw;
+
+    if (!LoadShaderRecord(&m_state, &pDraw->m_shaderRecord))
+    {
+        return;
+    }
+
+    pDraw->m_mode = mode;
+    pDraw->m_pIndices = pIndices;
+    pDraw->m_indexSize = indexSize;
+    pDraw->m_firstVertex = firstVertex;
+    pDraw->m_numPrimitives = numPrimitives;
+
+    //
+    // Vertices in the index range are shaded once, in batches of 16
+    //
+
+    UINT    minIndex = firstVertex;
+    UINT    maxIndex = firstVertex + length - 1;
+
+    if (pIndices)
+    {
+        minIndex = MAXUINT;
+        maxIndex = 0;
+
+        for (UINT i = 0; i < length; i++)
+        {
+            UINT    index = GetVertexIndex(i);
+
+            minIndex = min(minIndex, index);
+            maxIndex = max(maxIndex, index);
+        }
+    }
+
+    pDraw->m_minIndex = minIndex;
+    pDraw->m_numVertices = maxIndex - minIndex + 1;
+
+    if ((pDraw->m_numVertices > kMaxDrawVertices) ||
+        !Reserve(&m_pBinVertices, &m_binVertexCapacity, pDraw->m_numVertices) ||
+        !Reserve(&m_pBinPrimitives, &m_binPrimitiveCapacity, numPrimitives))
+    {
+        return;
+    }
+
+    m_pWorkerPool->Run(ShadeBinVerticesJob, this, (pDraw->m_numVertices + VC4EMU_QPU_LANES - 1) / VC4EMU_QPU_LANES);
+    m_pWorkerPool->Run(SetupBinPrimitivesJob, this, (numPrimitives + kPrimitivesPerItem - 1) / kPrimitivesPerItem);
+
+    //
+    // Each tile row is binned by one worker, in primitive order
+    //
+
+    m_pWorkerPool->Run(BinTileRowJob, this, m_binningConfig.HeightInTiles);
+}
+
+void
+Vc4Emulator::ShadeBinVertices(
+    UINT            batch,
+    WorkerScratch  *pWorker)
+{
+    const Vc4EmuShaderRecord   *pShaderRecord = &m_draw.m_shaderRecord;
+    UINT                        first = batch*VC4EMU_QPU_LANES;
+    UINT                        numVertices = min(VC4EMU_QPU_LANES, m_draw.m_numVertices - first);
+    BinVertex                  *pVertex = m_pBinVertices + first;
+    UINT                        index[VC4EMU_QPU_LANES];
+
+    for (UINT i = 0; i < numVertices; i++)
+    {
+        index[i] = m_draw.m_minIndex + first + i;
+    }
+
+    if (pShaderRecord->m_bNoVertexShading)
+    {
+        const VC4NVShaderStateRecord   *pRecord = &pShaderRecord->m_nv;
+        UINT                            headerSize = pRecord->ClipCoordinatesHeaderIncluded ? 4*sizeof(float) : 0;
+
+        for (UINT i = 0; i < numVertices; i++)
+        {
+            BYTE   *pData = Translate(
+                                pRecord->ShadedVertexDataAddress + index[i]*pRecord->ShadedVertexDataStride,
+                                headerSize + 3*sizeof(UINT));
+
+            RtlZeroMemory(&pVertex[i], sizeof(BinVertex));
+
+            if (!pData)
+            {
+                if (Warn(WarningBadAddress))
+                {
+                    ROS_LOG_ERROR(
+                        "Invalid shaded vertex data address. (address=0x%x)",
+                        pRecord->ShadedVertexDataAddress);
+                }
+                continue;
+            }
+
+            //
+            // Without the clip coordinates header the vertices are not clipped
+            //
+
+            if (headerSize)
+            {
+                RtlCopyMemory(pVertex[i].m_clip, pData, headerSize);
+            }
+            else
+            {
+                pVertex[i].m_clip[3] = 1.0f;
+            }
+
+            UINT    xy = ReadUint(pData + headerSize);
+
+            pVertex[i].m_xs = (SHORT)(xy & 0xFFFF);
+            pVertex[i].m_ys = (SHORT)(xy >> 16);
+            pVertex[i].m_zs = Vc4EmuAsFloat(ReadUint(pData + headerSize + sizeof(UINT)));
+            pVertex[i].m_invW = Vc4EmuAsFloat(ReadUint(pData + headerSize + 2*sizeof(UINT)));
+        }
+
+        return;
+    }
+
+    //
+    // The coordinate shader writes Xc, Yc, Zc, Wc, Xs/Ys, Zs and 1/Wc
+    //
+
+    Vc4EmuQpu  *pQpu = &pWorker->m_qpu;
+
+    pQpu->Reset(true);
+
+    LoadAttributes(pQpu, pShaderRecord, true, index, numVertices);
+
+    if (!RunQpu(pQpu, pShaderRecord->m_gl.CoordinateShaderCodeAddress, pShaderRecord->m_gl.CoordinateShaderUniformsAddress))
+    {
+        RtlZeroMemory(pVertex, numVertices*sizeof(BinVertex));
+        return;
+    }
+
+    for (UINT i = 0; i < numVertices; i++)
+    {
+        for (UINT j = 0; j < 4; j++)
+        {
+            pVertex[i].m_clip[j] = Vc4EmuAsFloat(pQpu->m_vpmOut[j][i]);
+        }
+
+        UINT    xy = pQpu->m_vpmOut[4][i];
+
+        pVertex[i].m_xs = (SHORT)(xy & 0xFFFF);
+        pVertex[i].m_ys = (SHORT)(xy >> 16);
+        pVertex[i].m_zs = Vc4EmuAsFloat(pQpu->m_vpmOut[5][i]);
+        pVertex[i].m_invW = Vc4EmuAsFloat(pQpu->m_vpmOut[6][i]);
+    }
+}
+
+void
+Vc4Emulator::SetupBinPrimitives(
+    UINT    chunk)
+{
+    UINT    first = chunk*kPrimitivesPerItem;
+    UINT    last = min(first + kPrimitivesPerItem, m_draw.m_numPrimitives);
+
+    for (UINT i = first; i < last; i++)
+    {
+        BinPrimitive   *pPrimitive = &m_pBinPrimitives[i];
+        UINT            vertex[3];
+
+        switch (m_draw.m_mode)
+        {
+        case VC4_TRIANGLES:
+            vertex[0] = 3*i;
+            vertex[1] = 3*i + 1;
+            vertex[2] = 3*i + 2;
+            break;
+        case VC4_TRIANGLE_STRIP:
+            //
+            // Odd triangles swap the first 2 vertices to keep the winding
+            //
+            vertex[0] = (i & 1) ? (i + 1) : i;
+            vertex[1] = (i & 1) ? i : (i + 1);
+            vertex[2] = i + 2;
+            break;
+        default:
+            vertex[0] = 0;
+            vertex[1] = i + 1;
+            vertex[2] = i + 2;
+            break;
+        }
+
+        for (UINT j = 0; j < 3; j++)
+        {
+            pPrimitive->m_index[j] = GetVertexIndex(vertex[j]);
+        }
+
+        if (!SetupBinPrimitive(pPrimitive))
+        {
+            pPrimitive->m_numVertices = 0;
+        }
+    }
+}
+
+struct Vc4EmuClipVertex
+{
+    float   m_clip[4];
+    float   m_weight[3];
+};
+
+static float GetClipDistance(const float * pClip, UINT plane, float guardX, float guardY)
+{
+    switch (plane)
+    {
+    case 0:
+        return pClip[3] - kMinW;
+    case 1:
+        return guardX*pClip[3] - pClip[0];
+    case 2:
+        return guardX*pClip[3] + pClip[0];
+    case 3:
+        return guardY*pClip[3] - pClip[1];
+    default:
+        return guardY*pClip[3] + pClip[1];
+    }
+}
+
+bool
+Vc4Emulator::SetupBinPrimitive(
+    BinPrimitive   *pPrimitive)
+{
+    const Vc4EmuState  *pState = &m_state;
+    const BinVertex    *pVertex[3];
+
+    for (UINT i = 0; i < 3; i++)
+    {
+        pVertex[i] = &m_pBinVertices[pPrimitive->m_index[i] - m_draw.m_minIndex];
+    }
+
+    //
+    // Guard band planes are only used with the clipper XY scaling set
+    //
+
+    float   scaleX = pState->m_clipperXYScaling.ViewportHalfWidth;
+    float   scaleY = pState->m_clipperXYScaling.ViewportHalfHeight;
+    bool    bGuardBand = (scaleX != 0.0f) && (scaleY != 0.0f);
+    float   guardX = bGuardBand ? kGuardBand / fabs(scaleX) : 0.0f;
+    float   guardY = bGuardBand ? kGuardBand / fabs(scaleY) : 0.0f;
+    UINT    numPlanes = bGuardBand ? 5 : 1;
+    UINT    outsideAll = MAXUINT;
+    UINT    outsideAny = 0;
+
+    for (UINT i = 0; i < 3; i++)
+    {
+        UINT    outside = 0;
+
+        for (UINT plane = 0; plane < numPlanes; plane++)
+        {
+            if (GetClipDistance(pVertex[i]->m_clip, plane, guardX, guardY) < 0.0f)
+            {
+                outside |= 1 << plane;
+            }
+        }
+
+        outsideAll &= outside;
+        outsideAny |= outside;
+    }
+
+    if (outsideAll)
+    {
+        return false;
+    }
+
+    Vc4EmuClippedPolygon    polygon;
+
+    if (!outsideAny)
+    {
+        polygon.m_numVertices = 3;
+
+        for (UINT i = 0; i < 3; i++)
+        {
+            polygon.m_vertex[i].m_xs = pVertex[i]->m_xs;
+            polygon.m_vertex[i].m_ys = pVertex[i]->m_ys;
+        }
+    }
+    else
+    {
+        //
+        // Sutherland-Hodgman in clip space, every plane adds at most 1 vertex
+        //
+
+        Vc4EmuClipVertex    buffer[2][VC4EMU_MAX_CLIPPED_VERTICES];
+        Vc4EmuClipVertex   *pIn = buffer[0];
+        Vc4EmuClipVertex   *pOut = buffer[1];
+        UINT                numIn = 3;
+
+        for (UINT i = 0; i < 3; i++)
+        {
+            RtlCopyMemory(pIn[i].m_clip, pVertex[i]->m_clip, sizeof(pIn[i].m_clip));
+
+            for (UINT j = 0; j < 3; j++)
+            {
+                pIn[i].m_weight[j] = (i == j) ? 1.0f : 0.0f;
+            }
+        }
+
+        for (UINT plane = 0; (plane < numPlanes) && (numIn >= 3); plane++)
+        {
+            if (0 == (outsideAny & (1 << plane)))
+            {
+                continue;
+            }
+
+            UINT    numOut = 0;
+
+            for (UINT i = 0; i < numIn; i++)
+            {
+                const Vc4EmuClipVertex *pA = &pIn[i];
+                const Vc4EmuClipVertex *pB = &pIn[(i + 1) % numIn];
+                float                   distanceA = GetClipDistance(pA->m_clip, plane, guardX, guardY);
+                float                   distanceB = GetClipDistance(pB->m_clip, plane, guardX, guardY);
+
+                if (distanceA >= 0.0f)
+                {
+                    pOut[numOut++] = *pA;
+                }
+
+                if ((distanceA >= 0.0f) != (distanceB >= 0.0f))
+                {
+                    Vc4EmuClipVertex   *pNew = &pOut[numOut++];
+                    float               t = distanceA / (distanceA - distanceB);
+
+                    for (UINT j = 0; j < 4; j++)
+                    {
+                        pNew->m_clip[j] = pA->m_clip[j] + t*(pB->m_clip[j] - pA->m_clip[j]);
+                    }
+
+                    for (UINT j = 0; j < 3; j++)
+                    {
+                        pNew->m_weight[j] = pA->m_weight[j] + t*(pB->m_weight[j] - pA->m_weight[j]);
+                    }
+                }
+            }
+
+            Vc4EmuClipVertex   *pTemp = pIn;
+
+            pIn = pOut;
+            pOut = pTemp;
+            numIn = numOut;
+        }
+
+        if (numIn < 3)
+        {
+            return false;
+        }
+
+        polygon.m_numVertices = numIn;
+
+        for (UINT i = 0; i < numIn; i++)
+        {
+            Vc4EmuClippedVertex    *pClipped = &polygon.m_vertex[i];
+            float                   invW = 1.0f / pIn[i].m_clip[3];
+
+            pClipped->m_xs = pIn[i].m_clip[0]*invW*scaleX;
+            pClipped->m_ys = pIn[i].m_clip[1]*invW*scaleY;
+            pClipped->m_zs = pIn[i].m_clip[2]*invW*pState->m_clipperZScaleAndOffset.ViewportZScale +
+                             pState->m_clipperZScaleAndOffset.ViewportZOffset;
+            pClipped->m_invW = invW;
+
+            RtlCopyMemory(pClipped->m_weight, pIn[i].m_weight, sizeof(pClipped->m_weight));
+        }
+    }
+
+    //
+    // Culling, with Y down a positive area is clockwise
+    //
+
+    float   area = 0.0f;
+
+    for (UINT i = 0; i < polygon.m_numVertices; i++)
+    {
+        const Vc4EmuClippedVertex  *pA = &polygon.m_vertex[i];
+        const Vc4EmuClippedVertex  *pB = &polygon.m_vertex[(i + 1) % polygon.m_numVertices];
+
+        area += pA->m_xs*pB->m_ys - pB->m_xs*pA->m_ys;
+    }
+
+    if (0.0f == area)
+    {
+        return false;
+    }
+
+    const VC4ConfigBits    *pConfigBits = &pState->m_configBits;
+    bool                    bForward = (area > 0.0f) != (pConfigBits->ClockwisePrimitives != 0);
+
+    if (bForward ? !pConfigBits->EnableForwardFacingPrimitive : !pConfigBits->EnableReverseFacingPrimitive)
+    {
+        return false;
+    }
+
+    //
+    // Bounding box in pixels, limited to the clip window and the tiles
+    //
+
+    float   minX = MAXLONG;
+    float   minY = MAXLONG;
+    float   maxX = -MAXLONG;
+    float   maxY = -MAXLONG;
+
+    pPrimitive->m_numVertices = polygon.m_numVertices;
+
+    for (UINT i = 0; i < polygon.m_numVertices; i++)
+    {
+        //
+        // Kept clockwise for the tile overlap test
+        //
+
+        UINT    j = (area > 0.0f) ? i : (polygon.m_numVertices - 1 - i);
+        float   x = (polygon.m_vertex[j].m_xs + pState->m_viewportOffset.ViewportCenterX) / 16.0f;
+        float   y = (polygon.m_vertex[j].m_ys + pState->m_viewportOffset.ViewportCenterY) / 16.0f;
+
+        pPrimitive->m_x[i] = x;
+        pPrimitive->m_y[i] = y;
+
+        minX = min(minX, x);
+        minY = min(minY, y);
+        maxX = max(maxX, x);
+        maxY = max(maxY, y);
+    }
+
+    const VC4ClipWindow    *pClipWindow = &pState->m_clipWindow;
+
+    minX = max(minX, (float)pClipWindow->ClipWindowLeft);
+    minY = max(minY, (float)pClipWindow->ClipWindowBottom);
+    maxX = min(maxX, (float)(pClipWindow->ClipWindowLeft + pClipWindow->ClipWindowWidth) - 1.0f);
+    maxY = min(maxY, (float)(pClipWindow->ClipWindowBottom + pClipWindow->ClipWindowHeight) - 1.0f);
+
+    if ((minX > maxX) || (minY > maxY))
+    {
+        return false;
+    }
+
+    pPrimitive->m_tileMinX = max(0, (int)(minX / kTilePixels));
+    pPrimitive->m_tileMinY = max(0, (int)(minY / kTilePixels));
+    pPrimitive->m_tileMaxX = min((int)m_binningConfig.WidthInTiles - 1, (int)(maxX / kTilePixels));
+    pPrimitive->m_tileMaxY = min((int)m_binningConfig.HeightInTiles - 1, (int)(maxY / kTilePixels));
+
+    if ((pPrimitive->m_tileMinX > pPrimitive->m_tileMaxX) ||
+        (pPrimitive->m_tileMinY > pPrimitive->m_tileMaxY))
+    {
+        return false;
+    }
+
+    pPrimitive->m_clippedPolygon = 0;
+
+    if (outsideAny)
+    {
+        pPrimitive->m_clippedPolygon = AllocateTileMemory(sizeof(polygon));
+
+        if (!pPrimitive->m_clippedPolygon)
+        {
+            return false;
+        }
+
+        BYTE   *pPolygon = Translate(pPrimitive->m_clippedPolygon, sizeof(polygon));
+
+        if (!pPolygon)
+        {
+            if (Warn(WarningBadAddress))
+            {
+                ROS_LOG_ERROR(
+                    "Clipped polygon outside of the tile allocation memory. (address=0x%x)",
+                    pPrimitive->m_clippedPolygon);
+            }
+
+            Fail();
+            return false;
+        }
+
+        RtlCopyMemory(pPolygon, &polygon, sizeof(polygon));
+    }
+
+    return true;
+}
+
+static bool PolygonOverlapsTile(const float * pX, const float * pY, UINT numVertices, float left, float top, float right, float bottom)
+{
+    //
+    // The polygon is clockwise (Y down), so the tile is outside when its
+    // corner furthest inside an edge is still outside of the edge
+    //
+
+    for (UINT i = 0; i < numVertices; i++)
+    {
+        UINT    j = (i + 1) % numVertices;
+        float   dx = pX[j] - pX[i];
+        float   dy = pY[j] - pY[i];
+        float   x = (dy > 0.0f) ? left : right;
+        float   y = (dx > 0.0f) ? bottom : top;
+
+        if (dx*(y - pY[i]) - dy*(x - pX[i]) < 0.0f)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void
+Vc4Emulator::BinTileRow(
+    UINT    row)
+{
+    float   top = (float)(row*kTilePixels);
+    float   bottom = top + kTilePixels;
+
+    for (UINT i = 0; i < m_draw.m_numPrimitives; i++)
+    {
+        const BinPrimitive *pPrimitive = &m_pBinPrimitives[i];
+
+        if ((0 == pPrimitive->m_numVertices) ||
+            ((int)row < pPrimitive->m_tileMinY) ||
+            ((int)row > pPrimitive->m_tileMaxY))
+        {
+            continue;
+        }
+
+        for (int x = pPrimitive->m_tileMinX; x <= pPrimitive->m_tileMaxX; x++)
+        {
+            float   left = (float)(x*kTilePixels);
+
+            if (PolygonOverlapsTile(pPrimitive->m_x, pPrimitive->m_y, pPrimitive->m_numVertices, left, top, left + kTilePixels, bottom))
+            {
+                WritePrimitive(&m_pTileState[row*m_binningConfig.WidthInTiles + x], pPrimitive);
+            }
+        }
+    }
+}
+
+void
+Vc4Emulator::ShadeBinVerticesJob(
+    void   *pContext,
+    UINT    item,
+    UINT    worker)
+{
+    Vc4Emulator    *pEmulator = (Vc4Emulator *)pContext;
+
+    NT_ASSERT(worker < pEmulator->m_numWorkers);
+
+    pEmulator->ShadeBinVertices(item, pEmulator->m_pWorkers[worker]);
+}
+
+void
+Vc4Emulator::SetupBinPrimitivesJob(
+    void   *pContext,
+    UINT    item,
+    UINT    worker)
+{
+    UNREFERENCED_PARAMETER(worker);
+
+    ((Vc4Emulator *)pContext)->SetupBinPrimitives(item);
+}
+
+void
+Vc4Emulator::BinTileRowJob(
+    void   *pContext,
+    UINT    item,
+    UINT    worker)
+{
+    UNREFERENCED_PARAMETER(worker);
+
+    ((Vc4Emulator *)pContext)->BinTileRow(item);
+}
+
+//
+// Rendering
+//
+
+bool
+Vc4Emulator::ExecuteRenderingControlList(
+    UINT    startAddress,
+    UINT    endAddress)
+{
+    VC4TileRenderingModeConfig  modeConfig = vc4TileRenderingModeConfig;
+    VC4ClearColors             &clearColors = m_clearColors;
+    UINT                        heightInTiles = 0;
+    UINT                        loadAddress = 0;
+    UINT                        numJobs = 0;
+    UINT                        address = startAddress;
+
+    m_bFailed = 0;
+    m_renderingEndAddress = endAddress;
+    m_renderingWidthInTiles = 0;
+    m_numUsedTiles = 0;
+    m_generation++;
+
+    //
+    // Splits the control list into jobs per tile, each from its tile
+    // coordinates (or a load before them) to the next tile's. The jobs of a
+    // tile run in order on one worker, the tiles run in parallel.
+    //
+
+    for (UINT numPackets = 0; address != endAddress; numPackets++)
+    {
+        if (kMaxPackets == numPackets)
+        {
+            ROS_LOG_ERROR(
+                "Rendering control list does not end. (startAddress=0x%x)",
+                startAddress);
+            Fail();
+            break;
+        }
+
+        UINT    size;
+        BYTE   *pPacket = TranslatePacket(address, &size);
+
+        if (!pPacket)
+        {
+            Fail();
+            break;
+        }
+
+        UINT    nextAddress = address + size;
+
+        switch (pPacket[0])
+        {
+        case VC4_CMD_HALT:
+            nextAddress = endAddress;
+            break;
+
+        case VC4_CMD_BRANCH:
+            nextAddress = ReadUint(pPacket + 1);
+            break;
+
+        case VC4_CMD_WAIT_ON_SEMAPHORE:
+            if (0 == m_semaphore)
+            {
+                ROS_LOG_ERROR("Rendering waits on semaphore not incremented by binning");
+            }
+            else
+            {
+                m_semaphore--;
+            }
+            break;
+
+        case VC4_CMD_CLEAR_COLOR:
+            RtlCopyMemory(&clearColors, pPacket, sizeof(clearColors));
+            break;
+
+        case VC4_CMD_TILE_RENDERING_MODE_CONFIG:
+            {
+                if (m_numUsedTiles)
+                {
+                    m_pWorkerPool->Run(RenderTileJob, this, m_numUsedTiles);
+
+                    numJobs = 0;
+                    m_numUsedTiles = 0;
+                }
+
+                RtlCopyMemory(&modeConfig, pPacket, sizeof(modeConfig));
+
+                m_renderingWidthInTiles = (modeConfig.WidthInPixels + kTilePixels - 1) / kTilePixels;
+                heightInTiles = (modeConfig.HeightInPixels + kTilePixels - 1) / kTilePixels;
+
+                //
+                // The tile arrays grow together, m_tileCapacity is only
+                // updated by the last one
+                //
+
+                UINT    numTiles = m_renderingWidthInTiles*heightInTiles;
+                UINT    firstTileJobCapacity = m_tileCapacity;
+                UINT    lastTileJobCapacity = m_tileCapacity;
+
+                if (!Reserve(&m_pFirstTileJob, &firstTileJobCapacity, numTiles) ||
+                    !Reserve(&m_pLastTileJob, &lastTileJobCapacity, numTiles) ||
+                    !Reserve(&m_pUsedTiles, &m_tileCapacity, numTiles))
+                {
+                    m_renderingWidthInTiles = 0;
+                    heightInTiles = 0;
+                    break;
+                }
+
+                for (UINT i = 0; i < numTiles; i++)
+                {
+                    m_pFirstTileJob[i] = kNoTileJob;
+                }
+            }
+            break;
+
+        case VC4_CMD_LOAD_TILE_BUF_GENERAL:
+        case VC4_CMD_LOAD_FULL_RESOLUTION_TILE_BUFFER:
+            if (!loadAddress)
+            {
+                loadAddress = address;
+            }
+            break;
+
+        case VC4_CMD_TILE_COORDINATES:
+            {
+                UINT    tileX = pPacket[1];
+                UINT    tileY = pPacket[2];
+
+                if ((tileX >= m_renderingWidthInTiles) || (tileY >= heightInTiles))
+                {
+                    if (Warn(WarningTileOutOfFrame))
+                    {
+                        ROS_LOG_ERROR(
+                            "Tile coordinates out of frame. (x=%d, y=%d)",
+                            tileX,
+                            tileY);
+                    }
+
+                    loadAddress = 0;
+                    break;
+                }
+
+                if (!Reserve(&m_pTileJobs, &m_tileJobCapacity, numJobs + 1))
+                {
+                    break;
+                }
+
+                UINT        tile = tileY*m_renderingWidthInTiles + tileX;
+                TileJob    *pJob = &m_pTileJobs[numJobs];
+
+                pJob->m_startAddress = loadAddress ? loadAddress : address;
+                pJob->m_nextJob = kNoTileJob;
+                pJob->m_modeConfig = modeConfig;
+                pJob->m_clearColors = clearColors;
+
+                if (kNoTileJob == m_pFirstTileJob[tile])
+                {
+                    m_pFirstTileJob[tile] = numJobs;
+                    m_pUsedTiles[m_numUsedTiles++] = tile;
+                }
+                else
+                {
+                    m_pTileJobs[m_pLastTileJob[tile]].m_nextJob = numJobs;
+                }
+
+                m_pLastTileJob[tile] = numJobs++;
+                loadAddress = 0;
+            }
+            break;
+
+        default:
+            //
+            // Runs with the tile jobs
+            //
+            break;
+        }
+
+        address = nextAddress;
+    }
+
+    if (m_numUsedTiles)
+    {
+        m_pWorkerPool->Run(RenderTileJob, this, m_numUsedTiles);
+    }
+
+    return !m_bFailed;
+}
+
+void
+Vc4Emulator::RenderTileJob(
+    void   *pContext,
+    UINT    item,
+    UINT    worker)
+{
+    Vc4Emulator    *pEmulator = (Vc4Emulator *)pContext;
+
+    NT_ASSERT(worker < pEmulator->m_numWorkers);
+
+    pEmulator->RenderTile(item, pEmulator->m_pWorkers[worker]);
+}
+
+void
+Vc4Emulator::RenderTile(
+    UINT            item,
+    WorkerScratch  *pWorker)
+{
+    UINT        tile = m_pUsedTiles[item];
+    TileContext context;
+
+    RtlZeroMemory(&context, sizeof(context));
+
+    context.m_pWorker = pWorker;
+    context.m_tileX = tile % m_renderingWidthInTiles;
+    context.m_tileY = tile / m_renderingWidthInTiles;
+    context.m_clearColors = m_pTileJobs[m_pFirstTileJob[tile]].m_clearColors;
+
+    ClearTileBuffer(&context, true, true);
+
+    for (UINT job = m_pFirstTileJob[tile]; job != kNoTileJob; job = m_pTileJobs[job].m_nextJob)
+    {
+        RunTileJob(&context, &m_pTileJobs[job]);
+    }
+}
+
+void
+Vc4Emulator::RunTileJob(
+    TileContext    *pContext,
+    const TileJob  *pJob)
+{
+    UINT    returnAddress[2];
+    UINT    depth = 0;
+    UINT    address = pJob->m_startAddress;
+    bool    bTileStarted = false;
+
+    pContext->m_modeConfig = pJob->m_modeConfig;
+    pContext->m_clearColors = pJob->m_clearColors;
+    pContext->m_bLoadPending = false;
+    pContext->m_bShaderRecordValid = false;
+
+    InitializeState(&pContext->m_state);
+
+    for (UINT numPackets = 0; ; numPackets++)
+    {
+        if ((0 == depth) && (address == m_renderingEndAddress))
+        {
+            break;
+        }
+
+        if (kMaxPackets == numPackets)
+        {
+            ROS_LOG_ERROR(
+                "Tile list does not end. (tileX=%d, tileY=%d)",
+                pContext->m_tileX,
+                pContext->m_tileY);
+            Fail();
+            break;
+        }
+
+        UINT    size;
+        BYTE   *pPacket = TranslatePacket(address, &size);
+
+        if (!pPacket)
+        {
+            Fail();
+            break;
+        }
+
+        UINT    nextAddress = address + size;
+        bool    bDone = false;
+
+        switch (pPacket[0])
+        {
+        case VC4_CMD_HALT:
+            bDone = true;
+            break;
+
+        case VC4_CMD_BRANCH:
+            nextAddress = ReadUint(pPacket + 1);
+            break;
+
+        case VC4_CMD_BRANCH_TO_SUB_LIST:
+            if (depth == ARRAYSIZE(returnAddress))
+            {
+                if (Warn(WarningBadPacket))
+                {
+                    ROS_LOG_ERROR(
+                        "Sub-lists nested too deep. (address=0x%x)",
+                        address);
+                }
+                break;
+            }
+
+            returnAddress[depth++] = nextAddress;
+            nextAddress = ReadUint(pPacket + 1);
+            break;
+
+        case VC4_CMD_RETURN_FROM_SUB_LIST:
+            if (0 == depth)
+            {
+                bDone = true;
+                break;
+            }
+
+            nextAddress = returnAddress[--depth];
+            break;
+
+        case VC4_CMD_WAIT_ON_SEMAPHORE:
+        case VC4_CMD_TILE_RENDERING_MODE_CONFIG:
+        case VC4_CMD_CLEAR_COLOR:
+            //
+            // Top level packets of the next job
+            //
+            bDone = bTileStarted && (0 == depth);
+            break;
+
+        case VC4_CMD_LOAD_TILE_BUF_GENERAL:
+            if (bTileStarted && (0 == depth))
+            {
+                bDone = true;
+                break;
+            }
+
+            RtlCopyMemory(&pContext->m_pendingLoad, pPacket, sizeof(pContext->m_pendingLoad));
+            pContext->m_bLoadPending = true;
+            break;
+
+        case VC4_CMD_LOAD_FULL_RESOLUTION_TILE_BUFFER:
+        case VC4_CMD_STORE_FULL_RESOLUTION_TILE_BUFFER:
+            if (bTileStarted && (0 == depth) && (VC4_CMD_LOAD_FULL_RESOLUTION_TILE_BUFFER == pPacket[0]))
+            {
+                bDone = true;
+                break;
+            }
+
+            if (Warn(WarningUnsupportedPacket))
+            {
+                ROS_LOG_ERROR("Full resolution tile buffer load/store is not supported");
+            }
+            break;
+
+        case VC4_CMD_TILE_COORDINATES:
+            if (bTileStarted && (0 == depth))
+            {
+                bDone = true;
+                break;
+            }
+
+            bTileStarted = true;
+
+            if (pContext->m_bLoadPending)
+            {
+                const VC4LoadTileBufferGeneral *pLoad = &pContext->m_pendingLoad;
+
+                CopyTileBuffer(
+                    pContext,
+                    false,
+                    pLoad->BufferToLoad,
+                    pLoad->Fortmat,
+                    VC4_TILE_BUFFER_PIXEL_FORMAT_RGBA8888 != pLoad->PixelColorFormat,
+                    pLoad->MemoryBaseAddress << 4);
+
+                pContext->m_bLoadPending = false;
+            }
+            break;
+
+        case VC4_CMD_STORE_MS_RESOLVED_TILE_COLOR_BUF:
+        case VC4_CMD_STORE_MS_RESOLVED_TILE_COLOR_BUF_AND_SIGNAL_END_OF_FRAME:
+            CopyTileBuffer(
+                pContext,
+                true,
+                VC4_TILE_BUFFER_COLOR,
+                pContext->m_modeConfig.MemoryFormat,
+                (USHORT)VC4_NON_HDR_FRAME_BUFFER_COLOR_FORMAT::RGBA8888 != pContext->m_modeConfig.NonHDRFrameBufferColorFormat,
+                pContext->m_modeConfig.MemoryAddress);
+            break;
+
+        case VC4_CMD_STORE_TILE_BUF_GENERAL:
+            {
+                VC4StoreTileBufferGeneral   store;
+
+                RtlCopyMemory(&store, pPacket, sizeof(store));
+
+                CopyTileBuffer(
+                    pContext,
+                    true,
+                    store.BufferToStore,
+                    store.Fortmat,
+                    VC4_TILE_BUFFER_PIXEL_FORMAT_RGBA8888 != store.PixelColorFormat,
+                    store.MemoryBaseAddress << 4);
+
+                ClearTileBuffer(pContext, !store.DisableColorBufferClear, !store.DisableZStencilClear);
+            }
+            break;
+
+        case VC4_CMD_COMPRESSED_PRIMITIVE_LIST:
+        case VC4_CMD_CLIPPED_PRIMITVE_WITH_COMPRESSED_PRIMITIVE_LIST:
+            {
+                UINT    index[3];
+                UINT    clippedPolygon = 0;
+
+                RtlCopyMemory(index, pPacket + 1, sizeof(index));
+
+                if (VC4_CMD_CLIPPED_PRIMITVE_WITH_COMPRESSED_PRIMITIVE_LIST == pPacket[0])
+                {
+                    clippedPolygon = ReadUint(pPacket + kPrimitivePacketSize);
+                }
+
+                RenderPrimitive(pContext, index, clippedPolygon);
+            }
+            break;
+
+        default:
+            if (UpdateState(&pContext->m_state, pPacket))
+            {
+                if ((VC4_CMD_GL_SHADER_STATE == pPacket[0]) || (VC4_CMD_NV_SHADER_STATE == pPacket[0]))
+                {
+                    pContext->m_bShaderRecordValid = false;
+                }
+            }
+            break;
+        }
+
+        if (bDone)
+        {
+            break;
+        }
+
+        address = nextAddress;
+    }
+}
+
+void
+Vc4Emulator::ClearTileBuffer(
+    TileContext    *pContext,
+    bool            bColor,
+    bool            bDepth)
+{
+    WorkerScratch  *pWorker = pContext->m_pWorker;
+    UINT            depth = (pContext->m_clearColors.ClearZ << 8) | pContext->m_clearColors.ClearStencil;
+
+    for (UINT i = 0; i < kTilePixels*kTilePixels; i++)
+    {
+        if (bColor)
+        {
+            pWorker->m_tileColor[i] = pContext->m_clearColors.ClearColor8;
+        }
+
+        if (bDepth)
+        {
+            pWorker->m_tileDepth[i] = depth;
+        }
+    }
+}
+
+static USHORT PackBgr565(UINT color)
+{
+    return (USHORT)(((color >> 8) & 0xF800) | ((color >> 5) & 0x07E0) | ((color >> 3) & 0x001F));
+}
+
+static UINT UnpackBgr565(USHORT color)
+{
+    UINT    r = (color >> 11) & 0x1F;
+    UINT    g = (color >> 5) & 0x3F;
+    UINT    b = color & 0x1F;
+
+    return 0xFF000000 | (((r << 3) | (r >> 2)) << 16) | (((g << 2) | (g >> 4)) << 8) | ((b << 3) | (b >> 2));
+}
+
+void
+Vc4Emulator::CopyTileBuffer(
+    TileContext    *pContext,
+    bool            bStore,
+    UINT            buffer,
+    UINT            memoryFormat,
+    bool            bBgr565,
+    UINT            address)
+{
+    UINT   *pTile;
+
+    switch (buffer)
+    {
+    case VC4_TILE_BUFFER_NONE:
+        return;
+    case VC4_TILE_BUFFER_COLOR:
+        pTile = pContext->m_pWorker->m_tileColor;
+        break;
+    case VC4_TILE_BUFFER_Z_STENCIL:
+    case VC4_TILE_BUFFER_LOAD_NA:
+        //
+        // Z (24 bits) and stencil (8 bits) in 32 bits
+        //
+        pTile = pContext->m_pWorker->m_tileDepth;
+        bBgr565 = false;
+        break;
+    default:
+        if (Warn(WarningUnsupportedFormat))
+        {
+            ROS_LOG_ERROR(
+                "Unsupported tile buffer load/store. (buffer=%d)",
+                buffer);
+        }
+        return;
+    }
+
+    UINT    width = pContext->m_modeConfig.WidthInPixels;
+    UINT    height = pContext->m_modeConfig.HeightInPixels;
+    UINT    bytesPerPixel = bBgr565 ? sizeof(USHORT) : sizeof(UINT);
+    UINT    rasterStride = ((width + kTilePixels - 1) & ~(kTilePixels - 1))*bytesPerPixel;
+    BYTE   *pImage = NULL;
+
+    if (memoryFormat <= (UINT)VC4_MEMORY_FORMAT::LT_FORMAT)
+    {
+        pImage = Translate(address, Vc4EmuGetImageSize(memoryFormat, width, height, bytesPerPixel, rasterStride));
+    }
+
+    if (!pImage)
+    {
+        if (Warn(WarningBadAddress))
+        {
+            ROS_LOG_ERROR(
+                "Invalid tile buffer load/store. (address=0x%x, format=%d, width=%d, height=%d)",
+                address,
+                memoryFormat,
+                width,
+                height);
+        }
+        return;
+    }
+
+    UINT    x0 = pContext->m_tileX*kTilePixels;
+    UINT    y0 = pContext->m_tileY*kTilePixels;
+    UINT    x1 = min(x0 + kTilePixels, width);
+    UINT    y1 = min(y0 + kTilePixels, height);
+
+    for (UINT y = y0; y < y1; y++)
+    {
+        UINT   *pRow = pTile + (y - y0)*kTilePixels;
+
+        for (UINT x = x0; x < x1; x++)
+        {
+            BYTE   *pPixel = pImage + Vc4EmuGetPixelOffset(memoryFormat, x, y, width, bytesPerPixel, rasterStride);
+
+            if (bBgr565)
+            {
+                if (bStore)
+                {
+                    *((USHORT *)pPixel) = PackBgr565(pRow[x - x0]);
+                }
+                else
+                {
+                    pRow[x - x0] = UnpackBgr565(*((USHORT *)pPixel));
+                }
+            }
+            else
+            {
+                if (bStore)
+                {
+                    *((UINT *)pPixel) = pRow[x - x0];
+                }
+                else
+                {
+                    pRow[x - x0] = *((UINT *)pPixel);
+                }
+            }
+        }
+    }
+}
+
+bool
+Vc4Emulator::ShadeVertices(
+    TileContext    *pContext,
+    const UINT     *pIndex)
+{
+    WorkerScratch              *pWorker = pContext->m_pWorker;
+    const Vc4EmuShaderRecord   *pShaderRecord = &pContext->m_shaderRecord;
+    UINT                        missIndex[3];
+    UINT                        missVertex[3];
+    UINT                        numMisses = 0;
+
+    for (UINT i = 0; i < 3; i++)
+    {
+        const Vc4EmuShadedVertex   *pCached = &pWorker->m_vertexCache[pIndex[i] % kVertexCacheSize];
+
+        if ((pCached->m_generation == m_generation) &&
+            (pCached->m_shaderRecord == pShaderRecord->m_address) &&
+            (pCached->m_index == pIndex[i]))
+        {
+            pWorker->m_vertex[i] = *pCached;
+        }
+        else
+        {
+            missIndex[numMisses] = pIndex[i];
+            missVertex[numMisses++] = i;
+        }
+    }
+
+    if (0 == numMisses)
+    {
+        return true;
+    }
+
+    if (pShaderRecord->m_bNoVertexShading)
+    {
+        const VC4NVShaderStateRecord   *pRecord = &pShaderRecord->m_nv;
+        UINT                            offset = pRecord->ClipCoordinatesHeaderIncluded ? 4*sizeof(float) : 0;
+        UINT                            varyingOffset = offset + (pRecord->PointSizeIncluded ? 4 : 3)*sizeof(UINT);
+
+        for (UINT i = 0; i < numMisses; i++)
+        {
+            Vc4EmuShadedVertex *pVertex = &pWorker->m_vertex[missVertex[i]];
+            BYTE               *pData = Translate(
+                                            pRecord->ShadedVertexDataAddress + missIndex[i]*pRecord->ShadedVertexDataStride,
+                                            varyingOffset + pShaderRecord->m_numVaryings*sizeof(float));
+
+            if (!pData)
+            {
+                if (Warn(WarningBadAddress))
+                {
+                    ROS_LOG_ERROR(
+                        "Invalid shaded vertex data address. (address=0x%x)",
+                        pRecord->ShadedVertexDataAddress);
+                }
+
+                return false;
+            }
+
+            UINT    xy = ReadUint(pData + offset);
+
+            pVertex->m_xs = (SHORT)(xy & 0xFFFF);
+            pVertex->m_ys = (SHORT)(xy >> 16);
+            pVertex->m_zs = Vc4EmuAsFloat(ReadUint(pData + offset + sizeof(UINT)));
+            pVertex->m_invW = Vc4EmuAsFloat(ReadUint(pData + offset + 2*sizeof(UINT)));
+
+            RtlCopyMemory(pVertex->m_varying, pData + varyingOffset, pShaderRecord->m_numVaryings*sizeof(float));
+        }
+    }
+    else
+    {
+        //
+        // The vertex shader writes Xs/Ys, Zs, 1/Wc and the varyings
+        //
+
+        Vc4EmuQpu  *pQpu = &pWorker->m_qpu;
+
+        pQpu->Reset(true);
+
+        LoadAttributes(pQpu, pShaderRecord, false, missIndex, numMisses);
+
+        if (!RunQpu(pQpu, pShaderRecord->m_gl.VertexShaderCodeAddress, pShaderRecord->m_gl.VertexShaderUniformsAddress))
+        {
+            return false;
+        }
+
+        for (UINT i = 0; i < numMisses; i++)
+        {
+            Vc4EmuShadedVertex *pVertex = &pWorker->m_vertex[missVertex[i]];
+            UINT                xy = pQpu->m_vpmOut[0][i];
+
+            pVertex->m_xs = (SHORT)(xy & 0xFFFF);
+            pVertex->m_ys = (SHORT)(xy >> 16);
+            pVertex->m_zs = Vc4EmuAsFloat(pQpu->m_vpmOut[1][i]);
+            pVertex->m_invW = Vc4EmuAsFloat(pQpu->m_vpmOut[2][i]);
+
+            for (UINT j = 0; j < pShaderRecord->m_numVaryings; j++)
+            {
+                pVertex->m_varying[j] = Vc4EmuAsFloat(pQpu->m_vpmOut[3 + j][i]);
+            }
+        }
+    }
+
+    for (UINT i = 0; i < numMisses; i++)
+    {
+        Vc4EmuShadedVertex *pVertex = &pWorker->m_vertex[missVertex[i]];
+
+        pVertex->m_shaderRecord = pShaderRecord->m_address;
+        pVertex->m_index = missIndex[i];
+        pVertex->m_generation = m_generation;
+
+        pWorker->m_vertexCache[missIndex[i] % kVertexCacheSize] = *pVertex;
+    }
+
+    return true;
+}
+
+void
+Vc4Emulator::RenderPrimitive(
+    TileContext    *pContext,
+    const UINT     *pIndex,
+    UINT            clippedPolygon)
+{
+    if (!pContext->m_bShaderRecordValid)
+    {
+        if (!LoadShaderRecord(&pContext->m_state, &pContext->m_shaderRecord))
+        {
+            return;
+        }
+
+        pContext->m_bShaderRecordValid = true;
+    }
+
+    if (!ShadeVertices(pContext, pIndex))
+    {
+        return;
+    }
+
+    Vc4EmuClippedPolygon    polygon;
+
+    if (clippedPolygon)
+    {
+        BYTE   *pPolygon = Translate(clippedPolygon, sizeof(polygon));
+
+        if (pPolygon)
+        {
+            RtlCopyMemory(&polygon, pPolygon, sizeof(polygon));
+        }
+
+        if (!pPolygon || (polygon.m_numVertices < 3) || (polygon.m_numVertices > VC4EMU_MAX_CLIPPED_VERTICES))
+        {
+            if (Warn(WarningBadAddress))
+            {
+                ROS_LOG_ERROR(
+                    "Invalid clipped polygon. (address=0x%x)",
+                    clippedPolygon);
+            }
+
+            return;
+        }
+    }
+    else
+    {
+        polygon.m_numVertices = 3;
+
+        for (UINT i = 0; i < 3; i++)
+        {
+            const Vc4EmuShadedVertex   *pVertex = &pContext->m_pWorker->m_vertex[i];
+            Vc4EmuClippedVertex        *pRasterVertex = &polygon.m_vertex[i];
+
+            pRasterVertex->m_xs = pVertex->m_xs;
+            pRasterVertex->m_ys = pVertex->m_ys;
+            pRasterVertex->m_zs = pVertex->m_zs;
+            pRasterVertex->m_invW = pVertex->m_invW;
+
+            for (UINT j = 0; j < 3; j++)
+            {
+                pRasterVertex->m_weight[j] = (i == j) ? 1.0f : 0.0f;
+            }
+        }
+    }
+
+    for (UINT i = 1; i + 1 < polygon.m_numVertices; i++)
+    {
+        RasterizeTriangle(pContext, &polygon.m_vertex[0], &polygon.m_vertex[i], &polygon.m_vertex[i + 1]);
+    }
+}
+
+//
+// Lanes of a 4x4 pixel block are 4 quads of 2x2 pixels
+//
+
+static const BYTE s_laneX[VC4EMU_QPU_LANES] = { 0, 1, 0, 1, 2, 3, 2, 3, 0, 1, 0, 1, 2, 3, 2, 3 };
+static const BYTE s_laneY[VC4EMU_QPU_LANES] = { 0, 0, 1, 1, 0, 0, 1, 1, 2, 2, 3, 3, 2, 2, 3, 3 };
+
+void
+Vc4Emulator::RasterizeTriangle(
+    TileContext                *pContext,
+    const Vc4EmuClippedVertex  *pV0,
+    const Vc4EmuClippedVertex  *pV1,
+    const Vc4EmuClippedVertex  *pV2)
+{
+    const Vc4EmuState          *pState = &pContext->m_state;
+    const Vc4EmuClippedVertex  *pVertex[3] = { pV0, pV1, pV2 };
+    LONGLONG                    x[3];
+    LONGLONG                    y[3];
+
+    //
+    // Fixed point positions in 1/16th of pixel
+    //
+
+    for (UINT i = 0; i < 3; i++)
+    {
+        x[i] = (LONGLONG)floor(pVertex[i]->m_xs + pState->m_viewportOffset.ViewportCenterX + 0.5f);
+        y[i] = (LONGLONG)floor(pVertex[i]->m_ys + pState->m_viewportOffset.ViewportCenterY + 0.5f);
+    }
+
+    LONGLONG    area = (x[1] - x[0])*(y[2] - y[0]) - (x[2] - x[0])*(y[1] - y[0]);
+
+    if (0 == area)
+    {
+        return;
+    }
+
+    if (area < 0)
+    {
+        const Vc4EmuClippedVertex  *pTemp = pVertex[1];
+        LONGLONG                    temp;
+
+        pVertex[1] = pVertex[2];
+        pVertex[2] = pTemp;
+
+        temp = x[1]; x[1] = x[2]; x[2] = temp;
+        temp = y[1]; y[1] = y[2]; y[2] = temp;
+
+        area = -area;
+    }
+
+    //
+    // Edge i is opposite of vertex i, pixels on an edge are covered for top
+    // and left edges only
+    //
+
+    LONGLONG    edgeX[3];
+    LONGLONG    edgeY[3];
+    LONGLONG    edgeBias[3];
+
+    for (UINT i = 0; i < 3; i++)
+    {
+        UINT    a = (i + 1) % 3;
+        UINT    b = (i + 2) % 3;
+
+        edgeX[i] = x[b] - x[a];
+        edgeY[i] = y[b] - y[a];
+        edgeBias[i] = ((edgeY[i] < 0) || ((0 == edgeY[i]) && (edgeX[i] > 0))) ? 0 : -1;
+    }
+
+    //
+    // Pixels with centers in the bounding box, the tile and the clip window
+    //
+
+    LONGLONG    minX = min(x[0], min(x[1], x[2]));
+    LONGLONG    minY = min(y[0], min(y[1], y[2]));
+    LONGLONG    maxX = max(x[0], max(x[1], x[2]));
+    LONGLONG    maxY = max(y[0], max(y[1], y[2]));
+
+    const VC4ClipWindow    *pClipWindow = &pState->m_clipWindow;
+    LONGLONG                tileX = pContext->m_tileX*kTilePixels;
+    LONGLONG                tileY = pContext->m_tileY*kTilePixels;
+
+    LONGLONG    pixelMinX = max((minX + 7) >> 4, max(tileX, (LONGLONG)pClipWindow->ClipWindowLeft));
+    LONGLONG    pixelMinY = max((minY + 7) >> 4, max(tileY, (LONGLONG)pClipWindow->ClipWindowBottom));
+    LONGLONG    pixelMaxX = min((maxX - 8) >> 4, min(tileX + kTilePixels, (LONGLONG)pClipWindow->ClipWindowLeft + pClipWindow->ClipWindowWidth) - 1);
+    LONGLONG    pixelMaxY = min((maxY - 8) >> 4, min(tileY + kTilePixels, (LONGLONG)pClipWindow->ClipWindowBottom + pClipWindow->ClipWindowHeight) - 1);
+
+    if ((pixelMinX > pixelMaxX) || (pixelMinY > pixelMaxY))
+    {
+        return;
+    }
+
+    Vc4EmuInterpolation interpolation;
+    float               w[VC4EMU_QPU_LANES];
+    UINT                depth[VC4EMU_QPU_LANES];
+    float               invArea = 1.0f / (float)area;
+
+    for (UINT i = 0; i < 3; i++)
+    {
+        interpolation.m_pVertex[i] = &pContext->m_pWorker->m_vertex[i];
+    }
+
+    interpolation.m_provokingVertex = 2;
+    interpolation.m_flatShadeFlags = pState->m_flatShadeFlags.FlatShadingFlags;
+    interpolation.m_numVaryings = pContext->m_shaderRecord.m_numVaryings;
+
+    for (LONGLONG blockY = pixelMinY & ~3; blockY <= pixelMaxY; blockY += 4)
+    {
+        for (LONGLONG blockX = pixelMinX & ~3; blockX <= pixelMaxX; blockX += 4)
+        {
+            UINT    laneMask = 0;
+
+            for (UINT lane = 0; lane < VC4EMU_QPU_LANES; lane++)
+            {
+                LONGLONG    pixelX = blockX + s_laneX[lane];
+                LONGLONG    pixelY = blockY + s_laneY[lane];
+
+                w[lane] = 0.0f;
+                depth[lane] = 0;
+
+                for (UINT i = 0; i < 3; i++)
+                {
+                    interpolation.m_weight[i][lane] = 0.0f;
+                }
+
+                if ((pixelX < pixelMinX) || (pixelX > pixelMaxX) ||
+                    (pixelY < pixelMinY) || (pixelY > pixelMaxY))
+                {
+                    continue;
+                }
+
+                LONGLONG    centerX = pixelX*16 + 8;
+                LONGLONG    centerY = pixelY*16 + 8;
+                LONGLONG    edge[3];
+
+                for (UINT i = 0; i < 3; i++)
+                {
+                    UINT    a = (i + 1) % 3;
+
+                    edge[i] = edgeX[i]*(centerY - y[a]) - edgeY[i]*(centerX - x[a]);
+                }
+
+                if ((edge[0] + edgeBias[0] < 0) ||
+                    (edge[1] + edgeBias[1] < 0) ||
+                    (edge[2] + edgeBias[2] < 0))
+                {
+                    continue;
+                }
+
+                laneMask |= 1 << lane;
+
+                //
+                // Z is linear in screen space, the varyings are perspective
+                // corrected with 1/Wc
+                //
+
+                float   z = 0.0f;
+                float   invW = 0.0f;
+
+                for (UINT i = 0; i < 3; i++)
+                {
+                    float   barycentric = edge[i]*invArea;
+                    float   weight = barycentric*pVertex[i]->m_invW;
+
+                    z += barycentric*pVertex[i]->m_zs;
+                    invW += weight;
+
+                    for (UINT j = 0; j < 3; j++)
+                    {
+                        interpolation.m_weight[j][lane] += weight*pVertex[i]->m_weight[j];
+                    }
+                }
+
+                z = min(max(z, 0.0f), 1.0f);
+
+                w[lane] = 1.0f / invW;
+                depth[lane] = (UINT)(z*16777215.0f);
+            }
+
+            if (laneMask)
+            {
+                ShadeFragments(pContext, (UINT)blockX, (UINT)blockY, laneMask, depth, &interpolation, w);
+            }
+        }
+    }
+}
+
+static bool TestDepth(UINT function, UINT depth, UINT bufferDepth)
+{
+    switch (function)
+    {
+    case VC4_DEPTH_TEST_NEVER:
+        return false;
+    case VC4_DEPTH_TEST_LESS:
+        return depth < bufferDepth;
+    case VC4_DEPTH_TEST_EQUAL:
+        return depth == bufferDepth;
+    case VC4_DEPTH_TEST_LESS_EQUAL:
+        return depth <= bufferDepth;
+    case VC4_DEPTH_TEST_GREATER:
+        return depth > bufferDepth;
+    case VC4_DEPTH_TEST_NOT_EQUAL:
+        return depth != bufferDepth;
+    case VC4_DEPTH_TEST_GREATER_EQUAL:
+        return depth >= bufferDepth;
+    default:
+        return true;
+    }
+}
+
+void
+Vc4Emulator::ShadeFragments(
+    TileContext                *pContext,
+    UINT                        blockX,
+    UINT                        blockY,
+    UINT                        laneMask,
+    const UINT                 *pDepth,
+    const Vc4EmuInterpolation  *pInterpolation,
+    const float                *pW)
+{
+    WorkerScratch          *pWorker = pContext->m_pWorker;
+    const VC4ConfigBits    *pConfigBits = &pContext->m_state.m_configBits;
+    UINT                    pixel[VC4EMU_QPU_LANES];
+
+    for (UINT lane = 0; lane < VC4EMU_QPU_LANES; lane++)
+    {
+        pixel[lane] = (blockY + s_laneY[lane] - pContext->m_tileY*kTilePixels)*kTilePixels +
+                      (blockX + s_laneX[lane] - pContext->m_tileX*kTilePixels);
+    }
+
+    if (pConfigBits->EarlyZEnable)
+    {
+        for (UINT lane = 0; lane < VC4EMU_QPU_LANES; lane++)
+        {
+            if (0 == (laneMask & (1 << lane)))
+            {
+                continue;
+            }
+
+            UINT   *pBufferDepth = &pWorker->m_tileDepth[pixel[lane]];
+
+            if (!TestDepth(pConfigBits->DepthTestFunction, pDepth[lane], *pBufferDepth >> 8))
+            {
+                laneMask &= ~(1 << lane);
+            }
+            else if (pConfigBits->EarlyZUpdatesEnable)
+            {
+                *pBufferDepth = (pDepth[lane] << 8) | (*pBufferDepth & 0xFF);
+            }
+        }
+
+        if (0 == laneMask)
+        {
+            return;
+        }
+    }
+
+    //
+    // The fragment shader gets W in ra15 and Z in rb15
+    //
+
+    Vc4EmuQpu  *pQpu = &pWorker->m_qpu;
+
+    pQpu->Reset(false);
+
+    pQpu->m_pInterpolation = pInterpolation;
+
+    for (UINT lane = 0; lane < VC4EMU_QPU_LANES; lane++)
+    {
+        pQpu->m_regFileA[15][lane] = Vc4EmuAsUint(pW[lane]);
+        pQpu->m_regFileB[15][lane] = pDepth[lane];
+        pQpu->m_pixelX[lane] = blockX + s_laneX[lane];
+        pQpu->m_pixelY[lane] = blockY + s_laneY[lane];
+        pQpu->m_tileColor[lane] = pWorker->m_tileColor[pixel[lane]];
+    }
+
+    if (!RunQpu(pQpu, pContext->m_shaderRecord.m_fragmentShaderCode, pContext->m_shaderRecord.m_fragmentShaderUniforms))
+    {
+        return;
+    }
+
+    for (UINT lane = 0; lane < VC4EMU_QPU_LANES; lane++)
+    {
+        UINT    laneBit = 1 << lane;
+
+        if (0 == (laneMask & laneBit))
+        {
+            continue;
+        }
+
+        if (!pConfigBits->EarlyZEnable)
+        {
+            UINT   *pBufferDepth = &pWorker->m_tileDepth[pixel[lane]];
+            UINT    depth = (pQpu->m_tlbZMask & laneBit) ? pQpu->m_tlbZ[lane] : pDepth[lane];
+
+            if (!TestDepth(pConfigBits->DepthTestFunction, depth, *pBufferDepth >> 8))
+            {
+                continue;
+            }
+
+            if (pConfigBits->ZUpdatesEnable)
+            {
+                *pBufferDepth = (depth << 8) | (*pBufferDepth & 0xFF);
+            }
+        }
+
+        if (pQpu->m_tlbColorMask & laneBit)
+        {
+            pWorker->m_tileColor[pixel[lane]] = pQpu->m_tlbColor[lane];
+        }
+    }
+}
@@ -0,0 +1,577 @@
+#pragma once
+
+#include "Vc4Hw.h"
+#include "Vc4Qpu.h"
+
+//
+// Software emulation of the VC4 3D pipeline (V3D) for RosKmdSoftAdapter
+//
+// Vc4Emulator executes the binning control list built by the UMD and the
+// rendering control list generated by the KMD directly against video memory,
+// so the soft adapter runs the same HW command buffers as RosKmdRapAdapter.
+// It covers the subset of V3D the driver uses:
+//
+// - The binner shades the vertices with the coordinate shader, clips and
+//   culls the triangles and writes them into per tile lists in the tile
+//   allocation memory, together with the state packets they depend on.
+// - The renderer runs the tile lists per tile: vertex shading, rasterization
+//   of the triangles in 4x4 pixel blocks, fragment shading with TMU fetch,
+//   depth test and the loads and stores of the 64x64 tile buffer.
+//
+// The shaders run on an interpreted QPU (Vc4EmulatorQpu.cpp).
+//
+// Only memory allocation and logging come from the kernel, so the emulator is
+// also built in user mode by its test (vc4emutest).
+//
+// Like on the hardware the tile lists are private to the binner and the
+// renderer. A triangle is written as VC4_CMD_COMPRESSED_PRIMITIVE_LIST
+// followed by its 3 vertex indices, a triangle that had to be clipped as
+// VC4_CMD_CLIPPED_PRIMITVE_WITH_COMPRESSED_PRIMITIVE_LIST followed by its
+// vertex indices and the address of the clipped polygon (Vc4EmuClippedPolygon)
+// in the tile allocation memory.
+//
+// Work is split into items (vertex batches, triangle chunks, tile rows and
+// tiles) and run on the Vc4EmuWorkerPool supplied by the adapter, so binning
+// and rendering use all of the host cores.
+//
+
+const UINT VC4EMU_QPU_LANES = 16;
+const UINT VC4EMU_MAX_WORKERS = 16;
+const UINT VC4EMU_MAX_VARYINGS = 32;
+const UINT VC4EMU_MAX_CLIPPED_VERTICES = 8;     // Triangle clipped by 5 planes
+
+typedef void (*PFN_VC4EMU_JOB)(void * pContext, UINT item, UINT worker);
+
+class Vc4EmuWorkerPool
+{
+public:
+
+    virtual UINT GetWorkerCount() = 0;
+
+    //
+    // Calls pfnJob for each item in [0, numItems) and returns once all items
+    // are done. worker is below GetWorkerCount() and is not used by 2 calls
+    // at the same time, the calling thread runs items as worker 0.
+    //
+    virtual void Run(PFN_VC4EMU_JOB pfnJob, void * pContext, UINT numItems) = 0;
+};
+
+enum Vc4EmuMemoryRegion
+{
+    Vc4EmuRegionVideoMemory,
+    Vc4EmuRegionDmaBuffer,
+    Vc4EmuRegionCount
+};
+
+__forceinline float Vc4EmuAsFloat(UINT value)
+{
+    union { UINT u; float f; } v;
+
+    v.u = value;
+
+    return v.f;
+}
+
+__forceinline UINT Vc4EmuAsUint(float value)
+{
+    union { UINT u; float f; } v;
+
+    v.f = value;
+
+    return v.u;
+}
+
+//
+// Byte offset of a pixel in a raster, T-format or LT-format image. The tiled
+// formats are made of 64 byte utiles of 4 rows, T-format groups 4x4 utiles
+// in 1KB subtiles and 2x2 subtiles in 4KB tiles, with the tile rows
+// alternating direction.
+//
+
+__forceinline UINT Vc4EmuGetPixelOffset(UINT memoryFormat, UINT x, UINT y, UINT width, UINT bytesPerPixel, UINT rasterStride)
+{
+    UINT utileWidth = VC4_MICRO_TILE_WIDTH_BYTES / bytesPerPixel;
+    UINT utileOffset = (y % VC4_MICRO_TILE_HEIGHT)*VC4_MICRO_TILE_WIDTH_BYTES + (x % utileWidth)*bytesPerPixel;
+
+    if ((UINT)VC4_MEMORY_FORMAT::LINEAR == memoryFormat)
+    {
+        return y*rasterStride + x*bytesPerPixel;
+    }
+
+    if ((UINT)VC4_MEMORY_FORMAT::LT_FORMAT == memoryFormat)
+    {
+        UINT widthInUtiles = (width + utileWidth - 1) / utileWidth;
+
+        return ((y / VC4_MICRO_TILE_HEIGHT)*widthInUtiles + x / utileWidth)*VC4_MICRO_TILE_SIZE_BYTES + utileOffset;
+    }
+
+    UINT tileWidth = 8*utileWidth;
+    UINT widthInTiles = (width + tileWidth - 1) / tileWidth;
+    UINT tileX = x / tileWidth;
+    UINT tileY = y / VC4_4KB_TILE_HEIGHT;
+    UINT subtileX = (x / (4*utileWidth)) & 1;
+    UINT subtileY = (y / VC4_1KB_SUB_TILE_HEIGHT) & 1;
+    UINT subtile;
+
+    if (tileY & 1)
+    {
+        tileX = widthInTiles - 1 - tileX;
+        subtile = subtileX ? (1 - subtileY) : (2 + subtileY);
+    }
+    else
+    {
+        subtile = subtileX ? (3 - subtileY) : subtileY;
+    }
+
+    UINT utile = ((y / VC4_MICRO_TILE_HEIGHT) & 3)*4 + ((x / utileWidth) & 3);
+
+    return ((tileY*widthInTiles + tileX)*4 + subtile)*VC4_1KB_SUB_TILE_SIZE_BYTES + utile*VC4_MICRO_TILE_SIZE_BYTES + utileOffset;
+}
+
+__forceinline UINT Vc4EmuGetImageSize(UINT memoryFormat, UINT width, UINT height, UINT bytesPerPixel, UINT rasterStride)
+{
+    UINT utileWidth = VC4_MICRO_TILE_WIDTH_BYTES / bytesPerPixel;
+
+    if ((UINT)VC4_MEMORY_FORMAT::LINEAR == memoryFormat)
+    {
+        return height*rasterStride;
+    }
+
+    if ((UINT)VC4_MEMORY_FORMAT::LT_FORMAT == memoryFormat)
+    {
+        return ((width + utileWidth - 1) / utileWidth)*((height + VC4_MICRO_TILE_HEIGHT - 1) / VC4_MICRO_TILE_HEIGHT)*VC4_MICRO_TILE_SIZE_BYTES;
+    }
+
+    UINT tileWidth = 8*utileWidth;
+
+    return ((width + tileWidth - 1) / tileWidth)*((height + VC4_4KB_TILE_HEIGHT - 1) / VC4_4KB_TILE_HEIGHT)*VC4_4KB_TILE_SIZE_BYTES;
+}
+
+//
+// Clipped polygon written by the binner, in the tile allocation memory
+//
+
+struct Vc4EmuClippedVertex
+{
+    float   m_xs;           // In 1/16th of pixel, relative to the viewport center
+    float   m_ys;
+    float   m_zs;
+    float   m_invW;
+    float   m_weight[3];    // Clip space weights of the triangle's vertices
+};
+
+struct Vc4EmuClippedPolygon
+{
+    UINT                m_numVertices;
+    Vc4EmuClippedVertex m_vertex[VC4EMU_MAX_CLIPPED_VERTICES];
+};
+
+//
+// Binning state kept per tile in the tile state data array
+//
+
+struct Vc4EmuTileState
+{
+    UINT    m_writeAddress;     // Next write in the tile list
+    UINT    m_blockEnd;         // Space for a VC4Branch is kept after it
+    UINT    m_stateVersion;     // Version of the state last written
+    UINT    m_bClosed;          // Tile list is terminated
+};
+
+//
+// State packets the primitives depend on, written to the tile lists by the
+// binner and tracked by the renderer
+//
+
+struct Vc4EmuState
+{
+    VC4_COMMAND_ID              m_shaderStateCommand;   // VC4_CMD_GL_SHADER_STATE or VC4_CMD_NV_SHADER_STATE
+    UINT                        m_shaderState;          // Payload of the shader state packet
+    VC4ConfigBits               m_configBits;
+    VC4FlatShadeFlags           m_flatShadeFlags;
+    VC4ClipWindow               m_clipWindow;
+    VC4ViewportOffset           m_viewportOffset;
+    VC4ClipperXYScaling         m_clipperXYScaling;
+    VC4ClipperZScaleAndOffset   m_clipperZScaleAndOffset;
+};
+
+//
+// Shader record and attributes of a draw
+//
+
+struct Vc4EmuShaderRecord
+{
+    UINT                    m_address;
+    bool                    m_bNoVertexShading;
+    VC4GLShaderStateRecord  m_gl;
+    VC4NVShaderStateRecord  m_nv;
+    VC4VertexAttribute      m_attributes[8];
+    UINT                    m_numAttributes;
+    UINT                    m_numVaryings;
+    UINT                    m_fragmentShaderCode;
+    UINT                    m_fragmentShaderUniforms;
+};
+
+//
+// Vertex after the vertex shader (or read from NV shaded vertex data)
+//
+
+struct Vc4EmuShadedVertex
+{
+    UINT    m_shaderRecord;
+    UINT    m_index;
+    UINT    m_generation;
+    float   m_xs;           // In 1/16th of pixel, relative to the viewport center
+    float   m_ys;
+    float   m_zs;
+    float   m_invW;
+    float   m_varying[VC4EMU_MAX_VARYINGS];
+};
+
+//
+// Interpolation of the varyings of a triangle, per lane
+//
+
+struct Vc4EmuInterpolation
+{
+    float                       m_weight[3][VC4EMU_QPU_LANES];  // Perspective corrected barycentrics
+    const Vc4EmuShadedVertex *  m_pVertex[3];
+    UINT                        m_provokingVertex;
+    UINT                        m_flatShadeFlags;
+    UINT                        m_numVaryings;
+};
+
+//
+// State of a QPU running one shader invocation (16 lanes)
+//
+
+struct Vc4EmuQpuWrite
+{
+    UINT    m_address;              // Regfile address
+    bool    m_bRegFileA;
+    UINT    m_laneMask;
+    UINT    m_byteMask;
+    UINT    m_value[VC4EMU_QPU_LANES];
+};
+
+struct Vc4EmuTmu
+{
+    static const UINT kFifoSize = 8;
+
+    UINT    m_coordinate[4][VC4EMU_QPU_LANES];  // s, t, r, b
+    UINT    m_written;
+    UINT    m_fifo[kFifoSize][VC4EMU_QPU_LANES];
+    UINT    m_fifoHead;
+    UINT    m_fifoCount;
+};
+
+struct Vc4EmuQpu
+{
+    UINT                m_regFileA[32][VC4EMU_QPU_LANES];
+    UINT                m_regFileB[32][VC4EMU_QPU_LANES];
+    UINT                m_acc[6][VC4EMU_QPU_LANES];
+    BYTE                m_flagZ[VC4EMU_QPU_LANES];
+    BYTE                m_flagN[VC4EMU_QPU_LANES];
+    BYTE                m_flagC[VC4EMU_QPU_LANES];
+
+    Vc4EmuQpuWrite      m_pendingWrites[2];     // Regfile writes of the previous instruction
+    UINT                m_numPendingWrites;
+
+    UINT                m_uniformAddress;
+
+    UINT                m_vpmReadAddress;
+    UINT                m_vpmReadStride;
+    UINT                m_vpmWriteAddress;
+    UINT                m_vpmWriteStride;
+
+    Vc4EmuTmu           m_tmu[2];
+
+    //
+    // Fragment shading
+    //
+
+    const Vc4EmuInterpolation * m_pInterpolation;
+    UINT                m_nextVarying;
+    UINT                m_pixelX[VC4EMU_QPU_LANES];
+    UINT                m_pixelY[VC4EMU_QPU_LANES];
+    UINT                m_tileColor[VC4EMU_QPU_LANES];  // For the color load signal
+    UINT                m_tlbColor[VC4EMU_QPU_LANES];
+    UINT                m_tlbZ[VC4EMU_QPU_LANES];
+    UINT                m_tlbColorMask;
+    UINT                m_tlbZMask;
+
+    //
+    // Vertex and coordinate shading, last so fragment shading does not clear
+    // them for every 4x4 block
+    //
+
+    UINT                m_vpmIn[64][VC4EMU_QPU_LANES];
+    UINT                m_vpmOut[64][VC4EMU_QPU_LANES];
+
+    void Reset(bool bVertexShading)
+    {
+        RtlZeroMemory(this, bVertexShading ? sizeof(*this) : FIELD_OFFSET(Vc4EmuQpu, m_vpmIn));
+
+        m_vpmReadStride = 1;
+        m_vpmWriteStride = 1;
+    }
+};
+
+class Vc4Emulator
+{
+public:
+
+    NTSTATUS Initialize(Vc4EmuWorkerPool * pWorkerPool);
+    void Uninitialize();
+
+    void SetMemoryRegion(Vc4EmuMemoryRegion region, UINT busAddress, UINT size, BYTE * pCpuAddress);
+
+    //
+    // Return false when the control list failed, e.g. it could not be read to
+    // its end or the tile lists could not be written. The tile lists of a
+    // failed binning are not terminated and must not be rendered.
+    //
+
+    bool ExecuteBinningControlList(UINT startAddress, UINT endAddress);
+    bool ExecuteRenderingControlList(UINT startAddress, UINT endAddress);
+
+private:
+
+    static const UINT kTilePixels = VC4_BINNING_TILE_PIXELS;
+    static const UINT kVertexCacheSize = 64;
+    static const UINT kPrimitivesPerItem = 256;
+    static const UINT kMaxPackets = 1 << 24;
+    static const UINT kMaxDrawVertices = 1 << 20;
+
+    enum Warning
+    {
+        WarningBadAddress,
+        WarningBadPacket,
+        WarningUnsupportedPacket,
+        WarningUnsupportedPrimitive,
+        WarningNoShaderState,
+        WarningTileAllocationOverflow,
+        WarningTileOutOfFrame,
+        WarningUnsupportedFormat,
+        WarningQpuFault,
+        WarningQpuInstructionLimit,
+        WarningTmuOverflow,
+        WarningOutOfMemory
+    };
+
+    struct MemoryRegion
+    {
+        UINT    m_busAddress;
+        UINT    m_size;
+        BYTE   *m_pCpuAddress;
+    };
+
+    //
+    // Binning
+    //
+
+    struct BinVertex
+    {
+        float   m_clip[4];
+        float   m_xs;
+        float   m_ys;
+        float   m_zs;
+        float   m_invW;
+    };
+
+    struct BinPrimitive
+    {
+        UINT    m_index[3];
+        UINT    m_clippedPolygon;       // 0 if not clipped
+        UINT    m_numVertices;          // 0 if culled
+        int     m_tileMinX;
+        int     m_tileMinY;
+        int     m_tileMaxX;
+        int     m_tileMaxY;
+        float   m_x[VC4EMU_MAX_CLIPPED_VERTICES];   // Pixels, clockwise
+        float   m_y[VC4EMU_MAX_CLIPPED_VERTICES];
+    };
+
+    struct Draw
+    {
+        Vc4EmuShaderRecord  m_shaderRecord;
+        UINT                m_mode;
+        const BYTE         *m_pIndices;
+        UINT                m_indexSize;
+        UINT                m_firstVertex;
+        UINT                m_minIndex;
+        UINT                m_numVertices;
+        UINT                m_numPrimitives;
+    };
+
+    //
+    // Rendering
+    //
+
+    struct TileJob
+    {
+        UINT                        m_startAddress;
+        UINT                        m_nextJob;
+        VC4TileRenderingModeConfig  m_modeConfig;
+        VC4ClearColors              m_clearColors;
+    };
+
+    struct WorkerScratch
+    {
+        Vc4EmuQpu           m_qpu;
+        Vc4EmuShadedVertex  m_vertexCache[kVertexCacheSize];
+        Vc4EmuShadedVertex  m_vertex[3];
+        UINT                m_tileColor[kTilePixels * kTilePixels];
+        UINT                m_tileDepth[kTilePixels * kTilePixels];    // Z (24 bits) << 8 | stencil
+    };
+
+    struct TileContext
+    {
+        WorkerScratch              *m_pWorker;
+        UINT                        m_tileX;
+        UINT                        m_tileY;
+        VC4TileRenderingModeConfig  m_modeConfig;
+        VC4ClearColors              m_clearColors;
+        Vc4EmuState                 m_state;
+        Vc4EmuShaderRecord          m_shaderRecord;
+        bool                        m_bShaderRecordValid;
+        VC4LoadTileBufferGeneral    m_pendingLoad;
+        bool                        m_bLoadPending;
+    };
+
+    template<typename T> bool Reserve(T ** ppBuffer, UINT * pCapacity, UINT count)
+    {
+        if (count <= *pCapacity)
+        {
+            return true;
+        }
+
+        UINT capacity = max(count, 2 * (*pCapacity));
+        T * pBuffer = (T *)ExAllocatePoolWithTag(NonPagedPoolNx, capacity * sizeof(T), 'ROSD');
+
+        if (!pBuffer)
+        {
+            if (Warn(WarningOutOfMemory))
+            {
+                ROS_LOG_ERROR(
+                    "Failed to allocate VC4 emulator buffer. (size=%Id)",
+                    capacity * sizeof(T));
+            }
+
+            return false;
+        }
+
+        if (*ppBuffer)
+        {
+            RtlCopyMemory(pBuffer, *ppBuffer, (*pCapacity) * sizeof(T));
+            ExFreePool(*ppBuffer);
+        }
+
+        *ppBuffer = pBuffer;
+        *pCapacity = capacity;
+
+        return true;
+    }
+
+    bool Warn(Warning warning)
+    {
+        LONG bit = 1 << warning;
+
+        return 0 == (InterlockedOr(&m_warnings, bit) & bit);
+    }
+
+    void Fail()
+    {
+        InterlockedExchange(&m_bFailed, 1);
+    }
+
+    BYTE * Translate(UINT busAddress, UINT size, UINT * pAvailable = NULL);
+    BYTE * TranslatePacket(UINT address, UINT * pSize);
+    bool LoadShaderRecord(const Vc4EmuState * pState, Vc4EmuShaderRecord * pShaderRecord);
+
+    // Binning (Vc4Emulator.cpp)
+    void StartBinning(const VC4TileBinningModeConfig * pConfig);
+    void BinDraw(UINT mode, const BYTE * pIndices, UINT indexSize, UINT length, UINT firstVertex);
+    void ShadeBinVertices(UINT batch, WorkerScratch * pWorker);
+    void SetupBinPrimitives(UINT chunk);
+    void BinTileRow(UINT row);
+    bool SetupBinPrimitive(BinPrimitive * pPrimitive);
+    BYTE * TranslateTileList(Vc4EmuTileState * pTile, UINT size);
+    bool WriteTileList(Vc4EmuTileState * pTile, const void * pData, UINT size);
+    void WritePrimitive(Vc4EmuTileState * pTile, const BinPrimitive * pPrimitive);
+    void CloseTileLists();
+    UINT AllocateTileMemory(UINT size);
+    UINT GetVertexIndex(UINT vertex);
+
+    static void ShadeBinVerticesJob(void * pContext, UINT item, UINT worker);
+    static void SetupBinPrimitivesJob(void * pContext, UINT item, UINT worker);
+    static void BinTileRowJob(void * pContext, UINT item, UINT worker);
+
+    // Rendering (Vc4Emulator.cpp)
+    void RenderTile(UINT item, WorkerScratch * pWorker);
+    void RunTileJob(TileContext * pContext, const TileJob * pJob);
+    void CopyTileBuffer(TileContext * pContext, bool bStore, UINT buffer, UINT memoryFormat, bool bBgr565, UINT address);
+    void ClearTileBuffer(TileContext * pContext, bool bColor, bool bDepth);
+    void RenderPrimitive(TileContext * pContext, const UINT * pIndex, UINT clippedPolygon);
+    bool ShadeVertices(TileContext * pContext, const UINT * pIndex);
+    void RasterizeTriangle(TileContext * pContext, const Vc4EmuClippedVertex * pV0, const Vc4EmuClippedVertex * pV1, const Vc4EmuClippedVertex * pV2);
+    void ShadeFragments(TileContext * pContext, UINT blockX, UINT blockY, UINT laneMask, const UINT * pDepth, const Vc4EmuInterpolation * pInterpolation, const float * pW);
+
+    static void RenderTileJob(void * pContext, UINT item, UINT worker);
+
+    // Shaders (Vc4EmulatorQpu.cpp)
+    void LoadAttributes(Vc4EmuQpu * pQpu, const Vc4EmuShaderRecord * pShaderRecord, bool bCoordinateShader, const UINT * pIndex, UINT numVertices);
+    bool RunQpu(Vc4EmuQpu * pQpu, UINT codeAddress, UINT uniformAddress);
+    bool ExecuteQpuInstruction(Vc4EmuQpu * pQpu, VC4_QPU_INSTRUCTION instruction);
+    void ReadQpuRegister(Vc4EmuQpu * pQpu, bool bRegFileA, UINT raddr, UINT * pValue, UINT * pR5, bool * pbR5Written);
+    void WriteQpuResult(Vc4EmuQpu * pQpu, UINT waddr, bool bRegFileA, UINT laneMask, UINT byteMask, const UINT * pValue);
+    UINT ReadUniform(Vc4EmuQpu * pQpu);
+    void SubmitTmuRequest(Vc4EmuQpu * pQpu, UINT tmu, UINT laneMask);
+    UINT SampleTexture(UINT config0, UINT config1, float s, float t);
+
+    MemoryRegion        m_regions[Vc4EmuRegionCount];
+
+    Vc4EmuWorkerPool   *m_pWorkerPool;
+    UINT                m_numWorkers;
+    WorkerScratch      *m_pWorkers[VC4EMU_MAX_WORKERS];
+
+    volatile LONG       m_warnings;
+    volatile LONG       m_bFailed;
+
+    //
+    // Binning
+    //
+
+    VC4TileBinningModeConfig    m_binningConfig;
+    bool                m_bBinning;
+    UINT                m_tileAllocationAddress;
+    UINT                m_tileAllocationSize;
+    volatile LONG       m_tileAllocationUsed;
+    UINT                m_blockSize;
+    Vc4EmuTileState    *m_pTileState;
+    Vc4EmuState         m_state;
+    UINT                m_stateVersion;
+    UINT                m_semaphore;
+
+    Draw                m_draw;
+    BinVertex          *m_pBinVertices;
+    UINT                m_binVertexCapacity;
+    BinPrimitive       *m_pBinPrimitives;
+    UINT                m_binPrimitiveCapacity;
+
+    //
+    // Rendering
+    //
+
+    UINT                m_renderingEndAddress;
+    UINT                m_renderingWidthInTiles;
+    VC4ClearColors      m_clearColors;
+    UINT                m_generation;
+    TileJob            *m_pTileJobs;
+    UINT                m_tileJobCapacity;
+    UINT               *m_pFirstTileJob;       // Per tile
+    UINT               *m_pLastTileJob;
+    UINT               *m_pUsedTiles;          // In order of first use
+    UINT                m_numUsedTiles;
+    UINT                m_tileCapacity;
+};
@@ -0,0 +1,1495 @@
+#ifdef _KERNEL_MODE
+
+#include "precomp.h"
+
+#include "RosKmdLogging.h"
+#include "Vc4EmulatorQpu.tmh"
+
+#else
+
+#include "vc4emutest.h"
+
+#endif
+
+#include "Vc4Emulator.h"
+
+#include <math.h>
+
+//
+// QPU interpreter of the VC4 emulator
+//
+// Runs one 16 lane shader invocation to its end. Like on the hardware a
+// branch has 3 delay slots and the program end 2, register file writes are
+// visible 2 instructions later and accumulators in the next instruction.
+//
+
+const UINT kMaxQpuInstructions = 1 << 20;
+
+const UINT kBranchDelaySlots = 3;
+const UINT kProgramEndDelaySlots = 2;
+
+static float HalfToFloat(UINT half)
+{
+    UINT    sign = (half >> 15) & 1;
+    UINT    exponent = (half >> 10) & 0x1F;
+    UINT    mantissa = half & 0x3FF;
+
+    if (0 == exponent)
+    {
+        float   value = mantissa / 16777216.0f;
+
+        return sign ? -value : value;
+    }
+
+    if (0x1F == exponent)
+    {
+        return Vc4EmuAsFloat((sign << 31) | 0x7F800000 | (mantissa << 13));
+    }
+
+    return Vc4EmuAsFloat((sign << 31) | ((exponent + 112) << 23) | (mantissa << 13));
+}
+
+static UINT FloatToHalf(float value)
+{
+    UINT    bits = Vc4EmuAsUint(value);
+    UINT    sign = (bits >> 16) & 0x8000;
+    INT     exponent = (INT)((bits >> 23) & 0xFF) - 127 + 15;
+    UINT    mantissa = bits & 0x7FFFFF;
+
+    if (0xFF == ((bits >> 23) & 0xFF))
+    {
+        return sign | 0x7C00 | (mantissa ? 0x200 : 0);
+    }
+
+    if (exponent >= 0x1F)
+    {
+        return sign | 0x7C00;
+    }
+
+    if (exponent <= 0)
+    {
+        if (exponent < -10)
+        {
+            return sign;
+        }
+
+        return sign | ((mantissa | 0x800000) >> (14 - exponent));
+    }
+
+    return sign | (exponent << 10) | (mantissa >> 13);
+}
+
+static UINT FloatToUnorm8(UINT value)
+{
+    float   f = Vc4EmuAsFloat(value);
+
+    if (!(f > 0.0f))
+    {
+        return 0;
+    }
+
+    if (f >= 1.0f)
+    {
+        return 0xFF;
+    }
+
+    return (UINT)(f*255.0f + 0.5f);
+}
+
+static UINT ApplyPerByte(UINT a, UINT b, UINT op)
+{
+    UINT    result = 0;
+
+    for (UINT shift = 0; shift < 32; shift += 8)
+    {
+        UINT    x = (a >> shift) & 0xFF;
+        UINT    y = (b >> shift) & 0xFF;
+        UINT    r;
+
+        switch (op)
+        {
+        case VC4_QPU_OPCODE_MUL_V8MULD:
+            r = (x*y + 127) / 255;
+            break;
+        case VC4_QPU_OPCODE_MUL_V8MIN:
+            r = min(x, y);
+            break;
+        case VC4_QPU_OPCODE_MUL_V8MAX:
+            r = max(x, y);
+            break;
+        case VC4_QPU_OPCODE_MUL_V8ADDS:
+            r = min(x + y, 0xFF);
+            break;
+        default:
+            r = (x > y) ? (x - y) : 0;
+            break;
+        }
+
+        result |= r << shift;
+    }
+
+    return result;
+}
+
+static bool IsAddOpFloatInput(UINT op)
+{
+    return (op >= VC4_QPU_OPCODE_ADD_FADD) && (op <= VC4_QPU_OPCODE_ADD_FTOI);
+}
+
+static bool IsAddOpFloatOutput(UINT op)
+{
+    return ((op >= VC4_QPU_OPCODE_ADD_FADD) && (op <= VC4_QPU_OPCODE_ADD_FMAX_ABS)) ||
+           (VC4_QPU_OPCODE_ADD_ITOF == op);
+}
+
+static UINT ExecuteAddOp(UINT op, UINT a, UINT b, BYTE * pCarry)
+{
+    float   fa = Vc4EmuAsFloat(a);
+    float   fb = Vc4EmuAsFloat(b);
+
+    *pCarry = 0;
+
+    switch (op)
+    {
+    case VC4_QPU_OPCODE_ADD_FADD:
+        return Vc4EmuAsUint(fa + fb);
+    case VC4_QPU_OPCODE_ADD_FSUB:
+        return Vc4EmuAsUint(fa - fb);
+    case VC4_QPU_OPCODE_ADD_FMIN:
+        return (fa < fb) ? a : b;
+    case VC4_QPU_OPCODE_ADD_FMAX:
+        return (fa > fb) ? a : b;
+    case VC4_QPU_OPCODE_ADD_FMIN_ABS:
+        return (fabs(fa) < fabs(fb)) ? (a & 0x7FFFFFFF) : (b & 0x7FFFFFFF);
+    case VC4_QPU_OPCODE_ADD_FMAX_ABS:
+        return (fabs(fa) > fabs(fb)) ? (a & 0x7FFFFFFF) : (b & 0x7FFFFFFF);
+    case VC4_QPU_OPCODE_ADD_FTOI:
+        if (!(fa == fa) || (fa >= 2147483648.0f) || (fa < -2147483648.0f))
+        {
+            return 0;
+        }
+        return (UINT)(INT)fa;
+    case VC4_QPU_OPCODE_ADD_ITOF:
+        return Vc4EmuAsUint((float)(INT)a);
+    case VC4_QPU_OPCODE_ADD_ADD:
+        *pCarry = (a + b) < a;
+        return a + b;
+    case VC4_QPU_OPCODE_ADD_SUB:
+        *pCarry = a < b;
+        return a - b;
+    case VC4_QPU_OPCODE_ADD_SHR:
+        return a >> (b & 31);
+    case VC4_QPU_OPCODE_ADD_ASR:
+        return (UINT)((INT)a >> (b & 31));
+    case VC4_QPU_OPCODE_ADD_ROR:
+        return (b & 31) ? ((a >> (b & 31)) | (a << (32 - (b & 31)))) : a;
+    case VC4_QPU_OPCODE_ADD_SHL:
+        return a << (b & 31);
+    case VC4_QPU_OPCODE_ADD_MIN:
+        return ((INT)a < (INT)b) ? a : b;
+    case VC4_QPU_OPCODE_ADD_MAX:
+        return ((INT)a > (INT)b) ? a : b;
+    case VC4_QPU_OPCODE_ADD_AND:
+        return a & b;
+    case VC4_QPU_OPCODE_ADD_OR:
+        return a | b;
+    case VC4_QPU_OPCODE_ADD_XOR:
+        return a ^ b;
+    case VC4_QPU_OPCODE_ADD_NOT:
+        return ~a;
+    case VC4_QPU_OPCODE_ADD_CLZ:
+        {
+            UINT    count = 0;
+
+            for (UINT bit = 0x80000000; bit && !(a & bit); bit >>= 1)
+            {
+                count++;
+            }
+
+            return count;
+        }
+    case VC4_QPU_OPCODE_ADD_V8ADDS:
+        return ApplyPerByte(a, b, VC4_QPU_OPCODE_MUL_V8ADDS);
+    case VC4_QPU_OPCODE_ADD_V8SUBS:
+        return ApplyPerByte(a, b, VC4_QPU_OPCODE_MUL_V8SUBS);
+    default:
+        return 0;
+    }
+}
+
+static UINT ExecuteMulOp(UINT op, UINT a, UINT b)
+{
+    switch (op)
+    {
+    case VC4_QPU_OPCODE_MUL_FMUL:
+        return Vc4EmuAsUint(Vc4EmuAsFloat(a)*Vc4EmuAsFloat(b));
+    case VC4_QPU_OPCODE_MUL_MUL24:
+        return (a & 0xFFFFFF)*(b & 0xFFFFFF);
+    case VC4_QPU_OPCODE_MUL_NOP:
+        return 0;
+    default:
+        return ApplyPerByte(a, b, op);
+    }
+}
+
+static UINT UnpackOperand(UINT value, UINT unpack, bool bFloat)
+{
+    switch (unpack)
+    {
+    case VC4_QPU_UNPACK_16a:
+    case VC4_QPU_UNPACK_16b:
+        {
+            UINT    half = (VC4_QPU_UNPACK_16a == unpack) ? (value & 0xFFFF) : (value >> 16);
+
+            return bFloat ? Vc4EmuAsUint(HalfToFloat(half)) : (UINT)(INT)(SHORT)half;
+        }
+    case VC4_QPU_UNPACK_8d_REP:
+        return (value >> 24)*0x01010101;
+    case VC4_QPU_UNPACK_8a:
+    case VC4_QPU_UNPACK_8b:
+    case VC4_QPU_UNPACK_8c:
+    case VC4_QPU_UNPACK_8d:
+        {
+            UINT    byte = (value >> (8*(unpack - VC4_QPU_UNPACK_8a))) & 0xFF;
+
+            return bFloat ? Vc4EmuAsUint(byte / 255.0f) : byte;
+        }
+    default:
+        return value;
+    }
+}
+
+static UINT PackResult(UINT value, UINT pack, bool bPm, bool bFloat, UINT * pByteMask)
+{
+    *pByteMask = 0xF;
+
+    if (bPm)
+    {
+        //
+        // MUL pack, float in [0, 1] to 8 bit color
+        //
+
+        switch (pack)
+        {
+        case VC4_QPU_PACK_MUL_8888:
+            return FloatToUnorm8(value)*0x01010101;
+        case VC4_QPU_PACK_MUL_8a:
+        case VC4_QPU_PACK_MUL_8b:
+        case VC4_QPU_PACK_MUL_8c:
+        case VC4_QPU_PACK_MUL_8d:
+            *pByteMask = 1 << (pack - VC4_QPU_PACK_MUL_8a);
+            return FloatToUnorm8(value) << (8*(pack - VC4_QPU_PACK_MUL_8a));
+        default:
+            return value;
+        }
+    }
+
+    bool    bSaturate = (pack >= VC4_QPU_PACK_A_32_SAT);
+    UINT    byte = value & 0xFF;
+
+    if (bSaturate)
+    {
+        byte = ((INT)value < 0) ? 0 : min(value, 0xFF);
+    }
+
+    switch (pack & 7)
+    {
+    case VC4_QPU_PACK_A_16a:
+    case VC4_QPU_PACK_A_16b:
+        {
+            UINT    half = value & 0xFFFF;
+
+            if (bFloat)
+            {
+                half = FloatToHalf(Vc4EmuAsFloat(value));
+            }
+            else if (bSaturate)
+            {
+                half = (UINT)min(max((INT)value, -32768), 32767) & 0xFFFF;
+            }
+
+            if (VC4_QPU_PACK_A_16a == (pack & 7))
+            {
+                *pByteMask = 0x3;
+                return half;
+            }
+
+            *pByteMask = 0xC;
+            return half << 16;
+        }
+    case VC4_QPU_PACK_A_8888:
+        return byte*0x01010101;
+    case VC4_QPU_PACK_A_8a:
+    case VC4_QPU_PACK_A_8b:
+    case VC4_QPU_PACK_A_8c:
+    case VC4_QPU_PACK_A_8d:
+        *pByteMask = 1 << ((pack & 7) - VC4_QPU_PACK_A_8a);
+        return byte << (8*((pack & 7) - VC4_QPU_PACK_A_8a));
+    default:
+        return value;
+    }
+}
+
+static void MergeLanes(UINT * pDest, const UINT * pValue, UINT laneMask, UINT byteMask)
+{
+    UINT    bits = 0;
+
+    for (UINT i = 0; i < 4; i++)
+    {
+        if (byteMask & (1 << i))
+        {
+            bits |= 0xFF << (8*i);
+        }
+    }
+
+    for (UINT lane = 0; lane < VC4EMU_QPU_LANES; lane++)
+    {
+        if (laneMask & (1 << lane))
+        {
+            pDest[lane] = (pDest[lane] & ~bits) | (pValue[lane] & bits);
+        }
+    }
+}
+
+static void CommitPendingWrites(Vc4EmuQpu * pQpu)
+{
+    for (UINT i = 0; i < pQpu->m_numPendingWrites; i++)
+    {
+        const Vc4EmuQpuWrite   *pWrite = &pQpu->m_pendingWrites[i];
+        UINT                   *pDest = pWrite->m_bRegFileA ?
+                                            pQpu->m_regFileA[pWrite->m_address] :
+                                            pQpu->m_regFileB[pWrite->m_address];
+
+        MergeLanes(pDest, pWrite->m_value, pWrite->m_laneMask, pWrite->m_byteMask);
+    }
+
+    pQpu->m_numPendingWrites = 0;
+}
+
+static UINT GetConditionMask(const Vc4EmuQpu * pQpu, UINT condition)
+{
+    UINT    mask = 0;
+
+    for (UINT lane = 0; lane < VC4EMU_QPU_LANES; lane++)
+    {
+        bool    bPass;
+
+        switch (condition)
+        {
+        case VC4_QPU_COND_ALWAYS:
+            bPass = true;
+            break;
+        case VC4_QPU_COND_ZS:
+            bPass = pQpu->m_flagZ[lane] != 0;
+            break;
+        case VC4_QPU_COND_ZC:
+            bPass = pQpu->m_flagZ[lane] == 0;
+            break;
+        case VC4_QPU_COND_NS:
+            bPass = pQpu->m_flagN[lane] != 0;
+            break;
+        case VC4_QPU_COND_NC:
+            bPass = pQpu->m_flagN[lane] == 0;
+            break;
+        case VC4_QPU_COND_CS:
+            bPass = pQpu->m_flagC[lane] != 0;
+            break;
+        case VC4_QPU_COND_CC:
+            bPass = pQpu->m_flagC[lane] == 0;
+            break;
+        default:
+            bPass = false;
+            break;
+        }
+
+        if (bPass)
+        {
+            mask |= 1 << lane;
+        }
+    }
+
+    return mask;
+}
+
+static bool IsBranchTaken(const Vc4EmuQpu * pQpu, UINT condition)
+{
+    if (VC4_QPU_BRANCH_COND_ALWAYS == condition)
+    {
+        return true;
+    }
+
+    if (condition > VC4_QPU_BRANCH_COND_ANY_CC)
+    {
+        return false;
+    }
+
+    //
+    // Z, N or C flags, all or any lane, set or clear
+    //
+
+    const BYTE *pFlags = (condition < VC4_QPU_BRANCH_COND_ALL_NS) ? pQpu->m_flagZ :
+                         (condition < VC4_QPU_BRANCH_COND_ALL_CS) ? pQpu->m_flagN : pQpu->m_flagC;
+    bool        bAny = (condition & 2) != 0;
+    bool        bClear = (condition & 1) != 0;
+    UINT        numMatches = 0;
+
+    for (UINT lane = 0; lane < VC4EMU_QPU_LANES; lane++)
+    {
+        if ((pFlags[lane] != 0) != bClear)
+        {
+            numMatches++;
+        }
+    }
+
+    return bAny ? (numMatches > 0) : (numMatches == VC4EMU_QPU_LANES);
+}
+
+static void ReadVarying(Vc4EmuQpu * pQpu, UINT * pValue, UINT * pR5)
+{
+    const Vc4EmuInterpolation  *pInterpolation = pQpu->m_pInterpolation;
+    UINT                        varying = pQpu->m_nextVarying++;
+
+    if (!pInterpolation || (varying >= pInterpolation->m_numVaryings))
+    {
+        RtlZeroMemory(pValue, VC4EMU_QPU_LANES*sizeof(UINT));
+        RtlZeroMemory(pR5, VC4EMU_QPU_LANES*sizeof(UINT));
+        return;
+    }
+
+    //
+    // The shader computes varying * W + r5, flat shaded varyings come in r5
+    //
+
+    bool    bFlat = (pInterpolation->m_flatShadeFlags >> varying) & 1;
+    float   provoking = pInterpolation->m_pVertex[pInterpolation->m_provokingVertex]->m_varying[varying];
+
+    for (UINT lane = 0; lane < VC4EMU_QPU_LANES; lane++)
+    {
+        float   value = 0.0f;
+
+        if (bFlat)
+        {
+            pR5[lane] = Vc4EmuAsUint(provoking);
+        }
+        else
+        {
+            for (UINT i = 0; i < 3; i++)
+            {
+                value += pInterpolation->m_weight[i][lane]*pInterpolation->m_pVertex[i]->m_varying[varying];
+            }
+
+            pR5[lane] = 0;
+        }
+
+        pValue[lane] = Vc4EmuAsUint(value);
+    }
+}
+
+static void ReadVpm(Vc4EmuQpu * pQpu, UINT * pValue)
+{
+    if (pQpu->m_vpmReadAddress < ARRAYSIZE(pQpu->m_vpmIn))
+    {
+        RtlCopyMemory(pValue, pQpu->m_vpmIn[pQpu->m_vpmReadAddress], VC4EMU_QPU_LANES*sizeof(UINT));
+    }
+    else
+    {
+        RtlZeroMemory(pValue, VC4EMU_QPU_LANES*sizeof(UINT));
+    }
+
+    pQpu->m_vpmReadAddress += pQpu->m_vpmReadStride;
+}
+
+UINT
+Vc4Emulator::ReadUniform(
+    Vc4EmuQpu  *pQpu)
+{
+    BYTE   *pUniform = Translate(pQpu->m_uniformAddress, sizeof(UINT));
+    UINT    value = 0;
+
+    if (pUniform)
+    {
+        RtlCopyMemory(&value, pUniform, sizeof(value));
+    }
+    else if (Warn(WarningBadAddress))
+    {
+        ROS_LOG_ERROR(
+            "Shader reads uniform from invalid address. (address=0x%x)",
+            pQpu->m_uniformAddress);
+    }
+
+    pQpu->m_uniformAddress += sizeof(UINT);
+
+    return value;
+}
+
+void
+Vc4Emulator::ReadQpuRegister(
+    Vc4EmuQpu  *pQpu,
+    bool        bRegFileA,
+    UINT        raddr,
+    UINT       *pValue,
+    UINT       *pR5,
+    bool       *pbR5Written)
+{
+    if (raddr < 32)
+    {
+        RtlCopyMemory(pValue, bRegFileA ? pQpu->m_regFileA[raddr] : pQpu->m_regFileB[raddr], VC4EMU_QPU_LANES*sizeof(UINT));
+        return;
+    }
+
+    UINT    value = 0;
+
+    switch (raddr)
+    {
+    case VC4_QPU_RADDR_UNIFORM:
+        value = ReadUniform(pQpu);
+        break;
+
+    case VC4_QPU_RADDR_VERYING:
+        ReadVarying(pQpu, pValue, pR5);
+        *pbR5Written = true;
+        return;
+
+    case VC4_QPU_RADDR_ELEMENT_NUMBER:
+        if (bRegFileA)
+        {
+            for (UINT lane = 0; lane < VC4EMU_QPU_LANES; lane++)
+            {
+                pValue[lane] = lane;
+            }
+            return;
+        }
+        break;
+
+    case VC4_QPU_RADDR_PIXEL_COORD_X:
+        RtlCopyMemory(pValue, bRegFileA ? pQpu->m_pixelX : pQpu->m_pixelY, VC4EMU_QPU_LANES*sizeof(UINT));
+        return;
+
+    case VC4_QPU_RADDR_VPM:
+        ReadVpm(pQpu, pValue);
+        return;
+
+    default:
+        //
+        // QPU number, flags, VPM status and mutex read as 0
+        //
+        break;
+    }
+
+    for (UINT lane = 0; lane < VC4EMU_QPU_LANES; lane++)
+    {
+        pValue[lane] = value;
+    }
+}
+
+void
+Vc4Emulator::WriteQpuResult(
+    Vc4EmuQpu  *pQpu,
+    UINT        waddr,
+    bool        bRegFileA,
+    UINT        laneMask,
+    UINT        byteMask,
+    const UINT *pValue)
+{
+    if (0 == laneMask)
+    {
+        return;
+    }
+
+    if (waddr < 32)
+    {
+        NT_ASSERT(pQpu->m_numPendingWrites < ARRAYSIZE(pQpu->m_pendingWrites));
+
+        Vc4EmuQpuWrite *pWrite = &pQpu->m_pendingWrites[pQpu->m_numPendingWrites++];
+
+        pWrite->m_address = waddr;
+        pWrite->m_bRegFileA = bRegFileA;
+        pWrite->m_laneMask = laneMask;
+        pWrite->m_byteMask = byteMask;
+
+        RtlCopyMemory(pWrite->m_value, pValue, sizeof(pWrite->m_value));
+
+        return;
+    }
+
+    UINT    value[VC4EMU_QPU_LANES];
+
+    switch (waddr)
+    {
+    case VC4_QPU_WADDR_ACC0:
+    case VC4_QPU_WADDR_ACC1:
+    case VC4_QPU_WADDR_ACC2:
+    case VC4_QPU_WADDR_ACC3:
+        MergeLanes(pQpu->m_acc[waddr - VC4_QPU_WADDR_ACC0], pValue, laneMask, byteMask);
+        break;
+
+    case VC4_QPU_WADDR_ACC5:
+        //
+        // Regfile A replicates the first pixel of each quad, B the first lane
+        //
+
+        for (UINT lane = 0; lane < VC4EMU_QPU_LANES; lane++)
+        {
+            value[lane] = pValue[bRegFileA ? (lane & ~3) : 0];
+        }
+
+        MergeLanes(pQpu->m_acc[5], value, laneMask, byteMask);
+        break;
+
+    case VC4_QPU_WADDR_UNIFORM_ADDRESS:
+        pQpu->m_uniformAddress = pValue[0];
+        break;
+
+    case VC4_QPU_WADDR_TLB_Z:
+        for (UINT lane = 0; lane < VC4EMU_QPU_LANES; lane++)
+        {
+            value[lane] = pValue[lane] & 0xFFFFFF;
+        }
+
+        MergeLanes(pQpu->m_tlbZ, value, laneMask, 0xF);
+        pQpu->m_tlbZMask |= laneMask;
+        break;
+
+    case VC4_QPU_WADDR_TLB_COLOUR_MS:
+    case VC4_QPU_WADDR_TLB_COLOUR_ALL:
+        MergeLanes(pQpu->m_tlbColor, pValue, laneMask, byteMask);
+        pQpu->m_tlbColorMask |= laneMask;
+        break;
+
+    case VC4_QPU_WADDR_VPM:
+        if (pQpu->m_vpmWriteAddress < ARRAYSIZE(pQpu->m_vpmOut))
+        {
+            MergeLanes(pQpu->m_vpmOut[pQpu->m_vpmWriteAddress], pValue, laneMask, byteMask);
+        }
+
+        pQpu->m_vpmWriteAddress += pQpu->m_vpmWriteStride;
+        break;
+
+    case VC4_QPU_WADDR_VPMVCD_RD_SETUP:
+        {
+            //
+            // Only 32 bit horizontal access, one VPM row per read or write
+            //
+
+            UINT    stride = (pValue[0] >> 12) & 0x3F;
+
+            if (bRegFileA)
+            {
+                pQpu->m_vpmReadAddress = pValue[0] & 0x3F;
+                pQpu->m_vpmReadStride = stride ? stride : 64;
+            }
+            else
+            {
+                pQpu->m_vpmWriteAddress = pValue[0] & 0x3F;
+                pQpu->m_vpmWriteStride = stride ? stride : 64;
+            }
+        }
+        break;
+
+    case VC4_QPU_WADDR_SFU_RECIP:
+    case VC4_QPU_WADDR_SFU_RECIPSQRT:
+    case VC4_QPU_WADDR_SFU_EXP:
+    case VC4_QPU_WADDR_SFU_LOG:
+        for (UINT lane = 0; lane < VC4EMU_QPU_LANES; lane++)
+        {
+            double  x = Vc4EmuAsFloat(pValue[lane]);
+            double  result;
+
+            switch (waddr)
+            {
+            case VC4_QPU_WADDR_SFU_RECIP:
+                result = 1.0 / x;
+                break;
+            case VC4_QPU_WADDR_SFU_RECIPSQRT:
+                result = 1.0 / sqrt(x);
+                break;
+            case VC4_QPU_WADDR_SFU_EXP:
+                result = pow(2.0, x);
+                break;
+            default:
+                result = log(x) / log(2.0);
+                break;
+            }
+
+            value[lane] = Vc4EmuAsUint((float)result);
+        }
+
+        MergeLanes(pQpu->m_acc[4], value, laneMask, 0xF);
+        break;
+
+    case VC4_QPU_WADDR_TMU0_S:
+    case VC4_QPU_WADDR_TMU0_T:
+    case VC4_QPU_WADDR_TMU0_R:
+    case VC4_QPU_WADDR_TMU0_B:
+    case VC4_QPU_WADDR_TMU1_S:
+    case VC4_QPU_WADDR_TMU1_T:
+    case VC4_QPU_WADDR_TMU1_R:
+    case VC4_QPU_WADDR_TMU1_B:
+        {
+            UINT        tmu = (waddr - VC4_QPU_WADDR_TMU0_S) / 4;
+            UINT        coordinate = (waddr - VC4_QPU_WADDR_TMU0_S) % 4;
+            Vc4EmuTmu  *pTmu = &pQpu->m_tmu[tmu];
+
+            MergeLanes(pTmu->m_coordinate[coordinate], pValue, laneMask, 0xF);
+            pTmu->m_written |= 1 << coordinate;
+
+            //
+            // Writing S submits the request
+            //
+
+            if (0 == coordinate)
+            {
+                SubmitTmuRequest(pQpu, tmu, laneMask);
+            }
+        }
+        break;
+
+    default:
+        //
+        // Host interrupt, TLB stencil and alpha mask, VPM DMA and mutex are
+        // not used by the driver's shaders
+        //
+        break;
+    }
+}
+
+bool
+Vc4Emulator::ExecuteQpuInstruction(
+    Vc4EmuQpu              *pQpu,
+    VC4_QPU_INSTRUCTION     instruction)
+{
+    UINT    sig = (UINT)VC4_QPU_GET_SIG(instruction);
+    bool    bPm = VC4_QPU_IS_PM_SET(instruction);
+    bool    bWriteSwap = VC4_QPU_IS_WRITESWAP_SET(instruction);
+    UINT    pack = (UINT)VC4_QPU_GET_PACK(instruction);
+    UINT    waddrAdd = (UINT)VC4_QPU_GET_WADDR_ADD(instruction);
+    UINT    waddrMul = (UINT)VC4_QPU_GET_WADDR_MUL(instruction);
+    UINT    addOp = VC4_QPU_OPCODE_ADD_NOP;
+    UINT    mulOp = VC4_QPU_OPCODE_MUL_NOP;
+    UINT    addResult[VC4EMU_QPU_LANES];
+    UINT    mulResult[VC4EMU_QPU_LANES];
+    BYTE    carry[VC4EMU_QPU_LANES] = { 0 };
+    UINT    r5[VC4EMU_QPU_LANES];
+    bool    bR5Written = false;
+    bool    bFlagsFromAdd;
+
+    if (VC4_QPU_SIG_LOAD_IMMEDIATE == sig)
+    {
+        //
+        // The immediate type overlaps the unpack field
+        //
+
+        UINT    type = (UINT)((instruction >> VC4_QPU_IMMEDIATE_TYPE_SHIFT) & 7);
+        UINT    immediate = (UINT)VC4_QPU_GET_IMMEDIATE_32(instruction);
+
+        CommitPendingWrites(pQpu);
+
+        if (VC4_QPU_IMMEDIATE_TYPE_SEMAPHORE == type)
+        {
+            //
+            // Instances run one at a time, there is nothing to synchronize
+            //
+
+            return true;
+        }
+
+        for (UINT lane = 0; lane < VC4EMU_QPU_LANES; lane++)
+        {
+            UINT    value = immediate;
+
+            if ((VC4_QPU_IMMEDIATE_TYPE_PER_ELEMENT_SIGNED == type) ||
+                (VC4_QPU_IMMEDIATE_TYPE_PER_ELEMENT_UNSIGNED == type))
+            {
+                value = (((immediate >> (16 + lane)) & 1) << 1) | ((immediate >> lane) & 1);
+
+                if ((VC4_QPU_IMMEDIATE_TYPE_PER_ELEMENT_SIGNED == type) && (value & 2))
+                {
+                    value |= ~3u;
+                }
+            }
+            else if (VC4_QPU_IMMEDIATE_TYPE_32 != type)
+            {
+                if (Warn(WarningQpuFault))
+                {
+                    ROS_LOG_ERROR(
+                        "Unsupported load immediate type. (type=%d)",
+                        type);
+                }
+
+                return false;
+            }
+
+            addResult[lane] = value;
+            mulResult[lane] = value;
+        }
+
+        bFlagsFromAdd = true;
+    }
+    else
+    {
+        //
+        // Register file reads happen before the writes of the previous
+        // instruction land
+        //
+
+        UINT    raddrA = (UINT)VC4_QPU_GET_RADDR_A(instruction);
+        UINT    raddrB = (UINT)VC4_QPU_GET_RADDR_B(instruction);
+        bool    bSmallImmediate = (VC4_QPU_SIG_ALU_WITH_RADDR_B == sig);
+        UINT    regA[VC4EMU_QPU_LANES];
+        UINT    regB[VC4EMU_QPU_LANES];
+
+        ReadQpuRegister(pQpu, true, raddrA, regA, r5, &bR5Written);
+
+        if (bSmallImmediate)
+        {
+            UINT    value;
+
+            if (raddrB < 16)
+            {
+                value = raddrB;
+            }
+            else if (raddrB < 32)
+            {
+                value = (UINT)((INT)raddrB - 32);
+            }
+            else if (raddrB < 40)
+            {
+                value = Vc4EmuAsUint((float)(1 << (raddrB - 32)));
+            }
+            else if (raddrB < 48)
+            {
+                value = Vc4EmuAsUint(1.0f / (float)(1 << (48 - raddrB)));
+            }
+            else
+            {
+                value = 0;
+            }
+
+            for (UINT lane = 0; lane < VC4EMU_QPU_LANES; lane++)
+            {
+                regB[lane] = value;
+            }
+        }
+        else
+        {
+            ReadQpuRegister(pQpu, false, raddrB, regB, r5, &bR5Written);
+        }
+
+        CommitPendingWrites(pQpu);
+
+        addOp = (UINT)VC4_QPU_GET_OPCODE_ADD(instruction);
+        mulOp = (UINT)VC4_QPU_GET_OPCODE_MUL(instruction);
+
+        UINT    unpack = (UINT)VC4_QPU_GET_UNPACK(instruction);
+        UINT    mux[4] =
+                {
+                    (UINT)VC4_QPU_GET_ADD_A(instruction),
+                    (UINT)VC4_QPU_GET_ADD_B(instruction),
+                    (UINT)VC4_QPU_GET_MUL_A(instruction),
+                    (UINT)VC4_QPU_GET_MUL_B(instruction)
+                };
+        UINT    operand[4][VC4EMU_QPU_LANES];
+
+        for (UINT i = 0; i < 4; i++)
+        {
+            const UINT *pSource = (VC4_QPU_ALU_REG_A == mux[i]) ? regA :
+                                  (VC4_QPU_ALU_REG_B == mux[i]) ? regB : pQpu->m_acc[mux[i]];
+            bool        bFloat = (i < 2) ? IsAddOpFloatInput(addOp) : (VC4_QPU_OPCODE_MUL_FMUL == mulOp);
+            bool        bUnpack = false;
+
+            //
+            // Unpack applies to regfile A reads, or to r4 with pm set, r4 is
+            // always unpacked as float
+            //
+
+            if (bPm)
+            {
+                bUnpack = (VC4_QPU_ALU_R4 == mux[i]);
+                bFloat = true;
+            }
+            else
+            {
+                bUnpack = (VC4_QPU_ALU_REG_A == mux[i]);
+            }
+
+            for (UINT lane = 0; lane < VC4EMU_QPU_LANES; lane++)
+            {
+                operand[i][lane] = bUnpack ? UnpackOperand(pSource[lane], unpack, bFloat) : pSource[lane];
+            }
+        }
+
+        //
+        // Small immediates 48-63 rotate the mul inputs
+        //
+
+        if (bSmallImmediate && (raddrB >= 48))
+        {
+            UINT    rotate = (48 == raddrB) ? (pQpu->m_acc[5][0] & 15) : (raddrB - 48);
+
+            for (UINT i = 2; i < 4; i++)
+            {
+                UINT    rotated[VC4EMU_QPU_LANES];
+
+                for (UINT lane = 0; lane < VC4EMU_QPU_LANES; lane++)
+                {
+                    rotated[lane] = operand[i][(lane - rotate) & 15];
+                }
+
+                RtlCopyMemory(operand[i], rotated, sizeof(rotated));
+            }
+        }
+
+        for (UINT lane = 0; lane < VC4EMU_QPU_LANES; lane++)
+        {
+            addResult[lane] = ExecuteAddOp(addOp, operand[0][lane], operand[1][lane], &carry[lane]);
+            mulResult[lane] = ExecuteMulOp(mulOp, operand[2][lane], operand[3][lane]);
+        }
+
+        bFlagsFromAdd = (VC4_QPU_OPCODE_ADD_NOP != addOp) || (VC4_QPU_OPCODE_MUL_NOP == mulOp);
+    }
+
+    UINT    addMask = GetConditionMask(pQpu, (UINT)VC4_QPU_GET_COND_ADD(instruction));
+    UINT    mulMask = GetConditionMask(pQpu, (UINT)VC4_QPU_GET_COND_MUL(instruction));
+    bool    bAddFloat = IsAddOpFloatOutput(addOp);
+    bool    bMulFloat = (VC4_QPU_OPCODE_MUL_FMUL == mulOp);
+
+    //
+    // Flags are set from the add result, or the mul result when add is a nop
+    //
+
+    if (VC4_QPU_IS_SETFLAGS_SET(instruction))
+    {
+        const UINT *pResult = bFlagsFromAdd ? addResult : mulResult;
+        bool        bFloat = bFlagsFromAdd ? bAddFloat : bMulFloat;
+        UINT        mask = bFlagsFromAdd ? addMask : mulMask;
+
+        for (UINT lane = 0; lane < VC4EMU_QPU_LANES; lane++)
+        {
+            if (0 == (mask & (1 << lane)))
+            {
+                continue;
+            }
+
+            UINT    value = pResult[lane];
+
+            if (bFloat)
+            {
+                pQpu->m_flagZ[lane] = (0.0f == Vc4EmuAsFloat(value));
+                pQpu->m_flagN[lane] = (Vc4EmuAsFloat(value) < 0.0f);
+                pQpu->m_flagC[lane] = (Vc4EmuAsFloat(value) > 0.0f);
+            }
+            else
+            {
+                pQpu->m_flagZ[lane] = (0 == value);
+                pQpu->m_flagN[lane] = ((INT)value < 0);
+                pQpu->m_flagC[lane] = bFlagsFromAdd ? carry[lane] : 0;
+            }
+        }
+    }
+
+    //
+    // Pack applies to the regfile A write with pm clear, and to the mul
+    // result with pm set
+    //
+
+    bool    bAddToRegFileA = !bWriteSwap;
+    UINT    addByteMask = 0xF;
+    UINT    mulByteMask = 0xF;
+
+    if (bPm)
+    {
+        for (UINT lane = 0; lane < VC4EMU_QPU_LANES; lane++)
+        {
+            mulResult[lane] = PackResult(mulResult[lane], pack, true, true, &mulByteMask);
+        }
+    }
+    else if (pack && (bAddToRegFileA ? (waddrAdd < 32) : (waddrMul < 32)))
+    {
+        UINT   *pResult = bAddToRegFileA ? addResult : mulResult;
+        UINT   *pByteMask = bAddToRegFileA ? &addByteMask : &mulByteMask;
+        bool    bFloat = bAddToRegFileA ? bAddFloat : bMulFloat;
+
+        for (UINT lane = 0; lane < VC4EMU_QPU_LANES; lane++)
+        {
+            pResult[lane] = PackResult(pResult[lane], pack, false, bFloat, pByteMask);
+        }
+    }
+
+    WriteQpuResult(pQpu, waddrAdd, bAddToRegFileA, addMask, addByteMask, addResult);
+    WriteQpuResult(pQpu, waddrMul, !bAddToRegFileA, mulMask, mulByteMask, mulResult);
+
+    //
+    // Varying reads and loads land in r5 and r4 at the end of the instruction
+    //
+
+    if (bR5Written)
+    {
+        RtlCopyMemory(pQpu->m_acc[5], r5, sizeof(r5));
+    }
+
+    switch (sig)
+    {
+    case VC4_QPU_SIG_COLOR_LOAD:
+    case VC4_QPU_SIG_COLOR_LOAD_AND_PROGRAM_END:
+        RtlCopyMemory(pQpu->m_acc[4], pQpu->m_tileColor, sizeof(pQpu->m_tileColor));
+        break;
+
+    case VC4_QPU_SIG_LOAD_TMU0:
+    case VC4_QPU_SIG_LOAD_TMU1:
+        {
+            Vc4EmuTmu  *pTmu = &pQpu->m_tmu[sig - VC4_QPU_SIG_LOAD_TMU0];
+
+            if (0 == pTmu->m_fifoCount)
+            {
+                if (Warn(WarningQpuFault))
+                {
+                    ROS_LOG_ERROR("Shader loads from an empty TMU FIFO");
+                }
+
+                RtlZeroMemory(pQpu->m_acc[4], sizeof(pQpu->m_acc[4]));
+                break;
+            }
+
+            RtlCopyMemory(pQpu->m_acc[4], pTmu->m_fifo[pTmu->m_fifoHead], sizeof(pQpu->m_acc[4]));
+
+            pTmu->m_fifoHead = (pTmu->m_fifoHead + 1) % Vc4EmuTmu::kFifoSize;
+            pTmu->m_fifoCount--;
+        }
+        break;
+
+    case VC4_QPU_SIG_COVERAGE_LOAD:
+    case VC4_QPU_SIG_ALPAH_MASK_LOAD:
+        RtlZeroMemory(pQpu->m_acc[4], sizeof(pQpu->m_acc[4]));
+        break;
+
+    default:
+        break;
+    }
+
+    return true;
+}
+
+bool
+Vc4Emulator::RunQpu(
+    Vc4EmuQpu  *pQpu,
+    UINT        codeAddress,
+    UINT        uniformAddress)
+{
+    UINT    available = 0;
+    BYTE   *pCode = Translate(codeAddress, sizeof(VC4_QPU_INSTRUCTION), &available);
+
+    if (!pCode)
+    {
+        if (Warn(WarningBadAddress))
+        {
+            ROS_LOG_ERROR(
+                "Invalid shader code address. (address=0x%x)",
+                codeAddress);
+        }
+
+        return false;
+    }
+
+    UINT    numInstructions = available / sizeof(VC4_QPU_INSTRUCTION);
+    UINT    pc = 0;
+    UINT    branchTarget = 0;
+    UINT    branchDelay = 0;
+    UINT    endDelay = 0;
+
+    pQpu->m_uniformAddress = uniformAddress;
+
+    for (UINT count = 0; ; count++)
+    {
+        if (kMaxQpuInstructions == count)
+        {
+            if (Warn(WarningQpuInstructionLimit))
+            {
+                ROS_LOG_ERROR(
+                    "Shader does not end. (address=0x%x)",
+                    codeAddress);
+            }
+
+            return false;
+        }
+
+        if (pc >= numInstructions)
+        {
+            if (Warn(WarningQpuFault))
+            {
+                ROS_LOG_ERROR(
+                    "Shader runs out of memory. (address=0x%x, pc=%d)",
+                    codeAddress,
+                    pc);
+            }
+
+            return false;
+        }
+
+        VC4_QPU_INSTRUCTION instruction;
+
+        RtlCopyMemory(&instruction, pCode + pc*sizeof(instruction), sizeof(instruction));
+
+        pc++;
+
+        UINT    sig = (UINT)VC4_QPU_GET_SIG(instruction);
+
+        if (VC4_QPU_SIG_BRANCH == sig)
+        {
+            //
+            // Relative branches are from the instruction after the delay
+            // slots, which is also the link address
+            //
+
+            UINT    link = codeAddress + (pc + kBranchDelaySlots)*sizeof(VC4_QPU_INSTRUCTION);
+            UINT    target = (UINT)VC4_QPU_GET_IMMEDIATE_32(instruction);
+            UINT    value[VC4EMU_QPU_LANES];
+
+            if (VC4_QPU_IS_BRANCH_RELATIVE(instruction))
+            {
+                target += link;
+            }
+
+            if (VC4_QPU_IS_BRANCH_USE_RADDR_A(instruction))
+            {
+                target += pQpu->m_regFileA[VC4_QPU_GET_BRANCH_RADDR_A(instruction)][0];
+            }
+
+            CommitPendingWrites(pQpu);
+
+            for (UINT lane = 0; lane < VC4EMU_QPU_LANES; lane++)
+            {
+                value[lane] = link;
+            }
+
+            bool    bWriteSwap = VC4_QPU_IS_WRITESWAP_SET(instruction);
+
+            WriteQpuResult(pQpu, (UINT)VC4_QPU_GET_WADDR_ADD(instruction), !bWriteSwap, 0xFFFF, 0xF, value);
+            WriteQpuResult(pQpu, (UINT)VC4_QPU_GET_WADDR_MUL(instruction), bWriteSwap, 0xFFFF, 0xF, value);
+
+            if (IsBranchTaken(pQpu, (UINT)VC4_QPU_GET_BRANCH_COND(instruction)))
+            {
+                if ((target < codeAddress) || ((target - codeAddress) % sizeof(VC4_QPU_INSTRUCTION)))
+                {
+                    if (Warn(WarningQpuFault))
+                    {
+                        ROS_LOG_ERROR(
+                            "Shader branches to invalid address. (address=0x%x, target=0x%x)",
+                            codeAddress,
+                            target);
+                    }
+
+                    return false;
+                }
+
+                branchTarget = (target - codeAddress) / sizeof(VC4_QPU_INSTRUCTION);
+                branchDelay = kBranchDelaySlots + 1;
+            }
+        }
+        else if (!ExecuteQpuInstruction(pQpu, instruction))
+        {
+            return false;
+        }
+
+        if ((VC4_QPU_SIG_PROGRAM_END == sig) || (VC4_QPU_SIG_COLOR_LOAD_AND_PROGRAM_END == sig))
+        {
+            endDelay = kProgramEndDelaySlots + 1;
+        }
+
+        if (endDelay && (0 == --endDelay))
+        {
+            CommitPendingWrites(pQpu);
+            return true;
+        }
+
+        if (branchDelay && (0 == --branchDelay))
+        {
+            pc = branchTarget;
+        }
+    }
+}
+
+void
+Vc4Emulator::LoadAttributes(
+    Vc4EmuQpu                  *pQpu,
+    const Vc4EmuShaderRecord   *pShaderRecord,
+    bool                        bCoordinateShader,
+    const UINT                 *pIndex,
+    UINT                        numVertices)
+{
+    //
+    // Attributes are loaded into VPM rows of 32 bits, one vertex per lane
+    //
+
+    UINT    selectBits = bCoordinateShader ?
+                            pShaderRecord->m_gl.CoordinateShaderAttributeArraySelectBits :
+                            pShaderRecord->m_gl.VertexShaderAttributeArraySelectBits;
+
+    for (UINT i = 0; i < pShaderRecord->m_numAttributes; i++)
+    {
+        if (0 == (selectBits & (1 << i)))
+        {
+            continue;
+        }
+
+        const VC4VertexAttribute   *pAttribute = &pShaderRecord->m_attributes[i];
+        UINT                        size = pAttribute->NumberOfBytesMinusOne + 1;
+        UINT                        offset = bCoordinateShader ? pAttribute->CoordinateShaderVPMOffset : pAttribute->VertexShaderVPMOffset;
+
+        for (UINT vertex = 0; vertex < numVertices; vertex++)
+        {
+            UINT    address = pAttribute->VertexBaseMemoryAddress + pIndex[vertex]*pAttribute->MemoryStride;
+            BYTE   *pData = Translate(address, size);
+
+            if (!pData)
+            {
+                if (Warn(WarningBadAddress))
+                {
+                    ROS_LOG_ERROR(
+                        "Invalid vertex attribute address. (address=0x%x, size=%d)",
+                        address,
+                        size);
+                }
+                continue;
+            }
+
+            for (UINT byte = 0; byte < size; byte++)
+            {
+                UINT    row = (offset + byte) / sizeof(UINT);
+                UINT    shift = 8*((offset + byte) % sizeof(UINT));
+
+                if (row < ARRAYSIZE(pQpu->m_vpmIn))
+                {
+                    pQpu->m_vpmIn[row][vertex] &= ~(0xFF << shift);
+                    pQpu->m_vpmIn[row][vertex] |= pData[byte] << shift;
+                }
+            }
+        }
+    }
+}
+
+//
+// TMU
+//
+
+static UINT WrapTexelCoordinate(INT coordinate, UINT size, UINT wrap)
+{
+    switch (wrap)
+    {
+    case VC4_TEX_REPEAT:
+        coordinate %= (INT)size;
+        return (coordinate < 0) ? (coordinate + size) : coordinate;
+
+    case VC4_TEX_MIRROR:
+        {
+            coordinate %= (INT)(2*size);
+
+            if (coordinate < 0)
+            {
+                coordinate += 2*size;
+            }
+
+            return ((UINT)coordinate < size) ? coordinate : (2*size - 1 - coordinate);
+        }
+
+    default:
+        //
+        // Border color is not supported, clamps to the edge
+        //
+        return (UINT)min(max(coordinate, 0), (INT)size - 1);
+    }
+}
+
+static UINT FetchTexel(const BYTE * pImage, UINT type, UINT memoryFormat, UINT x, UINT y, UINT width)
+{
+    UINT    bytesPerPixel = (VC4_TEX_RGB565 == type) ? sizeof(USHORT) : sizeof(UINT);
+    UINT    offset = Vc4EmuGetPixelOffset(memoryFormat, x, y, width, bytesPerPixel, width*bytesPerPixel);
+
+    if (VC4_TEX_RGB565 == type)
+    {
+        USHORT  texel;
+        UINT    r;
+        UINT    g;
+        UINT    b;
+
+        RtlCopyMemory(&texel, pImage + offset, sizeof(texel));
+
+        r = (texel >> 11) & 0x1F;
+        g = (texel >> 5) & 0x3F;
+        b = texel & 0x1F;
+
+        return 0xFF000000 | (((b << 3) | (b >> 2)) << 16) | (((g << 2) | (g >> 4)) << 8) | ((r << 3) | (r >> 2));
+    }
+
+    UINT    texel;
+
+    RtlCopyMemory(&texel, pImage + offset, sizeof(texel));
+
+    return (VC4_TEX_RGBX8888 == type) ? (texel | 0xFF000000) : texel;
+}
+
+UINT
+Vc4Emulator::SampleTexture(
+    UINT    config0,
+    UINT    config1,
+    float   s,
+    float   t)
+{
+    VC4TextureConfigParameter0  parameter0;
+    VC4TextureConfigParameter1  parameter1;
+
+    parameter0.UInt0 = config0;
+    parameter1.UInt0 = config1;
+
+    UINT    type = parameter0.TYPE | (parameter1.TYPE4 << 4);
+    UINT    width = parameter1.WIDTH ? parameter1.WIDTH : 2048;
+    UINT    height = parameter1.HEIGHT ? parameter1.HEIGHT : 2048;
+    UINT    bytesPerPixel;
+    UINT    memoryFormat;
+
+    switch (type)
+    {
+    case VC4_TEX_RGBA8888:
+    case VC4_TEX_RGBX8888:
+    case VC4_TEX_RGB565:
+        //
+        // Tiled formats use LT-format for levels up to 4 utiles wide or high
+        //
+
+        bytesPerPixel = (VC4_TEX_RGB565 == type) ? sizeof(USHORT) : sizeof(UINT);
+        memoryFormat = (UINT)VC4_MEMORY_FORMAT::T_FORMAT;
+
+        if ((width <= 4*(VC4_MICRO_TILE_WIDTH_BYTES / bytesPerPixel)) || (height <= 4*VC4_MICRO_TILE_HEIGHT))
+        {
+            memoryFormat = (UINT)VC4_MEMORY_FORMAT::LT_FORMAT;
+        }
+        break;
+
+    case VC4_TEX_RGBA32R:
+        bytesPerPixel = sizeof(UINT);
+        memoryFormat = (UINT)VC4_MEMORY_FORMAT::LINEAR;
+        break;
+
+    default:
+        if (Warn(WarningUnsupportedFormat))
+        {
+            ROS_LOG_ERROR(
+                "Unsupported texture type. (type=%d)",
+                type);
+        }
+        return 0;
+    }
+
+    UINT    address = parameter0.BASE << 12;
+    BYTE   *pImage = Translate(address, Vc4EmuGetImageSize(memoryFormat, width, height, bytesPerPixel, width*bytesPerPixel));
+
+    if (!pImage)
+    {
+        if (Warn(WarningBadAddress))
+        {
+            ROS_LOG_ERROR(
+                "Invalid texture address. (address=0x%x, width=%d, height=%d)",
+                address,
+                width,
+                height);
+        }
+        return 0;
+    }
+
+    //
+    // Level 0 only, the magnification filter selects nearest or bilinear
+    //
+
+    float   u = s*width;
+    float   v = t*height;
+
+    if (VC4_TEX_MAG_NEAREST == parameter1.MAGFILT)
+    {
+        return FetchTexel(
+                    pImage,
+                    type,
+                    memoryFormat,
+                    WrapTexelCoordinate((INT)floor(u), width, parameter1.WRAP_S),
+                    WrapTexelCoordinate((INT)floor(v), height, parameter1.WRAP_T),
+                    width);
+    }
+
+    u -= 0.5f;
+    v -= 0.5f;
+
+    INT     x0 = (INT)floor(u);
+    INT     y0 = (INT)floor(v);
+    float   fx = u - x0;
+    float   fy = v - y0;
+    UINT    x[2] = { WrapTexelCoordinate(x0, width, parameter1.WRAP_S), WrapTexelCoordinate(x0 + 1, width, parameter1.WRAP_S) };
+    UINT    y[2] = { WrapTexelCoordinate(y0, height, parameter1.WRAP_T), WrapTexelCoordinate(y0 + 1, height, parameter1.WRAP_T) };
+    UINT    texel[4];
+
+    for (UINT i = 0; i < 4; i++)
+    {
+        texel[i] = FetchTexel(pImage, type, memoryFormat, x[i & 1], y[i >> 1], width);
+    }
+
+    UINT    result = 0;
+
+    for (UINT shift = 0; shift < 32; shift += 8)
+    {
+        float   top = ((texel[0] >> shift) & 0xFF)*(1.0f - fx) + ((texel[1] >> shift) & 0xFF)*fx;
+        float   bottom = ((texel[2] >> shift) & 0xFF)*(1.0f - fx) + ((texel[3] >> shift) & 0xFF)*fx;
+
+        result |= ((UINT)(top*(1.0f - fy) + bottom*fy + 0.5f) & 0xFF) << shift;
+    }
+
+    return result;
+}
+
+void
+Vc4Emulator::SubmitTmuRequest(
+    Vc4EmuQpu  *pQpu,
+    UINT        tmu,
+    UINT        laneMask)
+{
+    Vc4EmuTmu  *pTmu = &pQpu->m_tmu[tmu];
+
+    //
+    // Config parameters come from the uniforms, P2 and P3 only for cube maps
+    //
+
+    UINT    config0 = ReadUniform(pQpu);
+    UINT    config1 = ReadUniform(pQpu);
+
+    if (pTmu->m_written & (1 << 2))
+    {
+        ReadUniform(pQpu);
+        ReadUniform(pQpu);
+    }
+
+    pTmu->m_written = 0;
+
+    if (Vc4EmuTmu::kFifoSize == pTmu->m_fifoCount)
+    {
+        if (Warn(WarningTmuOverflow))
+        {
+            ROS_LOG_ERROR("Shader overflows the TMU FIFO");
+        }
+
+        return;
+    }
+
+    UINT   *pResult = pTmu->m_fifo[(pTmu->m_fifoHead + pTmu->m_fifoCount) % Vc4EmuTmu::kFifoSize];
+
+    for (UINT lane = 0; lane < VC4EMU_QPU_LANES; lane++)
+    {
+        pResult[lane] = 0;
+
+        if (laneMask & (1 << lane))
+        {
+            pResult[lane] = SampleTexture(
+                                config0,
+                                config1,
+                                Vc4EmuAsFloat(pTmu->m_coordinate[0][lane]),
+                                Vc4EmuAsFloat(pTmu->m_coordinate[1][lane]));
+        }
+    }
+
+    pTmu->m_fifoCount++;
+}
@@ -188,11 +188,15 @@ void RosUmdDevice::Standup()
     //
 
     CreateInternalBuffer(&m_dummyBuffer, PAGE_SIZE);
+
+    m_shaderCache.Standup(this);
 }
 
 //----------------------------------------------------------------------------------------------------------------------------------
 void RosUmdDevice::Teardown()
 {
+    m_shaderCache.Teardown();
+
     if( m_hContext != NULL )
     {
         D3DDDICB_DESTROYCONTEXT destroyContext =
@@ -1693,7 +1697,9 @@ void RosUmdDevice::RefreshPipelineState(UINT vertexOffset)
     m_commandBuffer.SetPatchLocation(
         pCurPatchLocation,
         allocListIndex,
-        vc4NVShaderStateRecordOffset + offsetof(VC4NVShaderStateRecord, FragmentShaderCodeAddress));
+        vc4NVShaderStateRecordOffset + offsetof(VC4NVShaderStateRecord, FragmentShaderCodeAddress),
+        0,
+        m_pixelShader->GetCodeOffset());
 
     // TODO[indyz] : Set FragmentShaderUniformsAddress to constant buffer's address
     //
@@ -1902,7 +1908,9 @@ void RosUmdDevice::RefreshPipelineState(UINT vertexOffset)
     m_commandBuffer.SetPatchLocation(
         pCurPatchLocation,
         allocListIndex,
-        vc4GLShaderStateRecordOffset + offsetof(VC4GLShaderStateRecord, FragmentShaderCodeAddress));
+        vc4GLShaderStateRecordOffset + offsetof(VC4GLShaderStateRecord, FragmentShaderCodeAddress),
+        0,
+        m_pixelShader->GetCodeOffset());
 
     //
     // Set Fragment Shader Uniforms Address
@@ -1944,7 +1952,9 @@ void RosUmdDevice::RefreshPipelineState(UINT vertexOffset)
     m_commandBuffer.SetPatchLocation(
         pCurPatchLocation,
         allocListIndex,
-        vc4GLShaderStateRecordOffset + offsetof(VC4GLShaderStateRecord, VertexShaderCodeAddress));
+        vc4GLShaderStateRecordOffset + offsetof(VC4GLShaderStateRecord, VertexShaderCodeAddress),
+        0,
+        m_vertexShader->GetCodeOffset());
 
     //
     // Set Vertex Shader Uniform Address
@@ -1979,7 +1989,7 @@ void RosUmdDevice::RefreshPipelineState(UINT vertexOffset)
         allocListIndex,
         vc4GLShaderStateRecordOffset + offsetof(VC4GLShaderStateRecord, CoordinateShaderCodeAddress),
         0,
-        m_vertexShader->m_vc4CoordinateShaderOffset);
+        m_vertexShader->GetCoordinateShaderOffset());
 
     //
     // Set Vertex Shader Uniform Address
@@ -15,6 +15,7 @@
 #include "RosUmdResource.h"
 
 #include "RosUmdShader.h"
+#include "RosUmdShaderCache.h"
 
 #include "RosUmdBlendState.h"
 #include "RosUmdRasterizerState.h"
@@ -166,6 +167,8 @@ public:
 
     RosUmdResource                  m_dummyBuffer;
 
+    RosUmdShaderCache               m_shaderCache;
+
 public:
 
     //
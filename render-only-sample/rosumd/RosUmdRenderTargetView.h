@@ -4,6 +4,7 @@ class RosUmdRenderTargetView
 {
 friend class RosUmdDevice;
 friend class RosCompiler;
+friend class RosUmdPipelineShader;
 
 public:
 
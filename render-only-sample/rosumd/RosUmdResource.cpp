@@ -220,7 +220,15 @@ RosUmdResource::Map(
         return;
     }
 
-    pUmdDevice->m_commandBuffer.FlushIfMatching(m_mostRecentFence);
+    //
+    // With D3D10_DDI_MAP_WRITE_NOOVERWRITE the caller only writes data that no
+    // pending command reads, so the current command buffer is not flushed.
+    //
+
+    if (mapType != D3D10_DDI_MAP_WRITE_NOOVERWRITE)
+    {
+        pUmdDevice->m_commandBuffer.FlushIfMatching(m_mostRecentFence);
+    }
 
     D3DDDICB_LOCK lock;
     memset(&lock, 0, sizeof(lock));
@@ -24,15 +24,41 @@ RosUmdShader::Standup(
     memcpy(m_pCode, pCode, codeSize * sizeof(UINT));
 
     m_hRTShader = hRTShader;
+
+    m_codeHash = RosUmdShaderCache::HashCode(m_pCode);
+
+    //
+    // Collect SRV slots declared by the shader, only formats of these slots
+    // are baked into the h/w shader.
+    //
+
+    m_srvSlotMask = 0;
+
+    CShaderCodeParser parser;
+    CInstruction inst;
+
+    parser.SetShader(m_pCode);
+    while (!parser.EndOfShader())
+    {
+        parser.ParseInstruction(&inst);
+
+        if (inst.m_OpCode == D3D10_SB_OPCODE_DCL_RESOURCE)
+        {
+            UINT slot = inst.m_Operands[0].m_Index[0].m_RegIndex;
+            if (slot < ROS_SHADER_MAX_SRV_SLOTS)
+            {
+                m_srvSlotMask |= (1 << slot);
+            }
+        }
+    }
 }
 
 void
 RosUmdShader::Teardown()
 {
-    delete m_pCompiler;
     delete[] m_pCode;
 
-    m_hwShaderCode.Teardown();
+    m_pVariant = NULL;
 }
 
 void
@@ -47,7 +73,9 @@ VC4_UNIFORM_FORMAT *
 RosUmdShader::GetShaderUniformFormat(
     UINT Type, UINT *pUniformFormatEntries)
 {
-    return m_pCompiler->GetShaderUniformFormat(Type, pUniformFormatEntries);
+    assert(Type < _countof(m_pVariant->m_pUniformFormat));
+    *pUniformFormatEntries = m_pVariant->m_numUniformFormat[Type];
+    return m_pVariant->m_pUniformFormat[Type];
 }
 
 #endif
@@ -78,92 +106,134 @@ RosUmdPipelineShader::Standup(
 }
 
 void
-RosUmdPipelineShader::Update()
+RosUmdPipelineShader::GetVariantKey(
+    RosUmdShaderVariantKey * pKey)
 {
-    // TODO: state dirtiness check.
-    if (m_pCompiler)
-    {
-        return;
-    }
-
-    assert(m_pCode != NULL);
+    memset(pKey, 0, sizeof(*pKey));
 
-    const UINT *ShaderLinkage[2] = { NULL, NULL }; // Downstream, Upstream.
+    pKey->m_codeHash = m_codeHash;
+    pKey->m_pCode = m_pCode;
+    pKey->m_programType = m_ProgramType;
 
     switch (m_ProgramType)
     {
     case D3D10_SB_VERTEX_SHADER:
+        // Vertex shader outputs are laid out to match pixel shader inputs.
         assert(m_pDevice->m_pixelShader);
-        ShaderLinkage[0] = m_pDevice->m_pixelShader->GetHLSLCode();
+        pKey->m_linkageHash = m_pDevice->m_pixelShader->GetCodeHash();
+        pKey->m_pLinkageCode = m_pDevice->m_pixelShader->GetHLSLCode();
         break;
     case D3D10_SB_PIXEL_SHADER:
-        assert(m_pDevice->m_vertexShader);
-        ShaderLinkage[1] = m_pDevice->m_vertexShader->GetHLSLCode();
+    {
+        // Pixel shader does not depend on vertex shader code, but on the
+        // render target and texture formats, depth and blend state.
+        RosUmdRenderTargetView * pRTV = m_pDevice->m_renderTargetViews[0];
+        if (pRTV &&
+            (RosUmdResource::CastFrom(pRTV->m_create.hDrvResource)->m_format != DXGI_FORMAT_R8G8B8A8_UNORM))
+        {
+            pKey->m_stateBits |= ROS_SHADER_STATE_RT0_SWAP_COLOR;
+        }
+
+        if (m_pDevice->m_depthStencilState->GetDesc()->DepthEnable)
+        {
+            pKey->m_stateBits |= ROS_SHADER_STATE_DEPTH_ENABLE;
+        }
+
+        if (m_pDevice->m_blendState->GetDesc()->RenderTarget[0].BlendEnable)
+        {
+            pKey->m_stateBits |= ROS_SHADER_STATE_BLEND_ENABLE;
+        }
+
+        for (UINT slot = 0; slot < ROS_SHADER_MAX_SRV_SLOTS; slot++)
+        {
+            RosUmdShaderResourceView * pSRV = m_pDevice->m_psResourceViews[slot];
+            if ((m_srvSlotMask & (1 << slot)) &&
+                pSRV &&
+                (RosUmdResource::CastFrom(pSRV->m_create.hDrvResource)->m_format != DXGI_FORMAT_R8G8B8A8_UNORM))
+            {
+                pKey->m_stateBits |= (1 << (ROS_SHADER_STATE_SRV_SWAP_COLOR_SHIFT + slot));
+            }
+        }
         break;
+    }
     default:
         assert(false);
     };
+}
 
-    m_pCompiler = RosCompilerCreate(m_ProgramType,
-                                    m_pCode,
-                                    ShaderLinkage[0], // Downstream
-                                    ShaderLinkage[1], // Upstream
-                                    m_pDevice->m_blendState->GetDesc(),
-                                    m_pDevice->m_depthStencilState->GetDesc(),
-                                    m_pDevice->m_rasterizerState->GetDesc(),
-                                    (const RosUmdRenderTargetView **)&m_pDevice->m_renderTargetViews[0],
-                                    (const RosUmdShaderResourceView **)&m_pDevice->m_psResourceViews[0],
-                                    m_numInputSignatureEntries,
-                                    m_pInputSignatureEntries,
-                                    m_numOutputSignatureEntries,
-                                    m_pOutputSignatureEntries,
-                                    0,
-                                    NULL);
-    if (m_pCompiler == NULL)
-    {
-        throw RosUmdException(E_OUTOFMEMORY);
-    }
+void
+RosUmdPipelineShader::Update()
+{
+    assert(m_pCode != NULL);
 
-    HRESULT hr;
-    if (FAILED(hr = m_pCompiler->Compile()))
+    RosUmdShaderVariantKey key;
+    GetVariantKey(&key);
+
+    if (m_pVariant && (key == m_variantKey))
     {
-        throw RosUmdException(hr);
+        return;
     }
 
+    RosUmdShaderVariant * pVariant = m_pDevice->m_shaderCache.Find(key);
+
+    if (pVariant == NULL)
     {
-        m_hwShaderCodeSize = m_pCompiler->GetShaderCodeSize();
-        assert(m_hwShaderCodeSize != 0);
-           
-        m_pDevice->CreateInternalBuffer(
-            &m_hwShaderCode,
-            ROUND_TO_PAGES(m_hwShaderCodeSize)); // TODO: for now, for easier debugging, round allocation size to PAGE size aligned.
+        const UINT *ShaderLinkage[2] = { NULL, NULL }; // Downstream, Upstream.
 
+        switch (m_ProgramType)
         {
-            D3D10DDI_MAPPED_SUBRESOURCE mappedSubRes = { 0 };
-
-            m_hwShaderCode.Map(
-                m_pDevice,
-                0,
-                D3D10_DDI_MAP_WRITE,
-                0,
-                &mappedSubRes);
+        case D3D10_SB_VERTEX_SHADER:
+            ShaderLinkage[0] = m_pDevice->m_pixelShader->GetHLSLCode();
+            break;
+        case D3D10_SB_PIXEL_SHADER:
+            assert(m_pDevice->m_vertexShader);
+            ShaderLinkage[1] = m_pDevice->m_vertexShader->GetHLSLCode();
+            break;
+        default:
+            assert(false);
+        };
+
+        RosCompiler * pCompiler = RosCompilerCreate(m_ProgramType,
+                                                    m_pCode,
+                                                    ShaderLinkage[0], // Downstream
+                                                    ShaderLinkage[1], // Upstream
+                                                    m_pDevice->m_blendState->GetDesc(),
+                                                    m_pDevice->m_depthStencilState->GetDesc(),
+                                                    m_pDevice->m_rasterizerState->GetDesc(),
+                                                    (const RosUmdRenderTargetView **)&m_pDevice->m_renderTargetViews[0],
+                                                    (const RosUmdShaderResourceView **)&m_pDevice->m_psResourceViews[0],
+                                                    m_numInputSignatureEntries,
+                                                    m_pInputSignatureEntries,
+                                                    m_numOutputSignatureEntries,
+                                                    m_pOutputSignatureEntries,
+                                                    0,
+                                                    NULL);
+        if (pCompiler == NULL)
+        {
+            throw RosUmdException(E_OUTOFMEMORY);
+        }
 
-            if (mappedSubRes.pData)
+        try
+        {
+            HRESULT hr;
+            if (FAILED(hr = pCompiler->Compile()))
             {
-                m_pCompiler->GetShaderCode(
-                    mappedSubRes.pData, 
-                    &m_vc4CoordinateShaderOffset);
-
-                m_hwShaderCode.Unmap(
-                    m_pDevice,
-                    0);
-
-                return;
+                throw RosUmdException(hr);
             }
+
+            pVariant = m_pDevice->m_shaderCache.Insert(key, pCompiler);
         }
+        catch (...)
+        {
+            delete pCompiler;
+            throw;
+        }
+
+        delete pCompiler;
     }
 
-    throw RosUmdException(E_FAIL);
+    m_variantKey = key;
+    m_pVariant = pVariant;
 }
 
 void
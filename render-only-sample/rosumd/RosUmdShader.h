@@ -2,6 +2,7 @@
 
 #include "RosUmdDevice.h"
 #include <roscompiler.h>
+#include "RosUmdShaderCache.h"
 
 class RosUmdShader
 {
@@ -12,7 +13,7 @@ public:
     RosUmdShader(RosUmdDevice * pDevice, D3D10_SB_TOKENIZED_PROGRAM_TYPE Type)
         : m_pDevice(pDevice),
           m_ProgramType(Type),
-          m_pCompiler(NULL)
+          m_pVariant(NULL)
     {
     }
 
@@ -29,7 +30,17 @@ public:
 
     RosUmdResource * GetCodeResource()
     {
-        return &m_hwShaderCode;
+        return m_pVariant->m_pCodeResource;
+    }
+
+    UINT GetCodeOffset()
+    {
+        return m_pVariant->m_codeOffset;
+    }
+
+    UINT GetCoordinateShaderOffset()
+    {
+        return m_pVariant->m_coordinateShaderOffset;
     }
 
     UINT * GetHLSLCode()
@@ -37,14 +48,19 @@ public:
         return m_pCode;
     }
 
+    UINT64 GetCodeHash()
+    {
+        return m_codeHash;
+    }
+
     UINT GetShaderInputCount()
     {
-        return m_pCompiler->GetShaderInputCount();
+        return m_pVariant->m_shaderInputCount;
     }
 
     UINT GetShaderOutputCount()
     {
-        return m_pCompiler->GetShaderOutputCount();
+        return m_pVariant->m_shaderOutputCount;
     }
 
 #if VC4
@@ -60,12 +76,13 @@ protected:
     UINT *                          m_pCode;
     D3D10DDI_HRTSHADER              m_hRTShader;
 
+    UINT64                          m_codeHash;
+    UINT                            m_srvSlotMask;          // SRV slots declared by the shader.
+
     RosUmdDevice *                  m_pDevice;
-    RosUmdResource                  m_hwShaderCode;
-    UINT                            m_hwShaderCodeSize;
-    UINT                            m_vc4CoordinateShaderOffset;
 
-    RosCompiler *                   m_pCompiler;
+    RosUmdShaderVariantKey          m_variantKey;
+    RosUmdShaderVariant *           m_pVariant;             // owned by the device shader cache.
 };
 
 inline RosUmdShader* RosUmdShader::CastFrom(D3D10DDI_HSHADER hShader)
@@ -100,6 +117,8 @@ public:
 
 private:
 
+    void GetVariantKey(RosUmdShaderVariantKey * pKey);
+
     UINT                            m_numInputSignatureEntries;
     D3D11_1DDIARG_SIGNATURE_ENTRY * m_pInputSignatureEntries;
     UINT                            m_numOutputSignatureEntries;
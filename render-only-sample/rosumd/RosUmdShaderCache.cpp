@@ -0,0 +1,263 @@
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Shader variant cache implementation
+//
+// Copyright (C) Microsoft Corporation
+//
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#include "precomp.h"
+
+#include "RosUmdLogging.h"
+#include "RosUmdShaderCache.tmh"
+
+#include "RosUmdDevice.h"
+#include "RosUmdShaderCache.h"
+
+RosUmdShaderCache::RosUmdShaderCache() :
+    m_pDevice(NULL),
+    m_pChunks(NULL)
+{
+    memset(m_pBuckets, 0, sizeof(m_pBuckets));
+}
+
+RosUmdShaderCache::~RosUmdShaderCache()
+{
+    assert(m_pChunks == NULL);
+}
+
+void
+RosUmdShaderCache::Standup(
+    RosUmdDevice * pDevice)
+{
+    m_pDevice = pDevice;
+}
+
+void
+RosUmdShaderCache::Teardown()
+{
+    for (UINT i = 0; i < kNumBuckets; i++)
+    {
+        while (m_pBuckets[i])
+        {
+            RosUmdShaderVariant * pVariant = m_pBuckets[i];
+            m_pBuckets[i] = pVariant->m_pNext;
+
+#if VC4
+            for (UINT j = 0; j < _countof(pVariant->m_pUniformFormat); j++)
+            {
+                delete[] pVariant->m_pUniformFormat[j];
+            }
+#endif
+
+            delete[] pVariant->m_key.m_pCode;
+            delete[] pVariant->m_key.m_pLinkageCode;
+            delete pVariant;
+        }
+    }
+
+    while (m_pChunks)
+    {
+        Chunk * pChunk = m_pChunks;
+        m_pChunks = pChunk->m_pNext;
+
+        pChunk->m_resource.Teardown();
+        delete pChunk;
+    }
+}
+
+UINT64
+RosUmdShaderCache::HashCode(
+    const UINT * pCode)
+{
+    if (pCode == NULL)
+    {
+        return 0;
+    }
+
+    //
+    // FNV-1a over the tokens, 2nd token is the length of program in tokens.
+    //
+
+    UINT64 hash = 0xcbf29ce484222325ULL;
+    for (UINT i = 0; i < pCode[1]; i++)
+    {
+        hash ^= pCode[i];
+        hash *= 0x100000001b3ULL;
+    }
+
+    return hash;
+}
+
+bool
+RosUmdShaderCache::IsSameCode(
+    const UINT * pCode,
+    const UINT * pOtherCode)
+{
+    if ((pCode == NULL) || (pOtherCode == NULL))
+    {
+        return (pCode == pOtherCode);
+    }
+
+    return (pCode[1] == pOtherCode[1]) &&
+           (memcmp(pCode, pOtherCode, pCode[1] * sizeof(UINT)) == 0);
+}
+
+const UINT *
+RosUmdShaderCache::CopyCode(
+    const UINT * pCode)
+{
+    if (pCode == NULL)
+    {
+        return NULL;
+    }
+
+    UINT * pCopy = new UINT[pCode[1]];
+    memcpy(pCopy, pCode, pCode[1] * sizeof(UINT));
+
+    return pCopy;
+}
+
+RosUmdShaderVariant *
+RosUmdShaderCache::Find(
+    const RosUmdShaderVariantKey & key)
+{
+    for (RosUmdShaderVariant * pVariant = m_pBuckets[GetBucket(key)]; pVariant; pVariant = pVariant->m_pNext)
+    {
+        //
+        // Hashes can collide, so a hit is confirmed against the bytecode the
+        // variant was compiled from.
+        //
+
+        if (pVariant->m_key.IsSameState(key) &&
+            IsSameCode(pVariant->m_key.m_pCode, key.m_pCode) &&
+            IsSameCode(pVariant->m_key.m_pLinkageCode, key.m_pLinkageCode))
+        {
+            return pVariant;
+        }
+    }
+
+    return NULL;
+}
+
+RosUmdShaderCache::Chunk *
+RosUmdShaderCache::AllocateCode(
+    UINT size,
+    UINT * pOffset)
+{
+    Chunk * pChunk = m_pChunks;
+
+    if ((pChunk == NULL) ||
+        (AlignValue(pChunk->m_used, kCodeAlignment) + size > pChunk->m_size))
+    {
+        pChunk = new Chunk;
+
+        pChunk->m_size = max(kChunkSize, (UINT)ROUND_TO_PAGES(size));
+        pChunk->m_used = 0;
+
+        m_pDevice->CreateInternalBuffer(&pChunk->m_resource, pChunk->m_size);
+
+        pChunk->m_pNext = m_pChunks;
+        m_pChunks = pChunk;
+    }
+
+    *pOffset = AlignValue(pChunk->m_used, kCodeAlignment);
+    pChunk->m_used = *pOffset + size;
+
+    return pChunk;
+}
+
+RosUmdShaderVariant *
+RosUmdShaderCache::Insert(
+    const RosUmdShaderVariantKey & key,
+    RosCompiler * pCompiler)
+{
+    assert(Find(key) == NULL);
+
+    UINT codeSize = pCompiler->GetShaderCodeSize();
+    assert(codeSize != 0);
+
+    UINT codeOffset;
+    Chunk * pChunk = AllocateCode(codeSize, &codeOffset);
+
+    RosUmdShaderVariant * pVariant = new RosUmdShaderVariant;
+    memset(pVariant, 0, sizeof(*pVariant));
+
+    pVariant->m_key = key;
+    pVariant->m_pCodeResource = &pChunk->m_resource;
+    pVariant->m_codeOffset = codeOffset;
+    pVariant->m_coordinateShaderOffset = codeOffset;
+    pVariant->m_shaderInputCount = pCompiler->GetShaderInputCount();
+    pVariant->m_shaderOutputCount = pCompiler->GetShaderOutputCount();
+
+    {
+        D3D10DDI_MAPPED_SUBRESOURCE mappedSubRes = { 0 };
+
+        pChunk->m_resource.Map(
+            m_pDevice,
+            0,
+            D3D10_DDI_MAP_WRITE_NOOVERWRITE,
+            0,
+            &mappedSubRes);
+
+        if (mappedSubRes.pData == NULL)
+        {
+            delete pVariant;
+            throw RosUmdException(E_FAIL);
+        }
+
+        UINT csOffset = 0;
+
+        pCompiler->GetShaderCode(
+            (BYTE *)mappedSubRes.pData + codeOffset,
+            &csOffset);
+
+        pChunk->m_resource.Unmap(
+            m_pDevice,
+            0);
+
+        pVariant->m_coordinateShaderOffset += csOffset;
+    }
+
+#if VC4
+
+    {
+        UINT uniformTypes[2];
+        UINT numUniformTypes = 0;
+
+        if (key.m_programType == D3D10_SB_VERTEX_SHADER)
+        {
+            uniformTypes[numUniformTypes++] = ROS_VERTEX_SHADER_UNIFORM_STORAGE;
+            uniformTypes[numUniformTypes++] = ROS_COORDINATE_SHADER_UNIFORM_STORAGE;
+        }
+        else
+        {
+            assert(key.m_programType == D3D10_SB_PIXEL_SHADER);
+            uniformTypes[numUniformTypes++] = ROS_PIXEL_SHADER_UNIFORM_STORAGE;
+        }
+
+        for (UINT i = 0; i < numUniformTypes; i++)
+        {
+            UINT type = uniformTypes[i];
+            UINT numEntries = 0;
+            VC4_UNIFORM_FORMAT * pEntries = pCompiler->GetShaderUniformFormat(type, &numEntries);
+
+            if (numEntries)
+            {
+                pVariant->m_pUniformFormat[type] = new VC4_UNIFORM_FORMAT[numEntries];
+                memcpy(pVariant->m_pUniformFormat[type], pEntries, numEntries * sizeof(VC4_UNIFORM_FORMAT));
+            }
+            pVariant->m_numUniformFormat[type] = numEntries;
+        }
+    }
+
+#endif
+
+    pVariant->m_key.m_pCode = CopyCode(key.m_pCode);
+    pVariant->m_key.m_pLinkageCode = CopyCode(key.m_pLinkageCode);
+
+    UINT bucket = GetBucket(key);
+    pVariant->m_pNext = m_pBuckets[bucket];
+    m_pBuckets[bucket] = pVariant;
+
+    return pVariant;
+}
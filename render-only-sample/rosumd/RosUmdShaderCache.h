@@ -0,0 +1,142 @@
+#pragma once
+
+#include "RosUmdResource.h"
+#include <roscompiler.h>
+
+class RosUmdDevice;
+
+//
+// Shader variant cache
+//
+// The compiler bakes part of the pipeline state into the h/w shader, so each
+// HLSL shader can have several h/w variants. Variants are shared across all
+// shader objects of the device and keyed by:
+//
+//   - HLSL bytecode.
+//   - HLSL bytecode of the linked stage (pixel shader for vertex shader, as
+//     VS output linkage follows PS inputs).
+//   - state bits read by the compiler (see RosUmdPipelineShader::GetVariantKey).
+//
+// Bytecode is looked up by hash; each variant keeps a copy of the bytecode
+// it was compiled from, which is compared on a hash hit.
+//
+// Variants are never evicted and live until the device is torn down.
+//
+
+#define ROS_SHADER_STATE_RT0_SWAP_COLOR      0x00000001  // RT0 is not R8G8B8A8
+#define ROS_SHADER_STATE_DEPTH_ENABLE        0x00000002
+#define ROS_SHADER_STATE_BLEND_ENABLE        0x00000004
+#define ROS_SHADER_STATE_SRV_SWAP_COLOR_SHIFT 16         // 1 bit per SRV slot 0 ~ 15, SRV is not R8G8B8A8
+
+#define ROS_SHADER_MAX_SRV_SLOTS             16         // compiler limit on resource slot.
+
+struct RosUmdShaderVariantKey
+{
+    UINT64                          m_codeHash;
+    UINT64                          m_linkageHash;
+    D3D10_SB_TOKENIZED_PROGRAM_TYPE m_programType;
+    UINT                            m_stateBits;
+
+    // HLSL bytecode hashed to m_codeHash/m_linkageHash (NULL when no linked
+    // stage). Points to the shader objects when building the key, and to the
+    // copies owned by the variant in RosUmdShaderVariant::m_key.
+    const UINT *                    m_pCode;
+    const UINT *                    m_pLinkageCode;
+
+    bool IsSameState(const RosUmdShaderVariantKey &other) const
+    {
+        return (m_codeHash == other.m_codeHash) &&
+               (m_linkageHash == other.m_linkageHash) &&
+               (m_programType == other.m_programType) &&
+               (m_stateBits == other.m_stateBits);
+    }
+
+    // Same state of the same shader objects, without looking at bytecode.
+    // Used to check whether a shader still has the right variant; finding a
+    // variant compares bytecode, see RosUmdShaderCache::Find.
+    bool operator==(const RosUmdShaderVariantKey &other) const
+    {
+        return IsSameState(other) &&
+               (m_pCode == other.m_pCode) &&
+               (m_pLinkageCode == other.m_pLinkageCode);
+    }
+
+    bool operator!=(const RosUmdShaderVariantKey &other) const
+    {
+        return !(*this == other);
+    }
+};
+
+//
+// Compiled h/w shader. Code lives in a chunk of the shared shader heap; for
+// vertex shader, coordinate shader follows vertex shader code.
+//
+struct RosUmdShaderVariant
+{
+    RosUmdShaderVariantKey          m_key;
+    RosUmdShaderVariant *           m_pNext;                    // hash bucket chain.
+
+    RosUmdResource *                m_pCodeResource;
+    UINT                            m_codeOffset;               // offset in m_pCodeResource.
+    UINT                            m_coordinateShaderOffset;   // offset in m_pCodeResource.
+
+    UINT                            m_shaderInputCount;
+    UINT                            m_shaderOutputCount;
+
+#if VC4
+
+    VC4_UNIFORM_FORMAT *            m_pUniformFormat[ROS_COORDINATE_SHADER_UNIFORM_STORAGE + 1];
+    UINT                            m_numUniformFormat[ROS_COORDINATE_SHADER_UNIFORM_STORAGE + 1];
+
+#endif
+};
+
+class RosUmdShaderCache
+{
+public:
+
+    RosUmdShaderCache();
+    ~RosUmdShaderCache();
+
+    void Standup(RosUmdDevice * pDevice);
+    void Teardown();
+
+    static UINT64 HashCode(const UINT * pCode);
+    static bool IsSameCode(const UINT * pCode, const UINT * pOtherCode);
+
+    RosUmdShaderVariant * Find(const RosUmdShaderVariantKey & key);
+    RosUmdShaderVariant * Insert(const RosUmdShaderVariantKey & key, RosCompiler * pCompiler);
+
+private:
+
+    static const UINT kNumBuckets = 256;
+    static const UINT kChunkSize = 4 * PAGE_SIZE;
+    static const UINT kCodeAlignment = 16;
+
+    //
+    // Shader heap chunk. Code is appended to the unused tail until the chunk
+    // is full. Commands only read code below m_used, so the tail is written
+    // with D3D10_DDI_MAP_WRITE_NOOVERWRITE even while the chunk is referenced
+    // and never flushes the current command buffer.
+    //
+    struct Chunk
+    {
+        RosUmdResource  m_resource;
+        UINT            m_size;
+        UINT            m_used;
+        Chunk *         m_pNext;
+    };
+
+    UINT GetBucket(const RosUmdShaderVariantKey & key)
+    {
+        UINT64 hash = key.m_codeHash ^ (key.m_linkageHash * 31) ^ ((UINT64)key.m_stateBits << 32) ^ key.m_programType;
+        return (UINT)((hash ^ (hash >> 32)) % kNumBuckets);
+    }
+
+    Chunk * AllocateCode(UINT size, UINT * pOffset);
+    static const UINT * CopyCode(const UINT * pCode);
+
+    RosUmdDevice *          m_pDevice;
+    RosUmdShaderVariant *   m_pBuckets[kNumBuckets];
+    Chunk *                 m_pChunks;      // most recent first.
+};
@@ -4,6 +4,7 @@ class RosUmdShaderResourceView
 {
 friend class RosUmdDevice;
 friend class RosCompiler;
+friend class RosUmdPipelineShader;
 
 public:
 
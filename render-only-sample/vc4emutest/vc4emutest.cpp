@@ -0,0 +1,921 @@
+#include "vc4emutest.h"
+
+#include <string.h>
+#include <thread>
+#include <vector>
+
+#include "Vc4Ddi.h"
+#include "Vc4Emulator.h"
+
+// Test for the VC4 emulator of the software adapter
+//
+// Runs known binning and rendering control lists through Vc4Emulator over a
+// 128x128 RGBA8888 render target in a video memory region, the way
+// RosKmdSoftAdapter submits them, and checks the rendered pixels. Covers the
+// NV shader state (pre-shaded vertices) with 1 and 4 workers, the GL shader
+// state with coordinate and vertex shaders run on the QPU interpreter, small
+// fragment shaders checking the QPU register, small immediate, branch and
+// SFU semantics, and control lists that must fail the job.
+
+static const UINT kMemoryBase = 0x10000000;
+static const UINT kMemorySize = 8 * 1024 * 1024;
+
+static const UINT kFragmentShader = kMemoryBase + 0x10000;
+static const UINT kCoordinateShader = kMemoryBase + 0x10400;
+static const UINT kVertexShader = kMemoryBase + 0x10800;
+static const UINT kUniforms = kMemoryBase + 0x11000;
+static const UINT kShaderRecord = kMemoryBase + 0x12000;
+static const UINT kVertices = kMemoryBase + 0x13000;
+static const UINT kBinningControlList = kMemoryBase + 0x20000;
+static const UINT kRenderingControlList = kMemoryBase + 0x30000;
+static const UINT kRenderTarget = kMemoryBase + 0x100000;
+static const UINT kTileAllocation = kMemoryBase + 0x200000;
+static const UINT kTileState = kMemoryBase + 0x300000;
+
+static const UINT kWidth = 128;
+static const UINT kHeight = 128;
+static const UINT kTileSize = 64;
+static const UINT kClearColor = 0xFF0000FF;
+
+static bool Check(bool condition, const char * pMessage)
+{
+	if (!condition)
+		printf("%s\n", pMessage);
+
+	return condition;
+}
+
+static UINT AsUint(float value)
+{
+	UINT result;
+
+	memcpy(&result, &value, sizeof(result));
+
+	return result;
+}
+
+//
+// Runs the items of a job on worker threads, like RosKmdSoftAdapter
+//
+
+class ThreadWorkerPool : public Vc4EmuWorkerPool
+{
+public:
+
+	ThreadWorkerPool(UINT numWorkers) :
+		m_numWorkers(numWorkers)
+	{
+	}
+
+	virtual UINT GetWorkerCount()
+	{
+		return m_numWorkers;
+	}
+
+	virtual void Run(PFN_VC4EMU_JOB pfnJob, void * pContext, UINT numItems)
+	{
+		volatile LONG nextItem = 0;
+		std::vector<std::thread> threads;
+
+		for (UINT worker = 1; worker < m_numWorkers; worker++)
+			threads.push_back(std::thread(RunItems, pfnJob, pContext, numItems, &nextItem, worker));
+
+		RunItems(pfnJob, pContext, numItems, &nextItem, 0);
+
+		for (UINT i = 0; i < threads.size(); i++)
+			threads[i].join();
+	}
+
+private:
+
+	static void RunItems(PFN_VC4EMU_JOB pfnJob, void * pContext, UINT numItems, volatile LONG * pNextItem, UINT worker)
+	{
+		for (;;)
+		{
+			UINT item = (UINT)InterlockedIncrement(pNextItem) - 1;
+
+			if (item >= numItems)
+				break;
+
+			pfnJob(pContext, item, worker);
+		}
+	}
+
+	UINT m_numWorkers;
+};
+
+//
+// QPU instruction encoding
+//
+
+static const UINT kNop = VC4_QPU_WADDR_NOP;
+static const UINT kRaddrNop = VC4_QPU_RADDR_NOP;
+static const UINT kRegA = VC4_QPU_ALU_REG_A;
+static const UINT kRegB = VC4_QPU_ALU_REG_B;
+
+static VC4_QPU_INSTRUCTION Nop(UINT sig = VC4_QPU_SIG_NO_SIGNAL)
+{
+	VC4_QPU_INSTRUCTION instruction = 0;
+
+	VC4_QPU_SET_SIG(instruction, sig);
+	VC4_QPU_SET_WADDR_ADD(instruction, kNop);
+	VC4_QPU_SET_WADDR_MUL(instruction, kNop);
+	VC4_QPU_SET_RADDR_A(instruction, kRaddrNop);
+	VC4_QPU_SET_RADDR_B(instruction, kRaddrNop);
+
+	return instruction;
+}
+
+static VC4_QPU_INSTRUCTION Add(UINT opcode, UINT waddr, UINT a, UINT b, UINT raddrA = kRaddrNop, UINT raddrB = kRaddrNop, UINT sig = VC4_QPU_SIG_NO_SIGNAL, UINT pack = 0)
+{
+	VC4_QPU_INSTRUCTION instruction = Nop(sig);
+
+	VC4_QPU_SET_OPCODE_ADD(instruction, opcode);
+	VC4_QPU_SET_COND_ADD(instruction, VC4_QPU_COND_ALWAYS);
+	VC4_QPU_SET_WADDR_ADD(instruction, waddr);
+	VC4_QPU_SET_ADD_A(instruction, a);
+	VC4_QPU_SET_ADD_B(instruction, b);
+	VC4_QPU_SET_RADDR_A(instruction, raddrA);
+	VC4_QPU_SET_RADDR_B(instruction, raddrB);
+	VC4_QPU_SET_PACK(instruction, pack);
+
+	return instruction;
+}
+
+static VC4_QPU_INSTRUCTION Mul(UINT opcode, UINT waddr, UINT a, UINT b, UINT raddrA = kRaddrNop, UINT raddrB = kRaddrNop, UINT sig = VC4_QPU_SIG_NO_SIGNAL, UINT pack = 0)
+{
+	VC4_QPU_INSTRUCTION instruction = Nop(sig);
+
+	VC4_QPU_SET_OPCODE_MUL(instruction, opcode);
+	VC4_QPU_SET_COND_MUL(instruction, VC4_QPU_COND_ALWAYS);
+	VC4_QPU_SET_WADDR_MUL(instruction, waddr);
+	VC4_QPU_SET_MUL_A(instruction, a);
+	VC4_QPU_SET_MUL_B(instruction, b);
+	VC4_QPU_SET_RADDR_A(instruction, raddrA);
+	VC4_QPU_SET_RADDR_B(instruction, raddrB);
+
+	if (pack)
+	{
+		VC4_QPU_SET_PM(instruction, 1);
+		VC4_QPU_SET_PACK(instruction, pack);
+	}
+
+	return instruction;
+}
+
+//
+// mov waddr, raddrA from the regfile A
+//
+
+static VC4_QPU_INSTRUCTION Mov(UINT waddr, UINT raddrA)
+{
+	return Add(VC4_QPU_OPCODE_ADD_OR, waddr, kRegA, kRegA, raddrA);
+}
+
+static VC4_QPU_INSTRUCTION Ldi(UINT waddrAdd, UINT waddrMul, UINT value)
+{
+	VC4_QPU_INSTRUCTION instruction = Nop(VC4_QPU_SIG_LOAD_IMMEDIATE);
+
+	VC4_QPU_SET_COND_ADD(instruction, VC4_QPU_COND_ALWAYS);
+	VC4_QPU_SET_COND_MUL(instruction, VC4_QPU_COND_ALWAYS);
+	VC4_QPU_SET_WADDR_ADD(instruction, waddrAdd);
+	VC4_QPU_SET_WADDR_MUL(instruction, waddrMul);
+	VC4_QPU_SET_IMMEDIATE_32(instruction, value);
+
+	return instruction;
+}
+
+//
+// Branch relative to the instruction after the 3 delay slots
+//
+
+static VC4_QPU_INSTRUCTION BranchRelative(INT offset)
+{
+	VC4_QPU_INSTRUCTION instruction = 0;
+
+	VC4_QPU_SET_SIG(instruction, VC4_QPU_SIG_BRANCH);
+	VC4_QPU_SET_BRANCH_COND(instruction, VC4_QPU_BRANCH_COND_ALWAYS);
+	VC4_QPU_SET_BRANCH_RELATIVE(instruction, 1);
+	VC4_QPU_SET_WADDR_ADD(instruction, kNop);
+	VC4_QPU_SET_WADDR_MUL(instruction, kNop);
+	VC4_QPU_SET_IMMEDIATE_32(instruction, (UINT)offset);
+
+	return instruction;
+}
+
+//
+// Small immediates in raddr_b, see ExecuteQpuInstruction()
+//
+
+static UINT SmallInt(INT value)
+{
+	assert((value >= -16) && (value < 16));
+
+	return (UINT)value & 31;
+}
+
+static UINT SmallFloat(UINT exponent)
+{
+	assert(exponent < 8);
+
+	return 32 + exponent;
+}
+
+//
+// Coordinate or vertex shader with a float2 position attribute, the
+// uniforms scale it to screen coordinates and the vertex shader outputs the
+// position x as the varying
+//
+
+static UINT EmitVertexShader(VC4_QPU_INSTRUCTION * pCode, bool bCoordinate)
+{
+	UINT n = 0;
+
+	pCode[n++] = Ldi(VC4_QPU_WADDR_VPMVCD_RD_SETUP, kNop, MAKE_VR_SETUP(2, 1, 1, 0, 2, 0));
+	pCode[n++] = Ldi(kNop, VC4_QPU_WADDR_VPMVCD_WR_SETUP, MAKE_VW_SETUP(1, 1, 0, 2, 0));
+	pCode[n++] = Mov(0, VC4_QPU_RADDR_VPM);
+	pCode[n++] = Mov(1, VC4_QPU_RADDR_VPM);
+
+	if (bCoordinate)
+	{
+		pCode[n++] = Mov(VC4_QPU_WADDR_VPM, 0);
+		pCode[n++] = Mov(VC4_QPU_WADDR_VPM, 1);
+		pCode[n++] = Ldi(VC4_QPU_WADDR_VPM, kNop, AsUint(0.5f));
+		pCode[n++] = Ldi(VC4_QPU_WADDR_VPM, kNop, AsUint(1.0f));
+	}
+
+	pCode[n++] = Mul(VC4_QPU_OPCODE_MUL_FMUL, VC4_QPU_WADDR_ACC0, kRegA, kRegB, 0, VC4_QPU_RADDR_UNIFORM);
+	pCode[n++] = Mul(VC4_QPU_OPCODE_MUL_FMUL, VC4_QPU_WADDR_ACC1, kRegA, kRegB, 1, VC4_QPU_RADDR_UNIFORM);
+	pCode[n++] = Add(VC4_QPU_OPCODE_ADD_FTOI, VC4_QPU_WADDR_ACC0, VC4_QPU_ALU_R0, VC4_QPU_ALU_R0);
+	pCode[n++] = Add(VC4_QPU_OPCODE_ADD_FTOI, VC4_QPU_WADDR_ACC1, VC4_QPU_ALU_R1, VC4_QPU_ALU_R1);
+	pCode[n++] = Add(VC4_QPU_OPCODE_ADD_OR, 2, VC4_QPU_ALU_R0, VC4_QPU_ALU_R0, kRaddrNop, kRaddrNop, VC4_QPU_SIG_NO_SIGNAL, VC4_QPU_PACK_A_16a);
+	pCode[n++] = Add(VC4_QPU_OPCODE_ADD_OR, 2, VC4_QPU_ALU_R1, VC4_QPU_ALU_R1, kRaddrNop, kRaddrNop, VC4_QPU_SIG_NO_SIGNAL, VC4_QPU_PACK_A_16b);
+	pCode[n++] = Nop();
+	pCode[n++] = Mov(VC4_QPU_WADDR_VPM, 2);
+	pCode[n++] = Ldi(VC4_QPU_WADDR_VPM, kNop, AsUint(0.5f));
+	pCode[n++] = Ldi(VC4_QPU_WADDR_VPM, kNop, AsUint(1.0f));
+
+	if (!bCoordinate)
+	{
+		pCode[n++] = Mov(VC4_QPU_WADDR_VPM, 0);
+	}
+
+	pCode[n++] = Nop(VC4_QPU_SIG_PROGRAM_END);
+	pCode[n++] = Nop();
+	pCode[n++] = Nop();
+
+	return n;
+}
+
+//
+// Control list writer
+//
+
+class ControlList
+{
+public:
+
+	ControlList(BYTE * pMemory, UINT address) :
+		m_pStart(pMemory + (address - kMemoryBase)),
+		m_pCurrent(m_pStart),
+		m_address(address)
+	{
+	}
+
+	template<typename T>
+	void Put(const T & packet)
+	{
+		memcpy(m_pCurrent, &packet, sizeof(packet));
+		m_pCurrent += sizeof(packet);
+	}
+
+	void PutCommand(BYTE command)
+	{
+		*m_pCurrent++ = command;
+	}
+
+	UINT GetEndAddress() const
+	{
+		return m_address + (UINT)(m_pCurrent - m_pStart);
+	}
+
+private:
+
+	BYTE * m_pStart;
+	BYTE * m_pCurrent;
+	UINT m_address;
+};
+
+class EmulatorTest
+{
+public:
+
+	EmulatorTest(UINT numWorkers) :
+		m_workerPool(numWorkers)
+	{
+		m_pMemory = (BYTE *)calloc(kMemorySize, 1);
+		m_pEmulator = new Vc4Emulator;
+
+		NTSTATUS status = m_pEmulator->Initialize(&m_workerPool);
+		assert(NT_SUCCESS(status));
+		(void)status;
+
+		m_pEmulator->SetMemoryRegion(Vc4EmuRegionVideoMemory, kMemoryBase, kMemorySize, m_pMemory);
+	}
+
+	~EmulatorTest()
+	{
+		m_pEmulator->Uninitialize();
+
+		delete m_pEmulator;
+		free(m_pMemory);
+	}
+
+	template<typename T>
+	T * GetPointer(UINT address)
+	{
+		return (T *)(m_pMemory + (address - kMemoryBase));
+	}
+
+	UINT GetPixel(UINT x, UINT y)
+	{
+		return GetPointer<UINT>(kRenderTarget)[y*kWidth + x];
+	}
+
+	//
+	// Fragment shader ending in thrend with the scoreboard unblocked in the
+	// last delay slot
+	//
+
+	void SetFragmentShader(const VC4_QPU_INSTRUCTION * pCode, UINT numInstructions)
+	{
+		VC4_QPU_INSTRUCTION * pShader = GetPointer<VC4_QPU_INSTRUCTION>(kFragmentShader);
+
+		memcpy(pShader, pCode, numInstructions*sizeof(VC4_QPU_INSTRUCTION));
+
+		pShader[numInstructions] = Nop(VC4_QPU_SIG_PROGRAM_END);
+		pShader[numInstructions + 1] = Nop();
+		pShader[numInstructions + 2] = Nop(VC4_QPU_SIG_SCOREBOARD_UNBLOCK);
+	}
+
+	//
+	// Triangle with pre-shaded vertices at (0, 0), (size, 0) and (0, size)
+	// in pixels
+	//
+
+	void SetNVTriangle(UINT size)
+	{
+		VC4NVShaderStateRecord * pRecord = GetPointer<VC4NVShaderStateRecord>(kShaderRecord);
+
+		*pRecord = vc4NVShaderStateRecord;
+		pRecord->ShadedVertexDataStride = 12;
+		pRecord->FragmentShaderCodeAddress = kFragmentShader;
+		pRecord->FragmentShaderUniformsAddress = kUniforms;
+		pRecord->ShadedVertexDataAddress = kVertices;
+
+		struct ShadedVertex
+		{
+			SHORT m_x;
+			SHORT m_y;
+			float m_z;
+			float m_w;
+		};
+
+		ShadedVertex * pVertex = GetPointer<ShadedVertex>(kVertices);
+		SHORT extent = (SHORT)(size*16);
+
+		pVertex[0] = { 0, 0, 0.5f, 1.0f };
+		pVertex[1] = { extent, 0, 0.5f, 1.0f };
+		pVertex[2] = { 0, extent, 0.5f, 1.0f };
+
+		m_bGLShaderState = false;
+	}
+
+	//
+	// Triangle at (-1, -1), (1, -1) and (-1, 1) in normalized device
+	// coordinates, shaded by EmitVertexShader() and a fragment shader
+	// writing the varying as gray
+	//
+
+	void SetGLTriangle()
+	{
+		VC4_QPU_INSTRUCTION fragmentShader[] =
+		{
+			Mul(VC4_QPU_OPCODE_MUL_FMUL, VC4_QPU_WADDR_ACC0, kRegA, kRegB, 15, VC4_QPU_RADDR_VERYING),
+			Add(VC4_QPU_OPCODE_ADD_FADD, VC4_QPU_WADDR_ACC0, VC4_QPU_ALU_R0, VC4_QPU_ALU_R5),
+			Mul(VC4_QPU_OPCODE_MUL_FMUL, VC4_QPU_WADDR_TLB_COLOUR_ALL, VC4_QPU_ALU_R0, kRegB, kRaddrNop, SmallFloat(0), VC4_QPU_SIG_ALU_WITH_RADDR_B, VC4_QPU_PACK_MUL_8888),
+		};
+
+		SetFragmentShader(fragmentShader, ARRAYSIZE(fragmentShader));
+		EmitVertexShader(GetPointer<VC4_QPU_INSTRUCTION>(kCoordinateShader), true);
+		EmitVertexShader(GetPointer<VC4_QPU_INSTRUCTION>(kVertexShader), false);
+
+		float * pUniforms = GetPointer<float>(kUniforms);
+
+		pUniforms[0] = kWidth*8.0f;
+		pUniforms[1] = kHeight*8.0f;
+
+		VC4GLShaderStateRecord * pRecord = GetPointer<VC4GLShaderStateRecord>(kShaderRecord);
+
+		*pRecord = vc4GLShaderStateRecord;
+		pRecord->FragmentShaderNumberOfVaryings = 1;
+		pRecord->FragmentShaderCodeAddress = kFragmentShader;
+		pRecord->FragmentShaderUniformsAddress = kUniforms;
+		pRecord->VertexShaderAttributeArraySelectBits = 1;
+		pRecord->VertexShaderTotalAttributesSize = 8;
+		pRecord->VertexShaderCodeAddress = kVertexShader;
+		pRecord->VertexShaderUniformsAddress = kUniforms;
+		pRecord->CoordinateShaderAttributeArraySelectBits = 1;
+		pRecord->CoordinateShaderTotalAttributesSize = 8;
+		pRecord->CoordinateShaderCodeAddress = kCoordinateShader;
+		pRecord->CoordinateShaderUniformsAddress = kUniforms;
+
+		VC4VertexAttribute * pAttribute = (VC4VertexAttribute *)(pRecord + 1);
+
+		pAttribute->VertexBaseMemoryAddress = kVertices;
+		pAttribute->NumberOfBytesMinusOne = 7;
+		pAttribute->MemoryStride = 8;
+		pAttribute->VertexShaderVPMOffset = 0;
+		pAttribute->CoordinateShaderVPMOffset = 0;
+
+		const float positions[] = { -1.0f, -1.0f, 1.0f, -1.0f, -1.0f, 1.0f };
+
+		memcpy(GetPointer<float>(kVertices), positions, sizeof(positions));
+
+		m_bGLShaderState = true;
+	}
+
+	UINT BuildBinningControlList(const VC4TileBinningModeConfig & binningConfig)
+	{
+		ControlList list(m_pMemory, kBinningControlList);
+
+		list.Put(binningConfig);
+		list.Put(vc4StartTileBinng);
+
+		VC4PrimitiveListFormat primitiveListFormat = vc4PrimitiveListFormat;
+		primitiveListFormat.PrimitiveType = 2;
+		primitiveListFormat.DataType = 3;
+		list.Put(primitiveListFormat);
+
+		VC4ClipWindow clipWindow = vc4ClipWindow;
+		clipWindow.ClipWindowWidth = kWidth;
+		clipWindow.ClipWindowHeight = kHeight;
+		list.Put(clipWindow);
+
+		VC4ConfigBits configBits = vc4ConfigBits;
+		configBits.EnableForwardFacingPrimitive = 1;
+		configBits.EnableReverseFacingPrimitive = 1;
+		configBits.DepthTestFunction = VC4_DEPTH_TEST_ALWAYS;
+		configBits.EarlyZUpdatesEnable = 1;
+		list.Put(configBits);
+
+		if (m_bGLShaderState)
+		{
+			VC4ClipperXYScaling clipperXYScaling = vc4ClipperXYScaling;
+			clipperXYScaling.ViewportHalfWidth = kWidth*8.0f;
+			clipperXYScaling.ViewportHalfHeight = kHeight*8.0f;
+			list.Put(clipperXYScaling);
+
+			VC4ViewportOffset viewportOffset = vc4ViewportOffset;
+			viewportOffset.ViewportCenterX = kWidth*8;
+			viewportOffset.ViewportCenterY = kHeight*8;
+			list.Put(viewportOffset);
+
+			VC4GLShaderState shaderState = vc4GLShaderState;
+			shaderState.UInt1 = kShaderRecord | 1;	// 1 attribute array
+			list.Put(shaderState);
+		}
+		else
+		{
+			list.Put(vc4ViewportOffset);
+
+			VC4NVShaderState shaderState = vc4NVShaderState;
+			shaderState.ShaderRecordAddress = kShaderRecord;
+			list.Put(shaderState);
+		}
+
+		VC4VertexArrayPrimitives vertexArray = vc4VertexArrayPrimitives;
+		vertexArray.PrimitiveMode = VC4_TRIANGLES;
+		vertexArray.Length = 3;
+		vertexArray.IndexOfFirstVertex = 0;
+		list.Put(vertexArray);
+
+		list.PutCommand(VC4_CMD_INCREMENT_SEMAPHORE);
+		list.PutCommand(VC4_CMD_FLUSH_ALL_STATE);
+		list.PutCommand(VC4_CMD_NOP);
+		list.PutCommand(VC4_CMD_HALT);
+
+		return list.GetEndAddress();
+	}
+
+	static VC4TileBinningModeConfig GetBinningConfig()
+	{
+		VC4TileBinningModeConfig binningConfig = vc4TileBinningModeConfig;
+
+		binningConfig.TileAllocationMemoryAddress = kTileAllocation;
+		binningConfig.TileAllocationMemorySize = VC4_TILE_ALLOCATION_MEMORY_SIZE;
+		binningConfig.TileStateDataArrayBaseAddress = kTileState;
+		binningConfig.WidthInTiles = kWidth / kTileSize;
+		binningConfig.HeightInTiles = kHeight / kTileSize;
+		binningConfig.AutoInitialiseTileStateDataArray = 1;
+
+		return binningConfig;
+	}
+
+	//
+	// Clears to kClearColor and runs the tile list of each tile, like
+	// GenerateRenderingControlList()
+	//
+
+	UINT BuildRenderingControlList()
+	{
+		ControlList list(m_pMemory, kRenderingControlList);
+
+		VC4ClearColors clearColors = vc4ClearColors;
+		clearColors.ClearColor8 = kClearColor;
+		clearColors.ClearColor8Dup = kClearColor;
+		clearColors.ClearZ = 0xFFFFFF;
+		list.Put(clearColors);
+
+		list.Put(vc4WaitOnSemaphore);
+
+		VC4TileRenderingModeConfig renderingConfig = vc4TileRenderingModeConfig;
+		renderingConfig.MemoryAddress = kRenderTarget;
+		renderingConfig.WidthInPixels = kWidth;
+		renderingConfig.HeightInPixels = kHeight;
+		renderingConfig.NonHDRFrameBufferColorFormat = (USHORT)VC4_NON_HDR_FRAME_BUFFER_COLOR_FORMAT::RGBA8888;
+		renderingConfig.MemoryFormat = (USHORT)VC4_MEMORY_FORMAT::LINEAR;
+		list.Put(renderingConfig);
+
+		list.Put(vc4TileCoordinates);
+		list.Put(vc4StoreTileBufferGeneral);
+
+		UINT widthInTiles = kWidth / kTileSize;
+		UINT heightInTiles = kHeight / kTileSize;
+
+		for (UINT x = 0; x < widthInTiles; x++)
+		{
+			for (UINT y = 0; y < heightInTiles; y++)
+			{
+				VC4TileCoordinates tileCoordinates = vc4TileCoordinates;
+				tileCoordinates.TileColumnNumber = (BYTE)x;
+				tileCoordinates.TileRowNumber = (BYTE)y;
+				list.Put(tileCoordinates);
+
+				VC4BranchToSubList branch = vc4BranchToSubList;
+				branch.BranchAddress = kTileAllocation + (y*widthInTiles + x)*VC4_TILE_ALLOCATION_BLOCK_SIZE;
+				list.Put(branch);
+
+				if ((x == widthInTiles - 1) && (y == heightInTiles - 1))
+					list.Put(vc4StoreMSResolvedTileColorBufAndSignalEndOfFrame);
+				else
+					list.Put(vc4StoreMSResolvedTileColorBuf);
+			}
+		}
+
+		return list.GetEndAddress();
+	}
+
+	bool Render()
+	{
+		memset(GetPointer<BYTE>(kRenderTarget), 0, kWidth*kHeight*sizeof(UINT));
+
+		UINT binningEnd = BuildBinningControlList(GetBinningConfig());
+		UINT renderingEnd = BuildRenderingControlList();
+
+		bool passed = true;
+
+		passed &= Check(m_pEmulator->ExecuteBinningControlList(kBinningControlList, binningEnd), "binning failed");
+		passed &= Check(m_pEmulator->ExecuteRenderingControlList(kRenderingControlList, renderingEnd), "rendering failed");
+
+		return passed;
+	}
+
+	//
+	// Renders a triangle covering the render target with the given fragment
+	// shader and checks every pixel got the expected color
+	//
+
+	bool RenderFragmentShader(const VC4_QPU_INSTRUCTION * pCode, UINT numInstructions, const UINT * pUniforms, UINT numUniforms, UINT expected, const char * pName)
+	{
+		SetNVTriangle(2*kWidth);
+		SetFragmentShader(pCode, numInstructions);
+
+		if (numUniforms)
+			memcpy(GetPointer<UINT>(kUniforms), pUniforms, numUniforms*sizeof(UINT));
+
+		if (!Render())
+			return false;
+
+		for (UINT y = 0; y < kHeight; y++)
+		{
+			for (UINT x = 0; x < kWidth; x++)
+			{
+				if (GetPixel(x, y) != expected)
+				{
+					printf("%s: pixel (%u, %u) is 0x%08x, expected 0x%08x\n", pName, x, y, GetPixel(x, y), expected);
+					return false;
+				}
+			}
+		}
+
+		return true;
+	}
+
+	Vc4Emulator * m_pEmulator;
+
+private:
+
+	ThreadWorkerPool m_workerPool;
+	BYTE * m_pMemory;
+	bool m_bGLShaderState;
+};
+
+//
+// Constant colored triangle covering the lower left half of the render target
+//
+
+static bool TestNVTriangle(UINT numWorkers, std::vector<UINT> * pImage)
+{
+	EmulatorTest test(numWorkers);
+	bool passed = true;
+
+	const UINT color = 0xFF00FF00;
+	VC4_QPU_INSTRUCTION fragmentShader[] = { Mov(VC4_QPU_WADDR_TLB_COLOUR_ALL, VC4_QPU_RADDR_UNIFORM) };
+
+	test.SetNVTriangle(kWidth);
+	test.SetFragmentShader(fragmentShader, ARRAYSIZE(fragmentShader));
+	*test.GetPointer<UINT>(kUniforms) = color;
+
+	//
+	// The second frame runs on the tile allocation memory of the first one
+	//
+
+	passed &= test.Render();
+	passed &= test.Render();
+
+	UINT numInside = 0;
+
+	for (UINT y = 0; y < kHeight; y++)
+	{
+		for (UINT x = 0; x < kWidth; x++)
+		{
+			UINT pixel = test.GetPixel(x, y);
+
+			pImage->push_back(pixel);
+
+			if (x + y < kWidth - 1)
+			{
+				numInside += (color == pixel);
+			}
+			else if (x + y > kWidth)
+			{
+				if (!Check(kClearColor == pixel, "pixel outside of the triangle was written"))
+					return false;
+			}
+		}
+	}
+
+	passed &= Check(numInside == (kWidth - 1)*kWidth/2, "pixel inside of the triangle was not written");
+
+	return passed;
+}
+
+//
+// Triangle shaded on the QPU, the varying goes from 0 at x = -1 to 1 at x = 1
+// and is clamped at 0 by the 8888 pack
+//
+
+static bool TestGLTriangle()
+{
+	EmulatorTest test(4);
+
+	test.SetGLTriangle();
+
+	if (!test.Render())
+		return false;
+
+	UINT numCovered = 0;
+
+	for (UINT y = 0; y < kHeight; y++)
+	{
+		for (UINT x = 0; x < kWidth; x++)
+		{
+			UINT pixel = test.GetPixel(x, y);
+
+			if (kClearColor == pixel)
+				continue;
+
+			numCovered++;
+
+			float position = (x + 0.5f)/(kWidth/2) - 1.0f;
+			INT expected = (INT)(max(position, 0.0f)*255.0f + 0.5f);
+			INT gray = pixel & 0xFF;
+
+			if ((abs(expected - gray) > 1) || (pixel != (UINT)gray*0x01010101))
+			{
+				printf("GL triangle: pixel (%u, %u) is 0x%08x, expected gray 0x%02x\n", x, y, pixel, expected);
+				return false;
+			}
+		}
+	}
+
+	return Check(numCovered == (kWidth - 1)*kWidth/2, "GL triangle did not cover half of the render target");
+}
+
+static bool TestQpu()
+{
+	EmulatorTest test(2);
+	bool passed = true;
+
+	//
+	// Uniforms are read in order
+	//
+
+	{
+		VC4_QPU_INSTRUCTION code[] =
+		{
+			Mov(VC4_QPU_WADDR_ACC0, VC4_QPU_RADDR_UNIFORM),
+			Mov(VC4_QPU_WADDR_ACC1, VC4_QPU_RADDR_UNIFORM),
+			Add(VC4_QPU_OPCODE_ADD_ADD, VC4_QPU_WADDR_TLB_COLOUR_ALL, VC4_QPU_ALU_R0, VC4_QPU_ALU_R1),
+		};
+		UINT uniforms[] = { 0x00010203, 0x01020304 };
+
+		passed &= test.RenderFragmentShader(code, ARRAYSIZE(code), uniforms, ARRAYSIZE(uniforms), 0x01030507, "uniforms");
+	}
+
+	//
+	// A regfile write is read by the second instruction after it, the next
+	// one still reads the old value, an accumulator write is read by the
+	// next instruction
+	//
+
+	{
+		VC4_QPU_INSTRUCTION code[] =
+		{
+			Ldi(0, kNop, 0x100),
+			Mov(VC4_QPU_WADDR_ACC0, 0),	// 0
+			Mov(VC4_QPU_WADDR_ACC1, 0),	// 0x100
+			Ldi(VC4_QPU_WADDR_ACC2, kNop, 0x10000),
+			Add(VC4_QPU_OPCODE_ADD_ADD, VC4_QPU_WADDR_ACC3, VC4_QPU_ALU_R2, VC4_QPU_ALU_R1),
+			Add(VC4_QPU_OPCODE_ADD_ADD, VC4_QPU_WADDR_TLB_COLOUR_ALL, VC4_QPU_ALU_R3, VC4_QPU_ALU_R0),
+		};
+
+		passed &= test.RenderFragmentShader(code, ARRAYSIZE(code), NULL, 0, 0x10100, "write latency");
+	}
+
+	//
+	// Small immediates replace the regfile B read, as integers and as powers
+	// of 2
+	//
+
+	{
+		VC4_QPU_INSTRUCTION code[] =
+		{
+			Ldi(VC4_QPU_WADDR_ACC0, kNop, AsUint(1.5f)),
+			Mul(VC4_QPU_OPCODE_MUL_FMUL, VC4_QPU_WADDR_ACC1, VC4_QPU_ALU_R0, kRegB, kRaddrNop, SmallFloat(1), VC4_QPU_SIG_ALU_WITH_RADDR_B),
+			Add(VC4_QPU_OPCODE_ADD_FTOI, VC4_QPU_WADDR_ACC1, VC4_QPU_ALU_R1, VC4_QPU_ALU_R1),
+			Add(VC4_QPU_OPCODE_ADD_ADD, VC4_QPU_WADDR_ACC2, VC4_QPU_ALU_R1, kRegB, kRaddrNop, SmallInt(12), VC4_QPU_SIG_ALU_WITH_RADDR_B),
+			Add(VC4_QPU_OPCODE_ADD_ADD, VC4_QPU_WADDR_TLB_COLOUR_ALL, VC4_QPU_ALU_R2, kRegB, kRaddrNop, SmallInt(-3), VC4_QPU_SIG_ALU_WITH_RADDR_B),
+		};
+
+		passed &= test.RenderFragmentShader(code, ARRAYSIZE(code), NULL, 0, 12, "small immediates");
+	}
+
+	//
+	// The 3 delay slots of a taken branch run, the skipped instruction
+	// does not
+	//
+
+	{
+		VC4_QPU_INSTRUCTION code[] =
+		{
+			Ldi(VC4_QPU_WADDR_ACC0, kNop, 1),
+			BranchRelative(sizeof(VC4_QPU_INSTRUCTION)),
+			Add(VC4_QPU_OPCODE_ADD_ADD, VC4_QPU_WADDR_ACC0, VC4_QPU_ALU_R0, kRegB, kRaddrNop, SmallInt(2), VC4_QPU_SIG_ALU_WITH_RADDR_B),
+			Add(VC4_QPU_OPCODE_ADD_ADD, VC4_QPU_WADDR_ACC0, VC4_QPU_ALU_R0, kRegB, kRaddrNop, SmallInt(4), VC4_QPU_SIG_ALU_WITH_RADDR_B),
+			Add(VC4_QPU_OPCODE_ADD_ADD, VC4_QPU_WADDR_ACC0, VC4_QPU_ALU_R0, kRegB, kRaddrNop, SmallInt(8), VC4_QPU_SIG_ALU_WITH_RADDR_B),
+			Ldi(VC4_QPU_WADDR_ACC0, kNop, 0x100),
+			Add(VC4_QPU_OPCODE_ADD_OR, VC4_QPU_WADDR_TLB_COLOUR_ALL, VC4_QPU_ALU_R0, VC4_QPU_ALU_R0),
+		};
+
+		passed &= test.RenderFragmentShader(code, ARRAYSIZE(code), NULL, 0, 15, "branch");
+	}
+
+	//
+	// SFU results land in r4
+	//
+
+	{
+		VC4_QPU_INSTRUCTION code[] =
+		{
+			Ldi(VC4_QPU_WADDR_SFU_RECIP, kNop, AsUint(8.0f)),
+			Nop(),
+			Nop(),
+			Add(VC4_QPU_OPCODE_ADD_OR, VC4_QPU_WADDR_ACC1, VC4_QPU_ALU_R4, VC4_QPU_ALU_R4),
+			Ldi(VC4_QPU_WADDR_SFU_RECIPSQRT, kNop, AsUint(4.0f)),
+			Nop(),
+			Nop(),
+			Add(VC4_QPU_OPCODE_ADD_FADD, VC4_QPU_WADDR_TLB_COLOUR_ALL, VC4_QPU_ALU_R1, VC4_QPU_ALU_R4),
+		};
+
+		passed &= test.RenderFragmentShader(code, ARRAYSIZE(code), NULL, 0, AsUint(0.625f), "SFU");
+	}
+
+	return passed;
+}
+
+//
+// Control lists that cannot be run fail the job, the next frame renders
+//
+
+static bool TestFailures()
+{
+	EmulatorTest test(2);
+	bool passed = true;
+
+	const UINT invalidAddress = kMemoryBase + kMemorySize;
+	VC4_QPU_INSTRUCTION fragmentShader[] = { Mov(VC4_QPU_WADDR_TLB_COLOUR_ALL, VC4_QPU_RADDR_UNIFORM) };
+
+	test.SetNVTriangle(kWidth);
+	test.SetFragmentShader(fragmentShader, ARRAYSIZE(fragmentShader));
+	*test.GetPointer<UINT>(kUniforms) = 0xFF00FF00;
+
+	{
+		VC4TileBinningModeConfig binningConfig = EmulatorTest::GetBinningConfig();
+
+		binningConfig.TileStateDataArrayBaseAddress = invalidAddress;
+
+		UINT binningEnd = test.BuildBinningControlList(binningConfig);
+
+		passed &= Check(!test.m_pEmulator->ExecuteBinningControlList(kBinningControlList, binningEnd), "binning with an invalid tile state array did not fail");
+	}
+
+	{
+		VC4TileBinningModeConfig binningConfig = EmulatorTest::GetBinningConfig();
+
+		binningConfig.TileAllocationMemorySize = 16;
+
+		UINT binningEnd = test.BuildBinningControlList(binningConfig);
+
+		passed &= Check(!test.m_pEmulator->ExecuteBinningControlList(kBinningControlList, binningEnd), "binning with too little tile allocation memory did not fail");
+	}
+
+	{
+		//
+		// The branch replaces the 4 packets ending the list
+		//
+
+		UINT branchAddress = test.BuildBinningControlList(EmulatorTest::GetBinningConfig()) - 4;
+		VC4Branch branch = vc4Branch;
+
+		branch.BranchAddress = invalidAddress;
+		memcpy(test.GetPointer<VC4Branch>(branchAddress), &branch, sizeof(branch));
+
+		passed &= Check(!test.m_pEmulator->ExecuteBinningControlList(kBinningControlList, branchAddress + sizeof(branch)), "binning control list branching out of memory did not fail");
+	}
+
+	passed &= test.Render();
+
+	{
+		UINT binningEnd = test.BuildBinningControlList(EmulatorTest::GetBinningConfig());
+		UINT renderingEnd = test.BuildRenderingControlList();
+		VC4Branch branch = vc4Branch;
+
+		//
+		// The branch replaces the wait on semaphore and the start of the
+		// rendering mode config
+		//
+
+		branch.BranchAddress = invalidAddress;
+		memcpy(test.GetPointer<VC4Branch>(kRenderingControlList + sizeof(VC4ClearColors)), &branch, sizeof(branch));
+
+		passed &= Check(test.m_pEmulator->ExecuteBinningControlList(kBinningControlList, binningEnd), "binning failed");
+		passed &= Check(!test.m_pEmulator->ExecuteRenderingControlList(kRenderingControlList, renderingEnd), "rendering control list branching out of memory did not fail");
+	}
+
+	passed &= test.Render();
+	passed &= Check(0xFF00FF00 == test.GetPixel(0, 0), "frame after the failures was not rendered");
+
+	return passed;
+}
+
+int main()
+{
+	bool passed = true;
+
+	std::vector<UINT> serialImage;
+	std::vector<UINT> parallelImage;
+
+	passed &= TestNVTriangle(1, &serialImage);
+	passed &= TestNVTriangle(4, &parallelImage);
+	passed &= Check(serialImage == parallelImage, "image rendered by 4 workers differs");
+
+	passed &= TestGLTriangle();
+	passed &= TestQpu();
+	passed &= TestFailures();
+
+	printf("%s\n", passed ? "all tests passed" : "TESTS FAILED");
+
+	return passed ? 0 : 1;
+}
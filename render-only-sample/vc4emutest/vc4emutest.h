@@ -0,0 +1,21 @@
+#pragma once
+
+//
+// Stands in for the KMD precompiled header and WPP logging when the VC4
+// emulator sources are built in user mode for vc4emutest
+//
+
+#include <windows.h>
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define NT_ASSERT(e) assert(e)
+
+#define ExAllocatePoolWithTag(poolType, numberOfBytes, tag) malloc(numberOfBytes)
+#define ExFreePool(p) free(p)
+
+#define ROS_LOG_ERROR(...) (printf(__VA_ARGS__), printf("\n"))
+#define ROS_LOG_WARNING(...) (printf(__VA_ARGS__), printf("\n"))
+#define ROS_LOG_TRACE(...) ((void)0)
@@ -0,0 +1,1143 @@
+#include "precomp.h"
+#include "roscompiler.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+// Test for the QPU instruction scheduler of the VC4 shader compiler
+//
+// Builds QPU code with Vc4Instruction the way Vc4Shader emits it, one ALU
+// operation per instruction and NOP padded, runs Vc4Scheduler over it and
+// checks the scheduled code. Every result is executed next to the original
+// code on a symbolic QPU model that lands register writes after their
+// latency (regfile 2, accumulators 1, r4 3 after an SFU write and 1 after
+// ldtmu) and logs uniform, varying, VPM, TMU, TLB and SFU accesses in order,
+// so a read moved ahead of its value or a reordered access shows up as a
+// different final state. The cases on top of that check pairing, regfile
+// read port and small immediate conflicts, the thrend tail and keeping the
+// original code when it can't be shortened. Last, the demo shaders are
+// lowered by hand with Vc4Shader's emission pattern and their instruction
+// counts before and after scheduling are printed.
+
+static bool Check(bool condition, const char * pMessage)
+{
+	if (!condition)
+		printf("%s\n", pMessage);
+
+	return condition;
+}
+
+//
+// Symbolic QPU model, every value is a hash of how it was computed
+//
+
+enum QpuTrace
+{
+	TraceVpm,
+	TraceTmu,
+	TraceTlb,
+	TraceSfu,
+	TraceSignal,
+	TraceCount
+};
+
+static const UINT kSlotRegfileA = 0;
+static const UINT kSlotRegfileB = 32;
+static const UINT kSlotAcc = 64;		// r0~r5
+static const UINT kSlotFlags = 70;
+static const UINT kSlotCount = 71;
+
+static const UINT kMaxLatency = 4;
+
+enum QpuTag
+{
+	TagSeed = 1,
+	TagImmediate,
+	TagSmallImmediate,
+	TagUnpack,
+	TagAdd,
+	TagMul,
+	TagPack,
+	TagCond,
+	TagFlags,
+	TagUniform,
+	TagVarying,
+	TagVaryingC,
+	TagVpmRead,
+	TagRaddr,
+	TagAcc5,
+	TagSfu,
+	TagTmu,
+	TagWrite,
+};
+
+static UINT64 Hash(UINT64 a, UINT64 b)
+{
+	UINT64 h = (a ^ 0x9E3779B97F4A7C15ULL) * 0xBF58476D1CE4E5B9ULL;
+
+	h ^= b + 0x94D049BB133111EBULL + (h << 6) + (h >> 2);
+	h ^= h >> 31;
+
+	return h * 0x94D049BB133111EBULL;
+}
+
+static UINT64 Hash(UINT64 a, UINT64 b, UINT64 c)
+{
+	return Hash(Hash(a, b), c);
+}
+
+class QpuModel
+{
+public:
+
+	QpuModel() :
+		m_uniform(0),
+		m_varying(0),
+		m_vpm(0),
+		m_tmu(0)
+	{
+		for (UINT i = 0; i < kSlotCount; i++)
+			m_value[i] = Hash(TagSeed, i);
+	}
+
+	void Run(const std::vector<VC4_QPU_INSTRUCTION> & code)
+	{
+		// Keeps going past the last instruction until every write landed
+		for (UINT cycle = 0; cycle < code.size() + kMaxLatency; cycle++)
+		{
+			Land(cycle);
+
+			if (cycle < code.size())
+				Execute(code[cycle], cycle);
+		}
+	}
+
+	bool Equals(const QpuModel & other) const
+	{
+		if (memcmp(m_value, other.m_value, sizeof(m_value)) ||
+			(m_uniform != other.m_uniform) ||
+			(m_varying != other.m_varying))
+		{
+			return false;
+		}
+
+		for (UINT i = 0; i < TraceCount; i++)
+		{
+			if (m_trace[i] != other.m_trace[i])
+				return false;
+		}
+
+		return true;
+	}
+
+private:
+
+	struct Write
+	{
+		UINT m_slot;
+		UINT64 m_value;
+		UINT64 m_merge;		// non-zero for packed or conditional writes
+		UINT m_cycle;
+	};
+
+	void Pend(UINT slot, UINT64 value, UINT64 merge, UINT cycle)
+	{
+		Write write = { slot, value, merge, cycle };
+
+		m_pending.push_back(write);
+	}
+
+	void Land(UINT cycle)
+	{
+		for (UINT i = 0; i < m_pending.size();)
+		{
+			const Write & write = m_pending[i];
+
+			if (write.m_cycle != cycle)
+			{
+				i++;
+				continue;
+			}
+
+			if (write.m_merge)
+				m_value[write.m_slot] = Hash(write.m_merge, m_value[write.m_slot], write.m_value);
+			else
+				m_value[write.m_slot] = write.m_value;
+
+			m_pending.erase(m_pending.begin() + i);
+		}
+	}
+
+	UINT64 Read(UINT raddr, UINT file, UINT cycle)
+	{
+		if (raddr < 32)
+			return m_value[(file ? kSlotRegfileB : kSlotRegfileA) + raddr];
+
+		switch (raddr)
+		{
+		case VC4_QPU_RADDR_NOP:
+			return 0;
+		case VC4_QPU_RADDR_UNIFORM:
+			return Hash(TagUniform, m_uniform++);
+		case VC4_QPU_RADDR_VERYING:
+			Pend(kSlotAcc + 5, Hash(TagVaryingC, m_varying), 0, cycle + 1);
+			return Hash(TagVarying, m_varying++);
+		case VC4_QPU_RADDR_VPM:
+			m_trace[TraceVpm].push_back(Hash(TagVpmRead, m_vpm));
+			return Hash(TagVpmRead, m_vpm++);
+		default:
+			return Hash(TagRaddr, raddr, file);
+		}
+	}
+
+	void WriteResult(UINT waddr, bool bRegfileA, UINT cond, UINT64 value, UINT pack, UINT cycle)
+	{
+		if ((VC4_QPU_COND_NEVER == cond) || (VC4_QPU_WADDR_NOP == waddr))
+			return;
+
+		UINT64 merge = 0;
+
+		if (VC4_QPU_COND_ALWAYS != cond)
+			merge = Hash(TagCond + cond, m_value[kSlotFlags]);
+
+		if (pack)
+			merge = Hash(TagPack, merge, pack);
+
+		if (waddr < 32)
+		{
+			Pend((bRegfileA ? kSlotRegfileA : kSlotRegfileB) + waddr, value, merge, cycle + 2);
+			return;
+		}
+
+		UINT64 access = Hash(Hash(TagWrite, waddr), value, merge);
+
+		switch (waddr)
+		{
+		case VC4_QPU_WADDR_ACC0:
+		case VC4_QPU_WADDR_ACC1:
+		case VC4_QPU_WADDR_ACC2:
+		case VC4_QPU_WADDR_ACC3:
+			Pend(kSlotAcc + (waddr - VC4_QPU_WADDR_ACC0), value, merge, cycle + 1);
+			break;
+		case VC4_QPU_WADDR_ACC5:
+			Pend(kSlotAcc + 5, Hash(TagAcc5, value, bRegfileA), merge, cycle + 1);
+			break;
+		case VC4_QPU_WADDR_SFU_RECIP:
+		case VC4_QPU_WADDR_SFU_RECIPSQRT:
+		case VC4_QPU_WADDR_SFU_EXP:
+		case VC4_QPU_WADDR_SFU_LOG:
+			m_trace[TraceSfu].push_back(access);
+			Pend(kSlotAcc + 4, Hash(TagSfu, waddr, value), 0, cycle + 3);
+			break;
+		case VC4_QPU_WADDR_TMU_NOSWAP:
+		case VC4_QPU_WADDR_TMU0_T:
+		case VC4_QPU_WADDR_TMU0_R:
+		case VC4_QPU_WADDR_TMU0_B:
+		case VC4_QPU_WADDR_TMU1_T:
+		case VC4_QPU_WADDR_TMU1_R:
+		case VC4_QPU_WADDR_TMU1_B:
+			m_trace[TraceTmu].push_back(access);
+			break;
+		case VC4_QPU_WADDR_TMU0_S:
+		case VC4_QPU_WADDR_TMU1_S:
+			// the request takes its texture config from the uniform stream
+			m_trace[TraceTmu].push_back(access);
+			m_trace[TraceTmu].push_back(Hash(TagUniform, m_uniform++));
+			break;
+		case VC4_QPU_WADDR_TLB_STENCIL_SETUP:
+		case VC4_QPU_WADDR_TLB_Z:
+		case VC4_QPU_WADDR_TLB_COLOUR_MS:
+		case VC4_QPU_WADDR_TLB_COLOUR_ALL:
+		case VC4_QPU_WADDR_TLB_ALPHA_MASK:
+			m_trace[TraceTlb].push_back(access);
+			break;
+		default:
+			// VPM setup and address registers differ between regfile A and B
+			m_trace[TraceVpm].push_back(Hash(access, bRegfileA));
+			break;
+		}
+	}
+
+	void Execute(VC4_QPU_INSTRUCTION inst, UINT cycle)
+	{
+		UINT sig = (UINT)VC4_QPU_GET_SIG(inst);
+		bool bWriteSwap = VC4_QPU_IS_WRITESWAP_SET(inst);
+		bool bPm = VC4_QPU_IS_PM_SET(inst);
+		UINT pack = (UINT)VC4_QPU_GET_PACK(inst);
+
+		if (VC4_QPU_SIG_BRANCH == sig)
+		{
+			m_trace[TraceSignal].push_back(inst);
+			return;
+		}
+
+		if (VC4_QPU_SIG_LOAD_IMMEDIATE == sig)
+		{
+			UINT64 value = Hash(TagImmediate, VC4_QPU_GET_IMMEDIATE_32(inst));
+
+			WriteResult((UINT)VC4_QPU_GET_WADDR_ADD(inst), !bWriteSwap, (UINT)VC4_QPU_GET_COND_ADD(inst), value, 0, cycle);
+			WriteResult((UINT)VC4_QPU_GET_WADDR_MUL(inst), bWriteSwap, (UINT)VC4_QPU_GET_COND_MUL(inst), value, 0, cycle);
+			return;
+		}
+
+		UINT raddrA = (UINT)VC4_QPU_GET_RADDR_A(inst);
+		UINT unpack = (UINT)VC4_QPU_GET_UNPACK(inst);
+		UINT64 mux[8];
+
+		UINT64 a = Read(raddrA, 0, cycle);
+		if (unpack && !bPm && (raddrA < 32))
+			a = Hash(TagUnpack + unpack, a);
+
+		UINT64 b;
+		if (VC4_QPU_SIG_ALU_WITH_RADDR_B == sig)
+			b = Hash(TagSmallImmediate, VC4_QPU_GET_SMALL_IMMEDIATE(inst));
+		else
+			b = Read((UINT)VC4_QPU_GET_RADDR_B(inst), 1, cycle);
+
+		for (UINT i = 0; i < 6; i++)
+			mux[i] = m_value[kSlotAcc + i];
+		if (unpack && bPm)
+			mux[VC4_QPU_ALU_R4] = Hash(TagUnpack + unpack, mux[VC4_QPU_ALU_R4]);
+		mux[VC4_QPU_ALU_REG_A] = a;
+		mux[VC4_QPU_ALU_REG_B] = b;
+
+		UINT opAdd = (UINT)VC4_QPU_GET_OPCODE_ADD(inst);
+		UINT opMul = (UINT)VC4_QPU_GET_OPCODE_MUL(inst);
+		UINT64 add = Hash(TagAdd + opAdd, mux[VC4_QPU_GET_ADD_A(inst)], mux[VC4_QPU_GET_ADD_B(inst)]);
+		UINT64 mul = Hash(TagMul + opMul, mux[VC4_QPU_GET_MUL_A(inst)], mux[VC4_QPU_GET_MUL_B(inst)]);
+
+		UINT waddrAdd = (UINT)VC4_QPU_GET_WADDR_ADD(inst);
+		UINT waddrMul = (UINT)VC4_QPU_GET_WADDR_MUL(inst);
+
+		// Without pm, pack applies to whichever pipe writes regfile A
+		UINT packAdd = (pack && !bPm && !bWriteSwap && (waddrAdd < 32)) ? pack : 0;
+		UINT packMul = (pack && (bPm || (bWriteSwap && (waddrMul < 32)))) ? pack : 0;
+
+		if (VC4_QPU_IS_SETFLAGS_SET(inst))
+			Pend(kSlotFlags, Hash(TagFlags, (VC4_QPU_OPCODE_ADD_NOP != opAdd) ? add : mul), 0, cycle + 1);
+
+		WriteResult(waddrAdd, !bWriteSwap, (UINT)VC4_QPU_GET_COND_ADD(inst), add, packAdd, cycle);
+		WriteResult(waddrMul, bWriteSwap, (UINT)VC4_QPU_GET_COND_MUL(inst), mul, packMul, cycle);
+
+		switch (sig)
+		{
+		case VC4_QPU_SIG_NO_SIGNAL:
+		case VC4_QPU_SIG_ALU_WITH_RADDR_B:
+			break;
+		case VC4_QPU_SIG_LOAD_TMU0:
+		case VC4_QPU_SIG_LOAD_TMU1:
+			m_trace[TraceTmu].push_back(Hash(TagTmu, sig));
+			Pend(kSlotAcc + 4, Hash(TagTmu, m_tmu++), 0, cycle + 1);
+			break;
+		default:
+			m_trace[TraceSignal].push_back(sig);
+			break;
+		}
+	}
+
+	UINT64 m_value[kSlotCount];
+	std::vector<UINT64> m_trace[TraceCount];
+	std::vector<Write> m_pending;
+
+	UINT m_uniform;
+	UINT m_varying;
+	UINT m_vpm;
+	UINT m_tmu;
+};
+
+//
+// Emission helpers, one HLSL level operation per instruction like Vc4Shader
+//
+
+static Vc4Register RegA(uint8_t addr)
+{
+	return Vc4Register(VC4_QPU_ALU_REG_A, addr);
+}
+
+static Vc4Register RegB(uint8_t addr)
+{
+	return Vc4Register(VC4_QPU_ALU_REG_B, addr);
+}
+
+static Vc4Register Acc(uint8_t n)
+{
+	if (n == 4)
+		return Vc4Register(VC4_QPU_ALU_R4);
+
+	return Vc4Register(VC4_QPU_ALU_R0 + n, VC4_QPU_WADDR_ACC0 + n);
+}
+
+static void EmitNop(Vc4ShaderStorage * pCode, uint8_t sig = VC4_QPU_SIG_NO_SIGNAL)
+{
+	Vc4Instruction Vc4Inst;
+	Vc4Inst.Vc4_Sig(sig);
+	Vc4Inst.Emit(pCode);
+}
+
+static void EmitAdd(Vc4ShaderStorage * pCode, uint8_t opcode, Vc4Register dst, Vc4Register src1, Vc4Register src2, uint8_t sig = VC4_QPU_SIG_NO_SIGNAL)
+{
+	Vc4Instruction Vc4Inst((VC4_QPU_SIG_ALU_WITH_RADDR_B == sig) ? vc4_alu_small_immediate : vc4_alu);
+	Vc4Inst.Vc4_a_Inst(opcode, dst, src1, src2, VC4_QPU_COND_ALWAYS);
+	if (VC4_QPU_SIG_ALU_WITH_RADDR_B != sig)
+		Vc4Inst.Vc4_Sig(sig);
+	Vc4Inst.Emit(pCode);
+}
+
+static void EmitMul(Vc4ShaderStorage * pCode, uint8_t opcode, Vc4Register dst, Vc4Register src1, Vc4Register src2, uint8_t pack = 0, uint8_t sig = VC4_QPU_SIG_NO_SIGNAL)
+{
+	Vc4Instruction Vc4Inst((VC4_QPU_SIG_ALU_WITH_RADDR_B == sig) ? vc4_alu_small_immediate : vc4_alu);
+	Vc4Inst.Vc4_m_Inst(opcode, dst, src1, src2, VC4_QPU_COND_ALWAYS);
+	Vc4Inst.Vc4_m_Pack(pack);
+	if (VC4_QPU_SIG_ALU_WITH_RADDR_B != sig)
+		Vc4Inst.Vc4_Sig(sig);
+	Vc4Inst.Emit(pCode);
+}
+
+static void EmitMov(Vc4ShaderStorage * pCode, Vc4Register dst, Vc4Register src)
+{
+	EmitAdd(pCode, VC4_QPU_OPCODE_ADD_OR, dst, src, src);
+}
+
+static void EmitMulMov(Vc4ShaderStorage * pCode, Vc4Register dst, Vc4Register src, uint8_t pack = 0)
+{
+	EmitMul(pCode, VC4_QPU_OPCODE_MUL_V8MIN, dst, src, src, pack);
+}
+
+static void EmitLoad(Vc4ShaderStorage * pCode, Vc4Register dst, uint32_t value, bool bAddPipe)
+{
+	Vc4Register immediate;
+	immediate.SetImmediateI(value);
+
+	Vc4Instruction Vc4Inst(vc4_load_immediate_32);
+	if (bAddPipe)
+		Vc4Inst.Vc4_a_LOAD32(dst, immediate);
+	else
+		Vc4Inst.Vc4_m_LOAD32(dst, immediate);
+	Vc4Inst.Emit(pCode);
+}
+
+//
+// Shader code before and after Vc4Scheduler::Run()
+//
+
+class QpuCode
+{
+public:
+
+	QpuCode()
+	{
+		m_storage.Initialize();
+	}
+
+	Vc4ShaderStorage * Storage()
+	{
+		return &m_storage;
+	}
+
+	//
+	// Schedules the code in place, returns false when the scheduler failed or
+	// the scheduled code computes something else than the original
+	//
+
+	bool Schedule(const char * pName)
+	{
+		bool passed = true;
+
+		Copy(&m_input);
+
+		Vc4Scheduler scheduler;
+		HRESULT hr = scheduler.Run(&m_storage);
+
+		Copy(&m_output);
+
+		passed &= Check(SUCCEEDED(hr), "scheduler failed");
+		passed &= Check(scheduler.GetInputInstructionCount() == m_input.size(), "wrong input instruction count");
+		passed &= Check(scheduler.GetOutputInstructionCount() == m_output.size(), "wrong output instruction count");
+		passed &= Check(m_output.size() <= m_input.size(), "scheduled code is longer");
+
+		QpuModel before;
+		QpuModel after;
+
+		before.Run(m_input);
+		after.Run(m_output);
+
+		passed &= Check(before.Equals(after), "scheduled code computes a different result");
+
+		if (!passed)
+		{
+			printf("%s\n", pName);
+			Dump("input", m_input);
+			Dump("output", m_output);
+		}
+
+		return passed;
+	}
+
+	//
+	// Position of the first scheduled instruction matching (inst & mask)
+	//
+
+	UINT Find(UINT64 mask, UINT64 value) const
+	{
+		for (UINT i = 0; i < m_output.size(); i++)
+		{
+			if ((m_output[i] & mask) == value)
+				return i;
+		}
+
+		return UINT_MAX;
+	}
+
+	std::vector<VC4_QPU_INSTRUCTION> m_input;
+	std::vector<VC4_QPU_INSTRUCTION> m_output;
+
+private:
+
+	void Copy(std::vector<VC4_QPU_INSTRUCTION> * pCode)
+	{
+		const VC4_QPU_INSTRUCTION * pInst = m_storage.GetStorage<VC4_QPU_INSTRUCTION>();
+
+		pCode->assign(pInst, pInst + m_storage.GetUsedSize<VC4_QPU_INSTRUCTION>());
+	}
+
+	static void Dump(const char * pTitle, const std::vector<VC4_QPU_INSTRUCTION> & code)
+	{
+		printf("  %s\n", pTitle);
+
+		for (UINT i = 0; i < code.size(); i++)
+			printf("    %2u: %016llx\n", i, (unsigned long long)code[i]);
+	}
+
+	Vc4ShaderStorage m_storage;
+};
+
+static const UINT64 kWaddrAddMask = VC4_QPU_WADDR_ADD_MASK;
+static const UINT64 kWaddrMulMask = VC4_QPU_WADDR_MUL_MASK;
+
+static UINT64 WaddrAdd(UINT waddr)
+{
+	VC4_QPU_INSTRUCTION inst = 0;
+	VC4_QPU_SET_WADDR_ADD(inst, waddr);
+	return inst;
+}
+
+static UINT64 WaddrMul(UINT waddr)
+{
+	VC4_QPU_INSTRUCTION inst = 0;
+	VC4_QPU_SET_WADDR_MUL(inst, waddr);
+	return inst;
+}
+
+static bool IsPaired(VC4_QPU_INSTRUCTION inst)
+{
+	return !VC4_QPU_IS_OPCODE_ADD_NOP(inst) && !VC4_QPU_IS_OPCODE_MUL_NOP(inst);
+}
+
+//
+// Independent add and mul pipe operations are paired, NOP padding dropped
+//
+
+static bool TestPairing()
+{
+	bool passed = true;
+	QpuCode code;
+
+	EmitAdd(code.Storage(), VC4_QPU_OPCODE_ADD_FADD, Acc(1), RegA(0), RegA(0));
+	EmitNop(code.Storage());
+	EmitMul(code.Storage(), VC4_QPU_OPCODE_MUL_FMUL, Acc(2), RegA(0), RegB(1));
+	EmitNop(code.Storage());
+
+	passed &= code.Schedule("pairing");
+	passed &= Check(code.m_output.size() == 1, "add and mul were not paired");
+	passed &= Check(IsPaired(code.m_output[0]), "paired instruction lost an operation");
+
+	return passed;
+}
+
+//
+// Regfile results are read 2 instructions after the write, accumulators on
+// the next one, and independent operations fill the gap instead of a NOP
+//
+
+static bool TestRegisterLatency()
+{
+	bool passed = true;
+
+	{
+		QpuCode code;
+
+		EmitMov(code.Storage(), RegA(16), RegA(0));
+		EmitNop(code.Storage());
+		EmitMulMov(code.Storage(), Acc(1), RegA(16));
+		EmitNop(code.Storage());
+
+		passed &= code.Schedule("regfile latency");
+		passed &= Check(code.m_output.size() == 3, "regfile read was not kept 2 instructions after the write");
+		passed &= Check(VC4_QPU_IS_OPCODE_NOP(code.m_output[1]), "regfile latency was not padded");
+	}
+
+	{
+		QpuCode code;
+
+		EmitMov(code.Storage(), RegA(16), RegA(0));
+		EmitNop(code.Storage());
+		EmitMulMov(code.Storage(), Acc(1), RegA(16));
+		EmitNop(code.Storage());
+		EmitAdd(code.Storage(), VC4_QPU_OPCODE_ADD_FADD, Acc(2), RegB(1), RegB(1));
+		EmitNop(code.Storage());
+
+		passed &= code.Schedule("regfile latency fill");
+		passed &= Check(code.m_output.size() == 3, "regfile latency was not filled");
+		passed &= Check(VC4_QPU_GET_OPCODE_ADD(code.m_output[1]) == VC4_QPU_OPCODE_ADD_FADD, "independent add did not fill the gap");
+	}
+
+	{
+		QpuCode code;
+
+		EmitMov(code.Storage(), Acc(0), RegA(0));
+		EmitNop(code.Storage());
+		EmitMul(code.Storage(), VC4_QPU_OPCODE_MUL_FMUL, Acc(1), Acc(0), Acc(0));
+		EmitNop(code.Storage());
+		EmitAdd(code.Storage(), VC4_QPU_OPCODE_ADD_FADD, Acc(2), Acc(1), Acc(0));
+		EmitNop(code.Storage());
+
+		passed &= code.Schedule("accumulator latency");
+		passed &= Check(code.m_output.size() == 3, "accumulator chain was padded");
+	}
+
+	return passed;
+}
+
+//
+// r4 is read 3 instructions after the SFU write and the instruction after
+// ldtmu, TMU requests keep their order ahead of ldtmu
+//
+
+static bool TestR4Latency()
+{
+	bool passed = true;
+
+	{
+		QpuCode code;
+
+		EmitMov(code.Storage(), RegA(VC4_QPU_WADDR_SFU_RECIP), RegB(19));
+		EmitNop(code.Storage());
+		EmitNop(code.Storage());
+		EmitMul(code.Storage(), VC4_QPU_OPCODE_MUL_FMUL, Acc(0), RegB(16), Acc(4));
+		EmitNop(code.Storage());
+		EmitMulMov(code.Storage(), RegA(16), RegA(0));
+		EmitNop(code.Storage());
+		EmitMulMov(code.Storage(), RegA(17), RegA(1));
+		EmitNop(code.Storage());
+		EmitMov(code.Storage(), RegA(VC4_QPU_WADDR_SFU_RECIPSQRT), RegA(2));
+		EmitNop(code.Storage());
+		EmitNop(code.Storage());
+		EmitMul(code.Storage(), VC4_QPU_OPCODE_MUL_FMUL, Acc(1), RegB(17), Acc(4));
+		EmitNop(code.Storage());
+
+		passed &= code.Schedule("sfu latency");
+
+		UINT write = code.Find(kWaddrAddMask, WaddrAdd(VC4_QPU_WADDR_SFU_RECIP));
+		UINT read = code.Find(kWaddrMulMask, WaddrMul(VC4_QPU_WADDR_ACC0));
+
+		passed &= Check((write != UINT_MAX) && (read != UINT_MAX) && (read >= write + 3), "r4 was read before the SFU result");
+		passed &= Check(code.m_output.size() < 9, "SFU latency was not filled");
+	}
+
+	{
+		QpuCode code;
+
+		EmitMov(code.Storage(), RegA(VC4_QPU_WADDR_TMU0_T), RegA(1));
+		EmitMov(code.Storage(), RegA(VC4_QPU_WADDR_TMU0_S), RegA(0));
+		EmitNop(code.Storage(), VC4_QPU_SIG_LOAD_TMU0);
+		for (uint8_t i = 0; i < 4; i++)
+		{
+			Vc4Instruction Vc4Inst;
+			Vc4Inst.Vc4_m_MOV(Acc(i), Acc(4));
+			Vc4Inst.Vc4_m_Unpack(VC4_QPU_UNPACK_8a + i, true);
+			Vc4Inst.Emit(code.Storage());
+		}
+		EmitNop(code.Storage());
+
+		passed &= code.Schedule("ldtmu latency");
+
+		UINT t = code.Find(kWaddrAddMask, WaddrAdd(VC4_QPU_WADDR_TMU0_T));
+		UINT s = code.Find(kWaddrAddMask, WaddrAdd(VC4_QPU_WADDR_TMU0_S));
+		UINT load = code.Find(VC4_QPU_SIG_MASK, (UINT64)VC4_QPU_SIG_LOAD_TMU0 << VC4_QPU_SIG_SHIFT);
+
+		passed &= Check((t < s) && (s < load) && (load != UINT_MAX), "TMU request was reordered");
+		passed &= Check((load + 1 < code.m_output.size()) && !VC4_QPU_IS_OPCODE_MUL_NOP(code.m_output[load + 1]), "r4 was not read right after ldtmu");
+		passed &= Check(VC4_QPU_IS_OPCODE_MUL_NOP(code.m_output[load]), "r4 was read by the ldtmu instruction");
+		passed &= Check(code.m_output.size() == 7, "ldtmu sequence was padded");
+	}
+
+	return passed;
+}
+
+//
+// A small immediate takes the raddr_b field, so it only pairs with an
+// operation using the same immediate and no regfile B read
+//
+
+static bool TestSmallImmediate()
+{
+	bool passed = true;
+
+	{
+		QpuCode code;
+
+		EmitAdd(code.Storage(), VC4_QPU_OPCODE_ADD_FADD, Acc(1), RegA(0), RegB(1), VC4_QPU_SIG_ALU_WITH_RADDR_B);
+		EmitNop(code.Storage());
+		EmitMul(code.Storage(), VC4_QPU_OPCODE_MUL_FMUL, Acc(2), RegA(0), RegB(2), 0, VC4_QPU_SIG_ALU_WITH_RADDR_B);
+		EmitNop(code.Storage());
+
+		passed &= code.Schedule("different small immediates");
+		passed &= Check(code.m_output.size() == 2, "different small immediates were paired");
+	}
+
+	{
+		QpuCode code;
+
+		EmitAdd(code.Storage(), VC4_QPU_OPCODE_ADD_FADD, Acc(1), RegA(0), RegB(1), VC4_QPU_SIG_ALU_WITH_RADDR_B);
+		EmitNop(code.Storage());
+		EmitMul(code.Storage(), VC4_QPU_OPCODE_MUL_FMUL, Acc(2), RegA(0), RegB(1), 0, VC4_QPU_SIG_ALU_WITH_RADDR_B);
+		EmitNop(code.Storage());
+
+		passed &= code.Schedule("same small immediate");
+		passed &= Check(code.m_output.size() == 1, "same small immediate was not paired");
+		passed &= Check(VC4_QPU_GET_SIG(code.m_output[0]) == VC4_QPU_SIG_ALU_WITH_RADDR_B, "small immediate signal was lost");
+	}
+
+	{
+		QpuCode code;
+
+		EmitAdd(code.Storage(), VC4_QPU_OPCODE_ADD_FADD, Acc(1), RegA(0), RegB(0), VC4_QPU_SIG_ALU_WITH_RADDR_B);
+		EmitNop(code.Storage());
+		EmitMul(code.Storage(), VC4_QPU_OPCODE_MUL_FMUL, Acc(2), RegB(0), RegB(0));
+		EmitNop(code.Storage());
+
+		passed &= code.Schedule("small immediate and rb0");
+		passed &= Check(code.m_output.size() == 2, "small immediate was paired with a regfile B read");
+	}
+
+	return passed;
+}
+
+//
+// Each regfile has one read port, uniforms and varyings can move to the
+// other one and are read in their original order
+//
+
+static bool TestReadPorts()
+{
+	bool passed = true;
+
+	{
+		QpuCode code;
+
+		EmitAdd(code.Storage(), VC4_QPU_OPCODE_ADD_FADD, Acc(1), RegA(0), RegA(0));
+		EmitNop(code.Storage());
+		EmitMul(code.Storage(), VC4_QPU_OPCODE_MUL_FMUL, Acc(2), RegA(1), RegA(1));
+		EmitNop(code.Storage());
+
+		passed &= code.Schedule("raddr_a conflict");
+		passed &= Check(code.m_output.size() == 2, "different raddr_a were paired");
+	}
+
+	{
+		QpuCode code;
+
+		EmitAdd(code.Storage(), VC4_QPU_OPCODE_ADD_FADD, Acc(1), RegB(0), RegB(0));
+		EmitNop(code.Storage());
+		EmitMul(code.Storage(), VC4_QPU_OPCODE_MUL_FMUL, Acc(2), RegB(1), RegB(1));
+		EmitNop(code.Storage());
+
+		passed &= code.Schedule("raddr_b conflict");
+		passed &= Check(code.m_output.size() == 2, "different raddr_b were paired");
+	}
+
+	{
+		QpuCode code;
+
+		EmitAdd(code.Storage(), VC4_QPU_OPCODE_ADD_FADD, Acc(1), RegA(0), RegA(0));
+		EmitNop(code.Storage());
+		EmitMul(code.Storage(), VC4_QPU_OPCODE_MUL_FMUL, Acc(2), RegA(VC4_QPU_RADDR_UNIFORM), RegA(VC4_QPU_RADDR_UNIFORM));
+		EmitNop(code.Storage());
+
+		passed &= code.Schedule("uniform read port swap");
+		passed &= Check(code.m_output.size() == 1, "uniform read was not moved to regfile B");
+		passed &= Check(VC4_QPU_GET_RADDR_B(code.m_output[0]) == VC4_QPU_RADDR_UNIFORM, "uniform is not read from regfile B");
+		passed &= Check(VC4_QPU_GET_MUL_A(code.m_output[0]) == VC4_QPU_ALU_REG_B, "mul does not read regfile B");
+	}
+
+	{
+		QpuCode code;
+
+		EmitAdd(code.Storage(), VC4_QPU_OPCODE_ADD_FADD, Acc(1), RegA(VC4_QPU_RADDR_UNIFORM), RegA(VC4_QPU_RADDR_UNIFORM));
+		EmitNop(code.Storage());
+		EmitMul(code.Storage(), VC4_QPU_OPCODE_MUL_FMUL, Acc(2), RegB(VC4_QPU_RADDR_UNIFORM), RegB(VC4_QPU_RADDR_UNIFORM));
+		EmitNop(code.Storage());
+
+		passed &= code.Schedule("uniform order");
+		passed &= Check(code.m_output.size() == 2, "two uniform reads were paired");
+		passed &= Check(!VC4_QPU_IS_OPCODE_ADD_NOP(code.m_output[0]), "uniform reads were reordered");
+	}
+
+	return passed;
+}
+
+//
+// Nothing moves into or behind the thrend instruction and its 2 delay slots
+//
+
+static bool TestThreadEnd()
+{
+	bool passed = true;
+	QpuCode code;
+
+	EmitMulMov(code.Storage(), RegB(16), RegA(0), VC4_QPU_PACK_MUL_8a);
+	EmitNop(code.Storage());
+	EmitMul(code.Storage(), VC4_QPU_OPCODE_MUL_FMUL, Acc(1), RegA(1), RegA(1));
+	EmitNop(code.Storage());
+	EmitAdd(code.Storage(), VC4_QPU_OPCODE_ADD_OR, RegA(VC4_QPU_WADDR_TLB_COLOUR_ALL), RegB(16), RegB(16), VC4_QPU_SIG_PROGRAM_END);
+	EmitNop(code.Storage());
+	EmitNop(code.Storage(), VC4_QPU_SIG_SCOREBOARD_UNBLOCK);
+
+	passed &= code.Schedule("thrend");
+	passed &= Check(code.m_output.size() == 5, "thrend tail was not scheduled");
+
+	if (code.m_output.size() >= 3)
+	{
+		passed &= Check(!memcmp(&code.m_output[code.m_output.size() - 3], &code.m_input[code.m_input.size() - 3], 3 * sizeof(VC4_QPU_INSTRUCTION)), "thrend tail was changed");
+		passed &= Check(VC4_QPU_GET_OPCODE_MUL(code.m_output[1]) == VC4_QPU_OPCODE_MUL_FMUL, "independent mul did not fill the TLB write latency");
+	}
+
+	return passed;
+}
+
+//
+// Code that can't get shorter is left as is
+//
+
+static bool TestKeepOriginal()
+{
+	bool passed = true;
+	QpuCode code;
+
+	EmitMov(code.Storage(), RegA(16), RegA(0));
+	EmitNop(code.Storage());
+	EmitMov(code.Storage(), RegA(17), RegA(16));
+
+	passed &= code.Schedule("keep original");
+	passed &= Check(code.m_output == code.m_input, "unshortened code was changed");
+
+	return passed;
+}
+
+//
+// Demo shaders, hand lowered with the instruction sequence Vc4Shader emits
+// for them: inputs in ra0~, outputs in rb16~, render target R8G8B8A8 with
+// depth enabled
+//
+
+static void EmitPrologueVS(Vc4ShaderStorage * pCode, uint8_t cInput)
+{
+	EmitLoad(pCode, RegA(VC4_QPU_WADDR_VPMVCD_RD_SETUP), MAKE_VR_SETUP(cInput, 1, true, false, VC4_QPU_32BIT_VECTOR, 0), true);
+	EmitLoad(pCode, RegB(VC4_QPU_WADDR_VPMVCD_WR_SETUP), MAKE_VW_SETUP(1, true, false, VC4_QPU_32BIT_VECTOR, 0), true);
+	for (uint8_t i = 0; i < cInput; i++)
+		EmitMov(pCode, RegA(i), RegA(VC4_QPU_RADDR_VPM));
+	EmitNop(pCode);
+}
+
+static void EmitProloguePS(Vc4ShaderStorage * pCode, uint8_t cInput)
+{
+	for (uint8_t i = 0; i < cInput; i++)
+	{
+		Vc4Instruction Vc4Inst;
+		Vc4Inst.Vc4_m_FMUL(Acc(0), RegB(VC4_QPU_RADDR_VERYING), RegA(15));
+		Vc4Inst.Vc4_a_FADD(RegA(i), Acc(0), Vc4Register(VC4_QPU_ALU_R5, VC4_QPU_WADDR_ACC5));
+		Vc4Inst.Emit(pCode);
+	}
+	EmitNop(pCode, VC4_QPU_SIG_WAIT_FOR_SCOREBOARD);
+}
+
+// mov dst[i], src[i] with an optional pack per component
+static void EmitMovN(Vc4ShaderStorage * pCode, const Vc4Register * pDst, const Vc4Register * pSrc, const uint8_t * pPack, uint8_t count)
+{
+	for (uint8_t i = 0; i < count; i++)
+		EmitMulMov(pCode, pDst[i], pSrc[i], pPack ? pPack[i] : 0);
+	EmitNop(pCode);
+}
+
+static void EmitDp4(Vc4ShaderStorage * pCode, Vc4Register dst, const Vc4Register * pSrc0, const Vc4Register * pSrc1)
+{
+	// r3 = 0, from the small immediate
+	EmitMul(pCode, VC4_QPU_OPCODE_MUL_V8MIN, Acc(3), RegB(0), RegB(0), 0, VC4_QPU_SIG_ALU_WITH_RADDR_B);
+
+	for (uint8_t i = 0; i < 4; i++)
+	{
+		Vc4Instruction Vc4Inst;
+		Vc4Inst.Vc4_m_FMUL(Acc(1), pSrc0[i], pSrc1[i]);
+		if (i > 0)
+			Vc4Inst.Vc4_a_FADD(Acc(3), Acc(3), Acc(1));
+		Vc4Inst.Emit(pCode);
+	}
+	EmitAdd(pCode, VC4_QPU_OPCODE_ADD_FADD, Acc(3), Acc(3), Acc(1));
+	EmitMulMov(pCode, dst, Acc(3));
+	EmitNop(pCode);
+}
+
+// Position output, clipping and viewport transform; a VS also writes the linkage
+static void EmitShaderOutputVS(Vc4ShaderStorage * pCode, bool bCoordinate, uint8_t cLinkage)
+{
+	if (bCoordinate)
+	{
+		for (uint8_t i = 0; i < 4; i++)
+			EmitMulMov(pCode, RegB(VC4_QPU_WADDR_VPM), RegB(16 + i));
+	}
+
+	EmitMov(pCode, RegA(VC4_QPU_WADDR_SFU_RECIP), RegB(19));
+	EmitNop(pCode);
+	EmitNop(pCode);
+
+	for (uint8_t i = 0; i < 2; i++)
+	{
+		EmitMul(pCode, VC4_QPU_OPCODE_MUL_FMUL, Acc(i), RegB(16 + i), Acc(4));
+		EmitMul(pCode, VC4_QPU_OPCODE_MUL_FMUL, Acc(i), Acc(i), RegA(VC4_QPU_RADDR_UNIFORM));
+	}
+
+	for (uint8_t i = 0; i < 2; i++)
+	{
+		Vc4Instruction Vc4Inst;
+		Vc4Inst.Vc4_a_FTOI(RegA(16), Acc(i));
+		Vc4Inst.Vc4_a_Pack(VC4_QPU_PACK_A_16a + i);
+		Vc4Inst.Emit(pCode);
+	}
+	EmitNop(pCode);
+
+	EmitMulMov(pCode, RegB(VC4_QPU_WADDR_VPM), RegA(16));
+	EmitMul(pCode, VC4_QPU_OPCODE_MUL_FMUL, RegB(VC4_QPU_WADDR_VPM), RegB(18), Acc(4));
+	EmitMulMov(pCode, RegB(VC4_QPU_WADDR_VPM), Acc(4));
+
+	for (uint8_t i = 0; i < cLinkage; i++)
+		EmitMulMov(pCode, RegB(VC4_QPU_WADDR_VPM), RegB(20 + i));
+}
+
+static void EmitEpilogue(Vc4ShaderStorage * pCode, bool bPixelShader)
+{
+	if (bPixelShader)
+	{
+		EmitMulMov(pCode, RegB(VC4_QPU_WADDR_TLB_Z), RegB(15));
+		EmitAdd(pCode, VC4_QPU_OPCODE_ADD_OR, RegA(VC4_QPU_WADDR_TLB_COLOUR_ALL), RegB(16), RegB(16), VC4_QPU_SIG_PROGRAM_END);
+	}
+	else
+	{
+		EmitNop(pCode, VC4_QPU_SIG_PROGRAM_END);
+	}
+	EmitNop(pCode);
+	EmitNop(pCode, bPixelShader ? VC4_QPU_SIG_SCOREBOARD_UNBLOCK : VC4_QPU_SIG_NO_SIGNAL);
+}
+
+static const uint8_t kPackRGBA[] = { VC4_QPU_PACK_MUL_8a, VC4_QPU_PACK_MUL_8b, VC4_QPU_PACK_MUL_8c, VC4_QPU_PACK_MUL_8d };
+
+// VC4Test.fx
+//   vs: mov o0.xyzw, v0.xyzw; mov o1.xyz, v1.xyzx
+//   ps: mov o0.xyz, v1.xyzx; mov o0.w, l(1.0)
+static void EmitVC4Test(Vc4ShaderStorage * pCode, int stage)
+{
+	if (stage == 2)
+	{
+		Vc4Register dst[] = { RegB(16), RegB(16), RegB(16) };
+		Vc4Register src[] = { RegA(0), RegA(1), RegA(2) };
+
+		EmitProloguePS(pCode, 3);
+		EmitMovN(pCode, dst, src, kPackRGBA, 3);
+		EmitLoad(pCode, Acc(1), 0x3f800000, false);
+		EmitMulMov(pCode, RegB(16), Acc(1), VC4_QPU_PACK_MUL_8d);
+		EmitNop(pCode);
+		EmitEpilogue(pCode, true);
+		return;
+	}
+
+	bool bCoordinate = (stage == 1);
+	Vc4Register pos[] = { RegB(16), RegB(17), RegB(18), RegB(19) };
+	Vc4Register vertex[] = { RegA(0), RegA(1), RegA(2), RegA(3) };
+
+	EmitPrologueVS(pCode, 7);
+	EmitMovN(pCode, pos, vertex, NULL, 4);
+	if (!bCoordinate)
+	{
+		Vc4Register linkage[] = { RegB(20), RegB(21), RegB(22) };
+		Vc4Register color[] = { RegA(4), RegA(5), RegA(6) };
+
+		EmitMovN(pCode, linkage, color, NULL, 3);
+	}
+	EmitShaderOutputVS(pCode, bCoordinate, bCoordinate ? 0 : 3);
+	EmitEpilogue(pCode, false);
+}
+
+// VC4Test-Cube_Color.fx
+//   vs: dp4 r0.x~w, v0.xyzw, cb0[0~3]; dp4 r1.x~w, r0.xyzw, cb0[4~7];
+//       dp4 o0.x~w, r1.xyzw, cb0[8~11]; mov o1.xyzw, v1.xyzw
+//   ps: mov o0.xyzw, v1.xyzw
+static void EmitVC4TestCubeColor(Vc4ShaderStorage * pCode, int stage)
+{
+	if (stage == 2)
+	{
+		Vc4Register dst[] = { RegB(16), RegB(16), RegB(16), RegB(16) };
+		Vc4Register src[] = { RegA(0), RegA(1), RegA(2), RegA(3) };
+
+		EmitProloguePS(pCode, 4);
+		EmitMovN(pCode, dst, src, kPackRGBA, 4);
+		EmitEpilogue(pCode, true);
+		return;
+	}
+
+	bool bCoordinate = (stage == 1);
+
+	// r0.x in r0, r0.yzw in ra16~18 and r1 in ra19~22
+	Vc4Register v0[] = { RegA(0), RegA(1), RegA(2), RegA(3) };
+	Vc4Register r0[] = { Acc(0), RegA(16), RegA(17), RegA(18) };
+	Vc4Register r1[] = { RegA(19), RegA(20), RegA(21), RegA(22) };
+	Vc4Register o0[] = { RegB(16), RegB(17), RegB(18), RegB(19) };
+	Vc4Register cbA[] = { RegA(VC4_QPU_RADDR_UNIFORM), RegA(VC4_QPU_RADDR_UNIFORM), RegA(VC4_QPU_RADDR_UNIFORM), RegA(VC4_QPU_RADDR_UNIFORM) };
+	Vc4Register cbB[] = { RegB(VC4_QPU_RADDR_UNIFORM), RegB(VC4_QPU_RADDR_UNIFORM), RegB(VC4_QPU_RADDR_UNIFORM), RegB(VC4_QPU_RADDR_UNIFORM) };
+
+	// a uniform moves to regfile B when the other source is in regfile A
+	Vc4Register cbR0[] = { cbA[0], cbB[1], cbB[2], cbB[3] };
+
+	EmitPrologueVS(pCode, 8);
+	for (uint8_t i = 0; i < 4; i++)
+		EmitDp4(pCode, r0[i], v0, cbB);
+	for (uint8_t i = 0; i < 4; i++)
+		EmitDp4(pCode, r1[i], r0, cbR0);
+	for (uint8_t i = 0; i < 4; i++)
+		EmitDp4(pCode, o0[i], r1, cbB);
+	if (!bCoordinate)
+	{
+		Vc4Register linkage[] = { RegB(20), RegB(21), RegB(22), RegB(23) };
+		Vc4Register color[] = { RegA(4), RegA(5), RegA(6), RegA(7) };
+
+		EmitMovN(pCode, linkage, color, NULL, 4);
+	}
+	EmitShaderOutputVS(pCode, bCoordinate, bCoordinate ? 0 : 4);
+	EmitEpilogue(pCode, false);
+}
+
+// VC4Test-Cube.fx
+//   vs: mov o0.xyzw, v0.xyzw; mov o1.xy, v1.xyxx
+//   ps: sample r0.xyzw, v1.xyxx, t0.xyzw, s0; mul o0.xyz, r0.xyzx, cb0[0].xyzx;
+//       mov o0.w, l(1.0)
+static void EmitVC4TestCube(Vc4ShaderStorage * pCode, int stage)
+{
+	if (stage == 2)
+	{
+		// r0.x in r0, r0.y in r1, r0.z in r3 and r0.w in r2
+		Vc4Register r0[] = { Acc(0), Acc(1), Acc(3), Acc(2) };
+
+		EmitProloguePS(pCode, 2);
+
+		EmitMov(pCode, RegA(VC4_QPU_WADDR_TMU0_T), RegA(1));
+		EmitMov(pCode, RegA(VC4_QPU_WADDR_TMU0_S), RegA(0));
+		EmitNop(pCode, VC4_QPU_SIG_LOAD_TMU0);
+		for (uint8_t i = 0; i < 4; i++)
+		{
+			Vc4Instruction Vc4Inst;
+			Vc4Inst.Vc4_m_MOV(r0[i], Acc(4));
+			Vc4Inst.Vc4_m_Unpack(VC4_QPU_UNPACK_8a + i, true);
+			Vc4Inst.Emit(pCode);
+		}
+		EmitNop(pCode);
+
+		for (uint8_t i = 0; i < 3; i++)
+			EmitMul(pCode, VC4_QPU_OPCODE_MUL_FMUL, RegB(16), r0[i], RegA(VC4_QPU_RADDR_UNIFORM), kPackRGBA[i]);
+		EmitNop(pCode);
+
+		EmitLoad(pCode, Acc(1), 0x3f800000, false);
+		EmitMulMov(pCode, RegB(16), Acc(1), VC4_QPU_PACK_MUL_8d);
+		EmitNop(pCode);
+
+		EmitEpilogue(pCode, true);
+		return;
+	}
+
+	bool bCoordinate = (stage == 1);
+	Vc4Register pos[] = { RegB(16), RegB(17), RegB(18), RegB(19) };
+	Vc4Register vertex[] = { RegA(0), RegA(1), RegA(2), RegA(3) };
+
+	EmitPrologueVS(pCode, 6);
+	EmitMovN(pCode, pos, vertex, NULL, 4);
+	if (!bCoordinate)
+	{
+		Vc4Register linkage[] = { RegB(20), RegB(21) };
+		Vc4Register uv[] = { RegA(4), RegA(5) };
+
+		EmitMovN(pCode, linkage, uv, NULL, 2);
+	}
+	EmitShaderOutputVS(pCode, bCoordinate, bCoordinate ? 0 : 2);
+	EmitEpilogue(pCode, false);
+}
+
+static bool TestDemoShaders()
+{
+	static const struct
+	{
+		const char * m_pName;
+		void (*m_pEmit)(Vc4ShaderStorage * pCode, int stage);
+	} kShaders[] =
+	{
+		{ "VC4Test.fx", EmitVC4Test },
+		{ "VC4Test-Cube_Color.fx", EmitVC4TestCubeColor },
+		{ "VC4Test-Cube.fx", EmitVC4TestCube },
+	};
+	static const char * kStages[] = { "VS", "CS", "PS" };
+
+	bool passed = true;
+	size_t totalBefore = 0;
+	size_t totalAfter = 0;
+
+	for (UINT i = 0; i < ARRAYSIZE(kShaders); i++)
+	{
+		for (int stage = 0; stage < 3; stage++)
+		{
+			QpuCode code;
+			char name[64];
+
+			sprintf_s(name, sizeof(name), "%s %s", kShaders[i].m_pName, kStages[stage]);
+
+			kShaders[i].m_pEmit(code.Storage(), stage);
+
+			passed &= code.Schedule(name);
+			passed &= Check(code.m_output.size() < code.m_input.size(), "demo shader was not shortened");
+
+			printf("%-26s %3u -> %3u\n", name, (UINT)code.m_input.size(), (UINT)code.m_output.size());
+
+			totalBefore += code.m_input.size();
+			totalAfter += code.m_output.size();
+		}
+	}
+
+	printf("%-26s %3u -> %3u\n", "total", (UINT)totalBefore, (UINT)totalAfter);
+
+	return passed;
+}
+
+int main()
+{
+	bool passed = true;
+
+	passed &= TestPairing();
+	passed &= TestRegisterLatency();
+	passed &= TestR4Latency();
+	passed &= TestSmallImmediate();
+	passed &= TestReadPorts();
+	passed &= TestThreadEnd();
+	passed &= TestKeepOriginal();
+	passed &= TestDemoShaders();
+
+	printf("%s\n", passed ? "all tests passed" : "TESTS FAILED");
+
+	return passed ? 0 : 1;
+}